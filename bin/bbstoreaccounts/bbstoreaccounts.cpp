@@ -59,11 +59,13 @@ void PrintUsageAndExit()
 "  delete <account> [yes]\n"
 "        Deletes the specified account. Prompts for confirmation unless\n"
 "        the optional 'yes' parameter is provided.\n"
-"  check <account> [fix] [quiet]\n"
+"  check <account> [fix] [quiet] [incremental]\n"
 "        Checks the specified account for errors. If the 'fix' option is\n"
 "        provided, any errors discovered that can be fixed automatically\n"
 "        will be fixed. If the 'quiet' option is provided, less output is\n"
-"        produced.\n"
+"        produced. If the 'incremental' option is provided, the contents\n"
+"        of files verified by the last check with 'fix' which found no\n"
+"        errors are not read again.\n"
 "  name <account> <new name>\n"
 "        Changes the \"name\" of the account to the specified string.\n"
 "        The name is purely cosmetic and intended to make it easier to\n"
@@ -266,6 +268,7 @@ int main(int argc, const char *argv[])
 	{
 		bool fixErrors = false;
 		bool quiet = false;
+		bool incremental = false;
 		
 		// Look at other options
 		for(int o = 2; o < argc; ++o)
@@ -278,6 +281,10 @@ int main(int argc, const char *argv[])
 			{
 				quiet = true;
 			}
+			else if(::strcmp(argv[o], "incremental") == 0)
+			{
+				incremental = true;
+			}
 			else
 			{
 				BOX_ERROR("Unknown option " << argv[o] << ".");
@@ -286,7 +293,9 @@ int main(int argc, const char *argv[])
 		}
 	
 		// Check the account
-		return control.CheckAccount(id, fixErrors, quiet);
+		return control.CheckAccount(id, fixErrors, quiet,
+			false, // ReturnNumErrorsFound
+			incremental);
 	}
 	else if(command == "housekeep")
 	{
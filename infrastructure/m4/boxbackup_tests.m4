@@ -155,8 +155,8 @@ AC_HEADER_SYS_WAIT
 AC_CHECK_HEADERS([cxxabi.h dirent.h dlfcn.h fcntl.h getopt.h netdb.h process.h pwd.h signal.h])
 AC_CHECK_HEADERS([syslog.h time.h unistd.h])
 AC_CHECK_HEADERS([netinet/in.h netinet/tcp.h])
-AC_CHECK_HEADERS([sys/file.h sys/param.h sys/poll.h sys/socket.h sys/stat.h sys/time.h])
-AC_CHECK_HEADERS([sys/types.h sys/uio.h sys/un.h sys/wait.h sys/xattr.h])
+AC_CHECK_HEADERS([sys/file.h sys/inotify.h sys/mman.h sys/param.h sys/poll.h sys/socket.h sys/stat.h sys/time.h])
+AC_CHECK_HEADERS([sys/sysmacros.h sys/types.h sys/uio.h sys/un.h sys/wait.h sys/xattr.h])
 AC_CHECK_HEADERS([sys/ucred.h],,, [
 	#ifdef HAVE_SYS_PARAM_H
 	#	include <sys/param.h>
@@ -301,7 +301,8 @@ AC_FUNC_ERROR_AT_LINE
 AC_TYPE_SIGNAL
 AC_FUNC_STAT
 AC_CHECK_FUNCS([ftruncate getpeereid getpeername getpid gettimeofday lchown])
-AC_CHECK_FUNCS([setproctitle utimensat])
+AC_CHECK_FUNCS([posix_fadvise setproctitle utimensat])
+AC_CHECK_FUNCS([fstatat getdents64 statx])
 AC_SEARCH_LIBS([setproctitle], [bsd])
 
 # NetBSD implements kqueue too differently for us to get it fixed by 0.10
@@ -27,6 +27,8 @@ static const ConfigurationVerifyKey backuplocationkeys[] =
 	ConfigurationVerifyKey("AlwaysIncludeFilesRegex", ConfigTest_MultiValueAllowed),
 	ConfigurationVerifyKey("AlwaysIncludeDir", ConfigTest_MultiValueAllowed),
 	ConfigurationVerifyKey("AlwaysIncludeDirsRegex", ConfigTest_MultiValueAllowed),
+	ConfigurationVerifyKey("UploadPriority", ConfigTest_IsInt, 0),
+	// locations with higher priorities are backed up first
 	ConfigurationVerifyKey("Path", ConfigTest_Exists | ConfigTest_LastEntry)
 };
 
@@ -138,6 +140,34 @@ static const ConfigurationVerifyKey verifyrootkeys[] =
 	ConfigurationVerifyKey("TcpNice", ConfigTest_IsBool, false),
 	// optional enable of tcp nice/background mode
 
+	ConfigurationVerifyKey("DirectoryScanProcesses", ConfigTest_IsInt, 0),
+	// optional number of processes to read directories ahead of the sync
+
+	ConfigurationVerifyKey("DirectoryScanMethod", 0, "readdir"),
+	// how to read directories and the details of their entries
+
+	ConfigurationVerifyKey("UploadProcesses", ConfigTest_IsInt, 0),
+	// optional number of processes to upload files over their own
+	// connections to the store
+
+	ConfigurationVerifyKey("UploadQueueMemory", ConfigTest_IsInt, 1024),
+	// kbytes of memory to use for the files and directories waiting
+	// for the upload processes, before the scan waits for them
+
+	ConfigurationVerifyKey("UploadOrder", 0, "found"),
+	// which files the upload processes are given first
+
+	ConfigurationVerifyKey("LargeUploadSize", ConfigTest_IsInt, 0),
+	// optional size in kbytes of files which aren't given to the last
+	// idle upload process, so that small files aren't held up
+
+	ConfigurationVerifyKey("ChangeJournal", ConfigTest_IsBool, false),
+	// optional skipping of directories which haven't changed since the
+	// last backup
+	ConfigurationVerifyKey("ChangeJournalFullScanInterval",
+		ConfigTest_IsInt, 86400),
+	// how often to read all directories anyway, in seconds
+
 	ConfigurationVerifyKey("KeysFile", ConfigTest_Exists),
 	ConfigurationVerifyKey("DataDirectory", ConfigTest_Exists),
 
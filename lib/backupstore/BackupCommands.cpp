@@ -119,8 +119,10 @@ std::auto_ptr<BackupProtocolMessage> BackupProtocolVersion::DoCommand(BackupProt
 {
 	CHECK_PHASE(Phase_Version)
 
-	// Correct version?
-	if(mVersion != BACKUP_STORE_SERVER_VERSION)
+	// Correct version? Clients which know about staging ask for that
+	// version, to find out whether we do.
+	if(mVersion != BACKUP_STORE_SERVER_VERSION &&
+		mVersion != BACKUP_STORE_SERVER_VERSION_STAGING)
 	{
 		return PROTOCOL_ERROR(Err_WrongVersion);
 	}
@@ -128,8 +130,8 @@ std::auto_ptr<BackupProtocolMessage> BackupProtocolVersion::DoCommand(BackupProt
 	// Mark the next phase
 	rContext.SetPhase(BackupStoreContext::Phase_Login);
 
-	// Return our version
-	return std::auto_ptr<BackupProtocolMessage>(new BackupProtocolVersion(BACKUP_STORE_SERVER_VERSION));
+	// Return the version agreed
+	return std::auto_ptr<BackupProtocolMessage>(new BackupProtocolVersion(mVersion));
 }
 
 // --------------------------------------------------------------------------
@@ -306,6 +308,94 @@ std::auto_ptr<BackupProtocolMessage> BackupProtocolStoreFile::DoCommand(
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupProtocolStageFile::DoCommand(Protocol &, BackupStoreContext &)
+//		Purpose: Command to keep a file on the server, for the
+//			 session with the write lock to add later
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupProtocolMessage> BackupProtocolStageFile::DoCommand(
+	BackupProtocolReplyable &rProtocol, BackupStoreContext &rContext,
+	IOStream& rDataStream) const
+{
+	CHECK_PHASE(Phase_Commands)
+	// Allowed in read-only sessions, as nothing in the store changes
+	// until the staged file is added
+
+	int64_t id = rContext.StageFile(rDataStream, mStagingSessionID,
+		mDirectoryObjectID);
+
+	// Tell the caller what the staged file ID was
+	return std::auto_ptr<BackupProtocolMessage>(new BackupProtocolSuccess(id));
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupProtocolStartStaging::DoCommand(Protocol &, BackupStoreContext &)
+//		Purpose: Command to let other sessions stage files for this
+//			 one to add
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupProtocolMessage> BackupProtocolStartStaging::DoCommand(
+	BackupProtocolReplyable &rProtocol, BackupStoreContext &rContext) const
+{
+	CHECK_PHASE(Phase_Commands)
+	CHECK_WRITEABLE_SESSION
+
+	int64_t id = rContext.StartStaging();
+
+	// Tell the caller what the staging session ID is
+	return std::auto_ptr<BackupProtocolMessage>(new BackupProtocolSuccess(id));
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupProtocolStoreStagedFile::DoCommand(Protocol &, BackupStoreContext &)
+//		Purpose: Command to store a file staged by another session
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupProtocolMessage> BackupProtocolStoreStagedFile::DoCommand(
+	BackupProtocolReplyable &rProtocol, BackupStoreContext &rContext) const
+{
+	CHECK_PHASE(Phase_Commands)
+	CHECK_WRITEABLE_SESSION
+
+	std::auto_ptr<BackupProtocolMessage> hookResult =
+		rContext.StartCommandHook(*this);
+	if(hookResult.get())
+	{
+		return hookResult;
+	}
+
+	// Check that the diff from file actually exists, if it's specified
+	if(mDiffFromFileID != 0)
+	{
+		if(!rContext.ObjectExists(mDiffFromFileID,
+			BackupStoreContext::ObjectExists_File))
+		{
+			return PROTOCOL_ERROR(Err_DiffFromFileDoesNotExist);
+		}
+	}
+
+	// Ask the context to store it
+	int64_t id = rContext.AddStagedFile(mStagedFileID,
+		mDirectoryObjectID, mModificationTime, mAttributesHash,
+		mDiffFromFileID, mFilename);
+
+	// Tell the caller what the file ID was
+	return std::auto_ptr<BackupProtocolMessage>(new BackupProtocolSuccess(id));
+}
+
+
 
 
 // --------------------------------------------------------------------------
@@ -19,6 +19,10 @@
 // Should the store daemon convert files to Raid immediately?
 #define	BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY	true
 
+// Patches uploaded by clients are held in memory while the new version is
+// rebuilt, unless they're bigger than this, when they're spooled to disc
+#define	BACKUP_STORE_MAX_DIFF_IN_MEMORY	(8*1024*1024)
+
 #endif // BACKUPCONSTANTS__H
 
 
@@ -218,6 +218,22 @@ box_time_t BackupStoreAccountDatabase::GetDBFileModificationTime() const
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreAccountDatabase::GetModificationTime()
+//		Purpose: Get the modification time of the database file as
+//			 last read, after reading it again if it has changed
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+box_time_t BackupStoreAccountDatabase::GetModificationTime() const
+{
+	CheckUpToDate();
+	return pImpl->mModificationTime;
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
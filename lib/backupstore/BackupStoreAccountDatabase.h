@@ -62,6 +62,9 @@ public:
 	// This interface should change in the future. But for now it'll do.
 	void GetAllAccountIDs(std::vector<int32_t> &rIDsOut);
 
+	// Changes whenever the database file is modified
+	box_time_t GetModificationTime() const;
+
 private:
 	void ReadFile() const;	// const in concept only
 	void CheckUpToDate() const;	// const in concept only
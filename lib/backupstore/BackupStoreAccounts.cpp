@@ -497,7 +497,7 @@ bool BackupStoreAccountsControl::OpenAccount(int32_t ID, std::string &rRootDirOu
 }
 
 int BackupStoreAccountsControl::CheckAccount(int32_t ID, bool FixErrors, bool Quiet,
-	bool ReturnNumErrorsFound)
+	bool ReturnNumErrorsFound, bool Incremental)
 {
 	std::string rootDir;
 	int discSetNum;
@@ -514,6 +514,10 @@ int BackupStoreAccountsControl::CheckAccount(int32_t ID, bool FixErrors, bool Qu
 
 	// Check it
 	BackupStoreCheck check(rootDir, discSetNum, ID, FixErrors, Quiet);
+	check.SetNumberOfProcesses(mConfig.GetKeyValueInt("CheckProcesses"));
+	check.SetObjectTableOnDisc(
+		mConfig.GetKeyValueBool("CheckObjectTableOnDisc"));
+	check.SetIncremental(Incremental);
 	check.Check();
 
 	if(ReturnNumErrorsFound)
@@ -72,7 +72,7 @@ public:
 	int SetAccountEnabled(int32_t ID, bool enabled);
 	int DeleteAccount(int32_t ID, bool AskForConfirmation);
 	int CheckAccount(int32_t ID, bool FixErrors, bool Quiet,
-		bool ReturnNumErrorsFound = false);
+		bool ReturnNumErrorsFound = false, bool Incremental = false);
 	int CreateAccount(int32_t ID, int32_t DiscNumber, int32_t SoftLimit,
 		int32_t HardLimit);
 	int HousekeepAccountNow(int32_t ID);
@@ -9,6 +9,7 @@
 
 #include "Box.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -16,14 +17,26 @@
 #	include <unistd.h>
 #endif
 
+#ifdef HAVE_SYS_WAIT_H
+#	include <sys/wait.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#	include <signal.h>
+#endif
+
 #include "autogen_BackupStoreException.h"
 #include "BackupStoreAccountDatabase.h"
 #include "BackupStoreCheck.h"
 #include "BackupStoreConstants.h"
 #include "BackupStoreDirectory.h"
+#include "BackupStoreDirtyDirectoryLog.h"
 #include "BackupStoreFile.h"
+#include "BackupStoreFileWire.h"
 #include "BackupStoreObjectMagic.h"
 #include "BackupStoreRefCountDatabase.h"
+#include "CommonException.h"
+#include "FileStream.h"
 #include "RaidFileController.h"
 #include "RaidFileException.h"
 #include "RaidFileRead.h"
@@ -34,6 +47,18 @@
 
 #include "MemLeakFindOn.h"
 
+#define CHECKPOINT_MAGIC_VALUE	0x43686b31 // Chk1
+#define CHECKPOINT_FILENAME	"check.state"
+
+// Written in network byte order
+typedef struct
+{
+	int32_t mMagicValue;
+	int32_t mNextPackNumber;
+	int64_t mLastObjectID;
+	int64_t mStartTime;
+} checkpoint_StreamFormat;
+
 
 // --------------------------------------------------------------------------
 //
@@ -49,10 +74,18 @@ BackupStoreCheck::BackupStoreCheck(const std::string &rStoreRoot, int DiscSetNum
 	  mAccountID(AccountID),
 	  mFixErrors(FixErrors),
 	  mQuiet(Quiet),
+	  mNumberOfProcesses(1),
+	  mIncremental(false),
 	  mNumberErrorsFound(0),
+	  mNumObjectsVerified(0),
+	  mNumObjectsNotReverified(0),
+	  mCheckpointLastObjectID(0),
+	  mCheckpointNextPackNumber(0),
+	  mCheckpointTime(0),
 	  mLastIDInInfo(0),
-	  mpInfoLastBlock(0),
-	  mInfoLastBlockEntries(0),
+	  mObjectTableOnDisc(false),
+	  mObjectTableFileSize(0),
+	  mPackIndex(rStoreRoot, DiscSetNumber),
 	  mLostDirNameSerial(0),
 	  mLostAndFoundDirectoryID(0),
 	  mBlocksUsed(0),
@@ -80,6 +113,9 @@ BackupStoreCheck::~BackupStoreCheck()
 {
 	// Clean up
 	FreeInfo();
+#ifndef WIN32
+	StopCheckProcesses();
+#endif
 
 	// Avoid an exception if we forget to discard mapNewRefs
 	if (mapNewRefs.get())
@@ -127,6 +163,13 @@ void BackupStoreCheck::Check()
 	BackupStoreAccountDatabase::Entry account(mAccountID, mDiscSetNumber);
 	mapNewRefs = BackupStoreRefCountDatabase::Create(account);
 
+	// Anything written from now on will be verified next time
+	box_time_t startTime = GetCurrentBoxTime();
+	if(mIncremental)
+	{
+		ReadCheckpoint();
+	}
+
 	// Phase 1, check objects
 	if(!mQuiet)
 	{
@@ -135,6 +178,18 @@ void BackupStoreCheck::Check()
 		BOX_INFO("Phase 1, check objects...");
 	}
 	CheckObjects();
+	int64_t lastObjectID = mLastIDInInfo;
+	int32_t nextPackNumber = mPackIndex.GetNextPackNumber();
+	if(!mQuiet)
+	{
+		BOX_INFO("Verified " << mNumObjectsVerified << " objects, and "
+			"the headers of " << mNumObjectsNotReverified <<
+			" files unchanged since the last check");
+		BOX_INFO("Table of objects uses " << (mInfo.size() *
+			(mapObjectTableFile.get() ? GetIDBlockMappedSize() :
+			sizeof(IDBlock))) << " bytes" <<
+			(mapObjectTableFile.get() ? " on disc" : ""));
+	}
 
 	// Phase 2, check directories
 	if(!mQuiet)
@@ -196,7 +251,16 @@ void BackupStoreCheck::Check()
 	// force file to be saved and closed before releasing the lock below
 	if(mFixErrors)
 	{
+		mPackIndex.Save();
 		mapNewRefs->Commit();
+
+		// Directories may have been changed without being logged,
+		// so housekeeping must scan the whole account next time
+		if(mNumberErrorsFound > 0)
+		{
+			BackupStoreDirtyDirectoryLog(mStoreRoot,
+				mDiscSetNumber).Delete();
+		}
 	}
 	else
 	{
@@ -204,6 +268,13 @@ void BackupStoreCheck::Check()
 	}
 	mapNewRefs.reset();
 
+	// Only a check which holds the write lock, as fixing errors needs
+	// to, knows that nothing changed the files while it read them
+	if(mNumberErrorsFound == 0 && mFixErrors)
+	{
+		WriteCheckpoint(lastObjectID, nextPackNumber, startTime);
+	}
+
 	if(mNumberErrorsFound > 0)
 	{
 		BOX_WARNING("Finished checking store account ID " <<
@@ -314,15 +385,37 @@ void BackupStoreCheck::CheckObjects()
 		}
 
 		maxDir = CheckObjectsScanDir(0, 1, start);
+
+		// Packed objects may be in ranges with no directory left
+		mPackIndex.Load();
+		int64_t maxPackedDir = mPackIndex.GetLastObjectID() &
+			~((int64_t)((1<<STORE_ID_SEGMENT_LENGTH) - 1));
+		if(maxPackedDir > maxDir)
+		{
+			maxDir = maxPackedDir;
+		}
 		BOX_TRACE("Max dir starting ID is " <<
 			BOX_FORMAT_OBJECTID(maxDir));
 	}
 
+#ifndef WIN32
+	// Reading the objects takes most of the time, so share that out
+	// between other processes, leaving everything else to this one
+	if(mNumberOfProcesses > 1)
+	{
+		StartCheckProcesses(maxDir);
+	}
+#endif
+
 	// Then go through and scan all the objects within those directories
 	for(int64_t d = 0; d <= maxDir; d += (1<<STORE_ID_SEGMENT_LENGTH))
 	{
 		CheckObjectsDir(d);
 	}
+
+#ifndef WIN32
+	StopCheckProcesses();
+#endif
 }
 
 // --------------------------------------------------------------------------
@@ -378,6 +471,21 @@ int64_t BackupStoreCheck::CheckObjectsScanDir(int64_t StartID, int Level, const
 		{
 			// Check to see if it's the right name
 			int n = 0;
+			if(StartID == 0 && Level == 1 &&
+				*i == BACKUPSTORE_PACK_DIRECTORY)
+			{
+				// Pack files, checked through the pack index
+				continue;
+			}
+
+			if(StartID == 0 && Level == 1 &&
+				*i == BACKUPSTORE_STAGING_DIRECTORY)
+			{
+				// Files staged by other connections, which
+				// aren't part of the store yet
+				continue;
+			}
+
 			if((*i).size() == 2 && TwoDigitHexToInt((*i).c_str(), n)
 				&& n < (1<<STORE_ID_SEGMENT_LENGTH))
 			{
@@ -408,13 +516,49 @@ int64_t BackupStoreCheck::CheckObjectsScanDir(int64_t StartID, int Level, const
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    BackupStoreCheck::CheckObjectsDir(int64_t)
-//		Purpose: Check all the files within this directory which has
-//			 the given starting ID.
-//		Created: 22/4/04
+//		Name:    static ParseObjectFilename(const std::string &, int &)
+//		Purpose: Is this the name of an object file, o followed by
+//			 two hex digits? If so, return its index in the
+//			 directory.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
+static inline bool ParseObjectFilename(const std::string &rLeaf,
+	int &rIndexOut)
+{
+	return rLeaf.size() == 3 && rLeaf[0] == 'o' &&
+		TwoDigitHexToInt(rLeaf.c_str() + 1, rIndexOut) &&
+		rIndexOut < (1<<STORE_ID_SEGMENT_LENGTH);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static ObjectLeafName(int)
+//		Purpose: Return the name of the object file with the given
+//			 index, relative to its directory.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static inline std::string ObjectLeafName(int Index)
+{
+	char leaf[8];
+	::snprintf(leaf, sizeof(leaf), DIRECTORY_SEPARATOR "o%02x", Index);
+	return leaf;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::GetObjectsDirName(int64_t)
+//		Purpose: Return the name of the directory containing the
+//			 objects with the given starting ID.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupStoreCheck::GetObjectsDirName(int64_t StartID)
 {
 	// Make directory name -- first generate the filename of an entry in it
 	std::string dirName;
@@ -424,18 +568,22 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 		dirName[dirName.size() - 4] == DIRECTORY_SEPARATOR_ASCHAR);
 	// Remove the filename from it
 	dirName.resize(dirName.size() - 4); // four chars for "/o00"
+	return dirName;
+}
 
-	// Check directory exists
-	if(!RaidFileRead::DirectoryExists(mDiscSetNumber, dirName))
-	{
-		BOX_WARNING("RaidFile dir " << dirName << " does not exist");
-		return;
-	}
 
-	// Read directory contents
-	std::vector<std::string> files;
-	RaidFileRead::ReadDirectoryContents(mDiscSetNumber, dirName,
-		RaidFileRead::DirReadType_FilesOnly, files);
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::CheckObjectsDir(int64_t)
+//		Purpose: Check all the files within this directory which has
+//			 the given starting ID.
+//		Created: 22/4/04
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
+{
+	std::string dirName(GetObjectsDirName(StartID));
 
 	// Array of things present
 	bool idsPresent[(1<<STORE_ID_SEGMENT_LENGTH)];
@@ -444,6 +592,19 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 		idsPresent[l] = false;
 	}
 
+	// Read directory contents, if it exists. Packed objects in this
+	// range must still be checked if it doesn't.
+	std::vector<std::string> files;
+	if(RaidFileRead::DirectoryExists(mDiscSetNumber, dirName))
+	{
+		RaidFileRead::ReadDirectoryContents(mDiscSetNumber, dirName,
+			RaidFileRead::DirReadType_FilesOnly, files);
+	}
+	else
+	{
+		BOX_WARNING("RaidFile dir " << dirName << " does not exist");
+	}
+
 	// Parse each entry, building up a list of object IDs which are present in the dir.
 	// This is done so that whatever order is retured from the directory, objects are scanned
 	// in order.
@@ -452,8 +613,7 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 	{
 		bool fileOK = true;
 		int n = 0;
-		if((*i).size() == 3 && (*i)[0] == 'o' && TwoDigitHexToInt((*i).c_str() + 1, n)
-			&& n < (1<<STORE_ID_SEGMENT_LENGTH))
+		if(ParseObjectFilename(*i, n))
 		{
 			// Filename is valid, mark as existing
 			idsPresent[n] = true;
@@ -463,9 +623,15 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 		{
 			fileOK = false;
 		}
-		// info and refcount databases are OK in the root directory
+		// info and refcount databases, the dirty directory and
+		// usage logs and the check checkpoint are OK in the root
+		// directory
 		else if(*i == "info" || *i == "refcount.db" ||
-			*i == "refcount.rdb" || *i == "refcount.rdbX")
+			*i == "refcount.rdb" || *i == "refcount.rdbX" ||
+			*i == "dirty.log" || *i == "dirty.logX" ||
+			*i == "usage.log" || *i == "usage.logX" ||
+			*i == CHECKPOINT_FILENAME ||
+			*i == CHECKPOINT_FILENAME "X")
 		{
 			fileOK = true;
 		}
@@ -489,16 +655,93 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 		}
 	}
 
+	// Read and verify the objects, unless another process has already
+	// done it
+	std::vector<ObjectCheckResult> results;
+#ifndef WIN32
+	if(!ReadCheckProcessResults(StartID, results))
+#endif
+	{
+		VerifyObjectsDir(StartID, dirName, idsPresent, results);
+	}
+
+	const ObjectCheckResult *pverified[(1<<STORE_ID_SEGMENT_LENGTH)];
+	for(int l = 0; l < (1<<STORE_ID_SEGMENT_LENGTH); ++l)
+	{
+		pverified[l] = NULL;
+	}
+	for(std::vector<ObjectCheckResult>::const_iterator
+		i(results.begin()); i != results.end(); ++i)
+	{
+		int64_t index = i->mObjectID - StartID;
+		if(index >= 0 && index < (1<<STORE_ID_SEGMENT_LENGTH))
+		{
+			pverified[index] = &(*i);
+		}
+	}
+
 	// Check all the objects found in this directory
 	for(int i = 0; i < (1<<STORE_ID_SEGMENT_LENGTH); ++i)
 	{
-		if(idsPresent[i])
+		const BackupStorePackIndex::Entry *ppacked =
+			mPackIndex.Find(StartID | i);
+
+		if(idsPresent[i] && ppacked)
+		{
+			// The file takes precedence, so the packed copy is
+			// unreachable and just wasting space
+			BOX_ERROR("Object " << BOX_FORMAT_OBJECTID(StartID | i) <<
+				" is in a pack file as well as its own file" <<
+				(mFixErrors?", removing from pack index":""));
+			++mNumberErrorsFound;
+			if(mFixErrors)
+			{
+				mPackIndex.Remove(StartID | i);
+			}
+		}
+
+		if(!idsPresent[i] && ppacked)
+		{
+			// Copy, because removing it invalidates the pointer
+			BackupStorePackIndex::Entry packed(*ppacked);
+			ObjectCheckResult result;
+			if(pverified[i])
+			{
+				result = *(pverified[i]);
+			}
+			else
+			{
+				VerifyPackedObject(packed, result);
+			}
+
+			if(!CheckAndAddPackedObject(packed, result))
+			{
+				BOX_ERROR("Corrupted object " <<
+					BOX_FORMAT_OBJECTID(packed.mObjectID) <<
+					" found in pack " << packed.mPackNumber <<
+					(mFixErrors?", removing from pack index":""));
+				++mNumberErrorsFound;
+				if(mFixErrors)
+				{
+					mPackIndex.Remove(packed.mObjectID);
+				}
+			}
+		}
+		else if(idsPresent[i])
 		{
 			// Check the object is OK, and add entry
-			char leaf[8];
-			::snprintf(leaf, sizeof(leaf),
-				DIRECTORY_SEPARATOR "o%02x", i);
-			if(!CheckAndAddObject(StartID | i, dirName + leaf))
+			std::string leaf(ObjectLeafName(i));
+			ObjectCheckResult result;
+			if(pverified[i])
+			{
+				result = *(pverified[i]);
+			}
+			else
+			{
+				VerifyObject(StartID | i, dirName + leaf, result);
+			}
+
+			if(!CheckAndAddObject(StartID | i, dirName + leaf, result))
 			{
 				// File was bad, delete it
 				BOX_ERROR("Corrupted file " << dirName <<
@@ -519,28 +762,208 @@ void BackupStoreCheck::CheckObjectsDir(int64_t StartID)
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    BackupStoreCheck::CheckAndAddObject(int64_t,
-//			 const std::string &)
-//		Purpose: Check a specific object and add it to the list
-//			 if it's OK. If there are any errors with the
-//			 reading, return false and it'll be deleted.
-//		Created: 21/4/04
+//		Name:    BackupStoreCheck::VerifyObjectsDir(int64_t,
+//			 const std::string &, const bool *,
+//			 std::vector<ObjectCheckResult> &)
+//		Purpose: Read and verify the objects in this directory, and
+//			 the packed objects in its range, without changing
+//			 anything, so that it can be done in another
+//			 process. Asks the OS to start reading each object
+//			 while the one before it is being verified.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-bool BackupStoreCheck::CheckAndAddObject(int64_t ObjectID,
-	const std::string &rFilename)
+void BackupStoreCheck::VerifyObjectsDir(int64_t StartID,
+	const std::string &rDirName, const bool *pIdsPresent,
+	std::vector<ObjectCheckResult> &rResultsOut)
+{
+	rResultsOut.clear();
+
+	int next = 0;
+	while(next < (1<<STORE_ID_SEGMENT_LENGTH) && !pIdsPresent[next])
+	{
+		++next;
+	}
+	if(next < (1<<STORE_ID_SEGMENT_LENGTH))
+	{
+		RaidFileRead::HintWillRead(mDiscSetNumber,
+			rDirName + ObjectLeafName(next));
+	}
+
+	for(int i = 0; i < (1<<STORE_ID_SEGMENT_LENGTH); ++i)
+	{
+		ObjectCheckResult result;
+
+		if(pIdsPresent[i])
+		{
+			// Read ahead the next one
+			next = i + 1;
+			while(next < (1<<STORE_ID_SEGMENT_LENGTH) &&
+				!pIdsPresent[next])
+			{
+				++next;
+			}
+			if(next < (1<<STORE_ID_SEGMENT_LENGTH))
+			{
+				RaidFileRead::HintWillRead(mDiscSetNumber,
+					rDirName + ObjectLeafName(next));
+			}
+
+			VerifyObject(StartID | i, rDirName + ObjectLeafName(i),
+				result);
+			rResultsOut.push_back(result);
+			continue;
+		}
+
+		const BackupStorePackIndex::Entry *ppacked =
+			mPackIndex.Find(StartID | i);
+		if(ppacked)
+		{
+			VerifyPackedObject(*ppacked, result);
+			rResultsOut.push_back(result);
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::VerifyPackedObject(
+//			 const BackupStorePackIndex::Entry &,
+//			 ObjectCheckResult &)
+//		Purpose: Read an object stored in a pack file, and work out
+//			 whether it's OK. Only files are packed, so anything
+//			 else is an error.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::VerifyPackedObject(
+	const BackupStorePackIndex::Entry &rEntry,
+	ObjectCheckResult &rResultOut)
+{
+	rResultOut.mObjectID = rEntry.mObjectID;
+	rResultOut.mContainerID = -1;
+	// Count it at the size it had in its own file, as the store info does
+	rResultOut.mSizeInBlocks = rEntry.mSizeInBlocks;
+	rResultOut.mIsFile = true;
+	rResultOut.mContentsVerified = true;
+
+	try
+	{
+		std::auto_ptr<IOStream> object(
+			mPackIndex.OpenPackedObject(rEntry));
+
+		uint32_t signature;
+		if(!object->ReadFullBuffer(&signature, sizeof(signature),
+			0 /* not interested in bytes read if this fails */))
+		{
+			return;
+		}
+		object->Seek(0, IOStream::SeekType_Absolute);
+
+		switch(ntohl(signature))
+		{
+		case OBJECTMAGIC_FILE_MAGIC_VALUE_V1:
+			// Packs are never modified, so only objects in
+			// packs written since the last check need reading
+			if(rEntry.mPackNumber < mCheckpointNextPackNumber &&
+				rEntry.mObjectID <= mCheckpointLastObjectID)
+			{
+				rResultOut.mContentsVerified = false;
+				rResultOut.mContainerID = CheckFileHeader(
+					rEntry.mObjectID, *object);
+				break;
+			}
+			rResultOut.mContainerID = CheckFile(rEntry.mObjectID,
+				*object);
+			break;
+
+#ifndef BOX_DISABLE_BACKWARDS_COMPATIBILITY_BACKUPSTOREFILE
+		case OBJECTMAGIC_FILE_MAGIC_VALUE_V0:
+			rResultOut.mContainerID = CheckFile(rEntry.mObjectID,
+				*object);
+			break;
+#endif
+
+		default:
+			return;
+		}
+	}
+	catch(...)
+	{
+		rResultOut.mContainerID = -1;
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::CheckAndAddPackedObject(
+//			 const BackupStorePackIndex::Entry &,
+//			 const ObjectCheckResult &)
+//		Purpose: Add an object stored in a pack file to the list if
+//			 it was found to be OK. If not, return false and it'll
+//			 be removed from the index.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreCheck::CheckAndAddPackedObject(
+	const BackupStorePackIndex::Entry &rEntry,
+	const ObjectCheckResult &rResult)
+{
+	if(rResult.mContainerID == -1)
+	{
+		return false;
+	}
+
+	if(rResult.mContentsVerified)
+	{
+		++mNumObjectsVerified;
+	}
+	else
+	{
+		++mNumObjectsNotReverified;
+	}
+
+	AddID(rEntry.mObjectID, rResult.mContainerID, rResult.mSizeInBlocks,
+		true /* is file */);
+	mBlocksUsed += rResult.mSizeInBlocks;
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::VerifyObject(int64_t,
+//			 const std::string &, ObjectCheckResult &)
+//		Purpose: Read a specific object and work out whether it's
+//			 OK, and what it contains. Any errors with the
+//			 reading make it bad.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::VerifyObject(int64_t ObjectID,
+	const std::string &rFilename, ObjectCheckResult &rResultOut)
 {
 	// Info on object...
-	bool isFile = true;
-	int64_t containerID = -1;
-	int64_t size = -1;
+	rResultOut.mObjectID = ObjectID;
+	rResultOut.mContainerID = -1;
+	rResultOut.mSizeInBlocks = -1;
+	rResultOut.mIsFile = true;
+	rResultOut.mContentsVerified = true;
 
 	try
 	{
 		// Open file
+		int64_t revisionID = 0;
 		std::auto_ptr<RaidFileRead> file(
-			RaidFileRead::Open(mDiscSetNumber, rFilename));
-		size = file->GetDiscUsageInBlocks();
+			RaidFileRead::Open(mDiscSetNumber, rFilename,
+				&revisionID));
+		rResultOut.mSizeInBlocks = file->GetDiscUsageInBlocks();
 
 		// Read in first four bytes -- don't have to worry about
 		// retrying if not all bytes read as is RaidFile
@@ -548,7 +971,7 @@ bool BackupStoreCheck::CheckAndAddObject(int64_t ObjectID,
 		if(file->Read(&signature, sizeof(signature)) != sizeof(signature))
 		{
 			// Too short, can't read signature from it
-			return false;
+			return;
 		}
 		// Seek back to beginning
 		file->Seek(0, IOStream::SeekType_Absolute);
@@ -557,38 +980,79 @@ bool BackupStoreCheck::CheckAndAddObject(int64_t ObjectID,
 		switch(ntohl(signature))
 		{
 		case OBJECTMAGIC_FILE_MAGIC_VALUE_V1:
+			// Files never change once written, so if it was
+			// checked last time, the header is enough
+			if(IsUnchangedSinceCheckpoint(ObjectID, revisionID))
+			{
+				rResultOut.mContentsVerified = false;
+				rResultOut.mContainerID = CheckFileHeader(
+					ObjectID, *file);
+				break;
+			}
+			// Otherwise check it all
+			rResultOut.mContainerID = CheckFile(ObjectID, *file);
+			break;
+
 #ifndef BOX_DISABLE_BACKWARDS_COMPATIBILITY_BACKUPSTOREFILE
 		case OBJECTMAGIC_FILE_MAGIC_VALUE_V0:
 #endif
 			// File... check
-			containerID = CheckFile(ObjectID, *file);
+			rResultOut.mContainerID = CheckFile(ObjectID, *file);
 			break;
 
 		case OBJECTMAGIC_DIR_MAGIC_VALUE:
-			isFile = false;
-			containerID = CheckDirInitial(ObjectID, *file);
+			rResultOut.mIsFile = false;
+			rResultOut.mContainerID = CheckDirInitial(ObjectID,
+				*file);
 			break;
 
 		default:
 			// Unknown signature. Bad file. Very bad file.
-			return false;
+			return;
 			break;
 		}
 	}
 	catch(...)
 	{
 		// Error caught, not a good file then, let it be deleted
-		return false;
+		rResultOut.mContainerID = -1;
 	}
+}
+
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::CheckAndAddObject(int64_t,
+//			 const std::string &, const ObjectCheckResult &)
+//		Purpose: Add a specific object to the list if it was found
+//			 to be OK. If not, return false and it'll be deleted.
+//		Created: 21/4/04
+//
+// --------------------------------------------------------------------------
+bool BackupStoreCheck::CheckAndAddObject(int64_t ObjectID,
+	const std::string &rFilename, const ObjectCheckResult &rResult)
+{
 	// Got a container ID? (ie check was successful)
-	if(containerID == -1)
+	if(rResult.mContainerID == -1)
 	{
 		return false;
 	}
 
+	bool isFile = rResult.mIsFile;
+	int64_t size = rResult.mSizeInBlocks;
+
+	if(rResult.mContentsVerified)
+	{
+		++mNumObjectsVerified;
+	}
+	else
+	{
+		++mNumObjectsNotReverified;
+	}
+
 	// Add to list of IDs known about
-	AddID(ObjectID, containerID, size, isFile);
+	AddID(ObjectID, rResult.mContainerID, size, isFile);
 
 	// Add to usage counts
 	mBlocksUsed += size;
@@ -642,6 +1106,223 @@ bool BackupStoreCheck::CheckAndAddObject(int64_t ObjectID,
 }
 
 
+#ifndef WIN32
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::StartCheckProcesses(int64_t)
+//		Purpose: Fork processes to read and verify the objects in
+//			 phase 1, each taking every Nth directory of objects
+//			 and sending the results back in order through a
+//			 pipe, which also stops them getting too far ahead.
+//			 If they can't be started, this process does all
+//			 the work itself.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::StartCheckProcesses(int64_t MaxDir)
+{
+	for(int p = 0; p < mNumberOfProcesses; ++p)
+	{
+		int fds[2];
+		if(::pipe(fds) != 0)
+		{
+			BOX_LOG_SYS_WARNING("Failed to create pipe for check "
+				"process, checking in fewer processes");
+			break;
+		}
+
+		pid_t pid = ::fork();
+		if(pid == -1)
+		{
+			BOX_LOG_SYS_WARNING("Failed to start check process, "
+				"checking in fewer processes");
+			::close(fds[0]);
+			::close(fds[1]);
+			break;
+		}
+
+		if(pid == 0)
+		{
+			// In the child, which only needs its own pipe. It
+			// mustn't clean up anything belonging to the parent,
+			// such as the temporary refcount database, so it
+			// leaves with _exit().
+			::close(fds[0]);
+			for(std::vector<CheckProcess>::iterator
+				i(mCheckProcesses.begin());
+				i != mCheckProcesses.end(); ++i)
+			{
+				::close(i->mpResults->GetFileHandle());
+			}
+
+			try
+			{
+				RunCheckProcess(p, MaxDir, fds[1]);
+			}
+			catch(std::exception &e)
+			{
+				BOX_ERROR("Check process failed: " << e.what());
+				::_exit(1);
+			}
+			::_exit(0);
+		}
+
+		::close(fds[1]);
+		CheckProcess process;
+		process.mPid = pid;
+		process.mpResults = new FileStream(fds[0]);
+		mCheckProcesses.push_back(process);
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::RunCheckProcess(int, int64_t, int)
+//		Purpose: In a child process, read and verify the objects in
+//			 this process's share of the directories, writing
+//			 the results for each directory to the pipe.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::RunCheckProcess(int Process, int64_t MaxDir,
+	int WriteFd)
+{
+	FileStream results(WriteFd);
+	int numProcesses = mNumberOfProcesses;
+
+	for(int64_t d = 0; d <= MaxDir; d += (1<<STORE_ID_SEGMENT_LENGTH))
+	{
+		if(((d >> STORE_ID_SEGMENT_LENGTH) % numProcesses) != Process)
+		{
+			continue;
+		}
+
+		std::string dirName(GetObjectsDirName(d));
+		bool idsPresent[(1<<STORE_ID_SEGMENT_LENGTH)];
+		for(int l = 0; l < (1<<STORE_ID_SEGMENT_LENGTH); ++l)
+		{
+			idsPresent[l] = false;
+		}
+
+		if(RaidFileRead::DirectoryExists(mDiscSetNumber, dirName))
+		{
+			std::vector<std::string> files;
+			RaidFileRead::ReadDirectoryContents(mDiscSetNumber,
+				dirName, RaidFileRead::DirReadType_FilesOnly,
+				files);
+			for(std::vector<std::string>::const_iterator
+				i(files.begin()); i != files.end(); ++i)
+			{
+				int n = 0;
+				if(ParseObjectFilename(*i, n))
+				{
+					idsPresent[n] = true;
+				}
+			}
+		}
+
+		std::vector<ObjectCheckResult> dirResults;
+		VerifyObjectsDir(d, dirName, idsPresent, dirResults);
+
+		int64_t startID = d;
+		int32_t count = dirResults.size();
+		results.Write(&startID, sizeof(startID));
+		results.Write(&count, sizeof(count));
+		if(count > 0)
+		{
+			results.Write(&dirResults[0],
+				count * sizeof(ObjectCheckResult));
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::ReadCheckProcessResults(int64_t,
+//			 std::vector<ObjectCheckResult> &)
+//		Purpose: Get the results of verifying the objects in the
+//			 directory with this starting ID from the process
+//			 which did it. Returns false if there are no check
+//			 processes, or they've failed, in which case this
+//			 process must do the work.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreCheck::ReadCheckProcessResults(int64_t StartID,
+	std::vector<ObjectCheckResult> &rResultsOut)
+{
+	if(mCheckProcesses.empty())
+	{
+		return false;
+	}
+
+	CheckProcess &rprocess(mCheckProcesses[
+		(StartID >> STORE_ID_SEGMENT_LENGTH) % mCheckProcesses.size()]);
+
+	int64_t startID = 0;
+	int32_t count = 0;
+	if(!rprocess.mpResults->ReadFullBuffer(&startID, sizeof(startID),
+		0, IOStream::TimeOutInfinite) ||
+		!rprocess.mpResults->ReadFullBuffer(&count, sizeof(count),
+		0, IOStream::TimeOutInfinite) ||
+		startID != StartID || count < 0 ||
+		count > (1<<STORE_ID_SEGMENT_LENGTH))
+	{
+		BOX_WARNING("Check process " << rprocess.mPid << " failed, "
+			"continuing in this process");
+		StopCheckProcesses();
+		return false;
+	}
+
+	rResultsOut.resize(count);
+	if(count > 0 && !rprocess.mpResults->ReadFullBuffer(&rResultsOut[0],
+		count * sizeof(ObjectCheckResult), 0,
+		IOStream::TimeOutInfinite))
+	{
+		BOX_WARNING("Check process " << rprocess.mPid << " failed, "
+			"continuing in this process");
+		StopCheckProcesses();
+		return false;
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::StopCheckProcesses()
+//		Purpose: Stop any check processes still running, and wait
+//			 for them to finish.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::StopCheckProcesses()
+{
+	for(std::vector<CheckProcess>::iterator i(mCheckProcesses.begin());
+		i != mCheckProcesses.end(); ++i)
+	{
+		delete i->mpResults;
+		::kill(i->mPid, SIGTERM);
+
+		int status = 0;
+		while(::waitpid(i->mPid, &status, 0) == -1 && errno == EINTR)
+		{
+			// Interrupted, try again
+		}
+	}
+
+	mCheckProcesses.clear();
+}
+#endif // !WIN32
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -676,6 +1357,176 @@ int64_t BackupStoreCheck::CheckFile(int64_t ObjectID, IOStream &rStream)
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::CheckFileHeader(int64_t, IOStream &)
+//		Purpose: Read just the header of a file which was verified
+//			 by an earlier check, returning the container ID,
+//			 or -1 if it's not valid.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreCheck::CheckFileHeader(int64_t ObjectID, IOStream &rStream)
+{
+	if(ObjectID == BACKUPSTORE_ROOT_DIRECTORY_ID)
+	{
+		BOX_ERROR("Have file as root directory. This is bad.");
+		return -1;
+	}
+
+	file_StreamFormat hdr;
+	if(!rStream.ReadFullBuffer(&hdr, sizeof(hdr),
+		0 /* not interested in bytes read if this fails */))
+	{
+		return -1;
+	}
+
+	if(ntohl(hdr.mMagicValue) != OBJECTMAGIC_FILE_MAGIC_VALUE_V1)
+	{
+		return -1;
+	}
+
+	return box_ntoh64(hdr.mContainerID);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::GetCheckpointFilename()
+//		Purpose: Name of the file recording what the last check
+//			 without errors verified
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupStoreCheck::GetCheckpointFilename()
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(mDiscSetNumber));
+	return RaidFileUtil::MakeWriteFileName(rdiscSet,
+		mStoreRoot + CHECKPOINT_FILENAME);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::ReadCheckpoint()
+//		Purpose: Load the checkpoint, if there's a usable one. If
+//			 not, everything is verified.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::ReadCheckpoint()
+{
+	std::string filename = GetCheckpointFilename();
+	if(!FileExists(filename))
+	{
+		BOX_INFO("No checkpoint from an earlier check, so verifying "
+			"every object");
+		return;
+	}
+
+	checkpoint_StreamFormat checkpoint;
+	FileStream file(filename);
+	if(!file.ReadFullBuffer(&checkpoint, sizeof(checkpoint), 0) ||
+		ntohl(checkpoint.mMagicValue) != CHECKPOINT_MAGIC_VALUE)
+	{
+		BOX_WARNING("Ignoring damaged check checkpoint: " << filename);
+		return;
+	}
+
+	mCheckpointLastObjectID = box_ntoh64(checkpoint.mLastObjectID);
+	mCheckpointNextPackNumber = ntohl(checkpoint.mNextPackNumber);
+	mCheckpointTime = box_ntoh64(checkpoint.mStartTime);
+
+	// Revision IDs may have a resolution of one second, so round down
+	// to be sure of catching files written just after the last check
+	mCheckpointTime = SecondsToBoxTime(BoxTimeToSeconds(mCheckpointTime));
+
+	BOX_INFO("Only verifying objects changed since the check at " <<
+		FormatTime(mCheckpointTime, false) << ", or after object " <<
+		BOX_FORMAT_OBJECTID(mCheckpointLastObjectID));
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::WriteCheckpoint(int64_t, int32_t,
+//			 box_time_t)
+//		Purpose: Record that every object up to LastObjectID, and
+//			 in packs before NextPackNumber, was found to be good
+//			 by a check which started at StartTime.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::WriteCheckpoint(int64_t LastObjectID,
+	int32_t NextPackNumber, box_time_t StartTime)
+{
+	checkpoint_StreamFormat checkpoint;
+	checkpoint.mMagicValue = htonl(CHECKPOINT_MAGIC_VALUE);
+	checkpoint.mNextPackNumber = htonl(NextPackNumber);
+	checkpoint.mLastObjectID = box_hton64(LastObjectID);
+	checkpoint.mStartTime = box_hton64(StartTime);
+
+	std::string filename = GetCheckpointFilename();
+	std::string tempFilename(filename + "X");
+
+	try
+	{
+		{
+			FileStream file(tempFilename,
+				O_WRONLY | O_CREAT | O_TRUNC | O_BINARY);
+			file.Write(&checkpoint, sizeof(checkpoint));
+		}
+
+		#ifdef WIN32
+		if(FileExists(filename) && EMU_UNLINK(filename.c_str()) != 0)
+		{
+			THROW_EMU_FILE_ERROR("Failed to delete old check "
+				"checkpoint", filename, CommonException,
+				OSFileError);
+		}
+		#endif
+
+		if(::rename(tempFilename.c_str(), filename.c_str()) != 0)
+		{
+			THROW_EMU_ERROR("Failed to rename check checkpoint "
+				"from " << tempFilename << " to " << filename,
+				CommonException, OSFileError);
+		}
+	}
+	catch(BoxException &e)
+	{
+		// Not fatal, the next incremental check just does more work
+		BOX_WARNING("Failed to write check checkpoint: " << e.what());
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::IsUnchangedSinceCheckpoint(int64_t,
+//			 int64_t)
+//		Purpose: Whether an object in its own file, with the given
+//			 revision ID, was verified by the last check and not
+//			 rewritten since, e.g. by housekeeping. The checkpoint
+//			 is only valid because that check held the write lock.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreCheck::IsUnchangedSinceCheckpoint(int64_t ObjectID,
+	int64_t RevisionID)
+{
+	// Revision IDs are modification times, plus the file size
+	return ObjectID <= mCheckpointLastObjectID &&
+		RevisionID < mCheckpointTime;
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -729,16 +1580,16 @@ void BackupStoreCheck::CheckDirectories()
 	for(Info_t::const_iterator i(mInfo.begin()); i != mInfo.end(); ++i)
 	{
 		IDBlock *pblock = i->second;
-		int32_t bentries = (pblock == mpInfoLastBlock)?mInfoLastBlockEntries:BACKUPSTORECHECK_BLOCK_SIZE;
 
-		for(int e = 0; e < bentries; ++e)
+		for(int e = 0; e < BACKUPSTORECHECK_BLOCK_SIZE; ++e)
 		{
 			uint8_t flags = GetFlags(pblock, e);
-			if(flags & Flags_IsDir)
+			if((flags & Flags_Exists) && (flags & Flags_IsDir))
 			{
+				int64_t ObjectID = i->first + e;
 				// Found a directory. Read it in.
 				std::string filename;
-				StoreStructure::MakeObjectFilename(pblock->mID[e], mStoreRoot, mDiscSetNumber, filename, false /* no dir creation */);
+				StoreStructure::MakeObjectFilename(ObjectID, mStoreRoot, mDiscSetNumber, filename, false /* no dir creation */);
 				BackupStoreDirectory dir;
 				{
 					std::auto_ptr<RaidFileRead> file(RaidFileRead::Open(mDiscSetNumber, filename));
@@ -753,7 +1604,7 @@ void BackupStoreCheck::CheckDirectories()
 				{
 					// Wasn't quite right, and has been modified
 					BOX_ERROR("Directory ID " <<
-						BOX_FORMAT_OBJECTID(pblock->mID[e]) <<
+						BOX_FORMAT_OBJECTID(ObjectID) <<
 						" was still bad after all checks");
 					++mNumberErrorsFound;
 					isModified = true;
@@ -761,14 +1612,14 @@ void BackupStoreCheck::CheckDirectories()
 				else if(isModified)
 				{
 					BOX_INFO("Directory ID " <<
-						BOX_FORMAT_OBJECTID(pblock->mID[e]) <<
+						BOX_FORMAT_OBJECTID(ObjectID) <<
 						" was OK after fixing");
 				}
 
 				if(isModified && mFixErrors)
 				{
 					BOX_WARNING("Writing modified directory to disk: " <<
-						BOX_FORMAT_OBJECTID(pblock->mID[e]));
+						BOX_FORMAT_OBJECTID(ObjectID));
 					RaidFileWrite fixed(mDiscSetNumber, filename);
 					fixed.Open(true /* allow overwriting */);
 					dir.WriteToStream(fixed);
@@ -984,7 +1835,8 @@ bool BackupStoreCheck::CheckDirectoryEntry(BackupStoreDirectory::Entry& rEntry,
 	// the directory and removing all bad entries.
 	
 	// Check that the container ID of the object is correct
-	if(piBlock->mContainer[IndexInDirBlock] != DirectoryID)
+	if(GetContainer(rEntry.GetObjectID(), piBlock, IndexInDirBlock) !=
+		DirectoryID)
 	{
 		// Needs fixing...
 		if(iflags & Flags_IsDir)
@@ -1006,19 +1858,22 @@ bool BackupStoreCheck::CheckDirectoryEntry(BackupStoreDirectory::Entry& rEntry,
 		}
 		
 		// Fix entry for now
-		piBlock->mContainer[IndexInDirBlock] = DirectoryID;
+		SetContainer(rEntry.GetObjectID(), piBlock, IndexInDirBlock,
+			DirectoryID);
 	}
 
 	// Check the object size
-	if(rEntry.GetSizeInBlocks() != piBlock->mObjectSizeInBlocks[IndexInDirBlock])
+	int64_t sizeInBlocks = GetObjectSize(rEntry.GetObjectID(), piBlock,
+		IndexInDirBlock);
+	if(rEntry.GetSizeInBlocks() != sizeInBlocks)
 	{
 		// Wrong size, correct it.
 		BOX_ERROR("Directory " << BOX_FORMAT_OBJECTID(DirectoryID) <<
 			" entry for " << BOX_FORMAT_OBJECTID(rEntry.GetObjectID()) <<
 			" has wrong size " << rEntry.GetSizeInBlocks() <<
-			", should be " << piBlock->mObjectSizeInBlocks[IndexInDirBlock]);
+			", should be " << sizeInBlocks);
 
-		rEntry.SetSizeInBlocks(piBlock->mObjectSizeInBlocks[IndexInDirBlock]);
+		rEntry.SetSizeInBlocks(sizeInBlocks);
 
 		// Mark as changed
 		rIsModified = true;
@@ -17,7 +17,10 @@
 
 #include "NamedLock.h"
 #include "BackupStoreDirectory.h"
+#include "BackupStorePackIndex.h"
+#include "BoxTime.h"
 
+class FileStream;
 class IOStream;
 class BackupStoreFilename;
 class BackupStoreRefCountDatabase;
@@ -51,16 +54,17 @@ The following problems can be fixed:
 */
 
 
-// Size of blocks in the list of IDs
+// Number of consecutive object IDs covered by each block in the table of
+// IDs. Must be a multiple of Flags__NumItemsPerEntry.
 #ifdef BOX_RELEASE_BUILD
 	#define BACKUPSTORECHECK_BLOCK_SIZE		(64*1024)
 #else
 	#define BACKUPSTORECHECK_BLOCK_SIZE		8
 #endif
 
-// The object ID type -- can redefine to uint32_t to produce a lower memory version for smaller stores
+// The object ID type
 typedef int64_t BackupStoreCheck_ID_t;
-// Can redefine the size type for lower memory usage too
+// The size type
 typedef int64_t BackupStoreCheck_Size_t;
 
 // --------------------------------------------------------------------------
@@ -85,11 +89,41 @@ public:
 	// Do the exciting things
 	void Check();
 	
+	// Read and verify the objects in this many processes at once.
+	// One, the default, does everything in this process.
+	void SetNumberOfProcesses(int Processes)
+	{
+		mNumberOfProcesses = Processes;
+	}
+
+	// Keep the table of objects in a temporary file next to the
+	// account, rather than in memory, for very large accounts. Only
+	// supported where files can be mapped into memory.
+	void SetObjectTableOnDisc(bool OnDisc)
+	{
+		mObjectTableOnDisc = OnDisc;
+	}
+
+	// Only read the headers of files which haven't changed since the
+	// last check which found no errors, as recorded in its checkpoint.
+	// Directories, and everything else, are still checked in full.
+	// The checkpoint is only valid for a check run under the account's
+	// write lock, so only checks which fix errors write one.
+	void SetIncremental(bool Incremental)
+	{
+		mIncremental = Incremental;
+	}
+
 	bool ErrorsFound() {return mNumberErrorsFound > 0;}
 	inline int64_t GetNumErrorsFound()
 	{
 		return mNumberErrorsFound;
 	}
+	int64_t GetNumObjectsVerified() const {return mNumObjectsVerified;}
+	int64_t GetNumObjectsNotReverified() const
+	{
+		return mNumObjectsNotReverified;
+	}
 
 private:
 	enum
@@ -97,24 +131,50 @@ private:
 		// Bit mask
 		Flags_IsDir = 1,
 		Flags_IsContained = 2,
+		Flags_Exists = 4,
 		// Mask
-		Flags__MASK = 3,
-		// Number of bits
-		Flags__NumFlags = 2,
+		Flags__MASK = 7,
+		// Number of bits, one spare
+		Flags__NumFlags = 4,
 		// Items per uint8_t
-		Flags__NumItemsPerEntry = 4	// ie 8 / 2
+		Flags__NumItemsPerEntry = 2	// ie 8 / 4
 	};
 
+	// Container IDs and sizes which don't fit in 32 bits are kept in
+	// a map instead, and this value stored in the block
+	#define BACKUPSTORECHECK_VALUE_IN_MAP	((int32_t)-1)
+
+	// Object IDs are allocated in sequence, so the table is indexed
+	// directly by ID, and each block covers a range of IDs whether or
+	// not the objects still exist. This avoids storing the IDs, and
+	// makes lookups a single map search.
 	typedef struct
 	{
 		// Note use arrays within the block, rather than the more obvious array of
 		// objects, to be more memory efficient -- think alignment of the byte values.
-		uint8_t mFlags[BACKUPSTORECHECK_BLOCK_SIZE * Flags__NumFlags / Flags__NumItemsPerEntry];
-		BackupStoreCheck_ID_t mID[BACKUPSTORECHECK_BLOCK_SIZE];
-		BackupStoreCheck_ID_t mContainer[BACKUPSTORECHECK_BLOCK_SIZE];
-		BackupStoreCheck_Size_t mObjectSizeInBlocks[BACKUPSTORECHECK_BLOCK_SIZE];
+		int32_t mContainer[BACKUPSTORECHECK_BLOCK_SIZE];
+		int32_t mObjectSizeInBlocks[BACKUPSTORECHECK_BLOCK_SIZE];
+		uint8_t mFlags[BACKUPSTORECHECK_BLOCK_SIZE / Flags__NumItemsPerEntry];
 	} IDBlock;
 	
+	// What phase 1 found out about an object by reading it, which can
+	// be done in another process
+	typedef struct
+	{
+		int64_t mObjectID;
+		int64_t mContainerID;	// -1 if the object is bad
+		int64_t mSizeInBlocks;
+		int32_t mIsFile;
+		int32_t mContentsVerified;	// 0 if only the header was read
+	} ObjectCheckResult;
+
+	// A process reading and verifying every Nth range of objects
+	typedef struct
+	{
+		pid_t mPid;
+		FileStream *mpResults;
+	} CheckProcess;
+	
 	// Phases of the check
 	void CheckObjects();
 	void CheckDirectories();
@@ -127,12 +187,40 @@ private:
 	// Checking functions
 	int64_t CheckObjectsScanDir(int64_t StartID, int Level, const std::string &rDirName);
 	void CheckObjectsDir(int64_t StartID);
-	bool CheckAndAddObject(int64_t ObjectID, const std::string &rFilename);
+	std::string GetObjectsDirName(int64_t StartID);
+	void VerifyObjectsDir(int64_t StartID, const std::string &rDirName,
+		const bool *pIdsPresent,
+		std::vector<ObjectCheckResult> &rResultsOut);
+	void VerifyObject(int64_t ObjectID, const std::string &rFilename,
+		ObjectCheckResult &rResultOut);
+	void VerifyPackedObject(const BackupStorePackIndex::Entry &rEntry,
+		ObjectCheckResult &rResultOut);
+	bool CheckAndAddObject(int64_t ObjectID, const std::string &rFilename,
+		const ObjectCheckResult &rResult);
+	bool CheckAndAddPackedObject(const BackupStorePackIndex::Entry &rEntry,
+		const ObjectCheckResult &rResult);
+#ifndef WIN32
+	void StartCheckProcesses(int64_t MaxDir);
+	void RunCheckProcess(int Process, int64_t MaxDir, int WriteFd);
+	bool ReadCheckProcessResults(int64_t StartID,
+		std::vector<ObjectCheckResult> &rResultsOut);
+	void StopCheckProcesses();
+#endif
 	bool CheckDirectory(BackupStoreDirectory& dir);
 	bool CheckDirectoryEntry(BackupStoreDirectory::Entry& rEntry,
 		int64_t DirectoryID, bool& rIsModified);
 	void CountDirectoryEntries(BackupStoreDirectory& dir);
 	int64_t CheckFile(int64_t ObjectID, IOStream &rStream);
+	int64_t CheckFileHeader(int64_t ObjectID, IOStream &rStream);
+
+	// Checkpoint recorded by the last check which fixed errors, and so
+	// held the write lock, and found none
+	std::string GetCheckpointFilename();
+	void ReadCheckpoint();
+	void WriteCheckpoint(int64_t LastObjectID, int32_t NextPackNumber,
+		box_time_t StartTime);
+	bool IsUnchangedSinceCheckpoint(int64_t ObjectID,
+		int64_t RevisionID);
 	int64_t CheckDirInitial(int64_t ObjectID, IOStream &rStream);
 
 	// Fixing functions
@@ -143,8 +231,16 @@ private:
 
 	// Data handling
 	void FreeInfo();
+	IDBlock *AllocateIDBlock();
+	static size_t GetIDBlockMappedSize();
 	void AddID(BackupStoreCheck_ID_t ID, BackupStoreCheck_ID_t Container, BackupStoreCheck_Size_t ObjectSize, bool IsFile);
 	IDBlock *LookupID(BackupStoreCheck_ID_t ID, int32_t &rIndexOut);
+	BackupStoreCheck_ID_t GetContainer(BackupStoreCheck_ID_t ObjectID,
+		IDBlock *pBlock, int32_t Index);
+	void SetContainer(BackupStoreCheck_ID_t ObjectID, IDBlock *pBlock,
+		int32_t Index, BackupStoreCheck_ID_t Container);
+	BackupStoreCheck_Size_t GetObjectSize(BackupStoreCheck_ID_t ObjectID,
+		IDBlock *pBlock, int32_t Index);
 	inline void SetFlags(IDBlock *pBlock, int32_t Index, uint8_t Flags)
 	{
 		ASSERT(pBlock != 0);
@@ -176,18 +272,32 @@ private:
 	std::string mAccountName;
 	bool mFixErrors;
 	bool mQuiet;
+	int mNumberOfProcesses;
+	bool mIncremental;
 	
 	int64_t mNumberErrorsFound;
+	int64_t mNumObjectsVerified;
+	int64_t mNumObjectsNotReverified;
+
+	// From the checkpoint file, all zero if there isn't one
+	int64_t mCheckpointLastObjectID;
+	int32_t mCheckpointNextPackNumber;
+	box_time_t mCheckpointTime;
 	
 	// Lock for the store account
 	NamedLock mAccountLock;
 	
-	// Storage for ID data
+	// Storage for ID data, keyed by the first ID in each block
 	typedef std::map<BackupStoreCheck_ID_t, IDBlock*> Info_t;
 	Info_t mInfo;
 	BackupStoreCheck_ID_t mLastIDInInfo;
-	IDBlock *mpInfoLastBlock;
-	int32_t mInfoLastBlockEntries;
+	std::map<BackupStoreCheck_ID_t, int64_t> mLargeContainers;
+	std::map<BackupStoreCheck_ID_t, int64_t> mLargeSizes;
+
+	// Temporary file holding the blocks, if they're not in memory
+	bool mObjectTableOnDisc;
+	std::auto_ptr<FileStream> mapObjectTableFile;
+	int64_t mObjectTableFileSize;
 	
 	// List of stuff to fix
 	std::vector<BackupStoreCheck_ID_t> mDirsWithWrongContainerID;
@@ -195,11 +305,17 @@ private:
 	std::map<BackupStoreCheck_ID_t, BackupStoreCheck_ID_t>
 		mDirsWhichContainLostDirs;
 	
+	// Processes started by phase 1, in the order they take ranges
+	std::vector<CheckProcess> mCheckProcesses;
+	
 	// Set of extra directories added
 	std::set<BackupStoreCheck_ID_t> mDirsAdded;
 
 	// The refcount database, being reconstructed as the check/fix progresses
 	std::auto_ptr<BackupStoreRefCountDatabase> mapNewRefs;
+
+	// Objects stored in pack files rather than their own files
+	BackupStorePackIndex mPackIndex;
 	
 	// Misc stuff
 	int32_t mLostDirNameSerial;
@@ -104,10 +104,11 @@ class BackupStoreDirectoryFixer
 	std::string mFilename;
 	std::string mStoreRoot;
 	int mDiscSetNumber;
+	BackupStorePackIndex &mrPackIndex;
 
 	public:
 	BackupStoreDirectoryFixer(std::string storeRoot, int discSetNumber,
-		int64_t ID);
+		BackupStorePackIndex &rPackIndex, int64_t ID);
 	void InsertObject(int64_t ObjectID, bool IsDirectory,
 		int32_t lostDirNameSerial);
 	~BackupStoreDirectoryFixer();
@@ -131,15 +132,14 @@ void BackupStoreCheck::CheckUnattachedObjects()
 	for(Info_t::const_iterator i(mInfo.begin()); i != mInfo.end(); ++i)
 	{
 		IDBlock *pblock = i->second;
-		int32_t bentries = (pblock == mpInfoLastBlock)?mInfoLastBlockEntries:BACKUPSTORECHECK_BLOCK_SIZE;
 
-		for(int e = 0; e < bentries; ++e)
+		for(int e = 0; e < BACKUPSTORECHECK_BLOCK_SIZE; ++e)
 		{
 			uint8_t flags = GetFlags(pblock, e);
-			if((flags & Flags_IsContained) == 0)
+			if((flags & Flags_Exists) && (flags & Flags_IsContained) == 0)
 			{
 				// Unattached object...
-				int64_t ObjectID = pblock->mID[e];
+				int64_t ObjectID = i->first + e;
 				BOX_ERROR("Object " <<
 					BOX_FORMAT_OBJECTID(ObjectID) <<
 					" is unattached.");
@@ -168,7 +168,7 @@ void BackupStoreCheck::CheckUnattachedObjects()
 						// The easiest way to do this is to verify it again. Not such a bad penalty, because
 						// this really shouldn't be done very often.
 						{
-							std::auto_ptr<RaidFileRead> file(RaidFileRead::Open(mDiscSetNumber, filename));
+							std::auto_ptr<IOStream> file(mPackIndex.OpenObject(ObjectID));
 							BackupStoreFile::VerifyEncodedFileFormat(*file, &diffFromObjectID);
 						}
 
@@ -181,11 +181,19 @@ void BackupStoreCheck::CheckUnattachedObjects()
 							// Delete this object instead
 							if(mFixErrors)
 							{
-								RaidFileWrite del(mDiscSetNumber, filename);
-								del.Delete();
+								if(RaidFileRead::FileExists(mDiscSetNumber, filename))
+								{
+									RaidFileWrite del(mDiscSetNumber, filename);
+									del.Delete();
+								}
+								else
+								{
+									mPackIndex.Remove(ObjectID);
+								}
 							}
 
-							mBlocksUsed -= pblock->mObjectSizeInBlocks[e];
+							mBlocksUsed -= GetObjectSize(ObjectID,
+								pblock, e);
 
 							// Move on to next item
 							continue;
@@ -198,15 +206,17 @@ void BackupStoreCheck::CheckUnattachedObjects()
 					// Can't do this with a directory, because the name just wouldn't be known, which is
 					// pretty useless as bbackupd would just delete it. So better to put it in lost+found
 					// where the admin can do something about it.
+					int64_t containerID = GetContainer(ObjectID,
+						pblock, e);
 					int32_t dirindex;
-					IDBlock *pdirblock = LookupID(pblock->mContainer[e], dirindex);
+					IDBlock *pdirblock = LookupID(containerID, dirindex);
 					if(pdirblock != 0)
 					{
 						// Something with that ID has been found. Is it a directory?
 						if(GetFlags(pdirblock, dirindex) & Flags_IsDir)
 						{
 							// Directory exists, add to that one
-							putIntoDirectoryID = pblock->mContainer[e];
+							putIntoDirectoryID = containerID;
 						}
 						else
 						{
@@ -214,11 +224,11 @@ void BackupStoreCheck::CheckUnattachedObjects()
 							putIntoDirectoryID = GetLostAndFoundDirID();
 						}
 					}
-					else if(mDirsAdded.find(pblock->mContainer[e]) != mDirsAdded.end()
-						|| TryToRecreateDirectory(pblock->mContainer[e]))
+					else if(mDirsAdded.find(containerID) != mDirsAdded.end()
+						|| TryToRecreateDirectory(containerID))
 					{
 						// The directory reappeared, or was created somehow elsewhere
-						putIntoDirectoryID = pblock->mContainer[e];
+						putIntoDirectoryID = containerID;
 					}
 					else
 					{
@@ -239,7 +249,7 @@ void BackupStoreCheck::CheckUnattachedObjects()
 				{
 					// no match, create a new one
 					pFixer = new BackupStoreDirectoryFixer(
-						mStoreRoot, mDiscSetNumber,
+						mStoreRoot, mDiscSetNumber, mPackIndex,
 						putIntoDirectoryID);
 					fixers.insert(fixer_pair_t(
 						putIntoDirectoryID, pFixer));
@@ -330,9 +340,10 @@ bool BackupStoreCheck::TryToRecreateDirectory(int64_t MissingDirectoryID)
 }
 
 BackupStoreDirectoryFixer::BackupStoreDirectoryFixer(std::string storeRoot,
-	int discSetNumber, int64_t ID)
+	int discSetNumber, BackupStorePackIndex &rPackIndex, int64_t ID)
 : mStoreRoot(storeRoot),
-  mDiscSetNumber(discSetNumber)
+  mDiscSetNumber(discSetNumber),
+  mrPackIndex(rPackIndex)
 {
 	// Generate filename
 	StoreStructure::MakeObjectFilename(ID, mStoreRoot, mDiscSetNumber,
@@ -362,20 +373,15 @@ void BackupStoreDirectoryFixer::InsertObject(int64_t ObjectID, bool IsDirectory,
 	else
 	{
 		// Files require a little more work...
-		// Open file
-		std::string fileFilename;
-		StoreStructure::MakeObjectFilename(ObjectID, mStoreRoot,
-			mDiscSetNumber, fileFilename,
-			false /* don't make sure the dir exists */);
-		std::auto_ptr<RaidFileRead> file(
-			RaidFileRead::Open(mDiscSetNumber, fileFilename));
-
-		// Fill in size information
-		sizeInBlocks = file->GetDiscUsageInBlocks();
+		// Open file, which may be in a pack, and fill in size information
+		int64_t size = 0;
+		std::auto_ptr<IOStream> file(mrPackIndex.OpenObject(ObjectID,
+			&size));
+		sizeInBlocks = size;
 
 		// Read in header
 		file_StreamFormat hdr;
-		if(file->Read(&hdr, sizeof(hdr)) != sizeof(hdr) ||
+		if(!file->ReadFullBuffer(&hdr, sizeof(hdr), 0) ||
 			(ntohl(hdr.mMagicValue) != OBJECTMAGIC_FILE_MAGIC_VALUE_V1
 #ifndef BOX_DISABLE_BACKWARDS_COMPATIBILITY_BACKUPSTOREFILE
 			&& ntohl(hdr.mMagicValue) != OBJECTMAGIC_FILE_MAGIC_VALUE_V0
@@ -514,7 +520,7 @@ void BackupStoreCheck::FixDirsWithWrongContainerID()
 		}
 
 		// Adjust container ID
-		dir.SetContainerID(pblock->mContainer[index]);
+		dir.SetContainerID(GetContainer(*i, pblock, index));
 
 		// Write it out
 		RaidFileWrite root(mDiscSetNumber, filename);
@@ -10,9 +10,22 @@
 #include "Box.h"
 
 #include <stdlib.h>
+
+#ifdef HAVE_SYS_MMAN_H
+	#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+	#include <unistd.h>
+#endif
+
 #include <memory>
 
 #include "BackupStoreCheck.h"
+#include "CommonException.h"
+#include "InvisibleTempFileStream.h"
+#include "RaidFileController.h"
+#include "RaidFileUtil.h"
 #include "autogen_BackupStoreException.h"
 
 #include "MemLeakFindOn.h"
@@ -31,19 +44,112 @@ void BackupStoreCheck::FreeInfo()
 	// Free all the blocks
 	for(Info_t::iterator i(mInfo.begin()); i != mInfo.end(); ++i)
 	{
+#ifdef HAVE_SYS_MMAN_H
+		if(mapObjectTableFile.get())
+		{
+			if(::munmap(i->second, GetIDBlockMappedSize()) != 0)
+			{
+				BOX_LOG_SYS_ERROR("Failed to unmap check object "
+					"table");
+			}
+			continue;
+		}
+#endif
 		::free(i->second);
 	}
 	
 	// Clear the contents of the map
 	mInfo.clear();
+	mLargeContainers.clear();
+	mLargeSizes.clear();
+
+	// Deletes the temporary file, if there was one
+	mapObjectTableFile.reset();
+	mObjectTableFileSize = 0;
 	
 	// Reset the last ID, just in case
-	mpInfoLastBlock = 0;
-	mInfoLastBlockEntries = 0;
 	mLastIDInInfo = 0;
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::GetIDBlockMappedSize()
+//		Purpose: Size of the part of the temporary file used for
+//			 each block, which must be a whole number of pages
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+size_t BackupStoreCheck::GetIDBlockMappedSize()
+{
+#ifdef HAVE_SYS_MMAN_H
+	size_t pageSize = ::sysconf(_SC_PAGESIZE);
+	return ((sizeof(IDBlock) + pageSize - 1) / pageSize) * pageSize;
+#else
+	return sizeof(IDBlock);
+#endif
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::AllocateIDBlock()
+//		Purpose: Allocate a zeroed block for the table of IDs, in
+//			 memory or in the temporary file.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreCheck::IDBlock *BackupStoreCheck::AllocateIDBlock()
+{
+#ifdef HAVE_SYS_MMAN_H
+	if(mObjectTableOnDisc)
+	{
+		if(!mapObjectTableFile.get())
+		{
+			RaidFileController &rcontroller(
+				RaidFileController::GetController());
+			RaidFileDiscSet rdiscSet(
+				rcontroller.GetDiscSet(mDiscSetNumber));
+			std::string filename = RaidFileUtil::MakeWriteFileName(
+				rdiscSet, mStoreRoot + "checktable.tmp");
+			mapObjectTableFile.reset(new InvisibleTempFileStream(
+				filename, O_RDWR | O_CREAT | O_EXCL | O_BINARY));
+			mObjectTableFileSize = 0;
+		}
+
+		// The file is extended with zeros, so the block starts empty
+		size_t size = GetIDBlockMappedSize();
+		int fd = mapObjectTableFile->GetFileHandle();
+		if(::ftruncate(fd, mObjectTableFileSize + size) != 0)
+		{
+			THROW_SYS_ERROR("Failed to extend check object table",
+				CommonException, OSFileError);
+		}
+
+		void *pMapping = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, mObjectTableFileSize);
+		if(pMapping == MAP_FAILED)
+		{
+			THROW_SYS_ERROR("Failed to map check object table",
+				CommonException, OSFileError);
+		}
+
+		mObjectTableFileSize += size;
+		return (IDBlock *)pMapping;
+	}
+#endif
+
+	IDBlock *pblk = (IDBlock*)calloc(1, sizeof(IDBlock));
+	if(pblk == 0)
+	{
+		throw std::bad_alloc();
+	}
+	return pblk;
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -61,31 +167,34 @@ void BackupStoreCheck::AddID(BackupStoreCheck_ID_t ID,
 		THROW_EXCEPTION(BackupStoreException, InternalAlgorithmErrorCheckIDNotMonotonicallyIncreasing)
 	}
 	
-	// Can this go in the current block?
-	if(mpInfoLastBlock == 0 || mInfoLastBlockEntries >= BACKUPSTORECHECK_BLOCK_SIZE)
+	// Find the block covering this ID, allocating it if necessary
+	BackupStoreCheck_ID_t firstID = ID - (ID % BACKUPSTORECHECK_BLOCK_SIZE);
+	int32_t index = ID - firstID;
+	IDBlock *pblock;
+	Info_t::iterator ib(mInfo.find(firstID));
+	if(ib != mInfo.end())
 	{
-		// No. Allocate a new one
-		IDBlock *pblk = (IDBlock*)calloc(1, sizeof(IDBlock));
-		if(pblk == 0)
-		{
-			throw std::bad_alloc();
-		}
-		// Store in map
-		mInfo[ID] = pblk;
-		// Allocated and stored OK, setup for use
-		mpInfoLastBlock = pblk;
-		mInfoLastBlockEntries = 0;
+		pblock = ib->second;
+	}
+	else
+	{
+		pblock = AllocateIDBlock();
+		mInfo[firstID] = pblock;
 	}
-	ASSERT(mpInfoLastBlock != 0 && mInfoLastBlockEntries < BACKUPSTORECHECK_BLOCK_SIZE);
 	
 	// Add to block
-	mpInfoLastBlock->mID[mInfoLastBlockEntries] = ID;
-	mpInfoLastBlock->mContainer[mInfoLastBlockEntries] = Container;
-	mpInfoLastBlock->mObjectSizeInBlocks[mInfoLastBlockEntries] = ObjectSize;
-	SetFlags(mpInfoLastBlock, mInfoLastBlockEntries, IsFile?(0):(Flags_IsDir));
-	
-	// Increment size
-	++mInfoLastBlockEntries;
+	SetContainer(ID, pblock, index, Container);
+	if(ObjectSize >= 0 && ObjectSize <= 0x7fffffff)
+	{
+		pblock->mObjectSizeInBlocks[index] = (int32_t)ObjectSize;
+	}
+	else
+	{
+		pblock->mObjectSizeInBlocks[index] =
+			BACKUPSTORECHECK_VALUE_IN_MAP;
+		mLargeSizes[ID] = ObjectSize;
+	}
+	SetFlags(pblock, index, Flags_Exists | (IsFile?(0):(Flags_IsDir)));
 	
 	// Store last ID
 	mLastIDInInfo = ID;
@@ -103,69 +212,113 @@ void BackupStoreCheck::AddID(BackupStoreCheck_ID_t ID,
 // --------------------------------------------------------------------------
 BackupStoreCheck::IDBlock *BackupStoreCheck::LookupID(BackupStoreCheck_ID_t ID, int32_t &rIndexOut)
 {
-	IDBlock *pblock = 0;
+	if(ID <= 0 || ID > mLastIDInInfo)
+	{
+		return 0;
+	}
 
-	// Find the lower matching block who's first entry is not less than ID
-	Info_t::const_iterator ib(mInfo.lower_bound(ID));
-	
-	// Was there a block
+	BackupStoreCheck_ID_t firstID = ID - (ID % BACKUPSTORECHECK_BLOCK_SIZE);
+	Info_t::const_iterator ib(mInfo.find(firstID));
 	if(ib == mInfo.end())
 	{
-		// Block wasn't found... could be in last block
-		pblock = mpInfoLastBlock;
+		// No objects in this range
+		return 0;
 	}
-	else
+
+	int32_t index = ID - firstID;
+	if((GetFlags(ib->second, index) & Flags_Exists) == 0)
 	{
-		// Found it as first entry?
-		if(ib->first == ID)
-		{
-			rIndexOut = 0;
-			return ib->second;
-		}
-		
-		// Go back one block as it's not the first entry in this one
-		if(ib == mInfo.begin())
-		{
-			// Was first block, can't go back
-			return 0;
-		}
-		// Go back...
-		--ib;
+		// Not found
+		return 0;
+	}
 
-		// So, the ID will be in this block, if it's in anything
-		pblock = ib->second;
+	rIndexOut = index;
+	return ib->second;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::GetContainer(BackupStoreCheck_ID_t,
+//			 IDBlock *, int32_t)
+//		Purpose: Return the container ID of an object, given the
+//			 block and index returned by LookupID()
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreCheck_ID_t BackupStoreCheck::GetContainer(
+	BackupStoreCheck_ID_t ObjectID, IDBlock *pBlock, int32_t Index)
+{
+	ASSERT(pBlock != 0);
+	ASSERT(Index < BACKUPSTORECHECK_BLOCK_SIZE);
+
+	if(pBlock->mContainer[Index] != BACKUPSTORECHECK_VALUE_IN_MAP)
+	{
+		return pBlock->mContainer[Index];
 	}
 
-	if(pblock == 0) return 0;
-	ASSERT(pblock != 0);
-	
-	// How many entries are there in the block
-	int32_t bentries = (pblock == mpInfoLastBlock)?mInfoLastBlockEntries:BACKUPSTORECHECK_BLOCK_SIZE;
-	
-	// Do binary search within block
-	int high = bentries;
-	int low = -1;
-	while(high - low > 1)
+	std::map<BackupStoreCheck_ID_t, int64_t>::const_iterator i(
+		mLargeContainers.find(ObjectID));
+	ASSERT(i != mLargeContainers.end());
+	return i->second;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::SetContainer(BackupStoreCheck_ID_t,
+//			 IDBlock *, int32_t, BackupStoreCheck_ID_t)
+//		Purpose: Set the container ID of an object, given the
+//			 block and index returned by LookupID()
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreCheck::SetContainer(BackupStoreCheck_ID_t ObjectID,
+	IDBlock *pBlock, int32_t Index, BackupStoreCheck_ID_t Container)
+{
+	ASSERT(pBlock != 0);
+	ASSERT(Index < BACKUPSTORECHECK_BLOCK_SIZE);
+
+	if(Container >= 0 && Container <= 0x7fffffff)
 	{
-		int i = (high + low) / 2;
-		if(ID <= pblock->mID[i])
-		{
-			high = i;
-		}
-		else
-		{
-			low = i;
-		}
+		pBlock->mContainer[Index] = (int32_t)Container;
+		mLargeContainers.erase(ObjectID);
 	}
-	if(ID == pblock->mID[high])
+	else
+	{
+		pBlock->mContainer[Index] = BACKUPSTORECHECK_VALUE_IN_MAP;
+		mLargeContainers[ObjectID] = Container;
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreCheck::GetObjectSize(BackupStoreCheck_ID_t,
+//			 IDBlock *, int32_t)
+//		Purpose: Return the size in blocks of an object, given the
+//			 block and index returned by LookupID()
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreCheck_Size_t BackupStoreCheck::GetObjectSize(
+	BackupStoreCheck_ID_t ObjectID, IDBlock *pBlock, int32_t Index)
+{
+	ASSERT(pBlock != 0);
+	ASSERT(Index < BACKUPSTORECHECK_BLOCK_SIZE);
+
+	if(pBlock->mObjectSizeInBlocks[Index] != BACKUPSTORECHECK_VALUE_IN_MAP)
 	{
-		// Found
-		rIndexOut = high;
-		return pblock;
+		return pBlock->mObjectSizeInBlocks[Index];
 	}
 
-	// Not found
-	return 0;
+	std::map<BackupStoreCheck_ID_t, int64_t>::const_iterator i(
+		mLargeSizes.find(ObjectID));
+	ASSERT(i != mLargeSizes.end());
+	return i->second;
 }
 
 
@@ -183,16 +336,16 @@ void BackupStoreCheck::DumpObjectInfo()
 	for(Info_t::const_iterator i(mInfo.begin()); i != mInfo.end(); ++i)
 	{
 		IDBlock *pblock = i->second;
-		int32_t bentries = (pblock == mpInfoLastBlock)?mInfoLastBlockEntries:BACKUPSTORECHECK_BLOCK_SIZE;
 		BOX_TRACE("BLOCK @ " << BOX_FORMAT_HEX32(pblock) <<
-			", " << bentries << " entries");
+			", first ID " << BOX_FORMAT_OBJECTID(i->first));
 		
-		for(int e = 0; e < bentries; ++e)
+		for(int e = 0; e < BACKUPSTORECHECK_BLOCK_SIZE; ++e)
 		{
 			uint8_t flags = GetFlags(pblock, e);
+			if((flags & Flags_Exists) == 0) continue;
 			BOX_TRACE(std::hex << 
-				"id "  << pblock->mID[e] <<
-				", c " << pblock->mContainer[e] <<
+				"id "  << (i->first + e) <<
+				", c " << GetContainer(i->first + e, pblock, e) <<
 				", " << ((flags & Flags_IsDir)?"dir":"file") <<
 				", " << ((flags & Flags_IsContained) ? 
 					"contained":"unattached"));
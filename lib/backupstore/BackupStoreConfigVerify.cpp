@@ -36,8 +36,38 @@ static const ConfigurationVerifyKey verifyrootkeys[] =
 	ConfigurationVerifyKey("AccountDatabase", ConfigTest_Exists),
 	ConfigurationVerifyKey("TimeBetweenHousekeeping",
 		ConfigTest_Exists | ConfigTest_IsInt),
+	ConfigurationVerifyKey("HousekeepingProcesses", ConfigTest_IsInt, 1),
+	// number of accounts housekept at the same time
+	ConfigurationVerifyKey("HousekeepingOperationsPerSecond",
+		ConfigTest_IsInt, 0),
+	// directories read and objects deleted per second, shared between
+	// all housekeeping processes. 0 means no limit.
+	ConfigurationVerifyKey("HousekeepingFullScanInterval",
+		ConfigTest_IsInt, 0),
+	// in seconds; in between, housekeeping only scans the directories
+	// changed by clients. 0 always scans everything.
+	ConfigurationVerifyKey("HousekeepingMergeProcesses", ConfigTest_IsInt, 1),
+	// number of processes merging patches while housekeeping deletes
+	// files from one account. 1 merges in the housekeeping process.
+	ConfigurationVerifyKey("ScrubInterval", ConfigTest_IsInt, 0),
+	// in seconds between the starts of passes reading every object in
+	// the store to find damage. 0 disables scrubbing.
+	ConfigurationVerifyKey("ScrubBlocksPerSecond", ConfigTest_IsInt, 0),
+	// limit on the rate at which scrubbing reads. 0 means no limit.
+	ConfigurationVerifyKey("CheckProcesses", ConfigTest_IsInt, 1),
+	// number of processes reading objects during bbstoreaccounts check
+	ConfigurationVerifyKey("CheckObjectTableOnDisc", ConfigTest_IsBool,
+		false),
+	// keep bbstoreaccounts check's table of objects in a temporary file
 	ConfigurationVerifyKey("ExtendedLogging", ConfigTest_IsBool, false),
 	// make value "yes" to enable in config file
+	ConfigurationVerifyKey("PackFileObjectSizeLimit", ConfigTest_IsInt, 0),
+	// in blocks; files of up to this size are moved into pack files
+	// by housekeeping once they're old or deleted. 0 disables packing.
+	ConfigurationVerifyKey("MaxPatchChainDepth", ConfigTest_IsInt, 0),
+	ConfigurationVerifyKey("MaxPatchChainBlocks", ConfigTest_IsInt, 0),
+	// housekeeping rewrites old versions which need more patches than
+	// this, or more blocks of patches, to restore. 0 means no limit.
 	ConfigurationVerifyKey("RaidFileConf", ConfigTest_LastEntry)
 };
 
@@ -12,7 +12,14 @@
 
 #define BACKUPSTORE_ROOT_DIRECTORY_ID	1
 
+// Directory within the account, on one disc, holding files uploaded by
+// other connections until the session with the write lock adds them
+#define BACKUPSTORE_STAGING_DIRECTORY	"staging"
+
 #define BACKUP_STORE_SERVER_VERSION		1
+// Servers which can stage files for the session with the write lock also
+// accept this version, so that clients can find out before asking them to
+#define BACKUP_STORE_SERVER_VERSION_STAGING	2
 
 // Minimum size for a chunk to be compressed
 #define BACKUP_FILE_MIN_COMPRESSED_CHUNK_SIZE	256
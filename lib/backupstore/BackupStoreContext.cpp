@@ -11,20 +11,29 @@
 
 #include <stdio.h>
 
+#include <vector>
+
 #include "BackupConstants.h"
+#include "BackupStoreConstants.h"
 #include "BackupStoreContext.h"
 #include "BackupStoreDirectory.h"
 #include "BackupStoreException.h"
 #include "BackupStoreFile.h"
 #include "BackupStoreInfo.h"
 #include "BackupStoreObjectMagic.h"
+#include "BackupStoreSharedAccountState.h"
 #include "BufferedStream.h"
 #include "BufferedWriteStream.h"
+#include "CollectInBufferStream.h"
+#include "CommonException.h"
 #include "FileStream.h"
+#include "Guards.h"
 #include "InvisibleTempFileStream.h"
 #include "RaidFileController.h"
+#include "RaidFileException.h"
 #include "RaidFileRead.h"
 #include "RaidFileWrite.h"
+#include "Random.h"
 #include "StoreStructure.h"
 
 #include "MemLeakFindOn.h"
@@ -46,6 +55,9 @@
 // Maximum amount of store info updates before it's actually saved to disc.
 #define STORE_INFO_SAVE_DELAY	96
 
+// How much of a staged file arrives between checks of the hard limit
+#define STAGE_FILE_BUFFER_SIZE	(64*1024)
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -59,10 +71,12 @@ BackupStoreContext::BackupStoreContext(int32_t ClientID,
 : mConnectionDetails(rConnectionDetails),
   mClientID(ClientID),
   mpHousekeeping(pHousekeeping),
+  mpSharedAccountState(NULL),
   mProtocolPhase(Phase_START),
   mClientHasAccount(false),
   mStoreDiscSet(-1),
   mReadOnly(true),
+  mStagingSessionID(0),
   mSaveStoreInfoDelay(STORE_INFO_SAVE_DELAY),
   mpTestHook(NULL)
 // If you change the initialisers, be sure to update
@@ -81,6 +95,18 @@ BackupStoreContext::BackupStoreContext(int32_t ClientID,
 // --------------------------------------------------------------------------
 BackupStoreContext::~BackupStoreContext()
 {
+	// The client may have gone without finishing, leaving files staged
+	// for this session which will never be added
+	try
+	{
+		EndStaging();
+	}
+	catch(BoxException &e)
+	{
+		BOX_WARNING("Failed to delete staged files for client " <<
+			BOX_FORMAT_ACCOUNT(mClientID) << ": " << e.what());
+	}
+
 	ClearDirectoryCache();
 }
 
@@ -112,6 +138,12 @@ void BackupStoreContext::CleanUp()
 		mapStoreInfo->IsModified())
 	{
 		mapStoreInfo->Save();
+
+		if(mpSharedAccountState)
+		{
+			mpSharedAccountState->PublishStoreInfo(*mapStoreInfo,
+				true); // saved to disc
+		}
 	}
 }
 
@@ -132,6 +164,9 @@ void BackupStoreContext::ReceivedFinishCommand()
 		SaveStoreInfo(false);
 	}
 
+	// Anything still staged for this session will never be added
+	EndStaging();
+
 	// Just in case someone wants to reuse a local protocol object,
 	// put the context back to its initial state.
 	mProtocolPhase = BackupStoreContext::Phase_Version;
@@ -144,6 +179,8 @@ void BackupStoreContext::ReceivedFinishCommand()
 	mpTestHook = NULL;
 	mapStoreInfo.reset();
 	mapRefCount.reset();
+	mapPackIndex.reset();
+	mapDirtyDirectories.reset();
 	ClearDirectoryCache();
 }
 
@@ -210,7 +247,17 @@ void BackupStoreContext::LoadStoreInfo()
 	}
 
 	// Load it up!
-	std::auto_ptr<BackupStoreInfo> i(BackupStoreInfo::Load(mClientID, mAccountRootDir, mStoreDiscSet, mReadOnly));
+	std::auto_ptr<BackupStoreInfo> i;
+	if(mpSharedAccountState)
+	{
+		i = mpSharedAccountState->LoadStoreInfo(mClientID,
+			mAccountRootDir, mStoreDiscSet, mReadOnly);
+	}
+	else
+	{
+		i = BackupStoreInfo::Load(mClientID, mAccountRootDir,
+			mStoreDiscSet, mReadOnly);
+	}
 
 	// Check it
 	if(i->GetAccountID() != mClientID)
@@ -221,6 +268,17 @@ void BackupStoreContext::LoadStoreInfo()
 	// Keep the pointer to it
 	mapStoreInfo = i;
 
+	// The pack index is only read when an object isn't found in its
+	// own file
+	mapPackIndex.reset(new BackupStorePackIndex(mAccountRootDir,
+		mStoreDiscSet));
+
+	if(!mReadOnly)
+	{
+		mapDirtyDirectories.reset(new BackupStoreDirtyDirectoryLog(
+			mAccountRootDir, mStoreDiscSet));
+	}
+
 	BackupStoreAccountDatabase::Entry account(mClientID, mStoreDiscSet);
 
 	// try to load the reference count database
@@ -243,7 +301,9 @@ void BackupStoreContext::LoadStoreInfo()
 //
 // Function
 //		Name:    BackupStoreContext::SaveStoreInfo(bool)
-//		Purpose: Potentially delayed saving of the store info
+//		Purpose: Potentially delayed saving of the store info.
+//			 Changes to the usage counts are logged even if the
+//			 save is delayed, so that a crash can't lose them.
 //		Created: 16/12/03
 //
 // --------------------------------------------------------------------------
@@ -265,6 +325,15 @@ void BackupStoreContext::SaveStoreInfo(bool AllowDelay)
 		--mSaveStoreInfoDelay;
 		if(mSaveStoreInfoDelay > 0)
 		{
+			// Must be logged before anyone can see them
+			mapStoreInfo->LogChanges();
+
+			// Other processes can still see the changes now
+			if(mpSharedAccountState)
+			{
+				mpSharedAccountState->PublishStoreInfo(
+					*mapStoreInfo, false); // not saved
+			}
 			return;
 		}
 	}
@@ -272,6 +341,12 @@ void BackupStoreContext::SaveStoreInfo(bool AllowDelay)
 	// Want to save now
 	mapStoreInfo->Save();
 
+	if(mpSharedAccountState)
+	{
+		mpSharedAccountState->PublishStoreInfo(*mapStoreInfo,
+			true); // saved to disc
+	}
+
 	// Set count for next delay
 	mSaveStoreInfoDelay = STORE_INFO_SAVE_DELAY;
 }
@@ -443,11 +518,8 @@ int64_t BackupStoreContext::AllocateObjectID()
 		// Attempt to allocate an ID from the store
 		int64_t id = mapStoreInfo->AllocateObjectID();
 
-		// Generate filename
-		std::string filename;
-		MakeObjectFilename(id, filename);
-		// Check it doesn't exist
-		if(!RaidFileRead::FileExists(mStoreDiscSet, filename))
+		// Check it doesn't exist, in its own file or in a pack
+		if(!mapPackIndex->ObjectExists(id))
 		{
 			// Success!
 			return id;
@@ -467,6 +539,81 @@ int64_t BackupStoreContext::AllocateObjectID()
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static SpoolDiff(IOStream &, const std::string &)
+//		Purpose: Read an uploaded patch into a seekable stream. It's
+//			 kept in memory if it's no bigger than
+//			 BACKUP_STORE_MAX_DIFF_IN_MEMORY, otherwise it's
+//			 written to a temporary file of the given name, which
+//			 is deleted when the stream is closed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static std::auto_ptr<IOStream> SpoolDiff(IOStream &rFile,
+	const std::string &rTempFilename)
+{
+	std::auto_ptr<CollectInBufferStream> apBuffer(new CollectInBufferStream);
+	const int bufferSize = 64*1024;
+	MemoryBlockGuard<char*> buffer(bufferSize);
+
+	while(rFile.StreamDataLeft())
+	{
+		int bytes = rFile.Read(buffer, bufferSize, BACKUP_STORE_TIMEOUT);
+		if(bytes == 0 && rFile.StreamDataLeft())
+		{
+			THROW_EXCEPTION(BackupStoreException, ReadFileFromStreamTimedOut)
+		}
+		apBuffer->Write(buffer, bytes);
+
+		if(apBuffer->GetSize() <= BACKUP_STORE_MAX_DIFF_IN_MEMORY)
+		{
+			continue;
+		}
+
+		// Too big to keep in memory, move it to a file instead
+		std::auto_ptr<IOStream> apFile;
+		try
+		{
+#ifdef WIN32
+			apFile.reset(new InvisibleTempFileStream(
+				rTempFilename.c_str(), O_RDWR | O_CREAT | O_BINARY));
+#else
+			apFile.reset(new FileStream(rTempFilename.c_str(),
+				O_RDWR | O_CREAT | O_EXCL));
+
+			// Unlink it immediately, so it definitely goes away
+			if(::unlink(rTempFilename.c_str()) != 0)
+			{
+				THROW_EXCEPTION(CommonException, OSFileError);
+			}
+#endif
+			apFile->Write(apBuffer->GetBuffer(), apBuffer->GetSize());
+			apBuffer.reset();
+
+			if(!rFile.CopyStreamTo(*apFile, BACKUP_STORE_TIMEOUT,
+				bufferSize))
+			{
+				THROW_EXCEPTION(BackupStoreException, ReadFileFromStreamTimedOut)
+			}
+		}
+		catch(...)
+		{
+			// Be very paranoid about deleting this temp file -- we could only leave a zero byte file anyway
+			::unlink(rTempFilename.c_str());
+			throw;
+		}
+
+		apFile->Seek(0, IOStream::SeekType_Absolute);
+		return apFile;
+	}
+
+	apBuffer->SetForReading();
+	return std::auto_ptr<IOStream>(apBuffer.release());
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -483,6 +630,34 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 	int64_t DiffFromFileID, const BackupStoreFilename &rFilename,
 	bool MarkFileWithSameNameAsOldVersions)
 {
+	return AddFileInternal(&rFile, NULL, InDirectory, ModificationTime,
+		AttributesHash, DiffFromFileID, rFilename,
+		MarkFileWithSameNameAsOldVersions);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::AddFileInternal(IOStream *,
+//			 const std::string *, int64_t, int64_t, int64_t,
+//			 int64_t, const BackupStoreFilename &, bool)
+//		Purpose: Private. Add a file to the store as AddFile()
+//			 does, either from a stream, or for a full file,
+//			 by moving a staged file into place, if it can be
+//			 moved without copying it.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreContext::AddFileInternal(IOStream *pFile,
+	const std::string *pStagedFilename, int64_t InDirectory,
+	int64_t ModificationTime, int64_t AttributesHash,
+	int64_t DiffFromFileID, const BackupStoreFilename &rFilename,
+	bool MarkFileWithSameNameAsOldVersions)
+{
+	ASSERT((pFile == NULL) != (pStagedFilename == NULL));
+	ASSERT(pStagedFilename == NULL || DiffFromFileID == 0);
+
 	if(mapStoreInfo.get() == 0)
 	{
 		THROW_EXCEPTION(BackupStoreException, StoreInfoNotLoaded)
@@ -516,19 +691,62 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 	bool reversedDiffIsCompletelyDifferent = false;
 	int64_t oldVersionNewBlocksUsed = 0;
 	BackupStoreInfo::Adjustment adjustment = {};
+	std::auto_ptr<RaidFileRead> apStagedFile;
+	bool moved = false;
 
 	try
 	{
 		RaidFileWrite storeFile(mStoreDiscSet, fn);
-		storeFile.Open(false /* no overwriting */);
+
+		if(pStagedFilename != NULL)
+		{
+			// It's already on disc, so check it where it is,
+			// and move it into place rather than writing it again
+			apStagedFile = RaidFileRead::Open(mStoreDiscSet,
+				*pStagedFilename);
+			if(!BackupStoreFile::VerifyEncodedFileFormat(*apStagedFile))
+			{
+				THROW_EXCEPTION(BackupStoreException, AddedFileDoesNotVerify)
+			}
+
+			// It would certainly take the account over its hard
+			// limit, so don't even move it
+			if(mapStoreInfo->GetBlocksUsed() +
+				apStagedFile->GetDiscUsageInBlocks() >
+				mapStoreInfo->GetBlocksHardLimit())
+			{
+				THROW_EXCEPTION(BackupStoreException, AddedFileExceedsStorageLimit)
+			}
+
+			apStagedFile.reset();
+			moved = storeFile.MoveFrom(*pStagedFilename,
+				BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+
+			if(!moved)
+			{
+				// It's on another disc, so copy it after all
+				apStagedFile = RaidFileRead::Open(mStoreDiscSet,
+					*pStagedFilename);
+				pFile = apStagedFile.get();
+			}
+		}
+
+		if(!moved)
+		{
+			storeFile.Open(false /* no overwriting */);
+		}
 
 		int64_t spaceSavedByConversionToPatch = 0;
 
 		// Diff or full file?
-		if(DiffFromFileID == 0)
+		if(moved)
+		{
+			// Already in place
+		}
+		else if(DiffFromFileID == 0)
 		{
 			// A full file, just store to disc
-			if(!rFile.CopyStreamTo(storeFile, BACKUP_STORE_TIMEOUT))
+			if(!pFile->CopyStreamTo(storeFile, BACKUP_STORE_TIMEOUT))
 			{
 				THROW_EXCEPTION(BackupStoreException, ReadFileFromStreamTimedOut)
 			}
@@ -541,94 +759,71 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 				THROW_EXCEPTION(BackupStoreException, DiffFromIDNotFoundInDirectory)
 			}
 
-			// Diff file, needs to be recreated.
-			// Choose a temporary filename.
-			std::string tempFn(RaidFileController::DiscSetPathToFileSystemPath(mStoreDiscSet, fn + ".difftemp",
-				1 /* NOT the same disc as the write file, to avoid using lots of space on the same disc unnecessarily */));
+			// Diff file, needs to be recreated. Its block index
+			// is at the end, so it has to be read in before
+			// anything can be done with it.
+			std::auto_ptr<IOStream> diff(SpoolDiff(*pFile,
+				RaidFileController::DiscSetPathToFileSystemPath(
+					mStoreDiscSet, fn + ".difftemp",
+					1 /* NOT the same disc as the write file, to avoid using lots of space on the same disc unnecessarily */)));
 
-			try
+			// Verify the diff
+			if(!BackupStoreFile::VerifyEncodedFileFormat(*diff))
 			{
-				// Open it twice
-#ifdef WIN32
-				InvisibleTempFileStream diff(tempFn.c_str(), 
-					O_RDWR | O_CREAT | O_BINARY);
-				InvisibleTempFileStream diff2(tempFn.c_str(), 
-					O_RDWR | O_BINARY);
-#else
-				FileStream diff(tempFn.c_str(), O_RDWR | O_CREAT | O_EXCL);
-				FileStream diff2(tempFn.c_str(), O_RDONLY);
-
-				// Unlink it immediately, so it definitely goes away
-				if(::unlink(tempFn.c_str()) != 0)
-				{
-					THROW_EXCEPTION(CommonException, OSFileError);
-				}
-#endif
-
-				// Stream the incoming diff to this temporary file
-				if(!rFile.CopyStreamTo(diff, BACKUP_STORE_TIMEOUT))
-				{
-					THROW_EXCEPTION(BackupStoreException, ReadFileFromStreamTimedOut)
-				}
-
-				// Verify the diff
-				diff.Seek(0, IOStream::SeekType_Absolute);
-				if(!BackupStoreFile::VerifyEncodedFileFormat(diff))
-				{
-					THROW_EXCEPTION(BackupStoreException, AddedFileDoesNotVerify)
-				}
-
-				// Seek to beginning of diff file
-				diff.Seek(0, IOStream::SeekType_Absolute);
-
-				// Filename of the old version
-				std::string oldVersionFilename;
-				MakeObjectFilename(DiffFromFileID, oldVersionFilename, false /* no need to make sure the directory it's in exists */);
-
-				// Reassemble that diff -- open previous file, and combine the patch and file
-				std::auto_ptr<RaidFileRead> from(RaidFileRead::Open(mStoreDiscSet, oldVersionFilename));
-				BackupStoreFile::CombineFile(diff, diff2, *from, storeFile);
-
-				// Then... reverse the patch back (open the from file again, and create a write file to overwrite it)
-				std::auto_ptr<RaidFileRead> from2(RaidFileRead::Open(mStoreDiscSet, oldVersionFilename));
-				ppreviousVerStoreFile = new RaidFileWrite(mStoreDiscSet, oldVersionFilename);
-				ppreviousVerStoreFile->Open(true /* allow overwriting */);
-				from->Seek(0, IOStream::SeekType_Absolute);
-				diff.Seek(0, IOStream::SeekType_Absolute);
-				BackupStoreFile::ReverseDiffFile(diff, *from, *from2, *ppreviousVerStoreFile,
-						DiffFromFileID, &reversedDiffIsCompletelyDifferent);
-
-				// Store disc space used
-				oldVersionNewBlocksUsed = ppreviousVerStoreFile->GetDiscUsageInBlocks();
-
-				// And make a space adjustment for the size calculation
-				spaceSavedByConversionToPatch =
-					from->GetDiscUsageInBlocks() - 
-					oldVersionNewBlocksUsed;
-
-				adjustment.mBlocksUsed -= spaceSavedByConversionToPatch;
-				// The code below will change the patch from a
-				// Current file to an Old file, so we need to
-				// account for it as a Current file here.
-				adjustment.mBlocksInCurrentFiles -=
-					spaceSavedByConversionToPatch;
-
-				// Don't adjust anything else here. We'll do it
-				// when we update the directory just below,
-				// which also accounts for non-diff replacements.
-
-				// Everything cleans up here...
-			}
-			catch(...)
-			{
-				// Be very paranoid about deleting this temp file -- we could only leave a zero byte file anyway
-				::unlink(tempFn.c_str());
-				throw;
+				THROW_EXCEPTION(BackupStoreException, AddedFileDoesNotVerify)
 			}
+			diff->Seek(0, IOStream::SeekType_Absolute);
+
+			// Filename of the old version. If it's been packed,
+			// the reversed patch is written to its own file
+			// instead, so make sure the directory exists.
+			std::string oldVersionFilename;
+			MakeObjectFilename(DiffFromFileID, oldVersionFilename, true /* make sure the directory it's in exists */);
+
+			// Reassemble that diff, and at the same time reverse
+			// the patch so that the old version can be rewritten
+			// as a patch against the new one. The old version is
+			// only read once.
+			int64_t oldVersionBlocksUsed = 0;
+			std::auto_ptr<IOStream> from(mapPackIndex->OpenObject(
+				DiffFromFileID, &oldVersionBlocksUsed));
+			ppreviousVerStoreFile = new RaidFileWrite(mStoreDiscSet, oldVersionFilename);
+			ppreviousVerStoreFile->Open(true /* allow overwriting */);
+			BackupStoreFile::CombineFileAndReverseDiff(*diff, *from,
+				storeFile, *ppreviousVerStoreFile, DiffFromFileID,
+				&reversedDiffIsCompletelyDifferent);
+
+			// Store disc space used
+			oldVersionNewBlocksUsed = ppreviousVerStoreFile->GetDiscUsageInBlocks();
+
+			// And make a space adjustment for the size calculation
+			spaceSavedByConversionToPatch =
+				oldVersionBlocksUsed -
+				oldVersionNewBlocksUsed;
+
+			adjustment.mBlocksUsed -= spaceSavedByConversionToPatch;
+			// The code below will change the patch from a
+			// Current file to an Old file, so we need to
+			// account for it as a Current file here.
+			adjustment.mBlocksInCurrentFiles -=
+				spaceSavedByConversionToPatch;
+
+			// Don't adjust anything else here. We'll do it
+			// when we update the directory just below,
+			// which also accounts for non-diff replacements.
 		}
 
 		// Get the blocks used
-		newObjectBlocksUsed = storeFile.GetDiscUsageInBlocks();
+		if(moved)
+		{
+			std::auto_ptr<RaidFileRead> movedFile(
+				RaidFileRead::Open(mStoreDiscSet, fn));
+			newObjectBlocksUsed = movedFile->GetDiscUsageInBlocks();
+		}
+		else
+		{
+			newObjectBlocksUsed = storeFile.GetDiscUsageInBlocks();
+		}
 		adjustment.mBlocksUsed += newObjectBlocksUsed;
 		adjustment.mBlocksInCurrentFiles += newObjectBlocksUsed;
 		adjustment.mNumCurrentFiles++;
@@ -643,10 +838,20 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 		}
 
 		// Commit the file
-		storeFile.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+		if(!moved)
+		{
+			storeFile.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+		}
 	}
 	catch(...)
 	{
+		// Don't leave a moved file behind
+		if(moved)
+		{
+			RaidFileWrite del(mStoreDiscSet, fn);
+			del.Delete();
+		}
+
 		// Delete any previous version store file
 		if(ppreviousVerStoreFile != 0)
 		{
@@ -657,10 +862,11 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 		throw;
 	}
 
-	// Verify the file -- only necessary for non-diffed versions
+	// Verify the file -- only necessary for non-diffed versions, and not
+	// for staged files moved into place, which were verified first.
 	// NOTE: No need to catch exceptions and delete ppreviousVerStoreFile, because
 	// in the non-diffed code path it's never allocated.
-	if(DiffFromFileID == 0)
+	if(DiffFromFileID == 0 && !moved)
 	{
 		std::auto_ptr<RaidFileRead> checkFile(RaidFileRead::Open(mStoreDiscSet, fn));
 		if(!BackupStoreFile::VerifyEncodedFileFormat(*checkFile))
@@ -743,6 +949,14 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 			ppreviousVerStoreFile->Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
 			delete ppreviousVerStoreFile;
 			ppreviousVerStoreFile = 0;
+
+			// If the old version was packed, the new file now
+			// replaces it, so drop the stale copy from the index.
+			mapPackIndex->Load();
+			if(mapPackIndex->Remove(DiffFromFileID))
+			{
+				mapPackIndex->Save();
+			}
 		}
 	}
 	catch(...)
@@ -782,15 +996,312 @@ int64_t BackupStoreContext::AddFile(IOStream &rFile, int64_t InDirectory,
 	// Increment reference count on the new directory to one
 	mapRefCount->AddReference(id);
 
-	// Save the store info -- can cope if this exceptions because infomation
-	// will be rebuilt by housekeeping, and ID allocation can recover.
-	SaveStoreInfo(false);
+	// Save the store info, or at least log the changes -- can cope if
+	// this exceptions because infomation will be rebuilt by housekeeping,
+	// and ID allocation can recover.
+	SaveStoreInfo();
 
 	// Return the ID to the caller
 	return id;
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::StartStaging()
+//		Purpose: Allow other sessions to stage files for this one,
+//			 which holds the write lock, to add later with
+//			 AddStagedFile(). Returns the ID which they must give
+//			 to StageFile(). Anything staged for this session is
+//			 deleted when it ends.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreContext::StartStaging()
+{
+	if(mReadOnly)
+	{
+		THROW_EXCEPTION(BackupStoreException, ContextIsReadOnly)
+	}
+
+	if(mStagingSessionID != 0)
+	{
+		return mStagingSessionID;
+	}
+
+	std::string dirName(mAccountRootDir + BACKUPSTORE_STAGING_DIRECTORY);
+	if(!RaidFileRead::DirectoryExists(mStoreDiscSet, dirName))
+	{
+		RaidFileWrite::CreateDirectory(mStoreDiscSet, dirName,
+			true /* recursive */);
+	}
+
+	// Random, so that a session which stages files for an earlier one
+	// can't mistake this one for it
+	int64_t id = 0;
+	while(id == 0)
+	{
+		Random::Generate(&id, sizeof(id));
+		id &= 0x7fffffffffffffffLL;
+	}
+
+	// Files are only staged while the marker exists
+	RaidFileWrite marker(mStoreDiscSet,
+		StoreStructure::MakeStagedFilename(mAccountRootDir, id));
+	marker.Open(false /* no overwriting */);
+	marker.Commit(false /* not worth converting to raid */);
+
+	mStagingSessionID = id;
+	return id;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::EndStaging()
+//		Purpose: Delete anything staged for this session which
+//			 hasn't been added, and stop other sessions staging
+//			 any more.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void BackupStoreContext::EndStaging()
+{
+	if(mStagingSessionID == 0)
+	{
+		return;
+	}
+
+	int64_t id = mStagingSessionID;
+	mStagingSessionID = 0;
+	StoreStructure::DeleteStagedFiles(mAccountRootDir, mStoreDiscSet, id);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::GetStagedBlocksUsed()
+//		Purpose: Private. Returns the disc space used by files
+//			 staged for any session, which will soon be added.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreContext::GetStagedBlocksUsed()
+{
+	std::string dirName(mAccountRootDir + BACKUPSTORE_STAGING_DIRECTORY);
+	if(!RaidFileRead::DirectoryExists(mStoreDiscSet, dirName))
+	{
+		return 0;
+	}
+
+	std::vector<std::string> files;
+	RaidFileRead::ReadDirectoryContents(mStoreDiscSet, dirName,
+		RaidFileRead::DirReadType_FilesOnly, files);
+
+	int64_t blocks = 0;
+	for(std::vector<std::string>::const_iterator i(files.begin());
+		i != files.end(); ++i)
+	{
+		if((*i)[0] != 's')
+		{
+			// Not a staged file
+			continue;
+		}
+
+		try
+		{
+			std::auto_ptr<RaidFileRead> file(RaidFileRead::Open(
+				mStoreDiscSet, dirName + DIRECTORY_SEPARATOR + *i));
+			blocks += file->GetDiscUsageInBlocks();
+		}
+		catch(RaidFileException &e)
+		{
+			// Added or deleted since the directory was read
+		}
+	}
+
+	return blocks;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::StageFile(IOStream &, int64_t,
+//			 int64_t)
+//		Purpose: Keep an encoded file sent by this session, which
+//			 needn't hold the write lock, for the session which
+//			 does to add later with AddStagedFile(). Returns the
+//			 ID to give it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreContext::StageFile(IOStream &rFile,
+	int64_t StagingSessionID, int64_t InDirectory)
+{
+	if(mapStoreInfo.get() == 0)
+	{
+		THROW_EXCEPTION(BackupStoreException, StoreInfoNotLoaded)
+	}
+
+	// It could never be added unless the session is still going
+	std::string markerName(StoreStructure::MakeStagedFilename(
+		mAccountRootDir, StagingSessionID));
+	if(StagingSessionID <= 0 ||
+		!RaidFileRead::FileExists(mStoreDiscSet, markerName))
+	{
+		THROW_EXCEPTION_MESSAGE(BackupStoreException,
+			ObjectDoesNotExist, "Staging session " <<
+			BOX_FORMAT_OBJECTID(StagingSessionID) << " has ended");
+	}
+
+	// Or if the directory doesn't exist
+	if(!ObjectExists(InDirectory, ObjectExists_Directory))
+	{
+		THROW_EXCEPTION(BackupStoreException, ObjectDoesNotExist)
+	}
+
+	// Everything staged will soon be added, so it counts towards the
+	// hard limit
+	int64_t blocksAvailable = mapStoreInfo->GetBlocksHardLimit() -
+		mapStoreInfo->GetBlocksUsed() - GetStagedBlocksUsed();
+
+	// Random, so that sessions don't need to agree on them
+	int64_t id = 0;
+	while(id == 0)
+	{
+		Random::Generate(&id, sizeof(id));
+		id &= 0x7fffffffffffffffLL;
+	}
+
+	std::string stagedFilename(StoreStructure::MakeStagedFilename(
+		mAccountRootDir, StagingSessionID, id));
+	RaidFileWrite stagedFile(mStoreDiscSet, stagedFilename);
+	stagedFile.Open(false /* no overwriting */);
+
+	// Check the limit as the file arrives, rather than writing all of
+	// a file which is too big to disc first
+	MemoryBlockGuard<char*> buffer(STAGE_FILE_BUFFER_SIZE);
+	while(rFile.StreamDataLeft())
+	{
+		int bytes = rFile.Read(buffer, STAGE_FILE_BUFFER_SIZE,
+			BACKUP_STORE_TIMEOUT);
+		if(bytes == 0 && rFile.StreamDataLeft())
+		{
+			THROW_EXCEPTION(BackupStoreException, ReadFileFromStreamTimedOut)
+		}
+
+		if(bytes != 0)
+		{
+			stagedFile.Write(buffer, bytes);
+		}
+
+		if(stagedFile.GetDiscUsageInBlocks() > blocksAvailable)
+		{
+			// Deleted automatically by the RaidFile object, and
+			// the rest of the stream is thrown away
+			THROW_EXCEPTION(BackupStoreException, AddedFileExceedsStorageLimit)
+		}
+	}
+
+	stagedFile.Commit(false /* not worth converting to raid */);
+
+	// The session may have ended while the file was arriving, and
+	// deleted its files before this one was there to be deleted
+	if(!RaidFileRead::FileExists(mStoreDiscSet, markerName))
+	{
+		if(RaidFileRead::FileExists(mStoreDiscSet, stagedFilename))
+		{
+			RaidFileWrite del(mStoreDiscSet, stagedFilename);
+			del.Delete();
+		}
+
+		THROW_EXCEPTION_MESSAGE(BackupStoreException,
+			ObjectDoesNotExist, "Staging session " <<
+			BOX_FORMAT_OBJECTID(StagingSessionID) << " has ended");
+	}
+
+	return id;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreContext::AddStagedFile(int64_t, int64_t,
+//			 int64_t, int64_t, int64_t,
+//			 const BackupStoreFilename &)
+//		Purpose: Add a file staged for this session to the store,
+//			 as AddFile() does. The staged file is deleted,
+//			 whether or not it was added. Returns the new object
+//			 ID.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t BackupStoreContext::AddStagedFile(int64_t StagedFileID,
+	int64_t InDirectory, int64_t ModificationTime, int64_t AttributesHash,
+	int64_t DiffFromFileID, const BackupStoreFilename &rFilename)
+{
+	if(mReadOnly)
+	{
+		THROW_EXCEPTION(BackupStoreException, ContextIsReadOnly)
+	}
+
+	std::string stagedFilename(StoreStructure::MakeStagedFilename(
+		mAccountRootDir, mStagingSessionID, StagedFileID));
+	if(mStagingSessionID == 0 || StagedFileID <= 0 ||
+		!RaidFileRead::FileExists(mStoreDiscSet, stagedFilename))
+	{
+		THROW_EXCEPTION(BackupStoreException, ObjectDoesNotExist)
+	}
+
+	int64_t id = 0;
+	try
+	{
+		if(DiffFromFileID == 0)
+		{
+			id = AddFileInternal(NULL, &stagedFilename, InDirectory,
+				ModificationTime, AttributesHash,
+				DiffFromFileID, rFilename,
+				true /* mark files with same name as old versions */);
+		}
+		else
+		{
+			// A diff must be combined with the old version, so
+			// it's read like any other upload
+			std::auto_ptr<RaidFileRead> stagedFile(
+				RaidFileRead::Open(mStoreDiscSet,
+					stagedFilename));
+			id = AddFileInternal(stagedFile.get(), NULL,
+				InDirectory, ModificationTime, AttributesHash,
+				DiffFromFileID, rFilename,
+				true /* mark files with same name as old versions */);
+		}
+	}
+	catch(...)
+	{
+		if(RaidFileRead::FileExists(mStoreDiscSet, stagedFilename))
+		{
+			RaidFileWrite del(mStoreDiscSet, stagedFilename);
+			del.Delete();
+		}
+		throw;
+	}
+
+	// Unless it was moved into place
+	if(RaidFileRead::FileExists(mStoreDiscSet, stagedFilename))
+	{
+		RaidFileWrite del(mStoreDiscSet, stagedFilename);
+		del.Delete();
+	}
+
+	return id;
+}
+
+
 
 // --------------------------------------------------------------------------
 //
@@ -873,7 +1384,7 @@ bool BackupStoreContext::DeleteFile(const BackupStoreFilename &rFilename, int64_
 		{
 			// Save the directory back
 			SaveDirectory(dir);
-			SaveStoreInfo(false);
+			SaveStoreInfo();
 		}
 	}
 	catch(...)
@@ -1007,6 +1518,12 @@ void BackupStoreContext::SaveDirectory(BackupStoreDirectory &rDir)
 
 	int64_t ObjectID = rDir.GetObjectID();
 
+	// Tell housekeeping to look at this directory, before changing it
+	if(mapDirtyDirectories.get())
+	{
+		mapDirtyDirectories->Add(ObjectID);
+	}
+
 	try
 	{
 		// Write to disc, adjust size in store info
@@ -1201,9 +1718,9 @@ int64_t BackupStoreContext::AddDirectory(int64_t InDirectory,
 		throw;
 	}
 
-	// Save the store info (may not be postponed)
+	// Save the store info (the change is logged if postponed)
 	mapStoreInfo->AdjustNumDirectories(1);
-	SaveStoreInfo(false);
+	SaveStoreInfo();
 
 	// tell caller what the ID was
 	return id;
@@ -1278,7 +1795,7 @@ void BackupStoreContext::DeleteDirectory(int64_t ObjectID, bool Undelete)
 		}
 
 		// Update blocks deleted count
-		SaveStoreInfo(false);
+		SaveStoreInfo();
 	}
 	catch(...)
 	{
@@ -1526,12 +2043,10 @@ bool BackupStoreContext::ObjectExists(int64_t ObjectID, int MustBe)
 		return false;
 	}
 
-	// Test to see if it exists on the disc
-	std::string filename;
-	MakeObjectFilename(ObjectID, filename);
-	if(!RaidFileRead::FileExists(mStoreDiscSet, filename))
+	// Test to see if it exists on the disc, or in a pack
+	if(!mapPackIndex->ObjectExists(ObjectID))
 	{
-		// RaidFile reports no file there
+		// No file there
 		return false;
 	}
 
@@ -1539,7 +2054,7 @@ bool BackupStoreContext::ObjectExists(int64_t ObjectID, int MustBe)
 	if(MustBe != ObjectExists_Anything)
 	{
 		// Open the file
-		std::auto_ptr<RaidFileRead> objectFile(RaidFileRead::Open(mStoreDiscSet, filename));
+		std::auto_ptr<IOStream> objectFile(mapPackIndex->OpenObject(ObjectID));
 
 		// Read the first integer
 		uint32_t magic;
@@ -1588,10 +2103,8 @@ std::auto_ptr<IOStream> BackupStoreContext::OpenObject(int64_t ObjectID)
 		THROW_EXCEPTION(BackupStoreException, StoreInfoNotLoaded)
 	}
 
-	// Attempt to open the file
-	std::string fn;
-	MakeObjectFilename(ObjectID, fn);
-	return std::auto_ptr<IOStream>(RaidFileRead::Open(mStoreDiscSet, fn).release());
+	// Attempt to open the file, which may have been packed
+	return mapPackIndex->OpenObject(ObjectID);
 }
 
 
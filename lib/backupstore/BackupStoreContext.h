@@ -15,7 +15,9 @@
 #include <memory>
 
 #include "autogen_BackupProtocol.h"
+#include "BackupStoreDirtyDirectoryLog.h"
 #include "BackupStoreInfo.h"
+#include "BackupStorePackIndex.h"
 #include "BackupStoreRefCountDatabase.h"
 #include "NamedLock.h"
 #include "Message.h"
@@ -23,6 +25,7 @@
 
 class BackupStoreDirectory;
 class BackupStoreFilename;
+class BackupStoreSharedAccountState;
 class IOStream;
 class BackupProtocolMessage;
 class StreamableMemBlock;
@@ -97,6 +100,12 @@ public:
 
 	void SetClientHasAccount(const std::string &rStoreRoot, int StoreDiscSet) {mClientHasAccount = true; mAccountRootDir = rStoreRoot; mStoreDiscSet = StoreDiscSet;}
 	bool GetClientHasAccount() const {return mClientHasAccount;}
+	// Load the store info from, and publish changes to, memory shared
+	// with other connections and housekeeping
+	void SetSharedAccountState(BackupStoreSharedAccountState &rState)
+	{
+		mpSharedAccountState = &rState;
+	}
 	const std::string &GetAccountRoot() const {return mAccountRootDir;}
 	int GetStoreDiscSet() const {return mStoreDiscSet;}
 
@@ -160,6 +169,19 @@ public:
 	void DeleteDirectory(int64_t ObjectID, bool Undelete = false);
 	void MoveObject(int64_t ObjectID, int64_t MoveFromDirectory, int64_t MoveToDirectory, const BackupStoreFilename &rNewFilename, bool MoveAllWithSameName, bool AllowMoveOverDeletedObject);
 
+	// Files uploaded by other sessions, waiting to be added by the one
+	// holding the write lock
+	int64_t StartStaging();
+	int64_t StageFile(IOStream &rFile, int64_t StagingSessionID,
+		int64_t InDirectory);
+	int64_t AddStagedFile(int64_t StagedFileID,
+		int64_t InDirectory,
+		int64_t ModificationTime,
+		int64_t AttributesHash,
+		int64_t DiffFromFileID,
+		const BackupStoreFilename &rFilename);
+	void EndStaging();
+
 	// Manipulating objects
 	enum
 	{
@@ -176,6 +198,15 @@ public:
 
 private:
 	void MakeObjectFilename(int64_t ObjectID, std::string &rOutput, bool EnsureDirectoryExists = false);
+	int64_t AddFileInternal(IOStream *pFile,
+		const std::string *pStagedFilename,
+		int64_t InDirectory,
+		int64_t ModificationTime,
+		int64_t AttributesHash,
+		int64_t DiffFromFileID,
+		const BackupStoreFilename &rFilename,
+		bool MarkFileWithSameNameAsOldVersions);
+	int64_t GetStagedBlocksUsed();
 	BackupStoreDirectory &GetDirectoryInternal(int64_t ObjectID,
 		bool AllowFlushCache = true);
 	void SaveDirectory(BackupStoreDirectory &rDir);
@@ -187,6 +218,7 @@ private:
 	std::string mConnectionDetails;
 	int32_t mClientID;
 	HousekeepingInterface *mpHousekeeping;
+	BackupStoreSharedAccountState *mpSharedAccountState;
 	int mProtocolPhase;
 	bool mClientHasAccount;
 	std::string mAccountRootDir;	// has final directory separator
@@ -194,6 +226,8 @@ private:
 
 	bool mReadOnly;
 	NamedLock mWriteLock;
+	// Other sessions can stage files for this one while it's nonzero
+	int64_t mStagingSessionID;
 	int mSaveStoreInfoDelay; // how many times to delay saving the store info
 
 	// Store info
@@ -202,6 +236,12 @@ private:
 	// Refcount database
 	std::auto_ptr<BackupStoreRefCountDatabase> mapRefCount;
 
+	// Objects which housekeeping has moved into pack files
+	std::auto_ptr<BackupStorePackIndex> mapPackIndex;
+
+	// Directories changed in this session, for housekeeping
+	std::auto_ptr<BackupStoreDirtyDirectoryLog> mapDirtyDirectories;
+
 	// Directory cache
 	std::map<int64_t, BackupStoreDirectory*> mDirectoryCache;
 
@@ -0,0 +1,236 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreDirtyDirectoryLog.cpp
+//		Purpose: Log of the directories changed by clients since the
+//			 last housekeeping run
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "BackupStoreDirtyDirectoryLog.h"
+#include "CommonException.h"
+#include "FileStream.h"
+#include "RaidFileController.h"
+#include "RaidFileUtil.h"
+#include "Utils.h"
+
+#include "MemLeakFindOn.h"
+
+#define DIRTY_LOG_MAGIC_VALUE	0x44697274 // Dirt
+#define DIRTY_LOG_FILENAME	"dirty.log"
+
+// Magic value, unused, time of the last full scan
+#define DIRTY_LOG_HEADER_SIZE	(4 + 4 + 8)
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::BackupStoreDirtyDirectoryLog(
+//			 const std::string &, int)
+//		Purpose: Constructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreDirtyDirectoryLog::BackupStoreDirtyDirectoryLog(
+	const std::string &rStoreRoot, int DiscSet)
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(DiscSet));
+	mFilename = RaidFileUtil::MakeWriteFileName(rdiscSet,
+		rStoreRoot + DIRTY_LOG_FILENAME);
+	mExists = FileExists(mFilename);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::~BackupStoreDirtyDirectoryLog()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreDirtyDirectoryLog::~BackupStoreDirtyDirectoryLog()
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::Add(int64_t)
+//		Purpose: Record that a directory is about to be changed. Must
+//			 be called before the change is written, so that a
+//			 crash can't leave a change which isn't logged. If the
+//			 log can't be written, it's deleted instead, so that
+//			 housekeeping scans everything next time.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDirtyDirectoryLog::Add(int64_t DirectoryID)
+{
+	if(!mExists || mAdded.find(DirectoryID) != mAdded.end())
+	{
+		return;
+	}
+
+	try
+	{
+		if(!mapAppendFile.get())
+		{
+			mapAppendFile.reset(new FileStream(mFilename,
+				O_WRONLY | O_APPEND | O_BINARY));
+		}
+
+		int64_t id = box_hton64(DirectoryID);
+		mapAppendFile->Write(&id, sizeof(id));
+		mAdded.insert(DirectoryID);
+	}
+	catch(BoxException &e)
+	{
+		BOX_WARNING("Failed to add directory " <<
+			BOX_FORMAT_OBJECTID(DirectoryID) << " to " <<
+			mFilename << ", housekeeping will scan the whole "
+			"account: " << e.what());
+		mapAppendFile.reset();
+		Delete();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::Read(std::set<int64_t> &,
+//			 box_time_t &)
+//		Purpose: Read the IDs of the directories changed since the
+//			 log was last reset, and the time of the last full
+//			 scan. Returns false if there's no usable log, in
+//			 which case everything must be scanned.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreDirtyDirectoryLog::Read(std::set<int64_t> &rDirectoriesOut,
+	box_time_t &rLastFullScanOut)
+{
+	int64_t fileSize = 0;
+	if(!FileExists(mFilename, &fileSize))
+	{
+		return false;
+	}
+
+	if(fileSize < DIRTY_LOG_HEADER_SIZE ||
+		((fileSize - DIRTY_LOG_HEADER_SIZE) % sizeof(int64_t)) != 0)
+	{
+		BOX_WARNING("Ignoring damaged dirty directory log: " <<
+			mFilename);
+		return false;
+	}
+
+	FileStream file(mFilename);
+	std::vector<uint8_t> data(fileSize);
+	if(!file.ReadFullBuffer(&data[0], fileSize, 0))
+	{
+		THROW_FILE_ERROR("Failed to read dirty directory log",
+			mFilename, CommonException, OSFileReadError);
+	}
+
+	int32_t magic;
+	::memcpy(&magic, &data[0], sizeof(magic));
+	if(ntohl(magic) != DIRTY_LOG_MAGIC_VALUE)
+	{
+		BOX_WARNING("Ignoring dirty directory log with bad magic "
+			"value: " << mFilename);
+		return false;
+	}
+
+	int64_t lastFullScan;
+	::memcpy(&lastFullScan, &data[8], sizeof(lastFullScan));
+	rLastFullScanOut = box_ntoh64(lastFullScan);
+
+	rDirectoriesOut.clear();
+	for(int64_t pos = DIRTY_LOG_HEADER_SIZE; pos < fileSize;
+		pos += sizeof(int64_t))
+	{
+		int64_t id;
+		::memcpy(&id, &data[pos], sizeof(id));
+		rDirectoriesOut.insert(box_ntoh64(id));
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::Reset(box_time_t)
+//		Purpose: Replace the log with an empty one, once everything
+//			 listed in it has been dealt with, recording the time
+//			 of the last full scan.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDirtyDirectoryLog::Reset(box_time_t LastFullScan)
+{
+	mapAppendFile.reset();
+	mAdded.clear();
+
+	uint8_t header[DIRTY_LOG_HEADER_SIZE];
+	::memset(header, 0, sizeof(header));
+	int32_t magic = htonl(DIRTY_LOG_MAGIC_VALUE);
+	::memcpy(&header[0], &magic, sizeof(magic));
+	int64_t lastFullScan = box_hton64(LastFullScan);
+	::memcpy(&header[8], &lastFullScan, sizeof(lastFullScan));
+
+	std::string tempFilename(mFilename + "X");
+	{
+		FileStream file(tempFilename,
+			O_WRONLY | O_CREAT | O_TRUNC | O_BINARY);
+		file.Write(header, sizeof(header));
+	}
+
+	#ifdef WIN32
+	if(FileExists(mFilename) && EMU_UNLINK(mFilename.c_str()) != 0)
+	{
+		THROW_EMU_FILE_ERROR("Failed to delete old dirty directory "
+			"log", mFilename, CommonException, OSFileError);
+	}
+	#endif
+
+	if(::rename(tempFilename.c_str(), mFilename.c_str()) != 0)
+	{
+		THROW_EMU_ERROR("Failed to rename dirty directory log from " <<
+			tempFilename << " to " << mFilename, CommonException,
+			OSFileError);
+	}
+
+	mExists = true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDirtyDirectoryLog::Delete()
+//		Purpose: Remove the log, so that housekeeping scans the whole
+//			 account next time. Used when directories might have
+//			 been changed without being logged.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDirtyDirectoryLog::Delete()
+{
+	mapAppendFile.reset();
+	mAdded.clear();
+
+	if(FileExists(mFilename) && EMU_UNLINK(mFilename.c_str()) != 0)
+	{
+		BOX_LOG_SYS_ERROR("Failed to delete dirty directory log: " <<
+			mFilename);
+	}
+
+	mExists = false;
+}
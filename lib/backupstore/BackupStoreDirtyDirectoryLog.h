@@ -0,0 +1,69 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreDirtyDirectoryLog.h
+//		Purpose: Log of the directories changed by clients since the
+//			 last housekeeping run
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPSTOREDIRTYDIRECTORYLOG__H
+#define BACKUPSTOREDIRTYDIRECTORYLOG__H
+
+#include <memory>
+#include <set>
+#include <string>
+
+#include "BoxTime.h"
+
+class FileStream;
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupStoreDirtyDirectoryLog
+//		Purpose: A file next to the reference count database listing
+//			 the IDs of directories which have been written since
+//			 housekeeping last looked at them, so that it can skip
+//			 the rest of the account. Housekeeping creates it after
+//			 a full scan, and client connections only append to
+//			 it if it exists, so a missing or damaged log means
+//			 that everything must be scanned. Only the holder of
+//			 the account's write lock may use it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupStoreDirtyDirectoryLog
+{
+public:
+	BackupStoreDirtyDirectoryLog(const std::string &rStoreRoot, int DiscSet);
+	~BackupStoreDirtyDirectoryLog();
+private:
+	// no copying
+	BackupStoreDirtyDirectoryLog(const BackupStoreDirtyDirectoryLog &);
+	BackupStoreDirtyDirectoryLog &operator=(
+		const BackupStoreDirtyDirectoryLog &);
+public:
+
+	bool Exists() const {return mExists;}
+
+	// Used by client connections, before changing a directory
+	void Add(int64_t DirectoryID);
+
+	// Used by housekeeping
+	bool Read(std::set<int64_t> &rDirectoriesOut,
+		box_time_t &rLastFullScanOut);
+	void Reset(box_time_t LastFullScan);
+	void Delete();
+
+	const std::string &GetFilename() const {return mFilename;}
+
+private:
+	std::string mFilename;
+	bool mExists;
+	std::auto_ptr<FileStream> mapAppendFile;
+	std::set<int64_t> mAdded;
+};
+
+#endif // BACKUPSTOREDIRTYDIRECTORYLOG__H
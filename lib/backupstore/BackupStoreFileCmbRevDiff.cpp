@@ -0,0 +1,291 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreFileCmbRevDiff.cpp
+//		Purpose: Rebuild a patched file and reverse the patch in one pass
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <vector>
+
+#include "BackupStoreFile.h"
+#include "BackupStoreFileWire.h"
+#include "BackupStoreObjectMagic.h"
+#include "BackupStoreException.h"
+#include "BackupStoreConstants.h"
+#include "BackupStoreFilename.h"
+#include "Guards.h"
+
+#include "MemLeakFindOn.h"
+
+// Size of the buffer used to copy blocks, so that memory use doesn't
+// depend on the block size of the file
+#define COPY_BUFFER_SIZE	(64*1024)
+
+static void ReadBlockIndex(IOStream &rStream, int64_t NumBlocks,
+	file_BlockIndexHeader &rHeaderOut,
+	std::vector<file_BlockIndexEntry> &rEntriesOut);
+static void CopyBlock(IOStream &rFrom, IOStream &rOut, int64_t Size,
+	char *pBuffer);
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreFile::CombineFileAndReverseDiff(IOStream &,
+//			 IOStream &, IOStream &, IOStream &, int64_t, bool *)
+//		Purpose: Does the work of CombineFile() and ReverseDiffFile()
+//			 together. rDiff is a patch against rFrom, which are
+//			 both read only once, and must both be seekable. The
+//			 complete new file is written to rOut, and a patch
+//			 which recreates rFrom from it to rReversedOut. Only
+//			 the block indexes of the two files are held in memory.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreFile::CombineFileAndReverseDiff(IOStream &rDiff,
+	IOStream &rFrom, IOStream &rOut, IOStream &rReversedOut,
+	int64_t ObjectIDOfFrom, bool *pIsCompletelyDifferent)
+{
+	// Read and copy the header of the diff to the new file
+	file_StreamFormat hdr;
+	if(!rDiff.ReadFullBuffer(&hdr, sizeof(hdr), 0))
+	{
+		THROW_EXCEPTION(BackupStoreException, FailedToReadBlockOnCombine)
+	}
+	if(ntohl(hdr.mMagicValue) != OBJECTMAGIC_FILE_MAGIC_VALUE_V1)
+	{
+		THROW_EXCEPTION(BackupStoreException, BadBackupStoreFile)
+	}
+	rOut.Write(&hdr, sizeof(hdr));
+	// BLOCK
+	{
+		BackupStoreFilename filename;
+		filename.ReadFromStream(rDiff, IOStream::TimeOutInfinite);
+		filename.WriteToStream(rOut);
+		StreamableMemBlock attr;
+		attr.ReadFromStream(rDiff, IOStream::TimeOutInfinite);
+		attr.WriteToStream(rOut);
+	}
+	int64_t diffDataPosition = rDiff.GetPosition();
+
+	// And the header of the from file to the reversed patch
+	file_StreamFormat fromHdr;
+	if(!rFrom.ReadFullBuffer(&fromHdr, sizeof(fromHdr), 0))
+	{
+		THROW_EXCEPTION(BackupStoreException, FailedToReadBlockOnCombine)
+	}
+	if(ntohl(fromHdr.mMagicValue) != OBJECTMAGIC_FILE_MAGIC_VALUE_V1)
+	{
+		THROW_EXCEPTION(BackupStoreException, BadBackupStoreFile)
+	}
+	rReversedOut.Write(&fromHdr, sizeof(fromHdr));
+	// BLOCK
+	{
+		BackupStoreFilename filename;
+		filename.ReadFromStream(rFrom, IOStream::TimeOutInfinite);
+		filename.WriteToStream(rReversedOut);
+		StreamableMemBlock attr;
+		attr.ReadFromStream(rFrom, IOStream::TimeOutInfinite);
+		attr.WriteToStream(rReversedOut);
+	}
+	int64_t fromDataPosition = rFrom.GetPosition();
+
+	// Load both indexes
+	int64_t diffNumBlocks = box_ntoh64(hdr.mNumBlocks);
+	int64_t fromNumBlocks = box_ntoh64(fromHdr.mNumBlocks);
+	file_BlockIndexHeader diffIdxHdr, fromIdxHdr;
+	std::vector<file_BlockIndexEntry> diffIndex, fromIndex;
+	ReadBlockIndex(rDiff, diffNumBlocks, diffIdxHdr, diffIndex);
+	ReadBlockIndex(rFrom, fromNumBlocks, fromIdxHdr, fromIndex);
+	if(box_ntoh64(fromIdxHdr.mOtherFileID) != 0)
+	{
+		// Can only patch against complete files
+		THROW_EXCEPTION(BackupStoreException, BadBackupStoreFile)
+	}
+
+	// Work out where each block of the from file is, with an extra entry
+	// so that the size of the last block can be calculated.
+	std::vector<int64_t> fromPositions(fromNumBlocks + 1);
+	fromPositions[0] = fromDataPosition;
+	for(int64_t b = 0; b < fromNumBlocks; ++b)
+	{
+		int64_t encodedSize = box_ntoh64(fromIndex[b].mEncodedSize);
+		if(encodedSize <= 0)
+		{
+			THROW_EXCEPTION(BackupStoreException, OnCombineFromFileIsIncomplete)
+		}
+		fromPositions[b + 1] = fromPositions[b] + encodedSize;
+	}
+
+	// For each block in the from file, which block of the new file it
+	// became, as -1 - index, or 0 if it's not used by the new file.
+	std::vector<int64_t> fromUsedBy(fromNumBlocks, 0);
+	for(int64_t b = 0; b < diffNumBlocks; ++b)
+	{
+		int64_t encodedSize = box_ntoh64(diffIndex[b].mEncodedSize);
+		if(encodedSize <= 0)
+		{
+			int64_t fromBlock = 0 - encodedSize;
+			if(fromBlock >= fromNumBlocks)
+			{
+				THROW_EXCEPTION(BackupStoreException, IncompatibleFromAndDiffFiles)
+			}
+			fromUsedBy[fromBlock] = -1 - b;
+		}
+	}
+
+	MemoryBlockGuard<char*> buffer(COPY_BUFFER_SIZE);
+
+	// Write the data of the new file, taking blocks in turn from the
+	// diff or the from file.
+	rDiff.Seek(diffDataPosition, IOStream::SeekType_Absolute);
+	int64_t fromPosition = -1;
+	for(int64_t b = 0; b < diffNumBlocks; ++b)
+	{
+		int64_t encodedSize = box_ntoh64(diffIndex[b].mEncodedSize);
+		if(encodedSize > 0)
+		{
+			CopyBlock(rDiff, rOut, encodedSize, buffer);
+		}
+		else
+		{
+			int64_t fromBlock = 0 - encodedSize;
+			int64_t blockSize = fromPositions[fromBlock + 1] -
+				fromPositions[fromBlock];
+			if(fromPosition != fromPositions[fromBlock])
+			{
+				rFrom.Seek(fromPositions[fromBlock],
+					IOStream::SeekType_Absolute);
+			}
+			CopyBlock(rFrom, rOut, blockSize, buffer);
+			fromPosition = fromPositions[fromBlock] + blockSize;
+
+			// Fill in the real size for the new index
+			diffIndex[b].mEncodedSize = box_hton64(blockSize);
+		}
+	}
+
+	// Then its index, which no longer refers to any other file
+	diffIdxHdr.mOtherFileID = box_hton64(0);
+	rOut.Write(&diffIdxHdr, sizeof(diffIdxHdr));
+	if(diffNumBlocks > 0)
+	{
+		rOut.Write(&diffIndex[0],
+			diffNumBlocks * sizeof(file_BlockIndexEntry));
+	}
+
+	// Write the data of the reversed patch, which is the blocks of the
+	// from file which aren't used by the new file. None of these have
+	// been read yet.
+	bool isCompletelyDifferent = true;
+	for(int64_t b = 0; b < fromNumBlocks; ++b)
+	{
+		if(fromUsedBy[b] == 0)
+		{
+			int64_t blockSize = fromPositions[b + 1] -
+				fromPositions[b];
+			if(fromPosition != fromPositions[b])
+			{
+				rFrom.Seek(fromPositions[b],
+					IOStream::SeekType_Absolute);
+			}
+			CopyBlock(rFrom, rReversedOut, blockSize, buffer);
+			fromPosition = fromPositions[b + 1];
+		}
+		else
+		{
+			// Adjust to reflect real block index (0 has a
+			// different meaning in fromUsedBy)
+			fromIndex[b].mEncodedSize = box_hton64(fromUsedBy[b] + 1);
+			isCompletelyDifferent = false;
+		}
+	}
+
+	// And its index
+	fromIdxHdr.mOtherFileID = isCompletelyDifferent ? 0 :
+		box_hton64(ObjectIDOfFrom);
+	rReversedOut.Write(&fromIdxHdr, sizeof(fromIdxHdr));
+	if(fromNumBlocks > 0)
+	{
+		rReversedOut.Write(&fromIndex[0],
+			fromNumBlocks * sizeof(file_BlockIndexEntry));
+	}
+
+	if(pIsCompletelyDifferent != 0)
+	{
+		*pIsCompletelyDifferent = isCompletelyDifferent;
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static ReadBlockIndex(IOStream &, int64_t,
+//			 file_BlockIndexHeader &,
+//			 std::vector<file_BlockIndexEntry> &)
+//		Purpose: Static. Read the whole block index from the end of
+//			 a file.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void ReadBlockIndex(IOStream &rStream, int64_t NumBlocks,
+	file_BlockIndexHeader &rHeaderOut,
+	std::vector<file_BlockIndexEntry> &rEntriesOut)
+{
+	if(NumBlocks < 0)
+	{
+		THROW_EXCEPTION(BackupStoreException, BadBackupStoreFile)
+	}
+
+	rStream.Seek(0 - ((NumBlocks * sizeof(file_BlockIndexEntry)) +
+		sizeof(file_BlockIndexHeader)), IOStream::SeekType_End);
+
+	if(!rStream.ReadFullBuffer(&rHeaderOut, sizeof(rHeaderOut), 0))
+	{
+		THROW_EXCEPTION(BackupStoreException, FailedToReadBlockOnCombine)
+	}
+	if(ntohl(rHeaderOut.mMagicValue) != OBJECTMAGIC_FILE_BLOCKS_MAGIC_VALUE_V1
+		|| (int64_t)box_ntoh64(rHeaderOut.mNumBlocks) != NumBlocks)
+	{
+		THROW_EXCEPTION(BackupStoreException, BadBackupStoreFile)
+	}
+
+	rEntriesOut.resize(NumBlocks);
+	for(int64_t b = 0; b < NumBlocks; ++b)
+	{
+		if(!rStream.ReadFullBuffer(&rEntriesOut[b],
+			sizeof(file_BlockIndexEntry), 0))
+		{
+			THROW_EXCEPTION(BackupStoreException, FailedToReadBlockOnCombine)
+		}
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static CopyBlock(IOStream &, IOStream &, int64_t, char *)
+//		Purpose: Static. Copy Size bytes from the current position of
+//			 rFrom to rOut, through a buffer of COPY_BUFFER_SIZE.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void CopyBlock(IOStream &rFrom, IOStream &rOut, int64_t Size,
+	char *pBuffer)
+{
+	while(Size > 0)
+	{
+		int bytes = (Size > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : Size;
+		if(!rFrom.ReadFullBuffer(pBuffer, bytes, 0))
+		{
+			THROW_EXCEPTION(BackupStoreException, FailedToReadBlockOnCombine)
+		}
+		rOut.Write(pBuffer, bytes);
+		Size -= bytes;
+	}
+}
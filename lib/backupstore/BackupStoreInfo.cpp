@@ -14,6 +14,7 @@
 #include "Archive.h"
 #include "BackupStoreInfo.h"
 #include "BackupStoreException.h"
+#include "BackupStoreUsageLog.h"
 #include "RaidFileWrite.h"
 #include "RaidFileRead.h"
 
@@ -51,7 +52,8 @@ BackupStoreInfo::BackupStoreInfo()
   mNumOldFiles(0),
   mNumDeletedFiles(0),
   mNumDirectories(0),
-  mAccountEnabled(true)
+  mAccountEnabled(true),
+  mLoggedValues()
 {
 }
 
@@ -114,7 +116,8 @@ BackupStoreInfo::BackupStoreInfo(int32_t AccountID, const std::string &FileName,
   mNumOldFiles(0),
   mNumDeletedFiles(0),
   mNumDirectories(0),
-  mAccountEnabled(true)
+  mAccountEnabled(true),
+  mLoggedValues()
 {
 	mExtraData.SetForReading(); // extra data is empty in this case
 }
@@ -125,7 +128,9 @@ BackupStoreInfo::BackupStoreInfo(int32_t AccountID, const std::string &FileName,
 //		Name:    BackupStoreInfo::Load(int32_t, const std::string &,
 //			 int, bool)
 //		Purpose: Loads the info from disc, given the root
-//			 information. Can be marked as read only.
+//			 information, with any changes to the usage counts
+//			 logged since it was saved. Can be marked as read
+//			 only.
 //		Created: 2003/08/28
 //
 // --------------------------------------------------------------------------
@@ -148,6 +153,7 @@ std::auto_ptr<BackupStoreInfo> BackupStoreInfo::Load(int32_t AccountID,
 	}
 
 	info->mDiscSet = DiscSet;
+	info->AttachUsageLog(true); // replay changes
 	return info;
 }
 
@@ -375,9 +381,214 @@ void BackupStoreInfo::Save(bool allowOverwrite)
 
 	// Commit it to disc, converting it to RAID now
 	rf.Commit(true);
+
+	// The changes in the usage log are in the info now. If the log
+	// can't be started again, it mustn't be replayed either.
+	if(!mapUsageLog.get())
+	{
+		mapUsageLog.reset(new BackupStoreUsageLog(GetRootDir(),
+			mDiscSet));
+	}
+
+	mLoggedValues = GetUsageValues();
+	try
+	{
+		mapUsageLog->Reset(mLoggedValues);
+	}
+	catch(BoxException &e)
+	{
+		BOX_WARNING("Failed to reset usage log " <<
+			mapUsageLog->GetFilename() << ": " << e.what());
+		mapUsageLog->Delete();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreInfo::LogChanges()
+//		Purpose: Add the changes to the usage counts since they were
+//			 last saved or logged to the usage log, which is much
+//			 quicker than saving the info. If there's no usable
+//			 log, the info is saved instead. Other changes, such
+//			 as to the limits or the client store marker, still
+//			 need Save().
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreInfo::LogChanges()
+{
+	if(mReadOnly)
+	{
+		THROW_EXCEPTION(BackupStoreException, StoreInfoIsReadOnly)
+	}
+
+	Adjustment current(GetUsageValues());
+	Adjustment change;
+	#define USAGE_CHANGE(field) \
+	change.field = current.field - mLoggedValues.field
+
+	USAGE_CHANGE(mLastObjectIDUsed);
+	USAGE_CHANGE(mBlocksUsed);
+	USAGE_CHANGE(mBlocksInCurrentFiles);
+	USAGE_CHANGE(mBlocksInOldFiles);
+	USAGE_CHANGE(mBlocksInDeletedFiles);
+	USAGE_CHANGE(mBlocksInDirectories);
+	USAGE_CHANGE(mNumCurrentFiles);
+	USAGE_CHANGE(mNumOldFiles);
+	USAGE_CHANGE(mNumDeletedFiles);
+	USAGE_CHANGE(mNumDirectories);
+
+	#undef USAGE_CHANGE
+
+	Adjustment none = {};
+	if(::memcmp(&change, &none, sizeof(change)) == 0)
+	{
+		// Nothing to log
+		return;
+	}
+
+	if(mapUsageLog.get() && mapUsageLog->Append(change))
+	{
+		mLoggedValues = current;
+		return;
+	}
+
+	Save();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreInfo::AttachUsageLog(bool)
+//		Purpose: Private. Find the usage log for the info just
+//			 loaded, optionally adding the changes in it to the
+//			 counts. The log is only kept for adding to if the
+//			 info isn't read only, and started again if it
+//			 doesn't apply to the info.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreInfo::AttachUsageLog(bool ReplayChanges)
+{
+	std::auto_ptr<BackupStoreUsageLog> apLog(
+		new BackupStoreUsageLog(GetRootDir(), mDiscSet));
+
+	if(ReplayChanges)
+	{
+		Adjustment saved(GetUsageValues());
+		Adjustment values(saved);
+		if(!apLog->Replay(values))
+		{
+			if(!mReadOnly)
+			{
+				// Left over from before the info was last
+				// saved, so these are the counts it's for
+				try
+				{
+					apLog->Reset(saved);
+				}
+				catch(BoxException &e)
+				{
+					BOX_WARNING("Failed to reset usage log " <<
+						apLog->GetFilename() << ": " <<
+						e.what());
+					apLog->Delete();
+				}
+			}
+		}
+		else if(::memcmp(&values, &saved, sizeof(values)) != 0)
+		{
+			BOX_TRACE("Replayed usage log " << apLog->GetFilename() <<
+				", blocks used changed from " << mBlocksUsed <<
+				" to " << values.mBlocksUsed);
+			SetUsageValues(values);
+			// Make sure they get saved
+			mIsModified = !mReadOnly;
+		}
+	}
+
+	// Everything in memory is now either saved or logged
+	mLoggedValues = GetUsageValues();
+
+	if(!mReadOnly)
+	{
+		mapUsageLog = apLog;
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreInfo::GetRootDir()
+//		Purpose: Private. The account's directory, which the info
+//			 file is in.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupStoreInfo::GetRootDir() const
+{
+	ASSERT(mFilename.size() >= sizeof(INFO_FILENAME) - 1);
+	return mFilename.substr(0, mFilename.size() -
+		(sizeof(INFO_FILENAME) - 1));
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreInfo::GetUsageValues()
+//		Purpose: Private. The counts which the usage log records.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreInfo::Adjustment BackupStoreInfo::GetUsageValues() const
+{
+	Adjustment values;
+	values.mLastObjectIDUsed = mLastObjectIDUsed;
+	values.mBlocksUsed = mBlocksUsed;
+	values.mBlocksInCurrentFiles = mBlocksInCurrentFiles;
+	values.mBlocksInOldFiles = mBlocksInOldFiles;
+	values.mBlocksInDeletedFiles = mBlocksInDeletedFiles;
+	values.mBlocksInDirectories = mBlocksInDirectories;
+	values.mNumCurrentFiles = mNumCurrentFiles;
+	values.mNumOldFiles = mNumOldFiles;
+	values.mNumDeletedFiles = mNumDeletedFiles;
+	values.mNumDirectories = mNumDirectories;
+	return values;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreInfo::SetUsageValues(const Adjustment &)
+//		Purpose: Private. Replace the counts which the usage log
+//			 records.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreInfo::SetUsageValues(const Adjustment &rValues)
+{
+	mLastObjectIDUsed = rValues.mLastObjectIDUsed;
+	mBlocksUsed = rValues.mBlocksUsed;
+	mBlocksInCurrentFiles = rValues.mBlocksInCurrentFiles;
+	mBlocksInOldFiles = rValues.mBlocksInOldFiles;
+	mBlocksInDeletedFiles = rValues.mBlocksInDeletedFiles;
+	mBlocksInDirectories = rValues.mBlocksInDirectories;
+	mNumCurrentFiles = rValues.mNumCurrentFiles;
+	mNumOldFiles = rValues.mNumOldFiles;
+	mNumDeletedFiles = rValues.mNumDeletedFiles;
+	mNumDirectories = rValues.mNumDirectories;
 }
 
 void BackupStoreInfo::Save(IOStream& rOutStream)
+{
+	WriteToStream(rOutStream);
+
+	// Mark is as not modified
+	mIsModified = false;
+}
+
+void BackupStoreInfo::WriteToStream(IOStream& rOutStream)
 {
 	// Make header
 	int32_t magic = htonl(INFO_MAGIC_VALUE_2);
@@ -436,9 +647,6 @@ void BackupStoreInfo::Save(IOStream& rOutStream)
 	mExtraData.Seek(0, IOStream::SeekType_Absolute);
 	mExtraData.CopyStreamTo(rOutStream);
 	mExtraData.Seek(0, IOStream::SeekType_Absolute);
-
-	// Mark is as not modified
-	mIsModified = false;
 }
 
 int BackupStoreInfo::ReportChangesTo(BackupStoreInfo& rOldInfo)
@@ -17,6 +17,7 @@
 #include "CollectInBufferStream.h"
 
 class BackupStoreCheck;
+class BackupStoreUsageLog;
 
 // set packing to one byte
 #ifdef STRUCTURE_PACKING_FOR_WIRE_USE_HEADERS
@@ -70,6 +71,7 @@ END_STRUCTURE_PACKING_FOR_WIRE
 class BackupStoreInfo
 {
 	friend class BackupStoreCheck;
+	friend class BackupStoreSharedAccountState;
 public:
 	~BackupStoreInfo();
 private:
@@ -97,7 +99,12 @@ public:
 
 	// Save modified infomation back to store
 	void Save(bool allowOverwrite = true);
+	// Make changes to the usage counts survive a crash without saving
+	// everything, by adding them to the usage log, which Load() replays
+	void LogChanges();
 	void Save(IOStream& rOutStream);
+	// Write a copy to a stream without marking it as saved
+	void WriteToStream(IOStream& rOutStream);
 
 	// Data access functions
 	int32_t GetAccountID() const {return mAccountID;}
@@ -207,6 +214,15 @@ private:
 
 	void ApplyDelta(int64_t& field, const std::string& field_name,
 		const int64_t delta);
+
+	void AttachUsageLog(bool ReplayChanges);
+	std::string GetRootDir() const;
+	Adjustment GetUsageValues() const;
+	void SetUsageValues(const Adjustment &rValues);
+
+	// Changes since mLoggedValues haven't been saved or logged yet
+	std::auto_ptr<BackupStoreUsageLog> mapUsageLog;
+	Adjustment mLoggedValues;
 };
 
 #endif // BACKUPSTOREINFO__H
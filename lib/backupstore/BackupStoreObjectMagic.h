@@ -27,5 +27,9 @@
 // Magic value for directory streams
 #define OBJECTMAGIC_DIR_MAGIC_VALUE 		0x4449525F
 
+// Magic values for pack files and their index
+#define OBJECTMAGIC_PACK_MAGIC_VALUE		0x7061636B
+#define OBJECTMAGIC_PACK_INDEX_MAGIC_VALUE	0x70696478
+
 #endif // BACKUPSTOREOBJECTMAGIC__H
 
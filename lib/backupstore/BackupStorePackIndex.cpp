@@ -0,0 +1,917 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStorePackIndex.cpp
+//		Purpose: Storage of small objects in shared pack files
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <set>
+
+#include "autogen_BackupStoreException.h"
+#include "BackupConstants.h"
+#include "BackupStoreObjectMagic.h"
+#include "BackupStorePackIndex.h"
+#include "BufferedStream.h"
+#include "CommonException.h"
+#include "RaidFileException.h"
+#include "RaidFileRead.h"
+#include "RaidFileWrite.h"
+#include "StoreStructure.h"
+
+#include "MemLeakFindOn.h"
+
+// set packing to one byte
+#ifdef STRUCTURE_PACKING_FOR_WIRE_USE_HEADERS
+#include "BeginStructPackForWire.h"
+#else
+BEGIN_STRUCTURE_PACKING_FOR_WIRE
+#endif
+
+typedef struct
+{
+	int32_t mMagicValue;	// also the version number
+	int32_t mNextPackNumber;
+	int32_t mNumPacks;
+	int64_t mNumEntries;
+	// Then mNumPacks packindex_PackFormat
+	// Then mNumEntries packindex_EntryFormat, in object ID order
+} packindex_StreamFormat;
+
+typedef struct
+{
+	int32_t mPackNumber;
+	int64_t mSize;
+} packindex_PackFormat;
+
+typedef struct
+{
+	int64_t mObjectID;
+	int32_t mPackNumber;
+	int64_t mOffset;
+	int64_t mLength;
+	int64_t mSizeInBlocks;
+} packindex_EntryFormat;
+
+typedef struct
+{
+	int32_t mMagicValue;	// also the version number
+	int32_t mPackNumber;
+	// Then the objects, one after another
+} pack_StreamFormat;
+
+// Use default packing
+#ifdef STRUCTURE_PACKING_FOR_WIRE_USE_HEADERS
+#include "EndStructPackForWire.h"
+#else
+END_STRUCTURE_PACKING_FOR_WIRE
+#endif
+
+// Number of index entries to write out at once
+#define PACK_INDEX_WRITE_BATCH	1024
+
+static bool EntryIDLess(const BackupStorePackIndex::Entry &rEntry, int64_t ObjectID)
+{
+	return rEntry.mObjectID < ObjectID;
+}
+
+static bool EntryLess(const BackupStorePackIndex::Entry &x,
+	const BackupStorePackIndex::Entry &y)
+{
+	return x.mObjectID < y.mObjectID;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::BackupStorePackIndex(const std::string &, int)
+//		Purpose: Constructor. Nothing is read until Load() is called.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStorePackIndex::BackupStorePackIndex(const std::string &rStoreRoot,
+	int DiscSet)
+	: mStoreRoot(rStoreRoot),
+	  mDiscSet(DiscSet),
+	  mRevisionID(0),
+	  mIsModified(false),
+	  mNextPackNumber(1),
+	  mCurrentPackNumber(0),
+	  mCurrentPackSize(0)
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::~BackupStorePackIndex()
+//		Purpose: Destructor. Unsaved changes are discarded, as is
+//			 any pack which was being written.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStorePackIndex::~BackupStorePackIndex()
+{
+	if(mIsModified)
+	{
+		BOX_WARNING("Pack index for " << mStoreRoot << " destroyed "
+			"with unsaved changes");
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::GetIndexFilename()
+//		Purpose: RaidFile name of the index
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupStorePackIndex::GetIndexFilename() const
+{
+	return mStoreRoot + BACKUPSTORE_PACK_DIRECTORY DIRECTORY_SEPARATOR
+		"index";
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::GetPackFilename(int32_t)
+//		Purpose: RaidFile name of a pack
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupStorePackIndex::GetPackFilename(int32_t PackNumber) const
+{
+	char leaf[16];
+	::snprintf(leaf, sizeof(leaf), "p%08x", (unsigned int)PackNumber);
+	return mStoreRoot + BACKUPSTORE_PACK_DIRECTORY DIRECTORY_SEPARATOR +
+		leaf;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::EnsurePackDirectoryExists()
+//		Purpose: Create the directory for packs, if necessary
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackIndex::EnsurePackDirectoryExists()
+{
+	std::string dirName(mStoreRoot + BACKUPSTORE_PACK_DIRECTORY);
+	if(!RaidFileRead::DirectoryExists(mDiscSet, dirName))
+	{
+		RaidFileWrite::CreateDirectory(mDiscSet, dirName,
+			true /* recursive */);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::Load()
+//		Purpose: Read the index from disc. Does nothing if the file
+//			 hasn't changed since it was last read or written,
+//			 or if there are unsaved changes. A store without
+//			 an index has no packed objects.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackIndex::Load()
+{
+	if(mIsModified)
+	{
+		return;
+	}
+
+	std::string filename(GetIndexFilename());
+	int64_t revisionID = 0;
+	if(!RaidFileRead::FileExists(mDiscSet, filename, &revisionID))
+	{
+		mPacks.clear();
+		mEntries.clear();
+		mNextPackNumber = 1;
+		mRevisionID = 0;
+		return;
+	}
+
+	if(revisionID == mRevisionID)
+	{
+		// Already have the current version
+		return;
+	}
+
+	std::auto_ptr<RaidFileRead> file(RaidFileRead::Open(mDiscSet,
+		filename, &revisionID));
+	BufferedStream buf(*file);
+
+	packindex_StreamFormat hdr;
+	if(!buf.ReadFullBuffer(&hdr, sizeof(hdr), 0 /* not interested in bytes read if this fails */)
+		|| ntohl(hdr.mMagicValue) != OBJECTMAGIC_PACK_INDEX_MAGIC_VALUE)
+	{
+		THROW_FILE_ERROR("Bad header in pack index", filename,
+			BackupStoreException, BadPackIndex);
+	}
+
+	std::map<int32_t, int64_t> packs;
+	int32_t numPacks = ntohl(hdr.mNumPacks);
+	for(int32_t p = 0; p < numPacks; ++p)
+	{
+		packindex_PackFormat pack;
+		if(!buf.ReadFullBuffer(&pack, sizeof(pack), 0))
+		{
+			THROW_FILE_ERROR("Pack index is truncated", filename,
+				BackupStoreException, BadPackIndex);
+		}
+		packs[ntohl(pack.mPackNumber)] = box_ntoh64(pack.mSize);
+	}
+
+	std::vector<Entry> entries;
+	int64_t numEntries = box_ntoh64(hdr.mNumEntries);
+	if(numEntries < 0 || numEntries >
+		file->GetFileSize() / (int64_t)sizeof(packindex_EntryFormat))
+	{
+		THROW_FILE_ERROR("Pack index has bad number of entries",
+			filename, BackupStoreException, BadPackIndex);
+	}
+	entries.reserve(numEntries);
+	for(int64_t e = 0; e < numEntries; ++e)
+	{
+		packindex_EntryFormat en;
+		if(!buf.ReadFullBuffer(&en, sizeof(en), 0))
+		{
+			THROW_FILE_ERROR("Pack index is truncated", filename,
+				BackupStoreException, BadPackIndex);
+		}
+
+		Entry entry;
+		entry.mObjectID = box_ntoh64(en.mObjectID);
+		entry.mPackNumber = ntohl(en.mPackNumber);
+		entry.mOffset = box_ntoh64(en.mOffset);
+		entry.mLength = box_ntoh64(en.mLength);
+		entry.mSizeInBlocks = box_ntoh64(en.mSizeInBlocks);
+
+		if((!entries.empty() &&
+			entries.back().mObjectID >= entry.mObjectID) ||
+			packs.find(entry.mPackNumber) == packs.end())
+		{
+			THROW_FILE_ERROR("Pack index has bad entry for object " <<
+				BOX_FORMAT_OBJECTID(entry.mObjectID), filename,
+				BackupStoreException, BadPackIndex);
+		}
+
+		entries.push_back(entry);
+	}
+
+	mNextPackNumber = ntohl(hdr.mNextPackNumber);
+	mPacks.swap(packs);
+	mEntries.swap(entries);
+	mRevisionID = revisionID;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::Save()
+//		Purpose: Write the index to disc, if it has been modified
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackIndex::Save()
+{
+	if(!mIsModified)
+	{
+		return;
+	}
+
+	EnsurePackDirectoryExists();
+
+	std::string filename(GetIndexFilename());
+	RaidFileWrite file(mDiscSet, filename);
+	file.Open(true /* allow overwriting */);
+
+	packindex_StreamFormat hdr;
+	hdr.mMagicValue = htonl(OBJECTMAGIC_PACK_INDEX_MAGIC_VALUE);
+	hdr.mNextPackNumber = htonl(mNextPackNumber);
+	hdr.mNumPacks = htonl(mPacks.size());
+	hdr.mNumEntries = box_hton64(mEntries.size());
+	file.Write(&hdr, sizeof(hdr));
+
+	for(std::map<int32_t, int64_t>::const_iterator i(mPacks.begin());
+		i != mPacks.end(); ++i)
+	{
+		packindex_PackFormat pack;
+		pack.mPackNumber = htonl(i->first);
+		pack.mSize = box_hton64(i->second);
+		file.Write(&pack, sizeof(pack));
+	}
+
+	// Entries are written in batches, as there can be a great many
+	packindex_EntryFormat batch[PACK_INDEX_WRITE_BATCH];
+	int inBatch = 0;
+	for(std::vector<Entry>::const_iterator i(mEntries.begin());
+		i != mEntries.end(); ++i)
+	{
+		packindex_EntryFormat &en(batch[inBatch++]);
+		en.mObjectID = box_hton64(i->mObjectID);
+		en.mPackNumber = htonl(i->mPackNumber);
+		en.mOffset = box_hton64(i->mOffset);
+		en.mLength = box_hton64(i->mLength);
+		en.mSizeInBlocks = box_hton64(i->mSizeInBlocks);
+
+		if(inBatch == PACK_INDEX_WRITE_BATCH)
+		{
+			file.Write(batch, sizeof(batch));
+			inBatch = 0;
+		}
+	}
+	if(inBatch > 0)
+	{
+		file.Write(batch, inBatch * sizeof(packindex_EntryFormat));
+	}
+
+	file.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+
+	// Remember the revision we wrote, so Load() doesn't read it back
+	RaidFileRead::FileExists(mDiscSet, filename, &mRevisionID);
+	mIsModified = false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::Find(int64_t)
+//		Purpose: Find the index entry for an object, or return 0 if
+//			 it isn't packed. Only valid until the index changes.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+const BackupStorePackIndex::Entry *BackupStorePackIndex::Find(int64_t ObjectID) const
+{
+	std::vector<Entry>::const_iterator i(std::lower_bound(mEntries.begin(),
+		mEntries.end(), ObjectID, EntryIDLess));
+	if(i == mEntries.end() || i->mObjectID != ObjectID)
+	{
+		return 0;
+	}
+	return &(*i);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::Remove(int64_t)
+//		Purpose: Forget a packed object, returning whether it was in
+//			 the index. The space it used is reclaimed when the
+//			 pack is compacted.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStorePackIndex::Remove(int64_t ObjectID)
+{
+	std::vector<Entry>::iterator i(std::lower_bound(mEntries.begin(),
+		mEntries.end(), ObjectID, EntryIDLess));
+	if(i == mEntries.end() || i->mObjectID != ObjectID)
+	{
+		return false;
+	}
+
+	mEntries.erase(i);
+	mIsModified = true;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::ObjectExists(int64_t)
+//		Purpose: Does the object exist, either in its own file or
+//			 in a pack?
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStorePackIndex::ObjectExists(int64_t ObjectID)
+{
+	std::string filename;
+	StoreStructure::MakeObjectFilename(ObjectID, mStoreRoot, mDiscSet,
+		filename, false /* don't make sure the dir exists */);
+	if(RaidFileRead::FileExists(mDiscSet, filename))
+	{
+		return true;
+	}
+
+	Load();
+	return Find(ObjectID) != 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::OpenObject(int64_t, int64_t *)
+//		Purpose: Open an object for reading, from its own file if it
+//			 has one, otherwise from its pack. Optionally returns
+//			 the disc usage recorded for the object.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<IOStream> BackupStorePackIndex::OpenObject(int64_t ObjectID,
+	int64_t *pSizeInBlocks)
+{
+	std::string filename;
+	StoreStructure::MakeObjectFilename(ObjectID, mStoreRoot, mDiscSet,
+		filename, false /* don't make sure the dir exists */);
+
+	// Open the file without checking that it exists first, as
+	// housekeeping may pack and delete it at any moment. The index is
+	// always saved before the file is deleted, so it only needs to be
+	// consulted if the file has gone.
+	std::auto_ptr<RaidFileRead> file;
+	try
+	{
+		// Not worth a warning if the object turns out to be packed
+		HideSpecificExceptionGuard guard(RaidFileException::ExceptionType,
+			RaidFileException::RaidFileDoesntExist);
+		file = RaidFileRead::Open(mDiscSet, filename);
+	}
+	catch(RaidFileException &e)
+	{
+		if(e.GetSubType() != RaidFileException::RaidFileDoesntExist &&
+			e.GetSubType() != RaidFileException::ErrorOpeningFileForRead)
+		{
+			throw;
+		}
+
+		// Load() only checks for the index file if the account has
+		// never packed anything, so this is cheap in that case.
+		Load();
+		const Entry *pentry = Find(ObjectID);
+		if(pentry == 0)
+		{
+			throw;
+		}
+
+		if(pSizeInBlocks != 0)
+		{
+			*pSizeInBlocks = pentry->mSizeInBlocks;
+		}
+		return OpenPackedObject(*pentry);
+	}
+
+	if(pSizeInBlocks != 0)
+	{
+		*pSizeInBlocks = file->GetDiscUsageInBlocks();
+	}
+	return std::auto_ptr<IOStream>(file.release());
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::OpenPackedObject(const Entry &)
+//		Purpose: Open a stream on an object within its pack
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<IOStream> BackupStorePackIndex::OpenPackedObject(const Entry &rEntry)
+{
+	std::auto_ptr<RaidFileRead> pack(RaidFileRead::Open(mDiscSet,
+		GetPackFilename(rEntry.mPackNumber)));
+
+	if(rEntry.mOffset < (int64_t)sizeof(pack_StreamFormat) ||
+		rEntry.mOffset + rEntry.mLength > pack->GetFileSize())
+	{
+		THROW_FILE_ERROR("Pack index entry for object " <<
+			BOX_FORMAT_OBJECTID(rEntry.mObjectID) << " is outside "
+			"the pack", GetPackFilename(rEntry.mPackNumber),
+			BackupStoreException, BadPackIndex);
+	}
+
+	return std::auto_ptr<IOStream>(new BackupStorePackedObjectStream(pack,
+		rEntry.mOffset, rEntry.mLength));
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::AppendToPack(IOStream &, int64_t, int64_t, std::vector<Entry> &)
+//		Purpose: Copy an object onto the end of the pack being
+//			 written, starting a new pack if necessary, and add
+//			 its new location to rAdded.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackIndex::AppendToPack(IOStream &rObject, int64_t ObjectID,
+	int64_t SizeInBlocks, std::vector<Entry> &rAdded)
+{
+	if(mapCurrentPack.get() == 0)
+	{
+		// Skip over any packs left behind by an interrupted run
+		while(RaidFileRead::FileExists(mDiscSet,
+			GetPackFilename(mNextPackNumber)))
+		{
+			++mNextPackNumber;
+		}
+
+		mCurrentPackNumber = mNextPackNumber++;
+		mIsModified = true;
+		mapCurrentPack.reset(new RaidFileWrite(mDiscSet,
+			GetPackFilename(mCurrentPackNumber)));
+		mapCurrentPack->Open(false /* no overwriting */);
+
+		pack_StreamFormat hdr;
+		hdr.mMagicValue = htonl(OBJECTMAGIC_PACK_MAGIC_VALUE);
+		hdr.mPackNumber = htonl(mCurrentPackNumber);
+		mapCurrentPack->Write(&hdr, sizeof(hdr));
+		mCurrentPackSize = sizeof(hdr);
+	}
+
+	Entry entry;
+	entry.mObjectID = ObjectID;
+	entry.mPackNumber = mCurrentPackNumber;
+	entry.mOffset = mCurrentPackSize;
+	entry.mSizeInBlocks = SizeInBlocks;
+
+	rObject.CopyStreamTo(*mapCurrentPack, IOStream::TimeOutInfinite,
+		64*1024 /* buffer size */);
+	mCurrentPackSize = mapCurrentPack->GetPosition();
+	entry.mLength = mCurrentPackSize - entry.mOffset;
+	rAdded.push_back(entry);
+
+	if(mCurrentPackSize >= BACKUPSTORE_PACK_FILE_TARGET_SIZE)
+	{
+		FinishPack();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::FinishPack()
+//		Purpose: Commit the pack being written, if any
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackIndex::FinishPack()
+{
+	if(mapCurrentPack.get() == 0)
+	{
+		return;
+	}
+
+	mapCurrentPack->Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+	mapCurrentPack.reset();
+	mPacks[mCurrentPackNumber] = mCurrentPackSize;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::PackObjects(const std::vector<int64_t> &)
+//		Purpose: Move the given objects from their own files into
+//			 new packs. Objects which are already packed, or no
+//			 longer exist, are skipped. The individual files are
+//			 only deleted once the index referring to the packs
+//			 has been saved. Returns the number of objects moved.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t BackupStorePackIndex::PackObjects(const std::vector<int64_t> &rObjectIDs)
+{
+	Load();
+	EnsurePackDirectoryExists();
+
+	// Objects referenced from more than one directory are listed more
+	// than once, but must only be packed once
+	std::vector<int64_t> objectIDs(rObjectIDs);
+	std::sort(objectIDs.begin(), objectIDs.end());
+	objectIDs.erase(std::unique(objectIDs.begin(), objectIDs.end()),
+		objectIDs.end());
+
+	std::vector<Entry> added;
+	std::vector<std::string> filenames;
+
+	for(std::vector<int64_t>::const_iterator i(objectIDs.begin());
+		i != objectIDs.end(); ++i)
+	{
+		if(Find(*i) != 0)
+		{
+			continue;
+		}
+
+		std::string filename;
+		StoreStructure::MakeObjectFilename(*i, mStoreRoot, mDiscSet,
+			filename, false /* don't make sure the dir exists */);
+		if(!RaidFileRead::FileExists(mDiscSet, filename))
+		{
+			// Deleted since it was chosen
+			continue;
+		}
+
+		std::auto_ptr<RaidFileRead> object(RaidFileRead::Open(mDiscSet,
+			filename));
+		AppendToPack(*object, *i, object->GetDiscUsageInBlocks(), added);
+		filenames.push_back(filename);
+	}
+
+	FinishPack();
+
+	if(added.empty())
+	{
+		return 0;
+	}
+
+	mEntries.insert(mEntries.end(), added.begin(), added.end());
+	std::sort(mEntries.begin(), mEntries.end(), EntryLess);
+	mIsModified = true;
+	Save();
+
+	// The packed copies are now the only ones that will be found once
+	// the individual files are gone.
+	for(std::vector<std::string>::const_iterator i(filenames.begin());
+		i != filenames.end(); ++i)
+	{
+		RaidFileWrite del(mDiscSet, *i);
+		del.Delete();
+	}
+
+	return added.size();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackIndex::CompactPacks()
+//		Purpose: Reclaim the space used by objects which have been
+//			 removed from the index. Packs which are mostly
+//			 unused have their remaining objects copied into a
+//			 new pack, and are deleted along with any pack files
+//			 which the index doesn't mention (left behind by an
+//			 interrupted run). Returns the number of packs
+//			 deleted.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int BackupStorePackIndex::CompactPacks()
+{
+	Load();
+
+	std::map<int32_t, int64_t> liveSize;
+	for(std::vector<Entry>::const_iterator i(mEntries.begin());
+		i != mEntries.end(); ++i)
+	{
+		liveSize[i->mPackNumber] += i->mLength;
+	}
+
+	std::set<int32_t> toRemove;
+	for(std::map<int32_t, int64_t>::const_iterator i(mPacks.begin());
+		i != mPacks.end(); ++i)
+	{
+		int64_t contents = i->second - sizeof(pack_StreamFormat);
+		int64_t live = liveSize[i->first];
+		if(live * 100 < contents * BACKUPSTORE_PACK_FILE_MIN_LIVE_PERCENT)
+		{
+			toRemove.insert(i->first);
+		}
+	}
+
+	if(!toRemove.empty())
+	{
+		// Copy the remaining objects out of the packs to be deleted
+		std::vector<Entry> moved;
+		for(std::vector<Entry>::const_iterator i(mEntries.begin());
+			i != mEntries.end(); ++i)
+		{
+			if(toRemove.find(i->mPackNumber) != toRemove.end())
+			{
+				std::auto_ptr<IOStream> object(OpenPackedObject(*i));
+				AppendToPack(*object, i->mObjectID,
+					i->mSizeInBlocks, moved);
+			}
+		}
+		FinishPack();
+
+		// Both lists are in object ID order
+		std::vector<Entry>::iterator e(mEntries.begin());
+		for(std::vector<Entry>::const_iterator m(moved.begin());
+			m != moved.end(); ++m)
+		{
+			while(e->mObjectID != m->mObjectID)
+			{
+				++e;
+			}
+			*e = *m;
+		}
+
+		for(std::set<int32_t>::const_iterator p(toRemove.begin());
+			p != toRemove.end(); ++p)
+		{
+			mPacks.erase(*p);
+		}
+
+		mIsModified = true;
+		Save();
+	}
+
+	// Delete the old packs, and any others not in the index. If there's
+	// no index, leave the packs alone for bbstoreaccounts check to
+	// report, rather than throwing away everything in them.
+	int removed = 0;
+	std::vector<std::string> files;
+	std::string dirName(mStoreRoot + BACKUPSTORE_PACK_DIRECTORY);
+	if(mRevisionID != 0 && RaidFileRead::DirectoryExists(mDiscSet, dirName))
+	{
+		RaidFileRead::ReadDirectoryContents(mDiscSet, dirName,
+			RaidFileRead::DirReadType_FilesOnly, files);
+	}
+
+	for(std::vector<std::string>::const_iterator i(files.begin());
+		i != files.end(); ++i)
+	{
+		unsigned int packNumber = 0;
+		char check[16];
+		if(i->size() != 9 || ::sscanf(i->c_str(), "p%08x", &packNumber) != 1)
+		{
+			continue;
+		}
+		::snprintf(check, sizeof(check), "p%08x", packNumber);
+		if(*i != check || (int32_t)packNumber >= mNextPackNumber ||
+			mPacks.find(packNumber) != mPacks.end())
+		{
+			continue;
+		}
+
+		BOX_TRACE("Removing unused pack file " << dirName <<
+			DIRECTORY_SEPARATOR << *i);
+		RaidFileWrite del(mDiscSet, dirName + DIRECTORY_SEPARATOR + *i);
+		del.Delete();
+		++removed;
+	}
+
+	return removed;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::BackupStorePackedObjectStream(std::auto_ptr<RaidFileRead>, pos_type, pos_type)
+//		Purpose: Constructor, taking ownership of the pack file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStorePackedObjectStream::BackupStorePackedObjectStream(
+	std::auto_ptr<RaidFileRead> apPack, pos_type Offset, pos_type Length)
+	: mapPack(apPack),
+	  mOffset(Offset),
+	  mLength(Length),
+	  mPosition(0)
+{
+	mapPack->Seek(mOffset, IOStream::SeekType_Absolute);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::~BackupStorePackedObjectStream()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStorePackedObjectStream::~BackupStorePackedObjectStream()
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::Read(void *, int, int)
+//		Purpose: As interface, stopping at the end of the object
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int BackupStorePackedObjectStream::Read(void *pBuffer, int NBytes, int Timeout)
+{
+	if(NBytes > (mLength - mPosition))
+	{
+		NBytes = mLength - mPosition;
+	}
+	if(NBytes <= 0)
+	{
+		return 0;
+	}
+
+	int bytes = mapPack->Read(pBuffer, NBytes, Timeout);
+	mPosition += bytes;
+	return bytes;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::BytesLeftToRead()
+//		Purpose: As interface
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+IOStream::pos_type BackupStorePackedObjectStream::BytesLeftToRead()
+{
+	return mLength - mPosition;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::Write(const void *, int, int)
+//		Purpose: As interface, but not supported
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackedObjectStream::Write(const void *pBuffer, int NBytes,
+	int Timeout)
+{
+	THROW_EXCEPTION(CommonException, NotSupported)
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::GetPosition()
+//		Purpose: As interface, relative to the start of the object
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+IOStream::pos_type BackupStorePackedObjectStream::GetPosition() const
+{
+	return mPosition;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::Seek(pos_type, int)
+//		Purpose: As interface, within the object
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStorePackedObjectStream::Seek(pos_type Offset, int SeekType)
+{
+	pos_type newpos = mPosition;
+	switch(SeekType)
+	{
+	case IOStream::SeekType_Absolute:
+		newpos = Offset;
+		break;
+
+	case IOStream::SeekType_Relative:
+		newpos += Offset;
+		break;
+
+	case IOStream::SeekType_End:
+		newpos = mLength + Offset;
+		break;
+
+	default:
+		THROW_EXCEPTION(CommonException, IOStreamBadSeekType)
+	}
+
+	if(newpos < 0 || newpos > mLength)
+	{
+		THROW_EXCEPTION(CommonException, IOStreamBadSeekType)
+	}
+
+	mapPack->Seek(mOffset + newpos, IOStream::SeekType_Absolute);
+	mPosition = newpos;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::StreamDataLeft()
+//		Purpose: As interface
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStorePackedObjectStream::StreamDataLeft()
+{
+	return mPosition < mLength && mapPack->StreamDataLeft();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStorePackedObjectStream::StreamClosed()
+//		Purpose: As interface
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStorePackedObjectStream::StreamClosed()
+{
+	return true;
+}
+
@@ -0,0 +1,154 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStorePackIndex.h
+//		Purpose: Storage of small objects in shared pack files
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPSTOREPACKINDEX__H
+#define BACKUPSTOREPACKINDEX__H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "IOStream.h"
+
+class RaidFileRead;
+class RaidFileWrite;
+
+// Name of the directory, within the account root, holding the packs
+#define BACKUPSTORE_PACK_DIRECTORY	"packs"
+
+// When a pack file reaches this size, it's finished and a new one started
+#define BACKUPSTORE_PACK_FILE_TARGET_SIZE	(64*1024*1024)
+
+// Packs with less than this percentage of their contents still in use
+// are rewritten by housekeeping to reclaim the space
+#define BACKUPSTORE_PACK_FILE_MIN_LIVE_PERCENT	50
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupStorePackIndex
+//		Purpose: Index of the objects in an account which have been moved
+//			 out of their own RaidFiles and appended to large pack
+//			 files, to save inodes and directory lookups on stores
+//			 with many small objects. Packs are only written by
+//			 housekeeping and are never modified once committed.
+//			 An object's own file, if it exists, always takes
+//			 precedence over a packed copy.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupStorePackIndex
+{
+public:
+	BackupStorePackIndex(const std::string &rStoreRoot, int DiscSet);
+	~BackupStorePackIndex();
+private:
+	// no copying
+	BackupStorePackIndex(const BackupStorePackIndex &);
+	BackupStorePackIndex &operator=(const BackupStorePackIndex &);
+public:
+
+	typedef struct
+	{
+		int64_t mObjectID;
+		int32_t mPackNumber;
+		int64_t mOffset;
+		int64_t mLength;
+		int64_t mSizeInBlocks;	// of the object when in its own file
+	} Entry;
+
+	// (Re)load the index from disc, if it's changed since the last time
+	void Load();
+	void Save();
+	bool IsModified() const {return mIsModified;}
+
+	const Entry *Find(int64_t ObjectID) const;
+	bool Remove(int64_t ObjectID);
+	size_t GetNumberOfEntries() const {return mEntries.size();}
+	size_t GetNumberOfPacks() const {return mPacks.size();}
+	int32_t GetNextPackNumber() const {return mNextPackNumber;}
+	int64_t GetLastObjectID() const
+	{
+		return mEntries.empty() ? 0 : mEntries.back().mObjectID;
+	}
+
+	// Access to objects wherever they are stored
+	bool ObjectExists(int64_t ObjectID);
+	std::auto_ptr<IOStream> OpenObject(int64_t ObjectID,
+		int64_t *pSizeInBlocks = 0);
+	std::auto_ptr<IOStream> OpenPackedObject(const Entry &rEntry);
+
+	// Housekeeping, only with the account locked
+	int64_t PackObjects(const std::vector<int64_t> &rObjectIDs);
+	int CompactPacks();
+
+private:
+	std::string GetIndexFilename() const;
+	std::string GetPackFilename(int32_t PackNumber) const;
+	void EnsurePackDirectoryExists();
+	void AppendToPack(IOStream &rObject, int64_t ObjectID,
+		int64_t SizeInBlocks, std::vector<Entry> &rAdded);
+	void FinishPack();
+
+	std::string mStoreRoot;	// has final directory separator
+	int mDiscSet;
+	int64_t mRevisionID;	// of the index file last loaded or saved
+	bool mIsModified;
+	int32_t mNextPackNumber;
+
+	// Size of each pack file, by pack number
+	std::map<int32_t, int64_t> mPacks;
+	// Sorted by object ID
+	std::vector<Entry> mEntries;
+
+	// The pack currently being written by PackObjects or CompactPacks
+	std::auto_ptr<RaidFileWrite> mapCurrentPack;
+	int32_t mCurrentPackNumber;
+	int64_t mCurrentPackSize;
+};
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupStorePackedObjectStream
+//		Purpose: Read one object out of a pack file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupStorePackedObjectStream : public IOStream
+{
+public:
+	BackupStorePackedObjectStream(std::auto_ptr<RaidFileRead> apPack,
+		pos_type Offset, pos_type Length);
+	~BackupStorePackedObjectStream();
+private:
+	// no copying
+	BackupStorePackedObjectStream(const BackupStorePackedObjectStream &);
+public:
+
+	virtual int Read(void *pBuffer, int NBytes,
+		int Timeout = IOStream::TimeOutInfinite);
+	virtual pos_type BytesLeftToRead();
+	virtual void Write(const void *pBuffer, int NBytes,
+		int Timeout = IOStream::TimeOutInfinite);
+	virtual pos_type GetPosition() const;
+	virtual void Seek(pos_type Offset, int SeekType);
+	virtual bool StreamDataLeft();
+	virtual bool StreamClosed();
+
+private:
+	std::auto_ptr<RaidFileRead> mapPack;
+	pos_type mOffset;
+	pos_type mLength;
+	pos_type mPosition;
+};
+
+#endif // BACKUPSTOREPACKINDEX__H
+
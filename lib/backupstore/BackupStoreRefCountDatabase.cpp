@@ -10,6 +10,12 @@
 #include "Box.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_MMAN_H
+	#include <sys/mman.h>
+#endif
 
 #include <algorithm>
 
@@ -27,6 +33,10 @@
 #define REFCOUNT_MAGIC_VALUE	0x52656643 // RefC
 #define REFCOUNT_FILENAME	"refcount"
 
+// Space in memory, and in temporary database files, is grown by this many
+// entries at a time, as objects are usually added one at a time
+#define REFCOUNT_GROW_ENTRIES	(64*1024)
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -43,9 +53,15 @@ BackupStoreRefCountDatabase::BackupStoreRefCountDatabase(const
   mReadOnly(ReadOnly),
   mIsModified(false),
   mIsTemporaryFile(Temporary),
-  mapDatabaseFile(apDatabaseFile)
+  mapDatabaseFile(apDatabaseFile),
+  mpData(NULL),
+  mDataSize(0),
+  mLastObjectID(0),
+  mDirtyStart(0),
+  mDirtyEnd(0)
 {
 	ASSERT(!(ReadOnly && Temporary)); // being both doesn't make sense
+	MapFile();
 }
 
 void BackupStoreRefCountDatabase::Commit()
@@ -62,8 +78,9 @@ void BackupStoreRefCountDatabase::Commit()
 			"Reference count database is already closed");
 	}
 
-	mapDatabaseFile->Close();
-	mapDatabaseFile.reset();
+	// Make sure that everything is on disc before the new database
+	// replaces the old one
+	CloseFile(true);
 
 	std::string Final_Filename = GetFilename(mAccount, false);
 
@@ -100,11 +117,7 @@ void BackupStoreRefCountDatabase::Discard()
 	// open or not, and not Discard it unless it's open. However if the
 	// final rename() fails during Commit(), the file will already be
 	// closed, and we don't want to blow up here in that case.
-	if (mapDatabaseFile.get())
-	{
-		mapDatabaseFile->Close();
-		mapDatabaseFile.reset();
-	}
+	CloseFile(false);
 
 	if(EMU_UNLINK(mFilename.c_str()) != 0)
 	{
@@ -142,6 +155,304 @@ BackupStoreRefCountDatabase::~BackupStoreRefCountDatabase()
 				"in destructor: " << e.what());
 		}
 	}
+	else
+	{
+		try
+		{
+			CloseFile(false);
+		}
+		catch(BoxException &e)
+		{
+			BOX_ERROR("Failed to close BackupStoreRefCountDatabase "
+				"in destructor: " << e.what());
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::MapFile()
+//		Purpose: Map the whole database file into memory, or read it
+//			 in if mapping isn't available on this platform.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreRefCountDatabase::MapFile()
+{
+	mapDatabaseFile->Seek(0, IOStream::SeekType_Absolute);
+	IOStream::pos_type fileSize = mapDatabaseFile->BytesLeftToRead();
+	mLastObjectID = (fileSize - sizeof(refcount_StreamFormat)) /
+		GetEntrySize();
+	mDataSize = fileSize;
+
+#ifdef BOX_REFCOUNT_DATABASE_USE_MMAP
+	void *pMapping = ::mmap(NULL, mDataSize,
+		PROT_READ | (mReadOnly ? 0 : PROT_WRITE), MAP_SHARED,
+		mapDatabaseFile->GetFileHandle(), 0);
+	if(pMapping == MAP_FAILED)
+	{
+		THROW_SYS_FILE_ERROR("Failed to map refcount database",
+			mFilename, CommonException, OSFileError);
+	}
+	mpData = (uint8_t *)pMapping;
+#else
+	if(mReadOnly)
+	{
+		// Entries are read from the file each time, so that changes
+		// made by other processes are seen.
+		return;
+	}
+
+	mpData = (uint8_t *)::malloc(mDataSize);
+	if(mpData == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	if(!mapDatabaseFile->ReadFullBuffer(mpData, mDataSize, 0))
+	{
+		THROW_FILE_ERROR("Failed to read refcount database: "
+			"short read", mFilename, BackupStoreException,
+			CouldNotLoadStoreInfo);
+	}
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::Refresh()
+//		Purpose: Pick up new objects added to a read-only database by
+//			 another process since it was opened.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreRefCountDatabase::Refresh() const
+{
+	if(!mReadOnly)
+	{
+		// We are the only writer, so nothing can have changed
+		return;
+	}
+
+	mapDatabaseFile->Seek(0, IOStream::SeekType_Absolute);
+	IOStream::pos_type fileSize = mapDatabaseFile->BytesLeftToRead();
+
+#ifdef BOX_REFCOUNT_DATABASE_USE_MMAP
+	if(fileSize != mDataSize)
+	{
+		// Map the new size before letting go of the old mapping, so
+		// that mpData is still valid if this fails
+		void *pMapping = ::mmap(NULL, fileSize, PROT_READ, MAP_SHARED,
+			mapDatabaseFile->GetFileHandle(), 0);
+		if(pMapping == MAP_FAILED)
+		{
+			THROW_SYS_FILE_ERROR("Failed to map refcount database",
+				mFilename, CommonException, OSFileError);
+		}
+
+		uint8_t *pOldData = mpData;
+		IOStream::pos_type oldSize = mDataSize;
+		mpData = (uint8_t *)pMapping;
+		mDataSize = fileSize;
+
+		if(::munmap(pOldData, oldSize) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to unmap refcount "
+				"database", mFilename, CommonException,
+				OSFileError);
+		}
+	}
+#endif
+
+	mLastObjectID = (fileSize - sizeof(refcount_StreamFormat)) /
+		GetEntrySize();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::ExtendTo(int64_t)
+//		Purpose: Make room in the database for objects up to the
+//			 given ID, with no references to the new ones.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreRefCountDatabase::ExtendTo(int64_t LastObjectID)
+{
+	if(LastObjectID <= mLastObjectID)
+	{
+		return;
+	}
+
+	if(mReadOnly)
+	{
+		THROW_EXCEPTION_MESSAGE(CommonException, Internal,
+			"Cannot modify a read-only reference count database");
+	}
+
+	IOStream::pos_type oldEnd = GetOffset(mLastObjectID + 1);
+	IOStream::pos_type newEnd = GetOffset(LastObjectID + 1);
+
+	if(newEnd > mDataSize)
+	{
+		// Reserve space for a batch of new objects at a time, as they
+		// are usually added one by one
+		IOStream::pos_type grow = REFCOUNT_GROW_ENTRIES * GetEntrySize();
+		IOStream::pos_type newSize = ((newEnd + grow - 1) / grow) * grow;
+
+#ifdef BOX_REFCOUNT_DATABASE_USE_MMAP
+		// The mapping may extend beyond the end of the file, as long
+		// as nothing past the end is touched. Make the new one before
+		// letting go of the old, so that mpData stays valid if this
+		// fails.
+		void *pMapping = ::mmap(NULL, newSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, mapDatabaseFile->GetFileHandle(), 0);
+		if(pMapping == MAP_FAILED)
+		{
+			THROW_SYS_FILE_ERROR("Failed to map refcount database",
+				mFilename, CommonException, OSFileError);
+		}
+
+		uint8_t *pOldData = mpData;
+		IOStream::pos_type oldSize = mDataSize;
+		mpData = (uint8_t *)pMapping;
+		mDataSize = newSize;
+
+		if(::munmap(pOldData, oldSize) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to unmap refcount "
+				"database", mFilename, CommonException,
+				OSFileError);
+		}
+
+		if(mIsTemporaryFile &&
+			::ftruncate(mapDatabaseFile->GetFileHandle(), newSize) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to extend refcount "
+				"database", mFilename, CommonException,
+				OSFileError);
+		}
+#else
+		uint8_t *pNewData = (uint8_t *)::realloc(mpData, newSize);
+		if(pNewData == NULL)
+		{
+			throw std::bad_alloc();
+		}
+		mpData = pNewData;
+		::memset(mpData + mDataSize, 0, newSize - mDataSize);
+		mDataSize = newSize;
+#endif
+	}
+
+#ifdef BOX_REFCOUNT_DATABASE_USE_MMAP
+	// The permanent database must always be exactly the right size, as
+	// other processes work out the number of objects from it. Temporary
+	// ones are only trimmed when they're closed.
+	if(!mIsTemporaryFile &&
+		::ftruncate(mapDatabaseFile->GetFileHandle(), newEnd) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to extend refcount database",
+			mFilename, CommonException, OSFileError);
+	}
+#endif
+
+	// The new entries must be written out, even if they're zero
+	if(mDirtyEnd <= mDirtyStart)
+	{
+		mDirtyStart = oldEnd;
+	}
+	mDirtyStart = std::min(mDirtyStart, oldEnd);
+	mDirtyEnd = std::max(mDirtyEnd, newEnd);
+	mLastObjectID = LastObjectID;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::WriteBack()
+//		Purpose: Write changes made in memory back to the file.
+//			 Nothing needs doing if the file is mapped.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreRefCountDatabase::WriteBack()
+{
+#ifndef BOX_REFCOUNT_DATABASE_USE_MMAP
+	if(mDirtyEnd > mDirtyStart)
+	{
+		mapDatabaseFile->Seek(mDirtyStart, IOStream::SeekType_Absolute);
+		mapDatabaseFile->Write(mpData + mDirtyStart,
+			mDirtyEnd - mDirtyStart);
+		mDirtyStart = 0;
+		mDirtyEnd = 0;
+	}
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::CloseFile(bool)
+//		Purpose: Release the memory copy of the database and close
+//			 the file, trimming off any space reserved for new
+//			 objects. If Sync is true, the modified pages are
+//			 flushed to disc first.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreRefCountDatabase::CloseFile(bool Sync)
+{
+	if(!mapDatabaseFile.get())
+	{
+		return;
+	}
+
+	WriteBack();
+
+#ifdef BOX_REFCOUNT_DATABASE_USE_MMAP
+	if(mpData != NULL)
+	{
+		if(Sync && mDirtyEnd > mDirtyStart)
+		{
+			IOStream::pos_type pageSize = ::sysconf(_SC_PAGESIZE);
+			IOStream::pos_type start =
+				(mDirtyStart / pageSize) * pageSize;
+			if(::msync(mpData + start, mDirtyEnd - start,
+				MS_SYNC) != 0)
+			{
+				THROW_SYS_FILE_ERROR("Failed to write refcount "
+					"database to disc", mFilename,
+					CommonException, OSFileError);
+			}
+		}
+
+		if(::munmap(mpData, mDataSize) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to unmap refcount "
+				"database", mFilename, CommonException,
+				OSFileError);
+		}
+	}
+
+	IOStream::pos_type end = GetOffset(mLastObjectID + 1);
+	if(!mReadOnly && mDataSize > end &&
+		::ftruncate(mapDatabaseFile->GetFileHandle(), end) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to truncate refcount database",
+			mFilename, CommonException, OSFileError);
+	}
+#else
+	::free(mpData);
+#endif
+
+	mpData = NULL;
+	mDataSize = 0;
+	mDirtyStart = 0;
+	mDirtyEnd = 0;
+
+	mapDatabaseFile->Close();
+	mapDatabaseFile.reset();
 }
 
 std::string BackupStoreRefCountDatabase::GetFilename(const
@@ -278,9 +589,12 @@ std::auto_ptr<BackupStoreRefCountDatabase> BackupStoreRefCountDatabase::Load(
 BackupStoreRefCountDatabase::refcount_t
 BackupStoreRefCountDatabase::GetRefCount(int64_t ObjectID) const
 {
-	IOStream::pos_type offset = GetOffset(ObjectID);
+	if (ObjectID > mLastObjectID)
+	{
+		Refresh();
+	}
 
-	if (GetSize() < offset + GetEntrySize())
+	if (ObjectID < BACKUPSTORE_ROOT_DIRECTORY_ID || ObjectID > mLastObjectID)
 	{
 		THROW_FILE_ERROR("Failed to read refcount database: "
 			"attempted read of unknown refcount for object " <<
@@ -288,31 +602,75 @@ BackupStoreRefCountDatabase::GetRefCount(int64_t ObjectID) const
 			BackupStoreException, UnknownObjectRefCountRequested);
 	}
 
-	mapDatabaseFile->Seek(offset, SEEK_SET);
-
 	refcount_t refcount;
-	if (mapDatabaseFile->Read(&refcount, sizeof(refcount)) !=
-		sizeof(refcount))
+#ifndef BOX_REFCOUNT_DATABASE_USE_MMAP
+	if (mReadOnly)
 	{
-		THROW_FILE_ERROR("Failed to read refcount database: "
-			"short read at offset " << offset, mFilename,
-			BackupStoreException, CouldNotLoadStoreInfo);
+		mapDatabaseFile->Seek(GetOffset(ObjectID),
+			IOStream::SeekType_Absolute);
+		if (!mapDatabaseFile->ReadFullBuffer(&refcount,
+			sizeof(refcount), 0))
+		{
+			THROW_FILE_ERROR("Failed to read refcount database: "
+				"short read at offset " << GetOffset(ObjectID),
+				mFilename, BackupStoreException,
+				CouldNotLoadStoreInfo);
+		}
+		return ntohl(refcount);
 	}
+#endif
 
+	::memcpy(&refcount, mpData + GetOffset(ObjectID), sizeof(refcount));
 	return ntohl(refcount);
 }
 
 int64_t BackupStoreRefCountDatabase::GetLastObjectIDUsed() const
 {
-	return (GetSize() - sizeof(refcount_StreamFormat)) /
-		sizeof(refcount_t);
+	Refresh();
+	return mLastObjectID;
 }
 
 void BackupStoreRefCountDatabase::AddReference(int64_t ObjectID)
+{
+	ChangeRefCount(ObjectID, 1);
+	WriteBack();
+}
+
+void BackupStoreRefCountDatabase::SetRefCount(int64_t ObjectID,
+	refcount_t NewRefCount)
+{
+	ExtendTo(ObjectID);
+
+	IOStream::pos_type offset = GetOffset(ObjectID);
+	refcount_t RefCountNetOrder = htonl(NewRefCount);
+	::memcpy(mpData + offset, &RefCountNetOrder, sizeof(RefCountNetOrder));
+
+	if(mDirtyEnd <= mDirtyStart)
+	{
+		mDirtyStart = offset;
+		mDirtyEnd = offset;
+	}
+	mDirtyStart = std::min(mDirtyStart, offset);
+	mDirtyEnd = std::max(mDirtyEnd, offset + GetEntrySize());
+	mIsModified = true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreRefCountDatabase::ChangeRefCount(int64_t, int)
+//		Purpose: Add Delta to the refcount of an object, returning
+//			 the new value. Objects not yet in the database have
+//			 no references, but can't have any removed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreRefCountDatabase::refcount_t
+BackupStoreRefCountDatabase::ChangeRefCount(int64_t ObjectID, int Delta)
 {
 	refcount_t refcount;
 
-	if (ObjectID > GetLastObjectIDUsed())
+	if (Delta > 0 && ObjectID > mLastObjectID)
 	{
 		// new object, assume no previous references
 		refcount = 0;
@@ -321,30 +679,54 @@ void BackupStoreRefCountDatabase::AddReference(int64_t ObjectID)
 	{
 		// read previous value from database
 		refcount = GetRefCount(ObjectID);
+		ASSERT(Delta > 0 || refcount >= (refcount_t)(0 - Delta));
 	}
 
-	refcount++;
-
+	refcount += Delta;
 	SetRefCount(ObjectID, refcount);
+	return refcount;
 }
 
-void BackupStoreRefCountDatabase::SetRefCount(int64_t ObjectID,
-	refcount_t NewRefCount)
+bool BackupStoreRefCountDatabase::RemoveReference(int64_t ObjectID)
 {
-	IOStream::pos_type offset = GetOffset(ObjectID);
-	mapDatabaseFile->Seek(offset, SEEK_SET);
-	refcount_t RefCountNetOrder = htonl(NewRefCount);
-	mapDatabaseFile->Write(&RefCountNetOrder, sizeof(RefCountNetOrder));
-	mIsModified = true;
+	refcount_t refcount = ChangeRefCount(ObjectID, -1); // must exist in database
+	WriteBack();
+	return (refcount > 0);
 }
 
-bool BackupStoreRefCountDatabase::RemoveReference(int64_t ObjectID)
+void BackupStoreRefCountDatabase::AddReferences(
+	const std::vector<int64_t>& rObjectIDs)
 {
-	refcount_t refcount = GetRefCount(ObjectID); // must exist in database
-	ASSERT(refcount > 0);
-	refcount--;
-	SetRefCount(ObjectID, refcount);
-	return (refcount > 0);
+	if(rObjectIDs.empty())
+	{
+		return;
+	}
+
+	ExtendTo(*std::max_element(rObjectIDs.begin(), rObjectIDs.end()));
+
+	for(std::vector<int64_t>::const_iterator i = rObjectIDs.begin();
+		i != rObjectIDs.end(); i++)
+	{
+		ChangeRefCount(*i, 1);
+	}
+
+	WriteBack();
+}
+
+void BackupStoreRefCountDatabase::RemoveReferences(
+	const std::vector<int64_t>& rObjectIDs,
+	std::vector<int64_t>* pUnreferencedOut)
+{
+	for(std::vector<int64_t>::const_iterator i = rObjectIDs.begin();
+		i != rObjectIDs.end(); i++)
+	{
+		if(ChangeRefCount(*i, -1) == 0 && pUnreferencedOut != NULL)
+		{
+			pUnreferencedOut->push_back(*i);
+		}
+	}
+
+	WriteBack();
 }
 
 int BackupStoreRefCountDatabase::ReportChangesTo(BackupStoreRefCountDatabase& rOldRefs,
@@ -18,6 +18,12 @@
 #include "BackupStoreConstants.h"
 #include "FileStream.h"
 
+// Map the database into memory where possible, rather than reading and
+// writing each entry separately
+#if defined HAVE_SYS_MMAN_H && !defined WIN32
+	#define BOX_REFCOUNT_DATABASE_USE_MMAP
+#endif
+
 class BackupStoreCheck;
 class BackupStoreContext;
 
@@ -87,6 +93,12 @@ public:
 	void AddReference(int64_t ObjectID);
 	// RemoveReference returns false if refcount drops to zero
 	bool RemoveReference(int64_t ObjectID);
+	// Bulk versions, which only extend the database and write back
+	// changes once. RemoveReferences optionally returns the objects
+	// whose refcount dropped to zero.
+	void AddReferences(const std::vector<int64_t>& rObjectIDs);
+	void RemoveReferences(const std::vector<int64_t>& rObjectIDs,
+		std::vector<int64_t>* pUnreferencedOut = NULL);
 	int ReportChangesTo(BackupStoreRefCountDatabase& rOldRefs,
 		int64_t ignore_object_id = 0);
 
@@ -94,11 +106,6 @@ private:
 	static std::string GetFilename(const BackupStoreAccountDatabase::Entry&
 		rAccount, bool Temporary);
 
-	IOStream::pos_type GetSize() const
-	{
-		return mapDatabaseFile->GetPosition() +
-			mapDatabaseFile->BytesLeftToRead();
-	}
 	IOStream::pos_type GetEntrySize() const
 	{
 		return sizeof(refcount_t);
@@ -109,7 +116,15 @@ private:
 			sizeof(refcount_StreamFormat);
 	}
 	void SetRefCount(int64_t ObjectID, refcount_t NewRefCount);
-	
+	refcount_t ChangeRefCount(int64_t ObjectID, int Delta);
+
+	// Management of the in-memory copy of the file
+	void MapFile();
+	void Refresh() const;
+	void ExtendTo(int64_t LastObjectID);
+	void WriteBack();
+	void CloseFile(bool Sync);
+
 	// Location information
 	BackupStoreAccountDatabase::Entry mAccount;
 	std::string mFilename;
@@ -118,6 +133,17 @@ private:
 	bool mIsTemporaryFile;
 	std::auto_ptr<FileStream> mapDatabaseFile;
 
+	// The whole file, including the header, either mapped or read into
+	// memory. It may be bigger than the database itself, and than the
+	// file when mapped, to avoid resizing it for every new object.
+	// Read-only databases may be remapped by Refresh() when another
+	// process extends the file.
+	mutable uint8_t* mpData;
+	mutable IOStream::pos_type mDataSize;
+	mutable int64_t mLastObjectID;
+	// Range of bytes in mpData modified since the last WriteBack()
+	IOStream::pos_type mDirtyStart, mDirtyEnd;
+
 	bool NeedsCommitOrDiscard()
 	{
 		return mapDatabaseFile.get() && mIsModified && mIsTemporaryFile;
@@ -0,0 +1,637 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreSharedAccountState.cpp
+//		Purpose: Account details and store info shared between all
+//			 bbstored processes
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_MMAN_H
+	#include <sys/mman.h>
+#endif
+
+#include <vector>
+
+#include "BackupStoreAccountDatabase.h"
+#include "BackupStoreException.h"
+#include "BackupStoreInfo.h"
+#include "BackupStoreSharedAccountState.h"
+#include "CollectInBufferStream.h"
+#include "CommonException.h"
+#include "FileModificationTime.h"
+#include "MemBlockStream.h"
+#include "RaidFileController.h"
+#include "RaidFileRead.h"
+#include "RaidFileUtil.h"
+
+#include "MemLeakFindOn.h"
+
+// Number of times to try reading something which is being written by
+// another process, before giving up and using the disc instead
+#define SHARED_ACCOUNT_STATE_READ_TRIES	1000
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static SharedMemoryBarrier()
+//		Purpose: Static. Stop the compiler and CPU moving memory
+//			 accesses to the shared block across this point.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static inline void SharedMemoryBarrier()
+{
+#ifdef __GNUC__
+	__sync_synchronize();
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static BeginWrite(uint32_t *)
+//		Purpose: Static. Mark a sequence number as being written, so
+//			 that readers retry until EndWrite() is called. Makes
+//			 the number odd even if a previous writer died between
+//			 the two calls.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static uint32_t BeginWrite(uint32_t *pSequence)
+{
+	volatile uint32_t *pSeq = pSequence;
+	uint32_t writing = *pSeq | 1;
+	*pSeq = writing;
+	SharedMemoryBarrier();
+	return writing;
+}
+
+static void EndWrite(uint32_t *pSequence, uint32_t Writing)
+{
+	volatile uint32_t *pSeq = pSequence;
+	SharedMemoryBarrier();
+	*pSeq = Writing + 1;
+}
+
+static uint32_t ReadSequence(const uint32_t *pSequence)
+{
+	const volatile uint32_t *pSeq = pSequence;
+	uint32_t seq = *pSeq;
+	SharedMemoryBarrier();
+	return seq;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::BackupStoreSharedAccountState(int)
+//		Purpose: Constructor. The memory is shared with any processes
+//			 forked after this, or private if the platform can't
+//			 share memory, in which case it never forks anyway.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreSharedAccountState::BackupStoreSharedAccountState(int MaxAccounts)
+: mpMemory(NULL),
+  mMemorySize(0),
+  mMaxAccounts(MaxAccounts),
+  mpHeader(NULL),
+  mpAccounts(NULL),
+  mpInfoSlots(NULL),
+  mWarnedFull(false)
+{
+	if(mMaxAccounts < SHARED_ACCOUNT_STATE_MIN_ACCOUNTS)
+	{
+		mMaxAccounts = SHARED_ACCOUNT_STATE_MIN_ACCOUNTS;
+	}
+
+	// Keep the info slots aligned for their 64-bit members
+	size_t accountsSize = sizeof(AccountEntry) * mMaxAccounts;
+	accountsSize = (accountsSize + 7) & ~((size_t)7);
+	mMemorySize = sizeof(Header) + accountsSize +
+		(sizeof(InfoSlot) * mMaxAccounts);
+
+#ifdef HAVE_SYS_MMAN_H
+	void *pMemory = ::mmap(NULL, mMemorySize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANON, -1, 0);
+	if(pMemory == MAP_FAILED)
+	{
+		THROW_SYS_ERROR("Failed to allocate shared memory for "
+			"account state", CommonException, OSFileError);
+	}
+	mpMemory = (uint8_t *)pMemory;
+#else
+	mpMemory = (uint8_t *)::calloc(1, mMemorySize);
+	if(mpMemory == NULL)
+	{
+		throw std::bad_alloc();
+	}
+#endif
+
+	mpHeader = (Header *)mpMemory;
+	mpAccounts = (AccountEntry *)(mpMemory + sizeof(Header));
+	mpInfoSlots = (InfoSlot *)(mpMemory + sizeof(Header) + accountsSize);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::~BackupStoreSharedAccountState()
+//		Purpose: Destructor. Other processes keep their own mappings.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreSharedAccountState::~BackupStoreSharedAccountState()
+{
+#ifdef HAVE_SYS_MMAN_H
+	if(::munmap(mpMemory, mMemorySize) != 0)
+	{
+		BOX_LOG_SYS_ERROR("Failed to unmap shared account state");
+	}
+#else
+	::free(mpMemory);
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::UpdateAccounts(
+//			 BackupStoreAccountDatabase &)
+//		Purpose: Copy the account database into the shared table, if
+//			 it has changed since the last time. Each account keeps
+//			 its info slot for as long as it exists. Returns true if
+//			 the table was changed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreSharedAccountState::UpdateAccounts(
+	BackupStoreAccountDatabase &rDatabase)
+{
+	box_time_t modificationTime = rDatabase.GetModificationTime();
+	if(mpHeader->mDatabaseModificationTime == modificationTime)
+	{
+		return false;
+	}
+
+	// Returned in order of account ID
+	std::vector<int32_t> ids;
+	rDatabase.GetAllAccountIDs(ids);
+
+	if(ids.size() > (size_t)mMaxAccounts)
+	{
+		if(!mWarnedFull)
+		{
+			BOX_WARNING("Too many accounts to share between "
+				"processes (" << ids.size() << " > " <<
+				mMaxAccounts << "), the rest will be read "
+				"from disc. Restart bbstored to fix this.");
+			mWarnedFull = true;
+		}
+		ids.resize(mMaxAccounts);
+	}
+
+	// Only this process writes to the table, so it can be read here
+	// without any checks.
+	std::vector<AccountEntry> newTable(ids.size());
+	std::vector<bool> slotInUse(mMaxAccounts, false);
+	AccountEntry *pOldBegin = mpAccounts;
+	AccountEntry *pOldEnd = mpAccounts + mpHeader->mNumAccounts;
+
+	for(size_t i = 0; i < ids.size(); i++)
+	{
+		newTable[i].mAccountID = ids[i];
+		newTable[i].mDiscSet = rDatabase.GetEntry(ids[i]).GetDiscSet();
+		newTable[i].mInfoSlot = -1;
+
+		// Binary search in the old table
+		AccountEntry *pBegin = pOldBegin, *pEnd = pOldEnd;
+		while(pBegin < pEnd)
+		{
+			AccountEntry *pMid = pBegin + ((pEnd - pBegin) / 2);
+			if(pMid->mAccountID < ids[i])
+			{
+				pBegin = pMid + 1;
+			}
+			else
+			{
+				pEnd = pMid;
+			}
+		}
+
+		if(pBegin < pOldEnd && pBegin->mAccountID == ids[i])
+		{
+			newTable[i].mInfoSlot = pBegin->mInfoSlot;
+			slotInUse[pBegin->mInfoSlot] = true;
+		}
+	}
+
+	// Give new accounts the slots of deleted ones, or unused ones
+	std::vector<int32_t> newAccountSlots;
+	int32_t nextSlot = 0;
+	for(size_t i = 0; i < newTable.size(); i++)
+	{
+		if(newTable[i].mInfoSlot == -1)
+		{
+			while(slotInUse[nextSlot])
+			{
+				nextSlot++;
+			}
+			newTable[i].mInfoSlot = nextSlot;
+			slotInUse[nextSlot] = true;
+			newAccountSlots.push_back(nextSlot);
+		}
+	}
+
+	// Make sure that the new owner of a slot doesn't see the old
+	// account's info
+	for(std::vector<int32_t>::const_iterator i = newAccountSlots.begin();
+		i != newAccountSlots.end(); i++)
+	{
+		InfoSlot *pSlot = mpInfoSlots + *i;
+		uint32_t writing = BeginWrite(&pSlot->mSequence);
+		pSlot->mAccountID = 0;
+		pSlot->mSize = 0;
+		EndWrite(&pSlot->mSequence, writing);
+	}
+
+	uint32_t writing = BeginWrite(&mpHeader->mSequence);
+	if(!newTable.empty())
+	{
+		::memcpy(mpAccounts, &newTable[0],
+			newTable.size() * sizeof(AccountEntry));
+	}
+	mpHeader->mNumAccounts = newTable.size();
+	mpHeader->mDatabaseModificationTime = modificationTime;
+	EndWrite(&mpHeader->mSequence, writing);
+
+	BOX_TRACE("Shared account table updated with " << newTable.size() <<
+		" accounts");
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::LookupAccount(int32_t,
+//			 AccountEntry &)
+//		Purpose: Private. Find an account in the table, returning
+//			 false if it's not there.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreSharedAccountState::LookupAccount(int32_t AccountID,
+	AccountEntry &rEntryOut) const
+{
+	for(int tries = 0; tries < SHARED_ACCOUNT_STATE_READ_TRIES; tries++)
+	{
+		uint32_t seq = ReadSequence(&mpHeader->mSequence);
+		if(seq & 1)
+		{
+			// Being written
+			continue;
+		}
+
+		int32_t numAccounts = mpHeader->mNumAccounts;
+		if(numAccounts < 0 || numAccounts > mMaxAccounts)
+		{
+			continue;
+		}
+
+		int32_t begin = 0, end = numAccounts;
+		while(begin < end)
+		{
+			int32_t mid = begin + ((end - begin) / 2);
+			if(mpAccounts[mid].mAccountID < AccountID)
+			{
+				begin = mid + 1;
+			}
+			else
+			{
+				end = mid;
+			}
+		}
+
+		bool found = false;
+		if(begin < numAccounts &&
+			mpAccounts[begin].mAccountID == AccountID)
+		{
+			rEntryOut = mpAccounts[begin];
+			found = true;
+		}
+
+		if(ReadSequence(&mpHeader->mSequence) == seq)
+		{
+			return found && rEntryOut.mInfoSlot >= 0 &&
+				rEntryOut.mInfoSlot < mMaxAccounts;
+		}
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::GetAccount(int32_t, int &)
+//		Purpose: Find an account's disc set. Returns false if it
+//			 isn't known, in which case the caller should check
+//			 the account database itself, as the account may have
+//			 only just been created.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreSharedAccountState::GetAccount(int32_t AccountID,
+	int &rDiscSetOut) const
+{
+	AccountEntry entry;
+	if(!LookupAccount(AccountID, entry))
+	{
+		return false;
+	}
+
+	rDiscSetOut = entry.mDiscSet;
+	return true;
+}
+
+int BackupStoreSharedAccountState::GetNumberOfAccounts() const
+{
+	return mpHeader->mNumAccounts;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::ReadInfoSlot(
+//			 const InfoSlot *, InfoSlot &)
+//		Purpose: Private. Take a consistent copy of an info slot.
+//			 Returns false if the slot was being written the whole
+//			 time, perhaps by a process which died.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreSharedAccountState::ReadInfoSlot(const InfoSlot *pSlot,
+	InfoSlot &rCopyOut) const
+{
+	for(int tries = 0; tries < SHARED_ACCOUNT_STATE_READ_TRIES; tries++)
+	{
+		uint32_t seq = ReadSequence(&pSlot->mSequence);
+		if(seq & 1)
+		{
+			continue;
+		}
+
+		rCopyOut.mAccountID = pSlot->mAccountID;
+		rCopyOut.mSize = pSlot->mSize;
+		rCopyOut.mNotSaved = pSlot->mNotSaved;
+		rCopyOut.mFileVersion = pSlot->mFileVersion;
+		if(rCopyOut.mSize < 0 ||
+			rCopyOut.mSize > SHARED_ACCOUNT_STATE_INFO_SIZE)
+		{
+			continue;
+		}
+		::memcpy(rCopyOut.mData, pSlot->mData, rCopyOut.mSize);
+
+		if(ReadSequence(&pSlot->mSequence) == seq)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::LoadStoreInfo(int32_t,
+//			 const std::string &, int, bool)
+//		Purpose: Equivalent of BackupStoreInfo::Load(), which uses the
+//			 shared copy if the file on disc hasn't been changed
+//			 by another program since it was last saved. Info
+//			 loaded read-write from disc is shared for next time.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupStoreInfo> BackupStoreSharedAccountState::LoadStoreInfo(
+	int32_t AccountID, const std::string &rRootDir, int DiscSet,
+	bool ReadOnly)
+{
+	std::string filename(rRootDir + INFO_FILENAME);
+	AccountEntry entry;
+	InfoSlot *pSlot = NULL;
+
+	if(LookupAccount(AccountID, entry))
+	{
+		pSlot = mpInfoSlots + entry.mInfoSlot;
+		std::auto_ptr<InfoSlot> apCopy(new InfoSlot);
+		FileVersion version;
+
+		if(ReadInfoSlot(pSlot, *apCopy) &&
+			apCopy->mAccountID == AccountID &&
+			apCopy->mSize > 0 &&
+			GetFileVersion(DiscSet, filename, version) &&
+			version.mInode != 0 &&
+			::memcmp(&version, &apCopy->mFileVersion,
+				sizeof(version)) == 0)
+		{
+			MemBlockStream stream(apCopy->mData, apCopy->mSize);
+			std::auto_ptr<BackupStoreInfo> info(
+				BackupStoreInfo::Load(stream, filename,
+					ReadOnly));
+			info->mDiscSet = DiscSet;
+			// Make sure that changes made by a process which
+			// didn't save them get saved eventually. They were
+			// logged before being shared, so they're already
+			// in the usage log.
+			info->mIsModified = (apCopy->mNotSaved != 0);
+			info->AttachUsageLog(false); // don't replay
+			return info;
+		}
+	}
+
+	// Find out which version is on disc before reading it, so that if
+	// it's replaced in between, the slot is reloaded next time rather
+	// than the old contents being taken as the new version.
+	FileVersion version;
+	if(!GetFileVersion(DiscSet, filename, version))
+	{
+		::memset(&version, 0, sizeof(version));
+	}
+
+	std::auto_ptr<BackupStoreInfo> info(BackupStoreInfo::Load(AccountID,
+		rRootDir, DiscSet, ReadOnly));
+
+	// Only the holder of the write lock can write to the slot
+	if(pSlot != NULL && !ReadOnly)
+	{
+		CollectInBufferStream buffer;
+		info->WriteToStream(buffer);
+
+		std::auto_ptr<InfoSlot> apNew(new InfoSlot);
+		apNew->mAccountID = AccountID;
+		apNew->mSize = 0;
+		apNew->mNotSaved = 0;
+		apNew->mFileVersion = version;
+		// If the file can't be identified, it's not safe to share
+		if(version.mInode != 0 &&
+			buffer.GetSize() <= SHARED_ACCOUNT_STATE_INFO_SIZE)
+		{
+			apNew->mSize = buffer.GetSize();
+			::memcpy(apNew->mData, buffer.GetBuffer(),
+				apNew->mSize);
+		}
+		WriteInfoSlot(pSlot, *apNew);
+	}
+
+	return info;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::PublishStoreInfo(
+//			 BackupStoreInfo &, bool)
+//		Purpose: Copy the current values in a read-write store info
+//			 to the shared copy, so that other processes see them
+//			 immediately. Set SavedToDisc if the info was just
+//			 saved, otherwise the shared copy will be saved by the
+//			 next process to load it, if this one doesn't.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreSharedAccountState::PublishStoreInfo(BackupStoreInfo &rInfo,
+	bool SavedToDisc)
+{
+	ASSERT(!rInfo.IsReadOnly());
+
+	AccountEntry entry;
+	if(!LookupAccount(rInfo.GetAccountID(), entry))
+	{
+		return;
+	}
+
+	InfoSlot *pSlot = mpInfoSlots + entry.mInfoSlot;
+	std::auto_ptr<InfoSlot> apNew(new InfoSlot);
+	apNew->mAccountID = rInfo.GetAccountID();
+	apNew->mSize = 0;
+	apNew->mNotSaved = SavedToDisc ? 0 : 1;
+	::memset(&apNew->mFileVersion, 0, sizeof(apNew->mFileVersion));
+
+	if(SavedToDisc)
+	{
+		if(!GetFileVersion(rInfo.mDiscSet, rInfo.mFilename,
+			apNew->mFileVersion))
+		{
+			THROW_FILE_ERROR("Store info disappeared after saving",
+				rInfo.mFilename, BackupStoreException,
+				CouldNotLoadStoreInfo);
+		}
+	}
+	else
+	{
+		// Still based on the same file on disc as before. If we
+		// don't know which one that was, the slot can't be used.
+		std::auto_ptr<InfoSlot> apOld(new InfoSlot);
+		if(ReadInfoSlot(pSlot, *apOld) &&
+			apOld->mAccountID == rInfo.GetAccountID() &&
+			apOld->mSize > 0)
+		{
+			apNew->mFileVersion = apOld->mFileVersion;
+		}
+		else
+		{
+			WriteInfoSlot(pSlot, *apNew);
+			return;
+		}
+	}
+
+	CollectInBufferStream buffer;
+	rInfo.WriteToStream(buffer);
+	if(apNew->mFileVersion.mInode != 0 &&
+		buffer.GetSize() <= SHARED_ACCOUNT_STATE_INFO_SIZE)
+	{
+		apNew->mSize = buffer.GetSize();
+		::memcpy(apNew->mData, buffer.GetBuffer(), apNew->mSize);
+	}
+
+	WriteInfoSlot(pSlot, *apNew);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::GetFileVersion(int,
+//			 const std::string &, FileVersion &)
+//		Purpose: Private. Static. Identify the version of a RaidFile
+//			 which is on disc now, from the write file or the
+//			 first RAID component which exists. Returns false if
+//			 the file doesn't exist. The inode is 0 if the
+//			 platform doesn't have them, in which case the file
+//			 can't be identified.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+bool BackupStoreSharedAccountState::GetFileVersion(int DiscSet,
+	const std::string &rFilename, FileVersion &rVersionOut)
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet &rdiscSet(rcontroller.GetDiscSet(DiscSet));
+
+	int startDisc = 0;
+	std::vector<std::string> candidates;
+	candidates.push_back(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		rFilename, &startDisc));
+	for(int f = 0; f < (int)rdiscSet.size(); f++)
+	{
+		candidates.push_back(RaidFileUtil::MakeRaidComponentName(
+			rdiscSet, rFilename, (f + startDisc) % rdiscSet.size()));
+	}
+
+	for(std::vector<std::string>::const_iterator
+		i = candidates.begin(); i != candidates.end(); i++)
+	{
+		EMU_STRUCT_STAT st;
+		if(EMU_STAT(i->c_str(), &st) == 0)
+		{
+			::memset(&rVersionOut, 0, sizeof(rVersionOut));
+			rVersionOut.mInode = st.st_ino;
+			rVersionOut.mSize = st.st_size;
+			rVersionOut.mModificationTime =
+				FileModificationTime(st);
+			rVersionOut.mAttrModificationTime =
+				FileAttrModificationTime(st);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreSharedAccountState::WriteInfoSlot(InfoSlot *,
+//			 const InfoSlot &)
+//		Purpose: Private. Replace the contents of an info slot.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreSharedAccountState::WriteInfoSlot(InfoSlot *pSlot,
+	const InfoSlot &rNew)
+{
+	uint32_t writing = BeginWrite(&pSlot->mSequence);
+	pSlot->mAccountID = rNew.mAccountID;
+	pSlot->mSize = rNew.mSize;
+	pSlot->mNotSaved = rNew.mNotSaved;
+	pSlot->mFileVersion = rNew.mFileVersion;
+	::memcpy(pSlot->mData, rNew.mData, rNew.mSize);
+	EndWrite(&pSlot->mSequence, writing);
+}
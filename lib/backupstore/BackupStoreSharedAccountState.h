@@ -0,0 +1,121 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreSharedAccountState.h
+//		Purpose: Account details and store info shared between all
+//			 bbstored processes
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPSTORESHAREDACCOUNTSTATE__H
+#define BACKUPSTORESHAREDACCOUNTSTATE__H
+
+#include <memory>
+#include <string>
+
+#include "BoxTime.h"
+
+class BackupStoreAccountDatabase;
+class BackupStoreInfo;
+
+// Minimum number of accounts which can be held, so that accounts can be
+// created while the daemon is running
+#define SHARED_ACCOUNT_STATE_MIN_ACCOUNTS	1024
+
+// Space for a serialised BackupStoreInfo. Larger ones, with very many
+// deleted directories, are always read from disc.
+#define SHARED_ACCOUNT_STATE_INFO_SIZE		4000
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupStoreSharedAccountState
+//		Purpose: A block of memory, created by the main bbstored
+//			 process before it forks, holding the account database
+//			 and a copy of each account's store info. Connections
+//			 and housekeeping find accounts and load the store info
+//			 from here instead of from disc, and update the usage
+//			 counters here as soon as they change. Only the main
+//			 process writes to the account table, and only the
+//			 holder of an account's write lock writes its store
+//			 info, so readers only need to detect torn reads.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupStoreSharedAccountState
+{
+public:
+	BackupStoreSharedAccountState(int MaxAccounts);
+	~BackupStoreSharedAccountState();
+private:
+	// no copying
+	BackupStoreSharedAccountState(const BackupStoreSharedAccountState &);
+	BackupStoreSharedAccountState &operator=(
+		const BackupStoreSharedAccountState &);
+public:
+
+	// Account table, which must only be updated by the main process
+	bool UpdateAccounts(BackupStoreAccountDatabase &rDatabase);
+	bool GetAccount(int32_t AccountID, int &rDiscSetOut) const;
+	int GetNumberOfAccounts() const;
+
+	// Store info, which must only be saved by the holder of the write lock
+	std::auto_ptr<BackupStoreInfo> LoadStoreInfo(int32_t AccountID,
+		const std::string &rRootDir, int DiscSet, bool ReadOnly);
+	void PublishStoreInfo(BackupStoreInfo &rInfo, bool SavedToDisc);
+
+	typedef struct
+	{
+		int32_t mAccountID;
+		int32_t mDiscSet;
+		int32_t mInfoSlot;
+	} AccountEntry;
+
+	// Identifies one version of the info file on disc. Unlike a
+	// RaidFile revision ID, which is only the modification time to the
+	// second and the size, this changes however quickly the file is
+	// rewritten, because every save creates a new file while the old
+	// one still exists, so it can't have the same inode.
+	typedef struct
+	{
+		int64_t mInode;		// 0 if not known
+		int64_t mSize;
+		box_time_t mModificationTime;
+		box_time_t mAttrModificationTime;
+	} FileVersion;
+
+	typedef struct
+	{
+		uint32_t mSequence;
+		int32_t mAccountID;
+		int32_t mSize;		// 0 if not in use
+		int32_t mNotSaved;	// contains changes not yet on disc
+		FileVersion mFileVersion; // of the info file last read or written
+		uint8_t mData[SHARED_ACCOUNT_STATE_INFO_SIZE];
+	} InfoSlot;
+
+private:
+	bool LookupAccount(int32_t AccountID, AccountEntry &rEntryOut) const;
+	bool ReadInfoSlot(const InfoSlot *pSlot, InfoSlot &rCopyOut) const;
+	void WriteInfoSlot(InfoSlot *pSlot, const InfoSlot &rNew);
+	static bool GetFileVersion(int DiscSet, const std::string &rFilename,
+		FileVersion &rVersionOut);
+
+	typedef struct
+	{
+		uint32_t mSequence;
+		int32_t mNumAccounts;
+		box_time_t mDatabaseModificationTime;
+	} Header;
+
+	uint8_t *mpMemory;
+	size_t mMemorySize;
+	int mMaxAccounts;
+	Header *mpHeader;
+	AccountEntry *mpAccounts;	// sorted by ID
+	InfoSlot *mpInfoSlots;
+	bool mWarnedFull;
+};
+
+#endif // BACKUPSTORESHAREDACCOUNTSTATE__H
@@ -0,0 +1,325 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreUsageLog.cpp
+//		Purpose: Log of changes to an account's usage counts made
+//			 since the store info was last saved
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "BackupStoreUsageLog.h"
+#include "CommonException.h"
+#include "FileStream.h"
+#include "RaidFileController.h"
+#include "RaidFileUtil.h"
+#include "Utils.h"
+
+#include "MemLeakFindOn.h"
+
+#define USAGE_LOG_MAGIC_VALUE	0x55736167 // Usag
+#define USAGE_LOG_FILENAME	"usage.log"
+
+// The counts in BackupStoreInfo::Adjustment, in the order they're stored
+#define USAGE_LOG_NUM_VALUES	10
+#define USAGE_LOG_RECORD_SIZE	(USAGE_LOG_NUM_VALUES * sizeof(int64_t))
+
+// Magic value, unused, counts the changes apply to
+#define USAGE_LOG_HEADER_SIZE	(4 + 4 + USAGE_LOG_RECORD_SIZE)
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static EncodeValues(const BackupStoreInfo::Adjustment &,
+//			 uint8_t *)
+//		Purpose: Write the counts in network byte order
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void EncodeValues(const BackupStoreInfo::Adjustment &rValues,
+	uint8_t *pOutput)
+{
+	int64_t values[USAGE_LOG_NUM_VALUES] =
+	{
+		rValues.mLastObjectIDUsed,
+		rValues.mBlocksUsed,
+		rValues.mBlocksInCurrentFiles,
+		rValues.mBlocksInOldFiles,
+		rValues.mBlocksInDeletedFiles,
+		rValues.mBlocksInDirectories,
+		rValues.mNumCurrentFiles,
+		rValues.mNumOldFiles,
+		rValues.mNumDeletedFiles,
+		rValues.mNumDirectories
+	};
+
+	for(int i = 0; i < USAGE_LOG_NUM_VALUES; i++)
+	{
+		int64_t value = box_hton64(values[i]);
+		::memcpy(pOutput + (i * sizeof(int64_t)), &value,
+			sizeof(value));
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static DecodeValues(const uint8_t *,
+//			 BackupStoreInfo::Adjustment &)
+//		Purpose: Read counts written by EncodeValues()
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void DecodeValues(const uint8_t *pInput,
+	BackupStoreInfo::Adjustment &rValuesOut)
+{
+	int64_t values[USAGE_LOG_NUM_VALUES];
+	for(int i = 0; i < USAGE_LOG_NUM_VALUES; i++)
+	{
+		int64_t value;
+		::memcpy(&value, pInput + (i * sizeof(int64_t)),
+			sizeof(value));
+		values[i] = box_ntoh64(value);
+	}
+
+	rValuesOut.mLastObjectIDUsed = values[0];
+	rValuesOut.mBlocksUsed = values[1];
+	rValuesOut.mBlocksInCurrentFiles = values[2];
+	rValuesOut.mBlocksInOldFiles = values[3];
+	rValuesOut.mBlocksInDeletedFiles = values[4];
+	rValuesOut.mBlocksInDirectories = values[5];
+	rValuesOut.mNumCurrentFiles = values[6];
+	rValuesOut.mNumOldFiles = values[7];
+	rValuesOut.mNumDeletedFiles = values[8];
+	rValuesOut.mNumDirectories = values[9];
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::BackupStoreUsageLog(
+//			 const std::string &, int)
+//		Purpose: Constructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreUsageLog::BackupStoreUsageLog(const std::string &rStoreRoot,
+	int DiscSet)
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(DiscSet));
+	mFilename = RaidFileUtil::MakeWriteFileName(rdiscSet,
+		rStoreRoot + USAGE_LOG_FILENAME);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::~BackupStoreUsageLog()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreUsageLog::~BackupStoreUsageLog()
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::Replay(
+//			 BackupStoreInfo::Adjustment &)
+//		Purpose: If the log was started with the counts given, add
+//			 the changes logged since to them, and return true.
+//			 Otherwise the info has been saved since, and already
+//			 includes them, or the log is missing or damaged, so
+//			 the counts are left alone and the log mustn't be
+//			 added to until it's been reset. A change which was
+//			 only partly written when the log was last appended
+//			 to is ignored, as the operation it belongs to didn't
+//			 finish.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreUsageLog::Replay(BackupStoreInfo::Adjustment &rValues)
+{
+	int64_t fileSize = 0;
+	if(!FileExists(mFilename, &fileSize))
+	{
+		return false;
+	}
+
+	if(fileSize < (int64_t)USAGE_LOG_HEADER_SIZE)
+	{
+		BOX_WARNING("Ignoring damaged usage log: " << mFilename);
+		return false;
+	}
+
+	FileStream file(mFilename);
+	std::vector<uint8_t> data(fileSize);
+	if(!file.ReadFullBuffer(&data[0], fileSize, 0))
+	{
+		THROW_FILE_ERROR("Failed to read usage log", mFilename,
+			CommonException, OSFileReadError);
+	}
+
+	int32_t magic;
+	::memcpy(&magic, &data[0], sizeof(magic));
+	if(ntohl(magic) != USAGE_LOG_MAGIC_VALUE)
+	{
+		BOX_WARNING("Ignoring usage log with bad magic value: " <<
+			mFilename);
+		return false;
+	}
+
+	BackupStoreInfo::Adjustment base;
+	DecodeValues(&data[8], base);
+	if(::memcmp(&base, &rValues, sizeof(base)) != 0)
+	{
+		// The info has been saved since the log was started
+		return false;
+	}
+
+	int64_t numRecords = (fileSize - USAGE_LOG_HEADER_SIZE) /
+		USAGE_LOG_RECORD_SIZE;
+	if(numRecords * (int64_t)USAGE_LOG_RECORD_SIZE !=
+		fileSize - (int64_t)USAGE_LOG_HEADER_SIZE)
+	{
+		BOX_WARNING("Ignoring incomplete change at the end of usage "
+			"log: " << mFilename);
+	}
+
+	for(int64_t r = 0; r < numRecords; r++)
+	{
+		BackupStoreInfo::Adjustment change;
+		DecodeValues(&data[USAGE_LOG_HEADER_SIZE +
+			(r * USAGE_LOG_RECORD_SIZE)], change);
+
+		rValues.mLastObjectIDUsed += change.mLastObjectIDUsed;
+		rValues.mBlocksUsed += change.mBlocksUsed;
+		rValues.mBlocksInCurrentFiles += change.mBlocksInCurrentFiles;
+		rValues.mBlocksInOldFiles += change.mBlocksInOldFiles;
+		rValues.mBlocksInDeletedFiles += change.mBlocksInDeletedFiles;
+		rValues.mBlocksInDirectories += change.mBlocksInDirectories;
+		rValues.mNumCurrentFiles += change.mNumCurrentFiles;
+		rValues.mNumOldFiles += change.mNumOldFiles;
+		rValues.mNumDeletedFiles += change.mNumDeletedFiles;
+		rValues.mNumDirectories += change.mNumDirectories;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::Append(
+//			 const BackupStoreInfo::Adjustment &)
+//		Purpose: Record a change to the counts. Returns false if
+//			 there's no log, or it can't be written, or it ends
+//			 with a partly written change, in which case the
+//			 caller must save the info instead.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreUsageLog::Append(const BackupStoreInfo::Adjustment &rChange)
+{
+	try
+	{
+		if(!mapAppendFile.get())
+		{
+			int64_t fileSize = 0;
+			if(!FileExists(mFilename, &fileSize) ||
+				fileSize < (int64_t)USAGE_LOG_HEADER_SIZE ||
+				((fileSize - USAGE_LOG_HEADER_SIZE) %
+				 USAGE_LOG_RECORD_SIZE) != 0)
+			{
+				return false;
+			}
+
+			mapAppendFile.reset(new FileStream(mFilename,
+				O_WRONLY | O_APPEND | O_BINARY));
+		}
+
+		uint8_t record[USAGE_LOG_RECORD_SIZE];
+		EncodeValues(rChange, record);
+		mapAppendFile->Write(record, sizeof(record));
+	}
+	catch(BoxException &e)
+	{
+		BOX_WARNING("Failed to add to usage log " << mFilename <<
+			", saving the store info instead: " << e.what());
+		mapAppendFile.reset();
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::Reset(
+//			 const BackupStoreInfo::Adjustment &)
+//		Purpose: Replace the log with an empty one for the counts
+//			 just saved in the info.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreUsageLog::Reset(const BackupStoreInfo::Adjustment &rValues)
+{
+	mapAppendFile.reset();
+
+	uint8_t header[USAGE_LOG_HEADER_SIZE];
+	::memset(header, 0, sizeof(header));
+	int32_t magic = htonl(USAGE_LOG_MAGIC_VALUE);
+	::memcpy(&header[0], &magic, sizeof(magic));
+	EncodeValues(rValues, &header[8]);
+
+	std::string tempFilename(mFilename + "X");
+	{
+		FileStream file(tempFilename,
+			O_WRONLY | O_CREAT | O_TRUNC | O_BINARY);
+		file.Write(header, sizeof(header));
+	}
+
+	#ifdef WIN32
+	if(FileExists(mFilename) && EMU_UNLINK(mFilename.c_str()) != 0)
+	{
+		THROW_EMU_FILE_ERROR("Failed to delete old usage log",
+			mFilename, CommonException, OSFileError);
+	}
+	#endif
+
+	if(::rename(tempFilename.c_str(), mFilename.c_str()) != 0)
+	{
+		THROW_EMU_ERROR("Failed to rename usage log from " <<
+			tempFilename << " to " << mFilename, CommonException,
+			OSFileError);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreUsageLog::Delete()
+//		Purpose: Remove the log, for when it can't be reset. Changes
+//			 are then saved in the info until it can be.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreUsageLog::Delete()
+{
+	mapAppendFile.reset();
+
+	if(FileExists(mFilename) && EMU_UNLINK(mFilename.c_str()) != 0)
+	{
+		BOX_LOG_SYS_ERROR("Failed to delete usage log: " << mFilename);
+	}
+}
@@ -0,0 +1,63 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupStoreUsageLog.h
+//		Purpose: Log of changes to an account's usage counts made
+//			 since the store info was last saved
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPSTOREUSAGELOG__H
+#define BACKUPSTOREUSAGELOG__H
+
+#include <memory>
+#include <string>
+
+#include "BackupStoreInfo.h"
+
+class FileStream;
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupStoreUsageLog
+//		Purpose: A file next to the store info, holding the usage
+//			 counts which were saved in the info when the log was
+//			 started, followed by the changes made to them since.
+//			 Appending a change is much cheaper than rewriting the
+//			 info, and a crash can't lose it. The changes are only
+//			 replayed if the info still holds the counts the log
+//			 was started with, so a log which the info has been
+//			 saved over is ignored. Only the holder of the
+//			 account's write lock may change it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupStoreUsageLog
+{
+public:
+	BackupStoreUsageLog(const std::string &rStoreRoot, int DiscSet);
+	~BackupStoreUsageLog();
+private:
+	// no copying
+	BackupStoreUsageLog(const BackupStoreUsageLog &);
+	BackupStoreUsageLog &operator=(const BackupStoreUsageLog &);
+public:
+
+	// Adds the logged changes to the counts, if they apply to them
+	bool Replay(BackupStoreInfo::Adjustment &rValues);
+	// Returns false if there's no usable log to add to
+	bool Append(const BackupStoreInfo::Adjustment &rChange);
+	// Start again, once the info has been saved with these counts
+	void Reset(const BackupStoreInfo::Adjustment &rValues);
+	void Delete();
+
+	const std::string &GetFilename() const {return mFilename;}
+
+private:
+	std::string mFilename;
+	std::auto_ptr<FileStream> mapAppendFile;
+};
+
+#endif // BACKUPSTOREUSAGELOG__H
@@ -9,22 +9,41 @@
 
 #include "Box.h"
 
+#include <errno.h>
 #include <stdio.h>
 
+#ifdef HAVE_SYS_WAIT_H
+#	include <sys/wait.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#	include <signal.h>
+#endif
+
+#include <algorithm>
 #include <map>
+#include <set>
+#include <vector>
 
 #include "autogen_BackupStoreException.h"
 #include "BackupConstants.h"
 #include "BackupStoreAccountDatabase.h"
 #include "BackupStoreConstants.h"
 #include "BackupStoreDirectory.h"
+#include "BackupStoreDirtyDirectoryLog.h"
 #include "BackupStoreFile.h"
 #include "BackupStoreInfo.h"
 #include "BackupStoreRefCountDatabase.h"
+#include "BackupStoreSharedAccountState.h"
 #include "BufferedStream.h"
+#include "BufferedWriteStream.h"
+#include "FileStream.h"
+#include "InvisibleTempFileStream.h"
 #include "HousekeepStoreAccount.h"
 #include "NamedLock.h"
+#include "RaidFileController.h"
 #include "RaidFileRead.h"
+#include "RaidFileUtil.h"
 #include "RaidFileWrite.h"
 #include "StoreStructure.h"
 
@@ -33,6 +52,90 @@
 // check every 32 directories scanned/files deleted
 #define POLL_INTERPROCESS_MSG_CHECK_FREQUENCY	32
 
+// about 20MB of candidates for deletion
+#define MAX_POTENTIAL_DELETIONS_IN_MEMORY	(256*1024)
+
+// temporary files of candidates for deletion, before merging them into one
+#define MAX_DELETION_RUNS			8
+
+// files deleted, or directories changed, before saving the directories
+#define DELETION_BATCH_MAX_FILES	64
+
+// merges of patches started before saving the directories, unless there
+// are more merge processes to keep busy
+#define DELETION_BATCH_MAX_MERGES	16
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    HousekeepStoreAccount::DeletionBatch
+//		Purpose: Files being deleted, with the directories they're
+//			 in, which are saved once for the whole batch rather
+//			 than once for each file. Directories loaded for the
+//			 batch are owned by it. Anything not flushed is
+//			 thrown away when it's destroyed, including merges
+//			 still running.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class HousekeepStoreAccount::DeletionBatch
+{
+public:
+	typedef struct
+	{
+		BackupStoreDirectory *mpDirectory;
+		std::string mFilename;
+		bool mOwned;
+		bool mModified;
+		bool mFileRemoved;
+	} Directory;
+
+	DeletionBatch()
+	: mNumMerges(0),
+	  mBlocksToFree(0)
+	{
+	}
+	~DeletionBatch()
+	{
+		DiscardDeletions();
+		for(std::map<int64_t, Directory>::iterator
+			i(mDirectories.begin()); i != mDirectories.end(); ++i)
+		{
+			if(i->second.mOwned)
+			{
+				delete i->second.mpDirectory;
+			}
+		}
+	}
+private:
+	// no copying
+	DeletionBatch(const DeletionBatch &);
+	DeletionBatch &operator=(const DeletionBatch &);
+public:
+
+	Directory *Find(int64_t DirectoryID)
+	{
+		std::map<int64_t, Directory>::iterator i(
+			mDirectories.find(DirectoryID));
+		return (i == mDirectories.end()) ? NULL : &(i->second);
+	}
+	Directory &AddDirectory(int64_t DirectoryID,
+		BackupStoreDirectory *pDirectory, const std::string &rFilename,
+		bool Owned);
+	bool MergeWouldConflict(BackupStoreDirectory &rDirectory,
+		int64_t ObjectID) const;
+	bool IsFull(int MaxMergeProcesses) const;
+	void DiscardDeletions();
+	void Finished();
+
+	std::map<int64_t, Directory> mDirectories;
+	std::vector<PendingDeletion> mDeletions;
+	// Objects which merges in this batch are writing
+	std::set<int64_t> mAdjustedObjects;
+	int mNumMerges;
+	int64_t mBlocksToFree;
+};
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -51,6 +154,10 @@ HousekeepStoreAccount::HousekeepStoreAccount(int AccountID,
 	  mDeletionSizeTarget(0),
   	  mPotentialDeletionsTotalSize(0),
 	  mMaxSizeInPotentialDeletions(0),
+	  mMaxPotentialDeletionsInMemory(MAX_POTENTIAL_DELETIONS_IN_MEMORY),
+	  mNextDeletionRunNumber(0),
+	  mMaxSizeInDeletionRuns(0),
+	  mHaveDeletionCutoff(false),
 	  mErrorCount(0),
 	  mBlocksUsed(0),
 	  mBlocksInOldFiles(0),
@@ -62,7 +169,19 @@ HousekeepStoreAccount::HousekeepStoreAccount(int AccountID,
 	  mBlocksInDirectoriesDelta(0),
 	  mFilesDeleted(0),
 	  mEmptyDirectoriesDeleted(0),
-	  mCountUntilNextInterprocessMsgCheck(POLL_INTERPROCESS_MSG_CHECK_FREQUENCY)
+	  mPackIndex(rStoreRoot, StoreDiscSet),
+	  mPackFileObjectSizeLimit(0),
+	  mpSharedAccountState(NULL),
+	  mMaxPatchChainDepth(0),
+	  mMaxPatchChainBlocks(0),
+	  mPatchesRebased(0),
+	  mMaxMergeProcesses(1),
+	  mCountUntilNextInterprocessMsgCheck(POLL_INTERPROCESS_MSG_CHECK_FREQUENCY),
+	  mFullScanInterval(0),
+	  mIncremental(false),
+	  mMaxOperationsPerSecond(0),
+	  mOperationsInPeriod(0),
+	  mPeriodStart(0)
 {
 	std::ostringstream tag;
 	tag << "hk=" << BOX_FORMAT_ACCOUNT(mAccountID);
@@ -79,7 +198,11 @@ HousekeepStoreAccount::HousekeepStoreAccount(int AccountID,
 // --------------------------------------------------------------------------
 HousekeepStoreAccount::~HousekeepStoreAccount()
 {
-	if(mapNewRefs.get())
+	DeleteDeletionRuns();
+
+	// The permanent database is used in place when housekeeping
+	// incrementally, and only a temporary one needs discarding
+	if(mapNewRefs.get() && !mIncremental)
 	{
 		// Discard() can throw exception, but destructors aren't supposed to do that, so
 		// just catch and log them.
@@ -133,12 +256,14 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 		}
 	}
 
+	// No session can be staging files for the one with the write lock
+	// while we hold it, so any files still staged were left by one
+	// which didn't finish cleanly, and will never be added
+	StoreStructure::DeleteStagedFiles(mStoreRoot, mStoreDiscSet);
+
 	// Load the store info to find necessary info for the housekeeping
-	std::auto_ptr<BackupStoreInfo> info(BackupStoreInfo::Load(mAccountID,
-		mStoreRoot, mStoreDiscSet, false /* Read/Write */));
-	std::auto_ptr<BackupStoreInfo> pOldInfo(
-		BackupStoreInfo::Load(mAccountID, mStoreRoot, mStoreDiscSet,
-			true /* Read Only */));
+	std::auto_ptr<BackupStoreInfo> info(LoadStoreInfo(false /* Read/Write */));
+	std::auto_ptr<BackupStoreInfo> pOldInfo(LoadStoreInfo(true /* Read Only */));
 
 	// If the account has a name, change the logging tag to include it
 	if(!(info->GetAccountName().empty()))
@@ -157,12 +282,54 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 	}
 
 	BackupStoreAccountDatabase::Entry account(mAccountID, mStoreDiscSet);
-	mapNewRefs = BackupStoreRefCountDatabase::Create(account);
+
+	// Only look at the directories which clients have changed since
+	// the last run, unless files must be deleted to get under the soft
+	// limit (the oldest could be anywhere), or it's time to check the
+	// whole account again.
+	BackupStoreDirtyDirectoryLog dirtyLog(mStoreRoot, mStoreDiscSet);
+	std::set<int64_t> dirtyDirectories;
+	box_time_t startTime = GetCurrentBoxTime();
+	box_time_t lastFullScan = 0;
+	if(mFullScanInterval > 0 && mDeletionSizeTarget == 0 &&
+		dirtyLog.Read(dirtyDirectories, lastFullScan) &&
+		startTime >= lastFullScan &&
+		startTime - lastFullScan < mFullScanInterval)
+	{
+		// Reference counts are kept up to date by the clients, and
+		// aren't recalculated
+		try
+		{
+			mapNewRefs = BackupStoreRefCountDatabase::Load(account,
+				false);
+			mIncremental = true;
+		}
+		catch(BoxException &e)
+		{
+			BOX_WARNING("Reference count database is missing or "
+				"corrupted, scanning the whole account: " <<
+				e.what());
+		}
+	}
+
+	if(mIncremental)
+	{
+		BOX_TRACE("Housekeeping " << dirtyDirectories.size() <<
+			" changed directories");
+	}
+	else
+	{
+		mapNewRefs = BackupStoreRefCountDatabase::Create(account);
+	}
+
+	// Find out which objects are already packed
+	mPackIndex.Load();
 
 	// Scan the directory for potential things to delete
 	// This will also remove eligible items marked with RemoveASAP
-	bool continueHousekeeping = ScanDirectory(BACKUPSTORE_ROOT_DIRECTORY_ID,
-		*info);
+	bool continueHousekeeping = mIncremental ?
+		ScanChangedDirectories(dirtyDirectories, *info) :
+		ScanDirectory(BACKUPSTORE_ROOT_DIRECTORY_ID, *info);
 
 	if(!continueHousekeeping)
 	{
@@ -205,33 +372,47 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 
 	if(!continueHousekeeping)
 	{
-		mapNewRefs->Discard();
-		info->Save();
+		if(mIncremental)
+		{
+			mapNewRefs.reset();
+		}
+		else
+		{
+			mapNewRefs->Discard();
+		}
+		mPackIndex.Save();
+		SaveStoreInfo(*info);
 		return false;
 	}
 
 	// Report any UNexpected changes, and consider them to be errors.
 	// Do this before applying the expected changes below.
-	mErrorCount += info->ReportChangesTo(*pOldInfo);
-	info->Save();
+	if(!mIncremental)
+	{
+		mErrorCount += info->ReportChangesTo(*pOldInfo);
+	}
+	SaveStoreInfo(*info);
 
 	// Try to load the old reference count database and check whether
 	// any counts have changed. We want to compare the mapNewRefs to
 	// apOldRefs before we delete any files, because that will also change
 	// the reference count in a way that's not an error.
 
-	try
-	{
-		std::auto_ptr<BackupStoreRefCountDatabase> apOldRefs =
-			BackupStoreRefCountDatabase::Load(account, false);
-		mErrorCount += mapNewRefs->ReportChangesTo(*apOldRefs);
-	}
-	catch(BoxException &e)
+	if(!mIncremental)
 	{
-		BOX_WARNING("Reference count database was missing or "
-			"corrupted during housekeeping, cannot check it for "
-			"errors.");
-		mErrorCount++;
+		try
+		{
+			std::auto_ptr<BackupStoreRefCountDatabase> apOldRefs =
+				BackupStoreRefCountDatabase::Load(account, false);
+			mErrorCount += mapNewRefs->ReportChangesTo(*apOldRefs);
+		}
+		catch(BoxException &e)
+		{
+			BOX_WARNING("Reference count database was missing or "
+				"corrupted during housekeeping, cannot check it "
+				"for errors.");
+			mErrorCount++;
+		}
 	}
 
 	// Go and delete items from the accounts
@@ -244,6 +425,24 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 		deleteInterrupted = DeleteEmptyDirectories(*info);
 	}
 
+	// Turn old versions at the end of long patch chains back into
+	// complete files, now that any which were going to be deleted
+	// have gone
+	if(!deleteInterrupted)
+	{
+		deleteInterrupted = RebasePatchChains();
+	}
+
+	// Move small old objects into packs, and tidy up the packs. This
+	// only moves data around, so it doesn't affect the usage counts.
+	if(!deleteInterrupted)
+	{
+		PackObjects();
+	}
+
+	// Save the removal of any deleted objects from the packs
+	mPackIndex.Save();
+
 	// Log deletion if anything was deleted
 	if(mFilesDeleted > 0 || mEmptyDirectoriesDeleted > 0)
 	{
@@ -283,12 +482,23 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 	info->ChangeBlocksInDirectories(mBlocksInDirectoriesDelta);
 
 	// Save the store info back
-	info->Save();
+	SaveStoreInfo(*info);
 
 	// force file to be saved and closed before releasing the lock below
-	mapNewRefs->Commit();
+	if(!mIncremental)
+	{
+		mapNewRefs->Commit();
+	}
 	mapNewRefs.reset();
 
+	// Everything which clients changed has now been looked at. The log
+	// is only started by a full scan, and only if it's wanted.
+	if(!deleteInterrupted &&
+		(mFullScanInterval > 0 || dirtyLog.Exists()))
+	{
+		dirtyLog.Reset(mIncremental ? lastFullScan : startTime);
+	}
+
 	// Explicity release the lock (would happen automatically on
 	// going out of scope, included for code clarity)
 	writeLock.ReleaseLock();
@@ -300,6 +510,80 @@ bool HousekeepStoreAccount::DoHousekeeping(bool KeepTryingForever)
 
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::LoadStoreInfo(bool)
+//		Purpose: Load the store info, from shared memory if possible
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupStoreInfo> HousekeepStoreAccount::LoadStoreInfo(
+	bool ReadOnly)
+{
+	if(mpSharedAccountState)
+	{
+		return mpSharedAccountState->LoadStoreInfo(mAccountID,
+			mStoreRoot, mStoreDiscSet, ReadOnly);
+	}
+
+	return BackupStoreInfo::Load(mAccountID, mStoreRoot, mStoreDiscSet,
+		ReadOnly);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::SaveStoreInfo(BackupStoreInfo &)
+//		Purpose: Save the store info, and share the new values with
+//			 client connections
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::SaveStoreInfo(BackupStoreInfo& rBackupStoreInfo)
+{
+	rBackupStoreInfo.Save();
+
+	if(mpSharedAccountState)
+	{
+		mpSharedAccountState->PublishStoreInfo(rBackupStoreInfo,
+			true); // saved to disc
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::ThrottleOperation()
+//		Purpose: Private. Count a directory read or object deleted,
+//			 and sleep for the rest of the second if the budget
+//			 set by SetMaxOperationsPerSecond() has been used.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::ThrottleOperation()
+{
+	if(mMaxOperationsPerSecond <= 0)
+	{
+		return;
+	}
+
+	box_time_t now = GetCurrentBoxTime();
+	if(now - mPeriodStart >= MICRO_SEC_IN_SEC_LL || now < mPeriodStart)
+	{
+		// Start a new period
+		mPeriodStart = now;
+		mOperationsInPeriod = 0;
+	}
+
+	if(++mOperationsInPeriod > mMaxOperationsPerSecond)
+	{
+		ShortSleep(mPeriodStart + MICRO_SEC_IN_SEC_LL - now, false);
+		mPeriodStart = GetCurrentBoxTime();
+		mOperationsInPeriod = 1;
+	}
+}
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -326,7 +610,8 @@ void HousekeepStoreAccount::MakeObjectFilename(int64_t ObjectID, std::string &rF
 //
 // --------------------------------------------------------------------------
 bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
-	BackupStoreInfo& rBackupStoreInfo)
+	BackupStoreInfo& rBackupStoreInfo,
+	std::vector<int64_t> *pDeletedSubdirsOut)
 {
 #ifndef WIN32
 	if((--mCountUntilNextInterprocessMsgCheck) <= 0)
@@ -343,6 +628,7 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 		}
 	}
 #endif
+	ThrottleOperation();
 
 	// Get the filename
 	std::string objectFilename;
@@ -372,49 +658,60 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 	}
 
 	// Calculate reference counts first, before we start requesting
-	// files to be deleted.
-	// BLOCK
+	// files to be deleted. Incremental housekeeping uses the existing
+	// counts instead.
+	if(!mIncremental)
 	{
 		BackupStoreDirectory::Iterator i(dir);
 		BackupStoreDirectory::Entry *en = 0;
+		std::vector<int64_t> referenced;
+		referenced.reserve(dir.GetNumberOfEntries());
 
 		while((en = i.Next()) != 0)
 		{
 			// This directory references this object
-			mapNewRefs->AddReference(en->GetObjectID());
+			referenced.push_back(en->GetObjectID());
 		}
+
+		mapNewRefs->AddReferences(referenced);
 	}
 
 	// BLOCK
 	{
 		// Remove any files which are marked for removal as soon
 		// as they become old or deleted.
-		bool deletedSomething = false;
-		do
+		std::vector<int64_t> removeASAP;
+		BackupStoreDirectory::Iterator i(dir);
+		BackupStoreDirectory::Entry *en = 0;
+		while((en = i.Next(BackupStoreDirectory::Entry::Flags_File)) != 0)
 		{
-			// Iterate through the directory
-			deletedSomething = false;
-			BackupStoreDirectory::Iterator i(dir);
-			BackupStoreDirectory::Entry *en = 0;
-			while((en = i.Next(BackupStoreDirectory::Entry::Flags_File)) != 0)
+			int16_t enFlags = en->GetFlags();
+			if((enFlags & BackupStoreDirectory::Entry::Flags_RemoveASAP) != 0
+				&& (en->IsDeleted() || en->IsOld()))
 			{
-				int16_t enFlags = en->GetFlags();
-				if((enFlags & BackupStoreDirectory::Entry::Flags_RemoveASAP) != 0
-					&& (en->IsDeleted() || en->IsOld()))
-				{
-					// Delete this immediately.
-					DeleteFile(ObjectID, en->GetObjectID(), dir,
-						objectFilename, rBackupStoreInfo);
-
-					// flag as having done something
-					deletedSomething = true;
+				removeASAP.push_back(en->GetObjectID());
+			}
+		}
 
-					// Must start the loop from the beginning again, as iterator is now
-					// probably invalid.
-					break;
+		if(!removeASAP.empty())
+		{
+			// Delete them all in one go, saving the directory once
+			// rather than for each file.
+			DeletionBatch batch;
+			batch.AddDirectory(ObjectID, &dir, objectFilename,
+				false); // not owned
+			for(std::vector<int64_t>::iterator
+				r(removeASAP.begin()); r != removeASAP.end(); ++r)
+			{
+				if(batch.MergeWouldConflict(dir, *r) ||
+					batch.IsFull(mMaxMergeProcesses))
+				{
+					FlushDeletionBatch(batch, rBackupStoreInfo);
 				}
+				AddDeletion(batch, ObjectID, *r, rBackupStoreInfo);
 			}
-		} while(deletedSomething);
+			FlushDeletionBatch(batch, rBackupStoreInfo);
+		}
 	}
 
 	// BLOCK
@@ -456,6 +753,17 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 			}
 			// enVersionAge is now the age of this version.
 
+			// Small old and deleted files are unlikely to change
+			// again, so they can go into a pack
+			if(mPackFileObjectSizeLimit > 0 &&
+				(en->IsOld() || en->IsDeleted()) &&
+				enSizeInBlocks <= mPackFileObjectSizeLimit &&
+				(enFlags & BackupStoreDirectory::Entry::Flags_RemoveASAP) == 0 &&
+				mPackIndex.Find(en->GetObjectID()) == 0)
+			{
+				mPackCandidates.push_back(en->GetObjectID());
+			}
+
 			// Potentially add it to the list if it's deleted, if it's an old version or deleted
 			if(en->IsOld() || en->IsDeleted())
 			{
@@ -469,65 +777,25 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 				d.mIsFlagDeleted = en->IsDeleted();
 
 				// Add it to the list
-				mPotentialDeletions.insert(d);
-
-				// Update various counts
-				mPotentialDeletionsTotalSize += d.mSizeInBlocks;
-				if(d.mSizeInBlocks > mMaxSizeInPotentialDeletions) mMaxSizeInPotentialDeletions = d.mSizeInBlocks;
+				AddPotentialDeletion(d);
+			}
+		}
+	}
 
-				// Too much in the list of potential deletions?
-				// (check against the deletion target + the max size in deletions, so that we never delete things
-				// and take the total size below the deletion size target)
-				if(mPotentialDeletionsTotalSize > (mDeletionSizeTarget + mMaxSizeInPotentialDeletions))
-				{
-					int64_t sizeToRemove = mPotentialDeletionsTotalSize - (mDeletionSizeTarget + mMaxSizeInPotentialDeletions);
-					bool recalcMaxSize = false;
-
-					while(sizeToRemove > 0)
-					{
-						// Make iterator for the last element, while checking that there's something there in the first place.
-						std::set<DelEn, DelEnCompare>::iterator i(mPotentialDeletions.end());
-						if(i != mPotentialDeletions.begin())
-						{
-							// Nothing left in set
-							break;
-						}
-						// Make this into an iterator pointing to the last element in the set
-						--i;
-
-						// Delete this one?
-						if(sizeToRemove > i->mSizeInBlocks)
-						{
-							sizeToRemove -= i->mSizeInBlocks;
-							if(i->mSizeInBlocks >= mMaxSizeInPotentialDeletions)
-							{
-								// Will need to recalculate the maximum size now, because we've just deleted that element
-								recalcMaxSize = true;
-							}
-							mPotentialDeletions.erase(i);
-						}
-						else
-						{
-							// Over the size to remove, so stop now
-							break;
-						}
-					}
-
-					if(recalcMaxSize)
-					{
-						// Because an object which was the maximum size recorded was deleted from the set
-						// it's necessary to recalculate this maximum.
-						mMaxSizeInPotentialDeletions = 0;
-						std::set<DelEn, DelEnCompare>::const_iterator i(mPotentialDeletions.begin());
-						for(; i != mPotentialDeletions.end(); ++i)
-						{
-							if(i->mSizeInBlocks > mMaxSizeInPotentialDeletions)
-							{
-								mMaxSizeInPotentialDeletions = i->mSizeInBlocks;
-							}
-						}
-					}
-				}
+	// Find any chains of patches, starting from the current version,
+	// which have grown too long to restore the oldest version quickly
+	if(mMaxPatchChainDepth > 0 || mMaxPatchChainBlocks > 0)
+	{
+		BackupStoreDirectory::Iterator i(dir);
+		BackupStoreDirectory::Entry *en = 0;
+		while((en = i.Next(BackupStoreDirectory::Entry::Flags_File)) != 0)
+		{
+			if(en->GetDependsNewer() == 0 &&
+				en->GetDependsOlder() != 0 &&
+				FindPatchToRebase(dir, en->GetObjectID()) != 0)
+			{
+				mDirectoriesWithLongPatchChains.insert(ObjectID);
+				break;
 			}
 		}
 	}
@@ -540,7 +808,17 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 		{
 			ASSERT(en->IsDir());
 
-			if(!ScanDirectory(en->GetObjectID(), rBackupStoreInfo))
+			if(pDeletedSubdirsOut)
+			{
+				// Not recursing, but the caller wants the
+				// ones which might be empty and deletable
+				if(en->IsDeleted())
+				{
+					pDeletedSubdirsOut->push_back(
+						en->GetObjectID());
+				}
+			}
+			else if(!ScanDirectory(en->GetObjectID(), rBackupStoreInfo))
 			{
 				// Halting operation
 				return false;
@@ -552,6 +830,63 @@ bool HousekeepStoreAccount::ScanDirectory(int64_t ObjectID,
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::ScanChangedDirectories(
+//			 const std::set<int64_t> &, BackupStoreInfo &)
+//		Purpose: Private. Scan only the directories listed in the
+//			 dirty directory log, without recursing, instead of
+//			 the whole account. A client doesn't write a deleted
+//			 subdirectory which was already empty, only its
+//			 parent, so those are scanned too, to find out if
+//			 they can be removed. Returns true if the scan
+//			 should continue.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::ScanChangedDirectories(
+	const std::set<int64_t> &rDirectories,
+	BackupStoreInfo& rBackupStoreInfo)
+{
+	std::vector<int64_t> deletedSubdirs;
+	for(std::set<int64_t>::const_iterator i(rDirectories.begin());
+		i != rDirectories.end(); ++i)
+	{
+		// It might have been removed since it was changed
+		std::string dirFilename;
+		MakeObjectFilename(*i, dirFilename);
+		if(!RaidFileRead::FileExists(mStoreDiscSet, dirFilename))
+		{
+			continue;
+		}
+
+		if(!ScanDirectory(*i, rBackupStoreInfo, &deletedSubdirs))
+		{
+			return false;
+		}
+	}
+
+	std::vector<int64_t> ignored;
+	for(std::vector<int64_t>::const_iterator i(deletedSubdirs.begin());
+		i != deletedSubdirs.end(); ++i)
+	{
+		if(rDirectories.find(*i) != rDirectories.end())
+		{
+			// Already done
+			continue;
+		}
+
+		if(!ScanDirectory(*i, rBackupStoreInfo, &ignored))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 
 // --------------------------------------------------------------------------
 //
@@ -596,285 +931,1234 @@ bool HousekeepStoreAccount::DelEnCompare::operator()(const HousekeepStoreAccount
 
 // --------------------------------------------------------------------------
 //
-// Function
-//		Name:    HousekeepStoreAccount::DeleteFiles()
-//		Purpose: Delete the files targeted for deletion, returning
-//			 true if the operation was interrupted
-//		Created: 15/12/03
+// Class
+//		Name:    HousekeepStoreAccount::DeletionRun
+//		Purpose: Potential deletions, in DelEnCompare order, written
+//			 to a temporary file to save memory, and read back one
+//			 at a time. The file is removed when it's destroyed.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-bool HousekeepStoreAccount::DeleteFiles(BackupStoreInfo& rBackupStoreInfo)
+class HousekeepStoreAccount::DeletionRun
 {
-	// Only delete files if the deletion target is greater than zero
-	// (otherwise we delete one file each time round, which gradually deletes the old versions)
-	if(mDeletionSizeTarget <= 0)
+public:
+	DeletionRun(const std::string &rFilename)
+	: mFilename(rFilename),
+	  mHaveCurrent(false)
 	{
-		// Not interrupted
-		return false;
 	}
-
-	// Iterate through the set of potential deletions, until enough has been deleted.
-	// (there is likely to be more in the set than should be actually deleted).
-	for(std::set<DelEn, DelEnCompare>::iterator i(mPotentialDeletions.begin()); i != mPotentialDeletions.end(); ++i)
+	~DeletionRun()
 	{
-#ifndef WIN32
-		if((--mCountUntilNextInterprocessMsgCheck) <= 0)
+		mapWriteBuffer.reset();
+		mapBuffer.reset();
+		mapFile.reset();
+		if(EMU_UNLINK(mFilename.c_str()) != 0 && errno != ENOENT)
 		{
-			mCountUntilNextInterprocessMsgCheck = POLL_INTERPROCESS_MSG_CHECK_FREQUENCY;
-			// Check for having to stop
-			if(mpHousekeepingCallback && mpHousekeepingCallback->CheckForInterProcessMsg(mAccountID))	// include account ID here as the specified account is now locked
-			{
-				// Need to abort now
-				return true;
-			}
+			BOX_LOG_SYS_ERROR("Failed to delete temporary file: " <<
+				mFilename);
 		}
-#endif
+	}
 
-		// Load up the directory it's in
-		// Get the filename
-		std::string dirFilename;
-		BackupStoreDirectory dir;
+	void Write(const std::set<DelEn, DelEnCompare> &rEntries)
+	{
+		StartWriting();
+		for(std::set<DelEn, DelEnCompare>::const_iterator
+			i(rEntries.begin()); i != rEntries.end(); ++i)
 		{
-			MakeObjectFilename(i->mInDirectory, dirFilename);
-			std::auto_ptr<RaidFileRead> dirStream(RaidFileRead::Open(mStoreDiscSet, dirFilename));
-			dir.ReadFromStream(*dirStream, IOStream::TimeOutInfinite);
-			dir.SetUserInfo1_SizeInBlocks(dirStream->GetDiscUsageInBlocks());
+			Add(*i);
 		}
+		FinishWriting();
+	}
 
-		// Delete the file
-		BackupStoreRefCountDatabase::refcount_t refs =
-			DeleteFile(i->mInDirectory, i->mObjectID, dir,
-				dirFilename, rBackupStoreInfo);
-		if(refs == 0)
-		{
-			BOX_INFO("Housekeeping removed " <<
-				(i->mIsFlagDeleted ? "deleted" : "old") <<
-				" file " << BOX_FORMAT_OBJECTID(i->mObjectID) <<
-				" from dir " << BOX_FORMAT_OBJECTID(i->mInDirectory));
-		}
-		else
-		{
-			BOX_TRACE("Housekeeping preserved " <<
-				(i->mIsFlagDeleted ? "deleted" : "old") <<
-				" file " << BOX_FORMAT_OBJECTID(i->mObjectID) <<
-				" in dir " << BOX_FORMAT_OBJECTID(i->mInDirectory) <<
-				" with " << refs << " references");
-		}
+	void StartWriting()
+	{
+		mapFile.reset(new FileStream(mFilename, O_WRONLY | O_CREAT |
+			O_TRUNC | O_BINARY));
+		mapWriteBuffer.reset(new BufferedWriteStream(*mapFile));
+	}
 
-		// Stop if the deletion target has been matched or exceeded
-		// (checking here rather than at the beginning will tend to reduce the
-		// space to slightly less than the soft limit, which will allow the backup
-		// client to start uploading files again)
-		if((0 - mBlocksUsedDelta) >= mDeletionSizeTarget)
-		{
-			break;
-		}
+	void Add(const DelEn &rEntry)
+	{
+		mapWriteBuffer->Write(&rEntry, sizeof(DelEn));
 	}
 
-	return false;
-}
+	void FinishWriting()
+	{
+		mapWriteBuffer->Flush();
+		mapWriteBuffer.reset();
+		mapFile.reset();
+	}
+
+	void StartReading()
+	{
+		mapBuffer.reset();
+		mapFile.reset(new FileStream(mFilename));
+		mapBuffer.reset(new BufferedStream(*mapFile));
+		Next();
+	}
+
+	void Next()
+	{
+		mHaveCurrent = mapBuffer->ReadFullBuffer(&mCurrent,
+			sizeof(mCurrent), 0);
+	}
+
+	bool HaveCurrent() const {return mHaveCurrent;}
+	const DelEn &GetCurrent() const {return mCurrent;}
+
+private:
+	std::string mFilename;
+	std::auto_ptr<FileStream> mapFile;
+	std::auto_ptr<BufferedStream> mapBuffer;
+	std::auto_ptr<BufferedWriteStream> mapWriteBuffer;
+	DelEn mCurrent;
+	bool mHaveCurrent;
+};
+
+// Orders runs for a heap, so that the front is the one whose current
+// entry comes first
+struct HousekeepStoreAccount::DeletionRunCompare
+{
+	bool operator()(const DeletionRun *pX, const DeletionRun *pY) const
+	{
+		return DelEnCompare()(pY->GetCurrent(), pX->GetCurrent());
+	}
+};
 
 
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    HousekeepStoreAccount::DeleteFile(int64_t, int64_t,
-//			 BackupStoreDirectory &, const std::string &, int64_t)
-//		Purpose: Delete a file. Takes the directory already loaded
-//			 in and the filename, for efficiency in both the
-//			 usage scenarios. Returns the number of references
-//			 remaining. If it's zero, the file was removed from
-//			 disk as unused.
-//		Created: 15/7/04
+//		Name:    HousekeepStoreAccount::AddPotentialDeletion(const DelEn &)
+//		Purpose: Private. Add a file to the candidates for deletion,
+//			 keeping only as many of the first ones in deletion
+//			 order as are needed to meet the deletion target, and
+//			 moving them to a temporary file if there are too many
+//			 to keep in memory.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-
-BackupStoreRefCountDatabase::refcount_t HousekeepStoreAccount::DeleteFile(
-	int64_t InDirectory, int64_t ObjectID, BackupStoreDirectory &rDirectory,
-	const std::string &rDirectoryFilename,
-	BackupStoreInfo& rBackupStoreInfo)
+void HousekeepStoreAccount::AddPotentialDeletion(const DelEn &rEntry)
 {
-	// Find the entry inside the directory
-	bool wasDeleted = false;
-	bool wasOldVersion = false;
-	int64_t deletedFileSizeInBlocks = 0;
-	// A pointer to an object which requires committing if the directory save goes OK
-	std::auto_ptr<RaidFileWrite> padjustedEntry;
-	// BLOCK
+	// Enough candidates which sort before this one have been found
+	// already, including those in temporary files
+	if(mHaveDeletionCutoff && DelEnCompare()(mDeletionCutoff, rEntry))
 	{
-		BackupStoreRefCountDatabase::refcount_t refs =
-			mapNewRefs->GetRefCount(ObjectID);
-
-		BackupStoreDirectory::Entry *pentry = rDirectory.FindEntryByID(ObjectID);
-		if(pentry == 0)
-		{
-			BOX_ERROR("Housekeeping on account " <<
-				BOX_FORMAT_ACCOUNT(mAccountID) << " "
-				"found error: object " <<
-				BOX_FORMAT_OBJECTID(ObjectID) << " "
-				"not found in dir " <<
-				BOX_FORMAT_OBJECTID(InDirectory) << ", "
-				"indicates logic error/corruption? Run "
-				"bbstoreaccounts check <accid> fix");
-			mErrorCount++;
-			return refs;
-		}
-
-		// Record the flags it's got set
-		wasDeleted = pentry->IsDeleted();
-		wasOldVersion = pentry->IsOld();
-		// Check this should be deleted
-		if(!wasDeleted && !wasOldVersion)
+		return;
+	}
+
+	mPotentialDeletions.insert(rEntry);
+
+	// Update various counts
+	mPotentialDeletionsTotalSize += rEntry.mSizeInBlocks;
+	if(rEntry.mSizeInBlocks > mMaxSizeInPotentialDeletions)
+	{
+		mMaxSizeInPotentialDeletions = rEntry.mSizeInBlocks;
+	}
+
+	// Too much in the list of potential deletions? Drop the last ones
+	// while there's still more than the deletion target + the max size
+	// in deletions, so that we never delete things and take the total
+	// size below the deletion size target.
+	bool recalcMaxSize = false;
+	while(!mPotentialDeletions.empty())
+	{
+		std::set<DelEn, DelEnCompare>::iterator last(
+			mPotentialDeletions.end());
+		--last;
+
+		if(mPotentialDeletionsTotalSize - last->mSizeInBlocks <=
+			mDeletionSizeTarget + mMaxSizeInPotentialDeletions)
+		{
+			break;
+		}
+
+		if(last->mSizeInBlocks >= mMaxSizeInPotentialDeletions)
+		{
+			// Will need to recalculate the maximum size now,
+			// because we're about to remove that element
+			recalcMaxSize = true;
+		}
+		mPotentialDeletionsTotalSize -= last->mSizeInBlocks;
+		mPotentialDeletions.erase(last);
+	}
+
+	if(recalcMaxSize)
+	{
+		mMaxSizeInPotentialDeletions = 0;
+		for(std::set<DelEn, DelEnCompare>::const_iterator
+			i(mPotentialDeletions.begin());
+			i != mPotentialDeletions.end(); ++i)
+		{
+			if(i->mSizeInBlocks > mMaxSizeInPotentialDeletions)
+			{
+				mMaxSizeInPotentialDeletions = i->mSizeInBlocks;
+			}
+		}
+	}
+
+	// Anything after the last one would be dropped straight away
+	if(!mPotentialDeletions.empty() && mPotentialDeletionsTotalSize >
+		mDeletionSizeTarget + mMaxSizeInPotentialDeletions)
+	{
+		SetDeletionCutoff(*(mPotentialDeletions.rbegin()));
+	}
+
+	if(mPotentialDeletions.size() > mMaxPotentialDeletionsInMemory)
+	{
+		SpillPotentialDeletions();
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::SetDeletionCutoff(const DelEn &)
+//		Purpose: Private. Drop all future candidates for deletion
+//			 which sort after this one, because enough which sort
+//			 before it have been found to meet the target.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::SetDeletionCutoff(const DelEn &rLast)
+{
+	if(!mHaveDeletionCutoff || DelEnCompare()(rLast, mDeletionCutoff))
+	{
+		mDeletionCutoff = rLast;
+		mHaveDeletionCutoff = true;
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::SpillPotentialDeletions()
+//		Purpose: Private. Move the potential deletions in memory to a
+//			 new sorted run in a temporary file, to be merged with
+//			 the others when deleting. If there are too many runs,
+//			 merge them into one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::SpillPotentialDeletions()
+{
+	std::ostringstream name;
+	name << mStoreRoot << "deletions" << (mNextDeletionRunNumber++) <<
+		".tmp";
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(mStoreDiscSet));
+	std::string filename(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		name.str()));
+
+	BOX_TRACE("Writing " << mPotentialDeletions.size() << " potential "
+		"deletions to " << filename);
+
+	std::auto_ptr<DeletionRun> run(new DeletionRun(filename));
+	mDeletionRuns.push_back(NULL);
+	run->Write(mPotentialDeletions);
+	mDeletionRuns.back() = run.release();
+
+	if(mMaxSizeInPotentialDeletions > mMaxSizeInDeletionRuns)
+	{
+		mMaxSizeInDeletionRuns = mMaxSizeInPotentialDeletions;
+	}
+	mPotentialDeletions.clear();
+	mPotentialDeletionsTotalSize = 0;
+	mMaxSizeInPotentialDeletions = 0;
+
+	if(mDeletionRuns.size() > MAX_DELETION_RUNS)
+	{
+		MergeDeletionRuns();
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::MergeDeletionRuns()
+//		Purpose: Private. Replace the temporary files of potential
+//			 deletions with one, holding only as many of the
+//			 first ones as the deletion target needs. Each run is
+//			 trimmed on its own when it's written, so together
+//			 they can hold far more.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::MergeDeletionRuns()
+{
+	std::ostringstream name;
+	name << mStoreRoot << "deletions" << (mNextDeletionRunNumber++) <<
+		".tmp";
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(mStoreDiscSet));
+	std::auto_ptr<DeletionRun> merged(new DeletionRun(
+		RaidFileUtil::MakeWriteFileName(rdiscSet, name.str())));
+
+	BOX_TRACE("Merging " << mDeletionRuns.size() << " runs of potential "
+		"deletions");
+
+	// Keep them while there's no more than the deletion target + the
+	// max size in deletions before them, as AddPotentialDeletion() does
+	StartReadingDeletionRuns();
+	merged->StartWriting();
+	int64_t totalSize = 0;
+	int64_t maxSize = 0;
+	DelEn entry, last;
+	while(totalSize <= mDeletionSizeTarget + mMaxSizeInDeletionRuns &&
+		NextFromDeletionRuns(entry))
+	{
+		merged->Add(entry);
+		totalSize += entry.mSizeInBlocks;
+		if(entry.mSizeInBlocks > maxSize)
+		{
+			maxSize = entry.mSizeInBlocks;
+		}
+		last = entry;
+	}
+	merged->FinishWriting();
+
+	if(totalSize > mDeletionSizeTarget + mMaxSizeInDeletionRuns)
+	{
+		SetDeletionCutoff(last);
+	}
+
+	DeleteDeletionRuns();
+	mDeletionRuns.push_back(merged.release());
+	mMaxSizeInDeletionRuns = maxSize;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::StartReadingDeletionRuns()
+//		Purpose: Private. Prepare to merge the temporary files of
+//			 potential deletions with NextFromDeletionRuns().
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::StartReadingDeletionRuns()
+{
+	mDeletionRunHeap.clear();
+	for(std::vector<DeletionRun *>::iterator i(mDeletionRuns.begin());
+		i != mDeletionRuns.end(); ++i)
+	{
+		(*i)->StartReading();
+		if((*i)->HaveCurrent())
+		{
+			mDeletionRunHeap.push_back(*i);
+		}
+	}
+	std::make_heap(mDeletionRunHeap.begin(), mDeletionRunHeap.end(),
+		DeletionRunCompare());
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::NextFromDeletionRuns(DelEn &)
+//		Purpose: Private. Get the next potential deletion from the
+//			 temporary files, in the order of DelEnCompare,
+//			 returning false if there are no more.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::NextFromDeletionRuns(DelEn &rEntryOut)
+{
+	if(mDeletionRunHeap.empty())
+	{
+		return false;
+	}
+
+	std::pop_heap(mDeletionRunHeap.begin(), mDeletionRunHeap.end(),
+		DeletionRunCompare());
+	DeletionRun *pFirst = mDeletionRunHeap.back();
+	rEntryOut = pFirst->GetCurrent();
+	pFirst->Next();
+
+	if(pFirst->HaveCurrent())
+	{
+		std::push_heap(mDeletionRunHeap.begin(),
+			mDeletionRunHeap.end(), DeletionRunCompare());
+	}
+	else
+	{
+		mDeletionRunHeap.pop_back();
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::StartReadingPotentialDeletions()
+//		Purpose: Private. Prepare to return the potential deletions
+//			 in order from NextPotentialDeletion().
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::StartReadingPotentialDeletions()
+{
+	if(mDeletionRuns.empty())
+	{
+		mNextPotentialDeletion = mPotentialDeletions.begin();
+		return;
+	}
+
+	// Merge the ones still in memory with the runs on disc
+	if(!mPotentialDeletions.empty())
+	{
+		SpillPotentialDeletions();
+	}
+
+	StartReadingDeletionRuns();
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::NextPotentialDeletion(DelEn &)
+//		Purpose: Private. Get the next potential deletion, in the
+//			 order of DelEnCompare, returning false if there are
+//			 no more.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::NextPotentialDeletion(DelEn &rEntryOut)
+{
+	if(mDeletionRuns.empty())
+	{
+		if(mNextPotentialDeletion == mPotentialDeletions.end())
+		{
+			return false;
+		}
+		rEntryOut = *(mNextPotentialDeletion++);
+		return true;
+	}
+
+	return NextFromDeletionRuns(rEntryOut);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeleteDeletionRuns()
+//		Purpose: Private. Remove the temporary files of potential
+//			 deletions.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::DeleteDeletionRuns()
+{
+	for(std::vector<DeletionRun *>::iterator i(mDeletionRuns.begin());
+		i != mDeletionRuns.end(); ++i)
+	{
+		delete *i;
+	}
+	mDeletionRuns.clear();
+	mDeletionRunHeap.clear();
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeletionBatch::AddDirectory(
+//			 int64_t, BackupStoreDirectory *, const std::string &,
+//			 bool)
+//		Purpose: Add a directory which files will be deleted from,
+//			 deleting it with the batch if Owned.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+HousekeepStoreAccount::DeletionBatch::Directory &
+HousekeepStoreAccount::DeletionBatch::AddDirectory(int64_t DirectoryID,
+	BackupStoreDirectory *pDirectory, const std::string &rFilename,
+	bool Owned)
+{
+	Directory dir;
+	dir.mpDirectory = NULL;
+	dir.mFilename = rFilename;
+	dir.mOwned = Owned;
+	dir.mModified = false;
+	dir.mFileRemoved = false;
+
+	Directory &rdir(mDirectories.insert(
+		std::make_pair(DirectoryID, dir)).first->second);
+	rdir.mpDirectory = pDirectory;
+	return rdir;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeletionBatch::
+//			 MergeWouldConflict(BackupStoreDirectory &, int64_t)
+//		Purpose: Would deleting this object read or delete one
+//			 which a merge in the batch is still writing? If so,
+//			 the batch must be flushed first.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::DeletionBatch::MergeWouldConflict(
+	BackupStoreDirectory &rDirectory, int64_t ObjectID) const
+{
+	if(mAdjustedObjects.empty())
+	{
+		return false;
+	}
+
+	BackupStoreDirectory::Entry *pentry = rDirectory.FindEntryByID(ObjectID);
+	if(pentry == 0)
+	{
+		return false;
+	}
+
+	return mAdjustedObjects.count(ObjectID) != 0 ||
+		(pentry->GetDependsOlder() != 0 &&
+		 mAdjustedObjects.count(pentry->GetDependsOlder()) != 0);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeletionBatch::IsFull(int)
+//		Purpose: Has the batch got as many files, directories or
+//			 merges as it should hold before being flushed?
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::DeletionBatch::IsFull(int MaxMergeProcesses) const
+{
+	int maxMerges = DELETION_BATCH_MAX_MERGES;
+	if(maxMerges < (MaxMergeProcesses * 2))
+	{
+		// Enough to keep all the processes busy
+		maxMerges = MaxMergeProcesses * 2;
+	}
+
+	return mDeletions.size() >= DELETION_BATCH_MAX_FILES ||
+		mDirectories.size() >= DELETION_BATCH_MAX_FILES ||
+		mNumMerges >= maxMerges;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeletionBatch::DiscardDeletions()
+//		Purpose: Forget the deletions, stopping any merges still
+//			 running and throwing away the files they wrote.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::DeletionBatch::DiscardDeletions()
+{
+	for(std::vector<PendingDeletion>::iterator i(mDeletions.begin());
+		i != mDeletions.end(); ++i)
+	{
+#ifndef WIN32
+		if(i->mMergeProcess != 0)
+		{
+			::kill(i->mMergeProcess, SIGTERM);
+			int status = 0;
+			while(::waitpid(i->mMergeProcess, &status, 0) == -1 &&
+				errno == EINTR)
+			{
+				// Interrupted, try again
+			}
+			i->mMergeProcess = 0;
+		}
+#endif
+		// Discards the file if it wasn't committed
+		delete i->mpAdjustedEntry;
+		i->mpAdjustedEntry = NULL;
+	}
+
+	mDeletions.clear();
+	mAdjustedObjects.clear();
+	mNumMerges = 0;
+	mBlocksToFree = 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeletionBatch::Finished()
+//		Purpose: The batch has been flushed. Forget the deletions,
+//			 and the directories it owns, which keeps it small.
+//			 Directories which belong to the caller stay, and are
+//			 up to date with what's on disc.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::DeletionBatch::Finished()
+{
+	DiscardDeletions();
+
+	std::map<int64_t, Directory>::iterator i(mDirectories.begin());
+	while(i != mDirectories.end())
+	{
+		i->second.mModified = false;
+		i->second.mFileRemoved = false;
+
+		if(i->second.mOwned)
+		{
+			delete i->second.mpDirectory;
+			mDirectories.erase(i++);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::DeleteFiles()
+//		Purpose: Delete the files targeted for deletion, returning
+//			 true if the operation was interrupted
+//		Created: 15/12/03
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::DeleteFiles(BackupStoreInfo& rBackupStoreInfo)
+{
+	// Only delete files if the deletion target is greater than zero
+	// (otherwise we delete one file each time round, which gradually deletes the old versions)
+	if(mDeletionSizeTarget <= 0)
+	{
+		// Not interrupted
+		return false;
+	}
+
+	// Iterate through the potential deletions in order, until enough has been deleted.
+	// (there are likely to be more than should be actually deleted).
+	StartReadingPotentialDeletions();
+	DeletionBatch batch;
+	DelEn candidate;
+	while(NextPotentialDeletion(candidate))
+	{
+#ifndef WIN32
+		if((--mCountUntilNextInterprocessMsgCheck) <= 0)
+		{
+			mCountUntilNextInterprocessMsgCheck = POLL_INTERPROCESS_MSG_CHECK_FREQUENCY;
+			// Check for having to stop
+			if(mpHousekeepingCallback && mpHousekeepingCallback->CheckForInterProcessMsg(mAccountID))	// include account ID here as the specified account is now locked
+			{
+				// Need to abort now, but finish the batch so
+				// that the directories match the reference
+				// counts. It's small, so that doesn't take long.
+				FlushDeletionBatch(batch, rBackupStoreInfo);
+				return true;
+			}
+		}
+#endif
+		ThrottleOperation();
+
+		// Find the directory it's in, unless the batch has it already
+		DeletionBatch::Directory *pdir = batch.Find(candidate.mInDirectory);
+		if(pdir != NULL && batch.MergeWouldConflict(*pdir->mpDirectory,
+			candidate.mObjectID))
+		{
+			// It needs a file which is still being merged
+			FlushDeletionBatch(batch, rBackupStoreInfo);
+			pdir = NULL;
+		}
+		if(pdir == NULL)
+		{
+			std::string dirFilename;
+			MakeObjectFilename(candidate.mInDirectory, dirFilename);
+			std::auto_ptr<BackupStoreDirectory> apDir(
+				new BackupStoreDirectory);
+			{
+				std::auto_ptr<RaidFileRead> dirStream(RaidFileRead::Open(mStoreDiscSet, dirFilename));
+				apDir->ReadFromStream(*dirStream, IOStream::TimeOutInfinite);
+				apDir->SetUserInfo1_SizeInBlocks(dirStream->GetDiscUsageInBlocks());
+			}
+			pdir = &(batch.AddDirectory(candidate.mInDirectory,
+				apDir.get(), dirFilename, true)); // Owned
+			apDir.release();
+		}
+
+		// Delete the file
+		BackupStoreRefCountDatabase::refcount_t refs =
+			AddDeletion(batch, candidate.mInDirectory,
+				candidate.mObjectID, rBackupStoreInfo);
+		if(refs == 0)
+		{
+			BOX_INFO("Housekeeping removed " <<
+				(candidate.mIsFlagDeleted ? "deleted" : "old") <<
+				" file " << BOX_FORMAT_OBJECTID(candidate.mObjectID) <<
+				" from dir " << BOX_FORMAT_OBJECTID(candidate.mInDirectory));
+		}
+		else
+		{
+			BOX_TRACE("Housekeeping preserved " <<
+				(candidate.mIsFlagDeleted ? "deleted" : "old") <<
+				" file " << BOX_FORMAT_OBJECTID(candidate.mObjectID) <<
+				" in dir " << BOX_FORMAT_OBJECTID(candidate.mInDirectory) <<
+				" with " << refs << " references");
+		}
+
+		// The exact space freed is only known once the batch is
+		// flushed, as merging changes the size of the older versions
+		if(batch.IsFull(mMaxMergeProcesses) ||
+			((0 - mBlocksUsedDelta) + batch.mBlocksToFree) >=
+			mDeletionSizeTarget)
+		{
+			FlushDeletionBatch(batch, rBackupStoreInfo);
+		}
+
+		// Stop if the deletion target has been matched or exceeded
+		// (checking here rather than at the beginning will tend to reduce the
+		// space to slightly less than the soft limit, which will allow the backup
+		// client to start uploading files again)
+		if((0 - mBlocksUsedDelta) >= mDeletionSizeTarget)
+		{
+			break;
+		}
+	}
+
+	FlushDeletionBatch(batch, rBackupStoreInfo);
+	return false;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::AddDeletion(DeletionBatch &,
+//			 int64_t, int64_t, BackupStoreInfo &)
+//		Purpose: Remove a file from its directory, which must be in
+//			 the batch already, and add its deletion to the batch.
+//			 Returns the number of references remaining. If it's
+//			 zero, the file will be removed from disc when the
+//			 batch is flushed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupStoreRefCountDatabase::refcount_t HousekeepStoreAccount::AddDeletion(
+	DeletionBatch &rBatch, int64_t InDirectory, int64_t ObjectID,
+	BackupStoreInfo& rBackupStoreInfo)
+{
+	DeletionBatch::Directory *pdir = rBatch.Find(InDirectory);
+	ASSERT(pdir != NULL);
+	ASSERT(!rBatch.MergeWouldConflict(*pdir->mpDirectory, ObjectID));
+
+	bool wasInDirectory = (pdir->mpDirectory->FindEntryByID(ObjectID) != 0);
+
+	PendingDeletion deletion;
+	BackupStoreRefCountDatabase::refcount_t refs = PrepareDeleteFile(
+		InDirectory, ObjectID, *pdir->mpDirectory, rBackupStoreInfo,
+		deletion);
+
+	if(wasInDirectory && pdir->mpDirectory->FindEntryByID(ObjectID) == 0)
+	{
+		pdir->mModified = true;
+	}
+
+	if(refs == 0)
+	{
+		pdir->mFileRemoved = true;
+		rBatch.mDeletions.push_back(deletion);
+		rBatch.mBlocksToFree += deletion.mSizeInBlocks;
+		if(deletion.mAdjustedObjectID != 0)
+		{
+			rBatch.mAdjustedObjects.insert(deletion.mAdjustedObjectID);
+			rBatch.mNumMerges++;
+		}
+	}
+
+	return refs;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::FlushDeletionBatch(
+//			 DeletionBatch &, BackupStoreInfo &)
+//		Purpose: Finish the deletions in a batch. The merges run
+//			 first, in several processes if allowed, with the
+//			 objects for the next one read ahead while waiting.
+//			 Then every directory which changed is saved, once,
+//			 before the merged files are committed and the
+//			 deleted ones removed, so that the directories never
+//			 refer to a merged file which they don't describe.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::FlushDeletionBatch(DeletionBatch &rBatch,
+	BackupStoreInfo& rBackupStoreInfo)
+{
+	std::vector<size_t> merges;
+	for(size_t i = 0; i < rBatch.mDeletions.size(); ++i)
+	{
+		if(rBatch.mDeletions[i].mAdjustedObjectID != 0)
+		{
+			merges.push_back(i);
+		}
+	}
+
+	int maxProcesses = (mMaxMergeProcesses > 1) ? mMaxMergeProcesses : 1;
+	size_t started = 0, finished = 0;
+	while(finished < merges.size())
+	{
+		while(started < merges.size() &&
+			(started - finished) < (size_t)maxProcesses)
+		{
+			// Read ahead the objects for the one after this
+			if(started + 1 < merges.size())
+			{
+				const PendingDeletion &rnext(
+					rBatch.mDeletions[merges[started + 1]]);
+				std::string filename;
+				MakeObjectFilename(rnext.mObjectID, filename);
+				RaidFileRead::HintWillRead(mStoreDiscSet, filename);
+				MakeObjectFilename(rnext.mAdjustedObjectID, filename);
+				RaidFileRead::HintWillRead(mStoreDiscSet, filename);
+			}
+
+			StartMerge(rBatch.mDeletions[merges[started]],
+				mMaxMergeProcesses > 1);
+			++started;
+		}
+
+		PendingDeletion &rdeletion(rBatch.mDeletions[merges[finished]]);
+		FinishMerge(rdeletion,
+			*(rBatch.Find(rdeletion.mInDirectory)->mpDirectory));
+		++finished;
+	}
+
+	// Save the directories, newest first, as they're more likely to be
+	// inside the others. Saving one changes the size recorded in its
+	// parent, which must then be saved again if it's in the batch.
+	bool savedAny = true;
+	while(savedAny)
+	{
+		savedAny = false;
+		for(std::map<int64_t, DeletionBatch::Directory>::reverse_iterator
+			i(rBatch.mDirectories.rbegin());
+			i != rBatch.mDirectories.rend(); ++i)
+		{
+			DeletionBatch::Directory &rdir(i->second);
+			if(!rdir.mModified)
+			{
+				continue;
+			}
+
+			DeletionBatch::Directory *pparent = NULL;
+			if(i->first != BACKUPSTORE_ROOT_DIRECTORY_ID)
+			{
+				pparent = rBatch.Find(
+					rdir.mpDirectory->GetContainerID());
+			}
+
+			if(SaveDirectory(*rdir.mpDirectory, rdir.mFilename,
+				pparent ? pparent->mpDirectory : NULL))
+			{
+				pparent->mModified = true;
+			}
+			rdir.mModified = false;
+			savedAny = true;
+		}
+	}
+
+	// Commit the merged files and remove the deleted ones
+	for(std::vector<PendingDeletion>::iterator
+		i(rBatch.mDeletions.begin()); i != rBatch.mDeletions.end(); ++i)
+	{
+		FinishDeleteFile(*i, rBackupStoreInfo);
+	}
+
+	// Delete the directories?
+	// Do this if... dir has zero entries, and is marked as deleted in it's containing directory
+	for(std::map<int64_t, DeletionBatch::Directory>::iterator
+		i(rBatch.mDirectories.begin());
+		i != rBatch.mDirectories.end(); ++i)
+	{
+		if(i->second.mFileRemoved &&
+			i->second.mpDirectory->GetNumberOfEntries() == 0)
+		{
+			// Candidate for deletion
+			mEmptyDirectories.push_back(i->first);
+		}
+	}
+
+	rBatch.Finished();
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::PrepareDeleteFile(int64_t,
+//			 int64_t, BackupStoreDirectory &, BackupStoreInfo &,
+//			 PendingDeletion &)
+//		Purpose: Remove a file from the directory, already loaded
+//			 in, adjusting the patch chain it's part of. Returns
+//			 the number of references remaining. If it's zero,
+//			 rDeletionOut describes the rest of the work: the
+//			 merge which keeps any older version restorable, and
+//			 removing the file from disc.
+//		Created: 15/7/04
+//
+// --------------------------------------------------------------------------
+BackupStoreRefCountDatabase::refcount_t HousekeepStoreAccount::PrepareDeleteFile(
+	int64_t InDirectory, int64_t ObjectID, BackupStoreDirectory &rDirectory,
+	BackupStoreInfo& rBackupStoreInfo, PendingDeletion &rDeletionOut)
+{
+	rDeletionOut.mObjectID = ObjectID;
+	rDeletionOut.mInDirectory = InDirectory;
+	rDeletionOut.mSizeInBlocks = 0;
+	rDeletionOut.mWasDeleted = false;
+	rDeletionOut.mWasOldVersion = false;
+	rDeletionOut.mAdjustedObjectID = 0;
+	rDeletionOut.mCombineDiffs = false;
+	rDeletionOut.mpAdjustedEntry = NULL;
+	rDeletionOut.mMergeProcess = 0;
+
+	BackupStoreRefCountDatabase::refcount_t refs =
+		mapNewRefs->GetRefCount(ObjectID);
+
+	BackupStoreDirectory::Entry *pentry = rDirectory.FindEntryByID(ObjectID);
+	if(pentry == 0)
+	{
+		BOX_ERROR("Housekeeping on account " <<
+			BOX_FORMAT_ACCOUNT(mAccountID) << " "
+			"found error: object " <<
+			BOX_FORMAT_OBJECTID(ObjectID) << " "
+			"not found in dir " <<
+			BOX_FORMAT_OBJECTID(InDirectory) << ", "
+			"indicates logic error/corruption? Run "
+			"bbstoreaccounts check <accid> fix");
+		mErrorCount++;
+		return refs;
+	}
+
+	// Record the flags it's got set
+	rDeletionOut.mWasDeleted = pentry->IsDeleted();
+	rDeletionOut.mWasOldVersion = pentry->IsOld();
+	// Check this should be deleted
+	if(!rDeletionOut.mWasDeleted && !rDeletionOut.mWasOldVersion)
+	{
+		// Things changed since we were last around
+		return refs;
+	}
+
+	// Record size
+	rDeletionOut.mSizeInBlocks = pentry->GetSizeInBlocks();
+
+	if(refs > 1)
+	{
+		// Not safe to merge patches if someone else has a
+		// reference to this object, so just remove the
+		// directory entry and return.
+		rDirectory.DeleteEntry(ObjectID);
+		if(rDeletionOut.mWasDeleted)
 		{
-			// Things changed since we were last around
-			return refs;
+			rBackupStoreInfo.AdjustNumDeletedFiles(-1);
 		}
 
-		// Record size
-		deletedFileSizeInBlocks = pentry->GetSizeInBlocks();
+		if(rDeletionOut.mWasOldVersion)
+		{
+			rBackupStoreInfo.AdjustNumOldFiles(-1);
+		}
+
+		mapNewRefs->RemoveReference(ObjectID);
+		return refs - 1;
+	}
+
+	// If the entry is involved in a chain of patches, it needs to be handled
+	// a bit more carefully.
+	if(pentry->GetDependsNewer() != 0 && pentry->GetDependsOlder() == 0)
+	{
+		// This entry is a patch from a newer entry. Just need to update the info on that entry.
+		BackupStoreDirectory::Entry *pnewer = rDirectory.FindEntryByID(pentry->GetDependsNewer());
+		if(pnewer == 0 || pnewer->GetDependsOlder() != ObjectID)
+		{
+			THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
+		}
+		// Change the info in the newer entry so that this no longer points to this entry
+		pnewer->SetDependsOlder(0);
+	}
+	else if(pentry->GetDependsOlder() != 0)
+	{
+		BackupStoreDirectory::Entry *polder = rDirectory.FindEntryByID(pentry->GetDependsOlder());
+		if(pentry->GetDependsNewer() == 0)
+		{
+			// There exists an older version which depends on this one. Need to combine the two over that one.
+
+			// Adjust the other entry in the directory
+			if(polder == 0 || polder->GetDependsNewer() != ObjectID)
+			{
+				THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
+			}
+			// Change the info in the older entry so that this no longer points to this entry
+			polder->SetDependsNewer(0);
+		}
+		else
+		{
+			// This entry is in the middle of a chain, and two patches need combining.
+
+			// First, adjust the directory entries
+			BackupStoreDirectory::Entry *pnewer = rDirectory.FindEntryByID(pentry->GetDependsNewer());
+			if(pnewer == 0 || pnewer->GetDependsOlder() != ObjectID
+				|| polder == 0 || polder->GetDependsNewer() != ObjectID)
+			{
+				THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
+			}
+			// Remove the middle entry from the linked list by simply using the values from this entry
+			pnewer->SetDependsOlder(pentry->GetDependsOlder());
+			polder->SetDependsNewer(pentry->GetDependsNewer());
+			rDeletionOut.mCombineDiffs = true;
+		}
+
+		// The older version is rewritten later
+		rDeletionOut.mAdjustedObjectID = pentry->GetDependsOlder();
+	}
+
+	// pentry no longer valid after this
+	rDirectory.DeleteEntry(ObjectID);
+
+	return 0;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::StartMerge(PendingDeletion &,
+//			 bool)
+//		Purpose: Open the file which will replace the older version
+//			 depending on a file being deleted, and start writing
+//			 the merged version to it, in a child process if
+//			 InChildProcess and possible. The child writes
+//			 through the file descriptor opened here, so that
+//			 this process can commit the file once it's done.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::StartMerge(PendingDeletion &rDeletion,
+	bool InChildProcess)
+{
+	// Generate the filename of the older version. It gets
+	// its own file even if it was packed before.
+	std::string objFilenameOlder;
+	StoreStructure::MakeObjectFilename(rDeletion.mAdjustedObjectID,
+		mStoreRoot, mStoreDiscSet, objFilenameOlder,
+		true /* make sure the directory exists */);
+
+	// And open a write file to overwrite the other directory entry.
+	// The file will be committed later when the directory is safely
+	// committed.
+	rDeletion.mpAdjustedEntry = new RaidFileWrite(mStoreDiscSet,
+		objFilenameOlder, mapNewRefs->GetRefCount(rDeletion.mObjectID));
+	rDeletion.mpAdjustedEntry->Open(true /* allow overwriting */);
 
-		if(refs > 1)
+#ifndef WIN32
+	if(InChildProcess)
+	{
+		pid_t pid = ::fork();
+		if(pid == 0)
 		{
-			// Not safe to merge patches if someone else has a
-			// reference to this object, so just remove the
-			// directory entry and return.
-			rDirectory.DeleteEntry(ObjectID);
-			if(wasDeleted)
+			// In the child, which mustn't clean up anything
+			// belonging to the parent, such as the file being
+			// written, so it leaves with _exit().
+			try
 			{
-				rBackupStoreInfo.AdjustNumDeletedFiles(-1);
+				RunMerge(rDeletion);
 			}
-
-			if(wasOldVersion)
+			catch(std::exception &e)
 			{
-				rBackupStoreInfo.AdjustNumOldFiles(-1);
+				BOX_ERROR("Merge process for " <<
+					BOX_FORMAT_OBJECTID(rDeletion.mObjectID) <<
+					" failed: " << e.what());
+				::_exit(1);
 			}
-
-			mapNewRefs->RemoveReference(ObjectID);
-			return refs - 1;
+			::_exit(0);
 		}
 
-		// If the entry is involved in a chain of patches, it needs to be handled
-		// a bit more carefully.
-		if(pentry->GetDependsNewer() != 0 && pentry->GetDependsOlder() == 0)
+		if(pid != -1)
 		{
-			// This entry is a patch from a newer entry. Just need to update the info on that entry.
-			BackupStoreDirectory::Entry *pnewer = rDirectory.FindEntryByID(pentry->GetDependsNewer());
-			if(pnewer == 0 || pnewer->GetDependsOlder() != ObjectID)
-			{
-				THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
-			}
-			// Change the info in the newer entry so that this no longer points to this entry
-			pnewer->SetDependsOlder(0);
+			rDeletion.mMergeProcess = pid;
+			return;
 		}
-		else if(pentry->GetDependsOlder() != 0)
-		{
-			BackupStoreDirectory::Entry *polder = rDirectory.FindEntryByID(pentry->GetDependsOlder());
-			if(pentry->GetDependsNewer() == 0)
-			{
-				// There exists an older version which depends on this one. Need to combine the two over that one.
 
-				// Adjust the other entry in the directory
-				if(polder == 0 || polder->GetDependsNewer() != ObjectID)
-				{
-					THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
-				}
-				// Change the info in the older entry so that this no longer points to this entry
-				polder->SetDependsNewer(0);
-			}
-			else
-			{
-				// This entry is in the middle of a chain, and two patches need combining.
+		BOX_LOG_SYS_WARNING("Failed to start merge process, merging "
+			"in this process");
+	}
+#endif
 
-				// First, adjust the directory entries
-				BackupStoreDirectory::Entry *pnewer = rDirectory.FindEntryByID(pentry->GetDependsNewer());
-				if(pnewer == 0 || pnewer->GetDependsOlder() != ObjectID
-					|| polder == 0 || polder->GetDependsNewer() != ObjectID)
-				{
-					THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
-				}
-				// Remove the middle entry from the linked list by simply using the values from this entry
-				pnewer->SetDependsOlder(pentry->GetDependsOlder());
-				polder->SetDependsNewer(pentry->GetDependsNewer());
-			}
+	RunMerge(rDeletion);
+}
 
-			// COMMON CODE to both cases
-
-			// Generate the filename of the older version
-			std::string objFilenameOlder;
-			MakeObjectFilename(pentry->GetDependsOlder(), objFilenameOlder);
-			// Open it twice (it's the diff)
-			std::auto_ptr<RaidFileRead> pdiff(RaidFileRead::Open(mStoreDiscSet, objFilenameOlder));
-			std::auto_ptr<RaidFileRead> pdiff2(RaidFileRead::Open(mStoreDiscSet, objFilenameOlder));
-			// Open this file
-			std::string objFilename;
-			MakeObjectFilename(ObjectID, objFilename);
-			std::auto_ptr<RaidFileRead> pobjectBeingDeleted(RaidFileRead::Open(mStoreDiscSet, objFilename));
-			// And open a write file to overwrite the other directory entry
-			padjustedEntry.reset(new RaidFileWrite(mStoreDiscSet,
-				objFilenameOlder, mapNewRefs->GetRefCount(ObjectID)));
-			padjustedEntry->Open(true /* allow overwriting */);
-
-			if(pentry->GetDependsNewer() == 0)
-			{
-				// There exists an older version which depends on this one. Need to combine the two over that one.
-				BackupStoreFile::CombineFile(*pdiff, *pdiff2, *pobjectBeingDeleted, *padjustedEntry);
-			}
-			else
-			{
-				// This entry is in the middle of a chain, and two patches need combining.
-				BackupStoreFile::CombineDiffs(*pobjectBeingDeleted, *pdiff, *pdiff2, *padjustedEntry);
-			}
-			// The file will be committed later when the directory is safely commited.
 
-			// Work out the adjusted size
-			int64_t newSize = padjustedEntry->GetDiscUsageInBlocks();
-			int64_t sizeDelta = newSize - polder->GetSizeInBlocks();
-			mBlocksUsedDelta += sizeDelta;
-			if(polder->IsDeleted())
-			{
-				mBlocksInDeletedFilesDelta += sizeDelta;
-			}
-			if(polder->IsOld())
-			{
-				mBlocksInOldFilesDelta += sizeDelta;
-			}
-			polder->SetSizeInBlocks(newSize);
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::RunMerge(PendingDeletion &)
+//		Purpose: Combine the file being deleted with the older
+//			 version which depends on it, writing the result to
+//			 the file opened by StartMerge().
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::RunMerge(PendingDeletion &rDeletion)
+{
+	// Open the older version twice (it's the diff)
+	std::auto_ptr<IOStream> pdiff(mPackIndex.OpenObject(rDeletion.mAdjustedObjectID));
+	std::auto_ptr<IOStream> pdiff2(mPackIndex.OpenObject(rDeletion.mAdjustedObjectID));
+	// Open this file
+	std::auto_ptr<IOStream> pobjectBeingDeleted(mPackIndex.OpenObject(rDeletion.mObjectID));
+
+	if(rDeletion.mCombineDiffs)
+	{
+		// This entry is in the middle of a chain, and two patches need combining.
+		BackupStoreFile::CombineDiffs(*pobjectBeingDeleted, *pdiff, *pdiff2, *rDeletion.mpAdjustedEntry);
+	}
+	else
+	{
+		// There exists an older version which depends on this one. Need to combine the two over that one.
+		BackupStoreFile::CombineFile(*pdiff, *pdiff2, *pobjectBeingDeleted, *rDeletion.mpAdjustedEntry);
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::FinishMerge(PendingDeletion &,
+//			 BackupStoreDirectory &)
+//		Purpose: Wait for a merge started by StartMerge() to finish,
+//			 doing it again in this process if its child process
+//			 failed, and record the new size of the older version
+//			 in the directory.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::FinishMerge(PendingDeletion &rDeletion,
+	BackupStoreDirectory &rDirectory)
+{
+#ifndef WIN32
+	if(rDeletion.mMergeProcess != 0)
+	{
+		int status = 0;
+		pid_t p;
+		while((p = ::waitpid(rDeletion.mMergeProcess, &status, 0)) == -1 &&
+			errno == EINTR)
+		{
+			// Interrupted, try again
 		}
+		rDeletion.mMergeProcess = 0;
 
-		// pentry no longer valid
+		if(p == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			BOX_WARNING("Merge process for " <<
+				BOX_FORMAT_OBJECTID(rDeletion.mObjectID) <<
+				" failed, merging in this process");
+			rDeletion.mpAdjustedEntry->Discard();
+			rDeletion.mpAdjustedEntry->Open(true /* allow overwriting */);
+			RunMerge(rDeletion);
+		}
 	}
+#endif
 
-	// Delete it from the directory
-	rDirectory.DeleteEntry(ObjectID);
+	BackupStoreDirectory::Entry *polder =
+		rDirectory.FindEntryByID(rDeletion.mAdjustedObjectID);
+	if(polder == 0)
+	{
+		THROW_EXCEPTION(BackupStoreException, PatchChainInfoBadInDirectory);
+	}
 
-	// Save directory back to disc
-	// BLOCK
+	// Work out the adjusted size
+	int64_t newSize = rDeletion.mpAdjustedEntry->GetDiscUsageInBlocks();
+	int64_t sizeDelta = newSize - polder->GetSizeInBlocks();
+	mBlocksUsedDelta += sizeDelta;
+	if(polder->IsDeleted())
 	{
-		RaidFileWrite writeDir(mStoreDiscSet, rDirectoryFilename,
-			mapNewRefs->GetRefCount(InDirectory));
-		writeDir.Open(true /* allow overwriting */);
-		rDirectory.WriteToStream(writeDir);
+		mBlocksInDeletedFilesDelta += sizeDelta;
+	}
+	if(polder->IsOld())
+	{
+		mBlocksInOldFilesDelta += sizeDelta;
+	}
+	polder->SetSizeInBlocks(newSize);
+}
 
-		// Get the disc usage (must do this before commiting it)
-		int64_t new_size = writeDir.GetDiscUsageInBlocks();
 
-		// Commit directory
-		writeDir.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::SaveDirectory(
+//			 BackupStoreDirectory &, const std::string &,
+//			 BackupStoreDirectory *)
+//		Purpose: Save a directory which files have been deleted
+//			 from, and update its size in its parent. If the
+//			 parent is given, it's updated in memory and the
+//			 caller must save it, which it needs to if this
+//			 returns true.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::SaveDirectory(BackupStoreDirectory &rDirectory,
+	const std::string &rDirectoryFilename, BackupStoreDirectory *pParent)
+{
+	RaidFileWrite writeDir(mStoreDiscSet, rDirectoryFilename,
+		mapNewRefs->GetRefCount(rDirectory.GetObjectID()));
+	writeDir.Open(true /* allow overwriting */);
+	rDirectory.WriteToStream(writeDir);
 
-		// Adjust block counts if the directory itself changed in size
-		int64_t original_size = rDirectory.GetUserInfo1_SizeInBlocks();
-		int64_t adjust = new_size - original_size;
-		mBlocksUsedDelta += adjust;
-		mBlocksInDirectoriesDelta += adjust;
+	// Get the disc usage (must do this before commiting it)
+	int64_t new_size = writeDir.GetDiscUsageInBlocks();
 
-		UpdateDirectorySize(rDirectory, new_size);
-	}
+	// Commit directory
+	writeDir.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+
+	// Adjust block counts if the directory itself changed in size
+	int64_t original_size = rDirectory.GetUserInfo1_SizeInBlocks();
+	int64_t adjust = new_size - original_size;
+	mBlocksUsedDelta += adjust;
+	mBlocksInDirectoriesDelta += adjust;
+
+	return UpdateDirectorySize(rDirectory, new_size, pParent);
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::FinishDeleteFile(
+//			 PendingDeletion &, BackupStoreInfo &)
+//		Purpose: Once the directory has been saved, commit the
+//			 merged older version, if any, and remove the file
+//			 from disc.
+//		Created: 15/7/04
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::FinishDeleteFile(PendingDeletion &rDeletion,
+	BackupStoreInfo& rBackupStoreInfo)
+{
+	int64_t ObjectID = rDeletion.mObjectID;
 
 	// Commit any new adjusted entry
-	if(padjustedEntry.get() != 0)
+	if(rDeletion.mpAdjustedEntry != NULL)
 	{
-		padjustedEntry->Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
-		padjustedEntry.reset(); // delete it now
+		rDeletion.mpAdjustedEntry->Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+		delete rDeletion.mpAdjustedEntry; // delete it now
+		rDeletion.mpAdjustedEntry = NULL;
+
+		// Any packed copy is now out of date
+		mPackIndex.Remove(rDeletion.mAdjustedObjectID);
 	}
 
 	// Drop reference count by one. Must now be zero, to delete the file.
@@ -886,34 +2170,29 @@ BackupStoreRefCountDatabase::refcount_t HousekeepStoreAccount::DeleteFile(
 		BOX_FORMAT_OBJECTID(ObjectID));
 	std::string objFilename;
 	MakeObjectFilename(ObjectID, objFilename);
-	RaidFileWrite del(mStoreDiscSet, objFilename, mapNewRefs->GetRefCount(ObjectID));
-	del.Delete();
+	if(!mPackIndex.Remove(ObjectID) ||
+		RaidFileRead::FileExists(mStoreDiscSet, objFilename))
+	{
+		RaidFileWrite del(mStoreDiscSet, objFilename,
+			mapNewRefs->GetRefCount(ObjectID));
+		del.Delete();
+	}
 
 	// Adjust counts for the file
 	++mFilesDeleted;
-	mBlocksUsedDelta -= deletedFileSizeInBlocks;
+	mBlocksUsedDelta -= rDeletion.mSizeInBlocks;
 
-	if(wasDeleted)
+	if(rDeletion.mWasDeleted)
 	{
-		mBlocksInDeletedFilesDelta -= deletedFileSizeInBlocks;
+		mBlocksInDeletedFilesDelta -= rDeletion.mSizeInBlocks;
 		rBackupStoreInfo.AdjustNumDeletedFiles(-1);
 	}
 
-	if(wasOldVersion)
+	if(rDeletion.mWasOldVersion)
 	{
-		mBlocksInOldFilesDelta -= deletedFileSizeInBlocks;
+		mBlocksInOldFilesDelta -= rDeletion.mSizeInBlocks;
 		rBackupStoreInfo.AdjustNumOldFiles(-1);
 	}
-
-	// Delete the directory?
-	// Do this if... dir has zero entries, and is marked as deleted in it's containing directory
-	if(rDirectory.GetNumberOfEntries() == 0)
-	{
-		// Candidate for deletion
-		mEmptyDirectories.push_back(InDirectory);
-	}
-
-	return 0;
 }
 
 // --------------------------------------------------------------------------
@@ -921,16 +2200,20 @@ BackupStoreRefCountDatabase::refcount_t HousekeepStoreAccount::DeleteFile(
 // Function
 //		Name:    HousekeepStoreAccount::UpdateDirectorySize(
 //			 BackupStoreDirectory& rDirectory,
-//			 IOStream::pos_type new_size_in_blocks)
+//			 IOStream::pos_type new_size_in_blocks,
+//			 BackupStoreDirectory *pParent)
 //		Purpose: Update the directory size, modifying the parent
 //			 directory's entry for this directory if necessary.
+//			 If the parent is given, it's only changed in memory,
+//			 and this returns true if the caller needs to save it.
 //		Created: 05/03/14
 //
 // --------------------------------------------------------------------------
 
-void HousekeepStoreAccount::UpdateDirectorySize(
+bool HousekeepStoreAccount::UpdateDirectorySize(
 	BackupStoreDirectory& rDirectory,
-	IOStream::pos_type new_size_in_blocks)
+	IOStream::pos_type new_size_in_blocks,
+	BackupStoreDirectory *pParent)
 {
 #ifndef BOX_RELEASE_BUILD
 	{
@@ -947,22 +2230,26 @@ void HousekeepStoreAccount::UpdateDirectorySize(
 
 	if(new_size_in_blocks == old_size_in_blocks)
 	{
-		return;
+		return false;
 	}
 
 	rDirectory.SetUserInfo1_SizeInBlocks(new_size_in_blocks);
 
 	if (rDirectory.GetObjectID() == BACKUPSTORE_ROOT_DIRECTORY_ID)
 	{
-		return;
+		return false;
 	}
 
 	std::string parentFilename;
-	MakeObjectFilename(rDirectory.GetContainerID(), parentFilename);
-	std::auto_ptr<RaidFileRead> parentStream(
-		RaidFileRead::Open(mStoreDiscSet, parentFilename));
-	BackupStoreDirectory parent(*parentStream);
-	parentStream.reset();
+	std::auto_ptr<BackupStoreDirectory> apParent;
+	if(pParent == NULL)
+	{
+		MakeObjectFilename(rDirectory.GetContainerID(), parentFilename);
+		std::auto_ptr<RaidFileRead> parentStream(
+			RaidFileRead::Open(mStoreDiscSet, parentFilename));
+		apParent.reset(new BackupStoreDirectory(*parentStream));
+	}
+	BackupStoreDirectory &parent(pParent ? *pParent : *apParent);
 
 	BackupStoreDirectory::Entry* en =
 		parent.FindEntryByID(rDirectory.GetObjectID());
@@ -981,11 +2268,325 @@ void HousekeepStoreAccount::UpdateDirectorySize(
 
 	en->SetSizeInBlocks(new_size_in_blocks);
 
+	if(pParent != NULL)
+	{
+		// The caller will save it
+		return true;
+	}
+
 	RaidFileWrite writeDir(mStoreDiscSet, parentFilename,
 		mapNewRefs->GetRefCount(rDirectory.GetContainerID()));
 	writeDir.Open(true /* allow overwriting */);
 	parent.WriteToStream(writeDir);
 	writeDir.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+	return false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::FindPatchToRebase(
+//			 BackupStoreDirectory &, int64_t)
+//		Purpose: Private. Follow the chain of patches back from a
+//			 complete file, and return the ID of the first one
+//			 which can't be restored without going over the
+//			 depth or size limits, or zero if there isn't one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t HousekeepStoreAccount::FindPatchToRebase(
+	BackupStoreDirectory &rDirectory, int64_t CompleteObjectID)
+{
+	int depth = 0;
+	int64_t blocks = 0;
+	int64_t newerID = CompleteObjectID;
+	BackupStoreDirectory::Entry *pnewer =
+		rDirectory.FindEntryByID(newerID);
+
+	while(pnewer != 0 && pnewer->GetDependsOlder() != 0)
+	{
+		BackupStoreDirectory::Entry *polder =
+			rDirectory.FindEntryByID(pnewer->GetDependsOlder());
+		if(polder == 0 || polder->GetDependsNewer() != newerID)
+		{
+			// Broken chain, which bbstoreaccounts check will fix
+			return 0;
+		}
+
+		++depth;
+		blocks += polder->GetSizeInBlocks();
+		if((mMaxPatchChainDepth > 0 && depth > mMaxPatchChainDepth) ||
+			(mMaxPatchChainBlocks > 0 && blocks > mMaxPatchChainBlocks))
+		{
+			return polder->GetObjectID();
+		}
+
+		newerID = polder->GetObjectID();
+		pnewer = polder;
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::RebasePatchChains()
+//		Purpose: Private. Rewrite patches in the directories found
+//			 during the scan as complete files, wherever they
+//			 make a chain too long, returning true if the
+//			 operation was interrupted.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::RebasePatchChains()
+{
+	while(!mDirectoriesWithLongPatchChains.empty())
+	{
+#ifndef WIN32
+		if((--mCountUntilNextInterprocessMsgCheck) <= 0)
+		{
+			mCountUntilNextInterprocessMsgCheck =
+				POLL_INTERPROCESS_MSG_CHECK_FREQUENCY;
+			// Check for having to stop
+			if(mpHousekeepingCallback && mpHousekeepingCallback->CheckForInterProcessMsg(mAccountID))	// include account ID here as the specified account is now locked
+			{
+				// Need to abort now
+				return true;
+			}
+		}
+#endif
+		ThrottleOperation();
+
+		int64_t dirID = *(mDirectoriesWithLongPatchChains.begin());
+		mDirectoriesWithLongPatchChains.erase(
+			mDirectoriesWithLongPatchChains.begin());
+
+		// It might have been deleted since it was scanned
+		std::string dirFilename;
+		MakeObjectFilename(dirID, dirFilename);
+		if(!RaidFileRead::FileExists(mStoreDiscSet, dirFilename))
+		{
+			continue;
+		}
+
+		BackupStoreDirectory dir;
+		{
+			std::auto_ptr<RaidFileRead> dirStream(
+				RaidFileRead::Open(mStoreDiscSet, dirFilename));
+			dir.ReadFromStream(*dirStream, IOStream::TimeOutInfinite);
+			dir.SetUserInfo1_SizeInBlocks(
+				dirStream->GetDiscUsageInBlocks());
+		}
+
+		// Find the complete files at the start of each chain
+		std::vector<int64_t> chainStarts;
+		{
+			BackupStoreDirectory::Iterator i(dir);
+			BackupStoreDirectory::Entry *en = 0;
+			while((en = i.Next(BackupStoreDirectory::Entry::Flags_File)) != 0)
+			{
+				if(en->GetDependsNewer() == 0 &&
+					en->GetDependsOlder() != 0)
+				{
+					chainStarts.push_back(en->GetObjectID());
+				}
+			}
+		}
+
+		// Rebase each chain as many times as it takes to split it
+		// into chains which are short enough
+		for(std::vector<int64_t>::const_iterator
+			i(chainStarts.begin()); i != chainStarts.end(); ++i)
+		{
+			int64_t completeID = *i;
+			int64_t patchID;
+			while((patchID = FindPatchToRebase(dir, completeID)) != 0)
+			{
+				if(!RebasePatch(dir, dirFilename, completeID,
+					patchID))
+				{
+					break;
+				}
+				completeID = patchID;
+			}
+		}
+	}
+
+	if(mPatchesRebased > 0)
+	{
+		BOX_INFO("Housekeeping on account " <<
+			BOX_FORMAT_ACCOUNT(mAccountID) << " rewrote " <<
+			mPatchesRebased << " old versions as complete files "
+			"to shorten patch chains");
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::RebasePatch(
+//			 BackupStoreDirectory &, const std::string &,
+//			 int64_t, int64_t)
+//		Purpose: Private. Rebuild an old version from the complete
+//			 file at the start of its chain, store it as a
+//			 complete file in place of the patch, and cut the
+//			 chain there. Returns false if it's referenced from
+//			 somewhere else, and can't be changed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool HousekeepStoreAccount::RebasePatch(BackupStoreDirectory &rDirectory,
+	const std::string &rDirectoryFilename, int64_t CompleteObjectID,
+	int64_t PatchObjectID)
+{
+	// Another directory with the same entry would still think that
+	// it's a patch
+	BackupStoreRefCountDatabase::refcount_t refs =
+		mapNewRefs->GetRefCount(PatchObjectID);
+	if(refs != 1)
+	{
+		BOX_TRACE("Not rebasing patch " <<
+			BOX_FORMAT_OBJECTID(PatchObjectID) << " with " <<
+			refs << " references");
+		return false;
+	}
+
+	// Work out the chain of patches back to this one
+	std::vector<int64_t> patchChain;
+	BackupStoreDirectory::Entry *pnewer = 0;
+	{
+		int64_t id = CompleteObjectID;
+		while(id != PatchObjectID)
+		{
+			pnewer = rDirectory.FindEntryByID(id);
+			ASSERT(pnewer != 0);
+			id = pnewer->GetDependsOlder();
+			patchChain.push_back(id);
+		}
+	}
+
+	// Apply each patch in turn to the complete file
+	std::auto_ptr<IOStream> from(mPackIndex.OpenObject(CompleteObjectID));
+	for(size_t p = 0; p < patchChain.size(); ++p)
+	{
+		std::auto_ptr<IOStream> diff(mPackIndex.OpenObject(patchChain[p]));
+		std::auto_ptr<IOStream> diff2(mPackIndex.OpenObject(patchChain[p]));
+
+		std::ostringstream fs;
+		fs << mStoreRoot << ".rebasetemp." << p;
+		std::string tempFn =
+			RaidFileController::DiscSetPathToFileSystemPath(
+				mStoreDiscSet, fs.str(), p + 16);
+		std::auto_ptr<IOStream> combined(
+			new InvisibleTempFileStream(
+				tempFn, O_RDWR | O_CREAT | O_EXCL |
+				O_BINARY | O_TRUNC));
+
+		BackupStoreFile::CombineFile(*diff, *diff2, *from, *combined);
+		combined->Seek(0, IOStream::SeekType_Absolute);
+		from = combined;
+	}
+
+	// Overwrite the patch. It gets its own file even if it was packed
+	// before.
+	std::string objFilename;
+	StoreStructure::MakeObjectFilename(PatchObjectID, mStoreRoot,
+		mStoreDiscSet, objFilename,
+		true /* make sure the directory exists */);
+	RaidFileWrite rebased(mStoreDiscSet, objFilename, refs);
+	rebased.Open(true /* allow overwriting */);
+	from->CopyStreamTo(rebased);
+	from.reset();
+
+	// Cut the chain in the directory
+	BackupStoreDirectory::Entry *ppatch =
+		rDirectory.FindEntryByID(PatchObjectID);
+	ASSERT(ppatch != 0);
+	pnewer->SetDependsOlder(0);
+	ppatch->SetDependsNewer(0);
+
+	int64_t newSize = rebased.GetDiscUsageInBlocks();
+	int64_t sizeDelta = newSize - ppatch->GetSizeInBlocks();
+	mBlocksUsedDelta += sizeDelta;
+	if(ppatch->IsDeleted())
+	{
+		mBlocksInDeletedFilesDelta += sizeDelta;
+	}
+	if(ppatch->IsOld())
+	{
+		mBlocksInOldFilesDelta += sizeDelta;
+	}
+	ppatch->SetSizeInBlocks(newSize);
+
+	// Save directory back to disc before committing the object, as
+	// FinishDeleteFile() does
+	{
+		RaidFileWrite writeDir(mStoreDiscSet, rDirectoryFilename,
+			mapNewRefs->GetRefCount(rDirectory.GetObjectID()));
+		writeDir.Open(true /* allow overwriting */);
+		rDirectory.WriteToStream(writeDir);
+		int64_t new_size = writeDir.GetDiscUsageInBlocks();
+		writeDir.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+
+		int64_t adjust = new_size - rDirectory.GetUserInfo1_SizeInBlocks();
+		mBlocksUsedDelta += adjust;
+		mBlocksInDirectoriesDelta += adjust;
+
+		UpdateDirectorySize(rDirectory, new_size);
+	}
+
+	rebased.Commit(BACKUP_STORE_CONVERT_TO_RAID_IMMEDIATELY);
+
+	// Any packed copy is now out of date
+	mPackIndex.Remove(PatchObjectID);
+
+	BOX_TRACE("Rebased patch " << BOX_FORMAT_OBJECTID(PatchObjectID) <<
+		" in dir " << BOX_FORMAT_OBJECTID(rDirectory.GetObjectID()) <<
+		" as a complete file of " << newSize << " blocks");
+	++mPatchesRebased;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    HousekeepStoreAccount::PackObjects()
+//		Purpose: Move the small old and deleted files found during
+//			 the scan into pack files, and rewrite packs which
+//			 are now mostly unused.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void HousekeepStoreAccount::PackObjects()
+{
+	if(!mPackCandidates.empty())
+	{
+		int64_t packed = mPackIndex.PackObjects(mPackCandidates);
+		mPackCandidates.clear();
+
+		if(packed > 0)
+		{
+			BOX_INFO("Housekeeping on account " <<
+				BOX_FORMAT_ACCOUNT(mAccountID) << " moved " <<
+				packed << " files into packs");
+		}
+	}
+
+	// Compact even if packing is now disabled, so that space is
+	// still reclaimed from existing packs
+	if(mPackIndex.GetNumberOfPacks() > 0)
+	{
+		int removed = mPackIndex.CompactPacks();
+		if(removed > 0)
+		{
+			BOX_INFO("Housekeeping on account " <<
+				BOX_FORMAT_ACCOUNT(mAccountID) << " removed " <<
+				removed << " unused packs");
+		}
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -1018,6 +2619,7 @@ bool HousekeepStoreAccount::DeleteEmptyDirectories(BackupStoreInfo& rBackupStore
 				}
 			}
 #endif
+			ThrottleOperation();
 
 			// Do not delete the root directory
 			if(*i == BACKUPSTORE_ROOT_DIRECTORY_ID)
@@ -14,9 +14,13 @@
 #include <set>
 #include <vector>
 
+#include "BackupStorePackIndex.h"
 #include "BackupStoreRefCountDatabase.h"
+#include "BoxTime.h"
 
 class BackupStoreDirectory;
+class BackupStoreSharedAccountState;
+class RaidFileWrite;
 
 class HousekeepingCallback
 {
@@ -42,23 +46,94 @@ public:
 	
 	bool DoHousekeeping(bool KeepTryingForever = false);
 	int GetErrorCount() { return mErrorCount; }
+
+	// Move old and deleted files of up to this many blocks into packs.
+	// Zero, the default, leaves them in their own files.
+	void SetPackFileObjectSizeLimit(int64_t SizeInBlocks)
+	{
+		mPackFileObjectSizeLimit = SizeInBlocks;
+	}
+
+	// Load and publish the store info through memory shared with
+	// client connections
+	void SetSharedAccountState(BackupStoreSharedAccountState &rState)
+	{
+		mpSharedAccountState = &rState;
+	}
+
+	// Limit the number of directories read and objects deleted each
+	// second, to leave disc bandwidth for client connections. Zero,
+	// the default, means no limit.
+	void SetMaxOperationsPerSecond(int MaxOperationsPerSecond)
+	{
+		mMaxOperationsPerSecond = MaxOperationsPerSecond;
+	}
+
+	// Keep no more than this many candidates for deletion in memory,
+	// writing sorted runs of them to temporary files beyond that
+	void SetMaxPotentialDeletionsInMemory(size_t MaxEntries)
+	{
+		mMaxPotentialDeletionsInMemory = MaxEntries;
+	}
+
+	// Only scan the directories changed by clients since the last run,
+	// unless this long has passed since the whole account was scanned,
+	// or files must be deleted to bring it under its soft limit. Zero,
+	// the default, always scans the whole account.
+	void SetFullScanInterval(box_time_t Interval)
+	{
+		mFullScanInterval = Interval;
+	}
+
+	// Rewrite an old version stored as a patch as a complete file if
+	// restoring it would mean applying more than this many patches,
+	// or reading more than this many blocks of patches. Zero, the
+	// default, means no limit.
+	void SetMaxPatchChainDepth(int MaxDepth)
+	{
+		mMaxPatchChainDepth = MaxDepth;
+	}
+	void SetMaxPatchChainBlocks(int64_t MaxBlocks)
+	{
+		mMaxPatchChainBlocks = MaxBlocks;
+	}
+
+	// Merge the patches of files being deleted in up to this many
+	// processes at once. One, the default, merges them one after
+	// another in this process.
+	void SetMaxMergeProcesses(int MaxProcesses)
+	{
+		mMaxMergeProcesses = MaxProcesses;
+	}
 	
 private:
 	// utility functions
 	void MakeObjectFilename(int64_t ObjectID, std::string &rFilenameOut);
 
-	bool ScanDirectory(int64_t ObjectID, BackupStoreInfo& rBackupStoreInfo);
+	bool ScanDirectory(int64_t ObjectID, BackupStoreInfo& rBackupStoreInfo,
+		std::vector<int64_t> *pDeletedSubdirsOut = NULL);
+	bool ScanChangedDirectories(const std::set<int64_t> &rDirectories,
+		BackupStoreInfo& rBackupStoreInfo);
 	bool DeleteFiles(BackupStoreInfo& rBackupStoreInfo);
 	bool DeleteEmptyDirectories(BackupStoreInfo& rBackupStoreInfo);
 	void DeleteEmptyDirectory(int64_t dirId, std::vector<int64_t>& rToExamine,
 		BackupStoreInfo& rBackupStoreInfo);
-	BackupStoreRefCountDatabase::refcount_t DeleteFile(int64_t InDirectory,
-		int64_t ObjectID,
-		BackupStoreDirectory &rDirectory,
+	bool UpdateDirectorySize(BackupStoreDirectory &rDirectory,
+		IOStream::pos_type new_size_in_blocks,
+		BackupStoreDirectory *pParent = NULL);
+	bool SaveDirectory(BackupStoreDirectory &rDirectory,
 		const std::string &rDirectoryFilename,
-		BackupStoreInfo& rBackupStoreInfo);
-	void UpdateDirectorySize(BackupStoreDirectory &rDirectory,
-		IOStream::pos_type new_size_in_blocks);
+		BackupStoreDirectory *pParent = NULL);
+	void PackObjects();
+	int64_t FindPatchToRebase(BackupStoreDirectory &rDirectory,
+		int64_t CompleteObjectID);
+	bool RebasePatchChains();
+	bool RebasePatch(BackupStoreDirectory &rDirectory,
+		const std::string &rDirectoryFilename, int64_t CompleteObjectID,
+		int64_t PatchObjectID);
+	std::auto_ptr<BackupStoreInfo> LoadStoreInfo(bool ReadOnly);
+	void SaveStoreInfo(BackupStoreInfo& rBackupStoreInfo);
+	void ThrottleOperation();
 
 	typedef struct
 	{
@@ -74,6 +149,56 @@ private:
 	{
 		bool operator()(const DelEn &x, const DelEn &y) const;
 	};
+
+	// A sorted run of potential deletions in a temporary file
+	class DeletionRun;
+	struct DeletionRunCompare;
+
+	// A file being deleted, and the merge of patches, if any, which
+	// keeps the older version that depended on it restorable
+	typedef struct
+	{
+		int64_t mObjectID;
+		int64_t mInDirectory;
+		int64_t mSizeInBlocks;
+		bool    mWasDeleted;
+		bool    mWasOldVersion;
+		int64_t mAdjustedObjectID;	// 0 if nothing to merge
+		bool    mCombineDiffs;		// otherwise CombineFile
+		RaidFileWrite *mpAdjustedEntry;
+		pid_t   mMergeProcess;		// 0 if merged in this process
+	} PendingDeletion;
+
+	// Deletions whose directories are saved, and merged files
+	// committed, all at once
+	class DeletionBatch;
+
+	BackupStoreRefCountDatabase::refcount_t AddDeletion(
+		DeletionBatch &rBatch, int64_t InDirectory, int64_t ObjectID,
+		BackupStoreInfo& rBackupStoreInfo);
+	BackupStoreRefCountDatabase::refcount_t PrepareDeleteFile(
+		int64_t InDirectory, int64_t ObjectID,
+		BackupStoreDirectory &rDirectory,
+		BackupStoreInfo& rBackupStoreInfo,
+		PendingDeletion &rDeletionOut);
+	void StartMerge(PendingDeletion &rDeletion, bool InChildProcess);
+	void RunMerge(PendingDeletion &rDeletion);
+	void FinishMerge(PendingDeletion &rDeletion,
+		BackupStoreDirectory &rDirectory);
+	void FinishDeleteFile(PendingDeletion &rDeletion,
+		BackupStoreInfo& rBackupStoreInfo);
+	void FlushDeletionBatch(DeletionBatch &rBatch,
+		BackupStoreInfo& rBackupStoreInfo);
+
+	void AddPotentialDeletion(const DelEn &rEntry);
+	void SetDeletionCutoff(const DelEn &rLast);
+	void SpillPotentialDeletions();
+	void MergeDeletionRuns();
+	void StartReadingDeletionRuns();
+	bool NextFromDeletionRuns(DelEn &rEntryOut);
+	void StartReadingPotentialDeletions();
+	bool NextPotentialDeletion(DelEn &rEntryOut);
+	void DeleteDeletionRuns();
 	
 	int mAccountID;
 	std::string mStoreRoot;
@@ -85,6 +210,15 @@ private:
 	std::set<DelEn, DelEnCompare> mPotentialDeletions;
 	int64_t mPotentialDeletionsTotalSize;
 	int64_t mMaxSizeInPotentialDeletions;
+	size_t mMaxPotentialDeletionsInMemory;
+	std::vector<DeletionRun *> mDeletionRuns;
+	std::vector<DeletionRun *> mDeletionRunHeap;	// while reading runs
+	int mNextDeletionRunNumber;
+	int64_t mMaxSizeInDeletionRuns;
+	// Candidates which sort after this one would never be deleted
+	bool mHaveDeletionCutoff;
+	DelEn mDeletionCutoff;
+	std::set<DelEn, DelEnCompare>::const_iterator mNextPotentialDeletion;
 	
 	// List of directories which are empty, and might be good for deleting
 	std::vector<int64_t> mEmptyDirectories;
@@ -110,10 +244,34 @@ private:
 
 	// New reference count list
 	std::auto_ptr<BackupStoreRefCountDatabase> mapNewRefs;
+
+	// Small objects stored in pack files, and the ones to add
+	BackupStorePackIndex mPackIndex;
+	int64_t mPackFileObjectSizeLimit;
+	BackupStoreSharedAccountState *mpSharedAccountState;
+	std::vector<int64_t> mPackCandidates;
+	
+	// Limits on patch chains, and the directories with chains over them
+	int mMaxPatchChainDepth;
+	int64_t mMaxPatchChainBlocks;
+	std::set<int64_t> mDirectoriesWithLongPatchChains;
+	int64_t mPatchesRebased;
+
+	// Processes merging patches while deleting files
+	int mMaxMergeProcesses;
 	
 	// Poll frequency
 	int mCountUntilNextInterprocessMsgCheck;
 
+	// Incremental housekeeping
+	box_time_t mFullScanInterval;
+	bool mIncremental;
+
+	// I/O budget
+	int mMaxOperationsPerSecond;
+	int mOperationsInPeriod;
+	box_time_t mPeriodStart;
+
 	Logging::Tagger mTagWithClientID;
 };
 
@@ -9,10 +9,16 @@
 
 #include "Box.h"
 
+#include <stdio.h>
+
+#include <vector>
+
+#include "BackupStoreConstants.h"
 #include "StoreStructure.h"
 #include "RaidFileRead.h"
 #include "RaidFileWrite.h"
 #include "RaidFileController.h"
+#include "Logging.h"
 
 #include "MemLeakFindOn.h"
 
@@ -93,3 +99,106 @@ void StoreStructure::MakeWriteLockFilename(const std::string &rStoreRoot, int Di
 }
 
 
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    StoreStructure::MakeStagedFilename(const std::string &,
+//			 int64_t, int64_t)
+//		Purpose: Generate the RaidFile name of a file staged for a
+//			 session which holds the write lock, or if
+//			 StagedFileID is zero, of the marker which shows that
+//			 the session is still going.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+std::string StoreStructure::MakeStagedFilename(const std::string &rStoreRoot,
+	int64_t StagingSessionID, int64_t StagedFileID)
+{
+	char leaf[64];
+	if(StagedFileID == 0)
+	{
+		::snprintf(leaf, sizeof(leaf), "m%016llx",
+			(unsigned long long)StagingSessionID);
+	}
+	else
+	{
+		::snprintf(leaf, sizeof(leaf), "s%016llx-%016llx",
+			(unsigned long long)StagingSessionID,
+			(unsigned long long)StagedFileID);
+	}
+
+	return rStoreRoot + BACKUPSTORE_STAGING_DIRECTORY
+		DIRECTORY_SEPARATOR + leaf;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    StoreStructure::DeleteStagedFiles(const std::string &,
+//			 int, int64_t)
+//		Purpose: Delete the files staged for a session, and its
+//			 marker first, so that nothing more is staged for it.
+//			 If StagingSessionID is zero, delete everything
+//			 staged for any session, which must only be done
+//			 while holding the write lock.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void StoreStructure::DeleteStagedFiles(const std::string &rStoreRoot,
+	int DiscSet, int64_t StagingSessionID)
+{
+	std::string dirName(rStoreRoot + BACKUPSTORE_STAGING_DIRECTORY);
+	if(!RaidFileRead::DirectoryExists(DiscSet, dirName))
+	{
+		return;
+	}
+
+	std::vector<std::string> files;
+	RaidFileRead::ReadDirectoryContents(DiscSet, dirName,
+		RaidFileRead::DirReadType_FilesOnly, files);
+
+	std::string marker, prefix;
+	if(StagingSessionID != 0)
+	{
+		std::string path(MakeStagedFilename(rStoreRoot,
+			StagingSessionID));
+		marker = path.substr(dirName.size() + 1);
+		prefix = "s" + marker.substr(1) + "-";
+	}
+
+	std::vector<std::string> toDelete;
+	for(std::vector<std::string>::const_iterator i(files.begin());
+		i != files.end(); ++i)
+	{
+		if(StagingSessionID == 0 ? ((*i)[0] == 'm') : (*i == marker))
+		{
+			// Markers go first
+			toDelete.insert(toDelete.begin(), *i);
+		}
+		else if(StagingSessionID == 0 ||
+			i->compare(0, prefix.size(), prefix) == 0)
+		{
+			toDelete.push_back(*i);
+		}
+	}
+
+	for(std::vector<std::string>::const_iterator i(toDelete.begin());
+		i != toDelete.end(); ++i)
+	{
+		try
+		{
+			RaidFileWrite del(DiscSet,
+				dirName + DIRECTORY_SEPARATOR + *i);
+			del.Delete();
+		}
+		catch(BoxException &e)
+		{
+			BOX_WARNING("Failed to delete staged file " <<
+				dirName << DIRECTORY_SEPARATOR << *i << ": " <<
+				e.what());
+		}
+	}
+}
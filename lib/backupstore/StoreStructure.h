@@ -26,6 +26,10 @@ namespace StoreStructure
 {
 	void MakeObjectFilename(int64_t ObjectID, const std::string &rStoreRoot, int DiscSet, std::string &rFilenameOut, bool EnsureDirectoryExists);
 	void MakeWriteLockFilename(const std::string &rStoreRoot, int DiscSet, std::string &rFilenameOut);
+	std::string MakeStagedFilename(const std::string &rStoreRoot,
+		int64_t StagingSessionID, int64_t StagedFileID = 0);
+	void DeleteStagedFiles(const std::string &rStoreRoot, int DiscSet,
+		int64_t StagingSessionID = 0);
 };
 
 #endif // STORESTRUCTURE__H
@@ -0,0 +1,355 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientChangeJournal.cpp
+//		Purpose: Record of the local directories which have changed
+//			 since the last sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+#include "BackupClientChangeJournal.h"
+
+#include "MemLeakFindOn.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+	// Everything which changes the checksum of a directory's state,
+	// and more. Writes through a memory map aren't reported, but the
+	// file being closed afterwards is, which is usually soon enough.
+	#define CHANGE_JOURNAL_WATCH_EVENTS (IN_ATTRIB | IN_CLOSE_WRITE | \
+		IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | \
+		IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static NormalisePath(const std::string &)
+//		Purpose: Remove any trailing slash, so that a location's path
+//			 matches the one its subdirectories' paths start with
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static std::string NormalisePath(const std::string &rPath)
+{
+	std::string path(rPath);
+	while(path.size() > 1 && path[path.size() - 1] == '/')
+	{
+		path.resize(path.size() - 1);
+	}
+	return path;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::BackupClientChangeJournal(
+//			 box_time_t)
+//		Purpose: Constructor. If changes can't be watched for, every
+//			 sync is a full one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientChangeJournal::BackupClientChangeJournal(
+	box_time_t FullScanInterval)
+: mNotifyFD(-1),
+  mFullScanNeeded(true),
+  mFullScanThisSync(true),
+  mSyncInProgress(false),
+  mHaveLoggedWatchFailure(false),
+  mFullScanInterval(FullScanInterval),
+  mLastFullScan(0),
+  mSyncStartTime(0)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	mNotifyFD = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(mNotifyFD == -1)
+	{
+		BOX_LOG_SYS_WARNING("Failed to start watching for changes, "
+			"so every backup will read all directories");
+	}
+#else
+	BOX_WARNING("Watching for changes is not supported on this "
+		"platform, so every backup will read all directories");
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::~BackupClientChangeJournal()
+//		Purpose: Destructor, removes all the watches
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientChangeJournal::~BackupClientChangeJournal()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if(mNotifyFD != -1)
+	{
+		::close(mNotifyFD);
+	}
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::ReadEvents()
+//		Purpose: Mark the directories in which changes have been
+//			 reported since this was last called. The kernel only
+//			 keeps a limited number of events, so this should be
+//			 called regularly between syncs.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientChangeJournal::ReadEvents()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if(mNotifyFD == -1)
+	{
+		return;
+	}
+
+	// Aligned suitably for struct inotify_event
+	uint64_t buffer[1024];
+
+	while(true)
+	{
+		int bytes = ::read(mNotifyFD, buffer, sizeof(buffer));
+		if(bytes == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(bytes == -1 && errno != EAGAIN)
+		{
+			BOX_LOG_SYS_WARNING("Failed to read changes, so the "
+				"next backup will read all directories");
+			mFullScanNeeded = true;
+			return;
+		}
+		else if(bytes <= 0)
+		{
+			return;
+		}
+
+		char *pData = (char *)buffer;
+		for(int offset = 0; offset < bytes; )
+		{
+			struct inotify_event *pEvent =
+				(struct inotify_event *)(pData + offset);
+			offset += sizeof(struct inotify_event) + pEvent->len;
+
+			if(pEvent->mask & IN_Q_OVERFLOW)
+			{
+				BOX_INFO("Too many changes to keep track of, "
+					"so the next backup will read all "
+					"directories");
+				mFullScanNeeded = true;
+				continue;
+			}
+
+			std::map<int, std::string>::iterator
+				i(mWatches.find(pEvent->wd));
+			if(i == mWatches.end())
+			{
+				continue;
+			}
+
+			if((pEvent->mask & (IN_MOVE_SELF | IN_UNMOUNT)) ||
+				((pEvent->mask & IN_ISDIR) &&
+				 (pEvent->mask & (IN_MOVED_FROM | IN_MOVED_TO))))
+			{
+				// The paths of the directories below this one
+				// are no longer right.
+				BOX_TRACE("Directory moved in " << i->second <<
+					", so the next backup will read all "
+					"directories");
+				mFullScanNeeded = true;
+			}
+
+			MarkChanged(i->second);
+
+			if(pEvent->mask & IN_IGNORED)
+			{
+				// The directory was deleted, or unmounted
+				mWatches.erase(i);
+			}
+		}
+	}
+#endif // HAVE_SYS_INOTIFY_H
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::StartSync()
+//		Purpose: Collect the changes made since the last sync, and
+//			 decide whether this one can skip the directories
+//			 which haven't changed. Returns true if so.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientChangeJournal::StartSync()
+{
+	ReadEvents();
+
+	if(mSyncInProgress)
+	{
+		// The last sync didn't finish, so it may not have read
+		// all of the directories which had changed.
+		FinishSync(false);
+	}
+
+	mSyncStartTime = GetCurrentBoxTime();
+	mFullScanThisSync = (mNotifyFD == -1 || mFullScanNeeded ||
+		mLastFullScan == 0 ||
+		mSyncStartTime - mLastFullScan >= mFullScanInterval);
+	mFullScanNeeded = false;
+
+	// Changes from now on are for the next sync
+	mChangedThisSync.clear();
+	mChangedThisSync.swap(mChanged);
+	mSyncInProgress = true;
+
+	if(mFullScanThisSync)
+	{
+		BOX_TRACE("Reading all directories in this backup");
+	}
+	else
+	{
+		BOX_TRACE("Skipping directories which haven't changed since "
+			"the last backup: " << mChangedThisSync.size() <<
+			" directories to read, " << mWatches.size() <<
+			" watched");
+	}
+
+	return !mFullScanThisSync;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::FinishSync(bool)
+//		Purpose: Record the end of a sync. If it wasn't successful,
+//			 the directories it was given to read are read again
+//			 next time.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientChangeJournal::FinishSync(bool Successful)
+{
+	if(!mSyncInProgress)
+	{
+		return;
+	}
+
+	if(!Successful)
+	{
+		mChanged.insert(mChangedThisSync.begin(),
+			mChangedThisSync.end());
+		mFullScanNeeded = mFullScanNeeded || mFullScanThisSync;
+	}
+	else if(mFullScanThisSync)
+	{
+		mLastFullScan = mSyncStartTime;
+	}
+
+	mChangedThisSync.clear();
+	mSyncInProgress = false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::WatchDirectory(
+//			 const std::string &)
+//		Purpose: Start watching a directory, if not already, before
+//			 the sync reads it, so that no change made after it
+//			 was read can be missed. A directory which can't be
+//			 watched is read by every sync.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientChangeJournal::WatchDirectory(const std::string &rDirPath)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if(mNotifyFD == -1)
+	{
+		return;
+	}
+
+	std::string path(NormalisePath(rDirPath));
+	int wd = ::inotify_add_watch(mNotifyFD, path.c_str(),
+		CHANGE_JOURNAL_WATCH_EVENTS);
+	if(wd == -1)
+	{
+		if(!mHaveLoggedWatchFailure)
+		{
+			BOX_LOG_SYS_WARNING("Failed to watch directory for "
+				"changes, so it will be read by every backup "
+				"(you may need to increase "
+				"fs.inotify.max_user_watches): " << path);
+			mHaveLoggedWatchFailure = true;
+		}
+		MarkChanged(path);
+		return;
+	}
+
+	// Adding a watch again returns the same descriptor, so this also
+	// updates the path of a directory which has moved.
+	mWatches[wd] = path;
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::IsUnchanged(
+//			 const std::string &)
+//		Purpose: Returns true if nothing in the directory, or below
+//			 it, has changed since the last sync read it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientChangeJournal::IsUnchanged(const std::string &rDirPath) const
+{
+	return mSyncInProgress && !mFullScanThisSync &&
+		mChangedThisSync.find(NormalisePath(rDirPath)) ==
+			mChangedThisSync.end();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientChangeJournal::MarkChanged(
+//			 const std::string &)
+//		Purpose: Make the next sync read this directory, and the
+//			 directories above it, to reach it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientChangeJournal::MarkChanged(const std::string &rPath)
+{
+	std::string path(NormalisePath(rPath));
+
+	// If a directory is already marked, so are those above it
+	while(!path.empty() && mChanged.insert(path).second)
+	{
+		std::string::size_type pos = path.rfind('/');
+		if(pos == std::string::npos || path == "/")
+		{
+			break;
+		}
+		path.resize(pos == 0 ? 1 : pos);
+	}
+}
@@ -0,0 +1,81 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientChangeJournal.h
+//		Purpose: Record of the local directories which have changed
+//			 since the last sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPCLIENTCHANGEJOURNAL__H
+#define BACKUPCLIENTCHANGEJOURNAL__H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "BoxTime.h"
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientChangeJournal
+//		Purpose: Watches every directory the sync reads for changes
+//			 (with inotify, where available) and remembers which
+//			 ones changed between syncs, so that the sync can skip
+//			 directories in which nothing has changed. A directory
+//			 which changed is marked along with all the directories
+//			 above it, so that an unmarked directory has nothing
+//			 changed anywhere below it either.
+//
+//			 Every directory must be read once before it can be
+//			 skipped, so the first sync is a full one. A full sync
+//			 is also done if the kernel loses events, if a watched
+//			 directory is moved (as the paths of the directories
+//			 below it are then out of date), if a sync didn't
+//			 finish, and every FullScanInterval regardless.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientChangeJournal
+{
+public:
+	BackupClientChangeJournal(box_time_t FullScanInterval);
+	~BackupClientChangeJournal();
+private:
+	// no copying
+	BackupClientChangeJournal(const BackupClientChangeJournal &);
+	BackupClientChangeJournal &operator=(const BackupClientChangeJournal &);
+public:
+
+	// Collect the changes reported since the last call
+	void ReadEvents();
+
+	// Returns false if this sync must read every directory
+	bool StartSync();
+	void FinishSync(bool Successful);
+
+	// Called before the sync reads a directory
+	void WatchDirectory(const std::string &rDirPath);
+	bool IsUnchanged(const std::string &rDirPath) const;
+	// Make the next sync read this directory
+	void MarkChanged(const std::string &rPath);
+
+	int GetNumWatches() const {return mWatches.size();}
+
+private:
+	int mNotifyFD;
+	std::map<int, std::string> mWatches;
+	std::set<std::string> mChanged;
+	std::set<std::string> mChangedThisSync;
+	bool mFullScanNeeded;
+	bool mFullScanThisSync;
+	bool mSyncInProgress;
+	bool mHaveLoggedWatchFailure;
+	box_time_t mFullScanInterval;
+	box_time_t mLastFullScan;
+	box_time_t mSyncStartTime;
+};
+
+#endif // BACKUPCLIENTCHANGEJOURNAL__H
@@ -68,6 +68,7 @@ BackupClientContext::BackupClientContext
   mpCurrentIDMap(0),
   mpNewIDMap(0),
   mStorageLimitExceeded(false),
+  mStoreCanStageFiles(false),
   mpExcludeFiles(0),
   mpExcludeDirs(0),
   mKeepAliveTimer(0, "KeepAliveTime"),
@@ -98,6 +99,52 @@ BackupClientContext::~BackupClientContext()
 	}
 }
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CheckServerVersion(BackupProtocolCallable &)
+//		Purpose: Agree a protocol version with a newly connected
+//			 server. Servers which can stage files accept a later
+//			 version than older ones, which reject it but let us
+//			 try again. Returns whether it can stage files.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+static bool CheckServerVersion(BackupProtocolCallable &rConnection)
+{
+	try
+	{
+		std::auto_ptr<BackupProtocolVersion> serverVersion(
+			rConnection.QueryVersion(
+				BACKUP_STORE_SERVER_VERSION_STAGING));
+		if(serverVersion->GetVersion() !=
+			BACKUP_STORE_SERVER_VERSION_STAGING)
+		{
+			THROW_EXCEPTION(BackupStoreException, WrongServerVersion)
+		}
+		return true;
+	}
+	catch(ConnectionException &e)
+	{
+		int type, subtype;
+		if(e.GetSubType() != ConnectionException::Protocol_UnexpectedReply ||
+			!rConnection.GetLastError(type, subtype) ||
+			type != BackupProtocolError::ErrorType ||
+			subtype != BackupProtocolError::Err_WrongVersion)
+		{
+			throw;
+		}
+	}
+
+	std::auto_ptr<BackupProtocolVersion> serverVersion(
+		rConnection.QueryVersion(BACKUP_STORE_SERVER_VERSION));
+	if(serverVersion->GetVersion() != BACKUP_STORE_SERVER_VERSION)
+	{
+		THROW_EXCEPTION(BackupStoreException, WrongServerVersion)
+	}
+	return false;
+}
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -175,14 +222,7 @@ BackupProtocolCallable &BackupClientContext::GetConnection()
 		pClient->Handshake();
 
 		// Check the version of the server
-		{
-			std::auto_ptr<BackupProtocolVersion> serverVersion(
-				mapConnection->QueryVersion(BACKUP_STORE_SERVER_VERSION));
-			if(serverVersion->GetVersion() != BACKUP_STORE_SERVER_VERSION)
-			{
-				THROW_EXCEPTION(BackupStoreException, WrongServerVersion)
-			}
-		}
+		mStoreCanStageFiles = CheckServerVersion(*mapConnection);
 
 		// Login -- if this fails, the Protocol will exception
 		std::auto_ptr<BackupProtocolLoginConfirmed> loginConf(
@@ -247,6 +287,69 @@ BackupProtocolCallable &BackupClientContext::GetConnection()
 	return *mapConnection;
 }
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientContext::OpenReadOnlyConnection()
+//		Purpose: Opens and returns a new read-only connection to the
+//			 store, without affecting the main one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<BackupProtocolCallable> BackupClientContext::OpenReadOnlyConnection()
+{
+	std::auto_ptr<SocketStream> apSocket(new SocketStreamTLS);
+	((SocketStreamTLS *)(apSocket.get()))->Open(mrTLSContext,
+		Socket::TypeINET, mHostname, mPort);
+
+	std::auto_ptr<BackupProtocolClient> apClient(
+		new BackupProtocolClient(apSocket));
+	apClient->Handshake();
+
+	CheckServerVersion(*apClient);
+
+	std::auto_ptr<BackupProtocolLoginConfirmed> loginConf(
+		apClient->QueryLogin(mAccountNumber,
+			BackupProtocolLogin::Flags_ReadOnly));
+
+	// Make sure it's the same store that the main connection sees
+	if(mClientStoreMarker != ClientStoreMarker_NotKnown &&
+		loginConf->GetClientStoreMarker() != mClientStoreMarker)
+	{
+		THROW_EXCEPTION_MESSAGE(BackupStoreException,
+			ClientMarkerNotAsExpected,
+			"Expected " << mClientStoreMarker <<
+			" but found " << loginConf->GetClientStoreMarker() <<
+			" on a read-only connection");
+	}
+
+	return std::auto_ptr<BackupProtocolCallable>(apClient.release());
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientContext::StartStaging()
+//		Purpose: Ask the store to let other connections stage files
+//			 for the main one to add. Returns the staging session
+//			 ID which they must give, or zero if the store can't
+//			 stage files.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+int64_t BackupClientContext::StartStaging()
+{
+	BackupProtocolCallable &connection(GetConnection());
+	if(!mStoreCanStageFiles)
+	{
+		return 0;
+	}
+
+	std::auto_ptr<BackupProtocolSuccess> started(
+		connection.QueryStartStaging());
+	return started->GetObjectID();
+}
+
 BackupProtocolCallable* BackupClientContext::GetOpenConnection() const
 {
 	return mapConnection.get();
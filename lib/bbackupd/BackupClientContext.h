@@ -64,6 +64,13 @@ public:
 	// GetOpenConnection() will not open a connection, just return NULL if there is
 	// no connection already open.
 	virtual BackupProtocolCallable* GetOpenConnection() const;
+	// OpenReadOnlyConnection() opens another connection, which the
+	// caller owns, such as for staging uploads in another process.
+	virtual std::auto_ptr<BackupProtocolCallable> OpenReadOnlyConnection();
+	// StartStaging() lets other connections stage files for the main
+	// one to add, returning the ID they need, or zero if the store
+	// can't do that.
+	int64_t StartStaging();
 	void CloseAnyOpenConnection();
 	int GetTimeout() const;
 	BackupClientDeleteList &GetDeleteList();
@@ -205,6 +212,7 @@ public:
 	// -------------------------------------------------------------------
 	virtual void   DoKeepAlive();
 	virtual int    GetMaximumDiffingTime();
+	int GetKeepAliveTime() const { return mKeepAliveTime; }
 	virtual bool   IsManaged() { return mbIsManaged; }
 	
 	ProgressNotifier& GetProgressNotifier() const 
@@ -238,6 +246,7 @@ private:
 	const BackupClientInodeToIDMap *mpCurrentIDMap;
 	BackupClientInodeToIDMap *mpNewIDMap;
 	bool mStorageLimitExceeded;
+	bool mStoreCanStageFiles;
 	ExcludeList *mpExcludeFiles;
 	ExcludeList *mpExcludeDirs;
 	Timer mKeepAliveTimer;
@@ -0,0 +1,376 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientDirectoryReader.cpp
+//		Purpose: Reads the entries of a local directory, and their
+//			 details, for the sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_FCNTL_H
+	#include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+	#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SYSMACROS_H
+	#include <sys/sysmacros.h>
+#endif
+
+#include "BackupClientDirectoryReader.h"
+#include "CommonException.h"
+
+#include "MemLeakFindOn.h"
+
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	// Large enough for a few thousand entries at a time
+	#define DIRECTORY_READER_BUFFER_SIZE	(256 * 1024)
+
+	// The details that SyncDirectoryEntry(), UpdateItems() and
+	// BackupClientFileAttributes::GenerateAttributeHash() use. The
+	// device number is always returned.
+	#define DIRECTORY_READER_STATX_MASK (STATX_TYPE | STATX_MODE | \
+		STATX_NLINK | STATX_UID | STATX_GID | STATX_INO | \
+		STATX_SIZE | STATX_MTIME | STATX_CTIME)
+
+	// Set if the kernel turns out not to have statx(), which is only
+	// found out when it's first called.
+	static bool sStatxNotImplemented = false;
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::BackupClientDirectoryReader(
+//			 Method)
+//		Purpose: Constructor. Uses readdir() if the method asked for
+//			 isn't available on this platform.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientDirectoryReader::BackupClientDirectoryReader(Method ScanMethod)
+: mMethod(IsMethodSupported(ScanMethod) ? ScanMethod : ReadDir),
+  mpDirHandle(NULL),
+  mpEntry(NULL)
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+, mDirFD(-1),
+  mBufferUsed(0),
+  mBufferPos(0),
+  mpEntry64(NULL)
+#endif
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::~BackupClientDirectoryReader()
+//		Purpose: Destructor, closes the directory without checking
+//			 for errors
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientDirectoryReader::~BackupClientDirectoryReader()
+{
+	if(mpDirHandle != NULL)
+	{
+		::closedir(mpDirHandle);
+	}
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	if(mDirFD != -1)
+	{
+		::close(mDirFD);
+	}
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::GetNamedMethod(
+//			 const std::string &, Method &)
+//		Purpose: Convert the name of a method, as used in the
+//			 configuration file, into a Method. Returns false if
+//			 the name isn't known.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::GetNamedMethod(const std::string &rName,
+	Method &rMethod)
+{
+	if(rName == "readdir")
+	{
+		rMethod = ReadDir;
+	}
+	else if(rName == "statx")
+	{
+		rMethod = Statx;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::IsMethodSupported(Method)
+//		Purpose: Returns true if the method can be used on this
+//			 platform
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::IsMethodSupported(Method ScanMethod)
+{
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	return ScanMethod == ReadDir || ScanMethod == Statx;
+#else
+	return ScanMethod == ReadDir;
+#endif
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::Open(const std::string &)
+//		Purpose: Start reading a directory. Returns false, leaving
+//			 errno set, if it can't be opened.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::Open(const std::string &rDirPath)
+{
+	ASSERT(mpDirHandle == NULL);
+
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	ASSERT(mDirFD == -1);
+
+	if(mMethod == Statx)
+	{
+		mDirFD = ::open(rDirPath.c_str(),
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(mDirFD == -1)
+		{
+			return false;
+		}
+
+		if(mBuffer.empty())
+		{
+			mBuffer.resize(DIRECTORY_READER_BUFFER_SIZE /
+				sizeof(uint64_t));
+		}
+		mBufferUsed = 0;
+		mBufferPos = 0;
+		mpEntry64 = NULL;
+		return true;
+	}
+#endif
+
+	mpDirHandle = ::opendir(rDirPath.c_str());
+	mpEntry = NULL;
+	return mpDirHandle != NULL;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::Next()
+//		Purpose: Move on to the next entry in the directory,
+//			 including . and .., returning false if there are no
+//			 more.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::Next()
+{
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	if(mMethod == Statx)
+	{
+		if(mBufferPos >= mBufferUsed)
+		{
+			ssize_t bytes;
+			do
+			{
+				bytes = ::getdents64(mDirFD, &mBuffer[0],
+					mBuffer.size() * sizeof(uint64_t));
+			}
+			while(bytes == -1 && errno == EINTR);
+
+			if(bytes == -1)
+			{
+				BOX_LOG_SYS_ERROR("Failed to read directory");
+				THROW_EXCEPTION(CommonException, OSFileError)
+			}
+
+			mBufferUsed = bytes;
+			mBufferPos = 0;
+			if(bytes == 0)
+			{
+				mpEntry64 = NULL;
+				return false;
+			}
+		}
+
+		mpEntry64 = (struct dirent64 *)
+			(((char *)&mBuffer[0]) + mBufferPos);
+		mBufferPos += mpEntry64->d_reclen;
+		return true;
+	}
+#endif
+
+	mpEntry = ::readdir(mpDirHandle);
+	return mpEntry != NULL;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::Close()
+//		Purpose: Finish reading the directory. Exceptions are thrown
+//			 if this fails.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryReader::Close()
+{
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	if(mDirFD != -1)
+	{
+		int fd = mDirFD;
+		mDirFD = -1;
+		mpEntry64 = NULL;
+		if(::close(fd) != 0)
+		{
+			THROW_EXCEPTION(CommonException, OSFileError)
+		}
+	}
+#endif
+
+	if(mpDirHandle != NULL)
+	{
+		DIR *pDirHandle = mpDirHandle;
+		mpDirHandle = NULL;
+		mpEntry = NULL;
+		if(::closedir(pDirHandle) != 0)
+		{
+			THROW_EXCEPTION(CommonException, OSFileError)
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::GetName()
+//		Purpose: Returns the name of the current entry
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+const char *BackupClientDirectoryReader::GetName() const
+{
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	if(mMethod == Statx)
+	{
+		ASSERT(mpEntry64 != NULL);
+		return mpEntry64->d_name;
+	}
+#endif
+
+	ASSERT(mpEntry != NULL);
+	return mpEntry->d_name;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::Stat(const std::string &,
+//			 EMU_STRUCT_STAT &)
+//		Purpose: Stat the current entry, without following symbolic
+//			 links. With the Statx method, the entry is looked up
+//			 by name in the open directory rather than by its full
+//			 path, and only the details the sync uses are filled
+//			 in; the rest are zero.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::Stat(const std::string &rFullPath,
+	EMU_STRUCT_STAT &rStat)
+{
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	if(mMethod == Statx)
+	{
+		return StatAt(GetName(), rStat);
+	}
+#endif
+
+	return EMU_LSTAT(rFullPath.c_str(), &rStat) == 0;
+}
+
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryReader::StatAt(const char *,
+//			 EMU_STRUCT_STAT &)
+//		Purpose: Stat an entry in the open directory with statx(),
+//			 or with fstatat() if the kernel or filesystem can't
+//			 provide what we asked for.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryReader::StatAt(const char *pName,
+	EMU_STRUCT_STAT &rStat)
+{
+	if(!sStatxNotImplemented)
+	{
+		struct statx stx;
+		if(::statx(mDirFD, pName, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+			DIRECTORY_READER_STATX_MASK, &stx) != 0)
+		{
+			if(errno != ENOSYS)
+			{
+				return false;
+			}
+			sStatxNotImplemented = true;
+		}
+		else if((stx.stx_mask & DIRECTORY_READER_STATX_MASK) ==
+			DIRECTORY_READER_STATX_MASK)
+		{
+			::memset(&rStat, 0, sizeof(rStat));
+			rStat.st_dev = makedev(stx.stx_dev_major,
+				stx.stx_dev_minor);
+			rStat.st_ino = stx.stx_ino;
+			rStat.st_mode = stx.stx_mode;
+			rStat.st_nlink = stx.stx_nlink;
+			rStat.st_uid = stx.stx_uid;
+			rStat.st_gid = stx.stx_gid;
+			rStat.st_size = stx.stx_size;
+#ifdef HAVE_STRUCT_STAT_ST_ATIM
+			rStat.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+			rStat.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+			rStat.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+			rStat.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+#else
+			rStat.st_mtime = stx.stx_mtime.tv_sec;
+			rStat.st_ctime = stx.stx_ctime.tv_sec;
+#endif
+			return true;
+		}
+	}
+
+	return ::fstatat(mDirFD, pName, &rStat, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+#endif // BACKUPCLIENTDIRECTORYREADER_STATX
@@ -0,0 +1,96 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientDirectoryReader.h
+//		Purpose: Reads the entries of a local directory, and their
+//			 details, for the sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPCLIENTDIRECTORYREADER__H
+#define BACKUPCLIENTDIRECTORYREADER__H
+
+#include <string>
+#include <vector>
+
+#ifdef HAVE_DIRENT_H
+	#include <dirent.h>
+#endif
+
+#if defined HAVE_GETDENTS64 && defined HAVE_STATX && defined HAVE_FSTATAT
+	#define BACKUPCLIENTDIRECTORYREADER_STATX
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientDirectoryReader
+//		Purpose: Lists a directory for SyncDirectory(), and stats
+//			 each entry without following symbolic links. The
+//			 ReadDir method uses readdir() and lstat() on the full
+//			 path of each entry. The Statx method, where available,
+//			 reads many entries at a time with getdents64() into a
+//			 large buffer, and looks up each one with statx()
+//			 relative to the open directory, asking only for the
+//			 details which the sync uses. Any other method falls
+//			 back to ReadDir.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientDirectoryReader
+{
+public:
+	enum Method
+	{
+		ReadDir = 0,
+		Statx
+	};
+
+	BackupClientDirectoryReader(Method ScanMethod);
+	~BackupClientDirectoryReader();
+private:
+	// no copying
+	BackupClientDirectoryReader(const BackupClientDirectoryReader &);
+	BackupClientDirectoryReader &operator=(
+		const BackupClientDirectoryReader &);
+public:
+
+	static bool GetNamedMethod(const std::string &rName, Method &rMethod);
+	static bool IsMethodSupported(Method ScanMethod);
+
+	// Returns false, with errno set, if the directory can't be opened
+	bool Open(const std::string &rDirPath);
+	// Moves to the next entry, returning false at the end
+	bool Next();
+	void Close();
+
+	const char *GetName() const;
+#ifdef WIN32
+	// Our emulated readdir() puts the file attributes in d_type
+	int GetAttributes() const { return mpEntry->d_type; }
+#endif
+	// Stat the current entry, whose full path is given, without
+	// following symbolic links. Returns false, with errno set, if
+	// that fails.
+	bool Stat(const std::string &rFullPath, EMU_STRUCT_STAT &rStat);
+
+	// True if the results of Stat() hold everything the sync needs
+	// to know about a file, so that it needn't stat it again.
+	bool StatsAreReusable() const { return mMethod == Statx; }
+
+private:
+	Method mMethod;
+	DIR *mpDirHandle;
+	struct dirent *mpEntry;
+#ifdef BACKUPCLIENTDIRECTORYREADER_STATX
+	bool StatAt(const char *pName, EMU_STRUCT_STAT &rStat);
+	int mDirFD;
+	std::vector<uint64_t> mBuffer;
+	int mBufferUsed;
+	int mBufferPos;
+	struct dirent64 *mpEntry64;
+#endif
+};
+
+#endif // BACKUPCLIENTDIRECTORYREADER__H
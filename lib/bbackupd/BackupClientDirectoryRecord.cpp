@@ -17,11 +17,16 @@
 #include <errno.h>
 #include <string.h>
 
+#include <algorithm>
+#include <deque>
+
 #include "autogen_BackupProtocol.h"
 #include "autogen_CipherException.h"
 #include "autogen_ClientException.h"
 #include "Archive.h"
+#include "BackupClientChangeJournal.h"
 #include "BackupClientContext.h"
+#include "BackupClientDirectoryReader.h"
 #include "BackupClientDirectoryRecord.h"
 #include "BackupClientInodeToIDMap.h"
 #include "BackupDaemon.h"
@@ -43,6 +48,169 @@
 
 typedef std::map<std::string, BackupStoreDirectory::Entry *> DecryptedEntriesMap_t;
 
+// Orders directory records by name, for searching the sorted array of
+// sub directories
+class SubDirNameLess
+{
+public:
+	bool operator()(const BackupClientDirectoryRecord *pRecord,
+		const std::string &rName) const
+	{
+		return pRecord->GetSubDirName() < rName;
+	}
+};
+
+// Something the sync has to finish off once everything queued before it
+// is done: either a file which an upload process is staging, or the end
+// of a directory, whose state can't be recorded until its files are in
+class BackupClientDirectoryRecord::PendingUpload
+{
+public:
+	PendingUpload(BackupClientDirectoryRecord *pRecord)
+	: mpRecord(pRecord),
+	  mJobID(0),
+	  mTryDiff(false),
+	  mFileSize(0),
+	  mModTime(0),
+	  mAttributesHash(0),
+	  mNoPreviousVersionOnServer(false),
+	  mPendingFirstSeenTime(0),
+	  mInodeNum(0),
+	  mLatestObjectID(0),
+	  mDone(false),
+	  mScanned(false),
+	  mSyncedAll(false),
+	  mMarkChanged(false)
+	{
+		::memset(mStateChecksum, 0, sizeof(mStateChecksum));
+	}
+	int64_t GetMemoryUsed() const
+	{
+		return sizeof(*this) + mLeafName.size() + mFilename.size() +
+			mNonVssFilePath.size() + mRemotePath.size() +
+			mLocalPath.size();
+	}
+
+	BackupClientDirectoryRecord *mpRecord;
+	// The upload process's job, or zero for the end of a directory
+	int mJobID;
+	bool mTryDiff;
+	std::string mLeafName;
+	std::string mFilename;
+	std::string mNonVssFilePath;
+	std::string mRemotePath;
+	int64_t mFileSize;
+	box_time_t mModTime;
+	uint64_t mAttributesHash;
+	bool mNoPreviousVersionOnServer;
+	box_time_t mPendingFirstSeenTime;
+	InodeRefType mInodeNum;
+	int64_t mLatestObjectID;
+	// Whether the file has been finished off, which may happen before
+	// the things queued ahead of it unless they're uploaded in the
+	// order found
+	bool mDone;
+
+	// For the end of a directory: whether it was read at all, and if
+	// so, whether everything not queued was synced, whether it must be
+	// looked at again next time whatever happens, and its new state
+	std::string mLocalPath;
+	bool mScanned;
+	bool mSyncedAll;
+	bool mMarkChanged;
+	uint8_t mStateChecksum[MD5Digest::DigestLength];
+};
+
+// The queue between the stage which scans directories for files to
+// upload, and the stage which adds them to the store once the upload
+// processes have staged them. If the upload processes take files in the
+// order they were found, so are they added, and the number of files is
+// limited, as they're staged on the store until they're added. Otherwise
+// files are added as soon as they're staged, in whatever order that is,
+// and only the directories wait for the files before them. The queue is
+// always limited in memory. Anything still in it if the sync is
+// interrupted by an exception is dropped.
+class BackupClientDirectoryRecord::PendingUploads
+{
+public:
+	PendingUploads(BackupClientUploadPool &rPool, int MaxFiles,
+		int64_t MaxMemory)
+	: mrPool(rPool),
+	  mMaxFiles(MaxFiles),
+	  mMaxMemory(MaxMemory),
+	  mNumFiles(0),
+	  mMemoryUsed(0),
+	  mInOrder(rPool.GetOrder() == BackupClientUploadPool::Order_Found),
+	  mFilesQueued(0),
+	  mFilesFinished(0)
+	{ }
+	~PendingUploads()
+	{
+		for(std::deque<PendingUpload>::iterator i = mQueue.begin();
+			i != mQueue.end(); i++)
+		{
+			if(i->mJobID != 0 && !i->mDone)
+			{
+				mrPool.Forget(i->mJobID);
+			}
+		}
+	}
+	void Push(const PendingUpload &rItem)
+	{
+		mQueue.push_back(rItem);
+		mMemoryUsed += rItem.GetMemoryUsed();
+		if(rItem.mJobID != 0)
+		{
+			mNumFiles++;
+			mFilesQueued++;
+		}
+	}
+	void FileDone(PendingUpload &rItem)
+	{
+		rItem.mDone = true;
+		mNumFiles--;
+		mFilesFinished++;
+	}
+	void Pop()
+	{
+		mMemoryUsed -= mQueue.front().GetMemoryUsed();
+		mQueue.pop_front();
+	}
+	PendingUpload *Find(int JobID)
+	{
+		for(std::deque<PendingUpload>::iterator i = mQueue.begin();
+			JobID != 0 && i != mQueue.end(); i++)
+		{
+			if(i->mJobID == JobID)
+			{
+				return &(*i);
+			}
+		}
+		return NULL;
+	}
+	bool IsFull() const
+	{
+		// MaxFiles of zero means no limit
+		return (mMaxFiles > 0 && mNumFiles > mMaxFiles) ||
+			mMemoryUsed > mMaxMemory;
+	}
+
+	BackupClientUploadPool &mrPool;
+	std::deque<PendingUpload> mQueue;
+	int mMaxFiles;
+	int64_t mMaxMemory;
+	// Files not yet finished off
+	int mNumFiles;
+	int64_t mMemoryUsed;
+	// Whether files are added in the order they were found
+	bool mInOrder;
+	// For progress reports
+	int64_t mFilesQueued;
+	int64_t mFilesFinished;
+	// Directories with a queued file which wasn't uploaded
+	std::set<BackupClientDirectoryRecord *> mFailedDirectories;
+};
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -54,9 +222,14 @@ typedef std::map<std::string, BackupStoreDirectory::Entry *> DecryptedEntriesMap
 BackupClientDirectoryRecord::BackupClientDirectoryRecord(int64_t ObjectID, const std::string &rSubDirName)
 	: mObjectID(ObjectID),
 	  mSubDirName(rSubDirName),
+	  mpPendingEntries(0),
+	  mpStoredInfo(NULL),
+	  mStoredOffset(0),
+	  mSavedOffset(0),
+	  mSavedSubtreeStart(0),
+	  mSavedGeneration(0),
 	  mInitialSyncDone(false),
-	  mSyncDone(false),
-	  mpPendingEntries(0)
+	  mSyncDone(false)
 {
 	::memset(mStateChecksum, 0, sizeof(mStateChecksum));
 }
@@ -93,14 +266,133 @@ BackupClientDirectoryRecord::~BackupClientDirectoryRecord()
 void BackupClientDirectoryRecord::DeleteSubDirectories()
 {
 	// Delete all pointers
-	for(std::map<std::string, BackupClientDirectoryRecord *>::iterator i = mSubDirectories.begin();
+	for(SubDirectories_t::iterator i = mSubDirectories.begin();
 		i != mSubDirectories.end(); ++i)
 	{
-		delete i->second;
+		delete *i;
 	}
 	
-	// Empty list
-	mSubDirectories.clear();
+	// Empty list, and give back the array
+	SubDirectories_t().swap(mSubDirectories);
+
+	// Forget any which haven't been loaded yet too
+	mpStoredInfo = NULL;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FindSubDirectory(
+//			 const std::string &)
+//		Purpose: Returns the position of the record for the named
+//			 sub directory, or the end of the list if there isn't
+//			 one
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientDirectoryRecord::SubDirectories_t::iterator
+BackupClientDirectoryRecord::FindSubDirectory(const std::string &rName)
+{
+	SubDirectories_t::iterator i(std::lower_bound(mSubDirectories.begin(),
+		mSubDirectories.end(), rName, SubDirNameLess()));
+	if(i != mSubDirectories.end() && (*i)->mSubDirName != rName)
+	{
+		return mSubDirectories.end();
+	}
+	return i;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::AddSubDirectory(
+//			 BackupClientDirectoryRecord *)
+//		Purpose: Takes ownership of the record for a sub directory,
+//			 keeping the list sorted by name
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::AddSubDirectory(
+	BackupClientDirectoryRecord *pSubDirRecord)
+{
+	// Records are usually added in name order, so check the end first
+	if(mSubDirectories.empty() ||
+		mSubDirectories.back()->mSubDirName < pSubDirRecord->mSubDirName)
+	{
+		mSubDirectories.push_back(pSubDirRecord);
+		return;
+	}
+
+	mSubDirectories.insert(std::lower_bound(mSubDirectories.begin(),
+		mSubDirectories.end(), pSubDirRecord->mSubDirName,
+		SubDirNameLess()), pSubDirRecord);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::LoadSubDirectories()
+//		Purpose: Create the records for the sub directories, if this
+//			 record was loaded from a store object info file and
+//			 they haven't been needed until now
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::LoadSubDirectories()
+{
+	if(mpStoredInfo == NULL)
+	{
+		return;
+	}
+
+	const BackupClientStoreObjectInfo &rInfo(*mpStoredInfo);
+	mpStoredInfo = NULL;
+
+	storeobjectinfo_DirRecord header;
+	std::vector<std::pair<std::string, int64_t> > subDirs;
+	ReadStoredRecord(rInfo, mStoredOffset, header, NULL, NULL, &subDirs);
+
+	mSubDirectories.reserve(subDirs.size());
+	for(std::vector<std::pair<std::string, int64_t> >::const_iterator
+		i = subDirs.begin(); i != subDirs.end(); ++i)
+	{
+		std::auto_ptr<BackupClientDirectoryRecord> apSubDirRecord(
+			new BackupClientDirectoryRecord(0, ""));
+		apSubDirRecord->Load(rInfo, mStoredOffset - i->second);
+		AddSubDirectory(apSubDirRecord.get());
+		apSubDirRecord.release();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::SetUnchanged(
+//			 std::set<int64_t> &)
+//		Purpose: Record that this directory and all those below it
+//			 have been synced by finding that nothing in them has
+//			 changed, adding their IDs to the set given.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::SetUnchanged(std::set<int64_t> &rDirectoryIDs)
+{
+	rDirectoryIDs.insert(mObjectID);
+	mSyncDone = true;
+
+	if(mpStoredInfo != NULL)
+	{
+		// Don't load the records below just to find their IDs
+		GetStoredObjectIDs(*mpStoredInfo, mStoredOffset,
+			rDirectoryIDs);
+		return;
+	}
+
+	for(SubDirectories_t::iterator i = mSubDirectories.begin();
+		i != mSubDirectories.end(); ++i)
+	{
+		(*i)->SetUnchanged(rDirectoryIDs);
+	}
 }
 
 std::string BackupClientDirectoryRecord::ConvertVssPathToRealPath(
@@ -149,6 +441,55 @@ void BackupClientDirectoryRecord::SyncDirectory(
 	const Location& rBackupLocation,
 	bool ThisDirHasJustBeenCreated)
 {
+	// If there are upload processes, the outermost call keeps a queue
+	// of the files they're uploading, so that it can carry on scanning
+	// while they do, and finishes off whatever's left in it at the end.
+	if(rParams.mSyncDepth == 0)
+	{
+		std::auto_ptr<PendingUploads> apQueue;
+		if(rParams.mpUploadPool != NULL &&
+			rParams.mpUploadPool->IsRunning())
+		{
+			// Files which aren't added as soon as they're staged
+			// are limited to a couple for each process, but
+			// otherwise the processes should have as many as
+			// possible to choose from
+			BackupClientUploadPool &rPool(*rParams.mpUploadPool);
+			int maxFiles = 0;
+			if(rPool.GetOrder() == BackupClientUploadPool::Order_Found)
+			{
+				maxFiles = 2 * rPool.GetNumProcesses();
+			}
+			apQueue.reset(new PendingUploads(rPool, maxFiles,
+				rParams.mMaxUploadQueueMemory));
+		}
+
+		rParams.mpPendingUploads = apQueue.get();
+		rParams.mSyncDepth++;
+
+		try
+		{
+			SyncDirectory(rParams, ContainingDirectoryID,
+				rLocalPath, rRemotePath, rBackupLocation,
+				ThisDirHasJustBeenCreated);
+
+			while(apQueue.get() && !apQueue->mQueue.empty())
+			{
+				FinishFirstPendingUpload(rParams);
+			}
+		}
+		catch(...)
+		{
+			rParams.mpPendingUploads = NULL;
+			rParams.mSyncDepth--;
+			throw;
+		}
+
+		rParams.mpPendingUploads = NULL;
+		rParams.mSyncDepth--;
+		return;
+	}
+
 	BackupClientContext& rContext(rParams.mrContext);
 	ProgressNotifier& rNotifier(rContext.GetProgressNotifier());
 
@@ -164,12 +505,12 @@ void BackupClientDirectoryRecord::SyncDirectory(
 
 	// Start by making some flag changes, marking this sync as not done,
 	// and on the immediate sub directories.
+	LoadSubDirectories();
 	mSyncDone = false;
-	for(std::map<std::string, BackupClientDirectoryRecord *>::iterator
-		i  = mSubDirectories.begin();
+	for(SubDirectories_t::iterator i = mSubDirectories.begin();
 		i != mSubDirectories.end(); ++i)
 	{
-		i->second->mSyncDone = false;
+		(*i)->mSyncDone = false;
 	}
 
 	// Work out the time in the future after which the file should
@@ -183,6 +524,13 @@ void BackupClientDirectoryRecord::SyncDirectory(
 	// getting info from dirs. Note checksum is used locally only,
 	// so byte order isn't considered.
 	MD5Digest currentStateChecksum;
+
+	// Watch for changes before looking, so that none are missed
+	BackupClientChangeJournal *pJournal = rParams.mpChangeJournal;
+	if(pJournal)
+	{
+		pJournal->WatchDirectory(rLocalPath);
+	}
 	
 	EMU_STRUCT_STAT dest_st;
 	// Stat the directory, to get attribute info
@@ -197,6 +545,7 @@ void BackupClientDirectoryRecord::SyncDirectory(
 			// and this object deleted.
 			rNotifier.NotifyDirStatFailed(this, local_path_non_vss,
 				strerror(errno));
+			EndSyncDirectory(rParams, PendingUpload(this));
 			return;
 		}
 
@@ -232,6 +581,20 @@ void BackupClientDirectoryRecord::SyncDirectory(
 			rLocalPath.c_str());
 		currentStateChecksum.Add(xattr.GetBuffer(), xattr.GetSize());
 	}
+
+	// If nothing has changed here or below since the last sync, there's
+	// nothing it could do now, as long as it didn't leave anything to
+	// do later.
+	if(pJournal && mInitialSyncDone && !ThisDirHasJustBeenCreated &&
+		mpPendingEntries == NULL && pJournal->IsUnchanged(rLocalPath))
+	{
+		BOX_TRACE("Skipping directory " << local_path_non_vss <<
+			" (" << BOX_FORMAT_OBJECTID(mObjectID) << ") because "
+			"nothing in it has changed since the last backup");
+		SetUnchanged(rParams.mUnchangedDirectoryIDs);
+		EndSyncDirectory(rParams, PendingUpload(this));
+		return;
+	}
 	
 	// Read directory entries, building arrays of names
 	// First, need to read the contents of the directory.
@@ -242,70 +605,57 @@ void BackupClientDirectoryRecord::SyncDirectory(
 	// BLOCK
 	{
 		// read the contents...
-		DIR *dirHandle = 0;
-		try
-		{
-			rNotifier.NotifyScanDirectory(this, local_path_non_vss);
+		BackupClientDirectoryReader reader(rParams.mDirectoryScanMethod);
+		rParams.mScannedFileStats.clear();
 
-			dirHandle = ::opendir(rLocalPath.c_str());
-			if(dirHandle == 0)
-			{
-				// Report the error (logs and eventual email to administrator)
-				if (errno == EACCES)
-				{
-					rNotifier.NotifyDirListFailed(this, local_path_non_vss,
-						"Access denied");
-				}
-				else
-				{
-					rNotifier.NotifyDirListFailed(this, local_path_non_vss,
-						strerror(errno));
-				}
-
-				SetErrorWhenReadingFilesystemObject(rParams, local_path_non_vss);
-
-				// Ignore this directory for now.
-				return;
-			}
-
-			struct dirent *en = 0;
-			int num_entries_found = 0;
+		rNotifier.NotifyScanDirectory(this, local_path_non_vss);
 
-			while((en = ::readdir(dirHandle)) != 0)
+		if(!reader.Open(rLocalPath))
+		{
+			// Report the error (logs and eventual email to administrator)
+			if (errno == EACCES)
 			{
-				num_entries_found++;
-				rParams.mrContext.DoKeepAlive();
-				if(rParams.mpBackgroundTask)
-				{
-					rParams.mpBackgroundTask->RunBackgroundTask(
-						BackgroundTask::Scanning_Dirs,
-						num_entries_found, 0);
-				}
-
-				if (!SyncDirectoryEntry(rParams, rNotifier,
-					rBackupLocation, rLocalPath,
-					currentStateChecksum, en, dest_st, dirs,
-					files, downloadDirectoryRecordBecauseOfFutureFiles))
-				{
-					// This entry is not to be backed up.
-					continue;
-				}
+				rNotifier.NotifyDirListFailed(this, local_path_non_vss,
+					"Access denied");
 			}
-	
-			if(::closedir(dirHandle) != 0)
+			else
 			{
-				THROW_EXCEPTION(CommonException, OSFileError)
+				rNotifier.NotifyDirListFailed(this, local_path_non_vss,
+					strerror(errno));
 			}
-			dirHandle = 0;
+
+			SetErrorWhenReadingFilesystemObject(rParams, local_path_non_vss);
+
+			// Ignore this directory for now.
+			EndSyncDirectory(rParams, PendingUpload(this));
+			return;
 		}
-		catch(...)
+
+		int num_entries_found = 0;
+
+		while(reader.Next())
 		{
-			if(dirHandle != 0)
+			num_entries_found++;
+			rParams.mrContext.DoKeepAlive();
+			if(rParams.mpBackgroundTask)
 			{
-				::closedir(dirHandle);
+				rParams.mpBackgroundTask->RunBackgroundTask(
+					BackgroundTask::Scanning_Dirs,
+					num_entries_found, 0);
+			}
+
+			if (!SyncDirectoryEntry(rParams, rNotifier,
+				rBackupLocation, rLocalPath,
+				currentStateChecksum, reader, dest_st, dirs,
+				files, downloadDirectoryRecordBecauseOfFutureFiles))
+			{
+				// This entry is not to be backed up.
+				continue;
 			}
-			throw;
 		}
+
+		// The reader closes the directory if an exception is thrown
+		reader.Close();
 	}
 
 	// Finish off the checksum, and compare with the one currently stored
@@ -319,6 +669,11 @@ void BackupClientDirectoryRecord::SyncDirectory(
 
 	// Pointer to potentially downloaded store directory info
 	std::auto_ptr<BackupStoreDirectory> apDirOnStore;
+
+	// What's left to do once any files still being uploaded are done
+	PendingUpload end(this);
+	end.mLocalPath = rLocalPath;
+	end.mScanned = true;
 	
 	try
 	{
@@ -394,22 +749,17 @@ void BackupClientDirectoryRecord::SyncDirectory(
 			}
 		}
 		
+		// Visit the sub directories in name order, so that records
+		// for new ones are added to the end of the sorted array
+		// rather than the middle
+		std::sort(dirs.begin(), dirs.end());
+
 		// Do the directory reading
-		bool updateCompleteSuccess = UpdateItems(rParams, rLocalPath,
+		end.mSyncedAll = UpdateItems(rParams, rLocalPath,
 			rRemotePath, rBackupLocation, apDirOnStore.get(),
 			entriesLeftOver, files, dirs);
-		
-		// LAST THING! (think exception safety)
-		// Store the new checksum -- don't fetch things unnecessarily
-		// in the future But... only if 1) the storage limit isn't
-		// exceeded -- make sure things are done again if the directory
-		// is modified later and 2) All the objects within the
-		// directory were stored successfully.
-		if(!rParams.mrContext.StorageLimitExceeded() &&
-			updateCompleteSuccess)
-		{
-			currentStateChecksum.CopyDigestTo(mStateChecksum);
-		}
+		end.mMarkChanged = downloadDirectoryRecordBecauseOfFutureFiles;
+		currentStateChecksum.CopyDigestTo(end.mStateChecksum);
 	}
 	catch(...)
 	{
@@ -423,6 +773,9 @@ void BackupClientDirectoryRecord::SyncDirectory(
 	// Flag things as having happened.
 	mInitialSyncDone = true;
 	mSyncDone = true;
+
+	// LAST THING! (think exception safety)
+	EndSyncDirectory(rParams, end);
 }
 
 // --------------------------------------------------------------------------
@@ -443,13 +796,13 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 	const Location& rBackupLocation,
 	const std::string &rDirLocalPath,
 	MD5Digest& currentStateChecksum,
-	struct dirent *en,
+	BackupClientDirectoryReader &rReader,
 	EMU_STRUCT_STAT dir_st,
 	std::vector<std::string>& rDirs,
 	std::vector<std::string>& rFiles,
 	bool& rDownloadDirectoryRecordBecauseOfFutureFiles)
 {
-	std::string entry_name = en->d_name;
+	std::string entry_name = rReader.GetName();
 	if(entry_name == "." || entry_name == "..")
 	{
 		// ignore parent directory entries
@@ -471,7 +824,7 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 	// have the full file attributes.
 
 	int type;
-	if (en->d_type & FILE_ATTRIBUTE_DIRECTORY)
+	if (rReader.GetAttributes() & FILE_ATTRIBUTE_DIRECTORY)
 	{
 		type = S_IFDIR;
 	}
@@ -480,7 +833,7 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 		type = S_IFREG;
 	}
 #else // !WIN32
-	if(EMU_LSTAT(filename.c_str(), &file_st) != 0)
+	if(!rReader.Stat(filename, file_st))
 	{
 		// We don't know whether it's a file or a directory, so check
 		// both. This only affects whether a warning message is
@@ -549,7 +902,7 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 		// parent directory under Vista and later, and causes an
 		// infinite loop:
 		// http://social.msdn.microsoft.com/forums/en-US/windowscompatibility/thread/05d14368-25dd-41c8-bdba-5590bf762a68/
-		if (en->d_type & FILE_ATTRIBUTE_REPARSE_POINT)
+		if (rReader.GetAttributes() & FILE_ATTRIBUTE_REPARSE_POINT)
 		{
 			rNotifier.NotifyMountPointSkipped(this, realFileName);
 			return false;
@@ -622,7 +975,7 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 	checksum_info.mAttributeModificationTime = FileAttrModificationTime(file_st);
 	checksum_info.mSize = file_st.st_size;
 	currentStateChecksum.Add(&checksum_info, sizeof(checksum_info));
-	currentStateChecksum.Add(en->d_name, strlen(en->d_name));
+	currentStateChecksum.Add(entry_name.c_str(), entry_name.size());
 	
 	// If the file has been modified madly into the future, download the 
 	// directory record anyway to ensure that it doesn't get uploaded
@@ -639,10 +992,24 @@ bool BackupClientDirectoryRecord::SyncDirectoryEntry(
 		}
 	}
 
+#ifndef WIN32
+	// A file with several links can be changed through a directory
+	// that isn't this one, or isn't watched, so the change journal
+	// would never notice. Make sure the next sync reads this directory.
+	if(rParams.mpChangeJournal && type == S_IFREG && file_st.st_nlink > 1)
+	{
+		rParams.mpChangeJournal->MarkChanged(rDirLocalPath);
+	}
+#endif
+
 	// We've decided to back it up, so add to file or directory list.
 	if(type == S_IFREG || type == S_IFLNK)
 	{
 		rFiles.push_back(entry_name);
+		if(rReader.StatsAreReusable())
+		{
+			rParams.mScannedFileStats[entry_name] = file_st;
+		}
 	}
 	else if(type == S_IFDIR)
 	{
@@ -824,6 +1191,10 @@ bool BackupClientDirectoryRecord::UpdateItems(
 		}
 	}
 
+	// Files being uploaded by other processes, if there are any, are
+	// finished off in the order they were found
+	bool useUploadPool = (rParams.mpPendingUploads != NULL);
+
 	// Do files
 	for(std::vector<std::string>::const_iterator f = rFiles.begin();
 		f != rFiles.end(); ++f)
@@ -843,9 +1214,15 @@ bool BackupClientDirectoryRecord::UpdateItems(
 		InodeRefType inodeNum = 0;
 		// BLOCK
 		{
-			// Stat the file
+			// Stat the file, unless the scan already did
 			EMU_STRUCT_STAT st;
-			if(EMU_LSTAT(filename.c_str(), &st) != 0)
+			std::map<std::string, EMU_STRUCT_STAT>::const_iterator
+				scanned(rParams.mScannedFileStats.find(*f));
+			if(scanned != rParams.mScannedFileStats.end())
+			{
+				st = scanned->second;
+			}
+			else if(EMU_LSTAT(filename.c_str(), &st) != 0)
 			{
 				rNotifier.NotifyFileStatFailed(this, nonVssFilePath,
 					strerror(errno));
@@ -1043,6 +1420,7 @@ bool BackupClientDirectoryRecord::UpdateItems(
 			" (" << decisionReason << ")");
 
 		bool fileSynced = true;
+		bool uploadDeferred = false;
 
 		if(doUpload)
 		{
@@ -1064,65 +1442,44 @@ bool BackupClientDirectoryRecord::UpdateItems(
 				bool noPreviousVersionOnServer =
 					((pDirOnStore != 0) && (en == 0));
 				
-				// Surround this in a try/catch block, to
-				// catch errors, but still continue
-				bool uploadSuccess = false;
-				try
-				{
-					latestObjectID = UploadFile(rParams,
-						filename,
-						nonVssFilePath,
-						rRemotePath + "/" + *f,
-						storeFilename,
-						fileSize, modTime,
-						attributesHash,
-						noPreviousVersionOnServer);
-
-					if(latestObjectID == 0)
-					{
-						// storage limit exceeded
-						rParams.mrContext.SetStorageLimitExceeded();
-						uploadSuccess = false;
-						allUpdatedSuccessfully = false;
-					}
-					else
-					{
-						uploadSuccess = true;
-					}
-				}
-				catch(ConnectionException &e)
-				{
-					// Connection errors should just be
-					// passed on to the main handler,
-					// retries would probably just cause
-					// more problems.
-					rNotifier.NotifyFileUploadException(
-						this, nonVssFilePath, e);
-					throw;
-				}
-				catch(BoxException &e)
+				if(useUploadPool)
 				{
-					if(e.GetType() == BackupStoreException::ExceptionType &&
-						e.GetSubType() == BackupStoreException::SignalReceived)
-					{
-						// abort requested, pass the
-						// exception on up.
-						throw;
-					}
-					
-					// an error occured -- make return
-					// code false, to show error in directory
-					allUpdatedSuccessfully = false;
-					// Log it.
-					SetErrorWhenReadingFilesystemObject(rParams,
-						nonVssFilePath);
-					rNotifier.NotifyFileUploadException(this,
-						nonVssFilePath, e);
+					// Have another process stage it, and
+					// finish it off later
+					PendingUpload upload(this);
+					upload.mLeafName = *f;
+					upload.mFilename = filename;
+					upload.mNonVssFilePath = nonVssFilePath;
+					upload.mRemotePath = rRemotePath + "/" + *f;
+					upload.mFileSize = fileSize;
+					upload.mModTime = modTime;
+					upload.mAttributesHash = attributesHash;
+					upload.mNoPreviousVersionOnServer =
+						noPreviousVersionOnServer;
+					upload.mPendingFirstSeenTime =
+						pendingFirstSeenTime;
+					upload.mInodeNum = inodeNum;
+					upload.mLatestObjectID = latestObjectID;
+
+					BackupClientUploadPool::Job job;
+					job.mDirectoryID = mObjectID;
+					job.mLocalPath = filename;
+					job.mLeafName = *f;
+					job.mTryDiff = !noPreviousVersionOnServer &&
+						fileSize >= rParams.mDiffingUploadSizeThreshold;
+					job.mFileSize = fileSize;
+					job.mModTime = modTime;
+					upload.mTryDiff = job.mTryDiff;
+					upload.mJobID = rParams.mpUploadPool->Submit(job);
+					QueuePendingUpload(rParams, upload);
+					uploadDeferred = true;
 				}
-
-				// Update structures if the file was uploaded
-				// successfully.
-				if(uploadSuccess)
+				else if(UploadFileCatchingErrors(rParams,
+					filename, nonVssFilePath,
+					rRemotePath + "/" + *f, storeFilename,
+					fileSize, modTime, attributesHash,
+					noPreviousVersionOnServer, NULL,
+					latestObjectID))
 				{
 					fileSynced = true;
 
@@ -1132,6 +1489,10 @@ bool BackupClientDirectoryRecord::UpdateItems(
 						mpPendingEntries->erase(*f);
 					}
 				}
+				else
+				{
+					allUpdatedSuccessfully = false;
+				}
 			}
 			else
 			{
@@ -1205,66 +1566,18 @@ bool BackupClientDirectoryRecord::UpdateItems(
 			}
 		}
 		
-		// Does this file need an entry in the ID map?
-		if(fileSize >= rParams.mFileTrackingSizeThreshold)
+		if(uploadDeferred)
 		{
-			// Get the map
-			BackupClientInodeToIDMap &idMap(rContext.GetNewIDMap());
-		
-			// Need to get an ID from somewhere...
-			if(latestObjectID == 0)
-			{
-				// Don't know it -- haven't sent anything to the store, and didn't get a listing.
-				// Look it up in the current map, and if it's there, use that.
-				const BackupClientInodeToIDMap &currentIDMap(rContext.GetCurrentIDMap());
-				int64_t objid = 0, dirid = 0;
-				if(currentIDMap.Lookup(inodeNum, objid, dirid))
-				{
-					// Found
-					if(dirid != mObjectID)
-					{
-						BOX_WARNING("Found conflicting parent ID for "
-							"file ID " << inodeNum << " (" <<
-							nonVssFilePath << "): expected " <<
-							mObjectID << " but found " << dirid <<
-							" (same directory used in two different "
-							"locations?)");
-					}
-
-					ASSERT(dirid == mObjectID);
-
-					// NOTE: If the above assert fails, an inode number has been reused by the OS,
-					// or there is a problem somewhere. If this happened on a short test run, look
-					// into it. However, in a long running process this may happen occasionally and
-					// not indicate anything wrong.
-					// Run the release version for real life use, where this check is not made.
-
-					latestObjectID = objid;
-				}
-			}
-
-			if(latestObjectID != 0)
-			{
-				BOX_TRACE("Storing uploaded file ID " << inodeNum << " (" <<
-					nonVssFilePath << ") in ID map as object " <<
-					BOX_FORMAT_OBJECTID(latestObjectID) << " with parent " <<
-					BOX_FORMAT_OBJECTID(mObjectID));
-				idMap.AddToMap(inodeNum, latestObjectID,
-					mObjectID /* containing directory */,
-					nonVssFilePath);
-			}
-
+			continue;
 		}
 
-		if(fileSynced)
-		{
-			rNotifier.NotifyFileSynchronised(this, nonVssFilePath,
-				fileSize);
-		}
+		RecordSyncedFile(rParams, nonVssFilePath, fileSize, inodeNum,
+			latestObjectID, fileSynced);
 	}
 
 	// Erase contents of files to save space when recursing
 	rFiles.clear();
+	rParams.mScannedFileStats.clear();
 
 	// Delete the pending entries, if the map is empty
 	if(mpPendingEntries != 0 && mpPendingEntries->size() == 0)
@@ -1336,13 +1649,12 @@ bool BackupClientDirectoryRecord::UpdateItems(
 
 		// Next, see if it's in the list of sub directories
 		BackupClientDirectoryRecord *psubDirRecord = 0;
-		std::map<std::string, BackupClientDirectoryRecord *>::iterator
-			e(mSubDirectories.find(*d));
+		SubDirectories_t::iterator e(FindSubDirectory(*d));
 
 		if(e != mSubDirectories.end())
 		{
 			// In the list, just use this pointer
-			psubDirRecord = e->second;
+			psubDirRecord = *e;
 		}
 		else
 		{
@@ -1395,7 +1707,7 @@ bool BackupClientDirectoryRecord::UpdateItems(
 				// Store in list
 				try
 				{
-					mSubDirectories[*d] = psubDirRecord;
+					AddSubDirectory(psubDirRecord);
 				}
 				catch(...)
 				{
@@ -1471,12 +1783,12 @@ bool BackupClientDirectoryRecord::UpdateItems(
 				// If there's a directory record for it in
 				// the sub directory map, delete it now
 				BackupStoreFilenameClear dirname(en->GetName());
-				std::map<std::string, BackupClientDirectoryRecord *>::iterator
-					e(mSubDirectories.find(filenameClear));
+				SubDirectories_t::iterator
+					e(FindSubDirectory(filenameClear));
 				if(e != mSubDirectories.end() && !isCorruptFilename)
 				{
-					// Carefully delete the entry from the map
-					BackupClientDirectoryRecord *rec = e->second;
+					// Carefully delete the entry from the list
+					BackupClientDirectoryRecord *rec = *e;
 					mSubDirectories.erase(e);
 					delete rec;
 
@@ -1765,13 +2077,12 @@ void BackupClientDirectoryRecord::RemoveDirectoryInPlaceOfFile(
 		pEntry->GetObjectID(), clear.GetClearFilename());
 
 	// Then, delete any directory record
-	std::map<std::string, BackupClientDirectoryRecord *>::iterator
-		e(mSubDirectories.find(rFilename));
+	SubDirectories_t::iterator e(FindSubDirectory(rFilename));
 
 	if(e != mSubDirectories.end())
 	{
 		// A record exists for this, remove it
-		BackupClientDirectoryRecord *psubDirRecord = e->second;
+		BackupClientDirectoryRecord *psubDirRecord = *e;
 		mSubDirectories.erase(e);
 
 		// And delete the object
@@ -1918,27 +2229,13 @@ int64_t BackupClientDirectoryRecord::UploadFile(
 		rContext.UnManageDiffProcess();
 
 		if(e.GetType() == ConnectionException::ExceptionType &&
-			e.GetSubType() == ConnectionException::Protocol_UnexpectedReply)
+			e.GetSubType() == ConnectionException::Protocol_UnexpectedReply &&
+			IsStoreFullError(rParams, connection, rNonVssFilePath))
 		{
-			// Check and see what error the protocol has,
-			// this is more useful to users than the exception.
-			int type, subtype;
-			if(connection.GetLastError(type, subtype))
-			{
-				if(type == BackupProtocolError::ErrorType
-				&& subtype == BackupProtocolError::Err_StorageLimitExceeded)
-				{
-					// The hard limit was exceeded on the server, notify!
-					rParams.mrSysadminNotifier.NotifySysadmin(
-						SysadminNotifier::StoreFull);
-					// return an error code instead of
-					// throwing an exception that we
-					// can't debug.
-					return 0;
-				}
-				rNotifier.NotifyFileUploadServerError(this,
-					rNonVssFilePath, type, subtype);
-			}
+			// return an error code instead of
+			// throwing an exception that we
+			// can't debug.
+			return 0;
 		}
 		
 		// Send the error on it's way
@@ -1956,30 +2253,645 @@ int64_t BackupClientDirectoryRecord::UploadFile(
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    BackupClientDirectoryRecord::SetErrorWhenReadingFilesystemObject(
-//			 SyncParams &, const char *)
-//		Purpose: Sets the error state when there were problems
-//			 reading an object from the filesystem.
-//		Created: 29/3/04
+//		Name:    BackupClientDirectoryRecord::StoreStagedFile(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const std::string &,
+//			 const BackupStoreFilenameClear &, int64_t,
+//			 box_time_t, box_time_t,
+//			 const BackupClientUploadPool::Result &)
+//		Purpose: Private. Add a file which an upload process has
+//			 staged on the server, as UploadFile() would have
+//			 uploaded it.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-void BackupClientDirectoryRecord::SetErrorWhenReadingFilesystemObject(
+int64_t BackupClientDirectoryRecord::StoreStagedFile(
 	BackupClientDirectoryRecord::SyncParams &rParams,
-	const std::string& rFilename)
+	const std::string &rNonVssFilePath,
+	const BackupStoreFilenameClear &rStoreFilename,
+	int64_t FileSize,
+	box_time_t ModificationTime,
+	box_time_t AttributesHash,
+	const BackupClientUploadPool::Result &rStaged)
 {
-	// Zero hash, so it gets synced properly next time round.
-	::memset(mStateChecksum, 0, sizeof(mStateChecksum));
+	BackupClientContext& rContext(rParams.mrContext);
+	ProgressNotifier& rNotifier(rContext.GetProgressNotifier());
+	BackupProtocolCallable &connection(rContext.GetConnection());
 
-	// More detailed logging was already done by the caller, but if we
-	// have a read error reported, we need to be able to search the logs
-	// to find out which file it was, so we need to log a consistent and
-	// clear error message.
-	BOX_WARNING("Failed to backup file, see above for details: " <<
-		rFilename);
+	if(rStaged.mIsPatch)
+	{
+		rNotifier.NotifyFileUploadingPatch(this, rNonVssFilePath,
+			rStaged.mBytesToUpload);
+	}
+	else
+	{
+		rNotifier.NotifyFileUploading(this, rNonVssFilePath);
+	}
 
-	// Mark that an error occured in the parameters object
-	rParams.mReadErrorsOnFilesystemObjects = true;
-}
+	int64_t objID = 0;
+	try
+	{
+		std::auto_ptr<BackupProtocolSuccess> stored(
+			connection.QueryStoreStagedFile(mObjectID,
+				ModificationTime, AttributesHash,
+				rStaged.mDiffFromID, rStaged.mStagedFileID,
+				rStoreFilename));
+		objID = stored->GetObjectID();
+	}
+	catch(BoxException &e)
+	{
+		if(e.GetType() == ConnectionException::ExceptionType &&
+			e.GetSubType() == ConnectionException::Protocol_UnexpectedReply &&
+			IsStoreFullError(rParams, connection, rNonVssFilePath))
+		{
+			return 0;
+		}
+
+		throw;
+	}
+
+	rNotifier.NotifyFileUploaded(this, rNonVssFilePath, FileSize,
+		rStaged.mBytesSent, objID);
+
+	return objID;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::IsStoreFullError(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 BackupProtocolCallable &, const std::string &)
+//		Purpose: Private. After the server rejected a file, check
+//			 whether it was because the store is full, notifying
+//			 the sysadmin if so, and the progress notifier of any
+//			 other error.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryRecord::IsStoreFullError(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	BackupProtocolCallable &rConnection,
+	const std::string &rNonVssFilePath)
+{
+	// Check and see what error the protocol has,
+	// this is more useful to users than the exception.
+	int type, subtype;
+	if(!rConnection.GetLastError(type, subtype))
+	{
+		return false;
+	}
+
+	if(type == BackupProtocolError::ErrorType
+	&& subtype == BackupProtocolError::Err_StorageLimitExceeded)
+	{
+		// The hard limit was exceeded on the server, notify!
+		rParams.mrSysadminNotifier.NotifySysadmin(
+			SysadminNotifier::StoreFull);
+		return true;
+	}
+
+	rParams.mrContext.GetProgressNotifier().NotifyFileUploadServerError(
+		this, rNonVssFilePath, type, subtype);
+	return false;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::UploadFileCatchingErrors(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const std::string &, const std::string &,
+//			 const std::string &,
+//			 const BackupStoreFilenameClear &, int64_t,
+//			 box_time_t, box_time_t, bool,
+//			 const BackupClientUploadPool::Result *, int64_t &)
+//		Purpose: Private. Upload a file, or add it if it's been
+//			 staged, recording the new object ID. Errors other
+//			 than those which should stop the sync are reported
+//			 and return false, so that the sync can carry on.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryRecord::UploadFileCatchingErrors(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const std::string &rFilename,
+	const std::string &rNonVssFilePath,
+	const std::string &rRemotePath,
+	const BackupStoreFilenameClear &rStoreFilename,
+	int64_t FileSize,
+	box_time_t ModificationTime,
+	box_time_t AttributesHash,
+	bool NoPreviousVersionOnServer,
+	const BackupClientUploadPool::Result *pStaged,
+	int64_t &rLatestObjectID)
+{
+	ProgressNotifier& rNotifier(rParams.mrContext.GetProgressNotifier());
+
+	// Surround this in a try/catch block, to
+	// catch errors, but still continue
+	try
+	{
+		if(pStaged != NULL && pStaged->mStagedFileID != 0)
+		{
+			rLatestObjectID = StoreStagedFile(rParams,
+				rNonVssFilePath, rStoreFilename, FileSize,
+				ModificationTime, AttributesHash, *pStaged);
+		}
+		else
+		{
+			rLatestObjectID = UploadFile(rParams, rFilename,
+				rNonVssFilePath, rRemotePath, rStoreFilename,
+				FileSize, ModificationTime, AttributesHash,
+				NoPreviousVersionOnServer);
+		}
+
+		if(rLatestObjectID == 0)
+		{
+			// storage limit exceeded
+			rParams.mrContext.SetStorageLimitExceeded();
+			return false;
+		}
+	}
+	catch(ConnectionException &e)
+	{
+		// Connection errors should just be
+		// passed on to the main handler,
+		// retries would probably just cause
+		// more problems.
+		rNotifier.NotifyFileUploadException(
+			this, rNonVssFilePath, e);
+		throw;
+	}
+	catch(BoxException &e)
+	{
+		if(e.GetType() == BackupStoreException::ExceptionType &&
+			e.GetSubType() == BackupStoreException::SignalReceived)
+		{
+			// abort requested, pass the
+			// exception on up.
+			throw;
+		}
+		
+		// Log it.
+		SetErrorWhenReadingFilesystemObject(rParams,
+			rNonVssFilePath);
+		rNotifier.NotifyFileUploadException(this,
+			rNonVssFilePath, e);
+		return false;
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::QueuePendingUpload(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const PendingUpload &)
+//		Purpose: Private. Add a file or the end of a directory to
+//			 the queue between scanning and uploading. If that
+//			 fills it up, the scan waits for the oldest entries
+//			 to be finished off.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::QueuePendingUpload(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const PendingUpload &rUpload)
+{
+	PendingUploads &rQueue(*rParams.mpPendingUploads);
+	rQueue.Push(rUpload);
+
+	if(!rQueue.mInOrder)
+	{
+		FinishStagedUploads(rParams);
+	}
+
+	while(rQueue.IsFull())
+	{
+		FinishFirstPendingUpload(rParams);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FinishFirstPendingUpload(
+//			 BackupClientDirectoryRecord::SyncParams &)
+//		Purpose: Private. Finish off the oldest entry in the queue
+//			 between scanning and uploading, waiting for its
+//			 file to be staged if necessary. Unless files are
+//			 added in the order found, whichever file is staged
+//			 first is finished off instead, and the oldest entry
+//			 is only removed if that was it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::FinishFirstPendingUpload(
+	BackupClientDirectoryRecord::SyncParams &rParams)
+{
+	BackupClientContext& rContext(rParams.mrContext);
+	PendingUploads &rQueue(*rParams.mpPendingUploads);
+	PendingUpload &rFirst(rQueue.mQueue.front());
+
+	if(rFirst.mJobID == 0)
+	{
+		// Everything in the directory was queued before its end
+		BackupClientDirectoryRecord *pRecord = rFirst.mpRecord;
+		bool uploadsSucceeded =
+			(rQueue.mFailedDirectories.erase(pRecord) == 0);
+		pRecord->FinishSyncDirectory(rParams, rFirst,
+			uploadsSucceeded);
+		rQueue.Pop();
+		return;
+	}
+
+	if(!rFirst.mDone)
+	{
+		BackupClientUploadPool::Result staged;
+		PendingUpload *pStaged = NULL;
+
+		while(true)
+		{
+			if(!rQueue.mInOrder)
+			{
+				pStaged = rQueue.Find(
+					rParams.mpUploadPool->GetAnyResult(
+						staged, 1000 /* ms */));
+			}
+			else if(rParams.mpUploadPool->GetResult(rFirst.mJobID,
+				staged, 1000 /* ms */))
+			{
+				pStaged = &rFirst;
+			}
+
+			if(pStaged != NULL)
+			{
+				break;
+			}
+
+			// Send keep-alive message if needed
+			rContext.DoKeepAlive();
+
+			if(rParams.StopRun())
+			{
+				THROW_EXCEPTION(BackupStoreException,
+					SignalReceived)
+			}
+
+			// Report the upload stage's progress through the
+			// files found so far
+			if(rParams.mpBackgroundTask &&
+				!rParams.mpBackgroundTask->RunBackgroundTask(
+					rFirst.mTryDiff ?
+					BackgroundTask::Uploading_Patch :
+					BackgroundTask::Uploading_Full,
+					rQueue.mFilesFinished, rQueue.mFilesQueued))
+			{
+				THROW_EXCEPTION(BackupStoreException,
+					CancelledByBackgroundTask);
+			}
+		}
+
+		FinishStagedUpload(rParams, *pStaged, staged);
+	}
+
+	if(rFirst.mDone)
+	{
+		rQueue.Pop();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FinishStagedUploads(
+//			 BackupClientDirectoryRecord::SyncParams &)
+//		Purpose: Private. Unless files are added in the order found,
+//			 finish off every file which has been staged
+//			 already, and then the oldest entries in the queue
+//			 for as long as nothing has to be waited for.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::FinishStagedUploads(
+	BackupClientDirectoryRecord::SyncParams &rParams)
+{
+	PendingUploads &rQueue(*rParams.mpPendingUploads);
+
+	BackupClientUploadPool::Result staged;
+	int jobID;
+	while((jobID = rParams.mpUploadPool->GetAnyResult(staged, 0)) != 0)
+	{
+		PendingUpload *pStaged = rQueue.Find(jobID);
+		if(pStaged != NULL)
+		{
+			FinishStagedUpload(rParams, *pStaged, staged);
+		}
+	}
+
+	while(!rQueue.mQueue.empty() && (rQueue.mQueue.front().mJobID == 0 ||
+		rQueue.mQueue.front().mDone))
+	{
+		FinishFirstPendingUpload(rParams);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FinishStagedUpload(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 PendingUpload &,
+//			 const BackupClientUploadPool::Result &)
+//		Purpose: Private. Finish off a queued file, once an upload
+//			 process has staged it or given up, remembering if
+//			 its directory wasn't completely uploaded.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::FinishStagedUpload(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	PendingUpload &rUpload,
+	const BackupClientUploadPool::Result &rStaged)
+{
+	PendingUploads &rQueue(*rParams.mpPendingUploads);
+	BackupClientDirectoryRecord *pRecord = rUpload.mpRecord;
+
+	if(!pRecord->FinishPendingUpload(rParams, rUpload, rStaged))
+	{
+		rQueue.mFailedDirectories.insert(pRecord);
+	}
+
+	rQueue.FileDone(rUpload);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FinishPendingUpload(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 PendingUpload &,
+//			 const BackupClientUploadPool::Result &)
+//		Purpose: Private. Add a file which an upload process has
+//			 staged to the store, or upload it here if it
+//			 couldn't be staged, and finish syncing it. Returns
+//			 false if it wasn't uploaded successfully.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientDirectoryRecord::FinishPendingUpload(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	PendingUpload &rUpload,
+	const BackupClientUploadPool::Result &rStaged)
+{
+	BackupClientContext& rContext(rParams.mrContext);
+
+	bool uploadSuccess = true;
+	bool fileSynced = false;
+
+	// It may have filled up since the file was queued
+	rContext.GetConnection();
+	if(!rContext.StorageLimitExceeded())
+	{
+		uploadSuccess = UploadFileCatchingErrors(rParams,
+			rUpload.mFilename, rUpload.mNonVssFilePath,
+			rUpload.mRemotePath,
+			BackupStoreFilenameClear(rUpload.mLeafName),
+			rUpload.mFileSize, rUpload.mModTime,
+			rUpload.mAttributesHash,
+			rUpload.mNoPreviousVersionOnServer, &rStaged,
+			rUpload.mLatestObjectID);
+
+		if(uploadSuccess)
+		{
+			fileSynced = true;
+
+			// delete from pending entries
+			if(rUpload.mPendingFirstSeenTime != 0 &&
+				mpPendingEntries != 0)
+			{
+				mpPendingEntries->erase(rUpload.mLeafName);
+				if(mpPendingEntries->empty())
+				{
+					delete mpPendingEntries;
+					mpPendingEntries = 0;
+				}
+			}
+		}
+	}
+	else
+	{
+		rContext.GetProgressNotifier().NotifyFileSkippedServerFull(
+			this, rUpload.mNonVssFilePath);
+	}
+
+	RecordSyncedFile(rParams, rUpload.mNonVssFilePath, rUpload.mFileSize,
+		rUpload.mInodeNum, rUpload.mLatestObjectID, fileSynced);
+
+	return uploadSuccess;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::EndSyncDirectory(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const PendingUpload &)
+//		Purpose: Private. Called at the end of SyncDirectory() to
+//			 record the directory's new state, or to queue that
+//			 until any files still being uploaded, in it or
+//			 before it, are done.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::EndSyncDirectory(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const PendingUpload &rEnd)
+{
+	if(rParams.mpPendingUploads == NULL ||
+		rParams.mpPendingUploads->mQueue.empty())
+	{
+		FinishSyncDirectory(rParams, rEnd, true);
+		return;
+	}
+
+	if(rEnd.mScanned)
+	{
+		// Until its files are done, the directory must be looked
+		// at again if the sync is interrupted
+		::memset(mStateChecksum, 0, sizeof(mStateChecksum));
+	}
+
+	QueuePendingUpload(rParams, rEnd);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::FinishSyncDirectory(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const PendingUpload &, bool)
+//		Purpose: Private. Record the new state of a directory once
+//			 all its files are done, and save it to the new
+//			 store object info file, as it won't change again in
+//			 this run.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::FinishSyncDirectory(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const PendingUpload &rEnd, bool UploadsSucceeded)
+{
+	if(rEnd.mScanned)
+	{
+		bool syncedAll = rEnd.mSyncedAll && UploadsSucceeded;
+
+		// Store the new checksum -- don't fetch things unnecessarily
+		// in the future But... only if 1) the storage limit isn't
+		// exceeded -- make sure things are done again if the directory
+		// is modified later and 2) All the objects within the
+		// directory were stored successfully.
+		if(!rParams.mrContext.StorageLimitExceeded() && syncedAll)
+		{
+			::memcpy(mStateChecksum, rEnd.mStateChecksum,
+				sizeof(mStateChecksum));
+		}
+
+		// Make sure the next sync comes back to anything this one
+		// couldn't finish, and to files which are due to be uploaded
+		// whether they change or not.
+		if(rParams.mpChangeJournal && (!syncedAll ||
+			mpPendingEntries != NULL || rEnd.mMarkChanged))
+		{
+			rParams.mpChangeJournal->MarkChanged(rEnd.mLocalPath);
+		}
+	}
+
+	if(rParams.mpStoreObjectInfoWriter)
+	{
+		Save(*rParams.mpStoreObjectInfoWriter);
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::RecordSyncedFile(
+//			 BackupClientDirectoryRecord::SyncParams &,
+//			 const std::string &, int64_t, InodeRefType,
+//			 int64_t, bool)
+//		Purpose: Private. Add a file to the new ID map if it needs
+//			 to be tracked, and report it if it's synchronised.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::RecordSyncedFile(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const std::string &rNonVssFilePath, int64_t FileSize,
+	InodeRefType InodeNum, int64_t LatestObjectID, bool FileSynced)
+{
+	BackupClientContext& rContext(rParams.mrContext);
+	ProgressNotifier& rNotifier(rContext.GetProgressNotifier());
+
+	// Does this file need an entry in the ID map?
+	if(FileSize >= rParams.mFileTrackingSizeThreshold)
+	{
+		// Get the map
+		BackupClientInodeToIDMap &idMap(rContext.GetNewIDMap());
+	
+		// Need to get an ID from somewhere...
+		if(LatestObjectID == 0)
+		{
+			// Don't know it -- haven't sent anything to the store, and didn't get a listing.
+			// Look it up in the current map, and if it's there, use that.
+			const BackupClientInodeToIDMap &currentIDMap(rContext.GetCurrentIDMap());
+			int64_t objid = 0, dirid = 0;
+			if(currentIDMap.Lookup(InodeNum, objid, dirid))
+			{
+				// Found
+				if(dirid != mObjectID)
+				{
+					BOX_WARNING("Found conflicting parent ID for "
+						"file ID " << InodeNum << " (" <<
+						rNonVssFilePath << "): expected " <<
+						mObjectID << " but found " << dirid <<
+						" (same directory used in two different "
+						"locations?)");
+				}
+
+				ASSERT(dirid == mObjectID);
+
+				// NOTE: If the above assert fails, an inode number has been reused by the OS,
+				// or there is a problem somewhere. If this happened on a short test run, look
+				// into it. However, in a long running process this may happen occasionally and
+				// not indicate anything wrong.
+				// Run the release version for real life use, where this check is not made.
+
+				LatestObjectID = objid;
+			}
+		}
+
+		if(LatestObjectID != 0)
+		{
+			BOX_TRACE("Storing uploaded file ID " << InodeNum << " (" <<
+				rNonVssFilePath << ") in ID map as object " <<
+				BOX_FORMAT_OBJECTID(LatestObjectID) << " with parent " <<
+				BOX_FORMAT_OBJECTID(mObjectID));
+			idMap.AddToMap(InodeNum, LatestObjectID,
+				mObjectID /* containing directory */,
+				rNonVssFilePath);
+		}
+
+	}
+
+	if(FileSynced)
+	{
+		rNotifier.NotifyFileSynchronised(this, rNonVssFilePath,
+			FileSize);
+	}
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::SetErrorWhenReadingFilesystemObject(
+//			 SyncParams &, const char *)
+//		Purpose: Sets the error state when there were problems
+//			 reading an object from the filesystem.
+//		Created: 29/3/04
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::SetErrorWhenReadingFilesystemObject(
+	BackupClientDirectoryRecord::SyncParams &rParams,
+	const std::string& rFilename)
+{
+	// Zero hash, so it gets synced properly next time round.
+	::memset(mStateChecksum, 0, sizeof(mStateChecksum));
+
+	// More detailed logging was already done by the caller, but if we
+	// have a read error reported, we need to be able to search the logs
+	// to find out which file it was, so we need to log a consistent and
+	// clear error message.
+	BOX_WARNING("Failed to backup file, see above for details: " <<
+		rFilename);
+
+	// Mark that an error occured in the parameters object
+	rParams.mReadErrorsOnFilesystemObjects = true;
+
+	// And don't let the change journal skip it next time either
+	if(rParams.mpChangeJournal)
+	{
+		rParams.mpChangeJournal->MarkChanged(rFilename);
+	}
+}
 
 
 
@@ -2010,8 +2922,15 @@ BackupClientDirectoryRecord::SyncParams::SyncParams(
   mrContext(rContext),
   mReadErrorsOnFilesystemObjects(false),
   mMaxUploadRate(0),
+  mpChangeJournal(NULL),
+  mDirectoryScanMethod(BackupClientDirectoryReader::ReadDir),
+  mpStoreObjectInfoWriter(NULL),
+  mpUploadPool(NULL),
+  mMaxUploadQueueMemory(1024*1024),
   mUploadAfterThisTimeInTheFuture(99999999999999999LL),
-  mHaveLoggedWarningAboutFutureFileTimes(false)
+  mHaveLoggedWarningAboutFutureFileTimes(false),
+  mpPendingUploads(NULL),
+  mSyncDepth(0)
 {
 }
 
@@ -2114,18 +3033,14 @@ void BackupClientDirectoryRecord::Deserialize(Archive & rArchive)
 			std::string strItem;
 			rArchive.Read(strItem);
 
-			BackupClientDirectoryRecord* pSubDirRecord = 
-				new BackupClientDirectoryRecord(0, ""); 
+			std::auto_ptr<BackupClientDirectoryRecord> apSubDirRecord(
+				new BackupClientDirectoryRecord(0, strItem));
 			// will be deserialized anyway, give it id 0 for now
 
-			if (!pSubDirRecord)
-			{
-				throw std::bad_alloc();
-			}
-
 			/***** RECURSE *****/
-			pSubDirRecord->Deserialize(rArchive);
-			mSubDirectories[strItem] = pSubDirRecord;
+			apSubDirRecord->Deserialize(rArchive);
+			AddSubDirectory(apSubDirRecord.get());
+			apSubDirRecord.release();
 		}
 	}
 }
@@ -2133,74 +3048,283 @@ void BackupClientDirectoryRecord::Deserialize(Archive & rArchive)
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    BackupClientDirectoryRecord::Serialize(Archive & rArchive)
-//		Purpose: Serializes this object instance into a stream of bytes, using an Archive abstraction.
-//
-//		Created: 2005/04/11
+//		Name:    BackupClientDirectoryRecord::ReadStoredRecord(
+//			 const BackupClientStoreObjectInfo &, int64_t,
+//			 storeobjectinfo_DirRecord &, std::string *,
+//			 std::map<std::string, box_time_t> **,
+//			 std::vector<std::pair<std::string, int64_t> > *)
+//		Purpose: Reads a directory record from a store object info
+//			 file, returning the parts asked for. The sub
+//			 directories are returned with the distance back to
+//			 each one's record from this one.
+//		Created: 2026/10/16
 //
 // --------------------------------------------------------------------------
-void BackupClientDirectoryRecord::Serialize(Archive & rArchive) const
+void BackupClientDirectoryRecord::ReadStoredRecord(
+	const BackupClientStoreObjectInfo &rInfo, int64_t Offset,
+	storeobjectinfo_DirRecord &rHeaderOut, std::string *pSubDirNameOut,
+	std::map<std::string, box_time_t> **ppPendingEntriesOut,
+	std::vector<std::pair<std::string, int64_t> > *pSubDirsOut)
 {
-	//
-	//
-	//
-	rArchive.Write(mObjectID);
-	rArchive.Write(mSubDirName);
-	rArchive.Write(mInitialSyncDone);
-	rArchive.Write(mSyncDone);
+	::memcpy(&rHeaderOut, rInfo.GetBlock(Offset, sizeof(rHeaderOut)),
+		sizeof(rHeaderOut));
+
+	if(rHeaderOut.mMagicValue != STOREOBJECTINFO_RECORD_MAGIC ||
+		rHeaderOut.mSubtreeSize < 0 ||
+		rHeaderOut.mSubtreeSize > Offset)
+	{
+		THROW_FILE_ERROR("Invalid directory record at offset " <<
+			Offset << " in store object info file",
+			rInfo.GetFilename(), ClientException,
+			CorruptStoreObjectInfoFile);
+	}
+
+	MemBlockStream tail(rInfo.GetBlock(Offset + sizeof(rHeaderOut),
+		rHeaderOut.mTailSize), rHeaderOut.mTailSize);
+	Archive anArchive(tail, 0);
+
+	std::string subDirName;
+	anArchive.Read(subDirName);
+	if(pSubDirNameOut)
+	{
+		*pSubDirNameOut = subDirName;
+	}
 
-	//
-	//
-	//
 	int64_t iCount = 0;
+	anArchive.Read(iCount);
 
-	// when reading back the archive, we will 
-	// need to know how many items there are.
-	iCount = sizeof(mStateChecksum) / sizeof(mStateChecksum[0]);
-	rArchive.Write(iCount); 
+	if(iCount > 0 && ppPendingEntriesOut)
+	{
+		*ppPendingEntriesOut = new std::map<std::string, box_time_t>;
+	}
 
-	for (int v = 0; v < iCount; v++)
+	for(int64_t v = 0; v < iCount; v++)
 	{
-		rArchive.Write(mStateChecksum[v]);
+		std::string strItem;
+		box_time_t btItem;
+
+		anArchive.Read(strItem);
+		anArchive.Read(btItem);
+
+		if(ppPendingEntriesOut)
+		{
+			(**ppPendingEntriesOut)[strItem] = btItem;
+		}
 	}
 
-	//
-	//
-	//
-	if (!mpPendingEntries)
+	if(!pSubDirsOut)
+	{
+		return;
+	}
+
+	iCount = 0;
+	anArchive.Read(iCount);
+
+	for(int64_t v = 0; v < iCount; v++)
+	{
+		std::string strItem;
+		int64_t distance;
+
+		anArchive.Read(strItem);
+		anArchive.Read(distance);
+
+		// Sub directories are always written before the directory
+		// they're in, so this can't go round in circles
+		if(distance <= 0 || distance > rHeaderOut.mSubtreeSize)
+		{
+			THROW_FILE_ERROR("Invalid sub directory of record at "
+				"offset " << Offset << " in store object info "
+				"file", rInfo.GetFilename(), ClientException,
+				CorruptStoreObjectInfoFile);
+		}
+
+		pSubDirsOut->push_back(std::pair<std::string, int64_t>(
+			strItem, distance));
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::GetStoredObjectIDs(
+//			 const BackupClientStoreObjectInfo &, int64_t,
+//			 std::set<int64_t> &)
+//		Purpose: Adds the IDs of the directory whose record is at
+//			 the offset given in a store object info file, and of
+//			 all those below it, to the set given
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::GetStoredObjectIDs(
+	const BackupClientStoreObjectInfo &rInfo, int64_t Offset,
+	std::set<int64_t> &rDirectoryIDs)
+{
+	storeobjectinfo_DirRecord header;
+	std::vector<std::pair<std::string, int64_t> > subDirs;
+	ReadStoredRecord(rInfo, Offset, header, NULL, NULL, &subDirs);
+
+	rDirectoryIDs.insert(header.mObjectID);
+
+	for(std::vector<std::pair<std::string, int64_t> >::const_iterator
+		i = subDirs.begin(); i != subDirs.end(); ++i)
 	{
-		iCount = 0;
-		rArchive.Write(iCount);
+		GetStoredObjectIDs(rInfo, Offset - i->second, rDirectoryIDs);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::Load(
+//			 const BackupClientStoreObjectInfo &, int64_t)
+//		Purpose: Loads this record from the one at the offset given
+//			 in a store object info file. Its sub directories are
+//			 only loaded when they're needed, so the file must
+//			 stay open until this record is deleted.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientDirectoryRecord::Load(const BackupClientStoreObjectInfo &rInfo,
+	int64_t Offset)
+{
+	DeleteSubDirectories();
+
+	if(mpPendingEntries != 0)
+	{
+		delete mpPendingEntries;
+		mpPendingEntries = 0;
+	}
+
+	storeobjectinfo_DirRecord header;
+	ReadStoredRecord(rInfo, Offset, header, &mSubDirName,
+		&mpPendingEntries, NULL);
+
+	mObjectID = header.mObjectID;
+	mInitialSyncDone = (header.mFlags &
+		STOREOBJECTINFO_RECORD_INITIAL_SYNC_DONE) != 0;
+	mSyncDone = (header.mFlags & STOREOBJECTINFO_RECORD_SYNC_DONE) != 0;
+	::memcpy(mStateChecksum, header.mStateChecksum,
+		sizeof(mStateChecksum));
+
+	mpStoredInfo = &rInfo;
+	mStoredOffset = Offset;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientDirectoryRecord::Save(
+//			 BackupClientStoreObjectInfoWriter &)
+//		Purpose: Writes this record to a new store object info file,
+//			 after those of its sub directories, unless it's
+//			 already been written there. Returns the offset of
+//			 the record in the file.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int64_t BackupClientDirectoryRecord::Save(
+	BackupClientStoreObjectInfoWriter &rWriter)
+{
+	if(mSavedGeneration == rWriter.GetGeneration())
+	{
+		return mSavedOffset;
+	}
+
+	if(rWriter.IsFailed())
+	{
+		return 0;
+	}
+
+	// Sub directories, with the distance back to their records
+	std::vector<std::pair<std::string, int64_t> > subDirs;
+	int64_t subtreeStart = rWriter.GetPosition();
+
+	if(mpStoredInfo != NULL)
+	{
+		// Nothing below here has been touched, so copy it all from
+		// the old file. The sub directories are the same distance
+		// back from this record as they were in there.
+		storeobjectinfo_DirRecord header;
+		ReadStoredRecord(*mpStoredInfo, mStoredOffset, header, NULL,
+			NULL, &subDirs);
+		rWriter.Write(mpStoredInfo->GetBlock(
+			mStoredOffset - header.mSubtreeSize,
+			header.mSubtreeSize), header.mSubtreeSize);
 	}
 	else
 	{
-		iCount = mpPendingEntries->size();
-		rArchive.Write(iCount);
+		// Those synced during this run have been written already,
+		// just before this one, but any others must be written now
+		std::vector<int64_t> offsets;
+		for(SubDirectories_t::iterator i = mSubDirectories.begin();
+			i != mSubDirectories.end(); ++i)
+		{
+			offsets.push_back((*i)->Save(rWriter));
+			if((*i)->mSavedSubtreeStart < subtreeStart)
+			{
+				subtreeStart = (*i)->mSavedSubtreeStart;
+			}
+		}
 
-		for (std::map<std::string, box_time_t>::const_iterator
-			i =  mpPendingEntries->begin(); 
-			i != mpPendingEntries->end(); i++)
+		int64_t recordOffset = rWriter.GetPosition();
+		std::vector<int64_t>::const_iterator o = offsets.begin();
+		for(SubDirectories_t::iterator i = mSubDirectories.begin();
+			i != mSubDirectories.end(); ++i, ++o)
 		{
-			rArchive.Write(i->first);
-			rArchive.Write(i->second);
+			subDirs.push_back(std::pair<std::string, int64_t>(
+				(*i)->mSubDirName, recordOffset - *o));
 		}
 	}
-	//
-	//
-	//
-	iCount = mSubDirectories.size();
-	rArchive.Write(iCount);
 
-	for (std::map<std::string, BackupClientDirectoryRecord*>::const_iterator
-		i =  mSubDirectories.begin(); 
-		i != mSubDirectories.end(); i++)
+	CollectInBufferStream tail;
+	Archive anArchive(tail, 0);
+	anArchive.Write(mSubDirName);
+
+	if(!mpPendingEntries)
+	{
+		anArchive.Write((int64_t)0);
+	}
+	else
 	{
-		const BackupClientDirectoryRecord* pSubItem = i->second;
-		ASSERT(pSubItem);
+		anArchive.Write((int64_t)mpPendingEntries->size());
+		for(std::map<std::string, box_time_t>::const_iterator
+			i =  mpPendingEntries->begin();
+			i != mpPendingEntries->end(); i++)
+		{
+			anArchive.Write(i->first);
+			anArchive.Write(i->second);
+		}
+	}
 
-		rArchive.Write(i->first);
-		pSubItem->Serialize(rArchive);
+	anArchive.Write((int64_t)subDirs.size());
+	for(std::vector<std::pair<std::string, int64_t> >::const_iterator
+		i = subDirs.begin(); i != subDirs.end(); ++i)
+	{
+		anArchive.Write(i->first);
+		anArchive.Write(i->second);
 	}
+	tail.SetForReading();
+
+	storeobjectinfo_DirRecord header;
+	::memset(&header, 0, sizeof(header));
+	header.mMagicValue = STOREOBJECTINFO_RECORD_MAGIC;
+	header.mFlags =
+		(mInitialSyncDone ? STOREOBJECTINFO_RECORD_INITIAL_SYNC_DONE : 0) |
+		(mSyncDone ? STOREOBJECTINFO_RECORD_SYNC_DONE : 0);
+	header.mObjectID = mObjectID;
+	header.mTailSize = tail.GetSize();
+	::memcpy(header.mStateChecksum, mStateChecksum,
+		sizeof(header.mStateChecksum));
+
+	int64_t recordOffset = rWriter.GetPosition();
+	header.mSubtreeSize = recordOffset - subtreeStart;
+	rWriter.Write(&header, sizeof(header));
+	rWriter.Write(tail.GetBuffer(), tail.GetSize());
+
+	mSavedGeneration = rWriter.GetGeneration();
+	mSavedOffset = recordOffset;
+	mSavedSubtreeStart = subtreeStart;
+	return recordOffset;
 }
 
 // --------------------------------------------------------------------------
@@ -2212,7 +3336,8 @@ void BackupClientDirectoryRecord::Serialize(Archive & rArchive) const
 //
 // --------------------------------------------------------------------------
 Location::Location()
-: mIDMapIndex(0)
+: mIDMapIndex(0),
+  mUploadPriority(0)
 #ifdef WIN32
 #ifdef ENABLE_VSS
 , mIsSnapshotCreated(false)
@@ -2236,14 +3361,19 @@ Location::~Location()
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    Location::Serialize(Archive & rArchive)
+//		Name:    Location::Serialize(Archive & rArchive,
+//			 BackupClientStoreObjectInfoWriter &rWriter)
 //		Purpose: Serializes this object instance into a stream of bytes,
-//               using an Archive abstraction.
+//               using an Archive abstraction. The directory records
+//               are written to the store object info file being
+//               written, if they haven't been already, and the
+//               Archive refers to them.
 //
 //		Created: 2005/04/11
 //
 // --------------------------------------------------------------------------
-void Location::Serialize(Archive & rArchive) const
+void Location::Serialize(Archive & rArchive,
+	BackupClientStoreObjectInfoWriter &rWriter)
 {
 	//
 	//
@@ -2265,7 +3395,8 @@ void Location::Serialize(Archive & rArchive) const
 		int64_t aMagicMarker = ARCHIVE_MAGIC_VALUE_RECURSE; // be explicit about whether recursion follows
 		rArchive.Write(aMagicMarker);
 
-		mapDirectoryRecord->Serialize(rArchive);
+		int64_t offset = mapDirectoryRecord->Save(rWriter);
+		rArchive.Write(offset);
 	}
 
 	//
@@ -2304,13 +3435,18 @@ void Location::Serialize(Archive & rArchive) const
 // --------------------------------------------------------------------------
 //
 // Function
-//		Name:    Location::Deserialize(Archive & rArchive)
+//		Name:    Location::Deserialize(Archive & rArchive,
+//			 const BackupClientStoreObjectInfo *pInfo)
 //		Purpose: Deserializes this object instance from a stream of bytes, using an Archive abstraction.
+//			 If a store object info file is given, the Archive
+//			 refers to the directory records in it, otherwise
+//			 they're in the Archive itself (version 2).
 //
 //		Created: 2005/04/11
 //
 // --------------------------------------------------------------------------
-void Location::Deserialize(Archive &rArchive)
+void Location::Deserialize(Archive &rArchive,
+	const BackupClientStoreObjectInfo *pInfo)
 {
 	//
 	//
@@ -2345,7 +3481,17 @@ void Location::Deserialize(Archive &rArchive)
 		}
 
 		mapDirectoryRecord.reset(pSubRecord);
-		mapDirectoryRecord->Deserialize(rArchive);
+
+		if(pInfo)
+		{
+			int64_t offset;
+			rArchive.Read(offset);
+			mapDirectoryRecord->Load(*pInfo, offset);
+		}
+		else
+		{
+			mapDirectoryRecord->Deserialize(rArchive);
+		}
 	}
 	else
 	{
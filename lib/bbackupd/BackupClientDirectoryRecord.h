@@ -13,9 +13,15 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include "BackgroundTask.h"
+#include "BackupClientDirectoryReader.h"
 #include "BackupClientFileAttributes.h"
+#include "BackupClientStoreObjectInfo.h"
+#include "BackupClientUploadPool.h"
 #include "BackupDaemonInterface.h"
 #include "BackupStoreDirectory.h"
 #include "BoxTime.h"
@@ -31,8 +37,10 @@
 #endif
 
 class Archive;
+class BackupClientChangeJournal;
 class BackupClientContext;
 class BackupDaemon;
+class BackupProtocolCallable;
 class ExcludeList;
 class Location;
 
@@ -51,9 +59,15 @@ public:
 	virtual ~BackupClientDirectoryRecord();
 
 	void Deserialize(Archive & rArchive);
-	void Serialize(Archive & rArchive) const;
+	void Load(const BackupClientStoreObjectInfo &rInfo, int64_t Offset);
+	int64_t Save(BackupClientStoreObjectInfoWriter &rWriter);
 private:
 	BackupClientDirectoryRecord(const BackupClientDirectoryRecord &);
+
+	// Files waiting for an upload process to stage them, and the
+	// directories waiting for their files to be added
+	class PendingUpload;
+	class PendingUploads;
 public:
 
 	enum
@@ -100,11 +114,32 @@ public:
 		BackupClientContext &mrContext;
 		bool mReadErrorsOnFilesystemObjects;
 		int64_t mMaxUploadRate;
+		BackupClientChangeJournal *mpChangeJournal;
+		BackupClientDirectoryReader::Method mDirectoryScanMethod;
+		BackupClientStoreObjectInfoWriter *mpStoreObjectInfoWriter;
+		// Processes to upload files over their own connections,
+		// if there are any
+		BackupClientUploadPool *mpUploadPool;
+		// The most memory to use remembering the files and
+		// directories which are waiting for them
+		int64_t mMaxUploadQueueMemory;
 		
 		// Member variables modified by syncing process
 		box_time_t mUploadAfterThisTimeInTheFuture;
 		bool mHaveLoggedWarningAboutFutureFileTimes;
-	
+		// Directories skipped because they haven't changed, whose
+		// entries in the ID map must be kept
+		std::set<int64_t> mUnchangedDirectoryIDs;
+		// Details of the files found by the last directory scan, by
+		// name, if the scan method collects everything UpdateItems()
+		// needs, so that it doesn't stat them again
+		std::map<std::string, EMU_STRUCT_STAT> mScannedFileStats;
+		// The queue between scanning and uploading, while the
+		// outermost SyncDirectory() is running with upload
+		// processes
+		PendingUploads *mpPendingUploads;
+		int mSyncDepth;
+		
 		bool StopRun() { return mrRunStatusProvider.StopRun(); }
 		void NotifySysadmin(SysadminNotifier::EventCode Event)
 		{ 
@@ -146,7 +181,7 @@ public:
 		const Location& rBackupLocation,
 		const std::string &rDirLocalPath,
 		MD5Digest& currentStateChecksum,
-		struct dirent *en,
+		BackupClientDirectoryReader &rReader,
 		EMU_STRUCT_STAT dir_st,
 		std::vector<std::string>& rDirs,
 		std::vector<std::string>& rFiles,
@@ -156,9 +191,26 @@ public:
 		const Location& rBackupLocation);
 
 	int64_t GetObjectID() const { return mObjectID; }
+	const std::string &GetSubDirName() const { return mSubDirName; }
 
 private:
+	// The sub directories are kept sorted by name, in a single array
+	// rather than a map, so that each one costs a pointer rather than
+	// a map node holding another copy of its name.
+	typedef std::vector<BackupClientDirectoryRecord *> SubDirectories_t;
+
+	SubDirectories_t::iterator FindSubDirectory(const std::string &rName);
+	void AddSubDirectory(BackupClientDirectoryRecord *pSubDirRecord);
 	void DeleteSubDirectories();
+	void LoadSubDirectories();
+	static void ReadStoredRecord(const BackupClientStoreObjectInfo &rInfo,
+		int64_t Offset, storeobjectinfo_DirRecord &rHeaderOut,
+		std::string *pSubDirNameOut,
+		std::map<std::string, box_time_t> **ppPendingEntriesOut,
+		std::vector<std::pair<std::string, int64_t> > *pSubDirsOut);
+	static void GetStoredObjectIDs(const BackupClientStoreObjectInfo &rInfo,
+		int64_t Offset, std::set<int64_t> &rDirectoryIDs);
+	void SetUnchanged(std::set<int64_t> &rDirectoryIDs);
 	std::auto_ptr<BackupStoreDirectory> FetchDirectoryListing(SyncParams &rParams);
 	void UpdateAttributes(SyncParams &rParams,
 		BackupStoreDirectory *pDirOnStore,
@@ -184,6 +236,15 @@ private:
 		BackupStoreFilenameClear& storeFilename,
 		bool* pHaveJustCreatedDirOnServer,
 		BackupClientDirectoryRecord::SyncParams &rParams);
+	bool UploadFileCatchingErrors(SyncParams &rParams,
+		const std::string &rFilename,
+		const std::string &rNonVssFilePath,
+		const std::string &rRemotePath,
+		const BackupStoreFilenameClear &rStoreFilename,
+		int64_t FileSize, box_time_t ModificationTime,
+		box_time_t AttributesHash, bool NoPreviousVersionOnServer,
+		const BackupClientUploadPool::Result *pStaged,
+		int64_t &rLatestObjectID);
 	int64_t UploadFile(SyncParams &rParams,
 		const std::string &rFilename,
 		const std::string &rNonVssFilePath,
@@ -191,6 +252,32 @@ private:
 		const BackupStoreFilenameClear &rStoreFilename,
 		int64_t FileSize, box_time_t ModificationTime,
 		box_time_t AttributesHash, bool NoPreviousVersionOnServer);
+	int64_t StoreStagedFile(SyncParams &rParams,
+		const std::string &rNonVssFilePath,
+		const BackupStoreFilenameClear &rStoreFilename,
+		int64_t FileSize, box_time_t ModificationTime,
+		box_time_t AttributesHash,
+		const BackupClientUploadPool::Result &rStaged);
+	static void QueuePendingUpload(SyncParams &rParams,
+		const PendingUpload &rUpload);
+	static void FinishFirstPendingUpload(SyncParams &rParams);
+	static void FinishStagedUploads(SyncParams &rParams);
+	static void FinishStagedUpload(SyncParams &rParams,
+		PendingUpload &rUpload,
+		const BackupClientUploadPool::Result &rStaged);
+	bool FinishPendingUpload(SyncParams &rParams,
+		PendingUpload &rUpload,
+		const BackupClientUploadPool::Result &rStaged);
+	void EndSyncDirectory(SyncParams &rParams, const PendingUpload &rEnd);
+	void FinishSyncDirectory(SyncParams &rParams,
+		const PendingUpload &rEnd, bool UploadsSucceeded);
+	bool IsStoreFullError(SyncParams &rParams,
+		BackupProtocolCallable &rConnection,
+		const std::string &rNonVssFilePath);
+	void RecordSyncedFile(SyncParams &rParams,
+		const std::string &rNonVssFilePath, int64_t FileSize,
+		InodeRefType InodeNum, int64_t LatestObjectID,
+		bool FileSynced);
 	void SetErrorWhenReadingFilesystemObject(SyncParams &rParams,
 		const std::string& rFilename);
 	void RemoveDirectoryInPlaceOfFile(SyncParams &rParams,
@@ -205,17 +292,32 @@ private:
 
 	int64_t 	mObjectID;
 	std::string 	mSubDirName;
-	bool 		mInitialSyncDone;
-	bool 		mSyncDone;
-
-	// Checksum of directory contents and attributes, used to detect changes
-	uint8_t mStateChecksum[MD5Digest::DigestLength];
 
 	std::map<std::string, box_time_t> *mpPendingEntries;
-	std::map<std::string, BackupClientDirectoryRecord *> mSubDirectories;
+	SubDirectories_t mSubDirectories;
 	// mpPendingEntries is a pointer rather than simple a member
 	// variable, because most of the time it'll be empty. This would
 	// waste a lot of memory because of STL allocation policies.
+
+	// The store object info file this record was loaded from, if its
+	// sub directories haven't been needed yet, and where it is in it
+	const BackupClientStoreObjectInfo *mpStoredInfo;
+	int64_t mStoredOffset;
+
+	// Where this record was written in the new store object info
+	// file with the generation given, and where its sub directories
+	// start, so that it's only written once
+	int64_t mSavedOffset;
+	int64_t mSavedSubtreeStart;
+	int mSavedGeneration;
+
+	// Kept together after the other members, as there's one of these
+	// for every directory being backed up
+	bool 		mInitialSyncDone;
+	bool 		mSyncDone;
+
+	// Checksum of directory contents and attributes, used to detect changes
+	uint8_t mStateChecksum[MD5Digest::DigestLength];
 };
 
 class Location
@@ -224,8 +326,10 @@ public:
 	Location();
 	~Location();
 
-	void Deserialize(Archive & rArchive);
-	void Serialize(Archive & rArchive) const;
+	void Deserialize(Archive & rArchive,
+		const BackupClientStoreObjectInfo *pInfo = NULL);
+	void Serialize(Archive & rArchive,
+		BackupClientStoreObjectInfoWriter &rWriter);
 private:
 	Location(const Location &);	// copy not allowed
 	Location &operator=(const Location &);
@@ -236,6 +340,9 @@ public:
 	std::auto_ptr<ExcludeList> mapExcludeFiles;
 	std::auto_ptr<ExcludeList> mapExcludeDirs;
 	int mIDMapIndex;
+	// Locations with higher priorities are synced first. Set from
+	// the configuration rather than saved.
+	int mUploadPriority;
 #ifdef WIN32
 #ifdef ENABLE_VSS
 	bool mIsSnapshotCreated;
@@ -9,53 +9,139 @@
 
 #include "Box.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+	#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+	#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+
 #include <depot.h>
 
-#define BACKIPCLIENTINODETOIDMAP_IMPLEMENTATION
 #include "BackupClientInodeToIDMap.h"
-#undef BACKIPCLIENTINODETOIDMAP_IMPLEMENTATION
 
 #include "Archive.h"
 #include "BackupStoreException.h"
-#include "CollectInBufferStream.h"
 #include "MemBlockStream.h"
+#include "Utils.h"
 #include "autogen_CommonException.h"
 
 #include "MemLeakFindOn.h"
 
+#define INODEMAP_MAGIC_VALUE		0x494d7033 // IMp3
+#define INODEMAP_PATHS_SUFFIX		".paths"
+#define INODEMAP_CONVERT_SUFFIX		".conv"
+
+// How many records to collect before writing them out
+#define INODEMAP_PENDING_RECORDS	4096
+
+// The old qdbm format, which is converted when found
 #define BOX_DBM_INODE_DB_VERSION_KEY "BackupClientInodeToIDMap.Version"
 #define BOX_DBM_INODE_DB_VERSION_CURRENT 2
 
 #define BOX_DBM_MESSAGE(stuff) stuff << " (qdbm): " << dperrmsg(dpecode)
 
-#define BOX_LOG_DBM_ERROR(stuff) \
-	BOX_ERROR(BOX_DBM_MESSAGE(stuff))
-
-#define THROW_DBM_ERROR(message, filename, exception, subtype) \
-	BOX_LOG_DBM_ERROR(message << ": " << filename); \
-	THROW_EXCEPTION_MESSAGE(exception, subtype, \
-		BOX_DBM_MESSAGE(message << ": " << filename));
-
-#define ASSERT_DBM_OK(operation, message, filename, exception, subtype) \
-	if(!(operation)) \
-	{ \
-		THROW_DBM_ERROR(message, filename, exception, subtype); \
-	}
-
-#define ASSERT_DBM_OPEN() \
-	if(mpDepot == 0) \
+#define ASSERT_MAP_OPEN() \
+	if(!mapFile.get()) \
 	{ \
 		THROW_EXCEPTION_MESSAGE(BackupStoreException, InodeMapNotOpen, \
 			"Inode database not open"); \
 	}
 
-#define ASSERT_DBM_CLOSED() \
-	if(mpDepot != 0) \
+#define ASSERT_MAP_CLOSED() \
+	if(mapFile.get()) \
 	{ \
 		THROW_EXCEPTION_MESSAGE(CommonException, Internal, \
 			"Inode database already open: " << mFilename); \
-	} 
+	}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static CompareRecords(const inodemap_Record &,
+//			 const inodemap_Record &)
+//		Purpose: Order records by inode, and then by the order in
+//			 which they were added, which is the order of their
+//			 paths in the blob.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static bool CompareRecords(const inodemap_Record &rA,
+	const inodemap_Record &rB)
+{
+	if(rA.mInodeRef != rB.mInodeRef)
+	{
+		return rA.mInodeRef < rB.mInodeRef;
+	}
+	return rA.mPathOffset < rB.mPathOffset;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static SortRecords(inodemap_Record *, int64_t)
+//		Purpose: Sort the records of a new map, keeping only the one
+//			 added last for each inode. Returns the number left.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static int64_t SortRecords(inodemap_Record *pRecords, int64_t NumRecords)
+{
+	std::sort(pRecords, pRecords + NumRecords, CompareRecords);
+
+	int64_t kept = 0;
+	for(int64_t i = 0; i < NumRecords; i++)
+	{
+		if(i + 1 < NumRecords &&
+			pRecords[i + 1].mInodeRef == pRecords[i].mInodeRef)
+		{
+			// replaced by a later one
+			continue;
+		}
+		pRecords[kept++] = pRecords[i];
+	}
+
+	return kept;
+}
+
+#ifndef BOX_INODE_MAP_USE_MMAP
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    static ReadAt(FileStream &, int64_t, void *, int64_t)
+//		Purpose: Read a block of a map file, which may be larger than
+//			 a single read can manage.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void ReadAt(FileStream &rFile, int64_t Offset, void *pBuffer,
+	int64_t Size)
+{
+	rFile.Seek(Offset, IOStream::SeekType_Absolute);
+	uint8_t *pPos = (uint8_t *)pBuffer;
+	while(Size > 0)
+	{
+		int chunk = (Size > 0x40000000) ? 0x40000000 : (int)Size;
+		if(!rFile.ReadFullBuffer(pPos, chunk, 0))
+		{
+			THROW_FILE_ERROR("Failed to read inode database: "
+				"short read", rFile.GetFileName(),
+				BackupStoreException, BerkelyDBFailure);
+		}
+		pPos += chunk;
+		Size -= chunk;
+	}
+}
+
+#endif // !BOX_INODE_MAP_USE_MMAP
 
 // --------------------------------------------------------------------------
 //
@@ -68,7 +154,12 @@
 BackupClientInodeToIDMap::BackupClientInodeToIDMap()
 	: mReadOnly(true),
 	  mEmpty(false),
-	  mpDepot(0)
+	  mNumRecords(0),
+	  mPathsSize(0),
+	  mpData(NULL),
+	  mDataSize(0),
+	  mpRecords(NULL),
+	  mpPaths(NULL)
 {
 }
 
@@ -82,7 +173,7 @@ BackupClientInodeToIDMap::BackupClientInodeToIDMap()
 // --------------------------------------------------------------------------
 BackupClientInodeToIDMap::~BackupClientInodeToIDMap()
 {
-	if(mpDepot != 0)
+	if(mapFile.get())
 	{
 		Close();
 	}
@@ -92,7 +183,9 @@ BackupClientInodeToIDMap::~BackupClientInodeToIDMap()
 //
 // Function
 //		Name:    BackupClientInodeToIDMap::Open(const char *, bool, bool)
-//		Purpose: Open the database map, creating a file on disc to store everything
+//		Purpose: Open the database map, creating a file on disc to
+//			 store everything. A new map can only be added to, and
+//			 an existing one can only be read.
 //		Created: 20/11/03
 //
 // --------------------------------------------------------------------------
@@ -100,78 +193,56 @@ void BackupClientInodeToIDMap::Open(const char *Filename, bool ReadOnly,
 	bool CreateNew)
 {
 	mFilename = Filename;
+	mPathsFilename = mFilename + INODEMAP_PATHS_SUFFIX;
 
 	// Correct arguments?
 	ASSERT(!(CreateNew && ReadOnly));
-	
-	// Correct usage?
-	ASSERT_DBM_CLOSED();
-	ASSERT(!mEmpty);
-	
-	// Open the database file
-	int mode = ReadOnly ? DP_OREADER : DP_OWRITER;
-	if(CreateNew)
+	if(!ReadOnly && !CreateNew)
 	{
-		mode |= DP_OCREAT;
-	}
-	
-	mpDepot = dpopen(Filename, mode, 0);
-	
-	if(!mpDepot)
-	{
-		THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
-			BOX_DBM_MESSAGE("Failed to open inode database: " <<
-				mFilename));
+		THROW_EXCEPTION_MESSAGE(CommonException, Internal,
+			"Inode databases can't be modified once written: " <<
+			mFilename);
 	}
 
-	const char* version_key = BOX_DBM_INODE_DB_VERSION_KEY;
-	int32_t version = 0;
+	// Correct usage?
+	ASSERT_MAP_CLOSED();
+	ASSERT(!mEmpty);
+
+	mNumRecords = 0;
+	mPathsSize = 0;
 
 	if(CreateNew)
 	{
-		version = BOX_DBM_INODE_DB_VERSION_CURRENT;
-
-		int ret = dpput(mpDepot, version_key, strlen(version_key),
-			(char *)(&version), sizeof(version), DP_DKEEP);
-
-		if(!ret)
-		{
-			THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
-				BOX_DBM_MESSAGE("Failed to write version number to inode "
-					"database: " << mFilename));
-		}
+		mapFile.reset(new FileStream(mFilename,
+			O_RDWR | O_CREAT | O_TRUNC | O_BINARY));
+		mapPathsFile.reset(new FileStream(mPathsFilename,
+			O_RDWR | O_CREAT | O_TRUNC | O_BINARY));
+
+		// The magic value is only written when the map is finished,
+		// so that an unfinished one is never read.
+		inodemap_FileHeader header;
+		::memset(&header, 0, sizeof(header));
+		mapFile->Write(&header, sizeof(header));
+		mPendingRecords.reserve(INODEMAP_PENDING_RECORDS);
 	}
 	else
 	{
-		int ret = dpgetwb(mpDepot, version_key, strlen(version_key), 0,
-			sizeof(version), (char *)(&version));
-
-		if(ret == -1)
-		{
-			THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
-				"Missing version number in inode database. Perhaps it "
-				"needs to be recreated: " << mFilename);
-		}
-
-		if(ret != sizeof(version))
-		{
-			THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
-				"Wrong size version number in inode database: expected "
-				<< sizeof(version) << " bytes but found " << ret);
-		}
-
-		if(version != BOX_DBM_INODE_DB_VERSION_CURRENT)
+		mapFile.reset(new FileStream(mFilename, O_RDONLY | O_BINARY));
+		if(!MapFile())
 		{
-			THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
-				"Wrong version number in inode database: expected " <<
-				BOX_DBM_INODE_DB_VERSION_CURRENT << " but found " <<
-				version << ". Perhaps it needs to be recreated: " <<
-				mFilename);
+			mapFile.reset();
+			ConvertFromQdbm();
+			mapFile.reset(new FileStream(mFilename,
+				O_RDONLY | O_BINARY));
+			if(!MapFile())
+			{
+				THROW_FILE_ERROR("Converted inode database is "
+					"not readable", mFilename,
+					BackupStoreException, BerkelyDBFailure);
+			}
 		}
-
-		// By this point the version number has been checked and is OK.
 	}
-	
+
 	// Read only flag
 	mReadOnly = ReadOnly;
 }
@@ -189,8 +260,7 @@ void BackupClientInodeToIDMap::Open(const char *Filename, bool ReadOnly,
 // --------------------------------------------------------------------------
 void BackupClientInodeToIDMap::OpenEmpty()
 {
-	ASSERT_DBM_CLOSED();
-	ASSERT(mpDepot == 0);
+	ASSERT_MAP_CLOSED();
 	mEmpty = true;
 	mReadOnly = true;
 }
@@ -199,16 +269,33 @@ void BackupClientInodeToIDMap::OpenEmpty()
 //
 // Function
 //		Name:    BackupClientInodeToIDMap::Close()
-//		Purpose: Close the database file
+//		Purpose: Close the database file, finishing it first if it's
+//			 a new one.
 //		Created: 20/11/03
 //
 // --------------------------------------------------------------------------
 void BackupClientInodeToIDMap::Close()
 {
-	ASSERT_DBM_OPEN();
-	ASSERT_DBM_OK(dpclose(mpDepot), "Failed to close inode database",
-		mFilename, BackupStoreException, BerkelyDBFailure);
-	mpDepot = 0;
+	ASSERT_MAP_OPEN();
+
+	try
+	{
+		if(!mReadOnly)
+		{
+			FinishNewMap();
+		}
+	}
+	catch(...)
+	{
+		mapPathsFile.reset();
+		mapFile.reset();
+		mPendingRecords.clear();
+		mPendingPaths.clear();
+		throw;
+	}
+
+	UnmapFile();
+	mapFile.reset();
 }
 
 // --------------------------------------------------------------------------
@@ -229,25 +316,390 @@ void BackupClientInodeToIDMap::AddToMap(InodeRefType InodeRef, int64_t ObjectID,
 		THROW_EXCEPTION(BackupStoreException, InodeMapIsReadOnly);
 	}
 
-	if(mpDepot == 0)
+	ASSERT_MAP_OPEN();
+
+	inodemap_Record record;
+	record.mInodeRef = InodeRef;
+	record.mObjectID = ObjectID;
+	record.mInDirectory = InDirectory;
+	record.mPathOffset = mPathsSize;
+	mPendingRecords.push_back(record);
+
+	uint32_t length = LocalPath.size();
+	mPendingPaths.append((const char *)&length, sizeof(length));
+	mPendingPaths.append(LocalPath);
+	mPathsSize += sizeof(length) + LocalPath.size();
+
+	if(mPendingRecords.size() >= INODEMAP_PENDING_RECORDS)
 	{
-		THROW_EXCEPTION(BackupStoreException, InodeMapNotOpen);
+		FlushPendingRecords();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::FlushPendingRecords()
+//		Purpose: Append the records and paths collected so far to
+//			 the files of a new map.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientInodeToIDMap::FlushPendingRecords()
+{
+	if(!mPendingRecords.empty())
+	{
+		mapFile->Write(&mPendingRecords[0],
+			mPendingRecords.size() * sizeof(inodemap_Record));
+		mNumRecords += mPendingRecords.size();
+		mPendingRecords.clear();
+	}
+
+	if(!mPendingPaths.empty())
+	{
+		mapPathsFile->Write(mPendingPaths.c_str(),
+			mPendingPaths.size());
+		mPendingPaths.clear();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::FinishNewMap()
+//		Purpose: Sort the records of a new map in place, append the
+//			 paths to them, and mark the file as complete.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientInodeToIDMap::FinishNewMap()
+{
+	FlushPendingRecords();
+
+	int64_t recordsSize = mNumRecords * sizeof(inodemap_Record);
+	int64_t numKept = mNumRecords;
+
+	if(mNumRecords > 0)
+	{
+#ifdef BOX_INODE_MAP_USE_MMAP
+		int64_t mapSize = sizeof(inodemap_FileHeader) + recordsSize;
+		void *pMapping = ::mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, mapFile->GetFileHandle(), 0);
+		if(pMapping == MAP_FAILED)
+		{
+			THROW_SYS_FILE_ERROR("Failed to map inode database",
+				mFilename, CommonException, OSFileError);
+		}
+
+		numKept = SortRecords((inodemap_Record *)
+			(((uint8_t *)pMapping) + sizeof(inodemap_FileHeader)),
+			mNumRecords);
+
+		if(::munmap(pMapping, mapSize) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to unmap inode database",
+				mFilename, CommonException, OSFileError);
+		}
+#else
+		std::vector<inodemap_Record> records(mNumRecords);
+		ReadAt(*mapFile, sizeof(inodemap_FileHeader), &records[0],
+			recordsSize);
+		numKept = SortRecords(&records[0], mNumRecords);
+		mapFile->Seek(sizeof(inodemap_FileHeader),
+			IOStream::SeekType_Absolute);
+		mapFile->Write(&records[0], numKept * sizeof(inodemap_Record));
+#endif
+	}
+
+	// The paths go straight after the records that are left
+	inodemap_FileHeader header;
+	::memset(&header, 0, sizeof(header));
+	header.mMagicValue = INODEMAP_MAGIC_VALUE;
+	header.mNumRecords = numKept;
+	header.mPathsOffset = sizeof(inodemap_FileHeader) +
+		numKept * sizeof(inodemap_Record);
+	header.mPathsSize = mPathsSize;
+
+	mapFile->Seek(header.mPathsOffset, IOStream::SeekType_Absolute);
+	mapPathsFile->Seek(0, IOStream::SeekType_Absolute);
+	mapPathsFile->CopyStreamTo(*mapFile, IOStream::TimeOutInfinite,
+		64 * 1024);
+	mapPathsFile.reset();
+	if(EMU_UNLINK(mPathsFilename.c_str()) != 0)
+	{
+		BOX_LOG_SYS_WARNING(BOX_FILE_MESSAGE(mPathsFilename,
+			"Failed to delete temporary inode database file"));
+	}
+
+#ifdef HAVE_FTRUNCATE
+	if(numKept < mNumRecords &&
+		::ftruncate(mapFile->GetFileHandle(),
+			header.mPathsOffset + mPathsSize) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to truncate inode database",
+			mFilename, CommonException, OSFileError);
+	}
+#endif
+
+	mapFile->Seek(0, IOStream::SeekType_Absolute);
+	mapFile->Write(&header, sizeof(header));
+
+	BOX_TRACE("Wrote inode database with " << numKept << " entries (" <<
+		(mNumRecords - numKept) << " replaced): " << mFilename);
+	mNumRecords = numKept;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::MapFile()
+//		Purpose: Map a finished database file into memory, or read
+//			 it in if mapping isn't available on this platform.
+//			 Returns false if it's not in this format at all.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientInodeToIDMap::MapFile()
+{
+	IOStream::pos_type fileSize = mapFile->BytesLeftToRead();
+
+	inodemap_FileHeader header;
+	if(fileSize < (IOStream::pos_type)sizeof(header) ||
+		!mapFile->ReadFullBuffer(&header, sizeof(header), 0) ||
+		header.mMagicValue != INODEMAP_MAGIC_VALUE)
+	{
+		return false;
+	}
+
+	if(header.mNumRecords < 0 || header.mPathsSize < 0 ||
+		header.mPathsOffset != (int64_t)(sizeof(header) +
+			header.mNumRecords * sizeof(inodemap_Record)) ||
+		header.mPathsOffset + header.mPathsSize > fileSize)
+	{
+		THROW_FILE_ERROR("Inode database is corrupt", mFilename,
+			BackupStoreException, BerkelyDBFailure);
+	}
+
+	mDataSize = header.mPathsOffset + header.mPathsSize;
+
+#ifdef BOX_INODE_MAP_USE_MMAP
+	void *pMapping = ::mmap(NULL, mDataSize, PROT_READ, MAP_SHARED,
+		mapFile->GetFileHandle(), 0);
+	if(pMapping == MAP_FAILED)
+	{
+		THROW_SYS_FILE_ERROR("Failed to map inode database",
+			mFilename, CommonException, OSFileError);
+	}
+	mpData = (uint8_t *)pMapping;
+#else
+	mpData = (uint8_t *)::malloc(mDataSize);
+	if(mpData == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	try
+	{
+		ReadAt(*mapFile, 0, mpData, mDataSize);
+	}
+	catch(...)
+	{
+		UnmapFile();
+		throw;
 	}
+#endif
 
-	ASSERT_DBM_OPEN();
+	mNumRecords = header.mNumRecords;
+	mPathsSize = header.mPathsSize;
+	mpRecords = (const inodemap_Record *)(mpData + sizeof(header));
+	mpPaths = (const char *)(mpData + header.mPathsOffset);
+	return true;
+}
 
-	// Setup structures
-	CollectInBufferStream buf;
-	Archive arc(buf, IOStream::TimeOutInfinite);
-	arc.WriteExact((uint64_t)ObjectID);
-	arc.WriteExact((uint64_t)InDirectory);
-	arc.Write(LocalPath);
-	buf.SetForReading();
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::UnmapFile()
+//		Purpose: Release the memory holding a finished database
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientInodeToIDMap::UnmapFile()
+{
+	if(mpData != NULL)
+	{
+#ifdef BOX_INODE_MAP_USE_MMAP
+		if(::munmap(mpData, mDataSize) != 0)
+		{
+			BOX_LOG_SYS_ERROR(BOX_FILE_MESSAGE(mFilename,
+				"Failed to unmap inode database"));
+		}
+#else
+		::free(mpData);
+#endif
+	}
 
-	ASSERT_DBM_OK(dpput(mpDepot, (const char *)&InodeRef, sizeof(InodeRef),
-		(const char *)buf.GetBuffer(), buf.GetSize(), DP_DOVER),
-		"Failed to add record to inode database", mFilename,
-		BackupStoreException, BerkelyDBFailure);
+	mpData = NULL;
+	mDataSize = 0;
+	mpRecords = NULL;
+	mpPaths = NULL;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::ConvertFromQdbm()
+//		Purpose: Replace a database in the old qdbm format with one
+//			 in the current format, holding the same entries.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientInodeToIDMap::ConvertFromQdbm()
+{
+	DEPOT *pDepot = dpopen(mFilename.c_str(), DP_OREADER, 0);
+	if(!pDepot)
+	{
+		THROW_EXCEPTION_MESSAGE(BackupStoreException, BerkelyDBFailure,
+			BOX_DBM_MESSAGE("Inode database is not in a known "
+				"format: " << mFilename));
+	}
+
+	std::string newFilename(mFilename + INODEMAP_CONVERT_SUFFIX);
+	int64_t numConverted = 0;
+
+	try
+	{
+		const char* version_key = BOX_DBM_INODE_DB_VERSION_KEY;
+		int32_t version = 0;
+		int ret = dpgetwb(pDepot, version_key, strlen(version_key), 0,
+			sizeof(version), (char *)(&version));
+		if(ret != sizeof(version) ||
+			version != BOX_DBM_INODE_DB_VERSION_CURRENT)
+		{
+			THROW_EXCEPTION_MESSAGE(BackupStoreException,
+				BerkelyDBFailure, "Missing or wrong version "
+				"number in old inode database. Perhaps it needs "
+				"to be recreated: " << mFilename);
+		}
+
+		BackupClientInodeToIDMap converted;
+		converted.Open(newFilename.c_str(), false, true);
+
+		if(!dpiterinit(pDepot))
+		{
+			THROW_EXCEPTION_MESSAGE(BackupStoreException,
+				BerkelyDBFailure, BOX_DBM_MESSAGE("Failed to "
+				"iterate over inode database: " << mFilename));
+		}
+
+		int keySize;
+		char *key;
+		while((key = dpiternext(pDepot, &keySize)) != NULL)
+		{
+			MemoryBlockGuard<char *> keyGuard(key);
+			if(keySize != sizeof(InodeRefType))
+			{
+				// the version number
+				continue;
+			}
+
+			int size;
+			char* data = dpget(pDepot, key, keySize, 0, -1, &size);
+			if(data == NULL)
+			{
+				continue;
+			}
+			MemoryBlockGuard<char *> dataGuard(data);
+
+			InodeRefType inodeRef;
+			::memcpy(&inodeRef, key, sizeof(inodeRef));
+
+			MemBlockStream stream(data, size);
+			Archive arc(stream, IOStream::TimeOutInfinite);
+			int64_t objectID, inDirectory;
+			std::string localPath;
+			try
+			{
+				arc.Read(objectID);
+				arc.Read(inDirectory);
+				arc.Read(localPath);
+			}
+			catch(CommonException &e)
+			{
+				if(e.GetSubType() ==
+					CommonException::ArchiveBlockIncompleteRead)
+				{
+					THROW_FILE_ERROR("Failed to convert "
+						"record in inode database: " <<
+						inodeRef << ": not enough data "
+						"in record", mFilename,
+						BackupStoreException,
+						BerkelyDBFailure);
+				}
+				throw;
+			}
+
+			converted.AddToMap(inodeRef, objectID, inDirectory,
+				localPath);
+			numConverted++;
+		}
+
+		converted.Close();
+	}
+	catch(...)
+	{
+		dpclose(pDepot);
+		EMU_UNLINK(newFilename.c_str());
+		EMU_UNLINK((newFilename + INODEMAP_PATHS_SUFFIX).c_str());
+		throw;
+	}
+
+	dpclose(pDepot);
+
+#ifdef WIN32
+	// win32 rename doesn't overwrite existing files
+	::remove(mFilename.c_str());
+#endif
+	if(::rename(newFilename.c_str(), mFilename.c_str()) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to replace old inode database",
+			mFilename, CommonException, OSFileError);
+	}
+
+	BOX_NOTICE("Converted inode database with " << numConverted <<
+		" entries to the new format: " << mFilename);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::GetPath(
+//			 const inodemap_Record &) const
+//		Purpose: Returns the local path stored with a record
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::string BackupClientInodeToIDMap::GetPath(
+	const inodemap_Record &rRecord) const
+{
+	uint32_t length;
+	if(rRecord.mPathOffset + sizeof(length) > (uint64_t)mPathsSize)
+	{
+		THROW_FILE_ERROR("Inode database is corrupt: path of " <<
+			rRecord.mInodeRef << " is out of range", mFilename,
+			BackupStoreException, BerkelyDBFailure);
+	}
+
+	::memcpy(&length, mpPaths + rRecord.mPathOffset, sizeof(length));
+	if(rRecord.mPathOffset + sizeof(length) + length >
+		(uint64_t)mPathsSize)
+	{
+		THROW_FILE_ERROR("Inode database is corrupt: path of " <<
+			rRecord.mInodeRef << " is out of range", mFilename,
+			BackupStoreException, BerkelyDBFailure);
+	}
+
+	return std::string(mpPaths + rRecord.mPathOffset + sizeof(length),
+		length);
 }
 
 // --------------------------------------------------------------------------
@@ -270,51 +722,74 @@ bool BackupClientInodeToIDMap::Lookup(InodeRefType InodeRef, int64_t &rObjectIDO
 		return false;
 	}
 
-	if(mpDepot == 0)
+	ASSERT_MAP_OPEN();
+
+	if(!mReadOnly)
 	{
-		THROW_EXCEPTION(BackupStoreException, InodeMapNotOpen);
+		THROW_EXCEPTION_MESSAGE(CommonException, Internal,
+			"Inode database can't be searched until it's "
+			"finished: " << mFilename);
 	}
-	
-	ASSERT_DBM_OPEN();
-	int size;
-	char* data = dpget(mpDepot, (const char *)&InodeRef, sizeof(InodeRef),
-		0, -1, &size);
-	if(data == NULL)
+
+	inodemap_Record key;
+	key.mInodeRef = InodeRef;
+	key.mPathOffset = 0;
+	const inodemap_Record *pEnd = mpRecords + mNumRecords;
+	const inodemap_Record *pFound = std::lower_bound(mpRecords, pEnd,
+		key, CompareRecords);
+	if(pFound == pEnd || pFound->mInodeRef != (uint64_t)InodeRef)
 	{
 		// key not in file
 		return false;
 	}
 
-	// Free data automatically when the guard goes out of scope.
-	MemoryBlockGuard<char *> guard(data);
-	MemBlockStream stream(data, size);
-	Archive arc(stream, IOStream::TimeOutInfinite);
-
 	// Return data
-	try
+	rObjectIDOut = pFound->mObjectID;
+	rInDirectoryOut = pFound->mInDirectory;
+	if(pLocalPathOut)
 	{
-		arc.Read(rObjectIDOut);
-		arc.Read(rInDirectoryOut);
-		if(pLocalPathOut)
-		{
-			arc.Read(*pLocalPathOut);
-		}
+		*pLocalPathOut = GetPath(*pFound);
+	}
+
+	// Found
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientInodeToIDMap::CopyEntriesInDirectories(
+//			 const BackupClientInodeToIDMap &,
+//			 const std::set<int64_t> &)
+//		Purpose: Copy the entries of another map for everything in
+//			 the given directories into this one. Used to keep the
+//			 entries for directories which a sync skipped, as it
+//			 found that nothing in them had changed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientInodeToIDMap::CopyEntriesInDirectories(
+	const BackupClientInodeToIDMap &rFrom,
+	const std::set<int64_t> &rDirectoryIDs)
+{
+	if(rFrom.mEmpty || rDirectoryIDs.empty())
+	{
+		return;
 	}
-	catch(CommonException &e)
+
+	if(!rFrom.mapFile.get() || !rFrom.mReadOnly)
 	{
-		if(e.GetSubType() == CommonException::ArchiveBlockIncompleteRead)
+		THROW_EXCEPTION(BackupStoreException, InodeMapNotOpen);
+	}
+
+	for(int64_t i = 0; i < rFrom.mNumRecords; i++)
+	{
+		const inodemap_Record &rRecord(rFrom.mpRecords[i]);
+		if(rDirectoryIDs.find(rRecord.mInDirectory) !=
+			rDirectoryIDs.end())
 		{
-			THROW_FILE_ERROR("Failed to lookup record in inode database: "
-				<< InodeRef << ": not enough data in record", mFilename,
-				BackupStoreException, BerkelyDBFailure);
-			// Need to throw precisely that exception to ensure that the
-			// invalid database is deleted, so that we don't hit the same
-			// error next time.
+			AddToMap(rRecord.mInodeRef, rRecord.mObjectID,
+				rRecord.mInDirectory, rFrom.GetPath(rRecord));
 		}
-
-		throw;
 	}
-
-	// Found
-	return true;
 }
@@ -13,18 +13,53 @@
 #include <sys/types.h>
 
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
 #include <utility>
+#include <vector>
 
-// avoid having to include the DB files when not necessary
-#ifndef BACKIPCLIENTINODETOIDMAP_IMPLEMENTATION
-	class DEPOT;
+#include "FileStream.h"
+
+// Map the finished map file into memory where possible, rather than
+// reading it all in
+#if defined HAVE_SYS_MMAN_H && !defined WIN32
+	#define BOX_INODE_MAP_USE_MMAP
 #endif
 
+// The map file is only ever read by the machine that wrote it, so it's
+// in native byte order, and naturally aligned.
+typedef struct
+{
+	uint32_t mMagicValue;	// also the version number
+	uint32_t mReserved;
+	int64_t mNumRecords;
+	int64_t mPathsOffset;
+	int64_t mPathsSize;
+} inodemap_FileHeader;
+
+// Each local path is stored in the paths blob as a uint32_t length
+// followed by the path itself.
+typedef struct
+{
+	uint64_t mInodeRef;
+	int64_t mObjectID;
+	int64_t mInDirectory;
+	uint64_t mPathOffset;
+} inodemap_Record;
+
 // --------------------------------------------------------------------------
 //
 // Class
 //		Name:    BackupClientInodeToIDMap
-//		Purpose: Map of inode numbers to file IDs on the store
+//		Purpose: Map of inode numbers to file IDs on the store. A new
+//			 map is built by appending fixed size records to the
+//			 file, and their paths to a separate file, in whatever
+//			 order they're added. When the map is closed, the
+//			 records are sorted by inode, the paths are appended
+//			 to them, and the map can then be opened read-only and
+//			 searched in place. Maps in the old qdbm format are
+//			 converted when they're opened.
 //		Created: 11/11/03
 //
 // --------------------------------------------------------------------------
@@ -44,16 +79,41 @@ public:
 		int64_t InDirectory, const std::string& LocalPath);
 	bool Lookup(InodeRefType InodeRef, int64_t &rObjectIDOut,
 		int64_t &rInDirectoryOut, std::string* pLocalPathOut = NULL) const;
+	void CopyEntriesInDirectories(const BackupClientInodeToIDMap &rFrom,
+		const std::set<int64_t> &rDirectoryIDs);
 
 	void Close();
 
+	int64_t GetNumEntries() const { return mNumRecords; }
+
 private:
+	void FlushPendingRecords();
+	void FinishNewMap();
+	bool MapFile();
+	void UnmapFile();
+	void ConvertFromQdbm();
+	std::string GetPath(const inodemap_Record &rRecord) const;
+
 	bool mReadOnly;
 	bool mEmpty;
 	std::string mFilename;
-	DEPOT *mpDepot;
+	std::string mPathsFilename;
+	std::auto_ptr<FileStream> mapFile;
+	std::auto_ptr<FileStream> mapPathsFile;
+
+	// While building a new map
+	std::vector<inodemap_Record> mPendingRecords;
+	std::string mPendingPaths;
+
+	int64_t mNumRecords;
+	int64_t mPathsSize;
+
+	// Once the map is finished
+	uint8_t *mpData;
+	int64_t mDataSize;
+	const inodemap_Record *mpRecords;
+	const char *mpPaths;
 };
 
 #endif // BACKUPCLIENTINODETOIDMAP_H
 
-
@@ -0,0 +1,407 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientScanAhead.cpp
+//		Purpose: Pool of processes which read a location's directories
+//			 ahead of the sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#ifdef HAVE_DIRENT_H
+	#include <dirent.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+	#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_SYS_XATTR_H
+	#include <sys/xattr.h>
+#endif
+
+#ifndef WIN32
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+#include "BackupClientScanAhead.h"
+#include "ExcludeList.h"
+#include "PathUtils.h"
+
+#include "MemLeakFindOn.h"
+
+// Writes to a pipe of up to PIPE_BUF bytes are never split up or mixed
+// with others, and with the pipe in non-blocking mode, they're either
+// written completely or not at all. So the children can add directories
+// to the queue and take them off it without getting in each other's way,
+// provided every record is the same size. Paths which don't fit in a
+// record are read by the child which found them instead.
+#ifdef PIPE_BUF
+	#define SCAN_AHEAD_RECORD_SIZE	PIPE_BUF
+#else
+	#define SCAN_AHEAD_RECORD_SIZE	512
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::BackupClientScanAhead(int)
+//		Purpose: Constructor. No processes are started if
+//			 NumProcesses is less than one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientScanAhead::BackupClientScanAhead(int NumProcesses)
+: mMaxProcesses(NumProcesses),
+  mpExcludeDirs(NULL)
+{
+	mQueue[0] = mQueue[1] = -1;
+	mLifeline[0] = mLifeline[1] = -1;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::~BackupClientScanAhead()
+//		Purpose: Destructor, stops any processes still running
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientScanAhead::~BackupClientScanAhead()
+{
+	Stop();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::Start(const std::string &,
+//			 const ExcludeList *)
+//		Purpose: Start the processes reading the location, skipping
+//			 the directories which the sync will exclude. If they
+//			 can't be started, the sync just runs without them.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientScanAhead::Start(const std::string &rLocationPath,
+	const ExcludeList *pExcludeDirs)
+{
+	Stop();
+
+#ifndef WIN32
+	if(mMaxProcesses < 1 ||
+		rLocationPath.size() >= SCAN_AHEAD_RECORD_SIZE)
+	{
+		return;
+	}
+
+	mpExcludeDirs = pExcludeDirs;
+
+	if(::pipe(mQueue) != 0)
+	{
+		BOX_LOG_SYS_WARNING("Failed to create directory scan queue");
+		mQueue[0] = mQueue[1] = -1;
+		return;
+	}
+
+	if(::pipe(mLifeline) != 0)
+	{
+		BOX_LOG_SYS_WARNING("Failed to create directory scan queue");
+		mLifeline[0] = mLifeline[1] = -1;
+		Stop();
+		return;
+	}
+
+	// Neither the children taking directories off the queue, nor
+	// those adding them, may wait for it.
+	for(int i = 0; i < 2; i++)
+	{
+		int flags = ::fcntl(mQueue[i], F_GETFL);
+		if(flags == -1 ||
+			::fcntl(mQueue[i], F_SETFL, flags | O_NONBLOCK) == -1)
+		{
+			BOX_LOG_SYS_WARNING("Failed to set up directory scan "
+				"queue");
+			Stop();
+			return;
+		}
+	}
+
+	for(int i = 0; i < mMaxProcesses; i++)
+	{
+		pid_t pid = ::fork();
+		if(pid == 0)
+		{
+			// In the child, which mustn't clean up anything
+			// belonging to the parent, such as its connection
+			// to the store, so it leaves with _exit().
+			::close(mLifeline[1]);
+			try
+			{
+				RunWorker();
+			}
+			catch(...)
+			{
+				::_exit(1);
+			}
+			::_exit(0);
+		}
+
+		if(pid == -1)
+		{
+			BOX_LOG_SYS_WARNING("Failed to start directory scan "
+				"process");
+			break;
+		}
+
+		mProcesses.push_back(pid);
+	}
+
+	// The children hold both ends of the queue, so it lasts as long
+	// as they do. They stop when the lifeline is closed.
+	::close(mLifeline[0]);
+	mLifeline[0] = -1;
+
+	if(mProcesses.empty() || !ShareDirectory(rLocationPath))
+	{
+		Stop();
+		return;
+	}
+
+	::close(mQueue[0]);
+	::close(mQueue[1]);
+	mQueue[0] = mQueue[1] = -1;
+
+	BOX_TRACE("Started " << mProcesses.size() << " processes to scan "
+		"ahead in " << rLocationPath);
+#endif // !WIN32
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::Stop()
+//		Purpose: Tell the processes to stop, wherever they've got
+//			 to, and wait for them to finish.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientScanAhead::Stop()
+{
+#ifndef WIN32
+	for(int i = 0; i < 2; i++)
+	{
+		if(mLifeline[i] != -1)
+		{
+			::close(mLifeline[i]);
+			mLifeline[i] = -1;
+		}
+		if(mQueue[i] != -1)
+		{
+			::close(mQueue[i]);
+			mQueue[i] = -1;
+		}
+	}
+
+	for(std::vector<pid_t>::iterator i = mProcesses.begin();
+		i != mProcesses.end(); i++)
+	{
+		int status;
+		while(::waitpid(*i, &status, 0) == -1 && errno == EINTR)
+		{
+			// interrupted by a signal, try again
+		}
+	}
+#endif // !WIN32
+
+	mProcesses.clear();
+	mpExcludeDirs = NULL;
+}
+
+#ifndef WIN32
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::RunWorker()
+//		Purpose: In a child, read the directories in the queue until
+//			 told to stop.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientScanAhead::RunWorker()
+{
+	while(true)
+	{
+		struct pollfd p[2];
+		p[0].fd = mLifeline[0];
+		p[0].events = POLLIN;
+		p[0].revents = 0;
+		p[1].fd = mQueue[0];
+		p[1].events = POLLIN;
+		p[1].revents = 0;
+
+		if(::poll(p, 2, -1) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+
+		if(p[0].revents != 0)
+		{
+			// The parent has finished with us
+			return;
+		}
+
+		// Another child may take the directory first, so the read
+		// may fail with EAGAIN.
+		char record[SCAN_AHEAD_RECORD_SIZE];
+		int bytes = ::read(mQueue[0], record, sizeof(record));
+		if(bytes == -1 && (errno == EAGAIN || errno == EINTR))
+		{
+			continue;
+		}
+		else if(bytes != sizeof(record))
+		{
+			return;
+		}
+
+		record[sizeof(record) - 1] = '\0';
+		ScanDirectory(record);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::StopRequested()
+//		Purpose: In a child, check whether the parent has finished
+//			 with us, without waiting.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientScanAhead::StopRequested()
+{
+	struct pollfd p;
+	p.fd = mLifeline[0];
+	p.events = POLLIN;
+	p.revents = 0;
+	return ::poll(&p, 1, 0) != 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::ScanDirectory(const std::string &)
+//		Purpose: In a child, read a directory the way the sync will:
+//			 its attributes and the details of each entry. Then
+//			 pass on its subdirectories, or read them here if no
+//			 other child can take them.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientScanAhead::ScanDirectory(const std::string &rDirPath)
+{
+	if(StopRequested())
+	{
+		return;
+	}
+
+	EMU_STRUCT_STAT dir_st;
+	if(EMU_STAT(rDirPath.c_str(), &dir_st) != 0)
+	{
+		return;
+	}
+
+#ifdef HAVE_LLISTXATTR
+	char xattrs[1024];
+	::llistxattr(rDirPath.c_str(), xattrs, sizeof(xattrs));
+#endif
+
+	DIR *dirHandle = ::opendir(rDirPath.c_str());
+	if(dirHandle == NULL)
+	{
+		return;
+	}
+
+	std::vector<std::string> subdirs;
+	struct dirent *en;
+	while((en = ::readdir(dirHandle)) != NULL)
+	{
+		if(::strcmp(en->d_name, ".") == 0 ||
+			::strcmp(en->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		std::string path = MakeFullPath(rDirPath, en->d_name);
+		EMU_STRUCT_STAT file_st;
+		if(EMU_LSTAT(path.c_str(), &file_st) != 0)
+		{
+			continue;
+		}
+
+		// The sync doesn't cross into other filesystems
+		if((file_st.st_mode & S_IFMT) == S_IFDIR &&
+			file_st.st_dev == dir_st.st_dev &&
+			!(mpExcludeDirs != NULL &&
+				mpExcludeDirs->IsExcluded(path)))
+		{
+			subdirs.push_back(path);
+		}
+	}
+	::closedir(dirHandle);
+
+	for(std::vector<std::string>::iterator i = subdirs.begin();
+		i != subdirs.end(); i++)
+	{
+		if(!ShareDirectory(*i))
+		{
+			ScanDirectory(*i);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientScanAhead::ShareDirectory(
+//			 const std::string &)
+//		Purpose: Add a directory to the queue, returning false if it
+//			 doesn't fit.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientScanAhead::ShareDirectory(const std::string &rDirPath)
+{
+	if(rDirPath.size() >= SCAN_AHEAD_RECORD_SIZE)
+	{
+		return false;
+	}
+
+	char record[SCAN_AHEAD_RECORD_SIZE];
+	::memset(record, 0, sizeof(record));
+	::memcpy(record, rDirPath.c_str(), rDirPath.size());
+
+	int bytes;
+	do
+	{
+		bytes = ::write(mQueue[1], record, sizeof(record));
+	}
+	while(bytes == -1 && errno == EINTR);
+
+	return bytes == sizeof(record);
+}
+
+#endif // !WIN32
@@ -0,0 +1,68 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientScanAhead.h
+//		Purpose: Pool of processes which read a location's directories
+//			 ahead of the sync
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPCLIENTSCANAHEAD__H
+#define BACKUPCLIENTSCANAHEAD__H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+class ExcludeList;
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientScanAhead
+//		Purpose: Walks the directories of a location in several
+//			 child processes while the sync works through it, so
+//			 that the directory entries, inodes and attributes the
+//			 sync reads are already in the kernel's caches. The
+//			 children share a queue of directories still to be
+//			 read, which is a pipe of fixed size records. A child
+//			 which finds subdirectories adds them to the queue for
+//			 any idle child to take, and reads them itself if the
+//			 queue is full. The children don't decide anything, so
+//			 the sync does exactly what it would without them.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientScanAhead
+{
+public:
+	BackupClientScanAhead(int NumProcesses);
+	~BackupClientScanAhead();
+private:
+	// no copying
+	BackupClientScanAhead(const BackupClientScanAhead &);
+	BackupClientScanAhead &operator=(const BackupClientScanAhead &);
+public:
+
+	void Start(const std::string &rLocationPath,
+		const ExcludeList *pExcludeDirs);
+	void Stop();
+
+	int GetNumProcesses() const {return mProcesses.size();}
+
+private:
+	void RunWorker();
+	void ScanDirectory(const std::string &rDirPath);
+	bool ShareDirectory(const std::string &rDirPath);
+	bool StopRequested();
+
+	int mMaxProcesses;
+	int mQueue[2];
+	int mLifeline[2];
+	std::vector<pid_t> mProcesses;
+	const ExcludeList *mpExcludeDirs;
+};
+
+#endif // BACKUPCLIENTSCANAHEAD__H
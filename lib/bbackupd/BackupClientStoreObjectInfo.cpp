@@ -0,0 +1,410 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientStoreObjectInfo.cpp
+//		Purpose: Reading and writing the directory records in the
+//			 store object info file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+	#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+	#include <sys/mman.h>
+#endif
+
+#include "autogen_ClientException.h"
+#include "Archive.h"
+#include "BackupClientStoreObjectInfo.h"
+#include "CollectInBufferStream.h"
+#include "CommonException.h"
+#include "Logging.h"
+#include "MemBlockStream.h"
+
+#include "MemLeakFindOn.h"
+
+#define STOREOBJECTINFO_TEMP_SUFFIX		".new"
+
+// How much to collect before writing it out
+#define STOREOBJECTINFO_WRITE_BUFFER_SIZE	(256*1024)
+
+// The largest single read or write
+#define STOREOBJECTINFO_MAX_IO_SIZE		0x40000000
+
+static int sNextGeneration = 1;
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfo::BackupClientStoreObjectInfo(
+//			 const std::string &)
+//		Purpose: Constructor, maps the file (which must be in the
+//			 current format) into memory
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientStoreObjectInfo::BackupClientStoreObjectInfo(
+	const std::string &rFilename)
+: mFilename(rFilename),
+  mpData(NULL),
+  mDataSize(0),
+  mTrailerOffset(0)
+{
+	FileStream file(rFilename, O_RDONLY);
+	int64_t fileSize = file.BytesLeftToRead();
+
+	if(fileSize < (int64_t)sizeof(storeobjectinfo_Footer))
+	{
+		THROW_FILE_ERROR("Store object info file is too short",
+			rFilename, ClientException, CorruptStoreObjectInfoFile);
+	}
+
+#ifdef BOX_STORE_OBJECT_INFO_USE_MMAP
+	void *pMapping = ::mmap(NULL, fileSize, PROT_READ, MAP_SHARED,
+		file.GetFileHandle(), 0);
+	if(pMapping == MAP_FAILED)
+	{
+		THROW_SYS_FILE_ERROR("Failed to map store object info file",
+			rFilename, CommonException, OSFileError);
+	}
+	mpData = (uint8_t *)pMapping;
+	mDataSize = fileSize;
+#else
+	mpData = (uint8_t *)::malloc(fileSize);
+	if(mpData == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	mDataSize = fileSize;
+
+	for(int64_t done = 0; done < fileSize; )
+	{
+		int64_t chunk = fileSize - done;
+		if(chunk > STOREOBJECTINFO_MAX_IO_SIZE)
+		{
+			chunk = STOREOBJECTINFO_MAX_IO_SIZE;
+		}
+		if(!file.ReadFullBuffer(mpData + done, chunk, 0))
+		{
+			::free(mpData);
+			mpData = NULL;
+			THROW_FILE_ERROR("Failed to read store object info "
+				"file: short read", rFilename, ClientException,
+				CorruptStoreObjectInfoFile);
+		}
+		done += chunk;
+	}
+#endif
+
+	storeobjectinfo_Footer footer;
+	::memcpy(&footer, mpData + mDataSize - sizeof(footer), sizeof(footer));
+
+	if(footer.mMagicValue != STOREOBJECTINFO_FOOTER_MAGIC ||
+		footer.mTrailerOffset < 0 ||
+		footer.mTrailerOffset > mDataSize - (int64_t)sizeof(footer))
+	{
+		// The destructor won't be called
+#ifdef BOX_STORE_OBJECT_INFO_USE_MMAP
+		::munmap(mpData, mDataSize);
+#else
+		::free(mpData);
+#endif
+		mpData = NULL;
+		THROW_FILE_ERROR("Store object info file is incomplete",
+			rFilename, ClientException, CorruptStoreObjectInfoFile);
+	}
+
+	mTrailerOffset = footer.mTrailerOffset;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfo::~BackupClientStoreObjectInfo()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientStoreObjectInfo::~BackupClientStoreObjectInfo()
+{
+	if(mpData != NULL)
+	{
+#ifdef BOX_STORE_OBJECT_INFO_USE_MMAP
+		if(::munmap(mpData, mDataSize) != 0)
+		{
+			BOX_LOG_SYS_ERROR(BOX_FILE_MESSAGE(mFilename,
+				"Failed to unmap store object info file"));
+		}
+#else
+		::free(mpData);
+#endif
+		mpData = NULL;
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfo::GetTrailer()
+//		Purpose: Returns a stream from which the Archive holding
+//			 the state other than the directory records can be
+//			 read
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+std::auto_ptr<IOStream> BackupClientStoreObjectInfo::GetTrailer() const
+{
+	int64_t size = mDataSize - sizeof(storeobjectinfo_Footer) -
+		mTrailerOffset;
+	return std::auto_ptr<IOStream>(new MemBlockStream(
+		GetBlock(mTrailerOffset, size), size));
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfo::GetBlock(int64_t, int64_t)
+//		Purpose: Returns a pointer to part of the file, checking
+//			 that it's all there first
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+const uint8_t *BackupClientStoreObjectInfo::GetBlock(int64_t Offset,
+	int64_t Size) const
+{
+	if(Offset < 0 || Size < 0 || Offset > mTrailerOffset ||
+		Size > mDataSize - Offset || Size > STOREOBJECTINFO_MAX_IO_SIZE)
+	{
+		THROW_FILE_ERROR("Store object info file refers to data "
+			"outside it", mFilename, ClientException,
+			CorruptStoreObjectInfoFile);
+	}
+
+	return mpData + Offset;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::BackupClientStoreObjectInfoWriter(
+//			 const std::string &)
+//		Purpose: Constructor, starts writing a new file to replace
+//			 the one named
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientStoreObjectInfoWriter::BackupClientStoreObjectInfoWriter(
+	const std::string &rFilename)
+: mFilename(rFilename),
+  mTempFilename(rFilename + STOREOBJECTINFO_TEMP_SUFFIX),
+  mBytesFlushed(0),
+  mGeneration(sNextGeneration++),
+  mFailed(false),
+  mCommitted(false)
+{
+	try
+	{
+		mapFile.reset(new FileStream(mTempFilename,
+			O_WRONLY | O_CREAT | O_TRUNC));
+	}
+	catch(std::exception &e)
+	{
+		Failed(e.what());
+		return;
+	}
+
+	CollectInBufferStream header;
+	Archive anArchive(header, 0);
+	anArchive.Write((int)STOREOBJECTINFO_MAGIC_ID_VALUE);
+	anArchive.Write(std::string(STOREOBJECTINFO_MAGIC_ID_STRING));
+	anArchive.Write((int)STOREOBJECTINFO_VERSION);
+	header.SetForReading();
+	Write(header.GetBuffer(), header.GetSize());
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::~BackupClientStoreObjectInfoWriter()
+//		Purpose: Destructor, removes the new file if it wasn't
+//			 committed
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientStoreObjectInfoWriter::~BackupClientStoreObjectInfoWriter()
+{
+	if(mCommitted)
+	{
+		return;
+	}
+
+	try
+	{
+		mapFile.reset();
+	}
+	catch(...)
+	{
+		// ignore, as it's being thrown away anyway
+	}
+
+	if(EMU_UNLINK(mTempFilename.c_str()) != 0 && errno != ENOENT)
+	{
+		BOX_LOG_SYS_ERROR(BOX_FILE_MESSAGE(mTempFilename,
+			"Failed to delete incomplete store object info file"));
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::Write(const void *,
+//			 int64_t)
+//		Purpose: Appends data to the file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientStoreObjectInfoWriter::Write(const void *pData, int64_t Size)
+{
+	if(mFailed)
+	{
+		return;
+	}
+
+	if(Size < STOREOBJECTINFO_WRITE_BUFFER_SIZE)
+	{
+		mBuffer.append((const char *)pData, Size);
+		if(mBuffer.size() >= STOREOBJECTINFO_WRITE_BUFFER_SIZE)
+		{
+			Flush();
+		}
+		return;
+	}
+
+	// Big enough to write directly, which copies of whole directory
+	// trees from the old file may well be
+	Flush();
+
+	try
+	{
+		const uint8_t *pPos = (const uint8_t *)pData;
+		while(Size > 0)
+		{
+			int chunk = (Size > STOREOBJECTINFO_MAX_IO_SIZE) ?
+				STOREOBJECTINFO_MAX_IO_SIZE : (int)Size;
+			mapFile->Write(pPos, chunk);
+			pPos += chunk;
+			Size -= chunk;
+			mBytesFlushed += chunk;
+		}
+	}
+	catch(std::exception &e)
+	{
+		Failed(e.what());
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::Flush()
+//		Purpose: Writes out anything collected so far
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientStoreObjectInfoWriter::Flush()
+{
+	if(mFailed || mBuffer.empty())
+	{
+		return;
+	}
+
+	try
+	{
+		mapFile->Write(mBuffer.c_str(), mBuffer.size());
+	}
+	catch(std::exception &e)
+	{
+		Failed(e.what());
+		return;
+	}
+
+	mBytesFlushed += mBuffer.size();
+	mBuffer.clear();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::Commit(
+//			 const CollectInBufferStream &)
+//		Purpose: Finishes the file with the Archive holding the rest
+//			 of the state, and replaces the old file with it.
+//			 Returns false if the file couldn't be written.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientStoreObjectInfoWriter::Commit(
+	const CollectInBufferStream &rTrailer)
+{
+	storeobjectinfo_Footer footer;
+	::memset(&footer, 0, sizeof(footer));
+	footer.mTrailerOffset = GetPosition();
+	footer.mMagicValue = STOREOBJECTINFO_FOOTER_MAGIC;
+
+	Write(rTrailer.GetBuffer(), rTrailer.GetSize());
+	Write(&footer, sizeof(footer));
+	Flush();
+
+	if(mFailed)
+	{
+		return false;
+	}
+
+	try
+	{
+		mapFile->Close();
+	}
+	catch(std::exception &e)
+	{
+		Failed(e.what());
+		return false;
+	}
+
+	if(::rename(mTempFilename.c_str(), mFilename.c_str()) != 0)
+	{
+		BOX_LOG_SYS_ERROR(BOX_FILE_MESSAGE(mFilename,
+			"Failed to replace store object info file"));
+		mFailed = true;
+		return false;
+	}
+
+	mCommitted = true;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientStoreObjectInfoWriter::Failed(
+//			 const std::string &)
+//		Purpose: Stops writing the file after an error
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientStoreObjectInfoWriter::Failed(const std::string &rMessage)
+{
+	BOX_ERROR(BOX_FILE_MESSAGE(mTempFilename, "Failed to write store "
+		"object info file: " << rMessage));
+	mFailed = true;
+	mBuffer.clear();
+}
@@ -0,0 +1,154 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientStoreObjectInfo.h
+//		Purpose: Reading and writing the directory records in the
+//			 store object info file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPCLIENTSTOREOBJECTINFO_H
+#define BACKUPCLIENTSTOREOBJECTINFO_H
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+#include "FileStream.h"
+#include "MD5Digest.h"
+
+class CollectInBufferStream;
+class IOStream;
+
+// Map the file into memory where possible, rather than reading it all in
+#if defined HAVE_SYS_MMAN_H && !defined WIN32
+	#define BOX_STORE_OBJECT_INFO_USE_MMAP
+#endif
+
+// Every version of the file starts with these, written with an Archive
+#define STOREOBJECTINFO_MAGIC_ID_VALUE		0x7777525F
+#define STOREOBJECTINFO_MAGIC_ID_STRING		"BBACKUPD-STATE"
+
+// Version 2 holds the whole state in a single Archive, with each
+// directory record followed by its sub directories. Version 3 holds
+// the directory records first, each one after its sub directories,
+// and then the rest of the state in an Archive.
+#define STOREOBJECTINFO_VERSION_ARCHIVE		2
+#define STOREOBJECTINFO_VERSION			3
+
+// The file is only ever read by the machine that wrote it, so the
+// fixed size parts are in native byte order. They're not necessarily
+// aligned, so they're copied out before use.
+typedef struct
+{
+	uint32_t mMagicValue;
+	uint32_t mFlags;
+	int64_t mObjectID;
+	// Number of bytes immediately before this record which hold its
+	// sub directories, and theirs
+	int64_t mSubtreeSize;
+	// Number of bytes following this header, holding an Archive of
+	// the name, pending entries, and the name and distance back from
+	// this record of each sub directory
+	int64_t mTailSize;
+	uint8_t mStateChecksum[MD5Digest::DigestLength];
+} storeobjectinfo_DirRecord;
+
+#define STOREOBJECTINFO_RECORD_MAGIC		0x44526333 // DRc3
+#define STOREOBJECTINFO_RECORD_INITIAL_SYNC_DONE	1
+#define STOREOBJECTINFO_RECORD_SYNC_DONE	2
+
+// The last thing in the file, giving the position of the Archive
+// holding the rest of the state
+typedef struct
+{
+	int64_t mTrailerOffset;
+	uint32_t mMagicValue;
+	uint32_t mReserved;
+} storeobjectinfo_Footer;
+
+#define STOREOBJECTINFO_FOOTER_MAGIC		0x534f4933 // SOI3
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientStoreObjectInfo
+//		Purpose: A store object info file in the current format,
+//			 mapped into memory so that the directory records
+//			 can be read from it as they're needed, rather than
+//			 all at once when the daemon starts.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientStoreObjectInfo
+{
+public:
+	BackupClientStoreObjectInfo(const std::string &rFilename);
+	~BackupClientStoreObjectInfo();
+private:
+	BackupClientStoreObjectInfo(const BackupClientStoreObjectInfo &);
+	BackupClientStoreObjectInfo &operator=(
+		const BackupClientStoreObjectInfo &);
+public:
+	std::auto_ptr<IOStream> GetTrailer() const;
+	const uint8_t *GetBlock(int64_t Offset, int64_t Size) const;
+	const std::string &GetFilename() const { return mFilename; }
+
+private:
+	std::string mFilename;
+	uint8_t *mpData;
+	int64_t mDataSize;
+	int64_t mTrailerOffset;
+};
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientStoreObjectInfoWriter
+//		Purpose: Writes a new store object info file, one directory
+//			 record at a time, to a temporary file which only
+//			 replaces the real one when it's committed. Errors
+//			 are logged rather than thrown, so that failing to
+//			 save the state doesn't stop a backup.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientStoreObjectInfoWriter
+{
+public:
+	BackupClientStoreObjectInfoWriter(const std::string &rFilename);
+	~BackupClientStoreObjectInfoWriter();
+private:
+	BackupClientStoreObjectInfoWriter(
+		const BackupClientStoreObjectInfoWriter &);
+	BackupClientStoreObjectInfoWriter &operator=(
+		const BackupClientStoreObjectInfoWriter &);
+public:
+	void Write(const void *pData, int64_t Size);
+	bool Commit(const CollectInBufferStream &rTrailer);
+
+	int64_t GetPosition() const
+	{
+		return mBytesFlushed + mBuffer.size();
+	}
+	// Identifies the records written to this file
+	int GetGeneration() const { return mGeneration; }
+	bool IsFailed() const { return mFailed; }
+
+private:
+	void Flush();
+	void Failed(const std::string &rMessage);
+
+	std::string mFilename;
+	std::string mTempFilename;
+	std::auto_ptr<FileStream> mapFile;
+	std::string mBuffer;
+	int64_t mBytesFlushed;
+	int mGeneration;
+	bool mFailed;
+	bool mCommitted;
+};
+
+#endif // BACKUPCLIENTSTOREOBJECTINFO_H
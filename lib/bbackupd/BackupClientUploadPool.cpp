@@ -0,0 +1,1082 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientUploadPool.cpp
+//		Purpose: Pool of processes which encode and send files to
+//			 the store over their own connections
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_WAIT_H
+	#include <sys/wait.h>
+#endif
+
+#ifndef WIN32
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+#include "autogen_BackupProtocol.h"
+#include "Archive.h"
+#include "BackupClientContext.h"
+#include "BackupClientUploadPool.h"
+#include "BackupStoreFile.h"
+#include "BackupStoreFileEncodeStream.h"
+#include "BackupStoreFilenameClear.h"
+#include "BufferedStream.h"
+#include "CollectInBufferStream.h"
+#include "Logging.h"
+#include "MemBlockStream.h"
+#include "RateLimitingStream.h"
+#include "Timer.h"
+
+#include "MemLeakFindOn.h"
+
+// Jobs and results are small, so anything bigger is a mistake
+#define UPLOAD_POOL_MAX_MESSAGE_SIZE	(64*1024)
+
+#ifndef WIN32
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    UploadWorkerDiffTimer
+//		Purpose: Keeps a child's connection alive while it diffs a
+//			 file, and limits the time spent diffing, as the
+//			 BackupClientContext does for the main connection.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class UploadWorkerDiffTimer : public DiffTimer
+{
+public:
+	UploadWorkerDiffTimer(BackupProtocolCallable &rConnection,
+		int KeepAliveTime, int MaximumDiffingTime)
+	: mrConnection(rConnection),
+	  mKeepAliveTime(KeepAliveTime),
+	  mMaximumDiffingTime(MaximumDiffingTime),
+	  mKeepAliveTimer(KeepAliveTime * MILLI_SEC_IN_SEC, "KeepAliveTime")
+	{ }
+
+	virtual void DoKeepAlive()
+	{
+		if(mKeepAliveTime == 0 || !mKeepAliveTimer.HasExpired())
+		{
+			return;
+		}
+
+		BOX_TRACE("KeepAliveTime reached, sending keep-alive message");
+		mrConnection.QueryGetIsAlive();
+		mKeepAliveTimer.Reset(mKeepAliveTime * MILLI_SEC_IN_SEC);
+	}
+	virtual int GetMaximumDiffingTime() { return mMaximumDiffingTime; }
+	virtual bool IsManaged() { return true; }
+
+private:
+	BackupProtocolCallable &mrConnection;
+	int mKeepAliveTime;
+	int mMaximumDiffingTime;
+	Timer mKeepAliveTimer;
+};
+
+#endif // !WIN32
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::BackupClientUploadPool(int)
+//		Purpose: Constructor. No processes are started if
+//			 NumProcesses is less than one.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientUploadPool::BackupClientUploadPool(int NumProcesses)
+: mMaxProcesses(NumProcesses),
+  mNextJobID(1),
+  mStagingSessionID(0),
+  mOrder(Order_Found),
+  mLargeFileSize(0)
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::~BackupClientUploadPool()
+//		Purpose: Destructor, stops any processes still running
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+BackupClientUploadPool::~BackupClientUploadPool()
+{
+	Stop();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::Start(BackupClientContext &,
+//			 int64_t)
+//		Purpose: Start the processes, which share the upload rate
+//			 limit between them. They connect to the store when
+//			 they're first given a file. If they can't be
+//			 started, or the store can't accept staged files,
+//			 the sync uploads everything itself.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::Start(BackupClientContext &rContext,
+	int64_t MaxUploadRate)
+{
+	Stop();
+
+#ifndef WIN32
+	if(mMaxProcesses < 1)
+	{
+		return;
+	}
+
+	// Files are staged for the main connection's session to add
+	try
+	{
+		mStagingSessionID = rContext.StartStaging();
+	}
+	catch(BoxException &e)
+	{
+		BOX_WARNING("Failed to start staging files on the store, "
+			"uploading them one at a time: " << e.what());
+		return;
+	}
+
+	if(mStagingSessionID == 0)
+	{
+		BOX_WARNING("The store is too old to accept files from more "
+			"than one connection, uploading them one at a time");
+		return;
+	}
+
+	// A child which dies would otherwise take us with it, when
+	// we next give it a job
+	::signal(SIGPIPE, SIG_IGN);
+
+	int64_t rateEach = MaxUploadRate / mMaxProcesses;
+	if(MaxUploadRate > 0 && rateEach < 1)
+	{
+		rateEach = 1;
+	}
+
+	for(int i = 0; i < mMaxProcesses; i++)
+	{
+		int jobs[2], results[2];
+		if(::pipe(jobs) != 0)
+		{
+			BOX_LOG_SYS_WARNING("Failed to create upload queue");
+			break;
+		}
+		if(::pipe(results) != 0)
+		{
+			BOX_LOG_SYS_WARNING("Failed to create upload queue");
+			::close(jobs[0]);
+			::close(jobs[1]);
+			break;
+		}
+
+		pid_t pid = ::fork();
+		if(pid == 0)
+		{
+			// In the child, which mustn't clean up anything
+			// belonging to the parent, such as its connection
+			// to the store, so it leaves with _exit(). It
+			// mustn't keep the other children's pipes open
+			// either, or they'd never see them closed.
+			::close(jobs[1]);
+			::close(results[0]);
+			for(std::vector<Worker>::iterator w = mWorkers.begin();
+				w != mWorkers.end(); w++)
+			{
+				::close(w->mJobFd);
+				::close(w->mResultFd);
+			}
+
+			try
+			{
+				RunWorker(rContext, rateEach, jobs[0],
+					results[1]);
+			}
+			catch(...)
+			{
+				::_exit(1);
+			}
+			::_exit(0);
+		}
+
+		::close(jobs[0]);
+		::close(results[1]);
+
+		if(pid == -1)
+		{
+			BOX_LOG_SYS_WARNING("Failed to start upload process");
+			::close(jobs[1]);
+			::close(results[0]);
+			break;
+		}
+
+		Worker worker;
+		worker.mPid = pid;
+		worker.mJobFd = jobs[1];
+		worker.mResultFd = results[0];
+		worker.mJobID = 0;
+		mWorkers.push_back(worker);
+	}
+
+	BOX_TRACE("Started " << mWorkers.size() << " processes to upload "
+		"files");
+#endif // !WIN32
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::Stop()
+//		Purpose: Stop the processes and wait for them to finish.
+//			 Idle ones log out of the store when their queue is
+//			 closed. Busy ones are working on files which will
+//			 never be added, so they're killed, and the store
+//			 throws away what they'd sent.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::Stop()
+{
+#ifndef WIN32
+	for(std::vector<Worker>::iterator i = mWorkers.begin();
+		i != mWorkers.end(); i++)
+	{
+		::close(i->mJobFd);
+		::close(i->mResultFd);
+
+		if(i->mJobID != 0)
+		{
+			::kill(i->mPid, SIGKILL);
+		}
+
+		int status;
+		while(::waitpid(i->mPid, &status, 0) == -1 && errno == EINTR)
+		{
+			// interrupted by a signal, try again
+		}
+	}
+#endif // !WIN32
+
+	mWorkers.clear();
+	mQueuedJobs.clear();
+	mResults.clear();
+	mForgottenJobs.clear();
+	mStagingSessionID = 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::SetSchedule(Order, int64_t)
+//		Purpose: Choose the order in which queued files are given
+//			 to the children. If LargeFileSize is more than zero,
+//			 files of at least that size aren't given to the last
+//			 idle child, so that however many large files there
+//			 are, small ones can still get past them.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::SetSchedule(Order JobOrder, int64_t LargeFileSize)
+{
+	mOrder = JobOrder;
+	mLargeFileSize = LargeFileSize;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::GetNamedOrder(
+//			 const std::string &, Order &)
+//		Purpose: Convert the name of an order, as used in the
+//			 configuration file, into an Order. Returns false if
+//			 the name isn't known.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientUploadPool::GetNamedOrder(const std::string &rName,
+	Order &rOrder)
+{
+	if(rName == "found")
+	{
+		rOrder = Order_Found;
+	}
+	else if(rName == "smallest")
+	{
+		rOrder = Order_SmallestFirst;
+	}
+	else if(rName == "oldest")
+	{
+		rOrder = Order_OldestFirst;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::Submit(const Job &)
+//		Purpose: Queue a file for a child to stage, returning the ID
+//			 to collect the result with. If there are no children
+//			 left, the result is a failure, ready straight away.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int BackupClientUploadPool::Submit(const Job &rJob)
+{
+	int jobID = mNextJobID++;
+	mQueuedJobs.push_back(std::pair<int, Job>(jobID, rJob));
+	StartJobs();
+	return jobID;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::GetResult(int, Result &, int)
+//		Purpose: Wait up to TimeoutMS for a job to finish, returning
+//			 false if it hasn't. Children which finish other jobs
+//			 meanwhile are given the next ones in the queue.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientUploadPool::GetResult(int JobID, Result &rResultOut,
+	int TimeoutMS)
+{
+#ifndef WIN32
+	bool waited = false;
+	while(true)
+	{
+		std::map<int, Result>::iterator found(mResults.find(JobID));
+		if(found != mResults.end())
+		{
+			rResultOut = found->second;
+			mResults.erase(found);
+			return true;
+		}
+
+		if(waited)
+		{
+			return false;
+		}
+
+		if(!WaitForWorkers(TimeoutMS))
+		{
+			// Nothing will ever finish it
+			SetResult(JobID, Result());
+			continue;
+		}
+		waited = true;
+	}
+#else // WIN32
+	rResultOut = Result();
+	return true;
+#endif // !WIN32
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::GetAnyResult(Result &, int)
+//		Purpose: Wait up to TimeoutMS for any job to finish,
+//			 returning the ID of the earliest one submitted
+//			 which has, or zero if none has.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int BackupClientUploadPool::GetAnyResult(Result &rResultOut, int TimeoutMS)
+{
+#ifndef WIN32
+	bool waited = false;
+	while(true)
+	{
+		if(!mResults.empty())
+		{
+			std::map<int, Result>::iterator first(mResults.begin());
+			int jobID = first->first;
+			rResultOut = first->second;
+			mResults.erase(first);
+			return jobID;
+		}
+
+		if(waited || !WaitForWorkers(TimeoutMS))
+		{
+			return 0;
+		}
+		waited = true;
+	}
+#else // WIN32
+	return 0;
+#endif // !WIN32
+}
+
+#ifndef WIN32
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::WaitForWorkers(int)
+//		Purpose: Wait up to TimeoutMS for busy children to finish
+//			 their jobs, collecting the results of any which do
+//			 and giving them the next ones in the queue. Returns
+//			 false without waiting if no children are busy.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientUploadPool::WaitForWorkers(int TimeoutMS)
+{
+	std::vector<struct pollfd> p;
+	std::vector<size_t> busy;
+	for(size_t i = 0; i < mWorkers.size(); i++)
+	{
+		if(mWorkers[i].mJobID != 0)
+		{
+			struct pollfd pfd;
+			pfd.fd = mWorkers[i].mResultFd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			p.push_back(pfd);
+			busy.push_back(i);
+		}
+	}
+
+	if(p.empty())
+	{
+		return false;
+	}
+
+	int ready = ::poll(&p[0], p.size(), TimeoutMS);
+	if(ready == -1 && errno != EINTR)
+	{
+		BOX_LOG_SYS_WARNING("Failed to wait for upload processes");
+		ready = 0;
+	}
+
+	// Reading a result may drop a child which has failed, so find
+	// each one again afterwards
+	std::vector<pid_t> finished;
+	for(size_t i = 0; ready > 0 && i < p.size(); i++)
+	{
+		if(p[i].revents != 0)
+		{
+			finished.push_back(mWorkers[busy[i]].mPid);
+		}
+	}
+
+	for(std::vector<pid_t>::iterator f = finished.begin();
+		f != finished.end(); f++)
+	{
+		for(size_t i = 0; i < mWorkers.size(); i++)
+		{
+			if(mWorkers[i].mPid == *f)
+			{
+				ReadResult(mWorkers[i]);
+				break;
+			}
+		}
+	}
+
+	StartJobs();
+	return true;
+}
+
+#endif // !WIN32
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::Forget(int)
+//		Purpose: Drop a job whose result won't be collected
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::Forget(int JobID)
+{
+	if(mResults.erase(JobID) != 0)
+	{
+		return;
+	}
+
+	for(std::deque<std::pair<int, Job> >::iterator i = mQueuedJobs.begin();
+		i != mQueuedJobs.end(); i++)
+	{
+		if(i->first == JobID)
+		{
+			mQueuedJobs.erase(i);
+			return;
+		}
+	}
+
+	for(std::vector<Worker>::iterator i = mWorkers.begin();
+		i != mWorkers.end(); i++)
+	{
+		if(i->mJobID == JobID)
+		{
+			mForgottenJobs.insert(JobID);
+			return;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::StartJobs()
+//		Purpose: Give queued jobs to any idle children
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::StartJobs()
+{
+	while(!mQueuedJobs.empty())
+	{
+		if(mWorkers.empty())
+		{
+			SetResult(mQueuedJobs.front().first, Result());
+			mQueuedJobs.pop_front();
+			continue;
+		}
+
+		Worker *pIdle = NULL;
+		int numIdle = 0;
+		for(std::vector<Worker>::iterator i = mWorkers.begin();
+			i != mWorkers.end(); i++)
+		{
+			if(i->mJobID == 0)
+			{
+				if(pIdle == NULL)
+				{
+					pIdle = &(*i);
+				}
+				numIdle++;
+			}
+		}
+
+		if(pIdle == NULL)
+		{
+			return;
+		}
+
+		size_t chosen = ChooseJob(mQueuedJobs, mOrder, mLargeFileSize,
+			mWorkers.size(), numIdle);
+		if(chosen == mQueuedJobs.size())
+		{
+			return;
+		}
+
+		std::pair<int, Job> next(mQueuedJobs[chosen]);
+		mQueuedJobs.erase(mQueuedJobs.begin() + chosen);
+		SendJob(*pIdle, next.first, next.second);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::ChooseJob(
+//			 const std::deque<std::pair<int, Job> > &, Order,
+//			 int64_t, int, int)
+//		Purpose: Find the queued job which should be given to an
+//			 idle child next, returning its index in rQueue, or
+//			 rQueue.size() if none should be started yet. Jobs
+//			 which are equally good are started in the order
+//			 they were submitted. Large files aren't given to the
+//			 last idle child.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+size_t BackupClientUploadPool::ChooseJob(
+	const std::deque<std::pair<int, Job> > &rQueue, Order JobOrder,
+	int64_t LargeFileSize, int NumWorkers, int NumIdle)
+{
+	// Keep the last idle child for small files
+	bool allowLarge = (LargeFileSize <= 0 || NumWorkers < 2 ||
+		NumIdle > 1);
+	size_t best = rQueue.size();
+
+	for(size_t i = 0; i < rQueue.size(); i++)
+	{
+		const Job &rJob(rQueue[i].second);
+		if(!allowLarge && rJob.mFileSize >= LargeFileSize)
+		{
+			continue;
+		}
+
+		if(best == rQueue.size())
+		{
+			best = i;
+			if(JobOrder == Order_Found)
+			{
+				break;
+			}
+		}
+		else if(JobOrder == Order_SmallestFirst &&
+			rJob.mFileSize < rQueue[best].second.mFileSize)
+		{
+			best = i;
+		}
+		else if(JobOrder == Order_OldestFirst &&
+			rJob.mModTime < rQueue[best].second.mModTime)
+		{
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::SendJob(Worker &, int,
+//			 const Job &)
+//		Purpose: Give a job to an idle child
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::SendJob(Worker &rWorker, int JobID,
+	const Job &rJob)
+{
+	CollectInBufferStream message;
+	Archive archive(message, 0);
+	archive.Write(rJob.mDirectoryID);
+	archive.Write(rJob.mLocalPath);
+	archive.Write(rJob.mLeafName);
+	archive.Write(rJob.mTryDiff);
+	message.SetForReading();
+
+	rWorker.mJobID = JobID;
+	if(!SendMessage(rWorker.mJobFd, message))
+	{
+		WorkerFailed(rWorker);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::ReadResult(Worker &)
+//		Purpose: Collect the result of a busy child's job, which
+//			 is ready to read
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::ReadResult(Worker &rWorker)
+{
+	std::string data;
+	if(!ReceiveMessage(rWorker.mResultFd, data))
+	{
+		WorkerFailed(rWorker);
+		return;
+	}
+
+	Result result;
+	try
+	{
+		MemBlockStream message(data.c_str(), data.size());
+		Archive archive(message, 0);
+		archive.Read(result.mStagedFileID);
+		archive.Read(result.mDiffFromID);
+		archive.Read(result.mIsPatch);
+		archive.Read(result.mBytesToUpload);
+		archive.Read(result.mBytesSent);
+		archive.Read(result.mStopPool);
+	}
+	catch(BoxException &e)
+	{
+		WorkerFailed(rWorker);
+		return;
+	}
+
+	int jobID = rWorker.mJobID;
+	rWorker.mJobID = 0;
+	SetResult(jobID, result);
+
+	if(result.mStopPool)
+	{
+		Abandon();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::WorkerFailed(Worker &)
+//		Purpose: Stop using a child which can't be talked to, and
+//			 fail the job it was working on
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::WorkerFailed(Worker &rWorker)
+{
+	BOX_WARNING("Upload process " << rWorker.mPid << " failed, "
+		"uploading its files directly");
+
+	int jobID = rWorker.mJobID;
+
+#ifndef WIN32
+	::close(rWorker.mJobFd);
+	::close(rWorker.mResultFd);
+	::kill(rWorker.mPid, SIGKILL);
+	int status;
+	while(::waitpid(rWorker.mPid, &status, 0) == -1 && errno == EINTR)
+	{
+		// interrupted by a signal, try again
+	}
+#endif // !WIN32
+
+	for(std::vector<Worker>::iterator i = mWorkers.begin();
+		i != mWorkers.end(); i++)
+	{
+		if(&(*i) == &rWorker)
+		{
+			mWorkers.erase(i);
+			break;
+		}
+	}
+
+	SetResult(jobID, Result());
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::Abandon()
+//		Purpose: Stop all the children, as none of them will be able
+//			 to stage anything, failing their jobs and any which
+//			 are queued, so that the sync uploads them itself,
+//			 and any more files which it finds.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::Abandon()
+{
+	BOX_WARNING("Upload processes can't stage files on the store, "
+		"uploading the rest one at a time");
+
+#ifndef WIN32
+	for(std::vector<Worker>::iterator i = mWorkers.begin();
+		i != mWorkers.end(); i++)
+	{
+		::close(i->mJobFd);
+		::close(i->mResultFd);
+		::kill(i->mPid, SIGKILL);
+
+		int status;
+		while(::waitpid(i->mPid, &status, 0) == -1 && errno == EINTR)
+		{
+			// interrupted by a signal, try again
+		}
+
+		if(i->mJobID != 0)
+		{
+			SetResult(i->mJobID, Result());
+		}
+	}
+#endif // !WIN32
+
+	mWorkers.clear();
+
+	// With no children left, this fails the queued jobs
+	StartJobs();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::SetResult(int, const Result &)
+//		Purpose: Keep a job's result until it's collected, unless
+//			 it's been forgotten
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::SetResult(int JobID, const Result &rResult)
+{
+	if(mForgottenJobs.erase(JobID) == 0)
+	{
+		mResults[JobID] = rResult;
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::SendMessage(int, IOStream &)
+//		Purpose: Write a length and a message to a pipe, returning
+//			 false if the other end has gone
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientUploadPool::SendMessage(int Fd, IOStream &rMessage)
+{
+	std::string data;
+	char buffer[4096];
+	int bytes;
+	while((bytes = rMessage.Read(buffer, sizeof(buffer))) > 0)
+	{
+		data.append(buffer, bytes);
+	}
+
+	uint32_t size = data.size();
+	data.insert(0, (const char *)&size, sizeof(size));
+
+	for(size_t done = 0; done < data.size(); )
+	{
+		int written = ::write(Fd, data.c_str() + done,
+			data.size() - done);
+		if(written == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(written <= 0)
+		{
+			return false;
+		}
+		done += written;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::ReceiveMessage(int,
+//			 std::string &)
+//		Purpose: Read a message written by SendMessage(), returning
+//			 false if the other end has gone
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupClientUploadPool::ReceiveMessage(int Fd, std::string &rMessageOut)
+{
+	uint32_t size = 0;
+	std::string data;
+	size_t wanted = sizeof(size);
+	bool haveSize = false;
+
+	while(true)
+	{
+		char buffer[4096];
+		size_t toRead = wanted - data.size();
+		if(toRead > sizeof(buffer))
+		{
+			toRead = sizeof(buffer);
+		}
+
+		if(toRead > 0)
+		{
+			int bytes = ::read(Fd, buffer, toRead);
+			if(bytes == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			else if(bytes <= 0)
+			{
+				return false;
+			}
+			data.append(buffer, bytes);
+		}
+
+		if(data.size() < wanted)
+		{
+			continue;
+		}
+
+		if(haveSize)
+		{
+			rMessageOut = data;
+			return true;
+		}
+
+		::memcpy(&size, data.c_str(), sizeof(size));
+		if(size > UPLOAD_POOL_MAX_MESSAGE_SIZE)
+		{
+			return false;
+		}
+
+		haveSize = true;
+		wanted = size;
+		data.clear();
+	}
+}
+
+#ifndef WIN32
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupClientUploadPool::RunWorker(BackupClientContext &,
+//			 int64_t, int, int)
+//		Purpose: In a child, stage the files it's given until the
+//			 queue is closed. Anything which goes wrong just fails
+//			 the file, which the sync then uploads itself.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupClientUploadPool::RunWorker(BackupClientContext &rContext,
+	int64_t MaxUploadRate, int JobFd, int ResultFd)
+{
+	std::auto_ptr<BackupProtocolCallable> apConnection;
+
+	while(true)
+	{
+		std::string data;
+		if(!ReceiveMessage(JobFd, data))
+		{
+			// The parent has finished with us
+			break;
+		}
+
+		Job job;
+		MemBlockStream jobMessage(data.c_str(), data.size());
+		Archive jobArchive(jobMessage, 0);
+		jobArchive.Read(job.mDirectoryID);
+		jobArchive.Read(job.mLocalPath);
+		jobArchive.Read(job.mLeafName);
+		jobArchive.Read(job.mTryDiff);
+
+		Result result;
+		try
+		{
+			if(!apConnection.get())
+			{
+				apConnection = rContext.OpenReadOnlyConnection();
+			}
+			BackupProtocolCallable &connection(*apConnection);
+
+			BackupStoreFilenameClear storeFilename(job.mLeafName);
+			std::auto_ptr<BackupStoreFileEncodeStream> apStreamToUpload;
+
+			if(job.mTryDiff)
+			{
+				std::auto_ptr<BackupProtocolSuccess> getBlockIndex(
+					connection.QueryGetBlockIndexByName(
+						job.mDirectoryID, storeFilename));
+				result.mDiffFromID = getBlockIndex->GetObjectID();
+
+				if(result.mDiffFromID != 0)
+				{
+					std::auto_ptr<IOStream> blockIndexStream(
+						connection.ReceiveStream());
+					UploadWorkerDiffTimer diffTimer(connection,
+						rContext.GetKeepAliveTime(),
+						rContext.GetMaximumDiffingTime());
+					bool isCompletelyDifferent = false;
+
+					apStreamToUpload = BackupStoreFile::EncodeFileDiff(
+						job.mLocalPath, job.mDirectoryID,
+						storeFilename, result.mDiffFromID,
+						*blockIndexStream,
+						connection.GetTimeout(),
+						&diffTimer,
+						0 /* not interested in the modification time */,
+						&isCompletelyDifferent);
+
+					if(isCompletelyDifferent)
+					{
+						result.mDiffFromID = 0;
+					}
+					result.mIsPatch = true;
+					result.mBytesToUpload =
+						apStreamToUpload->GetBytesToUpload();
+				}
+			}
+
+			if(!apStreamToUpload.get())
+			{
+				apStreamToUpload = BackupStoreFile::EncodeFile(
+					job.mLocalPath, job.mDirectoryID,
+					storeFilename);
+			}
+
+			std::auto_ptr<IOStream> apWrappedStream;
+			if(MaxUploadRate > 0)
+			{
+				apWrappedStream.reset(new RateLimitingStream(
+					*apStreamToUpload, MaxUploadRate));
+			}
+			else
+			{
+				// So that we keep the encode stream, and can
+				// ask it how much was sent
+				apWrappedStream.reset(new BufferedStream(
+					*apStreamToUpload));
+			}
+
+			std::auto_ptr<BackupProtocolSuccess> staged(
+				connection.QueryStageFile(mStagingSessionID,
+					job.mDirectoryID, apWrappedStream));
+			result.mStagedFileID = staged->GetObjectID();
+			result.mBytesSent = apStreamToUpload->GetTotalBytesSent();
+		}
+		catch(BoxException &e)
+		{
+			BOX_WARNING("Failed to stage " << job.mLocalPath <<
+				", leaving it to the main connection: " <<
+				e.what());
+			result = Result();
+
+			// If we couldn't log in, or the store hung up rather
+			// than rejecting the file, the other files would
+			// fail in the same way
+			result.mStopPool = (!apConnection.get() ||
+				(e.GetType() == ConnectionException::ExceptionType &&
+				 e.GetSubType() != ConnectionException::Protocol_UnexpectedReply));
+
+			// Don't trust the connection after an error
+			apConnection.reset();
+		}
+
+		CollectInBufferStream resultMessage;
+		Archive resultArchive(resultMessage, 0);
+		resultArchive.Write(result.mStagedFileID);
+		resultArchive.Write(result.mDiffFromID);
+		resultArchive.Write(result.mIsPatch);
+		resultArchive.Write(result.mBytesToUpload);
+		resultArchive.Write(result.mBytesSent);
+		resultArchive.Write(result.mStopPool);
+		resultMessage.SetForReading();
+
+		if(!SendMessage(ResultFd, resultMessage))
+		{
+			break;
+		}
+	}
+
+	if(apConnection.get())
+	{
+		try
+		{
+			apConnection->QueryFinished();
+		}
+		catch(BoxException &e)
+		{
+			// The store will notice that we've gone anyway
+		}
+	}
+}
+
+#endif // !WIN32
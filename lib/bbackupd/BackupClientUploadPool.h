@@ -0,0 +1,161 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    BackupClientUploadPool.h
+//		Purpose: Pool of processes which encode and send files to
+//			 the store over their own connections
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef BACKUPCLIENTUPLOADPOOL__H
+#define BACKUPCLIENTUPLOADPOOL__H
+
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "BoxTime.h"
+
+class BackupClientContext;
+class IOStream;
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    BackupClientUploadPool
+//		Purpose: Uploads files in several child processes while the
+//			 sync carries on, so that more than one file can be
+//			 on its way to the store at once. Each child logs in
+//			 to the store read-only, diffs or encodes the files
+//			 it's given, and stages them on the store. Staged
+//			 files don't change anything until the sync adds
+//			 them over its own connection, which holds the
+//			 write lock. Files are given to the children in the
+//			 order they were found, unless another order is
+//			 chosen, such as smallest first so that as many
+//			 files as possible are backed up soon. A file which
+//			 can't be staged is left for the sync to upload
+//			 itself.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class BackupClientUploadPool
+{
+public:
+	BackupClientUploadPool(int NumProcesses);
+	~BackupClientUploadPool();
+private:
+	// no copying
+	BackupClientUploadPool(const BackupClientUploadPool &);
+	BackupClientUploadPool &operator=(const BackupClientUploadPool &);
+public:
+
+	// The order in which queued files are given to the children
+	enum Order
+	{
+		Order_Found = 0,
+		Order_SmallestFirst,
+		Order_OldestFirst
+	};
+
+	class Job
+	{
+	public:
+		Job()
+		: mDirectoryID(0),
+		  mTryDiff(false),
+		  mFileSize(0),
+		  mModTime(0)
+		{ }
+		int64_t mDirectoryID;
+		std::string mLocalPath;
+		std::string mLeafName;
+		// Whether there may be an old version to diff against
+		bool mTryDiff;
+		// Only used to schedule the job, so not sent to the child
+		int64_t mFileSize;
+		box_time_t mModTime;
+	};
+
+	class Result
+	{
+	public:
+		Result()
+		: mStagedFileID(0),
+		  mDiffFromID(0),
+		  mIsPatch(false),
+		  mBytesToUpload(0),
+		  mBytesSent(0),
+		  mStopPool(false)
+		{ }
+		// Zero if the file wasn't staged
+		int64_t mStagedFileID;
+		int64_t mDiffFromID;
+		// Whether it was diffed, even if nothing matched
+		bool mIsPatch;
+		int64_t mBytesToUpload;
+		int64_t mBytesSent;
+		// Set if the child won't be able to stage anything else
+		// either, so the sync should upload the rest itself
+		bool mStopPool;
+	};
+
+	void Start(BackupClientContext &rContext, int64_t MaxUploadRate);
+	void Stop();
+	void SetSchedule(Order JobOrder, int64_t LargeFileSize);
+
+	bool IsRunning() const {return !mWorkers.empty();}
+	int GetNumProcesses() const {return mWorkers.size();}
+	Order GetOrder() const {return mOrder;}
+
+	int Submit(const Job &rJob);
+	bool GetResult(int JobID, Result &rResultOut, int TimeoutMS);
+	int GetAnyResult(Result &rResultOut, int TimeoutMS);
+	void Forget(int JobID);
+
+	static bool GetNamedOrder(const std::string &rName, Order &rOrder);
+	static size_t ChooseJob(const std::deque<std::pair<int, Job> > &rQueue,
+		Order JobOrder, int64_t LargeFileSize, int NumWorkers,
+		int NumIdle);
+
+private:
+	class Worker
+	{
+	public:
+		pid_t mPid;
+		int mJobFd;
+		int mResultFd;
+		// The job it's working on, or zero if it's idle
+		int mJobID;
+	};
+
+	void StartJobs();
+	bool WaitForWorkers(int TimeoutMS);
+	void SendJob(Worker &rWorker, int JobID, const Job &rJob);
+	void ReadResult(Worker &rWorker);
+	void WorkerFailed(Worker &rWorker);
+	void Abandon();
+	void SetResult(int JobID, const Result &rResult);
+	void RunWorker(BackupClientContext &rContext, int64_t MaxUploadRate,
+		int JobFd, int ResultFd);
+
+	static bool SendMessage(int Fd, IOStream &rMessage);
+	static bool ReceiveMessage(int Fd, std::string &rMessageOut);
+
+	int mMaxProcesses;
+	int mNextJobID;
+	int64_t mStagingSessionID;
+	Order mOrder;
+	int64_t mLargeFileSize;
+	std::vector<Worker> mWorkers;
+	std::deque<std::pair<int, Job> > mQueuedJobs;
+	std::map<int, Result> mResults;
+	std::set<int> mForgottenJobs;
+};
+
+#endif // BACKUPCLIENTUPLOADPOOL__H
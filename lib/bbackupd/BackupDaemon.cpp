@@ -56,12 +56,17 @@
 #include "autogen_CommonException.h"
 #include "autogen_ConversionException.h"
 #include "Archive.h"
+#include "BackupClientChangeJournal.h"
 #include "BackupClientContext.h"
 #include "BackupClientCryptoKeys.h"
+#include "BackupClientDirectoryReader.h"
 #include "BackupClientDirectoryRecord.h"
 #include "BackupClientFileAttributes.h"
 #include "BackupClientInodeToIDMap.h"
 #include "BackupClientMakeExcludeList.h"
+#include "BackupClientScanAhead.h"
+#include "BackupClientUploadPool.h"
+#include "BackupClientStoreObjectInfo.h"
 #include "BackupConstants.h"
 #include "BackupDaemon.h"
 #include "BackupDaemonConfigVerify.h"
@@ -71,6 +76,7 @@
 #include "BackupStoreFile.h"
 #include "BackupStoreFilenameClear.h"
 #include "BannerText.h"
+#include "CollectInBufferStream.h"
 #include "Conversion.h"
 #include "ExcludeList.h"
 #include "FileStream.h"
@@ -208,6 +214,20 @@ static const time_t MAX_SLEEP_TIME = 1024;
 // This prevents repetative cycles of load on the server
 #define		SYNC_PERIOD_RANDOM_EXTRA_TIME_SHIFT_BY	6
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CompareUploadPriority(const Location *,
+//			 const Location *)
+//		Purpose: Orders locations by descending UploadPriority
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static bool CompareUploadPriority(const Location *pA, const Location *pB)
+{
+	return pA->mUploadPriority > pB->mUploadPriority;
+}
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -219,6 +239,7 @@ static const time_t MAX_SLEEP_TIME = 1024;
 BackupDaemon::BackupDaemon()
 	: mState(BackupDaemon::State_Initialising),
 	  mDeleteRedundantLocationsAfter(0),
+	  mDirectoryScanMethod(BackupClientDirectoryReader::ReadDir),
 	  mLastNotifiedEvent(SysadminNotifier::MAX),
 	  mDeleteUnusedRootDirEntriesAfter(0),
 	  mClientStoreMarker(BackupClientContext::ClientStoreMarker_NotKnown),
@@ -379,6 +400,39 @@ void BackupDaemon::SetupInInitialProcess()
 			);
 	}
 #endif
+
+	SetDirectoryScanMethod(config.GetKeyValue("DirectoryScanMethod"));
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupDaemon::SetDirectoryScanMethod(
+//			 const std::string &)
+//		Purpose: Choose the method to read directories with, from
+//			 its name in the configuration, warning if it can't
+//			 be used
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+void BackupDaemon::SetDirectoryScanMethod(const std::string &rName)
+{
+	mDirectoryScanMethodName = rName;
+
+	if(!BackupClientDirectoryReader::GetNamedMethod(rName,
+		mDirectoryScanMethod))
+	{
+		BOX_WARNING("Unknown DirectoryScanMethod '" << rName <<
+			"', using readdir instead");
+		mDirectoryScanMethod = BackupClientDirectoryReader::ReadDir;
+	}
+	else if(!BackupClientDirectoryReader::IsMethodSupported(
+		mDirectoryScanMethod))
+	{
+		BOX_WARNING("DirectoryScanMethod '" << rName << "' is not "
+			"supported on this platform, using readdir instead");
+		mDirectoryScanMethod = BackupClientDirectoryReader::ReadDir;
+	}
 }
 
 
@@ -401,9 +455,15 @@ void BackupDaemon::DeleteAllLocations()
 
 	// Clear the contents of the map, so it is empty
 	mLocations.clear();
+
+	// No records are left to read from the old state file
+	mapStoreObjectInfo.reset();
 	
 	// And delete everything from the associated mount vector
 	mIDMapMounts.clear();
+
+	// The records of what's changed went with them
+	mapChangeJournal.reset();
 }
 
 #ifdef WIN32
@@ -653,6 +713,13 @@ void BackupDaemon::Run2()
 		bool doSync = false;
 		bool mDoSyncForcedByCommand = false;
 
+		// Collect the changes made since we last looked, before
+		// the kernel runs out of space to hold them
+		if(mapChangeJournal.get())
+		{
+			mapChangeJournal->ReadEvents();
+		}
+
 		// Check whether we should be stopping, and if so,
 		// don't hang around waiting on the command socket.
 		if(StopRun())
@@ -912,6 +979,9 @@ void BackupDaemon::ResetCachedState()
 	mClientStoreMarker = BackupClientContext::ClientStoreMarker_NotKnown;	// no store marker, so download everything
 	DeleteAllLocations();
 	DeleteAllIDMaps();
+
+	// Anything written of the new state file is no use either
+	mapStoreObjectInfoWriter.reset();
 }
 
 std::auto_ptr<BackupClientContext> BackupDaemon::GetNewContext
@@ -958,6 +1028,17 @@ std::auto_ptr<BackupClientContext> BackupDaemon::RunSyncNow()
 
 	const Configuration &conf(GetConfiguration());
 
+	// Write the new one as the directories are synced, so that there's
+	// not much left to do when the sync finishes
+	mapStoreObjectInfoWriter.reset();
+	if(conf.KeyExists("StoreObjectInfoFile") &&
+		conf.GetKeyValue("StoreObjectInfoFile").size() > 0)
+	{
+		mapStoreObjectInfoWriter.reset(
+			new BackupClientStoreObjectInfoWriter(
+				conf.GetKeyValue("StoreObjectInfoFile")));
+	}
+
 	std::auto_ptr<FileLogger> fileLogger;
 
 	if (conf.KeyExists("LogFile"))
@@ -1085,6 +1166,33 @@ std::auto_ptr<BackupClientContext> BackupDaemon::RunSyncNow()
 		conf.GetKeyValueInt("DiffingUploadSizeThreshold");
 	params.mMaxFileTimeInFuture =
 		SecondsToBoxTime(conf.GetKeyValueInt("MaxFileTimeInFuture"));
+	params.mpStoreObjectInfoWriter = mapStoreObjectInfoWriter.get();
+
+	// Skip the directories in which nothing has changed, if we're
+	// keeping track of that
+	if(conf.GetKeyValueBool("ChangeJournal"))
+	{
+		if(!mapChangeJournal.get())
+		{
+			mapChangeJournal.reset(new BackupClientChangeJournal(
+				SecondsToBoxTime(conf.GetKeyValueInt(
+					"ChangeJournalFullScanInterval"))));
+		}
+		mapChangeJournal->StartSync();
+		params.mpChangeJournal = mapChangeJournal.get();
+	}
+	else
+	{
+		mapChangeJournal.reset();
+	}
+
+	// How to read the directories, checked again only if the
+	// configuration has been reloaded with a different one
+	if(conf.GetKeyValue("DirectoryScanMethod") != mDirectoryScanMethodName)
+	{
+		SetDirectoryScanMethod(conf.GetKeyValue("DirectoryScanMethod"));
+	}
+	params.mDirectoryScanMethod = mDirectoryScanMethod;
 	mNumFilesUploaded = 0;
 	mNumDirsCreated = 0;
 
@@ -1151,10 +1259,41 @@ std::auto_ptr<BackupClientContext> BackupDaemon::RunSyncNow()
 #endif
 #endif
 
+	// Processes to read each location ahead of the sync, if wanted
+	BackupClientScanAhead scanAhead(
+		conf.GetKeyValueInt("DirectoryScanProcesses"));
+
+	// Processes to upload files over their own connections, if wanted.
+	// Started before the scan ahead, so that they don't share its queue.
+	BackupClientUploadPool uploadPool(
+		conf.GetKeyValueInt("UploadProcesses"));
+	uploadPool.Start(*mapClientContext, params.mMaxUploadRate);
+	params.mpUploadPool = &uploadPool;
+	params.mMaxUploadQueueMemory =
+		(int64_t)conf.GetKeyValueInt("UploadQueueMemory") * 1024;
+
+	{
+		BackupClientUploadPool::Order order;
+		std::string orderName(conf.GetKeyValue("UploadOrder"));
+		if(!BackupClientUploadPool::GetNamedOrder(orderName, order))
+		{
+			BOX_WARNING("Unknown UploadOrder '" << orderName <<
+				"', uploading files in the order found");
+			order = BackupClientUploadPool::Order_Found;
+		}
+		uploadPool.SetSchedule(order,
+			(int64_t)conf.GetKeyValueInt("LargeUploadSize") * 1024);
+	}
+
+	// Sync the locations with the highest priority first, and the
+	// rest in the order they're configured
+	Locations locationsToSync(mLocations);
+	locationsToSync.sort(CompareUploadPriority);
+
 	// Go through the records, syncing them
 	for(Locations::const_iterator 
-		i(mLocations.begin()); 
-		i != mLocations.end(); ++i)
+		i(locationsToSync.begin()); 
+		i != locationsToSync.end(); ++i)
 	{
 		// Set current and new ID map pointers
 		// in the context
@@ -1184,14 +1323,32 @@ std::auto_ptr<BackupClientContext> BackupDaemon::RunSyncNow()
 #endif
 #endif
 		BOX_INFO("backup for location '" << (*i)->mName << "' on directory '" << (*i)->mPath << "'");
+		scanAhead.Start(locationPath, (*i)->mapExcludeDirs.get());
 		(*i)->mapDirectoryRecord->SyncDirectory(params,
 			BackupProtocolListDirectory::RootDirectory,
 			locationPath, std::string("/") + (*i)->mName, **i);
+		scanAhead.Stop();
+
+		if(mapStoreObjectInfoWriter.get())
+		{
+			(*i)->mapDirectoryRecord->Save(
+				*mapStoreObjectInfoWriter);
+		}
+
+		// Keep the ID map entries for the directories skipped because
+		// nothing in them had changed
+		mNewIDMaps[(*i)->mIDMapIndex]->CopyEntriesInDirectories(
+			*mCurrentIDMaps[(*i)->mIDMapIndex],
+			params.mUnchangedDirectoryIDs);
+		params.mUnchangedDirectoryIDs.clear();
 
 		// Unset exclude lists (just in case)
 		mapClientContext->SetExcludeLists(0, 0);
 	}
 
+	uploadPool.Stop();
+	params.mpUploadPool = NULL;
+
 	// Perform any deletions required -- these are
 	// delayed until the end to allow renaming to 
 	// happen neatly.
@@ -1206,6 +1363,12 @@ std::auto_ptr<BackupClientContext> BackupDaemon::RunSyncNow()
 	// Get the new store marker
 	mClientStoreMarker = mapClientContext->GetClientStoreMarker();
 	mStorageLimitExceeded = mapClientContext->StorageLimitExceeded();
+
+	if(mapChangeJournal.get())
+	{
+		// If the store was full, the changes weren't all uploaded
+		mapChangeJournal->FinishSync(!mStorageLimitExceeded);
+	}
 	mReadErrorsOnFilesystemObjects |=
 		params.mReadErrorsOnFilesystemObjects;
 
@@ -2729,6 +2892,7 @@ void BackupDaemon::SetupLocations(BackupClientContext &rClientContext, const Con
 		// Read the exclude lists from the Configuration
 		pLoc->mapExcludeFiles.reset(BackupClientMakeExcludeList_Files(rConfig));
 		pLoc->mapExcludeDirs.reset(BackupClientMakeExcludeList_Dirs(rConfig));
+		pLoc->mUploadPriority = rConfig.GetKeyValueInt("UploadPriority");
 
 		// Push it back on the vector of locations
 		mLocations.push_back(pLoc);
@@ -3325,17 +3489,14 @@ BackupDaemon::CommandSocketInfo::~CommandSocketInfo()
 //			 box_time_t theNextSyncTime)
 //		Purpose: Serializes remote directory and file information
 //			 into a stream of bytes, using an Archive
-//			 abstraction.
+//			 abstraction. The directory records synced have
+//			 been written already, so this writes any others,
+//			 and the rest of the state after them.
 //		Created: 2005/04/11
 //
 // --------------------------------------------------------------------------
-
-static const int STOREOBJECTINFO_MAGIC_ID_VALUE = 0x7777525F;
-static const std::string STOREOBJECTINFO_MAGIC_ID_STRING = "BBACKUPD-STATE";
-static const int STOREOBJECTINFO_VERSION = 2;
-
 bool BackupDaemon::SerializeStoreObjectInfo(box_time_t theLastSyncTime,
-	box_time_t theNextSyncTime) const
+	box_time_t theNextSyncTime)
 {
 	if(!GetConfiguration().KeyExists("StoreObjectInfoFile"))
 	{
@@ -3354,15 +3515,17 @@ bool BackupDaemon::SerializeStoreObjectInfo(box_time_t theLastSyncTime,
 
 	try
 	{
-		FileStream aFile(StoreObjectInfoFile.c_str(), 
-			O_WRONLY | O_CREAT | O_TRUNC);
-		created = true;
+		std::auto_ptr<BackupClientStoreObjectInfoWriter> apWriter(
+			mapStoreObjectInfoWriter);
+		if(!apWriter.get())
+		{
+			apWriter.reset(new BackupClientStoreObjectInfoWriter(
+				StoreObjectInfoFile));
+		}
 
-		Archive anArchive(aFile, 0);
+		CollectInBufferStream trailer;
+		Archive anArchive(trailer, 0);
 
-		anArchive.Write(STOREOBJECTINFO_MAGIC_ID_VALUE);
-		anArchive.Write(STOREOBJECTINFO_MAGIC_ID_STRING); 
-		anArchive.Write(STOREOBJECTINFO_VERSION);
 		anArchive.Write(GetLoadedConfigModifiedTime());
 		anArchive.Write(mClientStoreMarker);
 		anArchive.Write(theLastSyncTime);
@@ -3378,7 +3541,7 @@ bool BackupDaemon::SerializeStoreObjectInfo(box_time_t theLastSyncTime,
 			i != mLocations.end(); i++)
 		{
 			ASSERT(*i);
-			(*i)->Serialize(anArchive);
+			(*i)->Serialize(anArchive, *apWriter);
 		}
 
 		//
@@ -3410,10 +3573,15 @@ bool BackupDaemon::SerializeStoreObjectInfo(box_time_t theLastSyncTime,
 		//
 		//
 		//
-		aFile.Close();
-		BOX_INFO("Saved store object info file version " <<
-			STOREOBJECTINFO_VERSION << " (" <<
-			StoreObjectInfoFile << ")");
+		trailer.SetForReading();
+		created = apWriter->Commit(trailer);
+
+		if(created)
+		{
+			BOX_INFO("Saved store object info file version " <<
+				STOREOBJECTINFO_VERSION << " (" <<
+				StoreObjectInfoFile << ")");
+		}
 	}
 	catch(std::exception &e)
 	{
@@ -3515,7 +3683,21 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 			int iVersion = 0;
 			anArchive.Read(iVersion);
 
-			if(iVersion != STOREOBJECTINFO_VERSION)
+			std::auto_ptr<BackupClientStoreObjectInfo> apInfo;
+			std::auto_ptr<IOStream> apTrailer;
+			std::auto_ptr<Archive> apTrailerArchive;
+
+			if(iVersion == STOREOBJECTINFO_VERSION)
+			{
+				// The rest follows the directory records,
+				// which are read from the file as they're
+				// needed
+				apInfo.reset(new BackupClientStoreObjectInfo(
+					StoreObjectInfoFile));
+				apTrailer = apInfo->GetTrailer();
+				apTrailerArchive.reset(new Archive(*apTrailer, 0));
+			}
+			else if(iVersion != STOREOBJECTINFO_VERSION_ARCHIVE)
 			{
 				BOX_WARNING(BOX_FILE_MESSAGE(StoreObjectInfoFile,
 					"Store object info file version " <<
@@ -3523,12 +3705,15 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 				return false;
 			}
 
+			Archive &rArchive(apTrailerArchive.get() ?
+				*apTrailerArchive : anArchive);
+
 			//
 			// check if this state file is even valid 
 			// for the loaded bbackupd.conf file
 			//
 			box_time_t lastKnownConfigModTime;
-			anArchive.Read(lastKnownConfigModTime);
+			rArchive.Read(lastKnownConfigModTime);
 
 			if(lastKnownConfigModTime != GetLoadedConfigModifiedTime())
 			{
@@ -3541,15 +3726,15 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 			//
 			// this is it, go at it
 			//
-			anArchive.Read(mClientStoreMarker);
-			anArchive.Read(theLastSyncTime);
-			anArchive.Read(theNextSyncTime);
+			rArchive.Read(mClientStoreMarker);
+			rArchive.Read(theLastSyncTime);
+			rArchive.Read(theNextSyncTime);
 
 			//
 			//
 			//
 			int64_t iCount = 0;
-			anArchive.Read(iCount);
+			rArchive.Read(iCount);
 
 			for(int v = 0; v < iCount; v++)
 			{
@@ -3559,7 +3744,7 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 					throw std::bad_alloc();
 				}
 
-				pLocation->Deserialize(anArchive);
+				pLocation->Deserialize(rArchive, apInfo.get());
 				mLocations.push_back(pLocation);
 			}
 
@@ -3567,12 +3752,12 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 			//
 			//
 			iCount = 0;
-			anArchive.Read(iCount);
+			rArchive.Read(iCount);
 
 			for(int v = 0; v < iCount; v++)
 			{
 				std::string strItem;
-				anArchive.Read(strItem);
+				rArchive.Read(strItem);
 
 				mIDMapMounts.push_back(strItem);
 			}
@@ -3581,26 +3766,27 @@ bool BackupDaemon::DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 			//
 			//
 			iCount = 0;
-			anArchive.Read(iCount);
+			rArchive.Read(iCount);
 
 			for(int v = 0; v < iCount; v++)
 			{
 				int64_t anId;
-				anArchive.Read(anId);
+				rArchive.Read(anId);
 
 				std::string aName;
-				anArchive.Read(aName);
+				rArchive.Read(aName);
 
 				mUnusedRootDirEntries.push_back(std::pair<int64_t, std::string>(anId, aName));
 			}
 
 			if (iCount > 0)
-				anArchive.Read(mDeleteUnusedRootDirEntriesAfter);
+				rArchive.Read(mDeleteUnusedRootDirEntriesAfter);
 
 			//
 			//
 			//
 			aFile.Close();
+			mapStoreObjectInfo = apInfo;
 
 			BOX_INFO(BOX_FILE_MESSAGE(StoreObjectInfoFile,
 				"Loaded store object info file version " << iVersion));
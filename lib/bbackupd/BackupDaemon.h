@@ -41,6 +41,7 @@
 
 #define COMMAND_SOCKET_POLL_INTERVAL 1000
 
+class BackupClientChangeJournal;
 class BackupClientDirectoryRecord;
 class BackupClientContext;
 class Configuration;
@@ -64,13 +65,13 @@ public:
 	BackupDaemon();
 	~BackupDaemon();
 
-private:
 	// methods below do partial (specialized) serialization of 
-	// client state only
+	// client state only, public so that tests can use them
 	bool SerializeStoreObjectInfo(box_time_t theLastSyncTime,
-		box_time_t theNextSyncTime) const;
+		box_time_t theNextSyncTime);
 	bool DeserializeStoreObjectInfo(box_time_t & theLastSyncTime,
 		box_time_t & theNextSyncTime);
+private:
 	bool DeleteStoreObjectInfo() const;
 	BackupDaemon(const BackupDaemon &);
 
@@ -186,6 +187,7 @@ private:
 	void SendSyncStartOrFinish(bool SendStart);
 	
 	void DeleteUnusedRootDirEntries(BackupClientContext &rContext);
+	void SetDirectoryScanMethod(const std::string &rName);
 
 	// For warning user about potential security hole
 	virtual void SetupInInitialProcess();
@@ -209,6 +211,10 @@ private:
 	
 	int mDeleteRedundantLocationsAfter;
 
+	// The DirectoryScanMethod as configured, and the method used for it
+	std::string mDirectoryScanMethodName;
+	BackupClientDirectoryReader::Method mDirectoryScanMethod;
+
 	// For the command socket
 	class CommandSocketInfo
 	{
@@ -278,6 +284,13 @@ private:
 	SysadminNotifier* mpSysadminNotifier;
 	std::auto_ptr<Timer> mapCommandSocketPollTimer;
 	std::auto_ptr<BackupClientContext> mapClientContext;
+	std::auto_ptr<BackupClientChangeJournal> mapChangeJournal;
+	// The store object info file the directory records were loaded
+	// from, which they read from until they're all needed
+	std::auto_ptr<BackupClientStoreObjectInfo> mapStoreObjectInfo;
+	// The one being written as the directories are synced
+	std::auto_ptr<BackupClientStoreObjectInfoWriter>
+		mapStoreObjectInfoWriter;
 
 	/* ProgressNotifier implementation */
 public:
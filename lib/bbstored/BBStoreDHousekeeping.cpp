@@ -10,11 +10,28 @@
 #include "Box.h"
 
 #include <stdio.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <sstream>
+
+#ifdef HAVE_SYS_WAIT_H
+	#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+	#include <signal.h>
+#endif
 
 #include "BackupStoreDaemon.h"
 #include "BackupStoreAccountDatabase.h"
 #include "BackupStoreAccounts.h"
+#include "BackupStoreInfo.h"
+#include "BackupStoreSharedAccountState.h"
 #include "HousekeepStoreAccount.h"
+#include "NamedLock.h"
+#include "RaidFileScrubber.h"
+#include "StoreStructure.h"
 #include "BoxTime.h"
 #include "Configuration.h"
 
@@ -32,6 +49,9 @@ void BackupStoreDaemon::HousekeepingInit()
 {
 
 	mLastHousekeepingRun = 0;
+	mLastScrubStart = 0;
+	mScrubAccounts.clear();
+	mScrubResumeAfter.clear();
 }
 
 void BackupStoreDaemon::HousekeepingProcess()
@@ -52,6 +72,13 @@ void BackupStoreDaemon::HousekeepingProcess()
 			break;
 		}
 
+		// Look for damage in the time left over
+		RunScrubIfNeeded();
+		if(StopRun())
+		{
+			break;
+		}
+
 		// Calculate how long should wait before doing the next 
 		// housekeeping run
 		int64_t timeNow = GetCurrentBoxTime();
@@ -103,86 +130,658 @@ void BackupStoreDaemon::RunHousekeepingIfNeeded()
 	{
 		mpAccountDatabase->GetAllAccountIDs(accounts);
 	}
+
+	int maxProcesses = rconfig.GetKeyValueInt("HousekeepingProcesses");
+	int maxOperationsPerSecond = rconfig.GetKeyValueInt(
+		"HousekeepingOperationsPerSecond");
 			
 	SetProcessTitle("housekeeping, active");
-			
-	// Check them all
-	for(std::vector<int32_t>::const_iterator i = accounts.begin(); i != accounts.end(); ++i)
+
+#ifndef WIN32
+	if(maxProcesses > 1 && !IsSingleProcess())
+	{
+		// Most urgent first. Not worth reading every account's
+		// store info for when they're done one at a time anyway.
+		SortAccountsForHousekeeping(accounts);
+
+		// Share the budget between the accounts housekept at once
+		int operationsPerProcess = 0;
+		if(maxOperationsPerSecond > 0)
+		{
+			operationsPerProcess = maxOperationsPerSecond /
+				maxProcesses;
+			if(operationsPerProcess < 1)
+			{
+				operationsPerProcess = 1;
+			}
+		}
+
+		RunHousekeepingWorkers(accounts, maxProcesses,
+			operationsPerProcess);
+	}
+	else
+#endif // !WIN32
+	{
+		// Check them all, one after another
+		for(std::vector<int32_t>::const_iterator i = accounts.begin();
+			i != accounts.end(); ++i)
+		{
+			HousekeepAccount(*i, maxOperationsPerSecond);
+
+			int64_t timeNow = GetCurrentBoxTime();
+			time_t secondsToGo = BoxTimeToSeconds(
+				(mLastHousekeepingRun + housekeepingInterval) - 
+				timeNow);
+			if(secondsToGo < 1) secondsToGo = 1;
+			if(secondsToGo > 60) secondsToGo = 60;
+			int32_t millisecondsToGo = ((int)secondsToGo) * 1000;
+
+			// Check to see if there's any message pending
+			CheckForInterProcessMsg(0 /* no account */,
+				millisecondsToGo);
+
+			// Stop early?
+			if(StopRun())
+			{
+				break;
+			}
+		}
+	}
+		
+	BOX_INFO("Finished housekeeping");
+
+	// Placed here for accuracy, if StopRun() is true, for example.
+	SetProcessTitle("housekeeping, idle");
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::HousekeepAccount(int32_t, int)
+//		Purpose: Do housekeeping on one account, logging and
+//			 swallowing any errors so that the others are still
+//			 housekept.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::HousekeepAccount(int32_t AccountID,
+	int MaxOperationsPerSecond)
+{
+	const Configuration &rconfig(GetConfiguration());
+
+	try
 	{
+		std::string rootDir;
+		int discSet = 0;
+
+		{
+			// Tag log output to identify account
+			std::ostringstream tag;
+			tag << "hk/" << BOX_FORMAT_ACCOUNT(AccountID);
+			Logging::Tagger tagWithClientID(tag.str());
+
+			// Get the account root
+			mpAccounts->GetAccountRoot(AccountID, rootDir, discSet);
+
+			// Reset tagging as HousekeepStoreAccount will
+			// do that itself, to avoid duplicate tagging.
+			// Happens automatically when tagWithClientID
+			// goes out of scope.
+		}
+		
+		// Do housekeeping on this account
+		HousekeepStoreAccount housekeeping(AccountID, rootDir,
+			discSet, this);
+		housekeeping.SetPackFileObjectSizeLimit(
+			rconfig.GetKeyValueInt("PackFileObjectSizeLimit"));
+		housekeeping.SetMaxOperationsPerSecond(MaxOperationsPerSecond);
+		housekeeping.SetFullScanInterval(SecondsToBoxTime(
+			rconfig.GetKeyValueInt("HousekeepingFullScanInterval")));
+		housekeeping.SetMaxPatchChainDepth(
+			rconfig.GetKeyValueInt("MaxPatchChainDepth"));
+		housekeeping.SetMaxPatchChainBlocks(
+			rconfig.GetKeyValueInt("MaxPatchChainBlocks"));
+		housekeeping.SetMaxMergeProcesses(
+			rconfig.GetKeyValueInt("HousekeepingMergeProcesses"));
+		if(mpSharedAccountState)
+		{
+			housekeeping.SetSharedAccountState(
+				*mpSharedAccountState);
+		}
+		housekeeping.DoHousekeeping();
+	}
+	catch(BoxException &e)
+	{
+		BOX_ERROR("Housekeeping on account " <<
+			BOX_FORMAT_ACCOUNT(AccountID) << " threw exception, "
+			"aborting run for this account: " <<
+			e.what() << " (" <<
+			e.GetType() << "/" << e.GetSubType() << ")");
+	}
+	catch(std::exception &e)
+	{
+		BOX_ERROR("Housekeeping on account " <<
+			BOX_FORMAT_ACCOUNT(AccountID) << " threw exception, "
+			"aborting run for this account: " <<
+			e.what());
+	}
+	catch(...)
+	{
+		BOX_ERROR("Housekeeping on account " <<
+			BOX_FORMAT_ACCOUNT(AccountID) << " threw exception, "
+			"aborting run for this account: "
+			"unknown exception");
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::SortAccountsForHousekeeping(
+//			 std::vector<int32_t> &)
+//		Purpose: Put the accounts which are closest to (or furthest
+//			 over) their soft limit first, so that they get space
+//			 back soonest. Accounts whose store info can't be
+//			 read go last, and will report the problem when they
+//			 are housekept.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::SortAccountsForHousekeeping(
+	std::vector<int32_t> &rAccounts)
+{
+	// Negative proportion of soft limit used, and account ID, so
+	// that sorting puts the most urgent first and otherwise leaves
+	// the accounts in order of ID
+	std::vector<std::pair<double, int32_t> > order;
+	order.reserve(rAccounts.size());
+
+	for(std::vector<int32_t>::const_iterator i(rAccounts.begin());
+		i != rAccounts.end(); ++i)
+	{
+		double used = -1;
+
 		try
 		{
 			std::string rootDir;
 			int discSet = 0;
+			mpAccounts->GetAccountRoot(*i, rootDir, discSet);
 
+			std::auto_ptr<BackupStoreInfo> info;
+			if(mpSharedAccountState)
 			{
-				// Tag log output to identify account
-				std::ostringstream tag;
-				tag << "hk/" << BOX_FORMAT_ACCOUNT(*i);
-				Logging::Tagger tagWithClientID(tag.str());
-
-				// Get the account root
-				mpAccounts->GetAccountRoot(*i, rootDir, discSet);
-
-				// Reset tagging as HousekeepStoreAccount will
-				// do that itself, to avoid duplicate tagging.
-				// Happens automatically when tagWithClientID
-				// goes out of scope.
+				info = mpSharedAccountState->LoadStoreInfo(*i,
+					rootDir, discSet, true); // ReadOnly
+			}
+			else
+			{
+				info = BackupStoreInfo::Load(*i, rootDir,
+					discSet, true); // ReadOnly
+			}
+
+			if(info->GetBlocksSoftLimit() > 0)
+			{
+				used = (double)info->GetBlocksUsed() /
+					info->GetBlocksSoftLimit();
+			}
+			else
+			{
+				used = (double)info->GetBlocksUsed();
+			}
+		}
+		catch(std::exception &e)
+		{
+			BOX_TRACE("Failed to read store info for account " <<
+				BOX_FORMAT_ACCOUNT(*i) << " to prioritise "
+				"housekeeping: " << e.what());
+		}
+
+		order.push_back(std::make_pair(-used, *i));
+	}
+
+	std::sort(order.begin(), order.end());
+
+	rAccounts.clear();
+	for(std::vector<std::pair<double, int32_t> >::const_iterator
+		i(order.begin()); i != order.end(); ++i)
+	{
+		rAccounts.push_back(i->second);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::RunScrubIfNeeded()
+//		Purpose: Carry on with the current pass of reading every
+//			 file in the store to find damage, or start a new
+//			 one if ScrubInterval has passed since the last one
+//			 started. Returns when the pass is done, or earlier
+//			 if housekeeping is due or the daemon is stopping,
+//			 in which case the next call carries on from there.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::RunScrubIfNeeded()
+{
+	const Configuration &rconfig(GetConfiguration());
+	int64_t scrubInterval = SecondsToBoxTime(
+		rconfig.GetKeyValueInt("ScrubInterval"));
+	if(scrubInterval <= 0 || mpAccountDatabase == 0)
+	{
+		return;
+	}
+
+	if(mScrubAccounts.empty())
+	{
+		int64_t timeNow = GetCurrentBoxTime();
+		if(mLastScrubStart != 0 &&
+			(timeNow - mLastScrubStart) < scrubInterval)
+		{
+			return;
+		}
+
+		mLastScrubStart = timeNow;
+		mScrubResumeAfter.clear();
+		mpAccountDatabase->GetAllAccountIDs(mScrubAccounts);
+		if(mScrubAccounts.empty())
+		{
+			return;
+		}
+		BOX_INFO("Starting scrub of " << mScrubAccounts.size() <<
+			" accounts");
+	}
+
+	int maxBlocksPerSecond = rconfig.GetKeyValueInt("ScrubBlocksPerSecond");
+	SetProcessTitle("housekeeping, scrubbing");
+
+	while(!mScrubAccounts.empty())
+	{
+		if(!ScrubAccount(mScrubAccounts.front(), maxBlocksPerSecond))
+		{
+			// Stopped part way through, carry on later
+			BOX_TRACE("Scrub paused after " << mScrubResumeAfter);
+			SetProcessTitle("housekeeping, idle");
+			return;
+		}
+
+		mScrubAccounts.erase(mScrubAccounts.begin());
+		mScrubResumeAfter.clear();
+	}
+
+	BOX_INFO("Finished scrub");
+	SetProcessTitle("housekeeping, idle");
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::StopScrub()
+//		Purpose: RaidFileScrubberCallback implementation. Scrubbing
+//			 gives way to housekeeping and to stopping the daemon.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreDaemon::StopScrub()
+{
+	CheckForInterProcessMsg(0 /* no account */, 0);
+	if(StopRun())
+	{
+		return true;
+	}
+
+	int64_t housekeepingInterval = SecondsToBoxTime(
+		GetConfiguration().GetKeyValueInt("TimeBetweenHousekeeping"));
+	return (GetCurrentBoxTime() - mLastHousekeepingRun) >=
+		housekeepingInterval;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::ScrubAccount(int32_t, int)
+//		Purpose: Scrub one account, starting after mScrubResumeAfter,
+//			 and repair any damaged files found. Returns false if
+//			 stopped before the end of the account, with
+//			 mScrubResumeAfter set to carry on from. Errors are
+//			 logged and swallowed, so that the others are still
+//			 scrubbed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool BackupStoreDaemon::ScrubAccount(int32_t AccountID, int MaxBlocksPerSecond)
+{
+	std::ostringstream tag;
+	tag << "scrub/" << BOX_FORMAT_ACCOUNT(AccountID);
+	Logging::Tagger tagWithClientID(tag.str());
+
+	try
+	{
+		std::string rootDir;
+		int discSet = 0;
+		mpAccounts->GetAccountRoot(AccountID, rootDir, discSet);
+
+		RaidFileScrubber scrubber(discSet);
+		scrubber.SetMaxBlocksPerSecond(MaxBlocksPerSecond);
+		scrubber.SetCallback(this);
+		bool finished = scrubber.ScrubDirectory(rootDir,
+			mScrubResumeAfter);
+		mScrubResumeAfter = scrubber.GetLastFileScrubbed();
+
+		BOX_TRACE("Scrubbed " << scrubber.GetNumFilesScrubbed() <<
+			" files, " << scrubber.GetNumBlocksScrubbed() <<
+			" blocks, " << scrubber.GetNumDamagedFiles() <<
+			" damaged, " << scrubber.GetNumUnreadableFiles() <<
+			" unreadable");
+		if(scrubber.GetNumUnreadableFiles() > 0)
+		{
+			BOX_ERROR("Found " << scrubber.GetNumUnreadableFiles() <<
+				" files which can't be read, run bbstoreaccounts "
+				"check on account " << BOX_FORMAT_ACCOUNT(AccountID));
+		}
+
+		if(!scrubber.GetDamagedFiles().empty())
+		{
+			RepairScrubbedFiles(AccountID, rootDir, discSet,
+				scrubber.GetDamagedFiles());
+		}
+
+		return finished;
+	}
+	catch(BoxException &e)
+	{
+		BOX_ERROR("Scrubbing account " << BOX_FORMAT_ACCOUNT(AccountID) <<
+			" threw exception, skipping it: " << e.what() << " (" <<
+			e.GetType() << "/" << e.GetSubType() << ")");
+	}
+	catch(std::exception &e)
+	{
+		BOX_ERROR("Scrubbing account " << BOX_FORMAT_ACCOUNT(AccountID) <<
+			" threw exception, skipping it: " << e.what());
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::RepairScrubbedFiles(int32_t,
+//			 const std::string &, int,
+//			 const std::vector<std::string> &)
+//		Purpose: Rewrite the damaged files found by scrubbing, while
+//			 holding the account's write lock so that no client
+//			 or housekeeping changes them at the same time. Each
+//			 one is checked again first, in case it was only
+//			 being replaced while it was scrubbed. If the account
+//			 is in use, they're left for the next pass.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::RepairScrubbedFiles(int32_t AccountID,
+	const std::string &rRootDir, int DiscSet,
+	const std::vector<std::string> &rFiles)
+{
+	std::string writeLockFilename;
+	StoreStructure::MakeWriteLockFilename(rRootDir, DiscSet,
+		writeLockFilename);
+	NamedLock writeLock;
+	if(!writeLock.TryAndGetLock(writeLockFilename,
+		0600 /* restrictive file permissions */))
+	{
+		BOX_WARNING("Account is in use, not repairing " <<
+			rFiles.size() << " damaged files until the next scrub");
+		return;
+	}
+
+	RaidFileScrubber repairer(DiscSet);
+	for(std::vector<std::string>::const_iterator i(rFiles.begin());
+		i != rFiles.end(); ++i)
+	{
+		try
+		{
+			if(!repairer.ScrubFile(*i))
+			{
+				repairer.RepairFile(*i);
 			}
-			
-			// Do housekeeping on this account
-			HousekeepStoreAccount housekeeping(*i, rootDir,
-				discSet, this);
-			housekeeping.DoHousekeeping();
 		}
 		catch(BoxException &e)
 		{
-			BOX_ERROR("Housekeeping on account " <<
-				BOX_FORMAT_ACCOUNT(*i) << " threw exception, "
-				"aborting run for this account: " <<
-				e.what() << " (" <<
-				e.GetType() << "/" << e.GetSubType() << ")");
+			BOX_ERROR("Failed to repair " << *i << ": " << e.what());
+		}
+	}
+}
+
+#ifndef WIN32
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::RunHousekeepingWorkers(
+//			 const std::vector<int32_t> &, int, int)
+//		Purpose: Housekeep the accounts in order, up to MaxWorkers
+//			 at a time, each in a child of the housekeeping
+//			 process. This process passes on messages from the
+//			 main process until all the workers have finished.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::RunHousekeepingWorkers(
+	const std::vector<int32_t> &rAccounts, int MaxWorkers,
+	int MaxOperationsPerSecond)
+{
+	// A worker may finish just before a message is passed on to it,
+	// which must not kill this process
+	::signal(SIGPIPE, SIG_IGN);
+
+	std::vector<int32_t>::const_iterator next(rAccounts.begin());
+	while(!mHousekeepingWorkers.empty() ||
+		(next != rAccounts.end() && !StopRun()))
+	{
+		while(next != rAccounts.end() && !StopRun() &&
+			(int)mHousekeepingWorkers.size() < MaxWorkers)
+		{
+			StartHousekeepingWorker(*next, MaxOperationsPerSecond);
+			++next;
+		}
+
+		std::ostringstream title;
+		title << "housekeeping, active, " <<
+			mHousekeepingWorkers.size() << " accounts";
+		SetProcessTitle(title.str().c_str());
+
+		// Wait a short time for a message, which will be passed on
+		// to the workers, then clear up any which have finished
+		CheckForInterProcessMsg(0 /* no account */, 100);
+		if(mInterProcessComms.IsEOF())
+		{
+			// Which doesn't wait at all
+			ShortSleep(MilliSecondsToBoxTime(100), false);
+		}
+		WaitForHousekeepingWorkers();
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::StartHousekeepingWorker(int32_t, int)
+//		Purpose: Fork a process to housekeep one account, connected
+//			 to this one by a new socket pair, which it uses in
+//			 place of the connection to the main process.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::StartHousekeepingWorker(int32_t AccountID,
+	int MaxOperationsPerSecond)
+{
+	int sv[2] = {-1,-1};
+	if(::socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, sv) != 0)
+	{
+		THROW_EXCEPTION(ServerException, SocketPairFailed)
+	}
+
+	pid_t pid = ::fork();
+	if(pid == -1)
+	{
+		::close(sv[0]);
+		::close(sv[1]);
+		THROW_EXCEPTION(ServerException, ServerForkError)
+	}
+
+	if(pid == 0)
+	{
+		// In the worker. Messages now come from the coordinating
+		// process, and the other workers belong to it.
+		try
+		{
+			::close(sv[0]);
+			for(std::map<pid_t, HousekeepingWorker>::iterator
+				i(mHousekeepingWorkers.begin());
+				i != mHousekeepingWorkers.end(); i++)
+			{
+				delete i->second.mpSocket;
+			}
+			mHousekeepingWorkers.clear();
+
+			mInterProcessComms.IgnoreBufferedData(
+				mInterProcessComms.GetSizeOfBufferedData());
+			mInterProcessCommsSocket.Close();
+			mInterProcessCommsSocket.Attach(sv[1]);
+
+			std::ostringstream title;
+			title << "housekeeping, " <<
+				BOX_FORMAT_ACCOUNT(AccountID);
+			SetProcessTitle(title.str().c_str());
+
+			HousekeepAccount(AccountID, MaxOperationsPerSecond);
 		}
 		catch(std::exception &e)
 		{
-			BOX_ERROR("Housekeeping on account " <<
-				BOX_FORMAT_ACCOUNT(*i) << " threw exception, "
-				"aborting run for this account: " <<
+			BOX_ERROR("Housekeeping process for account " <<
+				BOX_FORMAT_ACCOUNT(AccountID) << " failed: " <<
 				e.what());
+			::_exit(1);
 		}
-		catch(...)
+		::_exit(0);
+	}
+
+	// In the coordinating process
+	::close(sv[1]);
+	HousekeepingWorker worker;
+	worker.mAccountID = AccountID;
+	worker.mpSocket = new SocketStream(sv[0]);
+	mHousekeepingWorkers[pid] = worker;
+
+	BOX_TRACE("Started housekeeping process " << pid << " for "
+		"account " << BOX_FORMAT_ACCOUNT(AccountID));
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::WaitForHousekeepingWorkers()
+//		Purpose: Clean up after any workers which have finished,
+//			 without waiting for the others.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::WaitForHousekeepingWorkers()
+{
+	std::map<pid_t, HousekeepingWorker>::iterator i(
+		mHousekeepingWorkers.begin());
+	while(i != mHousekeepingWorkers.end())
+	{
+		int status = 0;
+		pid_t p = ::waitpid(i->first, &status, WNOHANG);
+
+		if(p == 0 || (p == -1 && errno == EINTR))
 		{
-			BOX_ERROR("Housekeeping on account " <<
-				BOX_FORMAT_ACCOUNT(*i) << " threw exception, "
-				"aborting run for this account: "
-				"unknown exception");
+			// Still running
+			i++;
+			continue;
 		}
-	
-		int64_t timeNow = GetCurrentBoxTime();
-		time_t secondsToGo = BoxTimeToSeconds(
-			(mLastHousekeepingRun + housekeepingInterval) - 
-			timeNow);
-		if(secondsToGo < 1) secondsToGo = 1;
-		if(secondsToGo > 60) secondsToGo = 60;
-		int32_t millisecondsToGo = ((int)secondsToGo) * 1000;
-
-		// Check to see if there's any message pending
-		CheckForInterProcessMsg(0 /* no account */, millisecondsToGo);
 
-		// Stop early?
-		if(StopRun())
+		if(p == -1)
 		{
-			break;
+			BOX_LOG_SYS_ERROR("Failed to wait for housekeeping "
+				"process " << i->first);
+		}
+		else if(WIFSIGNALED(status))
+		{
+			BOX_ERROR("Housekeeping process for account " <<
+				BOX_FORMAT_ACCOUNT(i->second.mAccountID) <<
+				" terminated abnormally with signal " <<
+				WTERMSIG(status));
+		}
+		else
+		{
+			BOX_TRACE("Housekeeping process for account " <<
+				BOX_FORMAT_ACCOUNT(i->second.mAccountID) <<
+				" finished");
 		}
+
+		delete i->second.mpSocket;
+		mHousekeepingWorkers.erase(i++);
 	}
-		
-	BOX_INFO("Finished housekeeping");
+}
 
-	// Placed here for accuracy, if StopRun() is true, for example.
-	SetProcessTitle("housekeeping, idle");
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    BackupStoreDaemon::SendMessageToHousekeepingWorkers(
+//			 const std::string &, int32_t)
+//		Purpose: Pass a message from the main process on to all
+//			 the workers, or only the one housekeeping AccountID
+//			 if it's not zero.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void BackupStoreDaemon::SendMessageToHousekeepingWorkers(
+	const std::string &rMessage, int32_t AccountID)
+{
+	std::string line(rMessage + "\n");
+
+	for(std::map<pid_t, HousekeepingWorker>::iterator
+		i(mHousekeepingWorkers.begin());
+		i != mHousekeepingWorkers.end(); i++)
+	{
+		if(AccountID != 0 && i->second.mAccountID != AccountID)
+		{
+			continue;
+		}
+
+		try
+		{
+			i->second.mpSocket->Write(line.c_str(), line.size());
+		}
+		catch(BoxException &e)
+		{
+			// It has probably just finished
+			BOX_TRACE("Failed to send message to housekeeping "
+				"process " << i->first << ": " << e.what());
+		}
+	}
 }
+#endif // !WIN32
 
 void BackupStoreDaemon::OnIdle()
 {
+	// Pick up accounts created or deleted since the last connection,
+	// so that new connections find them in the shared table
+	if (mpSharedAccountState && mpAccountDatabase)
+	{
+		try
+		{
+			mpSharedAccountState->UpdateAccounts(
+				*mpAccountDatabase);
+		}
+		catch(BoxException &e)
+		{
+			BOX_ERROR("Failed to update shared account table: " <<
+				e.what());
+		}
+	}
+
 	if (!IsSingleProcess())
 	{
 		return;
@@ -217,6 +816,9 @@ bool BackupStoreDaemon::CheckForInterProcessMsg(int AccountNum, int MaximumWaitT
 	if(mInterProcessComms.IsEOF())
 	{
 		SetTerminateWanted();
+#ifndef WIN32
+		SendMessageToHousekeepingWorkers("t");
+#endif
 		return true;
 	}
 
@@ -233,12 +835,18 @@ bool BackupStoreDaemon::CheckForInterProcessMsg(int AccountNum, int MaximumWaitT
 		{
 			// HUP signal received by main process
 			SetReloadConfigWanted();
+#ifndef WIN32
+			SendMessageToHousekeepingWorkers(line);
+#endif
 			return true;
 		}
 		else if(line == "t")
 		{
 			// Terminate signal received by main process
 			SetTerminateWanted();
+#ifndef WIN32
+			SendMessageToHousekeepingWorkers(line);
+#endif
 			return true;
 		}
 		else if(sscanf(line.c_str(), "r%x", &account) == 1)
@@ -252,6 +860,11 @@ bool BackupStoreDaemon::CheckForInterProcessMsg(int AccountNum, int MaximumWaitT
 					"giving way to client connection");
 				return true;
 			}
+
+#ifndef WIN32
+			// Or is one of our workers?
+			SendMessageToHousekeepingWorkers(line, account);
+#endif
 		}
 	}
 	
@@ -24,6 +24,7 @@
 #include "RaidFileController.h"
 #include "BackupStoreAccountDatabase.h"
 #include "BackupStoreAccounts.h"
+#include "BackupStoreSharedAccountState.h"
 #include "BannerText.h"
 
 #include "MemLeakFindOn.h"
@@ -39,6 +40,7 @@
 BackupStoreDaemon::BackupStoreDaemon()
 	: mpAccountDatabase(0),
 	  mpAccounts(0),
+	  mpSharedAccountState(0),
 	  mExtendedLogging(false),
 	  mHaveForkedHousekeeping(false),
 	  mIsHousekeepingProcess(false),
@@ -70,6 +72,21 @@ BackupStoreDaemon::~BackupStoreDaemon()
 		delete mpAccountDatabase;
 		mpAccountDatabase = 0;
 	}
+	if(mpSharedAccountState != 0)
+	{
+		delete mpSharedAccountState;
+		mpSharedAccountState = 0;
+	}
+#ifndef WIN32
+	// Only left behind if housekeeping was interrupted by an exception
+	for(std::map<pid_t, HousekeepingWorker>::iterator
+		i(mHousekeepingWorkers.begin());
+		i != mHousekeepingWorkers.end(); i++)
+	{
+		delete i->second.mpSocket;
+	}
+	mHousekeepingWorkers.clear();
+#endif
 }
 
 // --------------------------------------------------------------------------
@@ -152,6 +169,17 @@ void BackupStoreDaemon::SetupInInitialProcess()
 	
 	// Create a accounts object
 	mpAccounts = new BackupStoreAccounts(*mpAccountDatabase);
+
+	// Share the accounts and their store info with all the processes
+	// forked from this one, with room to add more accounts later
+	if(mpSharedAccountState == 0)
+	{
+		std::vector<int32_t> accounts;
+		mpAccountDatabase->GetAllAccountIDs(accounts);
+		mpSharedAccountState = new BackupStoreSharedAccountState(
+			accounts.size() * 2);
+	}
+	mpSharedAccountState->UpdateAccounts(*mpAccountDatabase);
 	
 	// Ready to go!
 }
@@ -336,8 +364,17 @@ void BackupStoreDaemon::Connection2(std::auto_ptr<SocketStreamTLS> apStream)
 		context.SetTestHook(*mpTestHook);
 	}
 	
-	// See if the client has an account?
-	if(mpAccounts && mpAccounts->AccountExists(id))
+	// See if the client has an account? Accounts created since the
+	// shared table was last updated are only in the database.
+	int sharedDiscSet = 0;
+	if(mpSharedAccountState && mpSharedAccountState->GetAccount(id,
+		sharedDiscSet))
+	{
+		context.SetClientHasAccount(BackupStoreAccounts::GetAccountRoot(
+			BackupStoreAccountDatabase::Entry(id, sharedDiscSet)),
+			sharedDiscSet);
+	}
+	else if(mpAccounts && mpAccounts->AccountExists(id))
 	{
 		std::string root;
 		int discSet;
@@ -345,6 +382,11 @@ void BackupStoreDaemon::Connection2(std::auto_ptr<SocketStreamTLS> apStream)
 		context.SetClientHasAccount(root, discSet);
 	}
 
+	if(mpSharedAccountState)
+	{
+		context.SetSharedAccountState(*mpSharedAccountState);
+	}
+
 	// Handle a connection with the backup protocol
 	std::auto_ptr<SocketStream> apPlainStream(apStream);
 	BackupProtocolServer server(apPlainStream);
@@ -10,15 +10,20 @@
 #ifndef BACKUPSTOREDAEMON__H
 #define BACKUPSTOREDAEMON__H
 
+#include <map>
+#include <vector>
+
 #include "ServerTLS.h"
 #include "BoxPortsAndFiles.h"
 #include "BackupConstants.h"
 #include "BackupStoreContext.h"
 #include "HousekeepStoreAccount.h"
 #include "IOStreamGetLine.h"
+#include "RaidFileScrubber.h"
 
 class BackupStoreAccounts;
 class BackupStoreAccountDatabase;
+class BackupStoreSharedAccountState;
 
 // --------------------------------------------------------------------------
 //
@@ -29,7 +34,7 @@ class BackupStoreAccountDatabase;
 //
 // --------------------------------------------------------------------------
 class BackupStoreDaemon : public ServerTLS<BOX_PORT_BBSTORED>,
-	HousekeepingInterface, HousekeepingCallback
+	HousekeepingInterface, HousekeepingCallback, RaidFileScrubberCallback
 {
 public:
 	BackupStoreDaemon();
@@ -62,6 +67,21 @@ protected:
 	
 	// Housekeeping functions
 	void HousekeepingProcess();
+	void HousekeepAccount(int32_t AccountID, int MaxOperationsPerSecond);
+	void SortAccountsForHousekeeping(std::vector<int32_t> &rAccounts);
+	void RunScrubIfNeeded();
+	bool ScrubAccount(int32_t AccountID, int MaxBlocksPerSecond);
+	void RepairScrubbedFiles(int32_t AccountID, const std::string &rRootDir,
+		int DiscSet, const std::vector<std::string> &rFiles);
+#ifndef WIN32
+	void RunHousekeepingWorkers(const std::vector<int32_t> &rAccounts,
+		int MaxWorkers, int MaxOperationsPerSecond);
+	void StartHousekeepingWorker(int32_t AccountID,
+		int MaxOperationsPerSecond);
+	void WaitForHousekeepingWorkers();
+	void SendMessageToHousekeepingWorkers(const std::string &rMessage,
+		int32_t AccountID = 0);
+#endif
 
 	void LogConnectionStats(uint32_t accountId,
 		const std::string& accountName, const BackupProtocolServer &server);
@@ -70,10 +90,13 @@ public:
 	// HousekeepingInterface implementation
 	virtual bool CheckForInterProcessMsg(int AccountNum = 0, int MaximumWaitTime = 0);
 	void RunHousekeepingIfNeeded();
+	// RaidFileScrubberCallback implementation
+	virtual bool StopScrub();
 
 private:
 	BackupStoreAccountDatabase *mpAccountDatabase;
 	BackupStoreAccounts *mpAccounts;
+	BackupStoreSharedAccountState *mpSharedAccountState;
 	bool mExtendedLogging;
 	bool mHaveForkedHousekeeping;
 	bool mIsHousekeepingProcess;
@@ -86,6 +109,23 @@ private:
 	void HousekeepingInit();
 	int64_t mLastHousekeepingRun;
 
+	// Progress of the current pass of scrubbing: the accounts still to
+	// do, and the last file done in the first of them
+	box_time_t mLastScrubStart;
+	std::vector<int32_t> mScrubAccounts;
+	std::string mScrubResumeAfter;
+
+#ifndef WIN32
+	// Processes housekeeping one account each, when housekeeping
+	// several accounts at once
+	typedef struct
+	{
+		int32_t mAccountID;
+		SocketStream *mpSocket;
+	} HousekeepingWorker;
+	std::map<pid_t, HousekeepingWorker> mHousekeepingWorkers;
+#endif
+
 public:
 	void SetTestHook(BackupStoreContext::TestHook& rTestHook)
 	{
@@ -0,0 +1 @@
+#define BOX_VERSION "git_8c74c2bfa4430778792f1a35d52d1835e71d0d43"
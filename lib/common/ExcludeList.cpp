@@ -9,6 +9,8 @@
 
 #include "Box.h"
 
+#include <ctype.h>
+
 #ifdef HAVE_REGEX_SUPPORT
 	#if defined HAVE_PCREPOSIX_H
 		#include <pcreposix.h>
@@ -26,6 +28,156 @@
 
 #include "MemLeakFindOn.h"
 
+#ifdef HAVE_REGEX_SUPPORT
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    GetRegexFlags()
+//		Purpose: Returns the flags with which all the regular
+//			 expressions are compiled
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static int GetRegexFlags()
+{
+	int flags = REG_EXTENDED | REG_NOSUB;
+	#ifdef WIN32
+	flags |= REG_ICASE; // Windows convention
+	#endif
+	return flags;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CanCombineRegex(const std::string &, bool &)
+//		Purpose: Returns true if the expression, which is known to
+//			 compile, matches exactly the same strings when
+//			 it's put in brackets as one alternative of a larger
+//			 expression. That rules out back references, which
+//			 would be renumbered, and unmatched close brackets,
+//			 which some libraries take literally. Also sets
+//			 rPrefixStable to whether, if it matches a path, it
+//			 also matches anything which starts with that path
+//			 followed by a directory separator, which is true
+//			 unless it depends on where the string ends.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static bool CanCombineRegex(const std::string &rRegex, bool &rPrefixStable)
+{
+	rPrefixStable = true;
+	int depth = 0;
+	std::string::size_type size = rRegex.size();
+
+	for(std::string::size_type i = 0; i < size; i++)
+	{
+		char c = rRegex[i];
+		if(c == '\\')
+		{
+			if(++i == size)
+			{
+				return false;
+			}
+
+			char escaped = rRegex[i];
+			if(::isdigit((unsigned char)escaped) || escaped == 'Q')
+			{
+				// back reference, or quoted text which
+				// might contain brackets
+				return false;
+			}
+			if(::isalpha((unsigned char)escaped) || escaped == '\'')
+			{
+				// may be an assertion about the end
+				rPrefixStable = false;
+			}
+		}
+		else if(c == '[')
+		{
+			// Skip the bracket expression, in which a ] first
+			// or after ^ is literal, as is anything inside
+			// [: :], [. .] and [= =]
+			i++;
+			if(i < size && rRegex[i] == '^') i++;
+			if(i < size && rRegex[i] == ']') i++;
+			while(i < size && rRegex[i] != ']')
+			{
+				if(rRegex[i] == '[' && i + 1 < size &&
+					(rRegex[i + 1] == ':' ||
+					 rRegex[i + 1] == '.' ||
+					 rRegex[i + 1] == '='))
+				{
+					char terminator[3] = {rRegex[i + 1], ']', 0};
+					i = rRegex.find(terminator, i + 2);
+					if(i == std::string::npos)
+					{
+						return false;
+					}
+					i += 2;
+				}
+				else
+				{
+					i++;
+				}
+			}
+
+			if(i >= size)
+			{
+				return false;
+			}
+		}
+		else if(c == '(')
+		{
+			// Allow non-capturing groups, but no other (?...)
+			// extensions, such as lookahead or numbered
+			// subroutine calls
+			if(i + 1 < size && rRegex[i + 1] == '?' &&
+				!(i + 2 < size && rRegex[i + 2] == ':'))
+			{
+				return false;
+			}
+			depth++;
+		}
+		else if(c == ')')
+		{
+			if(depth == 0)
+			{
+				return false;
+			}
+			depth--;
+		}
+		else if(c == '$')
+		{
+			rPrefixStable = false;
+		}
+	}
+
+	return depth == 0;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CompileRegex(const std::string &)
+//		Purpose: Compiles an expression, returning NULL if it fails
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static regex_t *CompileRegex(const std::string &rRegex)
+{
+	regex_t *pregex = new regex_t;
+	if(::regcomp(pregex, rRegex.c_str(), GetRegexFlags()) != 0)
+	{
+		delete pregex;
+		return 0;
+	}
+	return pregex;
+}
+
+#endif // HAVE_REGEX_SUPPORT
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -35,7 +187,13 @@
 //
 // --------------------------------------------------------------------------
 ExcludeList::ExcludeList()
-	: mpAlwaysInclude(0)
+	:
+#ifdef HAVE_REGEX_SUPPORT
+	  mpCombinedRegex(0),
+	  mpPrefixRegex(0),
+	  mLastPrefixMatched(false),
+#endif
+	  mpAlwaysInclude(0)
 {
 }
 
@@ -51,6 +209,8 @@ ExcludeList::ExcludeList()
 ExcludeList::~ExcludeList()
 {
 #ifdef HAVE_REGEX_SUPPORT
+	FreeCombinedRegex();
+
 	// free regex memory
 	while(mRegex.size() > 0)
 	{
@@ -181,19 +341,17 @@ void ExcludeList::AddRegexEntries(const std::string &rEntries)
 			try
 			{
 				std::string entry = *i;
-				int flags = REG_EXTENDED | REG_NOSUB;
 
 				// Convert any forward slashes in the string
 				// to appropriately escaped backslashes
 
 				#ifdef WIN32
 				entry = ReplaceSlashesRegex(entry);
-				flags |= REG_ICASE; // Windows convention
 				#endif
 
 				// Compile
 				int errcode = ::regcomp(pregex, entry.c_str(),
-					flags);
+					GetRegexFlags());
 
 				if (errcode != 0)
 				{
@@ -217,12 +375,99 @@ void ExcludeList::AddRegexEntries(const std::string &rEntries)
 		}
 	}
 
+	CompileCombinedRegex();
+
 #else
 	THROW_EXCEPTION(CommonException, RegexNotSupportedOnThisPlatform)
 #endif
 }
 
 
+#ifdef HAVE_REGEX_SUPPORT
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    ExcludeList::CompileCombinedRegex()
+//		Purpose: Builds a single expression out of all the ones
+//			 which can be combined, so that a path is tested
+//			 against all of them in one pass, rather than one
+//			 at a time. Any which can't be combined are left
+//			 to be tested separately.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void ExcludeList::CompileCombinedRegex()
+{
+	FreeCombinedRegex();
+
+	std::string combined, prefix;
+	for(unsigned int i = 0; i < mRegexStr.size(); i++)
+	{
+		bool prefixStable;
+		if(!CanCombineRegex(mRegexStr[i], prefixStable))
+		{
+			mSeparateRegex.push_back(mRegex[i]);
+			continue;
+		}
+
+		std::string alternative = "(" + mRegexStr[i] + ")";
+		combined += (combined.empty() ? "" : "|") + alternative;
+		if(prefixStable)
+		{
+			prefix += (prefix.empty() ? "" : "|") + alternative;
+		}
+	}
+
+	if(!combined.empty())
+	{
+		mpCombinedRegex = CompileRegex(combined);
+		if(mpCombinedRegex == 0)
+		{
+			BOX_TRACE("Failed to combine regular expressions, "
+				"testing them separately");
+			mSeparateRegex = mRegex;
+			return;
+		}
+	}
+
+	if(!prefix.empty())
+	{
+		mpPrefixRegex = CompileRegex(prefix);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    ExcludeList::FreeCombinedRegex()
+//		Purpose: Frees the combined expressions, leaving only the
+//			 separate ones in mRegex
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void ExcludeList::FreeCombinedRegex()
+{
+	if(mpCombinedRegex != 0)
+	{
+		::regfree(mpCombinedRegex);
+		delete mpCombinedRegex;
+		mpCombinedRegex = 0;
+	}
+
+	if(mpPrefixRegex != 0)
+	{
+		::regfree(mpPrefixRegex);
+		delete mpPrefixRegex;
+		mpPrefixRegex = 0;
+	}
+
+	mSeparateRegex.clear();
+	mLastPrefix.clear();
+	mLastPrefixMatched = false;
+}
+#endif // HAVE_REGEX_SUPPORT
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -233,11 +478,11 @@ void ExcludeList::AddRegexEntries(const std::string &rEntries)
 // --------------------------------------------------------------------------
 bool ExcludeList::IsExcluded(const std::string &rTest) const
 {
-	std::string test = rTest;
-
 	#ifdef WIN32
 	// converts to lower case as well
-	test = ReplaceSlashesDefinite(test);
+	std::string test = ReplaceSlashesDefinite(rTest);
+	#else
+	const std::string &test(rTest);
 	#endif
 
 	// Check against the always include list
@@ -259,7 +504,38 @@ bool ExcludeList::IsExcluded(const std::string &rTest) const
 	
 	// Check against regular expressions
 #ifdef HAVE_REGEX_SUPPORT
-	for(std::vector<regex_t *>::const_iterator i(mRegex.begin()); i != mRegex.end(); ++i)
+	if(mpPrefixRegex != 0)
+	{
+		// Paths are mostly tested a directory at a time, so remember
+		// whether the last directory was matched, which excludes
+		// everything in it.
+		std::string::size_type pos =
+			test.rfind(DIRECTORY_SEPARATOR_ASCHAR);
+		if(pos != std::string::npos && pos > 0)
+		{
+			if(mLastPrefix.size() != pos ||
+				test.compare(0, pos, mLastPrefix) != 0)
+			{
+				mLastPrefix.assign(test, 0, pos);
+				mLastPrefixMatched = (::regexec(mpPrefixRegex,
+					mLastPrefix.c_str(), 0, 0, 0) == 0);
+			}
+
+			if(mLastPrefixMatched)
+			{
+				return true;
+			}
+		}
+	}
+
+	if(mpCombinedRegex != 0 &&
+		::regexec(mpCombinedRegex, test.c_str(), 0, 0, 0) == 0)
+	{
+		return true;
+	}
+
+	for(std::vector<regex_t *>::const_iterator i(mSeparateRegex.begin());
+		i != mSeparateRegex.end(); ++i)
 	{
 		// Test against this expression
 		if(regexec(*i, test.c_str(), 0, 0 /* no match information required */, 0 /* no flags */) == 0)
@@ -315,6 +591,8 @@ void ExcludeList::Deserialize(Archive & rArchive)
 	mDefinite.clear();
 
 #ifdef HAVE_REGEX_SUPPORT
+	FreeCombinedRegex();
+
 	// free regex memory
 	while(mRegex.size() > 0)
 	{
@@ -371,8 +649,8 @@ void ExcludeList::Deserialize(Archive & rArchive)
 			try
 			{
 				// Compile
-				if(::regcomp(pregex, strItem.c_str(), 
-					REG_EXTENDED | REG_NOSUB) != 0)
+				if(::regcomp(pregex, strItem.c_str(),
+					GetRegexFlags()) != 0)
 				{
 					THROW_EXCEPTION(CommonException, 
 						BadRegularExpression)
@@ -392,6 +670,8 @@ void ExcludeList::Deserialize(Archive & rArchive)
 			}
 		}
 	}
+
+	CompileCombinedRegex();
 #endif // HAVE_REGEX_SUPPORT
 
 	//
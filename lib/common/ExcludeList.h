@@ -61,6 +61,21 @@ private:
 #ifdef HAVE_REGEX_SUPPORT
 	std::vector<regex_t *> mRegex;
 	std::vector<std::string> mRegexStr;	// save original regular expression string-based source for Serialize
+
+	void CompileCombinedRegex();
+	void FreeCombinedRegex();
+
+	// All the expressions which can be tested together, as one
+	regex_t *mpCombinedRegex;
+	// The rest, which must be tested one at a time (not owned)
+	std::vector<regex_t *> mSeparateRegex;
+	// The expressions which match everything in a directory if they
+	// match the directory's own path
+	regex_t *mpPrefixRegex;
+	// The directory of the last path tested, and whether
+	// mpPrefixRegex matched it
+	mutable std::string mLastPrefix;
+	mutable bool mLastPrefixMatched;
 #endif
 
 #ifdef WIN32
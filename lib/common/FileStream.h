@@ -56,6 +56,7 @@ public:
 		return std::string("local file ") + mFileName;
 	}
 	const std::string GetFileName() const { return mFileName; }
+	tOSFileHandle GetFileHandle() const { return mOSFileHandle; }
 
 private:
 	tOSFileHandle mOSFileHandle;
@@ -0,0 +1,459 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileBlockChecksums.cpp
+//		Purpose: CRC32C of every block of a RaidFile component
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define RAIDFILE_HAVE_SSE42_CRC32C
+	#include <nmmintrin.h>
+#endif
+
+#include "FileStream.h"
+#include "RaidFileBlockChecksums.h"
+#include "RaidFileException.h"
+#include "Utils.h"
+
+#include "MemLeakFindOn.h"
+
+#define CHECKSUMS_MAGIC_VALUE	0x52464331 // RFC1
+
+// Castagnoli polynomial, bit reversed
+#define CRC32C_POLYNOMIAL	0x82f63b78
+
+typedef struct
+{
+	int32_t mMagicValue;	// also the version number
+	int32_t mBlockSize;
+	int64_t mComponentSize;
+	int64_t mComponentInode;
+	// Then a CRC32C for each block of the component
+} checksums_StreamFormat;
+
+static bool sTableInitialised = false;
+static uint32_t sTable[256];
+
+#ifdef RAIDFILE_HAVE_SSE42_CRC32C
+static bool sHaveSSE42 = false;
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    InitialiseTable()
+//		Purpose: Build the byte at a time table for the software
+//				 CRC32C, and see if the CPU can do it instead.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void InitialiseTable()
+{
+	if(sTableInitialised)
+	{
+		return;
+	}
+
+	for(uint32_t b = 0; b < 256; ++b)
+	{
+		uint32_t crc = b;
+		for(int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLYNOMIAL)
+				: (crc >> 1);
+		}
+		sTable[b] = crc;
+	}
+
+#ifdef RAIDFILE_HAVE_SSE42_CRC32C
+	sHaveSSE42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+	sTableInitialised = true;
+}
+
+#ifdef RAIDFILE_HAVE_SSE42_CRC32C
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CalculateSSE42(uint32_t, const uint8_t *, int)
+//		Purpose: CRC32C using the SSE4.2 CRC32 instruction, eight
+//				 bytes at a time where possible.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+__attribute__((target("sse4.2")))
+static uint32_t CalculateSSE42(uint32_t crc, const uint8_t *pData, int NBytes)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	for(; NBytes >= 8; NBytes -= 8, pData += 8)
+	{
+		uint64_t value;
+		::memcpy(&value, pData, sizeof(value));
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for(; NBytes >= 4; NBytes -= 4, pData += 4)
+	{
+		uint32_t value;
+		::memcpy(&value, pData, sizeof(value));
+		crc = _mm_crc32_u32(crc, value);
+	}
+	for(; NBytes > 0; --NBytes, ++pData)
+	{
+		crc = _mm_crc32_u8(crc, *pData);
+	}
+	return crc;
+}
+#endif // RAIDFILE_HAVE_SSE42_CRC32C
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Calculate(const void *, int, uint32_t)
+//		Purpose: CRC32C of the data, using the SSE4.2 instruction
+//				 where the CPU has it, and a table lookup per byte
+//				 otherwise. Pass the result of the previous call as
+//				 Previous to checksum data in several pieces.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+uint32_t RaidFileBlockChecksums::Calculate(const void *pData, int NBytes,
+	uint32_t Previous)
+{
+	InitialiseTable();
+
+	const uint8_t *data = (const uint8_t *)pData;
+	uint32_t crc = ~Previous;
+
+#ifdef RAIDFILE_HAVE_SSE42_CRC32C
+	if(sHaveSSE42)
+	{
+		return ~CalculateSSE42(crc, data, NBytes);
+	}
+#endif
+
+	for(int l = 0; l < NBytes; ++l)
+	{
+		crc = sTable[(crc ^ data[l]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::RaidFileBlockChecksums()
+//		Purpose: Constructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileBlockChecksums::RaidFileBlockChecksums()
+	: mBlockSize(0),
+	  mComponentSize(0),
+	  mCurrentChecksum(0),
+	  mBytesInCurrentBlock(0),
+	  mLoaded(false)
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::~RaidFileBlockChecksums()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileBlockChecksums::~RaidFileBlockChecksums()
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Delete(const std::string &)
+//		Purpose: Delete the checksums of a component, if it has any
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileBlockChecksums::Delete(const std::string &rComponentFilename)
+{
+	std::string filename(GetFilename(rComponentFilename));
+	if(EMU_UNLINK(filename.c_str()) != 0 && errno != ENOENT)
+	{
+		BOX_LOG_SYS_WARNING("Failed to delete RaidFile checksums: " <<
+			filename);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Start(unsigned int)
+//		Purpose: Start checksumming a component as it's written
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileBlockChecksums::Start(unsigned int BlockSize)
+{
+	Clear();
+	mBlockSize = BlockSize;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Add(const void *, int)
+//		Purpose: Checksum the next data written to the component
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileBlockChecksums::Add(const void *pData, int NBytes)
+{
+	ASSERT(mBlockSize > 0);
+	const uint8_t *data = (const uint8_t *)pData;
+
+	while(NBytes > 0)
+	{
+		int bytes = mBlockSize - mBytesInCurrentBlock;
+		if(bytes > NBytes)
+		{
+			bytes = NBytes;
+		}
+
+		mCurrentChecksum = Calculate(data, bytes, mCurrentChecksum);
+		mBytesInCurrentBlock += bytes;
+		mComponentSize += bytes;
+		data += bytes;
+		NBytes -= bytes;
+
+		if(mBytesInCurrentBlock == mBlockSize)
+		{
+			mChecksums.push_back(mCurrentChecksum);
+			mCurrentChecksum = 0;
+			mBytesInCurrentBlock = 0;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Write(const std::string &, int)
+//		Purpose: Write the checksums of everything added, to the named
+//				 file, for the component open as ComponentHandle.
+//				 The component must have been written exactly as
+//				 checksummed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileBlockChecksums::Write(const std::string &rFilename,
+	int ComponentHandle)
+{
+	if(mBytesInCurrentBlock > 0)
+	{
+		mChecksums.push_back(mCurrentChecksum);
+		mCurrentChecksum = 0;
+		mBytesInCurrentBlock = 0;
+	}
+
+	struct stat st;
+	if(::fstat(ComponentHandle, &st) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to stat RaidFile component",
+			rFilename, RaidFileException, OSError);
+	}
+	if(st.st_size != mComponentSize)
+	{
+		THROW_FILE_ERROR("RaidFile component is " << st.st_size <<
+			" bytes but " << mComponentSize << " were checksummed",
+			rFilename, RaidFileException, Internal);
+	}
+
+	std::vector<uint8_t> data(sizeof(checksums_StreamFormat) +
+		(mChecksums.size() * sizeof(uint32_t)));
+	checksums_StreamFormat header;
+	header.mMagicValue = htonl(CHECKSUMS_MAGIC_VALUE);
+	header.mBlockSize = htonl(mBlockSize);
+	header.mComponentSize = box_hton64(mComponentSize);
+	header.mComponentInode = box_hton64((int64_t)st.st_ino);
+	::memcpy(&data[0], &header, sizeof(header));
+	for(size_t b = 0; b < mChecksums.size(); ++b)
+	{
+		uint32_t crc = htonl(mChecksums[b]);
+		::memcpy(&data[sizeof(header) + (b * sizeof(crc))], &crc,
+			sizeof(crc));
+	}
+
+	FileStream file(rFilename, O_WRONLY | O_CREAT | O_EXCL | O_BINARY);
+	file.Write(&data[0], data.size());
+	file.Close();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Load(const std::string &, int,
+//				 unsigned int)
+//		Purpose: Load the checksums of the component open as
+//				 ComponentHandle. Returns false, leaving nothing to
+//				 check against, if it has none, or they're unreadable
+//				 or were made for another version of the file.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileBlockChecksums::Load(const std::string &rComponentFilename,
+	int ComponentHandle, unsigned int BlockSize)
+{
+	Clear();
+
+	struct stat st;
+	if(::fstat(ComponentHandle, &st) != 0)
+	{
+		return false;
+	}
+
+	std::string filename(GetFilename(rComponentFilename));
+	int handle = ::open(filename.c_str(), O_RDONLY | O_BINARY);
+	if(handle == -1)
+	{
+		if(errno != ENOENT)
+		{
+			BOX_LOG_SYS_WARNING("Failed to open RaidFile "
+				"checksums: " << filename);
+		}
+		return false;
+	}
+
+	int64_t numBlocks = (st.st_size + (BlockSize - 1)) / BlockSize;
+	std::vector<uint8_t> data(sizeof(checksums_StreamFormat) +
+		(numBlocks * sizeof(uint32_t)));
+	int bytes = 0;
+	while(bytes < (int)data.size())
+	{
+		int r = ::read(handle, &data[bytes], data.size() - bytes);
+		if(r <= 0)
+		{
+			break;
+		}
+		bytes += r;
+	}
+	char extra;
+	bool tooLong = (bytes == (int)data.size() &&
+		::read(handle, &extra, 1) != 0);
+	::close(handle);
+
+	checksums_StreamFormat header;
+	if(bytes != (int)data.size() || tooLong)
+	{
+		BOX_WARNING("Ignoring RaidFile checksums of the wrong size: " <<
+			filename);
+		return false;
+	}
+	::memcpy(&header, &data[0], sizeof(header));
+	if((int32_t)ntohl(header.mMagicValue) != CHECKSUMS_MAGIC_VALUE ||
+		(int32_t)ntohl(header.mBlockSize) != (int32_t)BlockSize)
+	{
+		BOX_WARNING("Ignoring RaidFile checksums with bad header: " <<
+			filename);
+		return false;
+	}
+	if((int64_t)box_ntoh64(header.mComponentSize) != (int64_t)st.st_size ||
+		(int64_t)box_ntoh64(header.mComponentInode) != (int64_t)st.st_ino)
+	{
+		// Left over from an earlier version of the file, or the
+		// file is being replaced right now
+		BOX_TRACE("Ignoring RaidFile checksums for a different "
+			"version of the file: " << filename);
+		return false;
+	}
+
+	mBlockSize = BlockSize;
+	mComponentSize = st.st_size;
+	mChecksums.resize(numBlocks);
+	for(int64_t b = 0; b < numBlocks; ++b)
+	{
+		uint32_t crc;
+		::memcpy(&crc, &data[sizeof(header) + (b * sizeof(crc))],
+			sizeof(crc));
+		mChecksums[b] = ntohl(crc);
+	}
+	mLoaded = true;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::GetBlockLength(int64_t)
+//		Purpose: How much of the component is in a block. All but
+//				 the last are full.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int RaidFileBlockChecksums::GetBlockLength(int64_t Block) const
+{
+	int64_t left = mComponentSize - (Block * mBlockSize);
+	if(left <= 0)
+	{
+		return 0;
+	}
+	return (left < (int64_t)mBlockSize) ? (int)left : (int)mBlockSize;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Verify(int64_t, const void *)
+//		Purpose: Check a block read from the component, which must
+//				 be all the bytes of the block that the component
+//				 has. Anything past the end of the component is
+//				 ignored. Always true if nothing is loaded.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileBlockChecksums::Verify(int64_t Block, const void *pData) const
+{
+	if(!mLoaded || Block < 0 || Block >= (int64_t)mChecksums.size())
+	{
+		return true;
+	}
+
+	return Calculate(pData, GetBlockLength(Block)) == mChecksums[Block];
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileBlockChecksums::Clear()
+//		Purpose: Forget everything
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileBlockChecksums::Clear()
+{
+	mBlockSize = 0;
+	mComponentSize = 0;
+	mChecksums.clear();
+	mCurrentChecksum = 0;
+	mBytesInCurrentBlock = 0;
+	mLoaded = false;
+}
@@ -0,0 +1,70 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileBlockChecksums.h
+//		Purpose: CRC32C of every block of a RaidFile component
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef RAIDFILEBLOCKCHECKSUMS__H
+#define RAIDFILEBLOCKCHECKSUMS__H
+
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    RaidFileBlockChecksums
+//		Purpose: The checksums of each block sized chunk of one
+//				 component (stripe or parity file) of a transformed
+//				 RaidFile, kept in a file next to the component with
+//				 an extra 'c' on the end of its name. The file records
+//				 the size and inode number of the component it was
+//				 made for, so that checksums left over from an earlier
+//				 version of the file are ignored rather than reported
+//				 as damage.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class RaidFileBlockChecksums
+{
+public:
+	RaidFileBlockChecksums();
+	~RaidFileBlockChecksums();
+
+	// CRC32C, which can be continued by passing in the previous result
+	static uint32_t Calculate(const void *pData, int NBytes,
+		uint32_t Previous = 0);
+
+	static std::string GetFilename(const std::string &rComponentFilename)
+	{
+		return rComponentFilename + 'c';
+	}
+	static void Delete(const std::string &rComponentFilename);
+
+	// Making the checksums as a component is written
+	void Start(unsigned int BlockSize);
+	void Add(const void *pData, int NBytes);
+	void Write(const std::string &rFilename, int ComponentHandle);
+
+	// Checking a component
+	bool Load(const std::string &rComponentFilename, int ComponentHandle,
+		unsigned int BlockSize);
+	bool IsLoaded() const {return mLoaded;}
+	int64_t GetNumBlocks() const {return mChecksums.size();}
+	int GetBlockLength(int64_t Block) const;
+	bool Verify(int64_t Block, const void *pData) const;
+	void Clear();
+
+private:
+	unsigned int mBlockSize;
+	int64_t mComponentSize;
+	std::vector<uint32_t> mChecksums;
+	uint32_t mCurrentChecksum;
+	unsigned int mBytesInCurrentBlock;
+	bool mLoaded;
+};
+
+#endif // RAIDFILEBLOCKCHECKSUMS__H
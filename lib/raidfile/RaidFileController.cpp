@@ -11,7 +11,11 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <sstream>
+
 #include "RaidFileController.h"
+#include "RaidFileErasureCode.h"
 #include "RaidFileException.h"
 #include "Configuration.h"
 
@@ -76,8 +80,25 @@ void RaidFileController::Initialise(const std::string& rConfigFilename)
 			ConfigTest_Exists | ConfigTest_IsInt),
 		ConfigurationVerifyKey("Dir0", ConfigTest_Exists),
 		ConfigurationVerifyKey("Dir1", ConfigTest_Exists),
-		ConfigurationVerifyKey("Dir2",
-			ConfigTest_Exists | ConfigTest_LastEntry)
+		ConfigurationVerifyKey("Dir2", ConfigTest_Exists),
+		// Extra discs for erasure coded disc sets
+		ConfigurationVerifyKey("Dir3", 0),
+		ConfigurationVerifyKey("Dir4", 0),
+		ConfigurationVerifyKey("Dir5", 0),
+		ConfigurationVerifyKey("Dir6", 0),
+		ConfigurationVerifyKey("Dir7", 0),
+		ConfigurationVerifyKey("Dir8", 0),
+		ConfigurationVerifyKey("Dir9", 0),
+		ConfigurationVerifyKey("Dir10", 0),
+		ConfigurationVerifyKey("Dir11", 0),
+		ConfigurationVerifyKey("Dir12", 0),
+		ConfigurationVerifyKey("Dir13", 0),
+		ConfigurationVerifyKey("Dir14", 0),
+		ConfigurationVerifyKey("Dir15", 0),
+		ConfigurationVerifyKey("ParityDiscs", ConfigTest_IsInt),
+		// Keep a CRC32C of every block of every transformed file
+		ConfigurationVerifyKey("BlockChecksums",
+			ConfigTest_IsBool | ConfigTest_LastEntry, false)
 	};
 	
 	static const ConfigurationVerify subverify = 
@@ -125,7 +146,55 @@ void RaidFileController::Initialise(const std::string& rConfigFilename)
 		{
 			THROW_EXCEPTION(RaidFileException, BadConfigFile)			
 		}
+
+		if(disc.KeyExists("ParityDiscs"))
+		{
+			// Erasure coded set: Dir0 to DirN, all different
+			int parityDiscs = disc.GetKeyValueInt("ParityDiscs");
+			RaidFileDiscSet set(setNum, (unsigned int)disc.GetKeyValueInt("BlockSize"),
+				parityDiscs);
+			set.SetBlockChecksums(disc.GetKeyValueBool("BlockChecksums"));
+			for(int d = 0; d < RAIDFILE_MAX_DISCS_IN_SET; ++d)
+			{
+				std::ostringstream key;
+				key << "Dir" << d;
+				if(!disc.KeyExists(key.str()))
+				{
+					break;
+				}
+				std::string dir(disc.GetKeyValue(key.str()));
+				if(std::find(set.begin(), set.end(), dir) != set.end())
+				{
+					THROW_EXCEPTION_MESSAGE(RaidFileException, BadConfigFile,
+						"Disc set " << setNum << " uses directory " <<
+						dir << " more than once");
+				}
+				set.push_back(dir);
+			}
+
+			if(parityDiscs < 1 || set.GetNumDataDiscs() < 1)
+			{
+				THROW_EXCEPTION_MESSAGE(RaidFileException, BadConfigFile,
+					"Disc set " << setNum << " has " << set.size() <<
+					" discs, which is not enough for " << parityDiscs <<
+					" parity discs");
+			}
+
+			mSetList.push_back(set);
+			expectedSetNum++;
+			continue;
+		}
+
+		if(disc.KeyExists("Dir3"))
+		{
+			// Only erasure coded sets may have more than three discs
+			THROW_EXCEPTION_MESSAGE(RaidFileException, BadConfigFile,
+				"Disc set " << setNum << " has more than three "
+				"directories but no ParityDiscs setting");
+		}
+
 		RaidFileDiscSet set(setNum, (unsigned int)disc.GetKeyValueInt("BlockSize"));
+		set.SetBlockChecksums(disc.GetKeyValueBool("BlockChecksums"));
 		// Get the values of the directory keys
 		std::string d0(disc.GetKeyValue("Dir0"));
 		std::string d1(disc.GetKeyValue("Dir1"));
@@ -30,15 +30,19 @@
 class RaidFileDiscSet : public std::vector<std::string>
 {
 public:
-	RaidFileDiscSet(int SetID, unsigned int BlockSize)
+	RaidFileDiscSet(int SetID, unsigned int BlockSize, int ErasureParityDiscs = 0)
 		: mSetID(SetID),
-		  mBlockSize(BlockSize)
+		  mBlockSize(BlockSize),
+		  mErasureParityDiscs(ErasureParityDiscs),
+		  mBlockChecksums(false)
 	{
 	}
 	RaidFileDiscSet(const RaidFileDiscSet &rToCopy)
 		: std::vector<std::string>(rToCopy),
 		  mSetID(rToCopy.mSetID),
-		  mBlockSize(rToCopy.mBlockSize)
+		  mBlockSize(rToCopy.mBlockSize),
+		  mErasureParityDiscs(rToCopy.mErasureParityDiscs),
+		  mBlockChecksums(rToCopy.mBlockChecksums)
 	{
 	}
 	
@@ -55,9 +59,32 @@ public:
 	// Is this disc set a non-RAID disc set? (ie files never get transformed to raid storage)
 	bool IsNonRaidSet() const {return 1 == size();}
 
+	// Is this an N+M Reed-Solomon disc set, rather than the classic
+	// two stripes plus XOR parity layout?
+	bool IsErasureCodedSet() const {return mErasureParityDiscs > 0;}
+
+	// How many discs hold parity, and how many of the discs must be
+	// readable to read a file back
+	int GetNumParityDiscs() const
+	{
+		return IsErasureCodedSet() ? mErasureParityDiscs
+			: (IsNonRaidSet() ? 0 : 1);
+	}
+	int GetNumDataDiscs() const {return (int)size() - GetNumParityDiscs();}
+
+	// Are the blocks of transformed files checksummed, so that damage
+	// which the disc doesn't report can be found and repaired?
+	bool HasBlockChecksums() const {return mBlockChecksums;}
+	void SetBlockChecksums(bool BlockChecksums)
+	{
+		mBlockChecksums = BlockChecksums;
+	}
+
 private:
 	int mSetID;
 	unsigned int mBlockSize;
+	int mErasureParityDiscs;
+	bool mBlockChecksums;
 };
 
 class _RaidFileController;	// compiler warning avoidance
@@ -0,0 +1,404 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileErasureCode.cpp
+//		Purpose: Reed-Solomon erasure coding for N+M RaidFile disc sets
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define RAIDFILE_HAVE_SSSE3_KERNEL
+	#include <tmmintrin.h>
+#endif
+
+#include "RaidFileErasureCode.h"
+#include "RaidFileException.h"
+
+#include "MemLeakFindOn.h"
+
+// Field generator polynomial x^8 + x^4 + x^3 + x^2 + 1
+#define GF_POLYNOMIAL	0x11d
+
+static bool sTablesInitialised = false;
+static uint8_t sExp[512];
+static uint8_t sLog[256];
+// Full multiplication table, one 256 byte row per coefficient, used by the
+// scalar kernel and to build the nibble tables for the SIMD kernel.
+static uint8_t sMul[256][256];
+
+#ifdef RAIDFILE_HAVE_SSSE3_KERNEL
+static bool sHaveSSSE3 = false;
+#endif
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::InitialiseTables()
+//		Purpose: Build the log, exp and multiplication tables
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileErasureCode::InitialiseTables()
+{
+	if(sTablesInitialised)
+	{
+		return;
+	}
+
+	int x = 1;
+	for(int l = 0; l < 255; ++l)
+	{
+		sExp[l] = x;
+		sLog[x] = l;
+		x <<= 1;
+		if(x & 0x100)
+		{
+			x ^= GF_POLYNOMIAL;
+		}
+	}
+	// Duplicate, so that sExp[sLog[a] + sLog[b]] never needs a modulo
+	for(int l = 255; l < 512; ++l)
+	{
+		sExp[l] = sExp[l - 255];
+	}
+	sLog[0] = 0;	// never used
+
+	for(int a = 0; a < 256; ++a)
+	{
+		for(int b = 0; b < 256; ++b)
+		{
+			sMul[a][b] = (a == 0 || b == 0) ? 0
+				: sExp[sLog[a] + sLog[b]];
+		}
+	}
+
+#ifdef RAIDFILE_HAVE_SSSE3_KERNEL
+	sHaveSSSE3 = __builtin_cpu_supports("ssse3");
+#endif
+
+	sTablesInitialised = true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::RaidFileErasureCode(int, int)
+//		Purpose: Constructor, builds the parity part of the coding
+//				 matrix for this geometry.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileErasureCode::RaidFileErasureCode(int DataDiscs, int ParityDiscs)
+	: mDataDiscs(DataDiscs),
+	  mParityDiscs(ParityDiscs)
+{
+	if(DataDiscs < 1 || ParityDiscs < 1 ||
+		(DataDiscs + ParityDiscs) > RAIDFILE_MAX_DISCS_IN_SET)
+	{
+		THROW_EXCEPTION(RaidFileException, WrongNumberOfDiscsInSet)
+	}
+
+	InitialiseTables();
+
+	// Cauchy matrix: element (p, d) = 1 / (x_p + y_d), with x_p = k + p
+	// and y_d = d all distinct. Every square submatrix of a Cauchy matrix
+	// is invertible, so [I; C] can rebuild from any k rows.
+	mParityMatrix.resize(ParityDiscs * DataDiscs);
+	for(int p = 0; p < ParityDiscs; ++p)
+	{
+		for(int d = 0; d < DataDiscs; ++d)
+		{
+			mParityMatrix[(p * DataDiscs) + d] =
+				Inverse((uint8_t)((DataDiscs + p) ^ d));
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::Multiply(uint8_t, uint8_t)
+//		Purpose: Multiplication in GF(2^8)
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+uint8_t RaidFileErasureCode::Multiply(uint8_t a, uint8_t b)
+{
+	InitialiseTables();
+	return sMul[a][b];
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::Inverse(uint8_t)
+//		Purpose: Multiplicative inverse in GF(2^8)
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+uint8_t RaidFileErasureCode::Inverse(uint8_t a)
+{
+	InitialiseTables();
+	if(a == 0)
+	{
+		THROW_EXCEPTION(RaidFileException, Internal)
+	}
+	return sExp[255 - sLog[a]];
+}
+
+#ifdef RAIDFILE_HAVE_SSSE3_KERNEL
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    MultiplyAddSSSE3(uint8_t *, const uint8_t *, uint8_t, int)
+//		Purpose: SIMD kernel, 16 bytes at a time. Multiplication by a
+//				 constant is linear, so c*x = c*(x & 0xf) ^ c*(x & 0xf0),
+//				 and each half is a 16 entry table lookup with PSHUFB.
+//				 Returns the number of bytes processed.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+__attribute__((target("ssse3")))
+static int MultiplyAddSSSE3(uint8_t *pDest, const uint8_t *pSrc,
+	const uint8_t *pMulRow, int Length)
+{
+	uint8_t lowTable[16], highTable[16];
+	for(int l = 0; l < 16; ++l)
+	{
+		lowTable[l] = pMulRow[l];
+		highTable[l] = pMulRow[l << 4];
+	}
+
+	__m128i low = _mm_loadu_si128((const __m128i *)lowTable);
+	__m128i high = _mm_loadu_si128((const __m128i *)highTable);
+	__m128i mask = _mm_set1_epi8(0x0f);
+
+	int done = 0;
+	for(; done + 16 <= Length; done += 16)
+	{
+		__m128i src = _mm_loadu_si128((const __m128i *)(pSrc + done));
+		__m128i dst = _mm_loadu_si128((const __m128i *)(pDest + done));
+		__m128i lo = _mm_and_si128(src, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi64(src, 4), mask);
+		__m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, lo),
+			_mm_shuffle_epi8(high, hi));
+		_mm_storeu_si128((__m128i *)(pDest + done),
+			_mm_xor_si128(dst, product));
+	}
+
+	return done;
+}
+#endif // RAIDFILE_HAVE_SSSE3_KERNEL
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::MultiplyAdd(uint8_t *, const uint8_t *, uint8_t, int)
+//		Purpose: Dest ^= Coefficient * Src over Length bytes. Uses the
+//				 SSSE3 kernel where the CPU supports it, and a table
+//				 lookup per byte for the remainder or otherwise.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileErasureCode::MultiplyAdd(uint8_t *pDest, const uint8_t *pSrc,
+	uint8_t Coefficient, int Length)
+{
+	InitialiseTables();
+
+	if(Coefficient == 0)
+	{
+		return;
+	}
+
+	int done = 0;
+	if(Coefficient == 1)
+	{
+		for(; done < Length; ++done)
+		{
+			pDest[done] ^= pSrc[done];
+		}
+		return;
+	}
+
+	const uint8_t *mulRow = sMul[Coefficient];
+
+#ifdef RAIDFILE_HAVE_SSSE3_KERNEL
+	if(sHaveSSSE3)
+	{
+		done = MultiplyAddSSSE3(pDest, pSrc, mulRow, Length);
+	}
+#endif
+
+	for(; done < Length; ++done)
+	{
+		pDest[done] ^= mulRow[pSrc[done]];
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::Encode(const uint8_t * const *, uint8_t * const *, int)
+//		Purpose: Calculate the parity blocks for one row of data blocks
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileErasureCode::Encode(const uint8_t * const *pData,
+	uint8_t * const *pParity, int Length) const
+{
+	for(int p = 0; p < mParityDiscs; ++p)
+	{
+		::memset(pParity[p], 0, Length);
+		for(int d = 0; d < mDataDiscs; ++d)
+		{
+			MultiplyAdd(pParity[p], pData[d],
+				mParityMatrix[(p * mDataDiscs) + d], Length);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::InvertMatrix(std::vector<uint8_t> &, int)
+//		Purpose: Gauss-Jordan inversion of a square matrix in place.
+//				 Returns false if the matrix is singular.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileErasureCode::InvertMatrix(std::vector<uint8_t> &rMatrix, int Size) const
+{
+	std::vector<uint8_t> inverse(Size * Size, 0);
+	for(int l = 0; l < Size; ++l)
+	{
+		inverse[(l * Size) + l] = 1;
+	}
+
+	for(int col = 0; col < Size; ++col)
+	{
+		// Find a pivot
+		int pivot = col;
+		while(pivot < Size && rMatrix[(pivot * Size) + col] == 0)
+		{
+			++pivot;
+		}
+		if(pivot == Size)
+		{
+			return false;
+		}
+		if(pivot != col)
+		{
+			for(int l = 0; l < Size; ++l)
+			{
+				std::swap(rMatrix[(pivot * Size) + l], rMatrix[(col * Size) + l]);
+				std::swap(inverse[(pivot * Size) + l], inverse[(col * Size) + l]);
+			}
+		}
+
+		// Scale the pivot row to 1
+		uint8_t scale = Inverse(rMatrix[(col * Size) + col]);
+		for(int l = 0; l < Size; ++l)
+		{
+			rMatrix[(col * Size) + l] = sMul[scale][rMatrix[(col * Size) + l]];
+			inverse[(col * Size) + l] = sMul[scale][inverse[(col * Size) + l]];
+		}
+
+		// Eliminate this column from every other row
+		for(int row = 0; row < Size; ++row)
+		{
+			uint8_t factor = rMatrix[(row * Size) + col];
+			if(row == col || factor == 0)
+			{
+				continue;
+			}
+			for(int l = 0; l < Size; ++l)
+			{
+				rMatrix[(row * Size) + l] ^= sMul[factor][rMatrix[(col * Size) + l]];
+				inverse[(row * Size) + l] ^= sMul[factor][inverse[(col * Size) + l]];
+			}
+		}
+	}
+
+	rMatrix.swap(inverse);
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileErasureCode::Reconstruct(uint8_t * const *, const bool *, int)
+//		Purpose: Rebuild missing data blocks from any k present components
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileErasureCode::Reconstruct(uint8_t * const *pComponents,
+	const bool *pPresent, int Length) const
+{
+	// Anything to do?
+	std::vector<int> missing;
+	for(int d = 0; d < mDataDiscs; ++d)
+	{
+		if(!pPresent[d])
+		{
+			missing.push_back(d);
+		}
+	}
+	if(missing.empty())
+	{
+		return;
+	}
+
+	// Choose k components to decode from, preferring data blocks, which
+	// contribute an identity row to the decoding matrix
+	std::vector<int> use;
+	for(int c = 0; c < (mDataDiscs + mParityDiscs) && (int)use.size() < mDataDiscs; ++c)
+	{
+		if(pPresent[c])
+		{
+			use.push_back(c);
+		}
+	}
+	if((int)use.size() < mDataDiscs)
+	{
+		THROW_EXCEPTION(RaidFileException, FileIsDamagedNotRecoverable)
+	}
+
+	// Build the rows of the coding matrix for the components we have...
+	std::vector<uint8_t> matrix(mDataDiscs * mDataDiscs, 0);
+	for(int r = 0; r < mDataDiscs; ++r)
+	{
+		int c = use[r];
+		for(int d = 0; d < mDataDiscs; ++d)
+		{
+			matrix[(r * mDataDiscs) + d] = (c < mDataDiscs)
+				? ((c == d) ? 1 : 0)
+				: mParityMatrix[((c - mDataDiscs) * mDataDiscs) + d];
+		}
+	}
+
+	// ...and invert it to get the data back from them
+	if(!InvertMatrix(matrix, mDataDiscs))
+	{
+		THROW_EXCEPTION(RaidFileException, Internal)
+	}
+
+	for(std::vector<int>::const_iterator i(missing.begin());
+		i != missing.end(); ++i)
+	{
+		uint8_t *pOut = pComponents[*i];
+		::memset(pOut, 0, Length);
+		for(int r = 0; r < mDataDiscs; ++r)
+		{
+			MultiplyAdd(pOut, pComponents[use[r]],
+				matrix[((*i) * mDataDiscs) + r], Length);
+		}
+	}
+}
+
@@ -0,0 +1,64 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileErasureCode.h
+//		Purpose: Reed-Solomon erasure coding for N+M RaidFile disc sets
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef RAIDFILEERASURECODE__H
+#define RAIDFILEERASURECODE__H
+
+#include <vector>
+
+// Maximum number of discs (data plus parity) in an erasure coded disc set.
+// Limited by the bitmask of existing components in RaidFileUtil.
+#define RAIDFILE_MAX_DISCS_IN_SET	16
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    RaidFileErasureCode
+//		Purpose: Systematic Reed-Solomon code over GF(2^8), using a Cauchy
+//				 matrix for the parity rows, so that any k of the n
+//				 components of a stripe are enough to rebuild the data.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class RaidFileErasureCode
+{
+public:
+	RaidFileErasureCode(int DataDiscs, int ParityDiscs);
+
+	int GetNumDataDiscs() const {return mDataDiscs;}
+	int GetNumParityDiscs() const {return mParityDiscs;}
+
+	// Calculate ParityDiscs blocks of Length bytes from DataDiscs blocks
+	void Encode(const uint8_t * const *pData, uint8_t * const *pParity,
+		int Length) const;
+
+	// Rebuild the missing data blocks in place. pComponents has one entry
+	// per disc (data first, then parity), pPresent says which are valid.
+	// Missing parity blocks are not rebuilt.
+	void Reconstruct(uint8_t * const *pComponents, const bool *pPresent,
+		int Length) const;
+
+	// Dest ^= Coefficient * Src, the inner loop of both operations
+	static void MultiplyAdd(uint8_t *pDest, const uint8_t *pSrc,
+		uint8_t Coefficient, int Length);
+	static uint8_t Multiply(uint8_t a, uint8_t b);
+	static uint8_t Inverse(uint8_t a);
+
+private:
+	static void InitialiseTables();
+	bool InvertMatrix(std::vector<uint8_t> &rMatrix, int Size) const;
+
+	int mDataDiscs;
+	int mParityDiscs;
+	// ParityDiscs rows of DataDiscs coefficients
+	std::vector<uint8_t> mParityMatrix;
+};
+
+#endif // RAIDFILEERASURECODE__H
+
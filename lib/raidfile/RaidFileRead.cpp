@@ -33,10 +33,13 @@
 #include <cstring>
 #include <map>
 #include <memory>
+#include <vector>
 
+#include "RaidFileBlockChecksums.h"
 #include "RaidFileRead.h"
 #include "RaidFileException.h"
 #include "RaidFileController.h"
+#include "RaidFileErasureCode.h"
 #include "RaidFileUtil.h"
 
 #include "MemLeakFindOn.h"
@@ -50,6 +53,7 @@
 const RaidFileReadCategory RaidFileRead::OPEN_IN_RECOVERY("OpenInRecovery");
 const RaidFileReadCategory RaidFileRead::IO_ERROR("IoError");
 const RaidFileReadCategory RaidFileRead::RECOVERING_IO_ERROR("RecoverIoError");
+const RaidFileReadCategory RaidFileRead::CHECKSUM_ERROR("ChecksumError");
 
 // --------------------------------------------------------------------------
 //
@@ -290,6 +294,8 @@ public:
 	virtual bool StreamDataLeft();
 
 private:
+	void LoadChecksums(RaidFileDiscSet &rdiscSet, int StartDisc);
+	int ReadVerified(void *pBuffer, int NBytes, int Timeout);
 	int ReadRecovered(void *pBuffer, int NBytes);
 	void AttemptToRecoverFromIOError(bool Stripe1);
 	void SetPosition(pos_type FilePosition);
@@ -306,6 +312,10 @@ private:
 	pos_type mRecoveryBufferStart;
 	bool mLastBlockHasSize;
 	bool mEOF;
+	RaidFileBlockChecksums mStripeChecksums[2];
+	RaidFileBlockChecksums mParityChecksums;
+	char *mVerifiedBuffer;
+	pos_type mVerifiedBlock;
 };
 
 // --------------------------------------------------------------------------
@@ -327,7 +337,9 @@ RaidFileRead_Raid::RaidFileRead_Raid(int SetNumber, const std::string &Filename,
 	  mRecoveryBuffer(0),
 	  mRecoveryBufferStart(-1),
 	  mLastBlockHasSize(LastBlockHasSize),
-	  mEOF(false)
+	  mEOF(false),
+	  mVerifiedBuffer(0),
+	  mVerifiedBlock(-1)
 {
 	// Make sure size of the IOStream::pos_type matches the pos_type used
 	ASSERT(sizeof(pos_type) >= sizeof(off_t));
@@ -339,6 +351,8 @@ RaidFileRead_Raid::RaidFileRead_Raid(int SetNumber, const std::string &Filename,
 	}
 	else
 	{
+		mRecovered = true;
+
 		// Check we have at least one stripe and a parity file
 		if((mStripe1Handle == -1 && mStripe2Handle == -1) || mParityHandle == -1)
 		{
@@ -363,6 +377,42 @@ RaidFileRead_Raid::~RaidFileRead_Raid()
 	{
 		::free(mRecoveryBuffer);
 	}
+	if(mVerifiedBuffer != 0)
+	{
+		::free(mVerifiedBuffer);
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_Raid::LoadChecksums(RaidFileDiscSet &, int)
+//		Purpose: Load the block checksums of the open components, if
+//				 the disc set keeps them. Components without usable
+//				 checksums are read without checking.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_Raid::LoadChecksums(RaidFileDiscSet &rdiscSet, int StartDisc)
+{
+	if(!rdiscSet.HasBlockChecksums())
+	{
+		return;
+	}
+
+	int handles[3] = {mStripe1Handle, mStripe2Handle, mParityHandle};
+	RaidFileBlockChecksums *checksums[3] = {&mStripeChecksums[0],
+		&mStripeChecksums[1], &mParityChecksums};
+	for(int c = 0; c < 3; ++c)
+	{
+		if(handles[c] != -1)
+		{
+			checksums[c]->Load(RaidFileUtil::MakeRaidComponentName(
+				rdiscSet, mFilename, (c + StartDisc) %
+				READ_NUMBER_DISCS_REQUIRED), handles[c],
+				mBlockSize);
+		}
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -395,6 +445,12 @@ int RaidFileRead_Raid::Read(void *pBuffer, int NBytes, int Timeout)
 		// File is damaged, try a the recovery read function
 		return ReadRecovered(pBuffer, NBytes);
 	}
+
+	// Or do whole blocks need to be read to check them?
+	if(mStripeChecksums[0].IsLoaded() || mStripeChecksums[1].IsLoaded())
+	{
+		return ReadVerified(pBuffer, NBytes, Timeout);
+	}
 	
 	// Vectors for reading stuff from the files
 	struct iovec stripe1Reads[READV_MAX_BLOCKS];
@@ -485,6 +541,132 @@ int RaidFileRead_Raid::Read(void *pBuffer, int NBytes, int Timeout)
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_Raid::ReadVerified(void *, int, int)
+//		Purpose: Reads bytes from the file a whole block at a time,
+//				 checking each block against its checksum, and
+//				 switching to reading from parity if one is wrong.
+//				 The last block read is kept, so that small reads
+//				 don't check the same block over and over.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int RaidFileRead_Raid::ReadVerified(void *pBuffer, int NBytes, int Timeout)
+{
+	// Note: NBytes has been adjusted to definately be a range
+	// inside the given file length.
+
+	if(mVerifiedBuffer == 0)
+	{
+		mVerifiedBuffer = (char*)::malloc(mBlockSize);
+		if(mVerifiedBuffer == 0)
+		{
+			throw std::bad_alloc();
+		}
+	}
+
+	char *outptr = (char*)pBuffer;
+	int bytesToGo = NBytes;
+	pos_type position = mCurrentPosition;
+
+	try
+	{
+		while(bytesToGo > 0)
+		{
+			pos_type block = position / mBlockSize;
+			int offset = position % mBlockSize;
+			int whichStripe = (block & 1);
+			pos_type stripeBlock = block / 2;
+			RaidFileBlockChecksums &rchecksums(mStripeChecksums[whichStripe]);
+
+			if(block != mVerifiedBlock)
+			{
+				mVerifiedBlock = -1;
+				int handle = (whichStripe == 0)?mStripe1Handle:mStripe2Handle;
+				int blockBytes = rchecksums.IsLoaded()
+					? rchecksums.GetBlockLength(stripeBlock) : mBlockSize;
+				if(mFileSize - (block * mBlockSize) < blockBytes)
+				{
+					blockBytes = mFileSize - (block * mBlockSize);
+				}
+
+				int r = -1;
+				if(::lseek(handle, stripeBlock * mBlockSize, SEEK_SET) != -1)
+				{
+					r = 0;
+					while(r < blockBytes)
+					{
+						int bytes = ::read(handle, mVerifiedBuffer + r,
+							blockBytes - r);
+						if(bytes == -1)
+						{
+							r = -1;
+							break;
+						}
+						if(bytes == 0)
+						{
+							break;
+						}
+						r += bytes;
+					}
+				}
+
+				if(r == -1 && errno != EIO)
+				{
+					THROW_EXCEPTION(RaidFileException, OSError)
+				}
+				else if(r != -1 && r != blockBytes)
+				{
+					// Got the file sizes wrong/logic error!
+					THROW_EXCEPTION(RaidFileException, Internal)
+				}
+
+				if(r == -1 || !rchecksums.Verify(stripeBlock, mVerifiedBuffer))
+				{
+					if(r != -1)
+					{
+						BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::CHECKSUM_ERROR,
+							"Checksum error in set " << mSetNumber << ": " <<
+							mFilename << ", stripe " << (whichStripe + 1) <<
+							", block " << stripeBlock);
+					}
+					// Attempt to recover from this failure
+					AttemptToRecoverFromIOError(whichStripe == 0);
+					// Retry
+					return Read(pBuffer, NBytes, Timeout);
+				}
+
+				mVerifiedBlock = block;
+			}
+
+			int toCopy = mBlockSize - offset;
+			if(toCopy > bytesToGo)
+			{
+				toCopy = bytesToGo;
+			}
+			::memcpy(outptr, mVerifiedBuffer + offset, toCopy);
+			outptr += toCopy;
+			bytesToGo -= toCopy;
+			position += toCopy;
+		}
+	}
+	catch(...)
+	{
+		// Don't trust whatever is in the buffer
+		mVerifiedBlock = -1;
+		throw;
+	}
+
+	// adjust current position (the file pointers aren't used by
+	// this routine, so don't need moving)
+	mCurrentPosition += NBytes;
+
+	return NBytes;
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -536,6 +718,7 @@ void RaidFileRead_Raid::MoveDamagedFileAlertDaemon(int SetNumber, const std::str
 	// Attempt to rename the file there -- ignore any return code here, as it's dubious anyway
 	std::string errorFile(RaidFileUtil::MakeRaidComponentName(rdiscSet, Filename, errOnDisc));
 	::rename(errorFile.c_str(), (dirname + DIRECTORY_SEPARATOR_ASCHAR + awayName).c_str());
+	RaidFileBlockChecksums::Delete(errorFile);
 
 	// TODO: Inform the recovery daemon
 }
@@ -555,6 +738,8 @@ void RaidFileRead_Raid::AttemptToRecoverFromIOError(bool Stripe1)
 	BOX_LOG_CATEGORY(Log::WARNING, RaidFileRead::RECOVERING_IO_ERROR,
 		"Attempting to recover from I/O error: " << mSetNumber <<
 		" " << mFilename << ", on stripe " << (Stripe1?1:2));
+	mRecovered = true;
+	mStripeChecksums[Stripe1?0:1].Clear();
 
 	// Close offending file
 	if(Stripe1)
@@ -607,6 +792,10 @@ void RaidFileRead_Raid::AttemptToRecoverFromIOError(bool Stripe1)
 	{
 		THROW_EXCEPTION(RaidFileException, OSError)
 	}
+	if(rdiscSet.HasBlockChecksums())
+	{
+		mParityChecksums.Load(parityFilename, mParityHandle, mBlockSize);
+	}
 	
 	// Work out whether or not there's a size XORed into the last block
 	unsigned int bytesInLastTwoBlocks = mFileSize % (mBlockSize * 2);
@@ -711,6 +900,20 @@ int RaidFileRead_Raid::ReadRecovered(void *pBuffer, int NBytes)
 					THROW_EXCEPTION(RaidFileException, OSError)
 				}
 
+				// Check both blocks against their checksums before
+				// they're changed, as there's nothing left to
+				// rebuild them from
+				char *stripeData = mRecoveryBuffer + ((mStripe1Handle != -1)?0:mBlockSize);
+				char *parityData = mRecoveryBuffer + ((mStripe1Handle != -1)?mBlockSize:0);
+				if(!mStripeChecksums[(mStripe1Handle != -1)?0:1].Verify(fileBlock, stripeData)
+					|| !mParityChecksums.Verify(fileBlock, parityData))
+				{
+					THROW_FILE_ERROR("Checksum error in set " <<
+						mSetNumber << " while recovering block " <<
+						fileBlock << " from parity", mFilename,
+						RaidFileException, FileIsDamagedNotRecoverable);
+				}
+
 				// error checking and manipulation
 				if(isLastBlock)
 				{
@@ -978,6 +1181,588 @@ RaidFileRead::pos_type RaidFileRead_Raid::GetFileSize() const
 // ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    RaidFileRead_ErasureCoded
+//		Purpose: Internal class for reading RaidFiles which have been
+//				 transformed on an erasure coded (N+M) disc set. Reads
+//				 come straight from the data stripes when they are
+//				 present, otherwise whole rows are rebuilt from any k
+//				 of the n components.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class RaidFileRead_ErasureCoded : public RaidFileRead
+{
+public:
+	RaidFileRead_ErasureCoded(int SetNumber, const std::string &Filename,
+		const std::vector<int> &rHandles, int DataDiscs, int ParityDiscs,
+		pos_type FileSize, unsigned int BlockSize);
+	virtual ~RaidFileRead_ErasureCoded();
+private:
+	RaidFileRead_ErasureCoded(const RaidFileRead_ErasureCoded &rToCopy);
+
+public:
+	void LoadChecksums(RaidFileDiscSet &rdiscSet, int StartDisc);
+	virtual int Read(void *pBuffer, int NBytes, int Timeout = IOStream::TimeOutInfinite);
+	virtual pos_type GetPosition() const;
+	virtual void Seek(IOStream::pos_type Offset, int SeekType);
+	virtual void Close();
+	virtual pos_type GetFileSize() const;
+	virtual bool StreamDataLeft();
+
+private:
+	bool ReadComponent(int Component, pos_type Offset, void *pBuffer, int NBytes);
+	void ComponentChecksumFailed(int Component, pos_type Row);
+	void LoadRecoveredRow(pos_type Row);
+
+private:
+	std::vector<int> mHandles;
+	std::vector<pos_type> mHandlePositions;
+	RaidFileErasureCode mCode;
+	pos_type mFileSize;
+	unsigned int mBlockSize;
+	pos_type mCurrentPosition;
+	std::vector<uint8_t> mRecoveryBuffer;
+	pos_type mRecoveryRow;
+	bool mEOF;
+	std::vector<RaidFileBlockChecksums> mChecksums;
+	std::vector<uint8_t> mVerifiedBuffer;
+	pos_type mVerifiedBlock;
+};
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::RaidFileRead_ErasureCoded(...)
+//		Purpose: Constructor. Takes ownership of the component handles,
+//				 data stripes first, -1 for missing components.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileRead_ErasureCoded::RaidFileRead_ErasureCoded(int SetNumber,
+	const std::string &Filename, const std::vector<int> &rHandles,
+	int DataDiscs, int ParityDiscs, pos_type FileSize, unsigned int BlockSize)
+	: RaidFileRead(SetNumber, Filename),
+	  mHandles(rHandles),
+	  mHandlePositions(rHandles.size(), 0),
+	  mCode(DataDiscs, ParityDiscs),
+	  mFileSize(FileSize),
+	  mBlockSize(BlockSize),
+	  mCurrentPosition(0),
+	  mRecoveryRow(-1),
+	  mEOF(false),
+	  mChecksums(rHandles.size()),
+	  mVerifiedBlock(-1)
+{
+	ASSERT((int)mHandles.size() == DataDiscs + ParityDiscs);
+
+	for(int c = 0; c < DataDiscs; ++c)
+	{
+		if(mHandles[c] == -1)
+		{
+			mRecovered = true;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::~RaidFileRead_ErasureCoded()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileRead_ErasureCoded::~RaidFileRead_ErasureCoded()
+{
+	Close();
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::LoadChecksums(RaidFileDiscSet &, int)
+//		Purpose: Load the block checksums of the open components, if
+//				 the disc set keeps them. Components without usable
+//				 checksums are read without checking.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_ErasureCoded::LoadChecksums(RaidFileDiscSet &rdiscSet,
+	int StartDisc)
+{
+	if(!rdiscSet.HasBlockChecksums())
+	{
+		return;
+	}
+
+	int numDiscs = mHandles.size();
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		if(mHandles[c] != -1)
+		{
+			mChecksums[c].Load(RaidFileUtil::MakeRaidComponentName(
+				rdiscSet, mFilename, (c + StartDisc) % numDiscs),
+				mHandles[c], mBlockSize);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::ReadComponent(int, pos_type, void *, int)
+//		Purpose: Read from one component file, zero filling anything
+//				 beyond its end (the short last row). Returns false,
+//				 having closed the component, on an I/O error, so that
+//				 the caller can carry on by rebuilding it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileRead_ErasureCoded::ReadComponent(int Component, pos_type Offset,
+	void *pBuffer, int NBytes)
+{
+	int handle = mHandles[Component];
+	ASSERT(handle != -1);
+
+	if(mHandlePositions[Component] != Offset)
+	{
+		if(::lseek(handle, Offset, SEEK_SET) == -1)
+		{
+			if(errno != EIO)
+			{
+				THROW_EXCEPTION(RaidFileException, OSError)
+			}
+			BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::IO_ERROR,
+				"I/O error when seeking in set " << mSetNumber <<
+				": " << mFilename << ", component " << Component);
+			::close(handle);
+			mHandles[Component] = -1;
+			mChecksums[Component].Clear();
+			mRecovered = true;
+			return false;
+		}
+	}
+
+	int done = 0;
+	while(done < NBytes)
+	{
+		int r = ::read(handle, ((char*)pBuffer) + done, NBytes - done);
+		if(r == -1)
+		{
+			if(errno != EIO)
+			{
+				THROW_EXCEPTION(RaidFileException, OSError)
+			}
+			BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::IO_ERROR,
+				"I/O error when reading set " << mSetNumber <<
+				": " << mFilename << ", component " << Component);
+			::close(handle);
+			mHandles[Component] = -1;
+			mChecksums[Component].Clear();
+			mRecovered = true;
+			return false;
+		}
+		if(r == 0)
+		{
+			break;
+		}
+		done += r;
+	}
+	mHandlePositions[Component] = Offset + done;
+
+	if(done < NBytes)
+	{
+		::memset(((char*)pBuffer) + done, 0, NBytes - done);
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::ComponentChecksumFailed(int, pos_type)
+//		Purpose: A block of a component doesn't match its checksum,
+//				 so stop using the component, and rebuild it from the
+//				 others instead.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_ErasureCoded::ComponentChecksumFailed(int Component,
+	pos_type Row)
+{
+	BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::CHECKSUM_ERROR,
+		"Checksum error in set " << mSetNumber << ": " << mFilename <<
+		", component " << Component << ", block " << Row);
+	::close(mHandles[Component]);
+	mHandles[Component] = -1;
+	mChecksums[Component].Clear();
+	mRecovered = true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::LoadRecoveredRow(pos_type)
+//		Purpose: Read every available component of a row and rebuild
+//				 the missing data blocks into the recovery buffer
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_ErasureCoded::LoadRecoveredRow(pos_type Row)
+{
+	if(mRecoveryRow == Row)
+	{
+		return;
+	}
+	mRecoveryRow = -1;
+
+	int numDiscs = mHandles.size();
+	mRecoveryBuffer.resize(numDiscs * mBlockSize);
+	std::vector<uint8_t *> components(numDiscs);
+	bool present[RAIDFILE_MAX_DISCS_IN_SET];
+	int available = 0;
+
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		components[c] = &mRecoveryBuffer[c * mBlockSize];
+		present[c] = (mHandles[c] != -1) &&
+			ReadComponent(c, Row * mBlockSize, components[c], mBlockSize);
+		if(present[c] && !mChecksums[c].Verify(Row, components[c]))
+		{
+			ComponentChecksumFailed(c, Row);
+			present[c] = false;
+		}
+		if(present[c])
+		{
+			available++;
+		}
+	}
+
+	if(available < mCode.GetNumDataDiscs())
+	{
+		THROW_FILE_ERROR("Too many components missing to rebuild "
+			"RaidFile in set " << mSetNumber, mFilename,
+			RaidFileException, FileIsDamagedNotRecoverable);
+	}
+
+	mCode.Reconstruct(&components[0], present, mBlockSize);
+	mRecoveryRow = Row;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::Read(void *, int, int)
+//		Purpose: Reads bytes from the file
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+int RaidFileRead_ErasureCoded::Read(void *pBuffer, int NBytes, int Timeout)
+{
+	// How many more bytes could we read?
+	pos_type maxRead = mFileSize - mCurrentPosition;
+	if((pos_type)NBytes > maxRead)
+	{
+		NBytes = maxRead;
+	}
+
+	// Return immediately if there's nothing to read, and set EOF
+	if(NBytes == 0)
+	{
+		mEOF = true;
+		return 0;
+	}
+
+	int dataDiscs = mCode.GetNumDataDiscs();
+	char *bufferPtr = (char*)pBuffer;
+	int leftToRead = NBytes;
+	while(leftToRead > 0)
+	{
+		pos_type block = mCurrentPosition / mBlockSize;
+		unsigned int offsetInBlock = mCurrentPosition % mBlockSize;
+		int component = block % dataDiscs;
+		pos_type row = block / dataDiscs;
+		int toCopy = mBlockSize - offsetInBlock;
+		if(toCopy > leftToRead)
+		{
+			toCopy = leftToRead;
+		}
+
+		if(mChecksums[component].IsLoaded())
+		{
+			// Read and check the whole block, keeping it so that
+			// small reads don't check it over and over
+			if(block != mVerifiedBlock)
+			{
+				mVerifiedBlock = -1;
+				mVerifiedBuffer.resize(mBlockSize);
+				if(!ReadComponent(component, row * mBlockSize,
+					&mVerifiedBuffer[0], mBlockSize) ||
+					!mChecksums[component].Verify(row, &mVerifiedBuffer[0]))
+				{
+					if(mHandles[component] != -1)
+					{
+						ComponentChecksumFailed(component, row);
+					}
+					LoadRecoveredRow(row);
+					::memcpy(&mVerifiedBuffer[0],
+						&mRecoveryBuffer[component * mBlockSize],
+						mBlockSize);
+				}
+				mVerifiedBlock = block;
+			}
+			::memcpy(bufferPtr, &mVerifiedBuffer[offsetInBlock], toCopy);
+		}
+		else if(mHandles[component] == -1 || !ReadComponent(component,
+			(row * mBlockSize) + offsetInBlock, bufferPtr, toCopy))
+		{
+			// Missing or failed data stripe, so rebuild the row
+			LoadRecoveredRow(row);
+			::memcpy(bufferPtr, &mRecoveryBuffer[(component * mBlockSize) +
+				offsetInBlock], toCopy);
+		}
+
+		bufferPtr += toCopy;
+		leftToRead -= toCopy;
+		mCurrentPosition += toCopy;
+	}
+
+	return NBytes;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::GetPosition()
+//		Purpose: Returns current position
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+IOStream::pos_type RaidFileRead_ErasureCoded::GetPosition() const
+{
+	return mCurrentPosition;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::Seek(pos_type, int)
+//		Purpose: Seek within the file. The component files are only
+//				 repositioned when they are next read.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_ErasureCoded::Seek(IOStream::pos_type Offset, int SeekType)
+{
+	pos_type newpos = mCurrentPosition;
+	switch(SeekType)
+	{
+	case IOStream::SeekType_Absolute:
+		newpos = Offset;
+		break;
+
+	case IOStream::SeekType_Relative:
+		newpos += Offset;
+		break;
+
+	case IOStream::SeekType_End:
+		newpos = mFileSize + Offset;
+		break;
+
+	default:
+		THROW_EXCEPTION(CommonException, IOStreamBadSeekType)
+	}
+
+	if(newpos > mFileSize)
+	{
+		newpos = mFileSize;
+	}
+
+	mCurrentPosition = newpos;
+	mEOF = false;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::Close()
+//		Purpose: Close the file (automatically done by destructor)
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead_ErasureCoded::Close()
+{
+	for(std::vector<int>::iterator i(mHandles.begin()); i != mHandles.end(); ++i)
+	{
+		if(*i != -1)
+		{
+			::close(*i);
+			*i = -1;
+		}
+	}
+
+	mEOF = true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::StreamDataLeft()
+//		Purpose: Any data left?
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileRead_ErasureCoded::StreamDataLeft()
+{
+	return !mEOF;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead_ErasureCoded::GetFileSize()
+//		Purpose: Returns file size.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileRead::pos_type RaidFileRead_ErasureCoded::GetFileSize() const
+{
+	return mFileSize;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    OpenErasureCoded(RaidFileDiscSet &, int, const std::string &, int, int)
+//		Purpose: Open the components of a transformed file on an erasure
+//				 coded disc set, and work out its size.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static std::auto_ptr<RaidFileRead> OpenErasureCoded(RaidFileDiscSet &rdiscSet,
+	int SetNumber, const std::string &Filename, int startDisc,
+	int existingFiles)
+{
+	int numDiscs = rdiscSet.size();
+	int dataDiscs = rdiscSet.GetNumDataDiscs();
+	std::vector<int> handles(numDiscs, -1);
+	int available = 0;
+
+	try
+	{
+		for(int c = 0; c < numDiscs; ++c)
+		{
+			if((existingFiles & (1 << c)) == 0)
+			{
+				continue;
+			}
+
+			std::string componentFilename(RaidFileUtil::MakeRaidComponentName(
+				rdiscSet, Filename, (c + startDisc) % numDiscs));
+			handles[c] = ::open(componentFilename.c_str(),
+				O_RDONLY | O_BINARY, 0555);
+			if(handles[c] == -1)
+			{
+				if(errno != EIO)
+				{
+					THROW_SYS_FILE_ERROR("Failed to open RaidFile",
+						componentFilename, RaidFileException,
+						ErrorOpeningFileForRead);
+				}
+				BOX_LOG_CATEGORY(Log::ERROR,
+					RaidFileRead::RECOVERING_IO_ERROR, "I/O error "
+					"on opening " << SetNumber << " " << Filename <<
+					" component " << c << ", trying recovery mode");
+				continue;
+			}
+			available++;
+		}
+
+		if(available < dataDiscs)
+		{
+			THROW_FILE_ERROR("Failed to recover RaidFile", Filename,
+				RaidFileException, FileIsDamagedNotRecoverable);
+		}
+
+		RaidFileRead::pos_type length = 0;
+		bool allDataPresent = true;
+		for(int d = 0; d < dataDiscs; ++d)
+		{
+			if(handles[d] == -1)
+			{
+				allDataPresent = false;
+			}
+		}
+
+		if(allDataPresent)
+		{
+			// The file is exactly the data stripes
+			for(int d = 0; d < dataDiscs; ++d)
+			{
+				struct stat st;
+				if(::fstat(handles[d], &st) != 0)
+				{
+					THROW_EXCEPTION(RaidFileException, OSError)
+				}
+				length += st.st_size;
+			}
+		}
+		else
+		{
+			BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::OPEN_IN_RECOVERY,
+				"Attempting to open RAID file " << SetNumber <<
+				" " << Filename << " in recovery mode (" <<
+				available << " of " << numDiscs << " components "
+				"present)");
+
+			// Get the size from the end of the first parity file
+			int parity = dataDiscs;
+			while(handles[parity] == -1)
+			{
+				parity++;
+			}
+			RaidFileRead::FileSizeType sizeRecord = 0;
+			if(::lseek(handles[parity], 0 - (int)sizeof(sizeRecord),
+				SEEK_END) == -1 || ::read(handles[parity], &sizeRecord,
+				sizeof(sizeRecord)) != sizeof(sizeRecord) ||
+				::lseek(handles[parity], 0, SEEK_SET) == -1)
+			{
+				THROW_FILE_ERROR("Failed to read size from parity "
+					"component " << parity, Filename,
+					RaidFileException, OSError);
+			}
+			length = box_ntoh64(sizeRecord);
+		}
+
+		// Which now owns the handles
+		std::auto_ptr<RaidFileRead_ErasureCoded> apRead(
+			new RaidFileRead_ErasureCoded(SetNumber, Filename,
+				handles, dataDiscs, rdiscSet.GetNumParityDiscs(),
+				length, rdiscSet.GetBlockSize()));
+		handles.assign(numDiscs, -1);
+		apRead->LoadChecksums(rdiscSet, startDisc);
+		return std::auto_ptr<RaidFileRead>(apRead.release());
+	}
+	catch(...)
+	{
+		for(int c = 0; c < numDiscs; ++c)
+		{
+			if(handles[c] != -1)
+			{
+				::close(handles[c]);
+			}
+		}
+		throw;
+	}
+}
+
+
+// ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
 
 // --------------------------------------------------------------------------
 //
@@ -989,7 +1774,8 @@ RaidFileRead::pos_type RaidFileRead_Raid::GetFileSize() const
 // --------------------------------------------------------------------------
 RaidFileRead::RaidFileRead(int SetNumber, const std::string &Filename)
 	: mSetNumber(SetNumber),
-	  mFilename(Filename)
+	  mFilename(Filename),
+	  mRecovered(false)
 {
 }
 
@@ -1020,7 +1806,8 @@ std::auto_ptr<RaidFileRead> RaidFileRead::Open(int SetNumber, const std::string
 	// Get disc set
 	RaidFileController &rcontroller(RaidFileController::GetController());
 	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(SetNumber));
-	if(READ_NUMBER_DISCS_REQUIRED != rdiscSet.size() && 1 != rdiscSet.size()) // allow non-RAID configurations
+	if(READ_NUMBER_DISCS_REQUIRED != rdiscSet.size() && 1 != rdiscSet.size() // allow non-RAID configurations
+		&& !rdiscSet.IsErasureCodedSet())
 	{
 		THROW_EXCEPTION(RaidFileException, WrongNumberOfDiscsInSet)
 	}
@@ -1059,6 +1846,17 @@ std::auto_ptr<RaidFileRead> RaidFileRead::Open(int SetNumber, const std::string
 			throw;
 		}
 	}
+	else if(rdiscSet.IsErasureCodedSet())
+	{
+		if(existance == RaidFileUtil::AsRaidWithMissingNotRecoverable)
+		{
+			THROW_FILE_ERROR("Failed to recover RaidFile", Filename,
+				RaidFileException, FileIsDamagedNotRecoverable);
+		}
+
+		return OpenErasureCoded(rdiscSet, SetNumber, Filename,
+			startDisc, existingFiles);
+	}
 	else if(existance == RaidFileUtil::AsRaid
 		|| ((existingFiles & RaidFileUtil::Stripe1Exists) && (existingFiles & RaidFileUtil::Stripe2Exists)))
 	{
@@ -1139,8 +1937,13 @@ std::auto_ptr<RaidFileRead> RaidFileRead::Open(int SetNumber, const std::string
 					RaidFileException, OSError);
 			}
 	
-			// Make a nice object to represent this file
-			return std::auto_ptr<RaidFileRead>(new RaidFileRead_Raid(SetNumber, Filename, stripe1, stripe2, -1, length, rdiscSet.GetBlockSize(), false /* actually we don't know */));
+			// Make a nice object to represent this file, which
+			// now owns the handles
+			std::auto_ptr<RaidFileRead_Raid> apRead(new RaidFileRead_Raid(SetNumber, Filename, stripe1, stripe2, -1, length, rdiscSet.GetBlockSize(), false /* actually we don't know */));
+			stripe1 = -1;
+			stripe2 = -1;
+			apRead->LoadChecksums(rdiscSet, startDisc);
+			return std::auto_ptr<RaidFileRead>(apRead.release());
 		}
 		catch(...)
 		{
@@ -1436,8 +2239,14 @@ std::auto_ptr<RaidFileRead> RaidFileRead::Open(int SetNumber, const std::string
 				}
 			}
 
-			// Create a lovely object to return
-			return std::auto_ptr<RaidFileRead>(new RaidFileRead_Raid(SetNumber, Filename, stripe1, stripe2, parity, length, blockSize, lastBlockHasSize));
+			// Create a lovely object to return, which now owns the
+			// handles
+			std::auto_ptr<RaidFileRead_Raid> apRead(new RaidFileRead_Raid(SetNumber, Filename, stripe1, stripe2, parity, length, blockSize, lastBlockHasSize));
+			stripe1 = -1;
+			stripe2 = -1;
+			parity = -1;
+			apRead->LoadChecksums(rdiscSet, startDisc);
+			return std::auto_ptr<RaidFileRead>(apRead.release());
 		}
 		catch(...)
 		{
@@ -1575,6 +2384,46 @@ bool RaidFileRead::FileExists(int SetNumber, const std::string &rFilename, int64
 	return RaidFileUtil::RaidFileExists(rdiscSet, rFilename, 0, 0, pRevisionID) != RaidFileUtil::NoFile;
 }
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileRead::HintWillRead(int, const std::string &)
+//		Purpose: Ask the OS to start reading a file into the cache,
+//			 because it's about to be read. Only a hint, so any
+//			 errors are ignored, and it does nothing on platforms
+//			 which can't do it.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileRead::HintWillRead(int SetNumber, const std::string &rFilename)
+{
+#ifdef HAVE_POSIX_FADVISE
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(SetNumber));
+
+	// It's quicker to try all the names it could have than to find
+	// out which it's using
+	std::vector<std::string> names;
+	names.push_back(RaidFileUtil::MakeWriteFileName(rdiscSet, rFilename));
+	for(int d = 0; d < (int)rdiscSet.size(); ++d)
+	{
+		names.push_back(RaidFileUtil::MakeRaidComponentName(rdiscSet,
+			rFilename, d));
+	}
+
+	for(std::vector<std::string>::const_iterator i(names.begin());
+		i != names.end(); ++i)
+	{
+		int fd = ::open(i->c_str(), O_RDONLY | O_BINARY);
+		if(fd != -1)
+		{
+			::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			::close(fd);
+		}
+	}
+#endif
+}
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -1716,7 +2565,7 @@ bool RaidFileRead::ReadDirectoryContents(int SetNumber, const std::string &rDirN
 	
 	for(std::map<std::string, unsigned int>::const_iterator i = counts.begin(); i != counts.end(); ++i)
 	{
-		if(i->second < (numDiscs - 1))
+		if(i->second < (unsigned int)rdiscSet.GetNumDataDiscs())
 		{
 			// Too few discs to be confident of reading everything
 			everythingReadable = false;
@@ -62,6 +62,7 @@ public:
 		DirReadType_DirsOnly = 1
 	};
 	static bool ReadDirectoryContents(int SetNumber, const std::string &rDirName, int DirReadType, std::vector<std::string> &rOutput);
+	static void HintWillRead(int SetNumber, const std::string &rFilename);
 
 	// Common IOStream interface implementation
 	virtual void Write(const void *pBuffer, int NBytes,
@@ -72,15 +73,21 @@ public:
 	pos_type GetDiscUsageInBlocks();
 	std::string ToString() const;
 
+	// Has any of the file been rebuilt from parity, because a
+	// component was missing, unreadable or failed its checksum?
+	bool WasRecovered() const {return mRecovered;}
+
 	typedef int64_t FileSizeType;
 
 	static const RaidFileReadCategory OPEN_IN_RECOVERY;
 	static const RaidFileReadCategory IO_ERROR;
 	static const RaidFileReadCategory RECOVERING_IO_ERROR;
+	static const RaidFileReadCategory CHECKSUM_ERROR;
 
 protected:
 	int mSetNumber;
 	std::string mFilename;
+	bool mRecovered;
 };
 
 #endif // RAIDFILEREAD__H
@@ -0,0 +1,485 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileScrubber.cpp
+//		Purpose: Read through RaidFiles looking for damage
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#include "Box.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+
+#include "Guards.h"
+#include "RaidFileBlockChecksums.h"
+#include "RaidFileController.h"
+#include "RaidFileException.h"
+#include "RaidFileRead.h"
+#include "RaidFileScrubber.h"
+#include "RaidFileUtil.h"
+#include "RaidFileWrite.h"
+
+#include "MemLeakFindOn.h"
+
+#define SCRUB_READ_BUFFER_SIZE	(64*1024)
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::RaidFileScrubber(int)
+//		Purpose: Constructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileScrubber::RaidFileScrubber(int SetNumber)
+	: mSetNumber(SetNumber),
+	  mMaxBlocksPerSecond(0),
+	  mpCallback(0),
+	  mNumFilesScrubbed(0),
+	  mNumBlocksScrubbed(0),
+	  mNumUnreadableFiles(0),
+	  mPeriodStart(0),
+	  mBlocksInPeriod(0)
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::~RaidFileScrubber()
+//		Purpose: Destructor
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+RaidFileScrubber::~RaidFileScrubber()
+{
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::ScrubDirectory(const std::string &,
+//				 const std::string &)
+//		Purpose: Scrub every file under the directory, in name order,
+//				 skipping those up to and including rResumeAfter.
+//				 Returns false if the callback stopped it first, in
+//				 which case GetLastFileScrubbed() says where to
+//				 resume.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::ScrubDirectory(const std::string &rDirName,
+	const std::string &rResumeAfter)
+{
+	std::string dirName(rDirName);
+	while(!dirName.empty() &&
+		dirName[dirName.size() - 1] == DIRECTORY_SEPARATOR_ASCHAR)
+	{
+		dirName.resize(dirName.size() - 1);
+	}
+
+	std::vector<std::string> resumeAfter;
+	std::string::size_type start = 0;
+	while(start < rResumeAfter.size())
+	{
+		std::string::size_type end = rResumeAfter.find(
+			DIRECTORY_SEPARATOR_ASCHAR, start);
+		if(end == std::string::npos)
+		{
+			end = rResumeAfter.size();
+		}
+		resumeAfter.push_back(rResumeAfter.substr(start, end - start));
+		start = end + 1;
+	}
+
+	mLastFileScrubbed = rResumeAfter;
+	return ScrubDirectory(dirName, std::string(), resumeAfter, 0,
+		!resumeAfter.empty());
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::ScrubDirectory(const std::string &,
+//				 const std::string &, const std::vector<std::string> &,
+//				 size_t, bool)
+//		Purpose: Private. Scrub one directory, and the ones inside it.
+//				 While OnResumePath, the directory is on the way to
+//				 the file to resume after, and anything which comes
+//				 before it is skipped.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::ScrubDirectory(const std::string &rDirName,
+	const std::string &rRelativeName,
+	const std::vector<std::string> &rResumeAfter, size_t Depth,
+	bool OnResumePath)
+{
+	std::vector<std::string> files, dirs;
+	RaidFileRead::ReadDirectoryContents(mSetNumber, rDirName,
+		RaidFileRead::DirReadType_FilesOnly, files);
+	RaidFileRead::ReadDirectoryContents(mSetNumber, rDirName,
+		RaidFileRead::DirReadType_DirsOnly, dirs);
+
+	// Name, and whether it's a directory, so that files come before
+	// directories of the same name
+	std::vector<std::pair<std::string, bool> > entries;
+	for(std::vector<std::string>::const_iterator i(files.begin());
+		i != files.end(); ++i)
+	{
+		entries.push_back(std::make_pair(*i, false));
+	}
+	for(std::vector<std::string>::const_iterator i(dirs.begin());
+		i != dirs.end(); ++i)
+	{
+		// Not .raidfile-unreadable, which only exists on the discs
+		// which have had errors
+		if(!i->empty() && (*i)[0] == '.')
+		{
+			continue;
+		}
+		entries.push_back(std::make_pair(*i, true));
+	}
+	std::sort(entries.begin(), entries.end());
+
+	for(std::vector<std::pair<std::string, bool> >::const_iterator
+		i(entries.begin()); i != entries.end(); ++i)
+	{
+		const std::string &rName(i->first);
+		bool isDirectory = i->second;
+		std::string filename(rDirName.empty() ? rName :
+			(rDirName + DIRECTORY_SEPARATOR_ASCHAR + rName));
+		std::string relativeName(rRelativeName.empty() ? rName :
+			(rRelativeName + DIRECTORY_SEPARATOR_ASCHAR + rName));
+		bool onResumePath = false;
+
+		if(OnResumePath && Depth < rResumeAfter.size())
+		{
+			int compare = rName.compare(rResumeAfter[Depth]);
+			if(compare < 0 || (compare == 0 && !isDirectory))
+			{
+				// Done already
+				continue;
+			}
+			onResumePath = (compare == 0);
+		}
+
+		if(isDirectory)
+		{
+			if(!ScrubDirectory(filename, relativeName, rResumeAfter,
+				Depth + 1, onResumePath))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if(mpCallback != 0 && mpCallback->StopScrub())
+		{
+			return false;
+		}
+
+		ScrubFile(filename);
+		mLastFileScrubbed = relativeName;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::ScrubFile(const std::string &)
+//		Purpose: Check one file, returning false if it's damaged
+//				 or unreadable.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::ScrubFile(const std::string &rFilename)
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(mSetNumber));
+
+	int startDisc = 0;
+	RaidFileUtil::ExistType existance = RaidFileUtil::RaidFileExists(
+		rdiscSet, rFilename, &startDisc);
+	if(existance == RaidFileUtil::NoFile)
+	{
+		// Deleted since the directory was read
+		return true;
+	}
+
+	bool damaged = (existance == RaidFileUtil::AsRaidWithMissingReadable ||
+		existance == RaidFileUtil::AsRaidWithMissingNotRecoverable);
+
+	// Only a whole set of components with checksums can be checked
+	// without reading the file
+	bool verified = false;
+	if(existance == RaidFileUtil::AsRaid && rdiscSet.HasBlockChecksums())
+	{
+		verified = VerifyComponents(rdiscSet, rFilename, startDisc,
+			damaged);
+	}
+
+	if(!verified && !damaged)
+	{
+		if(!ReadWholeFile(rFilename, damaged))
+		{
+			return false;
+		}
+	}
+
+	mNumFilesScrubbed++;
+
+	if(damaged)
+	{
+		BOX_WARNING("RaidFile " << mSetNumber << " " << rFilename <<
+			" is damaged");
+		mDamagedFiles.push_back(rFilename);
+	}
+
+	return !damaged;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::VerifyComponents(RaidFileDiscSet &,
+//				 const std::string &, int, bool &)
+//		Purpose: Private. Check every block of every component of a
+//				 transformed file against its checksum. Returns false
+//				 if any component has no checksums to check against,
+//				 so the file needs reading normally instead.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::VerifyComponents(RaidFileDiscSet &rdiscSet,
+	const std::string &rFilename, int StartDisc, bool &rDamagedOut)
+{
+	int numDiscs = rdiscSet.size();
+	unsigned int blockSize = rdiscSet.GetBlockSize();
+	MemoryBlockGuard<char*> buffer(blockSize);
+
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		std::string componentFilename(RaidFileUtil::MakeRaidComponentName(
+			rdiscSet, rFilename, (c + StartDisc) % numDiscs));
+		int handle = ::open(componentFilename.c_str(),
+			O_RDONLY | O_BINARY);
+		if(handle == -1)
+		{
+			if(errno != EIO)
+			{
+				// Probably deleted, let the normal read decide
+				return false;
+			}
+			BOX_ERROR("I/O error opening RaidFile component " <<
+				componentFilename);
+			rDamagedOut = true;
+			continue;
+		}
+		bool haveChecksums = false;
+		try
+		{
+			haveChecksums = VerifyComponent(componentFilename,
+				handle, blockSize, buffer, rDamagedOut);
+		}
+		catch(...)
+		{
+			::close(handle);
+			throw;
+		}
+		::close(handle);
+
+		if(!haveChecksums)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::VerifyComponent(const std::string &,
+//				 int, unsigned int, char *, bool &)
+//		Purpose: Private. Check every block of one component, which
+//				 is open as Handle, against its checksums. Returns
+//				 false if it has no checksums.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::VerifyComponent(const std::string &rComponentFilename,
+	int Handle, unsigned int BlockSize, char *pBuffer, bool &rDamagedOut)
+{
+	RaidFileBlockChecksums checksums;
+	if(!checksums.Load(rComponentFilename, Handle, BlockSize))
+	{
+		return false;
+	}
+
+	for(int64_t b = 0; b < checksums.GetNumBlocks(); ++b)
+	{
+		int length = checksums.GetBlockLength(b);
+		int bytes = 0;
+		while(bytes < length)
+		{
+			int r = ::read(Handle, pBuffer + bytes, length - bytes);
+			if(r <= 0)
+			{
+				break;
+			}
+			bytes += r;
+		}
+
+		ThrottleBlocks(1);
+
+		if(bytes != length)
+		{
+			BOX_LOG_SYS_ERROR("Failed to read block " << b <<
+				" of RaidFile component " << rComponentFilename);
+			rDamagedOut = true;
+			break;
+		}
+		if(!checksums.Verify(b, pBuffer))
+		{
+			BOX_LOG_CATEGORY(Log::ERROR, RaidFileRead::CHECKSUM_ERROR,
+				"Checksum error in RaidFile component " <<
+				rComponentFilename << ", block " << b);
+			rDamagedOut = true;
+			break;
+		}
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::ReadWholeFile(const std::string &,
+//				 bool &)
+//		Purpose: Private. Read a file through RaidFileRead, noting
+//				 whether it had to be rebuilt from parity. Returns
+//				 false if it couldn't be read at all.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+bool RaidFileScrubber::ReadWholeFile(const std::string &rFilename,
+	bool &rDamagedOut)
+{
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	unsigned int blockSize = rcontroller.GetDiscSet(mSetNumber).GetBlockSize();
+	MemoryBlockGuard<char*> buffer(SCRUB_READ_BUFFER_SIZE);
+
+	try
+	{
+		std::auto_ptr<RaidFileRead> apRead(RaidFileRead::Open(
+			mSetNumber, rFilename));
+		int bytes;
+		while((bytes = apRead->Read(buffer,
+			SCRUB_READ_BUFFER_SIZE)) > 0)
+		{
+			ThrottleBlocks((bytes + blockSize - 1) / blockSize);
+		}
+		rDamagedOut = rDamagedOut || apRead->WasRecovered();
+	}
+	catch(RaidFileException &e)
+	{
+		if(e.GetSubType() == RaidFileException::RaidFileDoesntExist)
+		{
+			// Deleted while being read
+			return true;
+		}
+		BOX_ERROR("Failed to read RaidFile " << mSetNumber << " " <<
+			rFilename << ": " << e.what());
+		mNumUnreadableFiles++;
+		return false;
+	}
+	catch(BoxException &e)
+	{
+		BOX_ERROR("Failed to read RaidFile " << mSetNumber << " " <<
+			rFilename << ": " << e.what());
+		mNumUnreadableFiles++;
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::RepairFile(const std::string &)
+//		Purpose: Rewrite a damaged file from what can be read of it,
+//				 which puts back missing or damaged components. The
+//				 caller must make sure that nothing else writes to
+//				 the file at the same time. Exceptions if the file
+//				 can't be read.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileScrubber::RepairFile(const std::string &rFilename)
+{
+	std::auto_ptr<RaidFileRead> apRead(RaidFileRead::Open(mSetNumber,
+		rFilename));
+	RaidFileWrite write(mSetNumber, rFilename);
+	write.Open(true); // AllowOverwrite
+	apRead->CopyStreamTo(write);
+	apRead.reset();
+	write.Commit(true); // ConvertToRaidNow
+
+	BOX_NOTICE("Repaired RaidFile " << mSetNumber << " " << rFilename);
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileScrubber::ThrottleBlocks(int64_t)
+//		Purpose: Private. Count blocks read, and sleep for long enough
+//				 to keep to the limit set by SetMaxBlocksPerSecond().
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileScrubber::ThrottleBlocks(int64_t NumBlocks)
+{
+	mNumBlocksScrubbed += NumBlocks;
+
+	if(mMaxBlocksPerSecond <= 0)
+	{
+		return;
+	}
+
+	box_time_t now = GetCurrentBoxTime();
+	if(now - mPeriodStart >= MICRO_SEC_IN_SEC_LL || now < mPeriodStart)
+	{
+		// Start a new period
+		mPeriodStart = now;
+		mBlocksInPeriod = 0;
+	}
+
+	mBlocksInPeriod += NumBlocks;
+	if(mBlocksInPeriod >= mMaxBlocksPerSecond)
+	{
+		// Wait until this many blocks are allowed
+		box_time_t due = mPeriodStart + ((MICRO_SEC_IN_SEC_LL *
+			mBlocksInPeriod) / mMaxBlocksPerSecond);
+		if(due > now)
+		{
+			ShortSleep(due - now, false);
+		}
+		mPeriodStart = GetCurrentBoxTime();
+		mBlocksInPeriod = 0;
+	}
+}
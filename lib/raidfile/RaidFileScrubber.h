@@ -0,0 +1,119 @@
+// --------------------------------------------------------------------------
+//
+// File
+//		Name:    RaidFileScrubber.h
+//		Purpose: Read through RaidFiles looking for damage
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+
+#ifndef RAIDFILESCRUBBER__H
+#define RAIDFILESCRUBBER__H
+
+#include <string>
+#include <vector>
+
+#include "BoxTime.h"
+
+class RaidFileDiscSet;
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    RaidFileScrubberCallback
+//		Purpose: Lets the user of a RaidFileScrubber stop it early
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class RaidFileScrubberCallback
+{
+public:
+	virtual ~RaidFileScrubberCallback() { }
+	// Called before each file is scrubbed
+	virtual bool StopScrub() = 0;
+};
+
+// --------------------------------------------------------------------------
+//
+// Class
+//		Name:    RaidFileScrubber
+//		Purpose: Reads every file in a directory tree of a disc set,
+//				 at a limited rate, to find damage before it's needed.
+//				 Where the disc set keeps block checksums, each
+//				 component (including the parity, which normal reads
+//				 never look at) is checked against them without
+//				 decoding the file. Other files are read through
+//				 RaidFileRead, which notices I/O errors and missing
+//				 components. Damaged files are remembered, so that
+//				 they can be rewritten with RepairFile() once it's
+//				 safe to do so.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+class RaidFileScrubber
+{
+public:
+	RaidFileScrubber(int SetNumber);
+	~RaidFileScrubber();
+private:
+	// no copying
+	RaidFileScrubber(const RaidFileScrubber &);
+	RaidFileScrubber &operator=(const RaidFileScrubber &);
+public:
+
+	void SetMaxBlocksPerSecond(int MaxBlocksPerSecond)
+	{
+		mMaxBlocksPerSecond = MaxBlocksPerSecond;
+	}
+	void SetCallback(RaidFileScrubberCallback *pCallback)
+	{
+		mpCallback = pCallback;
+	}
+
+	// Scrub everything under a directory, in name order, starting
+	// after the file (relative to the directory) given. Returns
+	// false if stopped by the callback before the end.
+	bool ScrubDirectory(const std::string &rDirName,
+		const std::string &rResumeAfter = std::string());
+	bool ScrubFile(const std::string &rFilename);
+	void RepairFile(const std::string &rFilename);
+
+	// Relative to the directory being scrubbed
+	const std::string &GetLastFileScrubbed() const
+	{
+		return mLastFileScrubbed;
+	}
+	const std::vector<std::string> &GetDamagedFiles() const
+	{
+		return mDamagedFiles;
+	}
+	int64_t GetNumFilesScrubbed() const {return mNumFilesScrubbed;}
+	int64_t GetNumBlocksScrubbed() const {return mNumBlocksScrubbed;}
+	int64_t GetNumDamagedFiles() const {return mDamagedFiles.size();}
+	int64_t GetNumUnreadableFiles() const {return mNumUnreadableFiles;}
+
+private:
+	bool ScrubDirectory(const std::string &rDirName,
+		const std::string &rRelativeName,
+		const std::vector<std::string> &rResumeAfter, size_t Depth,
+		bool OnResumePath);
+	bool VerifyComponents(RaidFileDiscSet &rdiscSet,
+		const std::string &rFilename, int StartDisc, bool &rDamagedOut);
+	bool VerifyComponent(const std::string &rComponentFilename, int Handle,
+		unsigned int BlockSize, char *pBuffer, bool &rDamagedOut);
+	bool ReadWholeFile(const std::string &rFilename, bool &rDamagedOut);
+	void ThrottleBlocks(int64_t NumBlocks);
+
+	int mSetNumber;
+	int mMaxBlocksPerSecond;
+	RaidFileScrubberCallback *mpCallback;
+	std::string mLastFileScrubbed;
+	std::vector<std::string> mDamagedFiles;
+	int64_t mNumFilesScrubbed;
+	int64_t mNumBlocksScrubbed;
+	int64_t mNumUnreadableFiles;
+	box_time_t mPeriodStart;
+	int64_t mBlocksInPeriod;
+};
+
+#endif // RAIDFILESCRUBBER__H
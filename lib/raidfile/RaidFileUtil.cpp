@@ -125,7 +125,7 @@ RaidFileUtil::ExistType RaidFileUtil::RaidFileExists(RaidFileDiscSet &rDiscSet,
 	{
 		return AsRaid;
 	}
-	else if((setSize > 1) && rfCount == (setSize - 1))
+	else if((setSize > 1) && rfCount >= rDiscSet.GetNumDataDiscs())
 	{
 		return AsRaidWithMissingReadable;
 	}
@@ -161,6 +161,15 @@ int64_t RaidFileUtil::DiscUsageInBlocks(int64_t FileSize, const RaidFileDiscSet
 		return blocks;
 	}
 
+	// Erasure coded sets have one parity block per row of data blocks on
+	// each parity disc, and the file size at the end of each parity file.
+	if(rDiscSet.IsErasureCodedSet())
+	{
+		int64_t dataDiscs = rDiscSet.GetNumDataDiscs();
+		int64_t rows = (blocks + dataDiscs - 1) / dataDiscs;
+		return blocks + (rDiscSet.GetNumParityDiscs() * (rows + 1));
+	}
+
 	// It's the parity which is mildly complex.
 	// First of all, add in size for all but the last two blocks.
 	int64_t parityblocks = (FileSize / ((int64_t)blockSize)) / 2;
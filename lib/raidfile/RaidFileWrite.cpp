@@ -26,9 +26,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <vector>
+
 #include "Guards.h"
+#include "RaidFileBlockChecksums.h"
 #include "RaidFileWrite.h"
 #include "RaidFileController.h"
+#include "RaidFileErasureCode.h"
 #include "RaidFileException.h"
 #include "RaidFileUtil.h"
 #include "Utils.h"
@@ -45,6 +49,48 @@
 // We want to use POSIX fstat() for now, not the emulated one, because it's
 // difficult to rewrite all this code to use HANDLEs instead of ints.
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    ChecksumsWriteName(const std::string &)
+//		Purpose: The name the checksums of a component are written
+//				 under, before being renamed into place
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static std::string ChecksumsWriteName(const std::string &rComponentFilename)
+{
+	return RaidFileBlockChecksums::GetFilename(rComponentFilename) + 'P';
+}
+
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    CommitChecksums(const std::string &)
+//		Purpose: Rename the checksums of a component into place, after
+//				 the component itself.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+static void CommitChecksums(const std::string &rComponentFilename)
+{
+	std::string filename(RaidFileBlockChecksums::GetFilename(rComponentFilename));
+	std::string writeFilename(ChecksumsWriteName(rComponentFilename));
+#ifdef WIN32
+	// Must delete before renaming
+	if(EMU_UNLINK(filename.c_str()) != 0 && errno != ENOENT)
+	{
+		THROW_EMU_ERROR("Failed to unlink raidfile checksums: " <<
+			filename, RaidFileException, OSError);
+	}
+#endif
+	if(::rename(writeFilename.c_str(), filename.c_str()) != 0)
+	{
+		THROW_SYS_ERROR("Failed to rename file: " << writeFilename <<
+			" to " << filename, RaidFileException, OSError);
+	}
+}
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -392,6 +438,77 @@ void RaidFileWrite::Commit(bool ConvertToRaidNow)
 	}
 }
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileWrite::MoveFrom(const std::string &, bool)
+//		Purpose: Instead of writing this file, take over another in
+//			 the same set, which has been committed but not
+//			 converted to RAID, by renaming it. Returns false,
+//			 leaving the other file alone, if it's on a different
+//			 disc, so that it would have to be copied instead.
+//		Created: 2026/10/17
+//
+// --------------------------------------------------------------------------
+bool RaidFileWrite::MoveFrom(const std::string &rCommittedFilename,
+	bool ConvertToRaidNow)
+{
+	if(mOSFileHandle != -1)
+	{
+		THROW_EXCEPTION(RaidFileException, AlreadyOpen)
+	}
+
+	if (mRefCount == 0)
+	{
+		THROW_FILE_ERROR("Attempted to modify object file with "
+			"no references", mFilename, RaidFileException,
+			RequestedModifyUnreferencedFile);
+	}
+
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(mSetNumber));
+
+	// Can't overwrite existing files, as Open() doesn't by default
+	if(RaidFileUtil::RaidFileExists(rdiscSet, mFilename) !=
+		RaidFileUtil::NoFile)
+	{
+		THROW_FILE_ERROR("Attempted to overwrite raidfile " <<
+			mSetNumber, mFilename, RaidFileException,
+			CannotOverwriteExistingFile);
+	}
+
+	int fromDisc = 0, toDisc = 0;
+	std::string renameFrom(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		rCommittedFilename, &fromDisc));
+	std::string renameTo(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		mFilename, &toDisc));
+	if(fromDisc != toDisc)
+	{
+		return false;
+	}
+
+	if(::rename(renameFrom.c_str(), renameTo.c_str()) != 0)
+	{
+		if(errno == EXDEV)
+		{
+			// The same disc in name only
+			return false;
+		}
+
+		THROW_SYS_ERROR("Failed to rename file: " << renameFrom <<
+			" to " << renameTo, RaidFileException, OSError);
+	}
+
+	// Raid it?
+	if(ConvertToRaidNow)
+	{
+		TransformToRaidStorage();
+	}
+
+	return true;
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -460,6 +577,11 @@ void RaidFileWrite::TransformToRaidStorage()
 		// Not in RAID mode -- do nothing
 		return;
 	}
+	if(rdiscSet.IsErasureCodedSet())
+	{
+		TransformToErasureCodedStorage(rdiscSet);
+		return;
+	}
 	// Otherwise check that it's the right sized set
 	if(TRANSFORM_NUMBER_DISCS_REQUIRED != rdiscSet.size())
 	{
@@ -515,7 +637,13 @@ void RaidFileWrite::TransformToRaidStorage()
 	std::string stripe1FilenameW(stripe1Filename + 'P');
 	std::string stripe2FilenameW(stripe2Filename + 'P');
 	std::string parityFilenameW(parityFilename + 'P');
-	
+
+	// Checksums of the stripes and parity, if the set keeps them
+	bool checksums = rdiscSet.HasBlockChecksums();
+	RaidFileBlockChecksums stripeChecksums[2], parityChecksums;
+	stripeChecksums[0].Start(blockSize);
+	stripeChecksums[1].Start(blockSize);
+	parityChecksums.Start(blockSize);
 	
 	// Then open them all for writing (in strict order)
 	try
@@ -612,6 +740,10 @@ void RaidFileWrite::TransformToRaidStorage()
 				{
 					THROW_EXCEPTION(RaidFileException, OSError)
 				}
+				if(checksums)
+				{
+					parityChecksums.Add(parityBuffer, parityWriteSize);
+				}
 			}
 
 			// Write stripes
@@ -626,6 +758,10 @@ void RaidFileWrite::TransformToRaidStorage()
 				{
 					THROW_EXCEPTION(RaidFileException, OSError)
 				}			
+				if(checksums)
+				{
+					stripeChecksums[l&1].Add(writeFrom, toWrite);
+				}
 
 				// Next block
 				writeFrom += blockSize;
@@ -659,6 +795,17 @@ void RaidFileWrite::TransformToRaidStorage()
 					writeFilename);
 				THROW_EXCEPTION(RaidFileException, OSError)
 			}
+			if(checksums)
+			{
+				parityChecksums.Add(&sw, sizeof(sw));
+			}
+		}
+
+		if(checksums)
+		{
+			stripeChecksums[0].Write(ChecksumsWriteName(stripe1Filename), stripe1);
+			stripeChecksums[1].Write(ChecksumsWriteName(stripe2Filename), stripe2);
+			parityChecksums.Write(ChecksumsWriteName(parityFilename), parity);
 		}
 
 		// Then close the written files (note in reverse order of opening)
@@ -691,6 +838,15 @@ void RaidFileWrite::TransformToRaidStorage()
 			THROW_EXCEPTION(RaidFileException, OSError)
 		}
 
+		// And their checksums, which are ignored until they match
+		// the files just renamed
+		if(checksums)
+		{
+			CommitChecksums(stripe1Filename);
+			CommitChecksums(stripe2Filename);
+			CommitChecksums(parityFilename);
+		}
+
 		// Close the write file
 		writeFile.Close();
 
@@ -711,6 +867,12 @@ void RaidFileWrite::TransformToRaidStorage()
 		EMU_UNLINK(stripe1FilenameW.c_str());
 		EMU_UNLINK(stripe2FilenameW.c_str());
 		EMU_UNLINK(parityFilenameW.c_str());
+		if(checksums)
+		{
+			EMU_UNLINK(ChecksumsWriteName(stripe1Filename).c_str());
+			EMU_UNLINK(ChecksumsWriteName(stripe2Filename).c_str());
+			EMU_UNLINK(ChecksumsWriteName(parityFilename).c_str());
+		}
 		
 		// and send the error on its way
 		throw;
@@ -719,6 +881,256 @@ void RaidFileWrite::TransformToRaidStorage()
 
 
 
+// --------------------------------------------------------------------------
+//
+// Function
+//		Name:    RaidFileWrite::TransformToErasureCodedStorage(RaidFileDiscSet &)
+//		Purpose: Turns the file into the erasure coded storage form. Block b
+//				 of the file goes to data component (b % k), and each parity
+//				 component gets one Reed-Solomon block per row of k data
+//				 blocks, followed by the file size. Component c is stored
+//				 on disc (start disc + c) % n.
+//		Created: 2026/10/16
+//
+// --------------------------------------------------------------------------
+void RaidFileWrite::TransformToErasureCodedStorage(RaidFileDiscSet &rdiscSet)
+{
+	unsigned int blockSize = rdiscSet.GetBlockSize();
+	int dataDiscs = rdiscSet.GetNumDataDiscs();
+	int parityDiscs = rdiscSet.GetNumParityDiscs();
+	int numDiscs = rdiscSet.size();
+	RaidFileErasureCode code(dataDiscs, parityDiscs);
+
+	// Get the filename for the write file (and get the disc set name for the start disc)
+	int startDisc = 0;
+	std::string writeFilename(RaidFileUtil::MakeWriteFileName(rdiscSet, mFilename, &startDisc));
+
+	FileHandleGuard<> writeFile(writeFilename.c_str());
+	struct stat writeFileStat;
+	if(::fstat(writeFile, &writeFileStat) != 0)
+	{
+		THROW_SYS_FILE_ERROR("Failed to stat RaidFile", writeFilename,
+			RaidFileException, OSError);
+	}
+
+	// One row of data blocks, followed by the parity blocks for that row
+	MemoryBlockGuard<uint8_t*> buffer(numDiscs * blockSize);
+	std::vector<uint8_t *> components;
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		components.push_back(((uint8_t*)buffer) + (c * blockSize));
+	}
+
+	std::vector<std::string> componentFilenames, componentFilenamesW;
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		componentFilenames.push_back(RaidFileUtil::MakeRaidComponentName(rdiscSet,
+			mFilename, (startDisc + c) % numDiscs));
+		componentFilenamesW.push_back(componentFilenames.back() + 'P');
+	}
+
+	// Checksums of each component, if the set keeps them
+	bool checksums = rdiscSet.HasBlockChecksums();
+	std::vector<RaidFileBlockChecksums> componentChecksums(numDiscs);
+	for(int c = 0; c < numDiscs; ++c)
+	{
+		componentChecksums[c].Start(blockSize);
+	}
+
+	std::vector<int> handles(numDiscs, -1);
+	try
+	{
+		// Open them all for writing (in strict order)
+		for(int c = 0; c < numDiscs; ++c)
+		{
+			handles[c] = ::open(componentFilenamesW[c].c_str(),
+#if HAVE_DECL_O_EXLOCK
+				O_WRONLY | O_CREAT | O_EXCL | O_EXLOCK | O_BINARY,
+#else
+				O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+#endif
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+			if(handles[c] == -1)
+			{
+				THROW_SYS_FILE_ERROR("Failed to create RaidFile "
+					"component", componentFilenamesW[c],
+					RaidFileException, OSError);
+			}
+		}
+
+		unsigned int rowSize = dataDiscs * blockSize;
+		while(true)
+		{
+			// Fill a row of data blocks
+			unsigned int bytesInRow = 0;
+			while(bytesInRow < rowSize)
+			{
+				int bytesRead = ::read(writeFile, ((uint8_t*)buffer) + bytesInRow,
+					rowSize - bytesInRow);
+				if(bytesRead == -1)
+				{
+					THROW_SYS_FILE_ERROR("Failed to read RaidFile",
+						writeFilename, RaidFileException, OSError);
+				}
+				if(bytesRead == 0)
+				{
+					break;
+				}
+				bytesInRow += bytesRead;
+			}
+			if(bytesInRow == 0)
+			{
+				break;
+			}
+
+			// Zero pad the short last row, then calculate the parity
+			::memset(((uint8_t*)buffer) + bytesInRow, 0, rowSize - bytesInRow);
+			code.Encode(&components[0], &components[dataDiscs], blockSize);
+
+			// Write only the data actually present to the data stripes
+			for(int d = 0; d < dataDiscs; ++d)
+			{
+				unsigned int start = d * blockSize;
+				if(start >= bytesInRow)
+				{
+					break;
+				}
+				int toWrite = (bytesInRow - start) < blockSize
+					? (bytesInRow - start) : blockSize;
+				if(::write(handles[d], components[d], toWrite) != toWrite)
+				{
+					THROW_SYS_FILE_ERROR("Failed to write RaidFile "
+						"stripe", componentFilenamesW[d],
+						RaidFileException, OSError);
+				}
+				if(checksums)
+				{
+					componentChecksums[d].Add(components[d], toWrite);
+				}
+			}
+
+			// And full blocks to the parity components
+			for(int p = dataDiscs; p < numDiscs; ++p)
+			{
+				if(::write(handles[p], components[p], blockSize) != (int)blockSize)
+				{
+					THROW_SYS_FILE_ERROR("Failed to write RaidFile "
+						"parity", componentFilenamesW[p],
+						RaidFileException, OSError);
+				}
+				if(checksums)
+				{
+					componentChecksums[p].Add(components[p], blockSize);
+				}
+			}
+
+			if(bytesInRow < rowSize)
+			{
+				break;
+			}
+		}
+
+		// The file size is needed to rebuild the file if any of the
+		// data stripes are missing, so every parity file ends with it
+		ASSERT(sizeof(writeFileStat.st_size) <= sizeof(RaidFileRead::FileSizeType));
+		RaidFileRead::FileSizeType sw = box_hton64(writeFileStat.st_size);
+		for(int p = dataDiscs; p < numDiscs; ++p)
+		{
+			if(::write(handles[p], &sw, sizeof(sw)) != sizeof(sw))
+			{
+				THROW_SYS_FILE_ERROR("Failed to write RaidFile "
+					"parity", componentFilenamesW[p],
+					RaidFileException, OSError);
+			}
+			if(checksums)
+			{
+				componentChecksums[p].Add(&sw, sizeof(sw));
+			}
+		}
+
+		if(checksums)
+		{
+			for(int c = 0; c < numDiscs; ++c)
+			{
+				componentChecksums[c].Write(
+					ChecksumsWriteName(componentFilenames[c]),
+					handles[c]);
+			}
+		}
+
+		// Close the written files (in reverse order of opening)
+		for(int c = numDiscs - 1; c >= 0; --c)
+		{
+			int handle = handles[c];
+			handles[c] = -1;
+			if(::close(handle) != 0)
+			{
+				THROW_SYS_FILE_ERROR("Failed to close RaidFile "
+					"component", componentFilenamesW[c],
+					RaidFileException, OSError);
+			}
+		}
+
+		// Rename them into place
+		for(int c = 0; c < numDiscs; ++c)
+		{
+#ifdef WIN32
+			// Must delete before renaming
+			if(EMU_UNLINK(componentFilenames[c].c_str()) != 0 && errno != ENOENT)
+			{
+				THROW_EMU_ERROR("Failed to unlink raidfile "
+					"component: " << componentFilenames[c],
+					RaidFileException, OSError);
+			}
+#endif
+			if(::rename(componentFilenamesW[c].c_str(),
+				componentFilenames[c].c_str()) != 0)
+			{
+				THROW_SYS_ERROR("Failed to rename file: " <<
+					componentFilenamesW[c] << " to " <<
+					componentFilenames[c], RaidFileException,
+					OSError);
+			}
+		}
+
+		// And their checksums, which are ignored until they match
+		// the files just renamed
+		for(int c = 0; checksums && c < numDiscs; ++c)
+		{
+			CommitChecksums(componentFilenames[c]);
+		}
+
+		// Close and delete the write file
+		writeFile.Close();
+		if(EMU_UNLINK(writeFilename.c_str()) != 0)
+		{
+			THROW_SYS_FILE_ERROR("Failed to delete file", writeFilename,
+				RaidFileException, OSError);
+		}
+	}
+	catch(...)
+	{
+		// Unlink all the dodgy files
+		for(int c = 0; c < numDiscs; ++c)
+		{
+			if(handles[c] != -1)
+			{
+				::close(handles[c]);
+			}
+			EMU_UNLINK(componentFilenames[c].c_str());
+			EMU_UNLINK(componentFilenamesW[c].c_str());
+			if(checksums)
+			{
+				EMU_UNLINK(ChecksumsWriteName(componentFilenames[c]).c_str());
+			}
+		}
+
+		// and send the error on its way
+		throw;
+	}
+}
+
+
 // --------------------------------------------------------------------------
 //
 // Function
@@ -765,21 +1177,15 @@ void RaidFileWrite::Delete()
 		return;
 	}
 	
-	// Now the other files
-	std::string stripe1Filename(RaidFileUtil::MakeRaidComponentName(rdiscSet, mFilename, 0 % TRANSFORM_NUMBER_DISCS_REQUIRED));
-	std::string stripe2Filename(RaidFileUtil::MakeRaidComponentName(rdiscSet, mFilename, 1 % TRANSFORM_NUMBER_DISCS_REQUIRED));
-	std::string parityFilename(RaidFileUtil::MakeRaidComponentName(rdiscSet, mFilename, 2 % TRANSFORM_NUMBER_DISCS_REQUIRED));
-	if(EMU_UNLINK(stripe1Filename.c_str()) == 0)
-	{
-		deletedSomething = true;
-	}
-	if(EMU_UNLINK(stripe2Filename.c_str()) == 0)
+	// Now the other files, one on each disc (stripes and parity)
+	for(unsigned int d = 0; d < rdiscSet.size(); ++d)
 	{
-		deletedSomething = true;
-	}
-	if(EMU_UNLINK(parityFilename.c_str()) == 0)
-	{
-		deletedSomething = true;
+		std::string componentFilename(RaidFileUtil::MakeRaidComponentName(rdiscSet, mFilename, d));
+		if(EMU_UNLINK(componentFilename.c_str()) == 0)
+		{
+			deletedSomething = true;
+		}
+		RaidFileBlockChecksums::Delete(componentFilename);
 	}
 	
 	// Check something happened
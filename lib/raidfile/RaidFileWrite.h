@@ -59,6 +59,8 @@ public:
 	// Extra bits
 	void Open(bool AllowOverwrite = false);
 	void Commit(bool ConvertToRaidNow = false);
+	bool MoveFrom(const std::string &rCommittedFilename,
+		bool ConvertToRaidNow = false);
 	void Discard();
 	void TransformToRaidStorage();
 	void Delete();
@@ -69,6 +71,8 @@ public:
 	static void CreateDirectory(const RaidFileDiscSet &rSet, const std::string &rDirName, bool Recursive = false, int mode = 0777);
 
 private:
+	void TransformToErasureCodedStorage(RaidFileDiscSet &rdiscSet);
+
 	int mSetNumber;
 	std::string mFilename, mTempFilename;
 	int mOSFileHandle;
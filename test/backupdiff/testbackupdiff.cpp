@@ -317,6 +317,28 @@ void test_diff(int from, int to, int new_blocks_expected, int old_blocks_expecte
 			TEST_THAT(files_identical(from_rebuild, from_encoded));
 		}
 	}
+
+	// Check that combining and reversing in one pass, as the store
+	// does, gives exactly the same files
+	if(!completelyDifferent)
+	{
+		char cmb_onepass[256];
+		sprintf(cmb_onepass, "testfiles/f%d.encoded_onepass", to);
+		char rev_onepass[256];
+		sprintf(rev_onepass, "testfiles/f%d.revdiff_onepass", to);
+		{
+			bool reversedCompletelyDifferent = !completelyDifferent;
+			FileStream diff(to_diff);
+			FileStream from(from_encoded);
+			FileStream out(cmb_onepass, O_WRONLY | O_CREAT | O_EXCL);
+			FileStream reversed(rev_onepass, O_WRONLY | O_CREAT | O_EXCL);
+			BackupStoreFile::CombineFileAndReverseDiff(diff, from, out,
+				reversed, to, &reversedCompletelyDifferent);
+			TEST_THAT(reversedCompletelyDifferent == completelyDifferent);
+		}
+		TEST_THAT(files_identical(cmb_onepass, to_encoded));
+		TEST_THAT(files_identical(rev_onepass, rev_diff));
+	}
 }
 
 void test_combined_diff(int version1, int version2, int serial)
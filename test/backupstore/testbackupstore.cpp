@@ -18,16 +18,21 @@
 #include "BackupProtocol.h"
 #include "BackupStoreAccountDatabase.h"
 #include "BackupStoreAccounts.h"
+#include "BackupStoreCheck.h"
 #include "BackupStoreConfigVerify.h"
 #include "BackupStoreConstants.h"
 #include "BackupStoreDirectory.h"
+#include "BackupStoreDirtyDirectoryLog.h"
 #include "BackupStoreException.h"
 #include "BackupStoreFile.h"
 #include "BackupStoreFilenameClear.h"
 #include "BackupStoreFileEncodeStream.h"
 #include "BackupStoreInfo.h"
 #include "BackupStoreObjectMagic.h"
+#include "BackupStorePackIndex.h"
 #include "BackupStoreRefCountDatabase.h"
+#include "BackupStoreSharedAccountState.h"
+#include "BackupStoreUsageLog.h"
 #include "BoxPortsAndFiles.h"
 #include "CollectInBufferStream.h"
 #include "Configuration.h"
@@ -37,6 +42,7 @@
 #include "RaidFileController.h"
 #include "RaidFileException.h"
 #include "RaidFileRead.h"
+#include "RaidFileUtil.h"
 #include "RaidFileWrite.h"
 #include "SSLLib.h"
 #include "ServerControl.h"
@@ -846,6 +852,149 @@ bool test_temporary_refcount_db_is_independent()
 	TEARDOWN_TEST_BACKUPSTORE();
 }
 
+bool test_refcount_db_bulk_updates()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+		BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+	const BackupStoreAccountDatabase::Entry& rAccount(
+		apAccounts->GetEntry(0x1234567));
+	std::auto_ptr<BackupStoreRefCountDatabase> temp(
+		BackupStoreRefCountDatabase::Create(rAccount));
+
+	// Make the database grow well beyond its initial allocation
+	std::vector<int64_t> ids;
+	ids.push_back(5);
+	ids.push_back(2);
+	ids.push_back(5);
+	ids.push_back(100000);
+	temp->AddReferences(ids);
+	TEST_EQUAL(100000, temp->GetLastObjectIDUsed());
+	TEST_EQUAL(1, temp->GetRefCount(BACKUPSTORE_ROOT_DIRECTORY_ID));
+	TEST_EQUAL(1, temp->GetRefCount(2));
+	TEST_EQUAL(0, temp->GetRefCount(3));
+	TEST_EQUAL(2, temp->GetRefCount(5));
+	TEST_EQUAL(0, temp->GetRefCount(99999));
+	TEST_EQUAL(1, temp->GetRefCount(100000));
+	TEST_CHECK_THROWS(temp->GetRefCount(100001),
+		BackupStoreException, UnknownObjectRefCountRequested);
+
+	ids.clear();
+	ids.push_back(5);
+	ids.push_back(2);
+	std::vector<int64_t> unreferenced;
+	temp->RemoveReferences(ids, &unreferenced);
+	TEST_EQUAL(1, unreferenced.size());
+	TEST_EQUAL(2, unreferenced[0]);
+	TEST_EQUAL(0, temp->GetRefCount(2));
+	TEST_EQUAL(1, temp->GetRefCount(5));
+	temp->Commit();
+	temp.reset();
+
+	// The committed file must be exactly the size of the database, with
+	// the same contents.
+	std::string filename = RaidFileUtil::MakeWriteFileName(
+		RaidFileController::GetController().GetDiscSet(
+			rAccount.GetDiscSet()),
+		BackupStoreAccounts::GetAccountRoot(rAccount) + "refcount.rdb");
+	{
+		EMU_STRUCT_STAT st;
+		TEST_EQUAL(0, EMU_STAT(filename.c_str(), &st));
+		TEST_EQUAL(8 + (100000 * 4), st.st_size);
+	}
+
+	std::auto_ptr<BackupStoreRefCountDatabase> perm(
+		BackupStoreRefCountDatabase::Load(rAccount, true)); // ReadOnly
+	TEST_EQUAL(100000, perm->GetLastObjectIDUsed());
+	TEST_EQUAL(1, perm->GetRefCount(BACKUPSTORE_ROOT_DIRECTORY_ID));
+	TEST_EQUAL(0, perm->GetRefCount(2));
+	TEST_EQUAL(1, perm->GetRefCount(5));
+	TEST_EQUAL(1, perm->GetRefCount(100000));
+
+	// Objects added one at a time to the permanent database must keep
+	// the file exactly the right size, and be seen by readers.
+	{
+		std::auto_ptr<BackupStoreRefCountDatabase> writer(
+			BackupStoreRefCountDatabase::Load(rAccount, false));
+		for(int64_t id = 100001; id <= 100003; id++)
+		{
+			writer->AddReference(id);
+			EMU_STRUCT_STAT st;
+			TEST_EQUAL(0, EMU_STAT(filename.c_str(), &st));
+			TEST_EQUAL(8 + (id * 4), st.st_size);
+			TEST_EQUAL(1, perm->GetRefCount(id));
+			TEST_EQUAL(id, perm->GetLastObjectIDUsed());
+		}
+	}
+	perm.reset();
+
+	// Put back a database that matches the empty account
+	temp = BackupStoreRefCountDatabase::Create(rAccount);
+	temp->Commit();
+	temp.reset();
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_shared_account_state()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+		BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+	BackupStoreSharedAccountState state(0);
+
+	TEST_THAT(state.UpdateAccounts(*apAccounts));
+	TEST_EQUAL(1, state.GetNumberOfAccounts());
+	// Nothing has changed since
+	TEST_THAT(!state.UpdateAccounts(*apAccounts));
+
+	int discSet = -1;
+	TEST_THAT(state.GetAccount(0x1234567, discSet));
+	TEST_EQUAL(0, discSet);
+	TEST_THAT(!state.GetAccount(0x1234568, discSet));
+
+	std::string root = BackupStoreAccounts::GetAccountRoot(
+		apAccounts->GetEntry(0x1234567));
+	std::auto_ptr<BackupStoreInfo> apOnDisc(BackupStoreInfo::Load(0x1234567,
+		root, 0, true)); // ReadOnly
+	int64_t originalBlocksUsed = apOnDisc->GetBlocksUsed();
+
+	// The first read-write load comes from disc, and is then shared
+	std::auto_ptr<BackupStoreInfo> apWriter(state.LoadStoreInfo(0x1234567,
+		root, 0, false)); // ReadWrite
+	TEST_EQUAL(originalBlocksUsed, apWriter->GetBlocksUsed());
+	TEST_THAT(!apWriter->IsModified());
+
+	// Changes are visible to other processes before they're saved
+	apWriter->ChangeBlocksUsed(10);
+	state.PublishStoreInfo(*apWriter, false); // not saved
+	std::auto_ptr<BackupStoreInfo> apReader(state.LoadStoreInfo(0x1234567,
+		root, 0, true)); // ReadOnly
+	TEST_EQUAL(originalBlocksUsed + 10, apReader->GetBlocksUsed());
+	TEST_THAT(apReader->IsModified());
+	apOnDisc = BackupStoreInfo::Load(0x1234567, root, 0, true);
+	TEST_EQUAL(originalBlocksUsed, apOnDisc->GetBlocksUsed());
+
+	// Saving clears the unsaved flag
+	apWriter->Save();
+	state.PublishStoreInfo(*apWriter, true); // saved
+	apReader = state.LoadStoreInfo(0x1234567, root, 0, true);
+	TEST_EQUAL(originalBlocksUsed + 10, apReader->GetBlocksUsed());
+	TEST_THAT(!apReader->IsModified());
+
+	// Changes made on disc by another program, such as bbstoreaccounts,
+	// replace the shared copy
+	apOnDisc = BackupStoreInfo::Load(0x1234567, root, 0, false);
+	apOnDisc->ChangeBlocksUsed(-10);
+	apOnDisc->Save();
+	apReader = state.LoadStoreInfo(0x1234567, root, 0, true);
+	TEST_EQUAL(originalBlocksUsed, apReader->GetBlocksUsed());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
 bool test_server_housekeeping()
 {
 	SETUP_TEST_BACKUPSTORE();
@@ -2276,6 +2425,191 @@ bool test_cannot_open_multiple_writable_connections()
 	TEARDOWN_TEST_BACKUPSTORE();
 }
 
+bool test_staged_uploads()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	// Servers which can stage files accept a later version, and older
+	// ones reject it without ending the conversation, so that clients
+	// can try again with the version they all know
+	{
+		BackupStoreContext bsContext(0x01234567,
+			(HousekeepingInterface *)NULL, "test");
+		bsContext.SetClientHasAccount("backup/01234567/", 0);
+		BackupProtocolLocal protocol(bsContext);
+		TEST_COMMAND_RETURNS_ERROR(protocol,
+			QueryVersion(BACKUP_STORE_SERVER_VERSION_STAGING + 1),
+			Err_WrongVersion);
+		TEST_EQUAL(BACKUP_STORE_SERVER_VERSION_STAGING,
+			protocol.QueryVersion(BACKUP_STORE_SERVER_VERSION_STAGING)->
+				GetVersion());
+	}
+
+	write_test_file(0);
+	std::string storeRoot("backup/01234567/");
+	int64_t fileBlocks = 0;
+
+	// Read-only sessions can stage files for the session which holds
+	// the write lock, once it's started staging, but only it can add
+	// them
+	{
+		BackupProtocolLocal2 protocolWritable(0x01234567, "test",
+			storeRoot, 0, false); // Not read-only
+		BackupProtocolLocal2 protocolReadOnly(0x01234567, "test",
+			storeRoot, 0, true); // ReadOnly
+
+		int64_t modtime = 0;
+		std::auto_ptr<IOStream> upload(BackupStoreFile::EncodeFile(
+			"testfiles/test0", BACKUPSTORE_ROOT_DIRECTORY_ID,
+			uploads[0].name, &modtime));
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStageFile(1234, BACKUPSTORE_ROOT_DIRECTORY_ID,
+				upload),
+			Err_DoesNotExist);
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStartStaging(), Err_SessionReadOnly);
+
+		int64_t sessionID =
+			protocolWritable.QueryStartStaging()->GetObjectID();
+		TEST_THAT(sessionID != 0);
+		// Asking again gives the same session
+		TEST_EQUAL(sessionID,
+			protocolWritable.QueryStartStaging()->GetObjectID());
+
+		upload = BackupStoreFile::EncodeFile("testfiles/test0",
+			BACKUPSTORE_ROOT_DIRECTORY_ID, uploads[0].name);
+		int64_t stagedID = protocolReadOnly.QueryStageFile(sessionID,
+			BACKUPSTORE_ROOT_DIRECTORY_ID, upload)->GetObjectID();
+		TEST_THAT(stagedID != 0);
+		fileBlocks = RaidFileRead::Open(0,
+			StoreStructure::MakeStagedFilename(storeRoot, sessionID,
+				stagedID))->GetDiscUsageInBlocks();
+
+		// Nothing changes until it's added
+		TEST_THAT(check_num_files(0, 0, 0, 1));
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStoreStagedFile(BACKUPSTORE_ROOT_DIRECTORY_ID,
+				modtime, modtime, 0, stagedID, uploads[0].name),
+			Err_SessionReadOnly);
+
+		// Another session can't take the write lock, and so can't
+		// disturb the files staged for this one
+		{
+			BackupStoreContext bsContext(0x01234567,
+				(HousekeepingInterface *)NULL, "test");
+			bsContext.SetClientHasAccount(storeRoot, 0);
+			BackupProtocolLocal protocolWritable2(bsContext);
+			protocolWritable2.QueryVersion(BACKUP_STORE_SERVER_VERSION);
+			TEST_COMMAND_RETURNS_ERROR(protocolWritable2,
+				QueryLogin(0x01234567, 0),
+				Err_CannotLockStoreForWriting);
+		}
+
+		int64_t objID = protocolWritable.QueryStoreStagedFile(
+			BACKUPSTORE_ROOT_DIRECTORY_ID, modtime,
+			modtime, /* use it for attr hash too */
+			0, /* diff from ID */
+			stagedID, uploads[0].name)->GetObjectID();
+		set_refcount(objID, 1);
+		TEST_THAT(check_num_files(1, 0, 0, 1));
+
+		protocolReadOnly.QueryGetFile(BACKUPSTORE_ROOT_DIRECTORY_ID,
+			objID);
+		std::auto_ptr<IOStream> filestream(
+			protocolReadOnly.ReceiveStream());
+		test_test_file(0, *filestream);
+
+		// Each one can only be added once, and it's been moved or
+		// copied into place
+		TEST_COMMAND_RETURNS_ERROR(protocolWritable,
+			QueryStoreStagedFile(BACKUPSTORE_ROOT_DIRECTORY_ID,
+				modtime, modtime, 0, stagedID, uploads[0].name),
+			Err_DoesNotExist);
+		TEST_THAT(!RaidFileRead::FileExists(0,
+			StoreStructure::MakeStagedFilename(storeRoot, sessionID,
+				stagedID)));
+
+		// And not to a directory which doesn't exist
+		upload = BackupStoreFile::EncodeFile("testfiles/test0",
+			BACKUPSTORE_ROOT_DIRECTORY_ID, uploads[0].name);
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStageFile(sessionID, objID + 1000, upload),
+			Err_DoesNotExist);
+
+		upload = BackupStoreFile::EncodeFile("testfiles/test0",
+			BACKUPSTORE_ROOT_DIRECTORY_ID, uploads[0].name);
+		int64_t abandonedID = protocolReadOnly.QueryStageFile(sessionID,
+			BACKUPSTORE_ROOT_DIRECTORY_ID, upload)->GetObjectID();
+		TEST_THAT(abandonedID != 0);
+
+		// Files which weren't added are thrown away when the session
+		// finishes, and no more can be staged for it
+		protocolWritable.QueryFinished();
+		TEST_THAT(!RaidFileRead::FileExists(0,
+			StoreStructure::MakeStagedFilename(storeRoot, sessionID,
+				abandonedID)));
+		upload = BackupStoreFile::EncodeFile("testfiles/test0",
+			BACKUPSTORE_ROOT_DIRECTORY_ID, uploads[0].name);
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStageFile(sessionID, BACKUPSTORE_ROOT_DIRECTORY_ID,
+				upload),
+			Err_DoesNotExist);
+
+		protocolReadOnly.QueryFinished();
+	}
+
+	// Staged files count towards the hard limit, so with room for
+	// just one more copy of the file, it can only be staged once
+	TEST_THAT(fileBlocks > 0);
+	{
+		std::auto_ptr<BackupStoreInfo> info(BackupStoreInfo::Load(
+			0x01234567, storeRoot, 0, false));
+		info->ChangeLimits(info->GetBlocksUsed() + fileBlocks,
+			info->GetBlocksUsed() + fileBlocks * 2 - 1);
+		info->Save();
+	}
+
+	{
+		BackupProtocolLocal2 protocolWritable(0x01234567, "test",
+			storeRoot, 0, false); // Not read-only
+		BackupProtocolLocal2 protocolReadOnly(0x01234567, "test",
+			storeRoot, 0, true); // ReadOnly
+		int64_t sessionID =
+			protocolWritable.QueryStartStaging()->GetObjectID();
+
+		std::auto_ptr<IOStream> upload(BackupStoreFile::EncodeFile(
+			"testfiles/test0", BACKUPSTORE_ROOT_DIRECTORY_ID,
+			uploads[0].name));
+		protocolReadOnly.QueryStageFile(sessionID,
+			BACKUPSTORE_ROOT_DIRECTORY_ID, upload);
+
+		upload = BackupStoreFile::EncodeFile("testfiles/test0",
+			BACKUPSTORE_ROOT_DIRECTORY_ID, uploads[0].name);
+		TEST_COMMAND_RETURNS_ERROR(protocolReadOnly,
+			QueryStageFile(sessionID, BACKUPSTORE_ROOT_DIRECTORY_ID,
+				upload),
+			Err_StorageLimitExceeded);
+
+		protocolReadOnly.QueryFinished();
+		protocolWritable.QueryFinished();
+	}
+
+	// Files left by a session which didn't finish cleanly are thrown
+	// away by housekeeping, which the store check doesn't mind
+	{
+		RaidFileWrite leftover(0, StoreStructure::MakeStagedFilename(
+			storeRoot, 1234, 5678));
+		leftover.Open();
+		leftover.Write("leftover", 8);
+		leftover.Commit();
+	}
+	TEST_THAT(run_housekeeping_and_check_account());
+	TEST_THAT(!RaidFileRead::FileExists(0,
+		StoreStructure::MakeStagedFilename(storeRoot, 1234, 5678)));
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
 bool test_encoding()
 {
 	// Now test encoded files
@@ -2550,6 +2884,123 @@ bool test_store_info()
 	TEARDOWN_TEST_BACKUPSTORE();
 }
 
+bool test_store_info_usage_log()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	RaidFileWrite::CreateDirectory(0, "test-usage");
+	BackupStoreInfo::CreateNew(77, "test-usage/", 0, 1000, 2000);
+	std::string logFilename =
+		BackupStoreUsageLog("test-usage/", 0).GetFilename();
+	TEST_THAT(FileExists(logFilename));
+
+	// Logged changes survive without the info being saved, as if the
+	// process had crashed
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, false));
+		info->ChangeBlocksUsed(10);
+		info->ChangeBlocksInCurrentFiles(10);
+		info->AdjustNumCurrentFiles(2);
+		info->AllocateObjectID();
+		info->LogChanges();
+	}
+
+	{
+		std::auto_ptr<RaidFileRead> rf(
+			RaidFileRead::Open(0, "test-usage/info"));
+		std::auto_ptr<BackupStoreInfo> saved(
+			BackupStoreInfo::Load(*rf, "test-usage/info", true));
+		TEST_EQUAL(0, saved->GetBlocksUsed());
+	}
+
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, true));
+		TEST_EQUAL(10, info->GetBlocksUsed());
+		TEST_EQUAL(10, info->GetBlocksInCurrentFiles());
+		TEST_EQUAL(2, info->GetNumCurrentFiles());
+		TEST_EQUAL(2, info->GetLastObjectIDUsed());
+	}
+
+	// Saving includes them in the info, so they aren't replayed again
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, false));
+		TEST_THAT(info->IsModified());
+		info->ChangeBlocksUsed(5);
+		info->LogChanges();
+		info->Save();
+		info->ChangeBlocksUsed(1);
+		info->LogChanges();
+	}
+
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, true));
+		TEST_EQUAL(16, info->GetBlocksUsed());
+		TEST_EQUAL(2, info->GetLastObjectIDUsed());
+	}
+
+	// A log which the info was saved over before it could be reset is
+	// ignored
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, false));
+		info->ChangeBlocksUsed(2);
+		info->LogChanges();
+
+		CollectInBufferStream oldLog;
+		{
+			FileStream log(logFilename);
+			log.CopyStreamTo(oldLog);
+		}
+		oldLog.SetForReading();
+
+		info->Save();
+
+		FileStream log(logFilename, O_WRONLY | O_TRUNC);
+		oldLog.CopyStreamTo(log);
+	}
+
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, true));
+		TEST_EQUAL(18, info->GetBlocksUsed());
+	}
+
+	// A partly written change is ignored, and not added to, so the info
+	// is saved instead
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, false));
+		info->ChangeBlocksUsed(3);
+		info->LogChanges();
+	}
+
+	{
+		FileStream log(logFilename, O_WRONLY | O_APPEND);
+		log.Write("abc", 3);
+	}
+
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, false));
+		TEST_EQUAL(21, info->GetBlocksUsed());
+		info->ChangeBlocksUsed(4);
+		info->LogChanges();
+		TEST_THAT(!info->IsModified());
+	}
+
+	{
+		std::auto_ptr<BackupStoreInfo> info(
+			BackupStoreInfo::Load(77, "test-usage/", 0, true));
+		TEST_EQUAL(25, info->GetBlocksUsed());
+	}
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
 bool test_login_without_account()
 {
 	// First, try logging in without an account having been created... just make sure login fails.
@@ -2765,6 +3216,823 @@ bool test_housekeeping_deletes_files()
 	TEARDOWN_TEST_BACKUPSTORE();
 }
 
+bool test_housekeeping_packs_small_objects()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+
+	// Upload the same file three times, so that the first two become
+	// old versions, and another one which is then deleted.
+	int64_t subdirid = create_directory(protocol);
+	int64_t old1 = create_file(protocol, subdirid, "packme");
+	int64_t old2 = create_file(protocol, subdirid, "packme");
+	int64_t current = create_file(protocol, subdirid, "packme");
+	int64_t deleted = create_file(protocol, subdirid, "deleteme");
+	protocol.QueryDeleteFile(subdirid, BackupStoreFilenameClear("deleteme"));
+	protocol.QueryFinished();
+
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetPackFileObjectSizeLimit(1000);
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+
+	// The old and deleted files have moved into a pack, the current one
+	// has been left alone.
+	BackupStorePackIndex index("backup/01234567/", 0);
+	index.Load();
+	TEST_EQUAL(3, index.GetNumberOfEntries());
+	TEST_EQUAL(1, index.GetNumberOfPacks());
+	TEST_THAT(index.Find(old1) != 0);
+	TEST_THAT(index.Find(old2) != 0);
+	TEST_THAT(index.Find(deleted) != 0);
+	TEST_THAT(index.Find(current) == 0);
+
+	int64_t packed[] = {old1, old2, deleted};
+	for(size_t i = 0; i < sizeof(packed) / sizeof(packed[0]); i++)
+	{
+		std::string filename;
+		StoreStructure::MakeObjectFilename(packed[i],
+			"backup/01234567/", 0, filename, false);
+		TEST_THAT(!RaidFileRead::FileExists(0, filename));
+
+		std::auto_ptr<IOStream> object(index.OpenObject(packed[i]));
+		TEST_THAT(BackupStoreFile::VerifyEncodedFileFormat(*object));
+	}
+
+	// The store is still consistent, and the packed objects can be
+	// downloaded.
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	protocol.Reopen();
+	TEST_EQUAL(old1, protocol.QueryGetObject(old1)->GetObjectID());
+	{
+		std::auto_ptr<IOStream> objstream(protocol.ReceiveStream());
+		CollectInBufferStream buf;
+		objstream->CopyStreamTo(buf, protocol.GetTimeout());
+		buf.SetForReading();
+		TEST_THAT(BackupStoreFile::VerifyEncodedFileFormat(buf));
+	}
+	protocol.QueryFinished();
+
+	// Reduce the limits so that housekeeping removes all the packed
+	// objects, after which the pack itself is useless and is deleted.
+	TEST_THAT(change_account_limits("0B", "20000B"));
+	TEST_THAT(run_housekeeping_and_check_account());
+	ExpectedRefCounts[old1] = 0;
+	ExpectedRefCounts[old2] = 0;
+	// The refcount DB ends at the current file, now that the deleted
+	// one has gone. Can't use set_refcount(), as that would prune the
+	// current file too.
+	TEST_EQUAL(deleted + 1, ExpectedRefCounts.size());
+	ExpectedRefCounts.resize(deleted);
+
+	index.Load();
+	TEST_EQUAL(0, index.GetNumberOfEntries());
+	TEST_EQUAL(0, index.GetNumberOfPacks());
+	TEST_THAT(!RaidFileRead::FileExists(0,
+		"backup/01234567/" BACKUPSTORE_PACK_DIRECTORY "/p00000001"));
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_operations_limit()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+	int64_t dirid = BACKUPSTORE_ROOT_DIRECTORY_ID;
+	for(int i = 0; i < 6; i++)
+	{
+		dirid = create_directory(protocol, dirid);
+	}
+	protocol.QueryFinished();
+
+	// Reading the root and six subdirectories, two per second, must
+	// take at least three seconds.
+	box_time_t start = GetCurrentBoxTime();
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetMaxOperationsPerSecond(2);
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+	TEST_THAT(GetCurrentBoxTime() - start >= SecondsToBoxTime(3));
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_several_accounts_at_once()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	TEST_THAT_OR(::system(BBSTOREACCOUNTS
+		" -c testfiles/bbstored.conf create 01234568 0 "
+		"10000B 20000B") == 0, FAIL);
+	TestRemoteProcessMemLeaks("bbstoreaccounts.memleaks");
+
+	// Housekeeping recreates a missing refcount database, so its
+	// reappearance shows that each account has been housekept.
+	RaidFileDiscSet discSet(RaidFileController::GetController().GetDiscSet(0));
+	std::string refs1 = RaidFileUtil::MakeWriteFileName(discSet,
+		"backup/01234567/refcount.rdb");
+	std::string refs2 = RaidFileUtil::MakeWriteFileName(discSet,
+		"backup/01234568/refcount.rdb");
+	TEST_EQUAL(0, EMU_UNLINK(refs1.c_str()));
+	TEST_EQUAL(0, EMU_UNLINK(refs2.c_str()));
+
+	// Housekeeping starts as soon as the server does, with two worker
+	// processes, one for each account.
+	bbstored_pid = StartDaemon(bbstored_pid, BBSTORED " " + bbstored_args +
+		" testfiles/bbstored_housekeeping.conf", "testfiles/bbstored.pid");
+	TEST_THAT_OR(bbstored_pid != 0, FAIL);
+
+	for(int i = 0; i < 30; i++)
+	{
+		if(FileExists(refs1) && FileExists(refs2))
+		{
+			break;
+		}
+		::safe_sleep(1);
+	}
+
+	TEST_THAT(ServerIsAlive(bbstored_pid));
+	TEST_THAT(StopServer());
+
+	TEST_THAT(FileExists(refs1));
+	TEST_THAT(FileExists(refs2));
+
+	// Both accounts are still consistent. The second one is only
+	// checked here, as teardown only knows about the first.
+	std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+		BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+	BackupStoreAccountDatabase::Entry account =
+		apAccounts->GetEntry(0x1234568);
+	TEST_EQUAL(0, run_housekeeping(account));
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_incremental()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+	int64_t subdirid = create_directory(protocol);
+	// Another object after it, so that removing it doesn't shorten the
+	// refcount database
+	create_file(protocol, BACKUPSTORE_ROOT_DIRECTORY_ID);
+	protocol.QueryFinished();
+
+	// Clients don't log changes until housekeeping has scanned the whole
+	// account once
+	BackupStoreDirtyDirectoryLog log("backup/01234567/", 0);
+	TEST_THAT(!log.Exists());
+
+	box_time_t lastFullScan = 0;
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetFullScanInterval(SecondsToBoxTime(3600));
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+
+	std::set<int64_t> dirty;
+	TEST_THAT(log.Read(dirty, lastFullScan));
+	TEST_EQUAL(0, dirty.size());
+	TEST_THAT(lastFullScan != 0);
+
+	// Deleting the empty subdirectory only changes the root
+	protocol.Reopen();
+	protocol.QueryDeleteDirectory(subdirid);
+	protocol.QueryFinished();
+
+	box_time_t logLastFullScan = 0;
+	TEST_THAT(log.Read(dirty, logLastFullScan));
+	TEST_EQUAL(1, dirty.size());
+	TEST_THAT(dirty.find(BACKUPSTORE_ROOT_DIRECTORY_ID) != dirty.end());
+	TEST_EQUAL(lastFullScan, logLastFullScan);
+
+	// Housekeeping only looks at the root, and finds the deleted
+	// subdirectory through it
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetFullScanInterval(SecondsToBoxTime(3600));
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+
+	std::string dirFilename;
+	StoreStructure::MakeObjectFilename(subdirid, "backup/01234567/", 0,
+		dirFilename, false);
+	TEST_THAT(!RaidFileRead::FileExists(0, dirFilename));
+	ExpectedRefCounts[subdirid] = 0;
+
+	TEST_THAT(log.Read(dirty, logLastFullScan));
+	TEST_EQUAL(0, dirty.size());
+	TEST_EQUAL(lastFullScan, logLastFullScan);
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	// Housekeeping without incremental scans enabled leaves an empty
+	// log, as it has looked at everything
+	TEST_THAT(run_housekeeping_and_check_account());
+	TEST_THAT(log.Read(dirty, logLastFullScan));
+	TEST_EQUAL(0, dirty.size());
+	TEST_THAT(logLastFullScan >= lastFullScan);
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_deletion_order_with_spill()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+
+	// Upload the same file many times, to make enough old versions
+	// that the temporary files have to be merged
+	int64_t subdirid = create_directory(protocol);
+	std::vector<int64_t> versions;
+	for(int i = 0; i < 20; i++)
+	{
+		versions.push_back(create_file(protocol, subdirid, "file"));
+	}
+	protocol.QueryFinished();
+
+	// Ask housekeeping to free about two of them
+	int64_t blocksUsed, blocksPerFile;
+	{
+		std::auto_ptr<BackupStoreInfo> info(BackupStoreInfo::Load(
+			0x01234567, "backup/01234567/", 0, true));
+		blocksUsed = info->GetBlocksUsed();
+		blocksPerFile = info->GetBlocksInOldFiles() /
+			(versions.size() - 1);
+	}
+	std::ostringstream softLimit;
+	softLimit << (blocksUsed - (blocksPerFile * 2) + 1) << "B";
+	TEST_THAT(change_account_limits(softLimit.str().c_str(), "20000B"));
+
+	// With only one candidate allowed in memory, they are all merged from
+	// temporary files, and must still be deleted oldest first.
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetMaxPotentialDeletionsInMemory(1);
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+
+	int numDeleted = 0;
+	bool keptOne = false;
+	for(size_t i = 0; i < versions.size(); i++)
+	{
+		std::string filename;
+		StoreStructure::MakeObjectFilename(versions[i],
+			"backup/01234567/", 0, filename, false);
+		if(RaidFileRead::FileExists(0, filename))
+		{
+			keptOne = true;
+		}
+		else
+		{
+			// Nothing newer may have gone before it
+			TEST_THAT(!keptOne);
+			ExpectedRefCounts[versions[i]] = 0;
+			numDeleted++;
+		}
+	}
+	TEST_THAT(numDeleted >= 1 && numDeleted <= 3);
+
+	// The temporary files have been removed
+	RaidFileController &rcontroller(RaidFileController::GetController());
+	RaidFileDiscSet rdiscSet(rcontroller.GetDiscSet(0));
+	for(size_t i = 0; i < versions.size(); i++)
+	{
+		std::ostringstream name;
+		name << "backup/01234567/deletions" << i << ".tmp";
+		TEST_THAT(!FileExists(RaidFileUtil::MakeWriteFileName(
+			rdiscSet, name.str())));
+	}
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_rebases_long_patch_chains()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+
+	// Upload five versions of a file, each as a patch to the last, so
+	// that the oldest is four patches away from the current version
+	BackupStoreFilenameClear storeFilename("chain");
+	std::vector<char> data(128 * 1024);
+	uint32_t seed = 1;
+	for(size_t i = 0; i < data.size(); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = (char)(seed >> 16);
+	}
+
+	std::vector<int64_t> versions;
+	for(int v = 0; v < 5; v++)
+	{
+		data[v * 20000] = 'A' + v;
+		std::ostringstream localFilename;
+		localFilename << "testfiles/chain" << v;
+		{
+			FileStream out(localFilename.str(),
+				O_WRONLY | O_CREAT | O_TRUNC);
+			out.Write(&data[0], data.size());
+		}
+
+		versions.push_back(BackupStoreFile::QueryStoreFileDiff(
+			protocol, localFilename.str(),
+			BACKUPSTORE_ROOT_DIRECTORY_ID,
+			versions.empty() ? 0 : versions.back(),
+			0, // AttributesHash
+			storeFilename));
+		set_refcount(versions.back(), 1);
+	}
+	protocol.QueryFinished();
+
+	// Housekeeping with a limit of two patches rewrites the second
+	// oldest version, leaving the oldest as a patch against it
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetMaxPatchChainDepth(2);
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		TEST_EQUAL(0, housekeeping.GetErrorCount());
+	}
+
+	// The dependency information isn't sent to clients
+	{
+		std::string dirFilename;
+		StoreStructure::MakeObjectFilename(
+			BACKUPSTORE_ROOT_DIRECTORY_ID, "backup/01234567/", 0,
+			dirFilename, false);
+		std::auto_ptr<RaidFileRead> dirStream(
+			RaidFileRead::Open(0, dirFilename));
+		BackupStoreDirectory dir(*dirStream);
+
+		BackupStoreDirectory::Entry *en =
+			dir.FindEntryByID(versions[1]);
+		TEST_THAT_OR(en != NULL, FAIL);
+		TEST_EQUAL(0, en->GetDependsNewer());
+		TEST_EQUAL(versions[0], en->GetDependsOlder());
+
+		en = dir.FindEntryByID(versions[2]);
+		TEST_THAT_OR(en != NULL, FAIL);
+		TEST_EQUAL(versions[3], en->GetDependsNewer());
+		TEST_EQUAL(0, en->GetDependsOlder());
+	}
+
+	// Every version can still be restored
+	protocol.Reopen();
+	for(int v = 0; v < 5; v++)
+	{
+		protocol.QueryGetFile(BACKUPSTORE_ROOT_DIRECTORY_ID,
+			versions[v]);
+		std::auto_ptr<IOStream> filestream(protocol.ReceiveStream());
+		BackupStoreFile::DecodeFile(*filestream,
+			"testfiles/chain.downloaded", SHORT_TIMEOUT);
+
+		std::ostringstream localFilename;
+		localFilename << "testfiles/chain" << v;
+		TEST_THAT(check_files_same("testfiles/chain.downloaded",
+			localFilename.str().c_str()));
+		EMU_UNLINK("testfiles/chain.downloaded");
+	}
+	protocol.QueryFinished();
+
+	for(int v = 0; v < 5; v++)
+	{
+		std::ostringstream localFilename;
+		localFilename << "testfiles/chain" << v;
+		EMU_UNLINK(localFilename.str().c_str());
+	}
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_housekeeping_merges_in_several_processes()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+
+	// Upload two files with five versions each, each version a patch
+	// to the next
+	std::vector<char> data(128 * 1024);
+	uint32_t seed = 1;
+	for(size_t i = 0; i < data.size(); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = (char)(seed >> 16);
+	}
+
+	std::vector<int64_t> versions[2];
+	for(int f = 0; f < 2; f++)
+	{
+		std::ostringstream name;
+		name << "merge" << f;
+		BackupStoreFilenameClear storeFilename(name.str());
+
+		for(int v = 0; v < 5; v++)
+		{
+			data[f * 1000 + v * 20000] = 'A' + v;
+			std::ostringstream localFilename;
+			localFilename << "testfiles/merge" << f << "-" << v;
+			{
+				FileStream out(localFilename.str(),
+					O_WRONLY | O_CREAT | O_TRUNC);
+				out.Write(&data[0], data.size());
+			}
+
+			versions[f].push_back(BackupStoreFile::QueryStoreFileDiff(
+				protocol, localFilename.str(),
+				BACKUPSTORE_ROOT_DIRECTORY_ID,
+				versions[f].empty() ? 0 : versions[f].back(),
+				0, // AttributesHash
+				storeFilename));
+			set_refcount(versions[f].back(), 1);
+		}
+	}
+	protocol.QueryFinished();
+
+	// Mark the middle versions for removal. Removing both the second and
+	// third versions merges both into the oldest, so the second merge
+	// has to wait for the first.
+	std::string dirFilename;
+	StoreStructure::MakeObjectFilename(BACKUPSTORE_ROOT_DIRECTORY_ID,
+		"backup/01234567/", 0, dirFilename, false);
+	{
+		BackupStoreDirectory dir;
+		{
+			std::auto_ptr<RaidFileRead> dirStream(
+				RaidFileRead::Open(0, dirFilename));
+			dir.ReadFromStream(*dirStream, IOStream::TimeOutInfinite);
+		}
+
+		for(int f = 0; f < 2; f++)
+		{
+			for(int v = 1; v < 3; v++)
+			{
+				BackupStoreDirectory::Entry *en =
+					dir.FindEntryByID(versions[f][v]);
+				TEST_THAT_OR(en != NULL, FAIL);
+				TEST_THAT(en->IsOld());
+				en->AddFlags(BackupStoreDirectory::Entry::Flags_RemoveASAP);
+			}
+		}
+
+		RaidFileWrite writedir(0, dirFilename);
+		writedir.Open(true /* overwrite */);
+		dir.WriteToStream(writedir);
+		writedir.Commit(true);
+	}
+
+	{
+		HousekeepStoreAccount housekeeping(0x01234567,
+			"backup/01234567/", 0, NULL);
+		housekeeping.SetMaxMergeProcesses(2);
+		TEST_THAT(housekeeping.DoHousekeeping(true));
+		// The full scan reports the files removed while scanning as
+		// differences from the old counts, so don't check for errors
+	}
+
+	for(int f = 0; f < 2; f++)
+	{
+		ExpectedRefCounts[versions[f][1]] = 0;
+		ExpectedRefCounts[versions[f][2]] = 0;
+	}
+
+	// The middle versions are gone, and the oldest now depends on the
+	// fourth
+	{
+		std::auto_ptr<RaidFileRead> dirStream(
+			RaidFileRead::Open(0, dirFilename));
+		BackupStoreDirectory dir(*dirStream);
+
+		for(int f = 0; f < 2; f++)
+		{
+			TEST_THAT(dir.FindEntryByID(versions[f][1]) == NULL);
+			TEST_THAT(dir.FindEntryByID(versions[f][2]) == NULL);
+
+			BackupStoreDirectory::Entry *en =
+				dir.FindEntryByID(versions[f][0]);
+			TEST_THAT_OR(en != NULL, FAIL);
+			TEST_EQUAL(versions[f][3], en->GetDependsNewer());
+		}
+	}
+
+	// The remaining versions can all be restored
+	protocol.Reopen();
+	for(int f = 0; f < 2; f++)
+	{
+		for(int v = 0; v < 5; v++)
+		{
+			std::ostringstream localFilename;
+			localFilename << "testfiles/merge" << f << "-" << v;
+
+			if(v == 1 || v == 2)
+			{
+				EMU_UNLINK(localFilename.str().c_str());
+				continue;
+			}
+
+			protocol.QueryGetFile(BACKUPSTORE_ROOT_DIRECTORY_ID,
+				versions[f][v]);
+			std::auto_ptr<IOStream> filestream(
+				protocol.ReceiveStream());
+			BackupStoreFile::DecodeFile(*filestream,
+				"testfiles/merge.downloaded", SHORT_TIMEOUT);
+			TEST_THAT(check_files_same("testfiles/merge.downloaded",
+				localFilename.str().c_str()));
+			EMU_UNLINK("testfiles/merge.downloaded");
+			EMU_UNLINK(localFilename.str().c_str());
+		}
+	}
+	protocol.QueryFinished();
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_check_in_several_processes()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+	write_test_file(1);
+	create_test_data_subdirs(protocol, BACKUPSTORE_ROOT_DIRECTORY_ID,
+		"test_check", 2 /* depth */, NULL /* pRefCount */);
+	protocol.QueryFinished();
+
+	// Damage the last file uploaded
+	int64_t damagedID = ExpectedRefCounts.size() - 1;
+	{
+		std::string filename;
+		StoreStructure::MakeObjectFilename(damagedID,
+			"backup/01234567/", 0, filename, false);
+		RaidFileWrite rfw(0, filename);
+		rfw.Open(true); // AllowOverwrite
+		char junk[1024];
+		::memset(junk, 'x', sizeof(junk));
+		rfw.Write(junk, sizeof(junk));
+		rfw.Commit(true); // ConvertToRaidNow
+	}
+
+	// Checking in several processes finds the same problems as checking
+	// in one
+	int64_t serialErrors = 0;
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			false, true); // FixErrors, Quiet
+		check.Check();
+		serialErrors = check.GetNumErrorsFound();
+	}
+	TEST_THAT(serialErrors > 0);
+
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			false, true); // FixErrors, Quiet
+		check.SetNumberOfProcesses(3);
+		check.Check();
+		TEST_EQUAL(serialErrors, check.GetNumErrorsFound());
+	}
+
+	// And fixes them, which needs the account's write lock
+	{
+		std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+			BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+		BackupStoreAccounts accounts(*apAccounts);
+		NamedLock lock;
+		accounts.LockAccount(0x01234567, lock);
+
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.SetNumberOfProcesses(3);
+		check.Check();
+		TEST_THAT(check.GetNumErrorsFound() > 0);
+	}
+
+	// The damaged file was the last object, so the rebuilt reference
+	// count database no longer includes it
+	ExpectedRefCounts.resize(damagedID);
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_check_with_object_table_on_disc()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+	write_test_file(1);
+	create_test_data_subdirs(protocol, BACKUPSTORE_ROOT_DIRECTORY_ID,
+		"test_check", 2 /* depth */, NULL /* pRefCount */);
+	protocol.QueryFinished();
+
+	// Delete the last file uploaded, leaving a directory entry for it
+	int64_t deletedID = ExpectedRefCounts.size() - 1;
+	{
+		std::string filename;
+		StoreStructure::MakeObjectFilename(deletedID,
+			"backup/01234567/", 0, filename, false);
+		RaidFileWrite del(0, filename);
+		del.Delete();
+	}
+
+	int64_t inMemoryErrors = 0;
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			false, true); // FixErrors, Quiet
+		check.Check();
+		inMemoryErrors = check.GetNumErrorsFound();
+	}
+	TEST_THAT(inMemoryErrors > 0);
+
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			false, true); // FixErrors, Quiet
+		check.SetObjectTableOnDisc(true);
+		check.Check();
+		TEST_EQUAL(inMemoryErrors, check.GetNumErrorsFound());
+	}
+
+	// Fixing errors needs the account's write lock
+	{
+		std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+			BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+		BackupStoreAccounts accounts(*apAccounts);
+		NamedLock lock;
+		accounts.LockAccount(0x01234567, lock);
+
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.SetObjectTableOnDisc(true);
+		check.Check();
+		TEST_EQUAL(inMemoryErrors, check.GetNumErrorsFound());
+	}
+
+	// The temporary file, which is named like a RaidFile's write file,
+	// has gone
+	{
+		RaidFileDiscSet rdiscSet(
+			RaidFileController::GetController().GetDiscSet(0));
+		TEST_THAT(!FileExists(RaidFileUtil::MakeWriteFileName(rdiscSet,
+			"backup/01234567/checktable.tmp")));
+	}
+
+	ExpectedRefCounts.resize(deletedID);
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
+bool test_incremental_check()
+{
+	SETUP_TEST_BACKUPSTORE();
+
+	BackupProtocolLocal2 protocol(0x01234567, "test", "backup/01234567/",
+		0, false); // Not read-only
+	write_test_file(1);
+	create_test_data_subdirs(protocol, BACKUPSTORE_ROOT_DIRECTORY_ID,
+		"test_check", 1 /* depth */, NULL /* pRefCount */);
+	protocol.QueryFinished();
+
+	// Revision IDs may only have a resolution of one second, so files
+	// written in the same second as a check are always verified again
+	::safe_sleep(2);
+
+	// A check without the write lock, which only reads, doesn't record
+	// a checkpoint, as files may have been changed while it ran
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			false, true); // FixErrors, Quiet
+		check.SetIncremental(true);
+		check.Check();
+		TEST_EQUAL(0, check.GetNumErrorsFound());
+		TEST_EQUAL(0, check.GetNumObjectsNotReverified());
+	}
+	RaidFileDiscSet rdiscSet(
+		RaidFileController::GetController().GetDiscSet(0));
+	TEST_THAT(!FileExists(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		"backup/01234567/check.state")));
+
+	// The rest do, so they need it
+	std::auto_ptr<BackupStoreAccountDatabase> apAccounts(
+		BackupStoreAccountDatabase::Read("testfiles/accounts.txt"));
+	BackupStoreAccounts accounts(*apAccounts);
+	NamedLock lock;
+	accounts.LockAccount(0x01234567, lock);
+
+	// Without a checkpoint, everything is verified
+	int64_t numObjects = 0;
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.SetIncremental(true);
+		check.Check();
+		TEST_EQUAL(0, check.GetNumErrorsFound());
+		TEST_EQUAL(0, check.GetNumObjectsNotReverified());
+		numObjects = check.GetNumObjectsVerified();
+	}
+	TEST_THAT(FileExists(RaidFileUtil::MakeWriteFileName(rdiscSet,
+		"backup/01234567/check.state")));
+
+	// Now only the directories are, as the files haven't changed
+	int64_t numDirs = 0;
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.SetIncremental(true);
+		check.Check();
+		TEST_EQUAL(0, check.GetNumErrorsFound());
+		TEST_THAT(check.GetNumObjectsNotReverified() > 0);
+		numDirs = check.GetNumObjectsVerified();
+		TEST_EQUAL(numObjects, numDirs +
+			check.GetNumObjectsNotReverified());
+	}
+
+	// A file rewritten since the last check is verified again
+	int64_t lastID = ExpectedRefCounts.size() - 1;
+	{
+		std::string filename;
+		StoreStructure::MakeObjectFilename(lastID,
+			"backup/01234567/", 0, filename, false);
+		CollectInBufferStream contents;
+		{
+			std::auto_ptr<RaidFileRead> read(
+				RaidFileRead::Open(0, filename));
+			read->CopyStreamTo(contents);
+		}
+		contents.SetForReading();
+		RaidFileWrite write(0, filename);
+		write.Open(true); // AllowOverwrite
+		contents.CopyStreamTo(write);
+		write.Commit(true); // ConvertToRaidNow
+	}
+
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.SetIncremental(true);
+		check.Check();
+		TEST_EQUAL(0, check.GetNumErrorsFound());
+		TEST_EQUAL(numDirs + 1, check.GetNumObjectsVerified());
+	}
+
+	// A full check still reads everything
+	{
+		BackupStoreCheck check("backup/01234567/", 0, 0x01234567,
+			true, true); // FixErrors, Quiet
+		check.Check();
+		TEST_EQUAL(0, check.GetNumErrorsFound());
+		TEST_EQUAL(numObjects, check.GetNumObjectsVerified());
+	}
+
+	lock.ReleaseLock();
+
+	TEST_THAT(check_account());
+	TEST_THAT(check_reference_counts());
+
+	TEARDOWN_TEST_BACKUPSTORE();
+}
+
 bool test_account_limits_respected()
 {
 	SETUP_TEST_BACKUPSTORE();
@@ -3290,14 +4558,18 @@ int test(int argc, const char *argv[])
 
 	TEST_THAT(test_filename_encoding());
 	TEST_THAT(test_temporary_refcount_db_is_independent());
+	TEST_THAT(test_refcount_db_bulk_updates());
+	TEST_THAT(test_shared_account_state());
 	TEST_THAT(test_bbstoreaccounts_create());
 	TEST_THAT(test_bbstoreaccounts_delete());
 	TEST_THAT(test_backupstore_directory());
 	TEST_THAT(test_directory_parent_entry_tracks_directory_size());
 	TEST_THAT(test_cannot_open_multiple_writable_connections());
+	TEST_THAT(test_staged_uploads());
 	TEST_THAT(test_encoding());
 	TEST_THAT(test_symlinks());
 	TEST_THAT(test_store_info());
+	TEST_THAT(test_store_info_usage_log());
 
 	init_context(context);
 
@@ -3309,6 +4581,16 @@ int test(int argc, const char *argv[])
 	TEST_THAT(test_account_limits_respected());
 	TEST_THAT(test_multiple_uploads());
 	TEST_THAT(test_housekeeping_deletes_files());
+	TEST_THAT(test_housekeeping_packs_small_objects());
+	TEST_THAT(test_housekeeping_operations_limit());
+	TEST_THAT(test_housekeeping_several_accounts_at_once());
+	TEST_THAT(test_housekeeping_incremental());
+	TEST_THAT(test_housekeeping_deletion_order_with_spill());
+	TEST_THAT(test_housekeeping_rebases_long_patch_chains());
+	TEST_THAT(test_housekeeping_merges_in_several_processes());
+	TEST_THAT(test_check_in_several_processes());
+	TEST_THAT(test_check_with_object_table_on_disc());
+	TEST_THAT(test_incremental_check());
 	TEST_THAT(test_read_write_attr_streamformat());
 
 	return finish_test_suite();
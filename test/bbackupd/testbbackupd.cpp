@@ -50,11 +50,19 @@
 
 #include <map>
 
+#include <depot.h>
+
+#include "Archive.h"
+#include "BackupClientChangeJournal.h"
 #include "BackupClientCryptoKeys.h"
 #include "BackupClientContext.h"
+#include "BackupClientDirectoryReader.h"
 #include "BackupClientFileAttributes.h"
 #include "BackupClientInodeToIDMap.h"
 #include "BackupClientRestore.h"
+#include "BackupClientScanAhead.h"
+#include "BackupClientStoreObjectInfo.h"
+#include "BackupClientUploadPool.h"
 #include "BackupDaemon.h"
 #include "BackupDaemonConfigVerify.h"
 #include "BackupProtocol.h"
@@ -80,6 +88,7 @@
 #include "LocalProcessStream.h"
 #include "MemBlockStream.h"
 #include "RaidFileController.h"
+#include "RaidFileRead.h"
 #include "SSLLib.h"
 #include "ServerControl.h"
 #include "Socket.h"
@@ -4011,6 +4020,842 @@ bool test_backup_many_files()
 	TEARDOWN_TEST_BBACKUPD();
 }
 
+bool test_backup_with_scan_ahead_processes()
+{
+	SETUP_WITH_BBSTORED();
+
+	unpack_files("test2");
+	unpack_files("test3");
+	unpack_files("testexclude");
+
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-scanahead.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("DirectoryScanProcesses = 3\n");
+	}
+
+#ifndef WIN32
+	// The processes read the whole location, skipping excluded
+	// directories, and stop when asked
+	{
+		BackupClientScanAhead scanAhead(3);
+		scanAhead.Start("testfiles/TestDir1", NULL);
+		TEST_EQUAL(3, scanAhead.GetNumProcesses());
+		scanAhead.Stop();
+		TEST_EQUAL(0, scanAhead.GetNumProcesses());
+	}
+#endif
+
+	// The backup must be exactly the same as without them
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-scanahead.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// And they must all have been waited for
+#ifndef WIN32
+	int status;
+	TEST_THAT(::waitpid(-1, &status, WNOHANG) <= 0);
+#endif
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
+bool test_backup_with_upload_processes()
+{
+	SETUP_WITH_BBSTORED();
+
+	unpack_files("test2");
+	unpack_files("test3");
+
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-upload.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("UploadProcesses = 3\n");
+	}
+
+	// Big enough to be diffed when it changes
+	{
+		FileStream big("testfiles/TestDir1/upload-diff",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		std::string block(1024, 'x');
+		for(int i = 0; i < 256; i++)
+		{
+			block[i % block.size()] = (char)i;
+			big.Write(block.c_str(), block.size());
+		}
+	}
+	{
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+		TEST_THAT(::utimes("testfiles/TestDir1/upload-diff",
+			times) == 0);
+	}
+
+	// The backup must be exactly the same as without them, with every
+	// file staged by the processes, rather than left to the sync, and
+	// nothing to warn about apart from the relative location path
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-upload.conf"));
+	{
+		Capture capture;
+		Logging::TempLoggerGuard guard(&capture);
+		bbackupd.RunSyncNow();
+
+		int warnings = 0;
+		std::vector<Capture::Message> messages = capture.GetMessages();
+		for(std::vector<Capture::Message>::iterator
+			i = messages.begin(); i != messages.end(); i++)
+		{
+			if(i->level <= Log::WARNING &&
+				!StartsWith("location path is not absolute",
+					i->message))
+			{
+				warnings++;
+			}
+		}
+		TEST_EQUAL(0, warnings);
+	}
+	TEST_COMPARE(Compare_Same);
+
+	// And nothing is left staged once the sync has finished
+	{
+		std::vector<std::string> staged;
+		RaidFileRead::ReadDirectoryContents(0,
+			"backup/01234567/" BACKUPSTORE_STAGING_DIRECTORY,
+			RaidFileRead::DirReadType_FilesOnly, staged);
+		TEST_EQUAL(0, staged.size());
+	}
+
+	// Including patches
+	{
+		FileStream big("testfiles/TestDir1/upload-diff", O_WRONLY);
+		big.Seek(100000, IOStream::SeekType_Absolute);
+		big.Write("changed", 7);
+	}
+	{
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(366*24*60*60)), times[1]);
+		times[0] = times[1];
+		TEST_THAT(::utimes("testfiles/TestDir1/upload-diff",
+			times) == 0);
+	}
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// With so little memory for the queue between scanning and
+	// uploading that the scan has to keep waiting for the uploads,
+	// files in several levels of new directories must still end up
+	// the same
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-upload.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("UploadProcesses = 2\n");
+		out.Write("UploadQueueMemory = 1\n");
+	}
+	{
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+
+		std::string dir = "testfiles/TestDir1/upload-queue";
+		for(int level = 0; level < 3; level++)
+		{
+			TEST_THAT(::mkdir(dir.c_str(), 0755) == 0);
+			for(int i = 0; i < 4; i++)
+			{
+				std::ostringstream name;
+				name << dir << "/file" << i;
+				{
+					FileStream file(name.str(),
+						O_WRONLY | O_CREAT | O_TRUNC);
+					file.Write(name.str().c_str(),
+						name.str().size());
+				}
+				TEST_THAT(::utimes(name.str().c_str(),
+					times) == 0);
+			}
+			dir += "/sub";
+		}
+	}
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-upload.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// Files sent smallest first are added as soon as they're staged,
+	// out of order, and large ones are kept off the last idle process,
+	// but the directories must still end up the same
+	{
+		BackupClientUploadPool::Order order;
+		TEST_THAT(BackupClientUploadPool::GetNamedOrder("smallest",
+			order));
+		TEST_EQUAL(BackupClientUploadPool::Order_SmallestFirst, order);
+		TEST_THAT(!BackupClientUploadPool::GetNamedOrder("biggest",
+			order));
+	}
+
+	// Jobs are picked by size or age, in the order they were queued when
+	// they're equally good, and large files are kept off the last idle
+	// process
+	{
+		typedef BackupClientUploadPool Pool;
+		std::deque<std::pair<int, Pool::Job> > queue;
+		int64_t sizes[] = {3000, 1000, 2000, 1000};
+		box_time_t times[] = {20, 30, 10, 10};
+		for(int i = 0; i < 4; i++)
+		{
+			Pool::Job job;
+			job.mFileSize = sizes[i];
+			job.mModTime = times[i];
+			queue.push_back(std::make_pair(i + 1, job));
+		}
+
+		TEST_EQUAL(0, Pool::ChooseJob(queue, Pool::Order_Found,
+			0, 3, 3));
+		TEST_EQUAL(1, Pool::ChooseJob(queue, Pool::Order_SmallestFirst,
+			0, 3, 3));
+		TEST_EQUAL(2, Pool::ChooseJob(queue, Pool::Order_OldestFirst,
+			0, 3, 3));
+
+		// Files of 2000 bytes or more are large, and can go to any
+		// idle process except the last, unless there's only one
+		TEST_EQUAL(0, Pool::ChooseJob(queue, Pool::Order_Found,
+			2000, 3, 2));
+		TEST_EQUAL(1, Pool::ChooseJob(queue, Pool::Order_Found,
+			2000, 3, 1));
+		TEST_EQUAL(3, Pool::ChooseJob(queue, Pool::Order_OldestFirst,
+			2000, 3, 1));
+		TEST_EQUAL(0, Pool::ChooseJob(queue, Pool::Order_Found,
+			2000, 1, 1));
+
+		// Nothing is started on the last idle process if only large
+		// files are left
+		queue.erase(queue.begin() + 3);
+		queue.erase(queue.begin() + 1);
+		TEST_EQUAL(queue.size(), Pool::ChooseJob(queue,
+			Pool::Order_SmallestFirst, 2000, 3, 1));
+		TEST_EQUAL(1, Pool::ChooseJob(queue,
+			Pool::Order_SmallestFirst, 2000, 3, 2));
+	}
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-upload.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("UploadProcesses = 3\n");
+		out.Write("UploadOrder = smallest\n");
+		out.Write("LargeUploadSize = 16\n");
+	}
+	{
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+
+		std::string dir = "testfiles/TestDir1/upload-order";
+		for(int level = 0; level < 2; level++)
+		{
+			TEST_THAT(::mkdir(dir.c_str(), 0755) == 0);
+			for(int i = 0; i < 6; i++)
+			{
+				// Largest first, so that the order changes
+				std::ostringstream name;
+				name << dir << "/file" << i;
+				{
+					FileStream file(name.str(),
+						O_WRONLY | O_CREAT | O_TRUNC);
+					std::string data((6 - i) * 8 * 1024,
+						(char)('a' + i));
+					file.Write(data.c_str(), data.size());
+				}
+				TEST_THAT(::utimes(name.str().c_str(),
+					times) == 0);
+			}
+			dir += "/sub";
+		}
+	}
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-upload.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// And they must all have been waited for
+#ifndef WIN32
+	int status;
+	TEST_THAT(::waitpid(-1, &status, WNOHANG) <= 0);
+#endif
+
+	// Files were staged, and every one was added to the store
+	{
+		TEST_THAT(RaidFileRead::DirectoryExists(0,
+			"backup/01234567/" BACKUPSTORE_STAGING_DIRECTORY));
+		std::vector<std::string> staged;
+		RaidFileRead::ReadDirectoryContents(0,
+			"backup/01234567/" BACKUPSTORE_STAGING_DIRECTORY,
+			RaidFileRead::DirReadType_FilesOnly, staged);
+		TEST_EQUAL(0, staged.size());
+	}
+
+	// Locations with a higher UploadPriority are synced first, whatever
+	// order they're configured in
+	{
+		CollectInBufferStream buf;
+		FileStream in("testfiles/bbackupd-temploc.conf");
+		in.CopyStreamTo(buf);
+		std::string conf((const char *)buf.GetBuffer(), buf.GetSize());
+		std::string path("Path = testfiles/TestDir2\n");
+		std::string::size_type pos = conf.find(path);
+		TEST_THAT_OR(pos != std::string::npos, FAIL);
+		conf.insert(pos + path.size(), "\t\tUploadPriority = 1\n");
+		conf += "UploadProcesses = 2\n";
+
+		FileStream out("testfiles/bbackupd-priority.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		out.Write(conf.c_str(), conf.size());
+	}
+	TEST_THAT(::mkdir("testfiles/TestDir2", 0755) == 0);
+	{
+		FileStream file("testfiles/TestDir2/file",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		file.Write("priority", 8);
+	}
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-priority.conf"));
+	{
+		Capture capture;
+		Logging::TempLoggerGuard guard(&capture);
+		bbackupd.RunSyncNow();
+
+		std::vector<std::string> locations;
+		std::string prefix("backup for location '");
+		std::vector<Capture::Message> messages = capture.GetMessages();
+		for(std::vector<Capture::Message>::iterator
+			i = messages.begin(); i != messages.end(); i++)
+		{
+			if(StartsWith(prefix, i->message))
+			{
+				locations.push_back(i->message.substr(
+					prefix.size(), 5));
+			}
+		}
+		TEST_EQUAL(2, locations.size());
+		if(locations.size() == 2)
+		{
+			TEST_EQUAL("Test2", locations[0]);
+			TEST_EQUAL("Test1", locations[1]);
+		}
+	}
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
+bool test_change_journal_skips_unchanged_directories()
+{
+	SETUP_WITH_BBSTORED();
+
+	unpack_files("test2");
+	unpack_files("test3");
+
+#ifdef HAVE_SYS_INOTIFY_H
+	// Directories are only skipped once they've been read, and only
+	// until something in them changes
+	{
+		BackupClientChangeJournal journal(SecondsToBoxTime(86400));
+		TEST_THAT(!journal.StartSync());
+		journal.WatchDirectory("testfiles/TestDir1");
+		journal.WatchDirectory("testfiles/TestDir1/x1");
+		journal.WatchDirectory("testfiles/TestDir1/sub23");
+		journal.WatchDirectory("testfiles/TestDir1/sub23/dhsfdss");
+		TEST_EQUAL(4, journal.GetNumWatches());
+		TEST_THAT(!journal.IsUnchanged("testfiles/TestDir1/x1"));
+		journal.FinishSync(true);
+
+		TEST_THAT(journal.StartSync());
+		TEST_THAT(journal.IsUnchanged("testfiles/TestDir1"));
+		TEST_THAT(journal.IsUnchanged("testfiles/TestDir1/x1"));
+		journal.FinishSync(true);
+
+		{
+			FileStream fs("testfiles/TestDir1/sub23/dhsfdss/new",
+				O_WRONLY | O_CREAT);
+			fs.Write("a", 1);
+		}
+
+		journal.ReadEvents();
+		TEST_THAT(journal.StartSync());
+		TEST_THAT(!journal.IsUnchanged("testfiles/TestDir1/sub23/dhsfdss"));
+		TEST_THAT(!journal.IsUnchanged("testfiles/TestDir1/sub23"));
+		TEST_THAT(!journal.IsUnchanged("testfiles/TestDir1/"));
+		TEST_THAT(journal.IsUnchanged("testfiles/TestDir1/x1"));
+
+		// A sync which fails must be repeated
+		journal.FinishSync(false);
+		TEST_THAT(journal.StartSync());
+		TEST_THAT(!journal.IsUnchanged("testfiles/TestDir1/sub23"));
+		journal.FinishSync(true);
+
+		TEST_THAT(journal.StartSync());
+		TEST_THAT(journal.IsUnchanged("testfiles/TestDir1/sub23"));
+		journal.FinishSync(true);
+
+		// Moving a directory means reading everything again
+		TEST_THAT(EMU_UNLINK("testfiles/TestDir1/sub23/dhsfdss/new") == 0);
+		TEST_THAT(::rename("testfiles/TestDir1/x1",
+			"testfiles/TestDir1/x2") == 0);
+		TEST_THAT(::rename("testfiles/TestDir1/x2",
+			"testfiles/TestDir1/x1") == 0);
+		TEST_THAT(!journal.StartSync());
+		journal.FinishSync(true);
+	}
+#endif
+
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-journal.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("ChangeJournal = yes\n");
+	}
+
+	// Whichever directories are skipped, the backup must always be the
+	// same as if they had been read
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-journal.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// Modify a file, but give it an old time, so that it would only be
+	// uploaded if its directory was read
+	{
+		FileStream fs("testfiles/TestDir1/sub23/rand.h",
+			O_WRONLY | O_APPEND);
+		fs.Write("MODIFIED!\n", 10);
+	}
+	{
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+		TEST_THAT(::utimes("testfiles/TestDir1/sub23/rand.h",
+			times) == 0);
+	}
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// Change files in directories which were skipped last time
+	TEST_THAT(EMU_UNLINK("testfiles/TestDir1/x1/dsfdsfs98.fd") == 0);
+	TEST_THAT(::rename("testfiles/TestDir1/df9834.dsf",
+		"testfiles/TestDir1/anotehr/df9834.dsf") == 0);
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// And a directory which was skipped, after moving it
+	TEST_THAT(::rename("testfiles/TestDir1/sub23/dhsfdss",
+		"testfiles/TestDir1/renamed-dir") == 0);
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
+bool test_backup_with_statx_directory_scan()
+{
+	SETUP_WITH_BBSTORED();
+
+	unpack_files("test2");
+	unpack_files("test3");
+
+	// Every Linux C library new enough to have getdents64() and statx()
+	// should get the statx method, however the tree was configured
+#if defined __linux__ && defined __GLIBC__ && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+	TEST_THAT(BackupClientDirectoryReader::IsMethodSupported(
+		BackupClientDirectoryReader::Statx));
+#endif
+
+	// Both methods must find the same entries, with the same details
+	// as far as the sync is concerned
+	if(BackupClientDirectoryReader::IsMethodSupported(
+		BackupClientDirectoryReader::Statx))
+	{
+		std::map<std::string, EMU_STRUCT_STAT> found;
+		BackupClientDirectoryReader readdir_reader(
+			BackupClientDirectoryReader::ReadDir);
+		TEST_THAT(readdir_reader.Open("testfiles/TestDir1"));
+		while(readdir_reader.Next())
+		{
+			std::string path = std::string("testfiles/TestDir1/") +
+				readdir_reader.GetName();
+			TEST_THAT(readdir_reader.Stat(path,
+				found[readdir_reader.GetName()]));
+		}
+		readdir_reader.Close();
+
+		BackupClientDirectoryReader statx_reader(
+			BackupClientDirectoryReader::Statx);
+		TEST_THAT(statx_reader.StatsAreReusable());
+		TEST_THAT(!statx_reader.Open("testfiles/nonexistent"));
+		TEST_EQUAL(ENOENT, errno);
+		TEST_THAT(statx_reader.Open("testfiles/TestDir1"));
+		size_t num_entries = 0;
+		while(statx_reader.Next())
+		{
+			num_entries++;
+			std::string name(statx_reader.GetName());
+			std::string path = "testfiles/TestDir1/" + name;
+			EMU_STRUCT_STAT st;
+			TEST_THAT(statx_reader.Stat(path, st));
+			TEST_THAT(found.find(name) != found.end());
+			TEST_EQUAL(found[name].st_dev, st.st_dev);
+			TEST_EQUAL(found[name].st_ino, st.st_ino);
+			TEST_EQUAL(found[name].st_mode, st.st_mode);
+			TEST_EQUAL(found[name].st_uid, st.st_uid);
+			TEST_EQUAL(found[name].st_gid, st.st_gid);
+			TEST_EQUAL(found[name].st_size, st.st_size);
+			TEST_EQUAL(found[name].st_nlink, st.st_nlink);
+			TEST_EQUAL(FileModificationTime(found[name]),
+				FileModificationTime(st));
+			TEST_EQUAL(FileAttrModificationTime(found[name]),
+				FileAttrModificationTime(st));
+		}
+		statx_reader.Close();
+		TEST_EQUAL(found.size(), num_entries);
+	}
+	else
+	{
+		BOX_NOTICE("Skipping comparison of directory scan methods: "
+			"statx is not supported on this platform");
+	}
+
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-statx.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("DirectoryScanMethod = statx\n");
+	}
+
+	// The backup must be exactly the same as with readdir, on every
+	// platform, as it falls back to readdir where statx isn't available
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-statx.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// Changes must be noticed from the details it collects
+	{
+		FileStream fs("testfiles/TestDir1/sub23/rand.h",
+			O_WRONLY | O_APPEND);
+		fs.Write("MODIFIED!\n", 10);
+	}
+	{
+		// Give it an old time, so that it's uploaded straight away
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+		TEST_THAT(::utimes("testfiles/TestDir1/sub23/rand.h",
+			times) == 0);
+	}
+	TEST_THAT(::chmod("testfiles/TestDir1/x1/dsfdsfs98.fd", 0600) == 0);
+	TEST_THAT(EMU_UNLINK("testfiles/TestDir1/df9834.dsf") == 0);
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// An unknown method is reported once, when the configuration is
+	// loaded, and not again on every sync
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-statx.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("DirectoryScanMethod = nonexistent\n");
+	}
+	{
+		Capture capture;
+		Logging::TempLoggerGuard guard(&capture);
+		TEST_THAT(configure_bbackupd(bbackupd,
+			"testfiles/bbackupd-statx.conf"));
+		bbackupd.RunSyncNow();
+		bbackupd.RunSyncNow();
+
+		int warnings = 0;
+		std::vector<Capture::Message> messages = capture.GetMessages();
+		for(std::vector<Capture::Message>::iterator
+			i = messages.begin(); i != messages.end(); i++)
+		{
+			if(i->message.find("DirectoryScanMethod") !=
+				std::string::npos)
+			{
+				warnings++;
+			}
+		}
+		TEST_EQUAL(1, warnings);
+	}
+	TEST_COMPARE(Compare_Same);
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
+bool test_inode_map_sorted_file()
+{
+	SETUP_TEST_BBACKUPD();
+
+	// Entries are found whatever order they were added in, and the one
+	// added last for an inode wins
+	{
+		BackupClientInodeToIDMap map;
+		map.Open("testfiles/test_inode_map", false, true);
+		map.AddToMap(300, 3, 10, "three");
+		map.AddToMap(100, 1, 10, "one");
+		map.AddToMap(200, 2, 20, "two");
+		map.AddToMap(100, 4, 20, "one, moved");
+		map.Close();
+	}
+	TEST_THAT(!TestFileExists("testfiles/test_inode_map.paths"));
+
+	{
+		BackupClientInodeToIDMap map;
+		map.Open("testfiles/test_inode_map", true, false);
+		TEST_EQUAL(3, map.GetNumEntries());
+
+		int64_t objectID, inDirectory;
+		std::string path;
+		TEST_THAT(map.Lookup(100, objectID, inDirectory, &path));
+		TEST_EQUAL(4, objectID);
+		TEST_EQUAL(20, inDirectory);
+		TEST_EQUAL("one, moved", path);
+		TEST_THAT(map.Lookup(300, objectID, inDirectory, &path));
+		TEST_EQUAL(3, objectID);
+		TEST_EQUAL("three", path);
+		TEST_THAT(!map.Lookup(150, objectID, inDirectory));
+		TEST_THAT(!map.Lookup(400, objectID, inDirectory));
+
+		BackupClientInodeToIDMap copy;
+		copy.Open("testfiles/test_inode_map.n", false, true);
+		std::set<int64_t> dirs;
+		dirs.insert(20);
+		copy.CopyEntriesInDirectories(map, dirs);
+		copy.Close();
+		copy.Open("testfiles/test_inode_map.n", true, false);
+		TEST_EQUAL(2, copy.GetNumEntries());
+		TEST_THAT(copy.Lookup(200, objectID, inDirectory, &path));
+		TEST_EQUAL("two", path);
+		TEST_THAT(!copy.Lookup(300, objectID, inDirectory));
+	}
+
+	// An empty map is still a valid one
+	{
+		BackupClientInodeToIDMap map;
+		map.Open("testfiles/test_inode_map", false, true);
+		map.Close();
+		map.Open("testfiles/test_inode_map", true, false);
+		TEST_EQUAL(0, map.GetNumEntries());
+		int64_t objectID, inDirectory;
+		TEST_THAT(!map.Lookup(100, objectID, inDirectory));
+	}
+
+	// One which was never finished can't be read
+	{
+		BackupClientInodeToIDMap map;
+		map.Open("testfiles/test_inode_map", false, true);
+		map.AddToMap(100, 1, 10, "one");
+		{
+			FileStream copy("testfiles/test_inode_map.copy",
+				O_WRONLY | O_CREAT | O_TRUNC);
+			FileStream orig("testfiles/test_inode_map");
+			orig.CopyStreamTo(copy);
+		}
+		map.Close();
+
+		BackupClientInodeToIDMap unfinished;
+		TEST_CHECK_THROWS(unfinished.Open(
+			"testfiles/test_inode_map.copy", true, false),
+			BackupStoreException, BerkelyDBFailure);
+	}
+
+	// Maps in the old qdbm format are converted when opened
+	{
+		DEPOT *pDepot = dpopen("testfiles/test_inode_map",
+			DP_OWRITER | DP_OCREAT | DP_OTRUNC, 0);
+		TEST_THAT_OR(pDepot != NULL, FAIL);
+		const char* version_key = "BackupClientInodeToIDMap.Version";
+		int32_t version = 2;
+		TEST_THAT(dpput(pDepot, version_key, strlen(version_key),
+			(char *)(&version), sizeof(version), DP_DKEEP));
+
+		CollectInBufferStream buf;
+		Archive arc(buf, IOStream::TimeOutInfinite);
+		arc.WriteExact((uint64_t)5);
+		arc.WriteExact((uint64_t)50);
+		arc.Write(std::string("five"));
+		buf.SetForReading();
+		InodeRefType inode = 500;
+		TEST_THAT(dpput(pDepot, (const char *)&inode, sizeof(inode),
+			(const char *)buf.GetBuffer(), buf.GetSize(), DP_DOVER));
+		TEST_THAT(dpclose(pDepot));
+
+		BackupClientInodeToIDMap map;
+		map.Open("testfiles/test_inode_map", true, false);
+		TEST_EQUAL(1, map.GetNumEntries());
+		int64_t objectID, inDirectory;
+		std::string path;
+		TEST_THAT(map.Lookup(500, objectID, inDirectory, &path));
+		TEST_EQUAL(5, objectID);
+		TEST_EQUAL(50, inDirectory);
+		TEST_EQUAL("five", path);
+		map.Close();
+
+		// And stay converted
+		map.Open("testfiles/test_inode_map", true, false);
+		TEST_THAT(map.Lookup(500, objectID, inDirectory));
+	}
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
+bool test_store_object_info_file()
+{
+	SETUP_WITH_BBSTORED();
+
+	unpack_files("test2");
+
+	{
+		FileStream in("testfiles/bbackupd.conf");
+		FileStream out("testfiles/bbackupd-state.conf",
+			O_WRONLY | O_CREAT | O_TRUNC);
+		in.CopyStreamTo(out);
+		out.Write("StoreObjectInfoFile = testfiles/bbackupd.state\n");
+	}
+
+	TEST_THAT(configure_bbackupd(bbackupd,
+		"testfiles/bbackupd-state.conf"));
+	bbackupd.RunSyncNow();
+	TEST_COMPARE(Compare_Same);
+
+	// The records are written as they're synced, to a new file which
+	// replaces the old one once it's finished
+	TEST_THAT(TestFileExists("testfiles/bbackupd.state"));
+	TEST_THAT(!TestFileExists("testfiles/bbackupd.state.new"));
+
+	CollectInBufferStream original;
+	{
+		FileStream fs("testfiles/bbackupd.state");
+		fs.CopyStreamTo(original);
+		original.SetForReading();
+
+		MemBlockStream header(original);
+		Archive archive(header, 0);
+		int magic, version;
+		std::string magic_string;
+		archive.Read(magic);
+		archive.Read(magic_string);
+		archive.Read(version);
+		TEST_EQUAL(STOREOBJECTINFO_MAGIC_ID_VALUE, magic);
+		TEST_EQUAL(std::string(STOREOBJECTINFO_MAGIC_ID_STRING),
+			magic_string);
+		TEST_EQUAL(STOREOBJECTINFO_VERSION, version);
+	}
+
+	int64_t root_id = bbackupd.GetLocations().front()->
+		mapDirectoryRecord->GetObjectID();
+
+	// Only the top level records are read when it's loaded, and those
+	// which are never needed are copied to the next file as they are,
+	// so saving again without a sync writes exactly the same file
+	{
+		BackupDaemon bbackupd2;
+		TEST_THAT(configure_bbackupd(bbackupd2,
+			"testfiles/bbackupd-state.conf"));
+		box_time_t last_sync = 0, next_sync = 0;
+		TEST_THAT(bbackupd2.DeserializeStoreObjectInfo(last_sync,
+			next_sync));
+		TEST_THAT(last_sync != 0);
+		TEST_EQUAL(1, bbackupd2.GetLocations().size());
+		TEST_EQUAL(root_id, bbackupd2.GetLocations().front()->
+			mapDirectoryRecord->GetObjectID());
+		TEST_THAT(bbackupd2.SerializeStoreObjectInfo(last_sync,
+			next_sync));
+	}
+
+	{
+		CollectInBufferStream copy;
+		FileStream fs("testfiles/bbackupd.state");
+		fs.CopyStreamTo(copy);
+		copy.SetForReading();
+		TEST_EQUAL(original.GetSize(), copy.GetSize());
+		TEST_THAT(original.GetSize() == copy.GetSize() &&
+			::memcmp(original.GetBuffer(), copy.GetBuffer(),
+				copy.GetSize()) == 0);
+	}
+
+	// A daemon which loaded it can carry on from where the last one
+	// stopped
+	{
+		FileStream fs("testfiles/TestDir1/sub23/rand.h",
+			O_WRONLY | O_APPEND);
+		fs.Write("MODIFIED!\n", 10);
+	}
+	{
+		// Give it an old time, so that it's uploaded straight away
+		struct timeval times[2];
+		BoxTimeToTimeval(SecondsToBoxTime(
+			(time_t)(365*24*60*60)), times[1]);
+		times[0] = times[1];
+		TEST_THAT(::utimes("testfiles/TestDir1/sub23/rand.h",
+			times) == 0);
+	}
+
+	{
+		BackupDaemon bbackupd3;
+		TEST_THAT(configure_bbackupd(bbackupd3,
+			"testfiles/bbackupd-state.conf"));
+		box_time_t last_sync = 0, next_sync = 0;
+		TEST_THAT(bbackupd3.DeserializeStoreObjectInfo(last_sync,
+			next_sync));
+		bbackupd3.RunSyncNow();
+		TEST_COMPARE(Compare_Same);
+		TEST_THAT(TestFileExists("testfiles/bbackupd.state"));
+	}
+
+	// An incomplete file isn't used
+	{
+		CollectInBufferStream copy;
+		{
+			FileStream fs("testfiles/bbackupd.state");
+			fs.CopyStreamTo(copy);
+			copy.SetForReading();
+		}
+		FileStream fs("testfiles/bbackupd.state",
+			O_WRONLY | O_TRUNC);
+		fs.Write(copy.GetBuffer(), copy.GetSize() - 1);
+	}
+
+	{
+		BackupDaemon bbackupd4;
+		TEST_THAT(configure_bbackupd(bbackupd4,
+			"testfiles/bbackupd-state.conf"));
+		box_time_t last_sync = 0, next_sync = 0;
+		TEST_THAT(!bbackupd4.DeserializeStoreObjectInfo(last_sync,
+			next_sync));
+		TEST_EQUAL(0, bbackupd4.GetLocations().size());
+		TEST_EQUAL(0, last_sync);
+	}
+
+	TEARDOWN_TEST_BBACKUPD();
+}
+
 bool test_parse_incomplete_command()
 {
 	SETUP_TEST_BBACKUPD();
@@ -4300,6 +5145,12 @@ int test(int argc, const char *argv[])
 	TEST_THAT(test_restore_deleted_files());
 	TEST_THAT(test_locked_file_behaviour());
 	TEST_THAT(test_backup_many_files());
+	TEST_THAT(test_backup_with_scan_ahead_processes());
+	TEST_THAT(test_backup_with_upload_processes());
+	TEST_THAT(test_change_journal_skips_unchanged_directories());
+	TEST_THAT(test_backup_with_statx_directory_scan());
+	TEST_THAT(test_inode_map_sorted_file());
+	TEST_THAT(test_store_object_info_file());
 	TEST_THAT(test_parse_incomplete_command());
 	TEST_THAT(test_parse_syncallowscript_output());
 	TEST_THAT(test_bbackupd_config_script());
@@ -876,6 +876,64 @@ int test(int argc, const char *argv[])
 		TEST_THAT(logger.IsTriggered());
 	}
 
+#if defined HAVE_REGEX_SUPPORT && !defined WIN32
+	// Test that regular expressions give the same answers when they're
+	// tested together, including ones which can't be combined
+	{
+		ExcludeList elist;
+		elist.AddRegexEntries(std::string(
+			"\\.tmp$" "\x01"
+			"/cache/" "\x01"
+			"^/home/[^/]+/Trash" "\x01"
+			"(ab)\\1" "\x01"
+			"x)y" "\x01"
+			"[])]z"));
+		TEST_THAT(elist.SizeOfRegexList() == 6);
+
+		// Tested twice, to check that the answers don't change
+		// once the directories have been seen before
+		for(int pass = 0; pass < 2; pass++)
+		{
+			TEST_THAT(elist.IsExcluded("/dir/file.tmp"));
+			TEST_THAT(!elist.IsExcluded("/dir/file.tmp/other"));
+			TEST_THAT(!elist.IsExcluded("/dir/file.tmpx"));
+			TEST_THAT(elist.IsExcluded("/a/cache/file"));
+			TEST_THAT(elist.IsExcluded("/a/cache/sub/file"));
+			TEST_THAT(!elist.IsExcluded("/a/cache"));
+			TEST_THAT(!elist.IsExcluded("/a/cached/file"));
+			TEST_THAT(elist.IsExcluded("/home/user/Trash"));
+			TEST_THAT(elist.IsExcluded("/home/user/Trash/file"));
+			TEST_THAT(!elist.IsExcluded("/x/home/user/Trash/file"));
+			TEST_THAT(elist.IsExcluded("/dir/abab"));
+			TEST_THAT(!elist.IsExcluded("/dir/ab"));
+			TEST_THAT(elist.IsExcluded("/dir/x)y"));
+			TEST_THAT(!elist.IsExcluded("/dir/xy"));
+			TEST_THAT(elist.IsExcluded("/dir/)z"));
+			TEST_THAT(elist.IsExcluded("/dir/]z"));
+			TEST_THAT(!elist.IsExcluded("/dir/z"));
+		}
+
+		// And after being copied through an Archive
+		CollectInBufferStream buffer;
+		{
+			Archive archive(buffer, 0);
+			elist.Serialize(archive);
+		}
+		buffer.SetForReading();
+
+		ExcludeList copy;
+		{
+			Archive archive(buffer, 0);
+			copy.Deserialize(archive);
+		}
+		TEST_THAT(copy.SizeOfRegexList() == 6);
+		TEST_THAT(copy.IsExcluded("/a/cache/file"));
+		TEST_THAT(!copy.IsExcluded("/a/cached/file"));
+		TEST_THAT(copy.IsExcluded("/dir/abab"));
+		TEST_THAT(copy.IsExcluded("/dir/x)y"));
+	}
+#endif
+
 	test_conversions();
 
 	// test that we can use Archive and CollectInBufferStream
@@ -20,10 +20,14 @@
 #include <string.h>
 
 #include "Test.h"
+#include "FileStream.h"
 #include "RaidFileController.h"
+#include "RaidFileErasureCode.h"
 #include "RaidFileWrite.h"
 #include "RaidFileException.h"
 #include "RaidFileRead.h"
+#include "RaidFileBlockChecksums.h"
+#include "RaidFileScrubber.h"
 #include "Guards.h"
 #include "intercept.h"
 
@@ -31,6 +35,13 @@
 
 #define RAID_BLOCK_SIZE	2048
 #define RAID_NUMBER_DISCS 3
+#define EC_SET_NUMBER 3
+#define EC_DATA_DISCS 4
+#define EC_PARITY_DISCS 2
+#define EC_NUMBER_DISCS (EC_DATA_DISCS + EC_PARITY_DISCS)
+#define CHECKSUM_SET_NUMBER 4
+#define EC_CHECKSUM_SET_NUMBER 5
+#define EC_CHECKSUM_NUMBER_DISCS 5
 
 #define TEST_DATA_SIZE	(8*1024 + 173)
 
@@ -575,6 +586,424 @@ void test_overwrites()
 }
 
 
+void test_galois_field_kernel()
+{
+	// Check the (possibly SIMD) multiply-add against single multiplies,
+	// with lengths that leave a remainder after the 16 byte chunks
+	uint8_t src[103], dest[103], expected[103];
+	for(unsigned int l = 0; l < sizeof(src); ++l)
+	{
+		src[l] = (uint8_t)((l * 37) + 11);
+	}
+	static int coefficients[] = {0, 1, 2, 0x53, 0x8e, 0xff};
+	for(unsigned int c = 0; c < (sizeof(coefficients)/sizeof(coefficients[0])); ++c)
+	{
+		for(unsigned int l = 0; l < sizeof(src); ++l)
+		{
+			dest[l] = (uint8_t)l;
+			expected[l] = (uint8_t)l ^
+				RaidFileErasureCode::Multiply(coefficients[c], src[l]);
+		}
+		RaidFileErasureCode::MultiplyAdd(dest, src, coefficients[c], sizeof(src));
+		TEST_THAT(::memcmp(dest, expected, sizeof(dest)) == 0);
+	}
+
+	// a * (1/a) == 1 for every non-zero element
+	bool allInverses = true;
+	for(int a = 1; a < 256; ++a)
+	{
+		if(RaidFileErasureCode::Multiply(a,
+			RaidFileErasureCode::Inverse(a)) != 1)
+		{
+			allInverses = false;
+		}
+	}
+	TEST_THAT(allInverses);
+}
+
+std::string ec_component_name(const char *filename, int component)
+{
+	int h = 0;
+	for(int n = 0; filename[n] != 0; ++n)
+	{
+		h += filename[n];
+	}
+	char fn[256];
+	sprintf(fn, "testfiles" DIRECTORY_SEPARATOR "%d_%d" DIRECTORY_SEPARATOR
+		"%s.rf", EC_SET_NUMBER, (h + component) % EC_NUMBER_DISCS,
+		filename);
+	return fn;
+}
+
+void test_erasure_coded_file(const char *filename, void *data, int datasize)
+{
+	RaidFileWrite write(EC_SET_NUMBER, filename);
+	write.Open();
+	write.Write(data, datasize);
+	int usageInBlocks = write.GetDiscUsageInBlocks();
+	write.Commit(true);
+
+	// Data stripes hold every kth block, parity files one block per row
+	// plus the file size
+	int blocks = (datasize + RAID_BLOCK_SIZE - 1) / RAID_BLOCK_SIZE;
+	int rows = (blocks + EC_DATA_DISCS - 1) / EC_DATA_DISCS;
+	int totalStripeSize = 0;
+	for(int c = 0; c < EC_NUMBER_DISCS; ++c)
+	{
+		std::string fn(ec_component_name(filename, c));
+		TEST_THAT(TestFileExists(fn.c_str()));
+		if(c < EC_DATA_DISCS)
+		{
+			totalStripeSize += TestGetFileSize(fn);
+		}
+		else
+		{
+			TEST_EQUAL((int)((rows * RAID_BLOCK_SIZE) +
+				sizeof(RaidFileRead::FileSizeType)),
+				TestGetFileSize(fn));
+		}
+	}
+	TEST_EQUAL(datasize, totalStripeSize);
+	TEST_EQUAL(blocks + (EC_PARITY_DISCS * (rows + 1)), usageInBlocks);
+
+	testReadingFileContents(EC_SET_NUMBER, filename, data, datasize,
+		false /* not the 2+1 layout */, usageInBlocks);
+
+	// Any two components may be lost
+	HideCategoryGuard hide(RaidFileRead::OPEN_IN_RECOVERY);
+	for(int a = 0; a < EC_NUMBER_DISCS; ++a)
+	{
+		for(int b = a + 1; b < EC_NUMBER_DISCS; ++b)
+		{
+			std::string fa(ec_component_name(filename, a));
+			std::string fb(ec_component_name(filename, b));
+			TEST_THAT(::rename(fa.c_str(), (fa + "-REMOVED").c_str()) == 0);
+			TEST_THAT(::rename(fb.c_str(), (fb + "-REMOVED").c_str()) == 0);
+			testReadingFileContents(EC_SET_NUMBER, filename, data,
+				datasize, false, usageInBlocks);
+			TEST_THAT(::rename((fa + "-REMOVED").c_str(), fa.c_str()) == 0);
+			TEST_THAT(::rename((fb + "-REMOVED").c_str(), fb.c_str()) == 0);
+		}
+	}
+
+	// But not three
+	std::string f0(ec_component_name(filename, 0));
+	std::string f2(ec_component_name(filename, 2));
+	std::string f4(ec_component_name(filename, 4));
+	TEST_THAT(EMU_UNLINK(f0.c_str()) == 0);
+	TEST_THAT(EMU_UNLINK(f4.c_str()) == 0);
+	{
+		// Still readable with just one parity file
+		std::auto_ptr<RaidFileRead> pread(RaidFileRead::Open(EC_SET_NUMBER, filename));
+		TEST_EQUAL(datasize, pread->GetFileSize());
+	}
+	TEST_THAT(EMU_UNLINK(f2.c_str()) == 0);
+	TEST_CHECK_THROWS(RaidFileRead::Open(EC_SET_NUMBER, filename),
+		RaidFileException, FileIsDamagedNotRecoverable);
+
+	// Deleting removes whatever is left
+	RaidFileWrite del(EC_SET_NUMBER, filename);
+	del.Delete();
+	for(int c = 0; c < EC_NUMBER_DISCS; ++c)
+	{
+		TEST_THAT(!TestFileExists(ec_component_name(filename, c).c_str()));
+	}
+}
+
+void test_erasure_coded_set(void *data, int maxsize)
+{
+	RaidFileDiscSet &rset(RaidFileController::GetController().GetDiscSet(EC_SET_NUMBER));
+	TEST_THAT(rset.IsErasureCodedSet());
+	TEST_EQUAL(EC_NUMBER_DISCS, rset.size());
+	TEST_EQUAL(EC_DATA_DISCS, rset.GetNumDataDiscs());
+	TEST_EQUAL(EC_PARITY_DISCS, rset.GetNumParityDiscs());
+
+	static int sizes[] = {0, 1, 9, RAID_BLOCK_SIZE - 1, RAID_BLOCK_SIZE,
+		RAID_BLOCK_SIZE + 1, (RAID_BLOCK_SIZE * EC_DATA_DISCS) - 8,
+		RAID_BLOCK_SIZE * EC_DATA_DISCS,
+		(RAID_BLOCK_SIZE * EC_DATA_DISCS) + 5, (RAID_BLOCK_SIZE * 9) + 173};
+	for(unsigned int s = 0; s < (sizeof(sizes)/sizeof(sizes[0])); ++s)
+	{
+		if(sizes[s] > maxsize) continue;
+		char fn[64];
+		sprintf(fn, "testEC%d", sizes[s]);
+		test_erasure_coded_file(fn, data, sizes[s]);
+	}
+
+	// Directory listings are readable while k components remain
+	RaidFileWrite::CreateDirectory(EC_SET_NUMBER, "ecdir");
+	{
+		RaidFileWrite w(EC_SET_NUMBER, "ecdir" DIRECTORY_SEPARATOR "ecfile");
+		w.Open();
+		w.Write(data, maxsize);
+		w.Commit(true);
+	}
+	std::vector<std::string> names;
+	TEST_THAT(RaidFileRead::ReadDirectoryContents(EC_SET_NUMBER, "ecdir",
+		RaidFileRead::DirReadType_FilesOnly, names));
+	TEST_EQUAL(1, names.size());
+	for(int c = 0; c < EC_PARITY_DISCS; ++c)
+	{
+		std::string fn(ec_component_name("ecdir" DIRECTORY_SEPARATOR "ecfile", c));
+		TEST_THAT(EMU_UNLINK(fn.c_str()) == 0);
+	}
+	TEST_THAT(RaidFileRead::ReadDirectoryContents(EC_SET_NUMBER, "ecdir",
+		RaidFileRead::DirReadType_FilesOnly, names));
+	std::string fn(ec_component_name("ecdir" DIRECTORY_SEPARATOR "ecfile",
+		EC_PARITY_DISCS));
+	TEST_THAT(EMU_UNLINK(fn.c_str()) == 0);
+	TEST_THAT(!RaidFileRead::ReadDirectoryContents(EC_SET_NUMBER, "ecdir",
+		RaidFileRead::DirReadType_FilesOnly, names));
+}
+
+class StopAfterFiles : public RaidFileScrubberCallback
+{
+public:
+	StopAfterFiles(int Files) : mFilesLeft(Files) { }
+	virtual bool StopScrub()
+	{
+		return (mFilesLeft-- <= 0);
+	}
+	int mFilesLeft;
+};
+
+std::string component_name(int set, const char *filename, int component)
+{
+	return RaidFileController::DiscSetPathToFileSystemPath(set, filename,
+		component) + ".rf";
+}
+
+void corrupt_byte(const std::string &rFilename, int Offset)
+{
+	// In place, so the size and inode don't change and the checksums
+	// are still believed
+	int handle = ::open(rFilename.c_str(), O_RDWR | O_BINARY);
+	TEST_THAT(handle != -1);
+	if(handle == -1) return;
+	char c = 0;
+	TEST_THAT(::lseek(handle, Offset, SEEK_SET) == Offset);
+	TEST_THAT(::read(handle, &c, 1) == 1);
+	c ^= 0x20;
+	TEST_THAT(::lseek(handle, Offset, SEEK_SET) == Offset);
+	TEST_THAT(::write(handle, &c, 1) == 1);
+	::close(handle);
+}
+
+bool read_matches(int set, const char *filename, void *data, int datasize,
+	bool &rRecoveredOut)
+{
+	std::auto_ptr<RaidFileRead> pread(RaidFileRead::Open(set, filename));
+	MemoryBlockGuard<char*> buffer(datasize + 1);
+	int bytes = 0;
+	while(true)
+	{
+		// Odd sized reads, which don't line up with blocks
+		int toread = (datasize + 1) - bytes;
+		if(toread > 1001) toread = 1001;
+		if(toread <= 0) break;
+		int r = pread->Read(((char*)buffer) + bytes, toread);
+		if(r <= 0) break;
+		bytes += r;
+	}
+	rRecoveredOut = pread->WasRecovered();
+	return bytes == datasize && ::memcmp(buffer, data, datasize) == 0;
+}
+
+void write_file(int set, const char *filename, void *data, int datasize)
+{
+	RaidFileWrite write(set, filename);
+	write.Open(true);
+	write.Write(data, datasize);
+	write.Commit(true);
+}
+
+void test_block_checksums(void *data, int datasize)
+{
+	// CRC32C check value, then the (possibly SSE4.2) calculation against
+	// a bitwise one, for lengths and alignments which aren't whole words
+	TEST_EQUAL(0xe3069283, RaidFileBlockChecksums::Calculate("123456789", 9));
+	const uint8_t *p = (const uint8_t *)data;
+	bool allMatch = true;
+	for(int o = 0; o < 4; ++o)
+	{
+		for(int l = 0; l < 100; ++l)
+		{
+			uint32_t expected = 0xffffffff;
+			for(int n = 0; n < l; ++n)
+			{
+				expected ^= p[o + n];
+				for(int b = 0; b < 8; ++b)
+				{
+					expected = (expected >> 1) ^
+						(0x82f63b78 & (0 - (expected & 1)));
+				}
+			}
+			expected = ~expected;
+			if(RaidFileBlockChecksums::Calculate(p + o, l) != expected)
+			{
+				allMatch = false;
+			}
+		}
+	}
+	TEST_THAT(allMatch);
+	TEST_EQUAL(RaidFileBlockChecksums::Calculate(p, 100),
+		RaidFileBlockChecksums::Calculate(p + 37, 63,
+			RaidFileBlockChecksums::Calculate(p, 37)));
+
+	RaidFileDiscSet &rset(RaidFileController::GetController().GetDiscSet(CHECKSUM_SET_NUMBER));
+	TEST_THAT(rset.HasBlockChecksums());
+	TEST_THAT(!RaidFileController::GetController().GetDiscSet(0).HasBlockChecksums());
+
+	// Every component gets checksums, which the directory listing ignores
+	write_file(CHECKSUM_SET_NUMBER, "cs1", data, datasize);
+	for(int c = 0; c < RAID_NUMBER_DISCS; ++c)
+	{
+		TEST_THAT(TestFileExists(RaidFileBlockChecksums::GetFilename(
+			component_name(CHECKSUM_SET_NUMBER, "cs1", c)).c_str()));
+	}
+	std::vector<std::string> names;
+	TEST_THAT(RaidFileRead::ReadDirectoryContents(CHECKSUM_SET_NUMBER, "",
+		RaidFileRead::DirReadType_FilesOnly, names));
+	TEST_EQUAL(1, names.size());
+	bool recovered = true;
+	TEST_THAT(read_matches(CHECKSUM_SET_NUMBER, "cs1", data, datasize, recovered));
+	TEST_THAT(!recovered);
+
+	// A flipped bit in a stripe is rebuilt from the parity
+	{
+		HideCategoryGuard hide(RaidFileRead::CHECKSUM_ERROR);
+		corrupt_byte(component_name(CHECKSUM_SET_NUMBER, "cs1", 1),
+			RAID_BLOCK_SIZE + 7);
+		TEST_THAT(read_matches(CHECKSUM_SET_NUMBER, "cs1", data,
+			datasize, recovered));
+		TEST_THAT(recovered);
+	}
+	write_file(CHECKSUM_SET_NUMBER, "cs1", data, datasize);
+
+	// A flipped bit in the parity isn't seen by reading, but the
+	// scrubber finds it, and the file can be repaired
+	write_file(CHECKSUM_SET_NUMBER, "cs2", data, datasize / 3);
+	corrupt_byte(component_name(CHECKSUM_SET_NUMBER, "cs2", 2), 3);
+	TEST_THAT(read_matches(CHECKSUM_SET_NUMBER, "cs2", data, datasize / 3,
+		recovered));
+	TEST_THAT(!recovered);
+	{
+		HideCategoryGuard hide(RaidFileRead::CHECKSUM_ERROR);
+		RaidFileScrubber scrubber(CHECKSUM_SET_NUMBER);
+		TEST_THAT(scrubber.ScrubDirectory(""));
+		TEST_EQUAL(2, scrubber.GetNumFilesScrubbed());
+		TEST_EQUAL(1, scrubber.GetNumDamagedFiles());
+		TEST_EQUAL(0, scrubber.GetNumUnreadableFiles());
+		TEST_THAT(scrubber.GetNumBlocksScrubbed() > 0);
+		TEST_EQUAL(1, scrubber.GetDamagedFiles().size());
+		if(scrubber.GetDamagedFiles().size() == 1)
+		{
+			TEST_EQUAL("cs2", scrubber.GetDamagedFiles()[0]);
+			scrubber.RepairFile(scrubber.GetDamagedFiles()[0]);
+		}
+	}
+	{
+		RaidFileScrubber scrubber(CHECKSUM_SET_NUMBER);
+		TEST_THAT(scrubber.ScrubDirectory(""));
+		TEST_EQUAL(0, scrubber.GetNumDamagedFiles());
+	}
+	TEST_THAT(read_matches(CHECKSUM_SET_NUMBER, "cs2", data, datasize / 3,
+		recovered));
+
+	// A missing stripe is also damage
+	TEST_THAT(EMU_UNLINK(component_name(CHECKSUM_SET_NUMBER, "cs2", 0).c_str()) == 0);
+	{
+		HideCategoryGuard hide(RaidFileRead::OPEN_IN_RECOVERY);
+		RaidFileScrubber scrubber(CHECKSUM_SET_NUMBER);
+		TEST_THAT(!scrubber.ScrubFile("cs2"));
+		scrubber.RepairFile("cs2");
+		TEST_THAT(scrubber.ScrubFile("cs2"));
+	}
+
+	// Checksums left over from a different version of a component are
+	// ignored, not reported as damage
+	{
+		std::string c0(component_name(CHECKSUM_SET_NUMBER, "cs1", 0));
+		std::string moved(c0 + "X");
+		TEST_THAT(::rename(c0.c_str(), moved.c_str()) == 0);
+		TEST_THAT(TestFileExists(RaidFileBlockChecksums::GetFilename(c0).c_str()));
+		FileStream in(moved);
+		FileStream out(c0, O_WRONLY | O_CREAT | O_EXCL | O_BINARY);
+		in.CopyStreamTo(out);
+		out.Close();
+		TEST_THAT(EMU_UNLINK(moved.c_str()) == 0);
+		corrupt_byte(c0, 5);
+		RaidFileScrubber scrubber(CHECKSUM_SET_NUMBER);
+		TEST_THAT(scrubber.ScrubFile("cs1"));
+		TEST_THAT(!read_matches(CHECKSUM_SET_NUMBER, "cs1", data,
+			datasize, recovered));
+		write_file(CHECKSUM_SET_NUMBER, "cs1", data, datasize);
+	}
+
+	// The scrubber can be stopped, and carries on where it left off
+	RaidFileWrite::CreateDirectory(CHECKSUM_SET_NUMBER, "d1");
+	RaidFileWrite::CreateDirectory(CHECKSUM_SET_NUMBER, "d1" DIRECTORY_SEPARATOR "d2");
+	write_file(CHECKSUM_SET_NUMBER, "d1" DIRECTORY_SEPARATOR "a", data, 100);
+	write_file(CHECKSUM_SET_NUMBER, "d1" DIRECTORY_SEPARATOR "d2" DIRECTORY_SEPARATOR "b", data, 200);
+	write_file(CHECKSUM_SET_NUMBER, "d1" DIRECTORY_SEPARATOR "z", data, 300);
+	{
+		StopAfterFiles stop(4);
+		RaidFileScrubber scrubber(CHECKSUM_SET_NUMBER);
+		scrubber.SetCallback(&stop);
+		TEST_THAT(!scrubber.ScrubDirectory(""));
+		TEST_EQUAL(4, scrubber.GetNumFilesScrubbed());
+		TEST_EQUAL("d1" DIRECTORY_SEPARATOR "d2" DIRECTORY_SEPARATOR "b",
+			scrubber.GetLastFileScrubbed());
+
+		std::string resumeAfter(scrubber.GetLastFileScrubbed());
+		RaidFileScrubber scrubber2(CHECKSUM_SET_NUMBER);
+		TEST_THAT(scrubber2.ScrubDirectory("", resumeAfter));
+		TEST_EQUAL(1, scrubber2.GetNumFilesScrubbed());
+		TEST_EQUAL("d1" DIRECTORY_SEPARATOR "z",
+			scrubber2.GetLastFileScrubbed());
+	}
+
+	// Deleting removes the checksums too
+	{
+		RaidFileWrite del(CHECKSUM_SET_NUMBER, "cs1");
+		del.Delete();
+		for(int c = 0; c < RAID_NUMBER_DISCS; ++c)
+		{
+			std::string fn(component_name(CHECKSUM_SET_NUMBER, "cs1", c));
+			TEST_THAT(!TestFileExists(fn.c_str()));
+			TEST_THAT(!TestFileExists(RaidFileBlockChecksums::GetFilename(fn).c_str()));
+		}
+	}
+
+	// Reed-Solomon coded sets
+	write_file(EC_CHECKSUM_SET_NUMBER, "ecs", data, datasize);
+	for(int c = 0; c < EC_CHECKSUM_NUMBER_DISCS; ++c)
+	{
+		TEST_THAT(TestFileExists(RaidFileBlockChecksums::GetFilename(
+			component_name(EC_CHECKSUM_SET_NUMBER, "ecs", c)).c_str()));
+	}
+	TEST_THAT(read_matches(EC_CHECKSUM_SET_NUMBER, "ecs", data, datasize,
+		recovered));
+	TEST_THAT(!recovered);
+	{
+		HideCategoryGuard hide(RaidFileRead::CHECKSUM_ERROR);
+		corrupt_byte(component_name(EC_CHECKSUM_SET_NUMBER, "ecs", 1), 11);
+		corrupt_byte(component_name(EC_CHECKSUM_SET_NUMBER, "ecs", 2),
+			RAID_BLOCK_SIZE + 100);
+		TEST_THAT(read_matches(EC_CHECKSUM_SET_NUMBER, "ecs", data,
+			datasize, recovered));
+		TEST_THAT(recovered);
+
+		RaidFileScrubber scrubber(EC_CHECKSUM_SET_NUMBER);
+		TEST_THAT(!scrubber.ScrubFile("ecs"));
+		scrubber.RepairFile("ecs");
+		TEST_THAT(scrubber.ScrubFile("ecs"));
+	}
+	TEST_THAT(read_matches(EC_CHECKSUM_SET_NUMBER, "ecs", data, datasize,
+		recovered));
+	TEST_THAT(!recovered);
+}
+
 int test(int argc, const char *argv[])
 {
 	#ifndef TRF_CAN_INTERCEPT
@@ -798,6 +1227,32 @@ int test(int argc, const char *argv[])
 	testReadingFileContents(0, "test1", data+7, sizeof(data) - 7, false 
 		/*TestRAIDProperties*/);
 
+	{
+		// A committed file can be moved into place under another
+		// name, but not over an existing file, and only on the same
+		// disc ("move1" and "move4" are, "move2" isn't).
+		RaidFileWrite w(0, "move1");
+		w.Open();
+		w.Write(data, sizeof(data));
+		w.Commit();
+
+		RaidFileWrite existing(0, "test1");
+		TEST_CHECK_THROWS(existing.MoveFrom("move1"), RaidFileException,
+			CannotOverwriteExistingFile);
+
+		RaidFileWrite otherDisc(0, "move2");
+		TEST_THAT(!otherDisc.MoveFrom("move1"));
+		TEST_THAT(!RaidFileRead::FileExists(0, "move2"));
+		TEST_THAT(RaidFileRead::FileExists(0, "move1"));
+
+		RaidFileWrite sameDisc(0, "move4");
+		TEST_THAT(sameDisc.MoveFrom("move1", true /* make RAID */));
+		TEST_THAT(!RaidFileRead::FileExists(0, "move1"));
+		testReadingFileContents(0, "move4", data, sizeof(data), false
+			/*TestRAIDProperties*/);
+		sameDisc.Delete();
+	}
+
 	// Test opening a file which doesn't exist
 	TEST_CHECK_THROWS(
 		std::auto_ptr<RaidFileRead> preadnotexist = RaidFileRead::Open(1, "doesnt-exist"),
@@ -924,6 +1379,13 @@ int test(int argc, const char *argv[])
 		((char*)(void*)bigblock)[l] = randomX2.next() & 0xff;
 	}
 	
+	// Reed-Solomon coded disc sets
+	test_galois_field_kernel();
+	test_erasure_coded_set(bigblock, BIG_BLOCK_SIZE);
+
+	// Block checksums and scrubbing
+	test_block_checksums(bigblock, BIG_BLOCK_SIZE);
+
 	// First on one size of data, on different discs
 	testReadWriteFile(0, "testdd", data, sizeof(data));
 	testReadWriteFile(0, "test2", bigblock, BIG_BLOCK_SIZE);